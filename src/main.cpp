@@ -22,6 +22,11 @@ static bool isMW;
 
 
 extern "C" BOOL _stdcall DllMain(HANDLE hModule, DWORD reason, void* unused) {
+    if (reason == DLL_PROCESS_DETACH) {
+        // Write out any queued log lines
+        LOG::close();
+        return true;
+    }
     if (reason != DLL_PROCESS_ATTACH) {
         return true;
     }
@@ -1,15 +1,18 @@
 
 #include "api.h"
 
+#include "callrecorder.h"
 #include "configuration.h"
 #include "distantland.h"
+#include "framesequence.h"
 #include "mmefunctiondefs.h"
 #include "mgeversion.h"
 #include "postshaders.h"
+#include "profiler.h"
+#include "screenshotqueue.h"
 #include "userhud.h"
 #include "mwbridge.h"
 #include "support/log.h"
-#include "support/pngsave.h"
 
 #include <array>
 
@@ -494,7 +497,7 @@ namespace api {
 
     bool MGEAPIv1::shaderGetBool(ShaderHandle handle, const char* variableName, bool* out_value) {
         auto shader = static_cast<MGEShader*>(handle);
-        auto param_handle = shader->effect->GetParameterByName(0, variableName);
+        auto param_handle = shader->vars.access(variableName);
 
         if (param_handle) {
             // Pointers to BOOL and bool aren't compatible.
@@ -509,7 +512,7 @@ namespace api {
 
     bool MGEAPIv1::shaderGetFloat(ShaderHandle handle, const char* variableName, float* out_value) {
         auto shader = static_cast<MGEShader*>(handle);
-        auto param_handle = shader->effect->GetParameterByName(0, variableName);
+        auto param_handle = shader->vars.access(variableName);
 
         if (param_handle) {
             return shader->effect->GetFloat(param_handle, out_value) == D3D_OK;
@@ -519,7 +522,7 @@ namespace api {
 
     bool MGEAPIv1::shaderGetInt(ShaderHandle handle, const char* variableName, int* out_value) {
         auto shader = static_cast<MGEShader*>(handle);
-        auto param_handle = shader->effect->GetParameterByName(0, variableName);
+        auto param_handle = shader->vars.access(variableName);
 
         if (param_handle) {
             return shader->effect->GetInt(param_handle, out_value) == D3D_OK;
@@ -529,7 +532,7 @@ namespace api {
 
     bool MGEAPIv1::shaderGetString(ShaderHandle handle, const char* variableName, const char** out_value) {
         auto shader = static_cast<MGEShader*>(handle);
-        auto param_handle = shader->effect->GetParameterByName(0, variableName);
+        auto param_handle = shader->vars.access(variableName);
 
         if (param_handle) {
             return shader->effect->GetString(param_handle, out_value) == D3D_OK;
@@ -539,7 +542,7 @@ namespace api {
 
     bool MGEAPIv1::shaderGetFloatArray(ShaderHandle handle, const char* variableName, float* out_values, size_t* count) {
         auto shader = static_cast<MGEShader*>(handle);
-        auto param_handle = shader->effect->GetParameterByName(0, variableName);
+        auto param_handle = shader->vars.access(variableName);
 
         if (param_handle) {
             D3DXPARAMETER_DESC desc;
@@ -556,7 +559,7 @@ namespace api {
 
     bool MGEAPIv1::shaderGetVector(ShaderHandle handle, const char* variableName, float* out_values, size_t count) {
         auto shader = static_cast<MGEShader*>(handle);
-        auto param_handle = shader->effect->GetParameterByName(0, variableName);
+        auto param_handle = shader->vars.access(variableName);
 
         if (param_handle) {
             return shader->effect->GetFloatArray(param_handle, out_values, count) == D3D_OK;
@@ -566,7 +569,7 @@ namespace api {
 
     bool MGEAPIv1::shaderGetMatrix(ShaderHandle handle, const char* variableName, float* out_values) {
         auto shader = static_cast<MGEShader*>(handle);
-        auto param_handle = shader->effect->GetParameterByName(0, variableName);
+        auto param_handle = shader->vars.access(variableName);
 
         if (param_handle) {
             return shader->effect->GetMatrix(param_handle, reinterpret_cast<D3DXMATRIX*>(out_values)) == D3D_OK;
@@ -576,7 +579,7 @@ namespace api {
 
     bool MGEAPIv3::shaderGetBoolArray(ShaderHandle handle, const char* variableName, int* out_values, size_t* count) {
         auto shader = static_cast<MGEShader*>(handle);
-        auto param_handle = shader->effect->GetParameterByName(0, variableName);
+        auto param_handle = shader->vars.access(variableName);
 
         if (param_handle) {
             D3DXPARAMETER_DESC desc;
@@ -593,7 +596,7 @@ namespace api {
 
     bool MGEAPIv3::shaderGetIntArray(ShaderHandle handle, const char* variableName, int* out_values, size_t* count) {
         auto shader = static_cast<MGEShader*>(handle);
-        auto param_handle = shader->effect->GetParameterByName(0, variableName);
+        auto param_handle = shader->vars.access(variableName);
 
         if (param_handle) {
             D3DXPARAMETER_DESC desc;
@@ -610,7 +613,7 @@ namespace api {
 
     bool MGEAPIv3::shaderGetVectorArray(ShaderHandle handle, const char* variableName, float* out_values, size_t* count) {
         auto shader = static_cast<MGEShader*>(handle);
-        auto param_handle = shader->effect->GetParameterByName(0, variableName);
+        auto param_handle = shader->vars.access(variableName);
 
         if (param_handle) {
             D3DXPARAMETER_DESC desc;
@@ -627,37 +630,22 @@ namespace api {
 
     bool MGEAPIv1::shaderSetBool(ShaderHandle handle, const char* variableName, bool value) {
         auto shader = static_cast<MGEShader*>(handle);
-        auto param_handle = shader->effect->GetParameterByName(0, variableName);
-
-        if (param_handle) {
-            return shader->effect->SetBool(param_handle, value) == D3D_OK;
-        }
-        return false;
+        return shader->vars.setBool(variableName, value);
     }
 
     bool MGEAPIv1::shaderSetFloat(ShaderHandle handle, const char* variableName, float value) {
         auto shader = static_cast<MGEShader*>(handle);
-        auto param_handle = shader->effect->GetParameterByName(0, variableName);
-
-        if (param_handle) {
-            return shader->effect->SetFloat(param_handle, value) == D3D_OK;
-        }
-        return false;
+        return shader->vars.setFloat(variableName, value);
     }
 
     bool MGEAPIv1::shaderSetInt(ShaderHandle handle, const char* variableName, int value) {
         auto shader = static_cast<MGEShader*>(handle);
-        auto param_handle = shader->effect->GetParameterByName(0, variableName);
-
-        if (param_handle) {
-            return shader->effect->SetInt(param_handle, value) == D3D_OK;
-        }
-        return false;
+        return shader->vars.setInt(variableName, value);
     }
 
     bool MGEAPIv1::shaderSetString(ShaderHandle handle, const char* variableName, const char* value) {
         auto shader = static_cast<MGEShader*>(handle);
-        auto param_handle = shader->effect->GetParameterByName(0, variableName);
+        auto param_handle = shader->vars.access(variableName);
 
         if (param_handle) {
             return shader->effect->SetString(param_handle, value) == D3D_OK;
@@ -667,7 +655,7 @@ namespace api {
 
     bool MGEAPIv1::shaderSetFloatArray(ShaderHandle handle, const char* variableName, const float* values, size_t* count) {
         auto shader = static_cast<MGEShader*>(handle);
-        auto param_handle = shader->effect->GetParameterByName(0, variableName);
+        auto param_handle = shader->vars.access(variableName);
 
         if (param_handle) {
             return shader->effect->SetFloatArray(param_handle, values, *count) == D3D_OK;
@@ -677,17 +665,12 @@ namespace api {
 
     bool MGEAPIv1::shaderSetVector(ShaderHandle handle, const char* variableName, const float* values, size_t count) {
         auto shader = static_cast<MGEShader*>(handle);
-        auto param_handle = shader->effect->GetParameterByName(0, variableName);
-
-        if (param_handle) {
-            return shader->effect->SetFloatArray(param_handle, values, count) == D3D_OK;
-        }
-        return false;
+        return shader->vars.setFloatArray(variableName, values, int(count));
     }
 
     bool MGEAPIv1::shaderSetMatrix(ShaderHandle handle, const char* variableName, const float* values) {
         auto shader = static_cast<MGEShader*>(handle);
-        auto param_handle = shader->effect->GetParameterByName(0, variableName);
+        auto param_handle = shader->vars.access(variableName);
 
         if (param_handle) {
             return shader->effect->SetMatrix(param_handle, reinterpret_cast<const D3DXMATRIX*>(values)) == D3D_OK;
@@ -697,7 +680,7 @@ namespace api {
 
     bool MGEAPIv3::shaderSetBoolArray(ShaderHandle handle, const char* variableName, const int* values, size_t* count) {
         auto shader = static_cast<MGEShader*>(handle);
-        auto param_handle = shader->effect->GetParameterByName(0, variableName);
+        auto param_handle = shader->vars.access(variableName);
 
         if (param_handle) {
             return shader->effect->SetBoolArray(param_handle, reinterpret_cast<const BOOL*>(values), *count) == D3D_OK;
@@ -707,7 +690,7 @@ namespace api {
 
     bool MGEAPIv3::shaderSetIntArray(ShaderHandle handle, const char* variableName, const int* values, size_t* count) {
         auto shader = static_cast<MGEShader*>(handle);
-        auto param_handle = shader->effect->GetParameterByName(0, variableName);
+        auto param_handle = shader->vars.access(variableName);
 
         if (param_handle) {
             return shader->effect->SetIntArray(param_handle, values, *count) == D3D_OK;
@@ -717,7 +700,7 @@ namespace api {
 
     bool MGEAPIv3::shaderSetVectorArray(ShaderHandle handle, const char* variableName, const float* values, size_t* count) {
         auto shader = static_cast<MGEShader*>(handle);
-        auto param_handle = shader->effect->GetParameterByName(0, variableName);
+        auto param_handle = shader->vars.access(variableName);
 
         if (param_handle) {
             return shader->effect->SetVectorArray(param_handle, reinterpret_cast<const D3DXVECTOR4*>(values), *count) == D3D_OK;
@@ -767,8 +750,7 @@ namespace api {
     // MGEAPI v2
     //
 
-    std::string saveScreenshotPath;
-    static void saveScreenshotCallback(IDirect3DSurface9* surface);
+    static void saveScreenshotCallback(IDirect3DSurface9* surface, const std::string& saveScreenshotPath);
 
     void MGEAPIv2::saveScreenshot(const char* path, bool captureWithUI) {
         // Requires distant land to be loaded
@@ -779,11 +761,12 @@ namespace api {
             return;
         }
 
-        saveScreenshotPath = path;
-        DistantLand::requestCapture(&saveScreenshotCallback, captureWithUI);
+        // Each request keeps its own path, so several screenshots may be requested in one frame
+        std::string savePath = path;
+        DistantLand::requestCapture([savePath](IDirect3DSurface9* surface) { saveScreenshotCallback(surface, savePath); }, captureWithUI);
     }
 
-    static void saveScreenshotCallback(IDirect3DSurface9* surface) {
+    static void saveScreenshotCallback(IDirect3DSurface9* surface, const std::string& saveScreenshotPath) {
         const std::array strImageExtensions{ ".bmp", ".jpg", ".dds", ".png", ".tga" };
         const std::array formats{ D3DXIFF_BMP, D3DXIFF_JPG, D3DXIFF_DDS, D3DXIFF_PNG, D3DXIFF_TGA };
         const char* path = saveScreenshotPath.c_str();
@@ -811,28 +794,15 @@ namespace api {
             }
         }
 
-        // Save screenshot to desired format
-        if (outputFormat == D3DXIFF_PNG) {
-            // D3DX PNG support does full compression which takes >1 sec to save an image
-            // Use a non-compressing PNG encoder for reasonable screenshot times
-            bool success = false;
-            D3DSURFACE_DESC desc;
-            D3DLOCKED_RECT rect;
-            surface->GetDesc(&desc);
-
-            if (surface->LockRect(&rect, NULL, D3DLOCK_READONLY) == D3D_OK) {
-                success = pngSaveBGRA(path, rect.pBits, desc.Width, desc.Height, rect.Pitch);
-                surface->UnlockRect();
-            }
+        // Queue screenshot to be saved in the desired format
+        std::string savePath = saveScreenshotPath;
+        bool queued = ScreenshotQueue::submit(surface, path, outputFormat, [savePath](bool success) {
             if (!success) {
-                LOG::logline("mge.saveScreenshot failed - pngSave error");
-            }
-        }
-        else {
-            HRESULT hr = D3DXSaveSurfaceToFile(path, outputFormat, surface, NULL, NULL);
-            if (FAILED(hr)) {
-                LOG::logline("mge.saveScreenshot failed - D3DX Error %lx", hr);
+                LOG::logline("mge.saveScreenshot failed - Cannot save %s", savePath.c_str());
             }
+        });
+        if (!queued) {
+            LOG::logline("mge.saveScreenshot failed - Cannot queue %s", path);
         }
     }
 
@@ -852,4 +822,87 @@ namespace api {
         distance = std::max(2500.0f, std::min(7168.0f, distance));
         MWBridge::get()->SetViewDistance(distance);
     }
+
+    //
+    // MGEAPI v4
+    //
+
+    bool MGEAPIv4::saveScreenshotSequence(const char* path, int frameCount, int intervalMs, bool captureWithUI) {
+        // Requires distant land to be loaded
+        if (!DistantLand::ready || !path) {
+            return false;
+        }
+
+        return FrameSequence::start(path, frameCount, intervalMs, captureWithUI);
+    }
+
+    void MGEAPIv4::stopScreenshotSequence() {
+        FrameSequence::stop();
+    }
+
+    //
+    // MGEAPI v5
+    //
+
+    bool MGEAPIv5::profilerGetOverlay() {
+        return Configuration.ProfilerOverlay;
+    }
+
+    void MGEAPIv5::profilerSetOverlay(bool enable) {
+        Configuration.ProfilerOverlay = enable;
+    }
+
+    bool MGEAPIv5::profilerGetZoneStats(size_t index, ProfilerZoneStats* out_stats) {
+        if (index >= Profiler::ZoneCount || !out_stats) {
+            return false;
+        }
+
+        auto zone = Profiler::Zone(index);
+        auto summary = Profiler::summarise(zone);
+        out_stats->name = Profiler::zoneName(zone);
+        out_stats->depth = Profiler::zoneDepth(zone);
+        out_stats->last = Profiler::lastSample(zone);
+        out_stats->min = summary.min;
+        out_stats->avg = summary.avg;
+        out_stats->max = summary.max;
+        out_stats->p99 = summary.p99;
+        return true;
+    }
+
+    // profilerGetZoneGPUStats - GPU times lag a few frames behind CPU times; CPU-only zones report zeros
+    bool MGEAPIv5::profilerGetZoneGPUStats(size_t index, ProfilerZoneStats* out_stats) {
+        if (index >= Profiler::ZoneCount || !out_stats) {
+            return false;
+        }
+
+        auto zone = Profiler::Zone(index);
+        auto summary = Profiler::summariseGPU(zone);
+        out_stats->name = Profiler::zoneName(zone);
+        out_stats->depth = Profiler::zoneDepth(zone);
+        out_stats->last = Profiler::lastSampleGPU(zone);
+        out_stats->min = summary.min;
+        out_stats->avg = summary.avg;
+        out_stats->max = summary.max;
+        out_stats->p99 = summary.p99;
+        return true;
+    }
+
+    size_t MGEAPIv5::profilerDump(char* buffer, size_t size) {
+        if (!buffer) {
+            return 0;
+        }
+        return Profiler::dump(buffer, size);
+    }
+
+    // callTraceStart - Record D3D8 calls for offline replay, starting at the next frame
+    bool MGEAPIv5::callTraceStart(const char* path, int frameCount) {
+        if (!path) {
+            return false;
+        }
+        return CallRecorder::start(path, frameCount);
+    }
+
+    void MGEAPIv5::callTraceStop() {
+        CallRecorder::stop();
+    }
 }
@@ -3,7 +3,7 @@
 #include <stddef.h>
 
 namespace api {
-	static const int supported_api_version = 3;
+	static const int supported_api_version = 5;
 
 	struct MGEAPI {
 		virtual int getAPIVersion() const = 0;
@@ -46,6 +46,13 @@ namespace api {
 		char name[128];
 	};
 
+	struct ProfilerZoneStats {
+		// API v5, times in microseconds per frame
+		const char* name;
+		int depth;
+		float last, min, avg, max, p99;
+	};
+
 	struct MacroFunctions {
 		typedef void (*Macro)();
 
@@ -225,7 +232,23 @@ namespace api {
 		virtual bool shaderSetVectorArray(ShaderHandle handle, const char* variableName, const float* values, size_t* count);
     };
 
-    typedef MGEAPIv3 MGEAPI_ExportVersion;
+    struct MGEAPIv4 : public MGEAPIv3 {
+        virtual bool saveScreenshotSequence(const char* path, int frameCount, int intervalMs, bool captureWithUI);
+        virtual void stopScreenshotSequence();
+    };
+
+    struct MGEAPIv5 : public MGEAPIv4 {
+        virtual bool profilerGetOverlay();
+        virtual void profilerSetOverlay(bool enable);
+        virtual bool profilerGetZoneStats(size_t index, ProfilerZoneStats* out_stats);
+        virtual bool profilerGetZoneGPUStats(size_t index, ProfilerZoneStats* out_stats);
+        virtual size_t profilerDump(char* buffer, size_t size);
+
+        virtual bool callTraceStart(const char* path, int frameCount);
+        virtual void callTraceStop();
+    };
+
+    typedef MGEAPIv5 MGEAPI_ExportVersion;
 
 	inline MGEAPIv1* api = nullptr;
 	inline const MacroFunctions* macros = nullptr;
@@ -0,0 +1,212 @@
+
+#include "callrecorder.h"
+#include "proxydx/d3d8texture.h"
+#include "statusoverlay.h"
+#include "support/calltrace.h"
+#include "support/log.h"
+
+#include <string>
+
+
+
+namespace CallRecorder {
+    static CallTraceWriter writer;
+    static std::string path;
+    static int framesRemaining;     // Zero when recording until stopped
+    static bool pending;            // Waiting for the next Present to start recording
+}
+
+using namespace CallRecorder;
+
+static void defineVertexBuffer(uint32_t id, IDirect3DVertexBuffer9* vb);
+static void defineIndexBuffer(uint32_t id, IDirect3DIndexBuffer9* ib);
+static void defineTexture(uint32_t id, IDirect3DTexture9* tex);
+
+// start - Open a new trace file, recording starts at the next Present so the trace holds whole frames
+// With a frame count of zero, records until stopped
+bool CallRecorder::start(const char* tracePath, int frameCount) {
+    stop();
+
+    if (!writer.open(tracePath)) {
+        LOG::logline("!! Call trace %s cannot be created", tracePath);
+        return false;
+    }
+
+    path = tracePath;
+    framesRemaining = frameCount > 0 ? frameCount : 0;
+    pending = true;
+
+    LOG::logline("-- Call trace %s started", tracePath);
+    StatusOverlay::setStatus("Recording call trace");
+    return true;
+}
+
+// stop - Finish the trace file
+void CallRecorder::stop() {
+    if (!writer.isOpen()) {
+        return;
+    }
+
+    recording = pending = false;
+    uint32_t frames = writer.frameCount();
+    if (writer.close()) {
+        LOG::logline("-- Call trace %s closed, %u frames", path.c_str(), frames);
+        StatusOverlay::setStatus("Call trace stopped");
+    } else {
+        LOG::logline("!! Call trace %s could not be written completely", path.c_str());
+        StatusOverlay::setStatus("Call trace failed, check mgeXE.log", StatusOverlay::PriorityError);
+    }
+}
+
+// present - Frame boundary; also starts a pending recording, which is why it is called when not recording
+void CallRecorder::present() {
+    if (pending) {
+        pending = false;
+        recording = true;
+        return;
+    }
+    if (!recording) {
+        return;
+    }
+
+    writer.write(CallOp::Present, {});
+    writer.endFrame();
+
+    if (writer.failed() || (framesRemaining > 0 && --framesRemaining == 0)) {
+        stop();
+    }
+}
+
+void CallRecorder::beginScene() {
+    writer.write(CallOp::BeginScene, {});
+}
+
+void CallRecorder::endScene() {
+    writer.write(CallOp::EndScene, {});
+}
+
+void CallRecorder::clear(DWORD count, const D3DRECT* rects, DWORD flags, D3DCOLOR colour, float z, DWORD stencil) {
+    uint32_t zBits = reinterpret_cast<const uint32_t&>(z);
+    writer.write(CallOp::Clear, { flags, colour, zBits, stencil }, rects, rects ? count * sizeof(D3DRECT) : 0);
+}
+
+void CallRecorder::setRenderTarget(const void* colour, const void* depth, bool isBackBuffer) {
+    // Surfaces have no recorded contents, IDs only let replay distinguish targets
+    bool isNew;
+    uint32_t colourId = writer.resourceId(colour, isNew);
+    uint32_t depthId = writer.resourceId(depth, isNew);
+    writer.write(CallOp::SetRenderTarget, { colourId, depthId, isBackBuffer });
+}
+
+void CallRecorder::setTransform(D3DTRANSFORMSTATETYPE state, const D3DMATRIX* m) {
+    writer.write(CallOp::SetTransform, { uint32_t(state) }, m, sizeof(D3DMATRIX));
+}
+
+void CallRecorder::multiplyTransform(D3DTRANSFORMSTATETYPE state, const D3DMATRIX* m) {
+    writer.write(CallOp::MultiplyTransform, { uint32_t(state) }, m, sizeof(D3DMATRIX));
+}
+
+void CallRecorder::setMaterial(const D3DMATERIAL8* material) {
+    writer.write(CallOp::SetMaterial, {}, material, sizeof(D3DMATERIAL8));
+}
+
+void CallRecorder::setLight(DWORD index, const D3DLIGHT8* light) {
+    writer.write(CallOp::SetLight, { index }, light, sizeof(D3DLIGHT8));
+}
+
+void CallRecorder::lightEnable(DWORD index, BOOL enable) {
+    writer.write(CallOp::LightEnable, { index, uint32_t(enable) });
+}
+
+void CallRecorder::setRenderState(D3DRENDERSTATETYPE state, DWORD value) {
+    writer.write(CallOp::SetRenderState, { uint32_t(state), value });
+}
+
+void CallRecorder::setTextureStageState(DWORD stage, D3DTEXTURESTAGESTATETYPE state, DWORD value) {
+    writer.write(CallOp::SetTextureStageState, { stage, uint32_t(state), value });
+}
+
+void CallRecorder::setTexture(DWORD stage, IDirect3DBaseTexture8* texture) {
+    bool isNew;
+    uint32_t id = writer.resourceId(texture, isNew);
+    if (isNew) {
+        defineTexture(id, static_cast<ProxyTexture*>(texture)->realTexture);
+    }
+    writer.write(CallOp::SetTexture, { stage, id });
+}
+
+void CallRecorder::setVertexShader(DWORD fvf) {
+    writer.write(CallOp::SetVertexShader, { fvf });
+}
+
+void CallRecorder::setStreamSource(UINT stream, IDirect3DVertexBuffer9* vb, UINT stride) {
+    bool isNew;
+    uint32_t id = writer.resourceId(vb, isNew);
+    if (isNew) {
+        defineVertexBuffer(id, vb);
+    }
+    writer.write(CallOp::SetStreamSource, { stream, id, stride });
+}
+
+void CallRecorder::setIndices(IDirect3DIndexBuffer9* ib, UINT baseVertexIndex) {
+    bool isNew;
+    uint32_t id = writer.resourceId(ib, isNew);
+    if (isNew) {
+        defineIndexBuffer(id, ib);
+    }
+    writer.write(CallOp::SetIndices, { id, baseVertexIndex });
+}
+
+void CallRecorder::drawIndexedPrimitive(D3DPRIMITIVETYPE type, UINT minIndex, UINT vertexCount, UINT startIndex, UINT primCount) {
+    writer.write(CallOp::DrawIndexedPrimitive, { uint32_t(type), minIndex, vertexCount, startIndex, primCount });
+}
+
+void CallRecorder::applyStateBlock(DWORD token) {
+    writer.write(CallOp::ApplyStateBlock, { token });
+}
+
+void CallRecorder::forgetResource(const void* resource) {
+    writer.forget(resource);
+}
+
+// --------------------------------------------------------
+// Resource contents, captured at first use
+// Buffers in the default pool cannot be read back, only their description is recorded
+
+void defineVertexBuffer(uint32_t id, IDirect3DVertexBuffer9* vb) {
+    D3DVERTEXBUFFER_DESC desc;
+    void* contents = NULL;
+
+    vb->GetDesc(&desc);
+    if (desc.Pool != D3DPOOL_DEFAULT && vb->Lock(0, 0, &contents, D3DLOCK_READONLY) != D3D_OK) {
+        contents = NULL;
+    }
+
+    writer.write(CallOp::DefineVertexBuffer, { id, desc.Size, desc.Usage, desc.FVF, uint32_t(desc.Pool) }, contents, desc.Size);
+    if (contents) {
+        vb->Unlock();
+    }
+}
+
+void defineIndexBuffer(uint32_t id, IDirect3DIndexBuffer9* ib) {
+    D3DINDEXBUFFER_DESC desc;
+    void* contents = NULL;
+
+    ib->GetDesc(&desc);
+    if (desc.Pool != D3DPOOL_DEFAULT && ib->Lock(0, 0, &contents, D3DLOCK_READONLY) != D3D_OK) {
+        contents = NULL;
+    }
+
+    writer.write(CallOp::DefineIndexBuffer, { id, desc.Size, desc.Usage, uint32_t(desc.Format), uint32_t(desc.Pool) }, contents, desc.Size);
+    if (contents) {
+        ib->Unlock();
+    }
+}
+
+void defineTexture(uint32_t id, IDirect3DTexture9* tex) {
+    // Texel contents do not affect the proxy, so only the description is recorded to keep traces small
+    D3DSURFACE_DESC desc;
+
+    tex->GetLevelDesc(0, &desc);
+    writer.write(CallOp::DefineTexture, { id, desc.Width, desc.Height, tex->GetLevelCount(), desc.Usage, uint32_t(desc.Format), uint32_t(desc.Pool) });
+}
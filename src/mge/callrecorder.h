@@ -0,0 +1,37 @@
+#pragma once
+
+#include "proxydx/d3d8header.h"
+
+// D3D8 call recorder, for offline replay of the proxy device with tools/mgetrace
+// Records the calls Morrowind makes through MGEProxyDevice, before any MGE filtering, from the next
+// Present for a number of frames (or until stopped) into a call trace file, see support/calltrace.h
+namespace CallRecorder {
+    bool start(const char* path, int frameCount);
+    void stop();
+
+    // Set while calls are being recorded, hooks should only be called when it is true
+    // The exception is present, which must be called every frame to start a pending recording
+    inline bool recording = false;
+
+    void present();
+    void beginScene();
+    void endScene();
+    void clear(DWORD count, const D3DRECT* rects, DWORD flags, D3DCOLOR colour, float z, DWORD stencil);
+    void setRenderTarget(const void* colour, const void* depth, bool isBackBuffer);
+    void setTransform(D3DTRANSFORMSTATETYPE state, const D3DMATRIX* m);
+    void multiplyTransform(D3DTRANSFORMSTATETYPE state, const D3DMATRIX* m);
+    void setMaterial(const D3DMATERIAL8* material);
+    void setLight(DWORD index, const D3DLIGHT8* light);
+    void lightEnable(DWORD index, BOOL enable);
+    void setRenderState(D3DRENDERSTATETYPE state, DWORD value);
+    void setTextureStageState(DWORD stage, D3DTEXTURESTAGESTATETYPE state, DWORD value);
+    void setTexture(DWORD stage, IDirect3DBaseTexture8* texture);
+    void setVertexShader(DWORD fvf);
+    void setStreamSource(UINT stream, IDirect3DVertexBuffer9* vb, UINT stride);
+    void setIndices(IDirect3DIndexBuffer9* ib, UINT baseVertexIndex);
+    void drawIndexedPrimitive(D3DPRIMITIVETYPE type, UINT minIndex, UINT vertexCount, UINT startIndex, UINT primCount);
+    void applyStateBlock(DWORD token);
+
+    // Resource creation, a new resource may reuse the address of a released one
+    void forgetResource(const void* resource);
+};
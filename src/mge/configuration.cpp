@@ -4,7 +4,11 @@
 
 #include <stdlib.h>
 #include <algorithm>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
 #include "support/winheader.h"
+#include "support/inifile.h"
 
 #include "configuration.h"
 #include "inidata.h"
@@ -12,24 +16,62 @@
 
 ConfigurationStruct Configuration;
 
-double getSettingValue(char* sval, const iniSetting& set) {
+// Hashed lookups for a dictionary, keyed by lowercased name and by value. The first entry wins, as with a linear search.
+struct DictionaryIndex {
+    std::unordered_map<std::string, double> values;
+    std::unordered_map<double, const char*> names;
+};
+
+static std::string lowercaseKey(const char* s) {
+    std::string key = s;
+    std::transform(key.begin(), key.end(), key.begin(), [](char c) { return (c >= 'A' && c <= 'Z') ? char(c + 'a' - 'A') : c; });
+    return key;
+}
+
+static const DictionaryIndex& indexDictionary(const tdictionary* dict) {
+    static std::unordered_map<const tdictionary*, DictionaryIndex> cache;
+
+    auto it = cache.find(dict);
+    if (it != cache.end()) {
+        return it->second;
+    }
+
+    DictionaryIndex& index = cache[dict];
+    for (unsigned int i = 0; i < dict->length; ++i) {
+        const tdictent& dictent = dict->dictent[i];
+        std::string key = lowercaseKey(dictent.key);
+        index.values.emplace(key, dictent.value);
+        index.names.emplace(dictent.value, dictent.key);
+    }
+    return index;
+}
+
+static bool lookupDictionary(const tdictionary* dict, const char* sval, double* value) {
+    std::string key = lowercaseKey(sval);
+
+    const DictionaryIndex& index = indexDictionary(dict);
+    auto it = index.values.find(key);
+    if (it == index.values.end()) {
+        return false;
+    }
+    *value = it->second;
+    return true;
+}
+
+double getSettingValue(const char* sval, const iniSetting& set) {
     const tdictionary* dict = set.dictionary;
+    double dictValue;
 
-    if (dict) {
-        for (unsigned int i = 0; i < dict->length; ++i) {
-            tdictent dictent = dict->dictent[i];
-            if (!_stricmp(sval, dictent.key)) {
-                if (set.flags & MINMAX) {
-                    if (dictent.value > set.max) {
-                        return set.max;
-                    }
-                    if (dictent.value < set.min) {
-                        return set.min;
-                    }
-                }
-                return dictent.value;
+    if (dict && lookupDictionary(dict, sval, &dictValue)) {
+        if (set.flags & MINMAX) {
+            if (dictValue > set.max) {
+                return set.max;
+            }
+            if (dictValue < set.min) {
+                return set.min;
             }
         }
+        return dictValue;
     }
     if (!(set.flags & DICTONLY)) {
         char* endptr;
@@ -47,28 +89,16 @@ double getSettingValue(char* sval, const iniSetting& set) {
             }
             return temp;
         }
-    } else if (dict) {
-        for (unsigned int i = 0; i < dict->length; ++i) {
-            tdictent dictent = dict->dictent[i];
-            if (!_stricmp(set.defval, dictent.key)) {
-                return dictent.value;
-            }
-        }
+    } else if (dict && lookupDictionary(dict, set.defval, &dictValue)) {
+        return dictValue;
     }
     return NAN;
 }
 
 const char* dictValueToString(double value, const iniSetting& set) {
-    const tdictionary* dict = set.dictionary;
-
-    for (unsigned int i = 0; i < dict->length; ++i) {
-        tdictent dictent = dict->dictent[i];
-        if (value == dictent.value) {
-            return dictent.key;
-        }
-    }
-
-    return nullptr;
+    const DictionaryIndex& index = indexDictionary(set.dictionary);
+    auto it = index.names.find(value);
+    return (it != index.names.end()) ? it->second : nullptr;
 }
 
 void utf8cpyToA_s(char* _Dst, size_t _SizeInBytes, const char* _Src) {
@@ -81,18 +111,18 @@ void utf8cpyToA_s(char* _Dst, size_t _SizeInBytes, const char* _Src) {
 
 bool ConfigurationStruct::LoadSettings() {
     char buffer[4096];
+    IniFile ini;
 
+    // Parse the ini once, instead of once per setting through GetPrivateProfileString
     MGEFlags = 0;
-    GetPrivateProfileSectionNames(buffer, countof(buffer), mgeini);
+    ini.load(mgeini);
 
-    char* pointer = buffer;
     bool initialized = false;
-    while (*pointer != '\0') {
-        if (_stricmp(pointer, siniRendState)) {
+    for (size_t i = 0; i != ini.sectionCount(); ++i) {
+        if (_stricmp(ini.sectionName(i), siniRendState)) {
             initialized = true;
             break;
         }
-        pointer += strlen(pointer) + 1;
     }
     if (!initialized) {
         return false;
@@ -100,13 +130,14 @@ bool ConfigurationStruct::LoadSettings() {
 
     for (int i = 0; i != countof(iniSettings); ++i) {
         const iniSetting& set = iniSettings[i];
-        GetPrivateProfileString(set.section, set.key, set.defval, buffer, countof(buffer), mgeini);
+        const char* sval = set.key ? ini.get(set.section, set.key) : nullptr;
+        std::snprintf(buffer, sizeof(buffer), "%s", sval ? sval : (set.defval ? set.defval : ""));
 
         if (set.type == t_string) {
             utf8cpyToA_s((char*)set.variable, set.bit_size, buffer);
         } else if (set.type == t_set) {
             size_t sz = std::min(set.bit_size, countof(buffer));
-            GetPrivateProfileSection(set.section, buffer, sz, mgeini);
+            ini.getSection(set.section, buffer, sz);
             memcpy(set.variable, buffer, sz);
         } else {
             double value = getSettingValue(buffer, set);
@@ -153,6 +184,10 @@ bool ConfigurationStruct::LoadSettings() {
 
 bool ConfigurationStruct::SaveSettings() {
     char buffer[4096];
+    IniFile ini;
+
+    // Only keys whose value changed are rewritten, and the file is written once
+    ini.load(mgeini);
 
     for (int i = 0; i != countof(iniSettings); ++i) {
         const iniSetting& set = iniSettings[i];
@@ -234,10 +269,8 @@ bool ConfigurationStruct::SaveSettings() {
 
         // Only write if a valid output string was produced
         if (strSize > 0) {
-            if (WritePrivateProfileString(set.section, set.key, buffer, mgeini) == 0) {
-                return false;
-            }
+            ini.set(set.section, set.key, buffer);
         }
     }
-    return true;
+    return ini.save(mgeini);
 }
@@ -91,6 +91,7 @@ struct ConfigurationStruct {
     BYTE AnisoLevel;
     BYTE ScaleFilter;
     bool UseDefaultTexturePool;
+    DWORD TextureCacheBudget;
     float ScreenFOV;
     BYTE FogMode;
     BYTE SSFormat;
@@ -100,6 +101,7 @@ struct ConfigurationStruct {
     float HDRReactionSpeed;
     DWORD PerPixelLightFlags;
     int StatusTimeout;
+    bool ProfilerOverlay;
     bool Force3rdPerson;
     struct {
         float x, y, z;
@@ -5,10 +5,13 @@
 #include "distantland.h"
 #include "distantshader.h"
 #include "dlformat.h"
+#include "dlplacement.h"
+#include "framesequence.h"
 #include "postshaders.h"
 #include "morrowindbsa.h"
 #include "mwbridge.h"
 #include "mgeversion.h"
+#include "screenshotqueue.h"
 #include "statusoverlay.h"
 #include <memory>
 #include <optional>
@@ -137,8 +140,7 @@ D3DXHANDLE DistantLand::ehTime;
 D3DXHANDLE DistantLand::ehRippleOrigin;
 D3DXHANDLE DistantLand::ehWaveHeight;
 
-std::function<void(IDirect3DSurface9*)> DistantLand::captureScreenHandler = nullptr;
-bool DistantLand::captureScreenWithUI;
+std::vector<DistantLand::CaptureRequest> DistantLand::captureRequests;
 
 
 struct MeshResources {
@@ -859,6 +861,9 @@ bool DistantLand::loadDistantStatics() {
     membuf_reader reader(file_buffer.get());
     CloseHandle(h2);
 
+    vector<const char*> textureNames;
+    vector<DistantSubset*> texturedSubsets;
+
     for (auto& i : distantStatics) {
         int numSubsets;
         reader.read(&numSubsets, 4);
@@ -867,8 +872,8 @@ bool DistantLand::loadDistantStatics() {
         reader.read(&i.type, 1);
 
         i.subsets.resize(numSubsets);
-        i.aabbMin = D3DXVECTOR3(FLT_MAX, FLT_MAX, FLT_MAX);
-        i.aabbMax = D3DXVECTOR3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+        i.aabbMin = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+        i.aabbMax = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
 
         for (auto& subset : i.subsets) {
             // Get bounding sphere
@@ -921,17 +926,27 @@ bool DistantLand::loadDistantStatics() {
             const char* texname = reader.get();
             reader.advance(pathsize);
 
-            IDirect3DTexture9* tex = BSA::loadTexture(device, texname);
-            if (!tex) {
-                LOG::logline("Cannot load texture %s", texname);
-                errorTexture->AddRef();
-                tex = errorTexture;
-            }
-            subset.tex = tex;
+            textureNames.push_back(texname);
+            texturedSubsets.push_back(&subset);
+        }
+    }
+
+    // Load all referenced textures as a batch, names point into the file buffer
+    vector<IDirect3DTexture9*> textures;
+    BSA::loadTextures(device, textureNames, textures);
 
-            // Keep resource pointers for deallocation
-            meshCollectionStatics.push_back(MeshResources(vb, ib, tex));
+    for (size_t n = 0; n != texturedSubsets.size(); ++n) {
+        DistantSubset* subset = texturedSubsets[n];
+        IDirect3DTexture9* tex = textures[n];
+        if (!tex) {
+            LOG::logline("Cannot load texture %s", textureNames[n]);
+            errorTexture->AddRef();
+            tex = errorTexture;
         }
+        subset->tex = tex;
+
+        // Keep resource pointers for deallocation
+        meshCollectionStatics.push_back(MeshResources(subset->vbuffer, subset->ibuffer, tex));
     }
     file_buffer.reset();
     errorTexture->Release();
@@ -1035,20 +1050,18 @@ bool DistantLand::loadDistantStatics() {
                 udsReader.read(&scale, 4);
                 NewUsedStatic.scale = scale;
 
-                D3DXMATRIX transmat, rotmatx, rotmaty, rotmatz, scalemat;
-                D3DXMatrixTranslation(&transmat, NewUsedStatic.pos.x, NewUsedStatic.pos.y, NewUsedStatic.pos.z);
-                D3DXMatrixRotationX(&rotmatx, -yaw);
-                D3DXMatrixRotationY(&rotmaty, -pitch);
-                D3DXMatrixRotationZ(&rotmatz, -roll);
-                D3DXMatrixScaling(&scalemat, scale, scale, scale);
+                mat4x3 transmat = mat4x3::translation(NewUsedStatic.pos.x, NewUsedStatic.pos.y, NewUsedStatic.pos.z);
+                mat4x3 rotmatx = mat4x3::rotationX(-yaw);
+                mat4x3 rotmaty = mat4x3::rotationY(-pitch);
+                mat4x3 rotmatz = mat4x3::rotationZ(-roll);
+                mat4x3 scalemat = mat4x3::scaling(scale);
 
-                const DistantStatic* stat = &distantStatics[NewUsedStatic.staticRef];
                 NewUsedStatic.transform = scalemat * rotmatz * rotmaty * rotmatx * transmat;
-                NewUsedStatic.sphere = NewUsedStatic.GetBoundingSphere(stat->sphere);
-                NewUsedStatic.box = NewUsedStatic.GetBoundingBox(stat->aabbMin, stat->aabbMax);
-
                 worldSpaceStatics.push_back(NewUsedStatic);
             }
+
+            // Bound the chunk in one batch
+            boundDistantStatics(distantStatics, &worldSpaceStatics[worldSpaceStatics.size() - staticsToRead], staticsToRead);
         }
 
         worldvis_memory_use += initDistantStaticsQT(*currentWorldSpace, distantStatics, worldSpaceStatics);
@@ -1062,130 +1075,29 @@ bool DistantLand::loadDistantStatics() {
     return true;
 }
 
+// addVisGroupReference - Track meshes belonging to a dynamic vis group, so they can be toggled at runtime
+static void addVisGroupReference(uint16_t visIndex, QuadTreeMesh* mesh) {
+    DistantLand::dynamicVisGroups[visIndex].references.push_back(mesh);
+}
+
 static size_t initDistantStaticsQT(DistantLand::WorldSpace& worldSpace, vector<DistantStatic>& distantStatics, vector<UsedDistantStatic>& uds) {
     // Initialize quadtrees
     worldSpace.NearStatics = std::make_unique<QuadTree>();
     worldSpace.FarStatics = std::make_unique<QuadTree>();
     worldSpace.VeryFarStatics = std::make_unique<QuadTree>();
     worldSpace.GrassStatics = std::make_unique<QuadTree>();
-    QuadTree* NQTR = worldSpace.NearStatics.get();
-    QuadTree* FQTR = worldSpace.FarStatics.get();
-    QuadTree* VFQTR = worldSpace.VeryFarStatics.get();
-    QuadTree* GQTR = worldSpace.GrassStatics.get();
-
-    // Calclulate optimal initial quadtree size
-    D3DXVECTOR2 aabbMax = D3DXVECTOR2(-FLT_MAX, -FLT_MAX);
-    D3DXVECTOR2 aabbMin = D3DXVECTOR2(FLT_MAX, FLT_MAX);
-
-    // Find xyz bounds
-    for (const auto& i : uds) {
-        float x = i.pos.x, y = i.pos.y, r = i.sphere.radius;
-
-        aabbMax.x = std::max(x + r, aabbMax.x);
-        aabbMax.y = std::max(y + r, aabbMax.y);
-        aabbMin.x = std::min(aabbMin.x, x - r);
-        aabbMin.y = std::min(aabbMin.y, y - r);
-    }
-
-    size_t total_instances = 0;
-    float box_size = std::max(aabbMax.x - aabbMin.x, aabbMax.y - aabbMin.y);
-    D3DXVECTOR2 box_center = 0.5 * (aabbMax + aabbMin);
-
-    NQTR->SetBox(box_size, box_center);
-    FQTR->SetBox(box_size, box_center);
-    VFQTR->SetBox(box_size, box_center);
-    GQTR->SetBox(box_size, box_center);
-
-    for (const auto& i : uds) {
-        DistantStatic* stat = &distantStatics[i.staticRef];
-        QuadTree* targetQTR;
-
-        // Use post-transform (include scale) radius
-        float radius = i.sphere.radius;
-
-        // Buildings are treated as larger objects, as they are typically
-        // smaller component meshes combined to make a single building
-        if (stat->type == STATIC_BUILDING) {
-            radius *= 2.0f;
-        }
-
-        // Select quadtree to place object in
-        switch (stat->type) {
-        case STATIC_AUTO:
-        case STATIC_TREE:
-        case STATIC_BUILDING:
-            if (radius <= Configuration.DL.FarStaticMinSize) {
-                targetQTR = NQTR;
-            } else if (radius <= Configuration.DL.VeryFarStaticMinSize) {
-                targetQTR = FQTR;
-            } else {
-                targetQTR = VFQTR;
-            }
-            break;
-
-        case STATIC_GRASS:
-            targetQTR = GQTR;
-            break;
 
-        case STATIC_NEAR:
-            targetQTR = NQTR;
-            break;
+    DistantStaticTrees trees;
+    trees.nearStatics = worldSpace.NearStatics.get();
+    trees.farStatics = worldSpace.FarStatics.get();
+    trees.veryFarStatics = worldSpace.VeryFarStatics.get();
+    trees.grassStatics = worldSpace.GrassStatics.get();
 
-        case STATIC_FAR:
-            targetQTR = FQTR;
-            break;
-
-        case STATIC_VERY_FAR:
-            targetQTR = VFQTR;
-            break;
-
-        default:
-            continue;
-        }
-
-        // Add sub-meshes to appropriate quadtree
-        for (auto& s : stat->subsets) {
-            BoundingSphere boundSphere;
-            BoundingBox boundBox;
-
-            if (stat->type == STATIC_BUILDING) {
-                // Use model bound so that all building parts have coherent visibility
-                boundSphere = i.sphere;
-                boundBox = i.box;
-            } else {
-                // Use individual mesh bounds
-                boundSphere = i.GetBoundingSphere(s.sphere);
-                boundBox = i.GetBoundingBox(s.aabbMin, s.aabbMax);
-            }
-
-            auto mesh = targetQTR->AddMesh(
-                boundSphere,
-                boundBox,
-                i.transform,
-                s.hasAlpha,
-                s.hasUVController,
-                s.tex,
-                s.verts,
-                s.vbuffer,
-                s.faces,
-                s.ibuffer
-            );
-            if (i.visIndex > 0) {
-                DistantLand::dynamicVisGroups[i.visIndex].references.push_back(mesh);
-            }
-        }
-
-        total_instances += stat->subsets.size();
-    }
+    DistantStaticRanges ranges;
+    ranges.farStaticMinSize = Configuration.DL.FarStaticMinSize;
+    ranges.veryFarStaticMinSize = Configuration.DL.VeryFarStaticMinSize;
 
-    NQTR->Optimize();
-    NQTR->CalcVolume();
-    FQTR->Optimize();
-    FQTR->CalcVolume();
-    VFQTR->Optimize();
-    VFQTR->CalcVolume();
-    GQTR->Optimize();
-    GQTR->CalcVolume();
+    size_t total_instances = placeDistantStatics(trees, ranges, distantStatics, uds, &addVisGroupReference);
 
     // Return total memory use of leaves only, non-leaf nodes barely use much memory
     return total_instances * sizeof(QuadTreeMesh);
@@ -1242,16 +1154,15 @@ bool DistantLand::initLandscape() {
     meshesLand.resize(mesh_count);
 
     if (!meshesLand.empty()) {
-        D3DXVECTOR2 qtmin(FLT_MAX, FLT_MAX), qtmax(-FLT_MAX, -FLT_MAX);
-        D3DXMATRIX world;
-        D3DXMatrixIdentity(&world);
+        vec2 qtmin(FLT_MAX, FLT_MAX), qtmax(-FLT_MAX, -FLT_MAX);
+        mat4x3 world = mat4x3::identity();
 
         // Load meshes and calculate max size of quadtree
         for (auto& i : meshesLand) {
             ReadFile(file, &i.sphere.radius, 4, &unused,0);
             ReadFile(file, &i.sphere.center, 12, &unused,0);
 
-            D3DXVECTOR3 boxMin, boxMax;
+            vec3 boxMin, boxMax;
             ReadFile(file, &boxMin, 12, &unused, 0);
             ReadFile(file, &boxMax, 12, &unused, 0);
             i.box.Set(boxMin, boxMax);
@@ -1283,7 +1194,7 @@ bool DistantLand::initLandscape() {
             qtmax.y = std::max(qtmax.y, i.sphere.center.y + i.sphere.radius);
         }
 
-        LandQuadTree.SetBox(std::max(qtmax.x - qtmin.x, qtmax.y - qtmin.y), 0.5 * (qtmax + qtmin));
+        LandQuadTree.SetBox(std::max(qtmax.x - qtmin.x, qtmax.y - qtmin.y), 0.5f * (qtmax + qtmin));
 
         // Add meshes to the quadtree
         for (auto& i : meshesLand) {
@@ -1329,6 +1240,8 @@ void DistantLand::release() {
     recordMW.clear();
     recordSky.clear();
 
+    FrameSequence::stop();
+    ScreenshotQueue::release();
     PostShaders::release();
     FixedFunctionShader::release();
 
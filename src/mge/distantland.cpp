@@ -5,8 +5,12 @@
 #include "distantland.h"
 #include "distantshader.h"
 #include "postshaders.h"
+#include "profiler.h"
 #include "mwbridge.h"
 
+#include <algorithm>
+#include <iterator>
+
 
 
 using std::string;
@@ -14,6 +18,7 @@ using std::unordered_map;
 
 // renderStage0 - Render distant land at beginning of scene 0, after sky
 void DistantLand::renderStage0() {
+    Profiler::Scope profile(Profiler::ZoneRenderStage0);
     auto mwBridge = MWBridge::get();
     IDirect3DStateBlock9* stateSaved;
     UINT passes;
@@ -142,6 +147,7 @@ void DistantLand::renderStage0() {
 
 // renderStage1 - Render grass and shadows over near features, and write depth texture for scene 0
 void DistantLand::renderStage1() {
+    Profiler::Scope profile(Profiler::ZoneRenderStage1);
     auto mwBridge = MWBridge::get();
     IDirect3DStateBlock9* stateSaved;
     UINT passes;
@@ -195,6 +201,7 @@ void DistantLand::renderStage1() {
 
 // renderStage2 - Render shadows and depth texture for scenes 1+ (post-stencil redraw/alpha/1st person)
 void DistantLand::renderStage2() {
+    Profiler::Scope profile(Profiler::ZoneRenderStage2);
     auto mwBridge = MWBridge::get();
     IDirect3DStateBlock9* stateSaved;
     UINT passes;
@@ -643,12 +650,11 @@ void DistantLand::postProcess() {
     }
 }
 
-// updatePostShader - callback for setting post shader variables based on environment
-void DistantLand::updatePostShader(MGEShader* shader) {
+// updatePostShader - callback for setting post shader variables based on environment, called once per frame
+void DistantLand::updatePostShader(MGEShaderFrameVars* shader) {
     auto mwBridge = MWBridge::get();
 
-    // Internal textures
-    // TODO: Should be set once at init time
+    // Internal textures, the shader chain only rebinds these when they change
     shader->SetTexture(EV_depthframe, texDepthFrame);
     shader->SetTexture(EV_watertexture, texWater);
 
@@ -853,6 +859,10 @@ void DistantLand::editProjectionZ(D3DMATRIX* m, float zn, float zf) {
     m->_43 = -zn * zf / (zf - zn);
 }
 
+void DistantLand::editProjectionZ(mat4* m, float zn, float zf) {
+    ::editProjectionZ(m, zn, zf);
+}
+
 void DistantLand::setHorizonColour(const RGBVECTOR& c) {
     horizonCol = c;
 }
@@ -919,55 +929,43 @@ bool DistantLand::inspectIndexedPrimitive(int sceneCount, const RenderedState* r
     return true;
 }
 
-// requestCapture - Set a function to be called with a screen capture
+// requestCapture - Add a function to be called with a screen capture
 // Either before the UI is drawn, or after UI and before MGE messages
+// Requests from different sources in the same frame are all served, in request order.
 void DistantLand::requestCapture(std::function<void(IDirect3DSurface9*)> handler, bool captureWithUI) {
-    captureScreenHandler = handler;
-    captureScreenWithUI = captureWithUI;
+    captureRequests.push_back({ std::move(handler), captureWithUI });
 }
 
+// checkCaptureScreenshot - Serve the capture requests for this point in the frame, sharing one back buffer reference
 void DistantLand::checkCaptureScreenshot(bool isUIDrawn) {
-    if (bool(captureScreenHandler) && captureScreenWithUI == isUIDrawn) {
-        IDirect3DSurface9* surface = captureScreenshot();
-        captureScreenHandler(surface);
-        if (surface) {
-            surface->Release();
-        }
-        captureScreenHandler = nullptr;
+    auto split = std::stable_partition(captureRequests.begin(), captureRequests.end(),
+                                       [isUIDrawn](const CaptureRequest& r) { return r.withUI != isUIDrawn; });
+    if (split == captureRequests.end()) {
+        return;
+    }
+
+    // Handlers may request further captures, so they run after removal from the list
+    std::vector<CaptureRequest> serving(std::make_move_iterator(split), std::make_move_iterator(captureRequests.end()));
+    captureRequests.erase(split, captureRequests.end());
+
+    IDirect3DSurface9* surface = captureScreenshot();
+    for (auto& r : serving) {
+        r.handler(surface);
+    }
+    if (surface) {
+        surface->Release();
     }
 }
 
 // captureScreen - Capture a screenshot
+// Returns the back buffer; handlers pass it to ScreenshotQueue, which resolves and copies it without stalling
 IDirect3DSurface9* DistantLand::captureScreenshot() {
-    IDirect3DTexture9* t;
-    IDirect3DSurface9* s;
-
-    // Resolve multisampled back buffer
-    t = PostShaders::borrowBuffer(0);
-    t->GetSurfaceLevel(0, &s);
-
-    // Cancel render cache, borrowBuffer just overwrote it
-    isRenderCached = false;
-
-    // Copy buffer to system memory surface
-    IDirect3DSurface9* surfSS;
-    D3DSURFACE_DESC desc;
+    IDirect3DSurface9* backbuffer;
 
-    s->GetDesc(&desc);
-    DWORD hr = device->CreateOffscreenPlainSurface(desc.Width, desc.Height, D3DFMT_A8R8G8B8, D3DPOOL_SYSTEMMEM, &surfSS, NULL);
-    if (hr != D3D_OK) {
-        s->Release();
+    if (device->GetBackBuffer(0, 0, D3DBACKBUFFER_TYPE_MONO, &backbuffer) != D3D_OK) {
         return nullptr;
     }
-
-    hr = device->GetRenderTargetData(s, surfSS);
-    s->Release();
-    if (hr != D3D_OK) {
-        surfSS->Release();
-        return nullptr;
-    }
-
-    return surfSS;
+    return backbuffer;
 }
 
 
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "dlplacement.h"
 #include "quadtree.h"
 #include "ffeshader.h"
 #include "specificrender.h"
@@ -13,6 +14,7 @@
 
 
 struct MGEShader;
+struct MGEShaderFrameVars;
 
 class DistantLand {
 public:
@@ -143,8 +145,12 @@ public:
     static D3DXHANDLE ehRippleOrigin;
     static D3DXHANDLE ehWaveHeight;
 
-    static std::function<void(IDirect3DSurface9*)> captureScreenHandler;
-    static bool captureScreenWithUI;
+    // Screen captures requested for the current frame, in request order
+    struct CaptureRequest {
+        std::function<void(IDirect3DSurface9*)> handler;
+        bool withUI;
+    };
+    static std::vector<CaptureRequest> captureRequests;
 
     static bool init();
     static bool initShader();
@@ -160,6 +166,7 @@ public:
     static void release();
 
     static void editProjectionZ(D3DMATRIX* m, float zn, float zf);
+    static void editProjectionZ(mat4* m, float zn, float zf);
     static bool selectDistantCell();
     static bool isDistantCell();
     static void resolveDynamicVisGroups();
@@ -185,6 +192,8 @@ public:
 
     static void renderDistantLand(ID3DXEffect* e, const D3DXMATRIX* view, const D3DXMATRIX* proj);
     static void renderDistantLandZ();
+    static DistantStaticTrees currentStaticTrees();
+    static DistantCullRanges cullRanges();
     static void cullDistantStatics(const D3DXMATRIX* view, const D3DXMATRIX* proj);
     static void renderDistantStatics();
     static void cullGrass(const D3DXMATRIX* view, const D3DXMATRIX* proj);
@@ -205,12 +214,13 @@ public:
     static void renderDepthRecorded();
 
     static void renderShadowMap();
-    static void renderShadowLayer(int layer, float radius, const D3DXMATRIX* inverseCameraProj);
+    static void calcShadowLayer(int layer, float radius);
+    static void renderShadowLayer(int layer, const ViewFrustum& frustum, const D3DXMATRIX* inverseCameraProj);
     static void renderShadow();
     static void renderShadowDebug();
 
     static void postProcess();
-    static void updatePostShader(MGEShader* shader);
+    static void updatePostShader(MGEShaderFrameVars* shader);
 
     static void requestCapture(std::function<void(IDirect3DSurface9*)> handler, bool captureWithUI);
     static void checkCaptureScreenshot(bool isUIDrawn);
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "dlmath.h"
+#include <cstdint>
 #include <vector>
 
 enum StaticType {
@@ -23,7 +25,7 @@ struct LandMesh {
 
 struct DistantSubset {
     BoundingSphere sphere;
-    D3DXVECTOR3 aabbMin, aabbMax;       // corners of the axis-aligned bounding box
+    vec3 aabbMin, aabbMax;       // corners of the axis-aligned bounding box
     IDirect3DTexture9* tex;
     bool hasAlpha, hasUVController;
     IDirect3DVertexBuffer9* vbuffer;
@@ -35,28 +37,28 @@ struct DistantSubset {
 struct DistantStatic {
     unsigned char type;
     BoundingSphere sphere;
-    D3DXVECTOR3 aabbMin, aabbMax;       // corners of the axis-aligned bounding box
+    vec3 aabbMin, aabbMax;       // corners of the axis-aligned bounding box
     std::vector<DistantSubset> subsets;
 };
 
 struct UsedDistantStatic {
     DWORD staticRef;
     uint16_t visIndex;
-    D3DXVECTOR3 pos;
+    vec3 pos;
     float scale;
-    D3DXMATRIX transform;
+    mat4x3 transform;
     BoundingSphere sphere;      // post-transform
     BoundingBox box;            // post-transform
 
     BoundingSphere GetBoundingSphere(const BoundingSphere& base) const {
         BoundingSphere sphere;
-        D3DXVec3TransformCoord(&sphere.center, &base.center, &transform);
+        sphere.center = transform.transformPoint(base.center);
         sphere.radius = base.radius * scale;
 
         return sphere;
     }
 
-    BoundingBox GetBoundingBox(const D3DXVECTOR3& aabbMin, const D3DXVECTOR3& aabbMax) const {
+    BoundingBox GetBoundingBox(const vec3& aabbMin, const vec3& aabbMax) const {
         BoundingBox box;
         box.Set(aabbMin, aabbMax);
         box.Transform(transform);
@@ -1,8 +1,14 @@
 
 #include "dlmath.h"
 
+#include <cfloat>
 #include <cmath>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DLMATH_SSE2
+#include <emmintrin.h>
+#endif
+
 //-----------------------------------------------------------------------------
 // BoundingSphere class
 //-----------------------------------------------------------------------------
@@ -37,8 +43,8 @@ BoundingSphere& BoundingSphere::operator+=(const BoundingSphere& rh) {
     // This will be defined as returning the minimum bounding sphere which contains the two spheres being added together
 
     BoundingSphere result;
-    D3DXVECTOR3 vect = rh.center - center;
-    float dist = D3DXVec3Length(&vect);
+    vec3 vect = rh.center - center;
+    float dist = length(vect);
 
     // Check if the sphere centers are almost the same, or if either radius is zero
     if (dist <= 0.001f || radius == 0.0f || rh.radius == 0.0f) {
@@ -66,9 +72,8 @@ BoundingSphere& BoundingSphere::operator+=(const BoundingSphere& rh) {
         // center is on the line c0 + coef * norm_vec
         // where coef = (dist + r1 - r0) / 2
 
-        D3DXVECTOR3 norm_vect;
         result.radius = 0.5f * (dist + radius + rh.radius);
-        D3DXVec3Normalize(&norm_vect, &vect);
+        vec3 norm_vect = normalize(vect);
 
         float coef = 0.5f * (dist + rh.radius - radius);
         result.center = center + coef * norm_vect;
@@ -91,7 +96,7 @@ BoundingSphere BoundingSphere::operator+(const BoundingSphere& rh) {
 //-----------------------------------------------------------------------------
 
 BoundingBox::BoundingBox() {
-    center = D3DXVECTOR3(0.0, 0.0, 0.0);
+    center = vec3(0.0, 0.0, 0.0);
     vx = vy = vz = center;
 }
 
@@ -114,84 +119,89 @@ BoundingBox& BoundingBox::operator=(const BoundingBox& rh) {
 
 //-----------------------------------------------------------------------------
 
-BoundingBox::BoundingBox(const D3DXVECTOR3& min, const D3DXVECTOR3& max) {
+BoundingBox::BoundingBox(const vec3& min, const vec3& max) {
     Set(min, max);
 }
 
 //-----------------------------------------------------------------------------
 
-void BoundingBox::Set(const D3DXVECTOR3& min, const D3DXVECTOR3& max) {
+void BoundingBox::Set(const vec3& min, const vec3& max) {
     center = 0.5f * (min + max);
-    vx = D3DXVECTOR3(0.5f * (max.x - min.x), 0, 0);
-    vy = D3DXVECTOR3(0, 0.5f * (max.y - min.y), 0);
-    vz = D3DXVECTOR3(0, 0, 0.5f * (max.z - min.z));
+    vx = vec3(0.5f * (max.x - min.x), 0, 0);
+    vy = vec3(0, 0.5f * (max.y - min.y), 0);
+    vz = vec3(0, 0, 0.5f * (max.z - min.z));
 }
 
 //-----------------------------------------------------------------------------
 
-void BoundingBox::Transform(const D3DXMATRIX& m) {
-    D3DXVec3TransformCoord(&center, &center, &m);
-    D3DXVec3TransformNormal(&vx, &vx, &m);
-    D3DXVec3TransformNormal(&vy, &vy, &m);
-    D3DXVec3TransformNormal(&vz, &vz, &m);
+void BoundingBox::Transform(const mat4x3& m) {
+    center = m.transformPoint(center);
+    vx = m.transformNormal(vx);
+    vy = m.transformNormal(vy);
+    vz = m.transformNormal(vz);
 }
 
 //-----------------------------------------------------------------------------
 // ViewFrustum class
 //-----------------------------------------------------------------------------
 
-ViewFrustum::ViewFrustum(const D3DXMATRIX* viewProj) {
-    // Near plane
-    frustum[0].a = viewProj->_13;
-    frustum[0].b = viewProj->_23;
-    frustum[0].c = viewProj->_33;
-    frustum[0].d = viewProj->_43;
-
-    // Far plane
-    frustum[1].a = viewProj->_14 - viewProj->_13;
-    frustum[1].b = viewProj->_24 - viewProj->_23;
-    frustum[1].c = viewProj->_34 - viewProj->_33;
-    frustum[1].d = viewProj->_44 - viewProj->_43;
-
-    // Left plane
-    frustum[2].a = viewProj->_14 + viewProj->_11;
-    frustum[2].b = viewProj->_24 + viewProj->_21;
-    frustum[2].c = viewProj->_34 + viewProj->_31;
-    frustum[2].d = viewProj->_44 + viewProj->_41;
-
-    // Right plane
-    frustum[3].a = viewProj->_14 - viewProj->_11;
-    frustum[3].b = viewProj->_24 - viewProj->_21;
-    frustum[3].c = viewProj->_34 - viewProj->_31;
-    frustum[3].d = viewProj->_44 - viewProj->_41;
-
-    // Top plane
-    frustum[4].a = viewProj->_14 - viewProj->_12;
-    frustum[4].b = viewProj->_24 - viewProj->_22;
-    frustum[4].c = viewProj->_34 - viewProj->_32;
-    frustum[4].d = viewProj->_44 - viewProj->_42;
-
-    // Bottom plane
-    frustum[5].a = viewProj->_14 + viewProj->_12;
-    frustum[5].b = viewProj->_24 + viewProj->_22;
-    frustum[5].c = viewProj->_34 + viewProj->_32;
-    frustum[5].d = viewProj->_44 + viewProj->_42;
-
-    // Normalize planes
-    for (size_t f = 0; f < 6; ++f) {
-        D3DXPLANE temp(frustum[f]);
-        D3DXPlaneNormalize(&frustum[f], &temp);
+ViewFrustum::ViewFrustum(const mat4& viewProj) {
+    plane planes[6];
+    extractFrustumPlanes(viewProj, planes);
+    SetPlanes(planes);
+}
+
+//-----------------------------------------------------------------------------
+
+ViewFrustum::ViewFrustum(const plane planes[6]) {
+    SetPlanes(planes);
+}
+
+//-----------------------------------------------------------------------------
+
+void ViewFrustum::SetPlanes(const plane planes[6]) {
+    for (size_t i = 0; i != 6; ++i) {
+        frustum[i] = planes[i];
+    }
+
+    for (size_t i = 0; i != 8; ++i) {
+        plane p = (i < 6) ? frustum[i] : plane(0, 0, 0, FLT_MAX);
+        planesSoA[i / 4][0][i % 4] = p.a;
+        planesSoA[i / 4][1][i % 4] = p.b;
+        planesSoA[i / 4][2][i % 4] = p.c;
+        planesSoA[i / 4][3][i % 4] = p.d;
     }
 }
 
 //-----------------------------------------------------------------------------
 
 ViewFrustum::Containment ViewFrustum::ContainsSphere(const BoundingSphere& sphere) const {
+#ifdef DLMATH_SSE2
+    // Same arithmetic order as plane::dotCoord, so results match the scalar path exactly
+    __m128 x = _mm_set1_ps(sphere.center.x), y = _mm_set1_ps(sphere.center.y), z = _mm_set1_ps(sphere.center.z);
+    __m128 r = _mm_set1_ps(sphere.radius), zero = _mm_setzero_ps();
+    __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    int outside = 0, intersects = 0;
+
+    for (size_t g = 0; g != 2; ++g) {
+        const float (*p)[4] = planesSoA[g];
+        __m128 dist = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(p[0]), x), _mm_mul_ps(_mm_loadu_ps(p[1]), y));
+        dist = _mm_add_ps(_mm_add_ps(dist, _mm_mul_ps(_mm_loadu_ps(p[2]), z)), _mm_loadu_ps(p[3]));
+
+        outside |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(dist, r), zero));
+        intersects |= _mm_movemask_ps(_mm_cmplt_ps(_mm_and_ps(dist, absMask), r));
+    }
+
+    if (outside) {
+        return OUTSIDE;
+    }
+    return intersects ? INTERSECTS : INSIDE;
+#else
     float dist[6];
     size_t f;
 
     for (f = 0; f < 6; ++f) {
-        dist[f] = D3DXPlaneDotCoord(&frustum[f], &sphere.center);
+        dist[f] = frustum[f].dotCoord(sphere.center);
         if (dist[f] + sphere.radius < 0) {
             return OUTSIDE;
         }
@@ -204,6 +214,7 @@ ViewFrustum::Containment ViewFrustum::ContainsSphere(const BoundingSphere& spher
     }
 
     return INSIDE;
+#endif
 }
 
 //-----------------------------------------------------------------------------
@@ -211,12 +222,12 @@ ViewFrustum::Containment ViewFrustum::ContainsSphere(const BoundingSphere& spher
 ViewFrustum::Containment ViewFrustum::ContainsBox(const BoundingBox& box) const {
     // Do OBB-plane test for each frustum plane
     for (size_t f = 0; f < 6; ++f) {
-        D3DXVECTOR4 extent;
+        vec4 extent;
 
-        extent.x = std::fabs(D3DXPlaneDotNormal(&frustum[f], &box.vx));
-        extent.y = std::fabs(D3DXPlaneDotNormal(&frustum[f], &box.vy));
-        extent.z = std::fabs(D3DXPlaneDotNormal(&frustum[f], &box.vz));
-        extent.w = D3DXPlaneDotCoord(&frustum[f], &box.center);
+        extent.x = std::fabs(frustum[f].dotNormal(box.vx));
+        extent.y = std::fabs(frustum[f].dotNormal(box.vy));
+        extent.z = std::fabs(frustum[f].dotNormal(box.vz));
+        extent.w = frustum[f].dotCoord(box.center);
 
         // Fail if centre + projected extents is outside the halfspace
         if (extent.w + extent.x + extent.y + extent.z < 0) {
@@ -230,3 +241,79 @@ ViewFrustum::Containment ViewFrustum::ContainsBox(const BoundingBox& box) const
 }
 
 //-----------------------------------------------------------------------------
+// Batch bounds transforms
+//-----------------------------------------------------------------------------
+
+void transformBoundingSpheres(const BoundingSphere* base, const mat4x3* transform, const float* scale, BoundingSphere* out, size_t count) {
+#ifdef DLMATH_SSE2
+    static_assert(sizeof(BoundingSphere) == 16 && sizeof(mat4x3) == 48, "batch layout");
+
+    for (size_t i = 0; i != count; ++i) {
+        // Matrix rows, with a spare fourth lane; the last row is loaded from the end of the matrix
+        const float* m = &transform[i]._11;
+        __m128 r1 = _mm_loadu_ps(m), r2 = _mm_loadu_ps(m + 3), r3 = _mm_loadu_ps(m + 6);
+        __m128 r4 = _mm_loadu_ps(m + 8);
+        r4 = _mm_shuffle_ps(r4, r4, _MM_SHUFFLE(3, 3, 2, 1));
+
+        const BoundingSphere& b = base[i];
+        float radius = b.radius * scale[i];
+        __m128 c = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(b.center.x), r1), _mm_mul_ps(_mm_set1_ps(b.center.y), r2));
+        c = _mm_add_ps(_mm_add_ps(c, _mm_mul_ps(_mm_set1_ps(b.center.z), r3)), r4);
+
+        // The spare lane lands on radius, which is written afterwards
+        _mm_storeu_ps(&out[i].center.x, c);
+        out[i].radius = radius;
+    }
+#else
+    for (size_t i = 0; i != count; ++i) {
+        out[i].center = transform[i].transformPoint(base[i].center);
+        out[i].radius = base[i].radius * scale[i];
+    }
+#endif
+}
+
+//-----------------------------------------------------------------------------
+
+void transformBoundingBoxes(const vec3* aabbMin, const vec3* aabbMax, const mat4x3* transform, BoundingBox* out, size_t count) {
+#ifdef DLMATH_SSE2
+    static_assert(sizeof(BoundingBox) == 48, "batch layout");
+    const __m128 half = _mm_set1_ps(0.5f);
+
+    for (size_t i = 0; i != count; ++i) {
+        const float* m = &transform[i]._11;
+        __m128 r1 = _mm_loadu_ps(m), r2 = _mm_loadu_ps(m + 3), r3 = _mm_loadu_ps(m + 6);
+        __m128 r4 = _mm_loadu_ps(m + 8);
+        r4 = _mm_shuffle_ps(r4, r4, _MM_SHUFFLE(3, 3, 2, 1));
+
+        const vec3& lo = aabbMin[i], &hi = aabbMax[i];
+        float cx = 0.5f * (lo.x + hi.x), cy = 0.5f * (lo.y + hi.y), cz = 0.5f * (lo.z + hi.z);
+        __m128 c = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(cx), r1), _mm_mul_ps(_mm_set1_ps(cy), r2));
+        c = _mm_add_ps(_mm_add_ps(c, _mm_mul_ps(_mm_set1_ps(cz), r3)), r4);
+
+        // Each axis is a half extent along one basis vector, so its transform is a scaled matrix row
+        __m128 vx = _mm_mul_ps(_mm_mul_ps(half, _mm_set1_ps(hi.x - lo.x)), r1);
+        __m128 vy = _mm_mul_ps(_mm_mul_ps(half, _mm_set1_ps(hi.y - lo.y)), r2);
+        __m128 vz = _mm_mul_ps(_mm_mul_ps(half, _mm_set1_ps(hi.z - lo.z)), r3);
+
+        // Overlapping stores in order, so each spare lane is overwritten by the next vector
+        BoundingBox& box = out[i];
+        _mm_storeu_ps(&box.center.x, c);
+        _mm_storeu_ps(&box.vx.x, vx);
+        _mm_storeu_ps(&box.vy.x, vy);
+        _mm_storel_pi(reinterpret_cast<__m64*>(&box.vz.x), vz);
+        _mm_store_ss(&box.vz.z, _mm_movehl_ps(vz, vz));
+    }
+#else
+    for (size_t i = 0; i != count; ++i) {
+        out[i].Set(aabbMin[i], aabbMax[i]);
+        out[i].Transform(transform[i]);
+    }
+#endif
+}
+
+//-----------------------------------------------------------------------------
+
+void editProjectionZ(mat4* m, float zn, float zf) {
+    m->_33 = zf / (zf - zn);
+    m->_43 = -zn * zf / (zf - zn);
+}
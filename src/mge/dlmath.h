@@ -1,13 +1,12 @@
 #pragma once
 
-#define D3DXFX_LARGEADDRESS_HANDLE
-
-#include "d3dx9math.h"
+#include "support/d3dxportable.h"
+#include "support/vecmath.h"
 
 
 
 struct BoundingSphere {
-    D3DXVECTOR3 center;
+    vec3 center;
     float radius;
 
     BoundingSphere();
@@ -23,24 +22,64 @@ struct BoundingSphere {
 
 
 struct BoundingBox {
-    D3DXVECTOR3 center, vx, vy, vz;
+    vec3 center, vx, vy, vz;
 
     BoundingBox();
     BoundingBox(const BoundingBox& rh);
 
     BoundingBox& operator=(const BoundingBox& rh);
-    BoundingBox(const D3DXVECTOR3& min, const D3DXVECTOR3& max);
-    void Set(const D3DXVECTOR3& min, const D3DXVECTOR3& max);
-    void Transform(const D3DXMATRIX& m);
+    BoundingBox(const vec3& min, const vec3& max);
+    void Set(const vec3& min, const vec3& max);
+    void Transform(const mat4x3& m);
 };
 
 
 struct ViewFrustum {
-    D3DXPLANE frustum[6];
+    plane frustum[6];
     enum Containment { INSIDE, OUTSIDE, INTERSECTS };
 
-    ViewFrustum(const D3DXMATRIX* viewProj);
+    // Planes transposed into two groups of four (a, b, c, d), for testing four planes at once.
+    // The last two slots hold planes that never reject.
+    float planesSoA[2][4][4];
+
+    ViewFrustum(const mat4& viewProj);
+    // From planes already extracted with extractFrustumPlanes, e.g. in a batch
+    explicit ViewFrustum(const plane planes[6]);
 
     Containment ContainsSphere(const BoundingSphere& sphere) const;
     Containment ContainsBox(const BoundingBox& box) const;
+
+private:
+    void SetPlanes(const plane planes[6]);
 };
+
+
+// Batch bounds transforms, for bounding many placed objects at once.
+// Element i of each array belongs to object i. Results are identical to the per-object
+// BoundingSphere/BoundingBox code, apart from the sign of zero in box axes.
+
+// transformBoundingSpheres - base[i] placed by transform[i], with the radius multiplied by scale[i]
+void transformBoundingSpheres(const BoundingSphere* base, const mat4x3* transform, const float* scale, BoundingSphere* out, size_t count);
+// transformBoundingBoxes - Box from aabbMin[i] to aabbMax[i] placed by transform[i]
+void transformBoundingBoxes(const vec3* aabbMin, const vec3* aabbMax, const mat4x3* transform, BoundingBox* out, size_t count);
+
+// editProjectionZ - Override the near and far clip planes of a perspective projection
+void editProjectionZ(mat4* m, float zn, float zf);
+
+
+#ifdef _WIN32
+// Layout compatible views between the math library and D3DX, for passing culling data to and from D3D.
+// Pointers rather than references, so that a D3DMATRIX cannot silently convert through a temporary.
+static_assert(sizeof(vec3) == sizeof(D3DXVECTOR3) && sizeof(vec4) == sizeof(D3DXVECTOR4), "vector layout");
+static_assert(sizeof(plane) == sizeof(D3DXPLANE) && sizeof(mat4) == sizeof(D3DXMATRIX), "plane/matrix layout");
+
+inline const D3DXVECTOR3* toD3DX(const vec3* v) { return reinterpret_cast<const D3DXVECTOR3*>(v); }
+inline const D3DXVECTOR4* toD3DX(const vec4* v) { return reinterpret_cast<const D3DXVECTOR4*>(v); }
+inline const D3DXPLANE* toD3DX(const plane* p) { return reinterpret_cast<const D3DXPLANE*>(p); }
+inline const D3DXMATRIX* toD3DX(const mat4* m) { return reinterpret_cast<const D3DXMATRIX*>(m); }
+
+inline const vec3* fromD3DX(const D3DXVECTOR3* v) { return reinterpret_cast<const vec3*>(v); }
+inline const vec4* fromD3DX(const D3DXVECTOR4* v) { return reinterpret_cast<const vec4*>(v); }
+inline const mat4* fromD3DX(const D3DXMATRIX* m) { return reinterpret_cast<const mat4*>(m); }
+inline mat4* fromD3DX(D3DXMATRIX* m) { return reinterpret_cast<mat4*>(m); }
+#endif
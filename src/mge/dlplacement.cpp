@@ -0,0 +1,235 @@
+
+#include "dlplacement.h"
+
+#include <algorithm>
+#include <cfloat>
+
+
+
+// selectTree - Quadtree receiving an instance, or nullptr for unknown static types
+static QuadTree* selectTree(const DistantStaticTrees& trees, const DistantStaticRanges& ranges, unsigned char type, float radius) {
+    // Buildings are treated as larger objects, as they are typically
+    // smaller component meshes combined to make a single building
+    if (type == STATIC_BUILDING) {
+        radius *= 2.0f;
+    }
+
+    switch (type) {
+    case STATIC_AUTO:
+    case STATIC_TREE:
+    case STATIC_BUILDING:
+        if (radius <= ranges.farStaticMinSize) {
+            return trees.nearStatics;
+        } else if (radius <= ranges.veryFarStaticMinSize) {
+            return trees.farStatics;
+        } else {
+            return trees.veryFarStatics;
+        }
+
+    case STATIC_GRASS:
+        return trees.grassStatics;
+
+    case STATIC_NEAR:
+        return trees.nearStatics;
+
+    case STATIC_FAR:
+        return trees.farStatics;
+
+    case STATIC_VERY_FAR:
+        return trees.veryFarStatics;
+    }
+
+    return nullptr;
+}
+
+// boundDistantStatics - Streams instances through the batch transforms in blocks small enough to stay in cache
+void boundDistantStatics(const std::vector<DistantStatic>& distantStatics, UsedDistantStatic* uds, size_t count) {
+    const size_t blockSize = 64;
+    BoundingSphere spheres[blockSize];
+    BoundingBox boxes[blockSize];
+    vec3 aabbMin[blockSize], aabbMax[blockSize];
+    mat4x3 transforms[blockSize];
+    float scales[blockSize];
+
+    for (size_t first = 0; first < count; first += blockSize) {
+        size_t n = std::min(blockSize, count - first);
+        UsedDistantStatic* block = uds + first;
+
+        for (size_t i = 0; i != n; ++i) {
+            const DistantStatic* stat = &distantStatics[block[i].staticRef];
+            spheres[i] = stat->sphere;
+            aabbMin[i] = stat->aabbMin;
+            aabbMax[i] = stat->aabbMax;
+            transforms[i] = block[i].transform;
+            scales[i] = block[i].scale;
+        }
+
+        transformBoundingSpheres(spheres, transforms, scales, spheres, n);
+        transformBoundingBoxes(aabbMin, aabbMax, transforms, boxes, n);
+
+        for (size_t i = 0; i != n; ++i) {
+            block[i].sphere = spheres[i];
+            block[i].box = boxes[i];
+        }
+    }
+}
+
+// placeDistantStatics - Fill quadtrees with the sub-meshes of every instance in a worldspace
+size_t placeDistantStatics(const DistantStaticTrees& trees, const DistantStaticRanges& ranges,
+                           const std::vector<DistantStatic>& distantStatics, const std::vector<UsedDistantStatic>& uds,
+                           VisGroupMeshCallback visGroupMesh) {
+    QuadTree* allTrees[] = { trees.nearStatics, trees.farStatics, trees.veryFarStatics, trees.grassStatics };
+
+    // Calclulate optimal initial quadtree size
+    vec2 aabbMax = vec2(-FLT_MAX, -FLT_MAX);
+    vec2 aabbMin = vec2(FLT_MAX, FLT_MAX);
+
+    // Find xyz bounds
+    for (const auto& i : uds) {
+        float x = i.pos.x, y = i.pos.y, r = i.sphere.radius;
+
+        aabbMax.x = std::max(x + r, aabbMax.x);
+        aabbMax.y = std::max(y + r, aabbMax.y);
+        aabbMin.x = std::min(aabbMin.x, x - r);
+        aabbMin.y = std::min(aabbMin.y, y - r);
+    }
+
+    size_t total_instances = 0;
+    float box_size = std::max(aabbMax.x - aabbMin.x, aabbMax.y - aabbMin.y);
+    vec2 box_center = 0.5f * (aabbMax + aabbMin);
+
+    for (QuadTree* tree : allTrees) {
+        tree->SetBox(box_size, box_center);
+    }
+
+    const size_t blockSize = 64;
+    BoundingSphere spheres[blockSize];
+    BoundingBox boxes[blockSize];
+    vec3 subsetMin[blockSize], subsetMax[blockSize];
+    mat4x3 transforms[blockSize];
+    float scales[blockSize];
+
+    for (const auto& i : uds) {
+        const DistantStatic* stat = &distantStatics[i.staticRef];
+
+        // Use post-transform (include scale) radius
+        QuadTree* targetQTR = selectTree(trees, ranges, stat->type, i.sphere.radius);
+        if (!targetQTR) {
+            continue;
+        }
+
+        // Add sub-meshes to appropriate quadtree, a block at a time
+        for (size_t first = 0; first < stat->subsets.size(); first += blockSize) {
+            size_t n = std::min(blockSize, stat->subsets.size() - first);
+            const DistantSubset* block = &stat->subsets[first];
+
+            if (stat->type == STATIC_BUILDING) {
+                // Use model bound so that all building parts have coherent visibility
+                std::fill(spheres, spheres + n, i.sphere);
+                std::fill(boxes, boxes + n, i.box);
+            } else {
+                // Use individual mesh bounds
+                for (size_t j = 0; j != n; ++j) {
+                    spheres[j] = block[j].sphere;
+                    subsetMin[j] = block[j].aabbMin;
+                    subsetMax[j] = block[j].aabbMax;
+                    transforms[j] = i.transform;
+                    scales[j] = i.scale;
+                }
+                transformBoundingSpheres(spheres, transforms, scales, spheres, n);
+                transformBoundingBoxes(subsetMin, subsetMax, transforms, boxes, n);
+            }
+
+            for (size_t j = 0; j != n; ++j) {
+                const DistantSubset& s = block[j];
+                auto mesh = targetQTR->AddMesh(
+                    spheres[j],
+                    boxes[j],
+                    i.transform,
+                    s.hasAlpha,
+                    s.hasUVController,
+                    s.tex,
+                    s.verts,
+                    s.vbuffer,
+                    s.faces,
+                    s.ibuffer
+                );
+                if (i.visIndex > 0 && visGroupMesh) {
+                    visGroupMesh(i.visIndex, mesh);
+                }
+            }
+        }
+
+        total_instances += stat->subsets.size();
+    }
+
+    for (QuadTree* tree : allTrees) {
+        tree->Optimize();
+        tree->CalcVolume();
+    }
+
+    return total_instances;
+}
+
+void cullDistantStaticRanges(const DistantStaticTrees& trees, const DistantCullRanges& ranges, const vec3& eyePos,
+                             const mat4& view, const mat4& proj, VisibleSet& visible) {
+    QuadTree* rangeTrees[] = { trees.nearStatics, trees.farStatics, trees.veryFarStatics };
+    const float rangeEnds[] = { ranges.nearStaticEnd, ranges.farStaticEnd, ranges.veryFarStaticEnd };
+    mat4 ds_proj = proj, ds_viewproj[3];
+    plane range_planes[3][6];
+    float range_zf[3];
+    QuadTree* range_tree[3];
+    size_t n = 0;
+    vec4 viewsphere(eyePos.x, eyePos.y, eyePos.z, 0);
+    float zn = ranges.nearViewRange - 768.0f;
+    float cullDist = ranges.fogEnd;
+
+    visible.RemoveAll();
+
+    // Collect the ranges that reach past the near view, and extract their frusta together
+    for (size_t r = 0; r != 3; ++r) {
+        float zf = std::min(rangeEnds[r], cullDist);
+        if (zn < zf) {
+            editProjectionZ(&ds_proj, zn, zf);
+            ds_viewproj[n] = view * ds_proj;
+            range_zf[n] = zf;
+            range_tree[n] = rangeTrees[r];
+            ++n;
+        }
+    }
+
+    extractFrustumPlanes(ds_viewproj, range_planes, n);
+
+    for (size_t r = 0; r != n; ++r) {
+        ViewFrustum range_frustum(range_planes[r]);
+        viewsphere.w = range_zf[r];
+        range_tree[r]->GetVisibleMeshes(range_frustum, viewsphere, visible);
+    }
+
+    visible.SortByState();
+}
+
+bool cullGrassRange(const DistantStaticTrees& trees, const DistantCullRanges& ranges,
+                    const mat4& view, const mat4& proj, VisibleSet& visible) {
+    mat4 ds_proj = proj, ds_viewproj;
+    float zn = 4.0f, zf = ranges.nearViewRange;
+
+    // Don't draw beyond fully fogged distance; early out if frustum is empty
+    if (!ranges.grassIgnoresFog) {
+        zf = std::min(ranges.fogEnd, zf);
+    }
+    if (zf <= zn) {
+        return false;
+    }
+
+    // Create a clipping frustum for visibility determination
+    editProjectionZ(&ds_proj, zn, zf);
+    ds_viewproj = view * ds_proj;
+
+    // Cull and sort
+    ViewFrustum range_frustum(ds_viewproj);
+    visible.RemoveAll();
+    trees.grassStatics->GetVisibleMeshesCoarse(range_frustum, visible);
+    visible.SortByState();
+    return true;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "dlformat.h"
+#include "quadtree.h"
+
+
+
+// Quadtrees receiving the statics of one worldspace, by draw range
+struct DistantStaticTrees {
+    QuadTree* nearStatics;
+    QuadTree* farStatics;
+    QuadTree* veryFarStatics;
+    QuadTree* grassStatics;
+};
+
+// Size thresholds (post-transform radius) for automatic range selection
+struct DistantStaticRanges {
+    float farStaticMinSize;
+    float veryFarStaticMinSize;
+};
+
+// Called for each mesh added on behalf of an instance in a dynamic vis group
+typedef void (*VisGroupMeshCallback)(uint16_t visIndex, QuadTreeMesh* mesh);
+
+// Sets the post-transform sphere and box of count instances from their transforms, in one batch
+void boundDistantStatics(const std::vector<DistantStatic>& distantStatics, UsedDistantStatic* uds, size_t count);
+
+// Places instances into the trees by type and size, then optimizes the trees. Returns number of meshes added.
+// Portable, so that offline tools build exactly the trees the game does.
+size_t placeDistantStatics(const DistantStaticTrees& trees, const DistantStaticRanges& ranges,
+                           const std::vector<DistantStatic>& distantStatics, const std::vector<UsedDistantStatic>& uds,
+                           VisGroupMeshCallback visGroupMesh);
+
+// Draw distances for culling distant statics and grass, in world units
+struct DistantCullRanges {
+    float nearViewRange;            // Morrowind's view range, where distant statics begin
+    float fogEnd;                   // Fully fogged distance
+    float nearStaticEnd, farStaticEnd, veryFarStaticEnd;
+    bool grassIgnoresFog;           // Exponential fog, grass is drawn to the view range
+};
+
+// Culls the near, far and very far trees to their ranges from the eye, then sorts the visible set by state.
+// Portable, so that offline tools cull exactly as the game does.
+void cullDistantStaticRanges(const DistantStaticTrees& trees, const DistantCullRanges& ranges, const vec3& eyePos,
+                             const mat4& view, const mat4& proj, VisibleSet& visible);
+
+// Culls the grass tree up to the near view range and sorts the visible set by state.
+// Returns false, leaving the visible set unchanged, if fog hides all grass.
+bool cullGrassRange(const DistantStaticTrees& trees, const DistantCullRanges& ranges,
+                    const mat4& view, const mat4& proj, VisibleSet& visible);
@@ -0,0 +1,138 @@
+
+#include "effectvariables.h"
+#include "support/stringinterner.h"
+
+#include <cstring>
+
+
+
+static StringInterner variableNames;
+
+
+
+// reset - Drop cached handles and pending writes, on effect load, reload or release
+void EffectVariables::reset(ID3DXEffect* e) {
+    effect = e;
+    handles.clear();
+    pendingIndex.clear();
+    pending.clear();
+}
+
+// find - Parameter handle by name, looked up in the effect once. Missing names are cached as null.
+D3DXHANDLE EffectVariables::find(const char* name) {
+    if (!effect) {
+        return nullptr;
+    }
+
+    return find(variableNames.intern(name));
+}
+
+D3DXHANDLE EffectVariables::find(int nameId) {
+    if (size_t(nameId) >= handles.size()) {
+        handles.resize(variableNames.size(), Handle { nullptr, false });
+    }
+
+    Handle& h = handles[nameId];
+    if (!h.resolved) {
+        h.handle = effect->GetParameterByName(0, variableNames.name(nameId));
+        h.resolved = true;
+    }
+    return h.handle;
+}
+
+// access - Handle for getting or setting a variable on the effect directly.
+// Pending writes are applied first, so that reads see them and direct writes are not overwritten by them later.
+D3DXHANDLE EffectVariables::access(const char* name) {
+    flush();
+    return find(name);
+}
+
+// flush - Apply pending writes to the effect
+void EffectVariables::flush() {
+    for (const auto& w : pending) {
+        switch (w.type) {
+        case WriteBool:
+            effect->SetBool(w.handle, w.b);
+            break;
+        case WriteInt:
+            effect->SetInt(w.handle, w.i);
+            break;
+        case WriteFloat:
+            effect->SetFloat(w.handle, w.f[0]);
+            break;
+        case WriteFloatArray:
+            effect->SetFloatArray(w.handle, w.f, w.count);
+            break;
+        }
+        pendingIndex[w.nameId] = -1;
+    }
+
+    pending.clear();
+}
+
+// queue - Record a write, replacing any earlier write to the same variable this frame
+bool EffectVariables::queue(const char* name, Write& w) {
+    if (!effect) {
+        return false;
+    }
+
+    w.nameId = variableNames.intern(name);
+    w.handle = find(w.nameId);
+    if (!w.handle) {
+        return false;
+    }
+
+    if (size_t(w.nameId) >= pendingIndex.size()) {
+        pendingIndex.resize(variableNames.size(), -1);
+    }
+
+    int& i = pendingIndex[w.nameId];
+    if (i >= 0) {
+        pending[i] = w;
+    } else {
+        i = int(pending.size());
+        pending.push_back(w);
+    }
+    return true;
+}
+
+bool EffectVariables::setBool(const char* name, bool b) {
+    Write w;
+    w.type = WriteBool;
+    w.count = 1;
+    w.b = b;
+    return queue(name, w);
+}
+
+bool EffectVariables::setInt(const char* name, int x) {
+    Write w;
+    w.type = WriteInt;
+    w.count = 1;
+    w.i = x;
+    return queue(name, w);
+}
+
+bool EffectVariables::setFloat(const char* name, float x) {
+    Write w;
+    w.type = WriteFloat;
+    w.count = 1;
+    w.f[0] = x;
+    return queue(name, w);
+}
+
+// setFloatArray - Deferred for up to 4 floats, larger arrays are written immediately after pending writes
+bool EffectVariables::setFloatArray(const char* name, const float* v, int n) {
+    if (n > 4) {
+        D3DXHANDLE h = access(name);
+        if (!h) {
+            return false;
+        }
+        return effect->SetFloatArray(h, v, n) == D3D_OK;
+    }
+
+    Write w;
+    w.type = WriteFloatArray;
+    w.count = n;
+    std::memcpy(w.f, v, n * sizeof(float));
+    return queue(name, w);
+}
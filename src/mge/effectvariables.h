@@ -0,0 +1,57 @@
+#pragma once
+
+#ifdef _WIN32
+#include "proxydx/d3d9header.h"
+#else
+#include "support/d3dxportable.h"
+#endif
+
+#include <cstdint>
+
+#include <vector>
+
+
+
+// Per-effect cache of parameter handles by name, for script-driven variables
+// Names are interned once into IDs shared by all effects, and handles are cached in an array indexed by name ID
+// Scalar and vector writes are deferred and applied once per frame by flush(), the last write to a variable winning
+class EffectVariables {
+public:
+    void reset(ID3DXEffect* e);
+    D3DXHANDLE find(const char* name);
+    D3DXHANDLE access(const char* name);
+    void flush();
+
+    bool setBool(const char* name, bool b);
+    bool setInt(const char* name, int x);
+    bool setFloat(const char* name, float x);
+    bool setFloatArray(const char* name, const float* v, int n);
+
+private:
+    enum WriteType : uint8_t { WriteBool, WriteInt, WriteFloat, WriteFloatArray };
+
+    struct Handle {
+        D3DXHANDLE handle;
+        bool resolved;
+    };
+
+    struct Write {
+        D3DXHANDLE handle;
+        int nameId;
+        WriteType type;
+        int count;
+        union {
+            BOOL b;
+            int i;
+            float f[4];
+        };
+    };
+
+    ID3DXEffect* effect = nullptr;
+    std::vector<Handle> handles;        // By name ID
+    std::vector<int> pendingIndex;      // By name ID, index into pending or -1
+    std::vector<Write> pending;
+
+    D3DXHANDLE find(int nameId);
+    bool queue(const char* name, Write& w);
+};
@@ -1,6 +1,8 @@
 
 #include "ffeshader.h"
 #include "configuration.h"
+#include "dlmath.h"
+#include "profiler.h"
 #include "support/log.h"
 
 #include <algorithm>
@@ -16,6 +18,7 @@ IDirect3DDevice* FixedFunctionShader::device;
 ID3DXEffectPool* FixedFunctionShader::constantPool;
 unordered_map<FixedFunctionShader::ShaderKey, ID3DXEffect*, FixedFunctionShader::ShaderKey::hasher> FixedFunctionShader::cacheEffects;
 FixedFunctionShader::ShaderLRU FixedFunctionShader::shaderLRU;
+FixedFunctionShader::LightPackCache FixedFunctionShader::lightPackCache;
 ID3DXEffect* FixedFunctionShader::effectDefaultPurple;
 
 D3DXHANDLE FixedFunctionShader::ehWorld, FixedFunctionShader::ehWorldView;
@@ -88,6 +91,7 @@ bool FixedFunctionShader::init(IDirect3DDevice* d, ID3DXEffectPool* pool) {
     shaderLRU.effect = nullptr;
     shaderLRU.last_sk = ShaderKey();
     cacheEffects.clear();
+    lightPackCache.clear();
 
     // Pre-warm cache if any per-pixel mode is active
     if (Configuration.MGEFlags & USE_FFESHADER) {
@@ -208,93 +212,10 @@ void FixedFunctionShader::renderMorrowind(const RenderedState* rs, const Fragmen
     effectFFE->SetVector(ehMaterialAmbient, (D3DXVECTOR4*)&frs->material.ambient);
     effectFFE->SetVector(ehMaterialEmissive, (D3DXVECTOR4*)&frs->material.emissive);
 
-    // Set up lighting
-    const size_t MaxLights = 8;
-    D3DXVECTOR4 bufferDiffuse[MaxLights];
-    float bufferAmbient[MaxLights];
-    float bufferPosition[3 * MaxLights];
-    float bufferFalloffQuadratic[MaxLights], bufferFalloffLinear[MaxLights], bufferFalloffConstant;
-
-    memset(&bufferDiffuse, 0, sizeof(bufferDiffuse));
-    memset(&bufferAmbient, 0, sizeof(bufferAmbient));
-    memset(&bufferPosition, 0, sizeof(bufferPosition));
-    memset(&bufferFalloffQuadratic, 0, sizeof(bufferFalloffQuadratic));
-    memset(&bufferFalloffLinear, 0, sizeof(bufferFalloffLinear));
-    bufferFalloffConstant = 0.33;
-
-    // Check each active light
-    RGBVECTOR sunDiffuse(0, 0, 0), ambient = lightrs->globalAmbient;
-    size_t n = std::min(lightrs->active.size(), MaxLights), pointLightCount = 0;
-    for (; n --> 0; ) {
-        DWORD i = lightrs->active[n];
-        const LightState::Light* light = &lightrs->lights.find(i)->second;
-
-        // Transform to view space if not transformed this frame
-        if (lightrs->lightsTransformed.find(i) == lightrs->lightsTransformed.end()) {
-            if (light->type == D3DLIGHT_DIRECTIONAL) {
-                D3DXVec3TransformNormal((D3DXVECTOR3*)&light->viewspacePos, (D3DXVECTOR3*)&light->position, &rs->viewTransform);
-            } else {
-                D3DXVec3TransformCoord((D3DXVECTOR3*)&light->viewspacePos, (D3DXVECTOR3*)&light->position, &rs->viewTransform);
-            }
-
-            lightrs->lightsTransformed[i] = true;
-        }
-
-        if (light->type == D3DLIGHT_POINT) {
-            memcpy(&bufferDiffuse[pointLightCount], &light->diffuse, sizeof(light->diffuse));
-
-            // Scatter position vectors for vectorization
-            bufferPosition[pointLightCount] = light->viewspacePos.x;
-            bufferPosition[pointLightCount + MaxLights] = light->viewspacePos.y;
-            bufferPosition[pointLightCount + 2*MaxLights] = light->viewspacePos.z;
-
-            // Scatter attenuation factors for vectorization
-            if (light->falloff.x > 0) {
-                // Standard point light source (falloffConstant doesn't vary per light)
-                bufferFalloffConstant = light->falloff.x;
-                bufferFalloffLinear[pointLightCount] = light->falloff.y;
-                bufferFalloffQuadratic[pointLightCount] = light->falloff.z;
-            } else if (light->falloff.z > 0) {
-                // Probably a magic light source patched by Morrowind Code Patch
-                // Patched falloff calculation is quadratic only, which needs to be
-                // modified to account for the standard falloffConstant
-                // Diffuse colour is correctly specified with the patch
-                // Some overbrightness is applied to diffuse to cause glowing
-                bufferDiffuse[pointLightCount].x *= bufferFalloffConstant;
-                bufferDiffuse[pointLightCount].y *= bufferFalloffConstant;
-                bufferDiffuse[pointLightCount].z *= bufferFalloffConstant;
-                bufferAmbient[pointLightCount] = 1.0f + 1e-4f / sqrt(light->falloff.z);
-                bufferFalloffQuadratic[pointLightCount] = bufferFalloffConstant * light->falloff.z;
-            } else if (light->falloff.y == 0.10000001f) {
-                // Projectile light source, normally hard coded by Morrowind to { 0, 3 * (1/30), 0 }
-                // This falloff value cannot be produced by other magic effects
-                // Replacement falloff is significantly brighter to look cool
-                // Avoids modifying colour or position
-                bufferFalloffQuadratic[pointLightCount] = 5e-5;
-            } else if (light->falloff.y > 0) {
-                // Light magic effect, falloffs calculated by { 0, 3 / (22 * spell magnitude), 0 }
-                // A mix of ambient (falloff but no N.L component) and over-bright diffuse lighting
-                // It is approximated with a half-lambert weight + quadratic falloff
-                // Light colour is altered to avoid variable brightness from Morrowind bugs
-                // The point source is moved up slightly as it is often embedded in the ground
-                float brightness = 0.25f + 1e-4f / light->falloff.y;
-                bufferDiffuse[pointLightCount].x = brightness;
-                bufferDiffuse[pointLightCount].y = brightness;
-                bufferDiffuse[pointLightCount].z = brightness;
-                bufferAmbient[pointLightCount] = 1.0;
-                bufferFalloffQuadratic[pointLightCount] = 0.5555f * light->falloff.y * light->falloff.y;
-                bufferPosition[pointLightCount + 2*MaxLights] += 25.0;
-            }
-            ++pointLightCount;
-        } else if (light->type == D3DLIGHT_DIRECTIONAL) {
-            effectFFE->SetFloatArray(ehLightSunDirection, (const float*)&light->viewspacePos, 3);
-
-            sunDiffuse = light->diffuse;
-            ambient.r += light->ambient.x;
-            ambient.g += light->ambient.y;
-            ambient.b += light->ambient.z;
-        }
-    }
+    // Set up lighting, re-using packed light constants where the active light set is unchanged
+    const LightPack* lp = lightPackCache.select(lightrs, *fromD3DX(&rs->viewTransform));
+    RGBVECTOR sunDiffuse(lp->sunDiffuse.x, lp->sunDiffuse.y, lp->sunDiffuse.z);
+    RGBVECTOR ambient(lightrs->globalAmbient.r + lp->sunAmbient.x, lightrs->globalAmbient.g + lp->sunAmbient.y, lightrs->globalAmbient.b + lp->sunAmbient.z);
 
     // Apply light multipliers, for HDR light levels
     sunDiffuse *= sunMultiplier;
@@ -313,12 +234,20 @@ void FixedFunctionShader::renderMorrowind(const RenderedState* rs, const Fragmen
 
     effectFFE->SetFloatArray(ehLightSceneAmbient, ambient, 3);
     effectFFE->SetFloatArray(ehLightSunDiffuse, sunDiffuse, 3);
-    effectFFE->SetVectorArray(ehLightDiffuse, bufferDiffuse, MaxLights);
-    effectFFE->SetFloatArray(ehLightAmbient, bufferAmbient, MaxLights);
-    effectFFE->SetFloatArray(ehLightPosition, bufferPosition, 3 * MaxLights);
-    effectFFE->SetFloatArray(ehLightFalloffQuadratic, bufferFalloffQuadratic, MaxLights);
-    effectFFE->SetFloatArray(ehLightFalloffLinear, bufferFalloffLinear, MaxLights);
-    effectFFE->SetFloat(ehLightFalloffConstant, bufferFalloffConstant);
+
+    // Light parameters are shared through the effect pool, so only upload them when the pack changes
+    if (lp != lightPackCache.lastUploaded) {
+        if (lp->hasSun) {
+            effectFFE->SetFloatArray(ehLightSunDirection, (const float*)&lp->sunDirection, 3);
+        }
+        effectFFE->SetVectorArray(ehLightDiffuse, toD3DX(lp->diffuse), LightPack::MaxLights);
+        effectFFE->SetFloatArray(ehLightAmbient, lp->ambient, LightPack::MaxLights);
+        effectFFE->SetFloatArray(ehLightPosition, lp->position, 3 * LightPack::MaxLights);
+        effectFFE->SetFloatArray(ehLightFalloffQuadratic, lp->falloffQuadratic, LightPack::MaxLights);
+        effectFFE->SetFloatArray(ehLightFalloffLinear, lp->falloffLinear, LightPack::MaxLights);
+        effectFFE->SetFloat(ehLightFalloffConstant, lp->falloffConstant);
+        lightPackCache.lastUploaded = lp;
+    }
 
     // Bump mapping state
     if (sk.usesBumpmap) {
@@ -366,6 +295,7 @@ void FixedFunctionShader::renderMorrowind(const RenderedState* rs, const Fragmen
 }
 
 ID3DXEffect* FixedFunctionShader::generateMWShader(const ShaderKey& sk) {
+    Profiler::Scope profile(Profiler::ZoneFFECompile);
     string genVBCoupling, genPSCoupling, genTransform, genTexcoords, genVertexColour, genLightCount, genMaterial, genTexturing, genFog;
     stringstream buf;
 
@@ -728,6 +658,7 @@ void FixedFunctionShader::release() {
     shaderLRU.effect = nullptr;
     shaderLRU.last_sk = ShaderKey();
     cacheEffects.clear();
+    lightPackCache.clear();
     effectDefaultPurple->Release();
 }
 
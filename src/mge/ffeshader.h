@@ -1,67 +1,14 @@
 #pragma once
 
 #include "proxydx/d3d8header.h"
+#include "lightpack.h"
+#include "proxystate.h"
 
 #include <unordered_map>
 #include <vector>
 
 
 
-struct RenderedState {
-    IDirect3DTexture9* texture;
-    IDirect3DVertexBuffer9* vb;
-    UINT vbOffset, vbStride;
-    IDirect3DIndexBuffer9* ib;
-    DWORD ibBase;
-    DWORD fvf;
-    DWORD zWrite, cullMode;
-    DWORD vertexBlendState;
-    D3DXMATRIX worldTransforms[4];
-    D3DXMATRIX viewTransform;
-    D3DXMATRIX worldViewTransforms[4];
-    D3DCOLORVALUE diffuseMaterial;
-    BYTE blendEnable, srcBlend, destBlend;
-    BYTE alphaTest, alphaFunc, alphaRef;
-    BYTE useLighting, useFog, matSrcDiffuse, matSrcEmissive;
-
-    D3DPRIMITIVETYPE primType;
-    UINT baseIndex, minIndex, vertCount, startIndex, primCount;
-};
-
-struct FragmentState {
-    struct Stage {
-        BYTE colorOp, colorArg1, colorArg2;
-        BYTE alphaOp, alphaArg1, alphaArg2;
-        BYTE colorArg0, alphaArg0, resultArg;
-        DWORD texcoordIndex;
-        DWORD texTransformFlags;
-        float bumpEnvMat[2][2];
-        float bumpLumiScale, bumpLumiBias;
-    } stage[8];
-
-    struct Material {
-        D3DCOLORVALUE diffuse, ambient, emissive;
-    } material;
-};
-
-struct LightState {
-    struct Light {
-        D3DLIGHTTYPE type;
-        D3DCOLORVALUE diffuse;
-        D3DVECTOR position;     // position / normalized direction
-        D3DVECTOR viewspacePos;
-        union {
-            D3DVECTOR falloff;  // constant, linear, quadratic
-            D3DVECTOR ambient;  // for directional lights
-        };
-    };
-
-    D3DCOLORVALUE globalAmbient;
-    std::unordered_map<DWORD, Light> lights;
-    std::unordered_map<DWORD, bool> lightsTransformed;
-    std::vector<DWORD> active;
-};
-
 class FixedFunctionShader {
     struct ShaderKey {
         DWORD uvSets : 4;
@@ -108,6 +55,7 @@ class FixedFunctionShader {
     static ID3DXEffectPool* constantPool;
     static std::unordered_map<ShaderKey, ID3DXEffect*, ShaderKey::hasher> cacheEffects;
     static ShaderLRU shaderLRU;
+    static LightPackCache lightPackCache;
     static ID3DXEffect* effectDefaultPurple;
 
     static D3DXHANDLE ehWorld, ehWorldView;
@@ -0,0 +1,175 @@
+
+#include "framesequence.h"
+#include "proxydx/d3d8header.h"
+#include "distantland.h"
+#include "screenshotqueue.h"
+#include "statusoverlay.h"
+#include "support/log.h"
+#include "support/sequencefile.h"
+#include "support/timing.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+
+
+
+namespace FrameSequence {
+    // Open sequence file, shared with pending captures so that it is closed after the last frame is written
+    struct Output {
+        SequenceWriter writer;
+        SRWLOCK lock;
+        std::string path;
+
+        Output() {
+            InitializeSRWLock(&lock);
+        }
+        ~Output();
+        bool writeFrame(DWORD index, __int64 timestamp, const void* pixels, UINT w, UINT h, UINT pitch);
+    };
+
+    // Staging slots held while recording; raw frames are written quickly, so a few are enough to absorb disk stalls
+    constexpr int stagingDepth = 4;
+
+    std::shared_ptr<Output> output;
+    int framesRemaining;            // Zero when recording until stopped
+    int interval;
+    int lastCaptureTime;
+    unsigned int lastMicroseconds;
+    __int64 elapsed;
+    DWORD nextIndex;
+    bool withUI;
+    bool capturePending;            // A capture request is queued with distant land and not yet served
+}
+
+static void captureFrame(IDirect3DSurface9* surface);
+
+// writeFrame - Append one frame, called from screenshot queue workers
+bool FrameSequence::Output::writeFrame(DWORD index, __int64 timestamp, const void* pixels, UINT w, UINT h, UINT pitch) {
+    AcquireSRWLockExclusive(&lock);
+    bool success = writer.writeFrame(index, timestamp, pixels, w, h, pitch);
+    ReleaseSRWLockExclusive(&lock);
+    return success;
+}
+
+// ~Output - Write the final header and close the file, on the render thread after the last pending frame
+FrameSequence::Output::~Output() {
+    if (!writer.isOpen()) {
+        return;
+    }
+
+    DWORD frames = writer.frames();
+    if (!writer.close()) {
+        LOG::logline("!! Frame sequence %s could not be finalised", path.c_str());
+    }
+    LOG::logline("-- Frame sequence %s closed, %lu frames", path.c_str(), frames);
+}
+
+// start - Begin recording to a new sequence file
+// With a frame count of zero, records until stopped; with an interval of zero, records every frame
+bool FrameSequence::start(const char* path, int frameCount, int intervalMs, bool captureWithUI) {
+    stop();
+
+    // Size is set at the first frame, and the header rewritten when closed
+    auto out = std::make_shared<Output>();
+    if (!out->writer.create(path)) {
+        LOG::logline("!! Frame sequence %s cannot be created", path);
+        return false;
+    }
+    out->path = path;
+
+    output = out;
+    framesRemaining = std::max(0, frameCount);
+    interval = std::max(0, intervalMs);
+    withUI = captureWithUI;
+    nextIndex = 0;
+    elapsed = 0;
+    lastCaptureTime = HighResolutionTimer::getMilliseconds() - interval;
+
+    LOG::logline("-- Frame sequence %s started", path);
+    StatusOverlay::setStatus("Recording frame sequence");
+    return true;
+}
+
+// stop - Stop recording; the file is closed once pending frames are written
+void FrameSequence::stop() {
+    if (!output) {
+        return;
+    }
+
+    output.reset();
+    ScreenshotQueue::preallocate(nullptr, 0);
+    StatusOverlay::setStatus("Frame sequence stopped");
+}
+
+bool FrameSequence::active() {
+    return bool(output);
+}
+
+// update - Called once per frame, requests a capture of the next frame when it is due
+void FrameSequence::update() {
+    if (!output) {
+        return;
+    }
+
+    int now = HighResolutionTimer::getMilliseconds();
+    if (now - lastCaptureTime >= interval) {
+        // Keep to the interval schedule unless a capture was missed entirely
+        lastCaptureTime = (interval > 0 && now - lastCaptureTime < 2 * interval) ? lastCaptureTime + interval : now;
+
+        // Capture requests queue alongside screenshots; a frame still waiting to be captured is not requested twice
+        if (!capturePending) {
+            DistantLand::requestCapture(&captureFrame, withUI);
+            capturePending = true;
+        }
+    }
+}
+
+// captureFrame - Queue a copy of the frame, it is read back and written by screenshot queue workers
+static void captureFrame(IDirect3DSurface9* surface) {
+    using namespace FrameSequence;
+
+    capturePending = false;
+    if (!output || !surface) {
+        return;
+    }
+
+    D3DSURFACE_DESC desc;
+    surface->GetDesc(&desc);
+
+    // Timestamps accumulate 32-bit timer differences, so they do not wrap
+    unsigned int now = unsigned(HighResolutionTimer::getMicroseconds());
+    if (nextIndex == 0) {
+        output->writer.setSize(desc.Width, desc.Height);
+        ScreenshotQueue::preallocate(surface, stagingDepth);
+    } else {
+        elapsed += now - lastMicroseconds;
+    }
+    lastMicroseconds = now;
+
+    if (desc.Width != output->writer.width() || desc.Height != output->writer.height()) {
+        LOG::logline("!! Frame sequence stopped, resolution changed");
+        stop();
+        return;
+    }
+
+    auto out = output;
+    DWORD index = nextIndex++;
+    __int64 timestamp = elapsed;
+    auto sink = [out, index, timestamp](const void* pixels, UINT w, UINT h, UINT pitch) {
+        return out->writeFrame(index, timestamp, pixels, w, h, pitch);
+    };
+    auto onComplete = [index](bool success) {
+        if (!success) {
+            LOG::logline("!! Frame sequence failed to write frame %lu", index);
+        }
+    };
+
+    if (!ScreenshotQueue::submitRaw(surface, sink, onComplete)) {
+        LOG::logline("!! Frame sequence failed to capture frame %lu", index);
+    }
+
+    if (framesRemaining > 0 && --framesRemaining == 0) {
+        stop();
+    }
+}
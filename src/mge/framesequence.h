@@ -0,0 +1,10 @@
+#pragma once
+
+// Frame sequence capture, for benchmarking and visual comparison
+// Records every frame, or a frame every interval, as raw pixels to a sequence file that is encoded offline
+namespace FrameSequence {
+    bool start(const char* path, int frameCount, int intervalMs, bool captureWithUI);
+    void stop();
+    bool active();
+    void update();
+};
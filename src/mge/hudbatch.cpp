@@ -0,0 +1,57 @@
+
+#include "hudbatch.h"
+
+#include <algorithm>
+#include <functional>
+
+
+
+void HudBatch::sort(Item* items, int count) {
+    std::sort(items, items + count, [](const Item& a, const Item& b) {
+        if (a.effect != b.effect) {
+            return std::less<const void*>()(a.effect, b.effect);
+        }
+        if (a.texture != b.texture) {
+            return std::less<const void*>()(a.texture, b.texture);
+        }
+        return a.id < b.id;
+    });
+}
+
+void HudBatch::submit(const Item* items, int count, Target& target) {
+    for (int i = 0; i != count; ) {
+        const void* effect = items[i].effect;
+        target.beginEffect(items[i]);
+
+        while (i != count && items[i].effect == effect) {
+            const void* texture = items[i].texture;
+            int run = 1;
+            while (i + run != count && items[i + run].effect == effect && items[i + run].texture == texture) {
+                ++run;
+            }
+
+            target.draw(items[i], i, run);
+            i += run;
+        }
+
+        target.endEffect();
+    }
+}
+
+void HudBatch::writeQuad(float x0, float y0, float x1, float y1, float* v) {
+    // Correct for D3D9 pixel offset
+    x0 -= 0.5;
+    y0 -= 0.5;
+    x1 -= 0.5;
+    y1 -= 0.5;
+
+    const float quad[VertexFloats] = {
+        x0, y1, 0, 1,   0, 1, 0, 0,
+        x0, y0, 0, 1,   0, 0, 0, 0,
+        x1, y1, 0, 1,   1, 1, 0, 0,
+        x1, y1, 0, 1,   1, 1, 0, 0,
+        x0, y0, 0, 1,   0, 0, 0, 0,
+        x1, y0, 0, 1,   1, 0, 0, 0
+    };
+    std::copy(quad, quad + VertexFloats, v);
+}
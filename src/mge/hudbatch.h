@@ -0,0 +1,35 @@
+#pragma once
+
+
+
+// Ordering and batching of HUD elements into effect passes and draw calls.
+// Effects and textures are opaque pointers here, so that batching can be tested without a device.
+class HudBatch {
+public:
+    struct Item {
+        int id;                     // HUD element
+        const void* effect;         // Custom effect, or null for the standard effect
+        const void* texture;
+    };
+
+    // Target - Device side of a batch. Quads are numbered by position in the sorted list.
+    class Target {
+    public:
+        virtual ~Target() {}
+        virtual void beginEffect(const Item& first) = 0;
+        virtual void draw(const Item& first, int firstQuad, int quads) = 0;
+        virtual void endEffect() = 0;
+    };
+
+    static const int VertexFloats = 48;     // Floats written per quad by writeQuad
+
+    // sort - Group items by effect then texture, keeping element order within a group
+    static void sort(Item* items, int count);
+
+    // submit - One effect pass per run of items sharing an effect, and one draw per run sharing a texture
+    static void submit(const Item* items, int count, Target& target);
+
+    // writeQuad - Pre-transformed vertices with texcoords, as two triangles in a list so that
+    // consecutive quads can be drawn in one call
+    static void writeQuad(float x0, float y0, float x1, float y1, float* v);
+};
@@ -171,6 +171,7 @@ const iniSetting iniSettings[] = {
     {&Configuration.MGEFlags, t_bit, USE_HW_SHADER_BIT, siniRendState, "Hardware Shader", False, &dictBool, DICTONLY, 0, 0},
     {&Configuration.HDRReactionSpeed, t_float, 1, siniRendState, "HDR Reaction Time", "2", NULL, MINMAX, 0.01, 30},
     {&Configuration.UseDefaultTexturePool, t_bool, 1, siniRendState, "Reduce Texture Memory Use", True, &dictBool, DICTONLY|DONT_SAVE, 0, 0},
+    {&Configuration.TextureCacheBudget, t_uint32, 1, siniRendState, "Texture Cache Budget MB", "256", NULL, MINMAX|DONT_SAVE, 16, 2048},
     {&Configuration.PerPixelLightFlags, t_uint32, 1, siniDL, "Per Pixel Shader Flags", "Always", &dictPPLFlags, DICTONLY, 0, 0},
 
     // Generic variables
@@ -179,6 +180,7 @@ const iniSetting iniSettings[] = {
     {&Configuration.SSName, t_string, sizeof(Configuration.SSName), siniRendState, "Screenshot Name Prefix", "Morrowind", NULL, DONT_SAVE, 0, 0},
     {&Configuration.SSSuffix, t_uint8, 1, siniRendState, "Screenshot Name Suffix", "Timestamp", &dictSSSuffix, DICTONLY|DONT_SAVE, 0, 0},
     {&Configuration.StatusTimeout, t_int32, 1, siniRendState, "MGE Messages Timeout", "2000", NULL, MINMAX, 1000, 10000},
+    {&Configuration.ProfilerOverlay, t_bool, 1, siniRendState, "MGE Profiler Overlay", False, &dictBool, DICTONLY|DONT_SAVE, 0, 0},
     {&Configuration.Force3rdPerson, t_bool, 1, siniMisc, "Customize 3rd Person Camera", "False", &dictBool, DICTONLY, 0, 0},
     {&Configuration.Offset3rdPerson.x, t_float, 1, siniMisc, "Initial 3rd Person Camera X", "0", NULL, MINMAX, -250.0, 250.0},
     {&Configuration.Offset3rdPerson.y, t_float, 1, siniMisc, "Initial 3rd Person Camera Y", "-160", NULL, MINMAX, -2500.0, 2500.0},
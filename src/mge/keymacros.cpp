@@ -0,0 +1,309 @@
+
+#include "keymacros.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define KEYSET_SSE2
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+
+
+static const uint32_t ConsoleKey = 0x29;           // DIK_GRAVE
+
+uint32_t KeySet::next(uint32_t k) const {
+    if (k >= MGEINPUT_MAXMACROS) {
+        return MGEINPUT_MAXMACROS;
+    }
+
+    uint32_t w = k >> 5, m = bits[w] & (~0u << (k & 31));
+    for (;;) {
+        if (m) {
+#ifdef _MSC_VER
+            unsigned long bit;
+            _BitScanForward(&bit, m);
+#else
+            uint32_t bit = __builtin_ctz(m);
+#endif
+            return (w << 5) + bit;
+        }
+        if (++w == Words) {
+            return MGEINPUT_MAXMACROS;
+        }
+        m = bits[w];
+    }
+}
+
+void KeySet::fromStates(const uint8_t* states) {
+    uint32_t k = 0;
+    clear();
+#ifdef KEYSET_SSE2
+    for (; k + 32 <= MGEINPUT_MAXMACROS; k += 32) {
+        uint32_t lo = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(states + k)));
+        uint32_t hi = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(states + k + 16)));
+        bits[k >> 5] = lo | (hi << 16);
+    }
+#endif
+    for (; k < MGEINPUT_MAXMACROS; ++k) {
+        if (states[k] & 0x80) {
+            set(k);
+        }
+    }
+}
+
+// reset - Precompute which keys have macros, the keys each macro and trigger affects,
+// and the trigger schedule, so that polling only visits keys and triggers that are active
+void KeyMacros::reset(uint32_t time) {
+    globalHammer = true;
+    lastDown.clear();
+    disallowedKeys.clear();
+    boundKeys.clear();
+
+    for (uint32_t key = 0; key != MGEINPUT_MAXMACROS; ++key) {
+        const sFakeKey& macro = keys[key];
+        macroTargets[key].clear();
+
+        switch (macro.type) {
+        case MT_Unused:
+            continue;
+        case MT_Hammer1:
+        case MT_Hammer2:
+        case MT_Unhammer:
+        case MT_AHammer1:
+        case MT_AHammer2:
+        case MT_AUnhammer:
+        case MT_Press1:
+        case MT_Press2:
+        case MT_Unpress:
+            for (uint32_t byte = 0; byte != MGEINPUT_MAXMACROS; ++byte) {
+                if (macro.Press.KeyStates[byte]) {
+                    macroTargets[key].push_back(uint16_t(byte));
+                }
+            }
+            break;
+        }
+        boundKeys.set(key);
+    }
+
+    triggerQueue = decltype(triggerQueue)();
+    dueTriggers.clear();
+    for (uint32_t trigger = 0; trigger != MGEINPUT_MAXTRIGGERS; ++trigger) {
+        triggerFireTimes[trigger] = time + triggers[trigger].TimeInterval;
+        triggerKeys[trigger].clear();
+        for (uint32_t byte = 0; byte != MGEINPUT_MAXMACROS; ++byte) {
+            if (triggers[trigger].Data.KeyStates[byte]) {
+                triggerKeys[trigger].push_back(uint16_t(byte));
+            }
+        }
+        if (triggers[trigger].TimeInterval > 0) {
+            triggerQueue.push(std::make_pair(triggerFireTimes[trigger], trigger));
+        }
+    }
+}
+
+void KeyMacros::changeKeyBehavior(uint32_t key, Behavior kb, bool on) {
+    if (key >= MGEINPUT_MAXMACROS) {
+        return;
+    }
+
+    switch (kb) {
+    case Tap:
+        tapStates.assign(key, on);
+        break;
+    case Push:
+        fakeStates.assign(key, on);
+        break;
+    case Hammer:
+        hammerStates.assign(key, on);
+        break;
+    case AHammer:
+        aHammerStates.assign(key, on);
+        break;
+    case Disallow:
+        disallowedKeys.assign(key, on);
+        break;
+    }
+}
+
+bool KeyMacros::takeTap(uint32_t key) {
+    bool tap = tapStates.test(key);
+    tapStates.reset(key);
+    return tap;
+}
+
+void KeyMacros::poll(uint8_t* bytes, uint32_t time, bool closingConsole, Actions& actions) {
+    // Get any extra key presses, visiting only keys that have a forced state
+    globalHammer = !globalHammer;
+    const KeySet& hammer = globalHammer ? hammerStates : aHammerStates;
+
+    for (uint32_t byte = disallowedKeys.next(0); byte < 256; byte = disallowedKeys.next(byte + 1)) {
+        bytes[byte] = 0;
+    }
+    for (uint32_t byte = fakeStates.next(0); byte < MGEINPUT_MAXMACROS; byte = fakeStates.next(byte + 1)) {
+        if (byte >= 256 || !disallowedKeys.test(byte)) {
+            bytes[byte] |= 0x80;
+        }
+    }
+    for (uint32_t byte = hammer.next(0); byte < MGEINPUT_MAXMACROS; byte = hammer.next(byte + 1)) {
+        if (byte >= 256 || !disallowedKeys.test(byte)) {
+            bytes[byte] |= 0x80;
+        }
+    }
+    for (uint32_t byte = tapStates.next(0); byte < 256; byte = tapStates.next(byte + 1)) {
+        bytes[byte] |= 0x80;
+        tapStates.reset(byte);
+    }
+
+    // Track pressed keys, and the subset with macros, as bitsets
+    KeySet down, active;
+    down.fromStates(bytes);
+    for (uint32_t w = 0; w != KeySet::Words; ++w) {
+        active.bits[w] = down.bits[w] & boundKeys.bits[w];
+    }
+
+    // Macros can press keys later in the scan, which then run their own macros this frame
+    auto press = [&](uint32_t byte, uint8_t state) {
+        bytes[byte] = state;
+        if (state & 0x80) {
+            down.set(byte);
+            if (boundKeys.test(byte)) {
+                active.set(byte);
+            }
+        }
+    };
+
+    if (closingConsole) {
+        // Close the console after faking a command (If using console 1 style)
+        press(ConsoleKey, 0x80);
+        lastDown = down;
+        return;
+    }
+
+    // Process triggers that are due. A trigger that came due while inactive fires once it is active again.
+    // Rescheduled triggers are queued after the scan, as a fire time that wraps around could be due again at once.
+    uint32_t fired[MGEINPUT_MAXTRIGGERS], firedCount = 0;
+    auto fire = [&](uint32_t trigger) {
+        for (uint16_t byte : triggerKeys[trigger]) {
+            press(byte, bytes[byte] | triggers[trigger].Data.KeyStates[byte]);
+        }
+        triggerFireTimes[trigger] = time + triggers[trigger].TimeInterval;
+        fired[firedCount++] = trigger;
+    };
+
+    for (size_t i = 0; i < dueTriggers.size(); ) {
+        uint32_t trigger = dueTriggers[i];
+        if (triggers[trigger].Active) {
+            if (triggerFireTimes[trigger] < time) {
+                fire(trigger);
+            } else {
+                triggerQueue.push(std::make_pair(triggerFireTimes[trigger], trigger));
+            }
+            dueTriggers[i] = dueTriggers.back();
+            dueTriggers.pop_back();
+        } else {
+            ++i;
+        }
+    }
+    while (!triggerQueue.empty() && triggerQueue.top().first < time) {
+        uint32_t trigger = triggerQueue.top().second;
+        triggerQueue.pop();
+        if (triggers[trigger].Active) {
+            fire(trigger);
+        } else {
+            dueTriggers.push_back(trigger);
+        }
+    }
+    for (uint32_t i = 0; i != firedCount; ++i) {
+        triggerQueue.push(std::make_pair(triggerFireTimes[fired[i]], fired[i]));
+    }
+
+    // Process pressed keys that have macros, in key order
+    for (uint32_t key = active.next(0); key < MGEINPUT_MAXMACROS; key = active.next(key + 1)) {
+        const sFakeKey& macro = keys[key];
+        bool last = lastDown.test(key);
+
+        switch (macro.type) {
+        case MT_Console1:
+            if (!last) {
+                press(ConsoleKey, 0x80);
+                actions.consoleCommand(macro.Console, true);
+            }
+            break;
+        case MT_Console2:
+            if (!last) {
+                actions.consoleCommand(macro.Console, false);
+            }
+            break;
+        case MT_Hammer1:
+            if (globalHammer) {
+                for (uint16_t byte : macroTargets[key]) {
+                    press(byte, 0x80);
+                }
+            }
+            break;
+        case MT_Hammer2:
+            for (uint16_t byte : macroTargets[key]) {
+                hammerStates.set(byte);
+            }
+            break;
+        case MT_Unhammer:
+            for (uint16_t byte : macroTargets[key]) {
+                hammerStates.reset(byte);
+            }
+            break;
+        case MT_AHammer1:
+            if (!globalHammer) {
+                for (uint16_t byte : macroTargets[key]) {
+                    press(byte, 0x80);
+                }
+            }
+            break;
+        case MT_AHammer2:
+            for (uint16_t byte : macroTargets[key]) {
+                aHammerStates.set(byte);
+            }
+            break;
+        case MT_AUnhammer:
+            for (uint16_t byte : macroTargets[key]) {
+                aHammerStates.reset(byte);
+            }
+            break;
+        case MT_Press1:
+            for (uint16_t byte : macroTargets[key]) {
+                press(byte, 0x80);
+            }
+            break;
+        case MT_Press2:
+            for (uint16_t byte : macroTargets[key]) {
+                fakeStates.set(byte);
+            }
+            break;
+        case MT_Unpress:
+            for (uint16_t byte : macroTargets[key]) {
+                fakeStates.reset(byte);
+            }
+            break;
+        case MT_BeginTimer:
+            if (!last) {
+                triggers[macro.Timer.TimerID].Active = true;
+            }
+            break;
+        case MT_EndTimer:
+            if (!last) {
+                triggers[macro.Timer.TimerID].Active = false;
+            }
+            break;
+        case MT_Graphics:
+            // Activate on keydown only, except for certain functions which should repeat
+            if (!last || macro.Function.index == GF_IncreaseZoom || macro.Function.index == GF_DecreaseZoom ||
+                         macro.Function.index == GF_IncreaseFOV || macro.Function.index == GF_DecreaseFOV) {
+                actions.graphicsFunction(macro.Function.index);
+            }
+            break;
+        }
+    }
+
+    lastDown = down;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "mmefunctiondefs.h"
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+// KeySet - Bitset over keyboard and mouse macro keys, iterated in proportion to the number of keys set
+struct KeySet {
+    enum { Words = (MGEINPUT_MAXMACROS + 31) / 32 };
+    uint32_t bits[Words];
+
+    void clear() {
+        std::memset(bits, 0, sizeof(bits));
+    }
+    bool test(uint32_t k) const {
+        return (bits[k >> 5] >> (k & 31)) & 1;
+    }
+    void set(uint32_t k) {
+        bits[k >> 5] |= 1u << (k & 31);
+    }
+    void reset(uint32_t k) {
+        bits[k >> 5] &= ~(1u << (k & 31));
+    }
+    void assign(uint32_t k, bool on) {
+        if (on) {
+            set(k);
+        } else {
+            reset(k);
+        }
+    }
+
+    // next - First key set at or after k, or MGEINPUT_MAXMACROS if there is none
+    uint32_t next(uint32_t k) const;
+
+    // fromStates - Keys with the pressed bit (0x80) set in a DirectInput state array
+    void fromStates(const uint8_t* states);
+};
+
+// Keyboard macros and timed triggers, applied to each keyboard poll.
+// Keys 0-255 are DirectInput scan codes and 256-265 the mouse buttons and wheel, as in the macro settings.
+// Console commands and graphics functions are left to the caller, so that polling can be tested offline.
+class KeyMacros {
+public:
+    enum Behavior { Tap, Push, Hammer, AHammer, Disallow };
+
+    // Actions - Side effects of macros, run in key order during a poll
+    class Actions {
+    public:
+        virtual ~Actions() {}
+        virtual void consoleCommand(const FD_Console& console, bool closeConsole) = 0;
+        virtual void graphicsFunction(uint8_t index) = 0;
+    };
+
+    sFakeKey keys[MGEINPUT_MAXMACROS];              // Macro for each key, last 10 reserved for mouse
+    sFakeTrigger triggers[MGEINPUT_MAXTRIGGERS];    // Up to 4 time delayed triggers
+
+    // reset - Initial state, once keys and triggers are loaded. Trigger intervals count from time.
+    void reset(uint32_t time);
+
+    // changeKeyBehavior - Force a key state until turned off, or tap it once
+    void changeKeyBehavior(uint32_t key, Behavior kb, bool on);
+
+    // poll - Apply forced key states, due triggers and macros to the state of all macro keys.
+    // While closing the console after a command, only presses the console key.
+    void poll(uint8_t* bytes, uint32_t time, bool closingConsole, Actions& actions);
+
+    // hammerPhase - Alternates on each poll; hammered keys are down while true, ahammered keys while false
+    bool hammerPhase() const { return globalHammer; }
+
+    // Mouse buttons, whose state is read separately, apply their own disallow and tap states
+    bool disallowed(uint32_t key) const { return disallowedKeys.test(key); }
+    bool takeTap(uint32_t key);
+
+private:
+    KeySet lastDown;                                // Which keys were pressed last poll
+    KeySet fakeStates;                              // Which keys are currently permanently down
+    KeySet hammerStates;                            // Which keys are currently being hammered
+    KeySet aHammerStates;                           // Which keys are currently being ahammered
+    KeySet tapStates;                               // Which keys need to be tapped next frame
+    KeySet disallowedKeys;                          // Which keys are disallowed
+    KeySet boundKeys;                               // Which keys have a macro
+    std::vector<uint16_t> macroTargets[MGEINPUT_MAXMACROS];     // Keys affected by each press/hammer macro
+    std::vector<uint16_t> triggerKeys[MGEINPUT_MAXTRIGGERS];    // Keys pressed by each trigger
+    uint32_t triggerFireTimes[MGEINPUT_MAXTRIGGERS];
+    std::priority_queue<std::pair<uint32_t, uint32_t>, std::vector<std::pair<uint32_t, uint32_t>>,
+                        std::greater<std::pair<uint32_t, uint32_t>>> triggerQueue;   // (fire time, trigger)
+    std::vector<uint32_t> dueTriggers;              // Triggers past their fire time while inactive
+    bool globalHammer = true;
+};
@@ -0,0 +1,139 @@
+
+#include "lightpack.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+
+
+void LightPackCache::clear() {
+    packs.clear();
+    last = lastUploaded = nullptr;
+}
+
+// select - Find or build the packed light constants for the current active light set
+const LightPack* LightPackCache::select(LightState* lightrs, const mat4& view) {
+    // Any light or view change invalidates all packs
+    if (changeStamp != lightrs->changeStamp) {
+        clear();
+        changeStamp = lightrs->changeStamp;
+    }
+
+    // Consecutive draws commonly share the same lights
+    LightSetKey key(lightrs);
+    if (last && key == lastKey) {
+        return last;
+    }
+
+    auto iPack = packs.find(key);
+    if (iPack == packs.end()) {
+        iPack = packs.emplace(key, LightPack()).first;
+        iPack->second.pack(lightrs, key, view);
+    }
+
+    lastKey = key;
+    last = &iPack->second;
+    return last;
+}
+
+void LightPack::pack(LightState* lightrs, const LightSetKey& key, const mat4& view) {
+    std::memset(&diffuse, 0, sizeof(diffuse));
+    std::memset(&ambient, 0, sizeof(ambient));
+    std::memset(&position, 0, sizeof(position));
+    std::memset(&falloffQuadratic, 0, sizeof(falloffQuadratic));
+    std::memset(&falloffLinear, 0, sizeof(falloffLinear));
+    falloffConstant = 0.33;
+    hasSun = false;
+    sunDirection = vec3(0, 0, 0);
+    sunDiffuse = vec3(0, 0, 0);
+    sunAmbient = vec3(0, 0, 0);
+
+    // Check each active light
+    size_t n = key.count, pointLightCount = 0;
+    for (; n --> 0; ) {
+        DWORD i = key.lights[n];
+        LightState::Light* light = &lightrs->lights.find(i)->second;
+
+        // Transform to view space once per view change
+        if (light->viewspaceStamp != lightrs->viewStamp) {
+            if (light->type == LightState::TypeDirectional) {
+                light->viewspacePos = view.transformNormal(light->position);
+            } else {
+                light->viewspacePos = view.transformCoord(light->position);
+            }
+
+            light->viewspaceStamp = lightrs->viewStamp;
+        }
+
+        if (light->type == LightState::TypePoint) {
+            diffuse[pointLightCount] = vec4(light->diffuse.r, light->diffuse.g, light->diffuse.b, light->diffuse.a);
+
+            // Scatter position vectors for vectorization
+            position[pointLightCount] = light->viewspacePos.x;
+            position[pointLightCount + MaxLights] = light->viewspacePos.y;
+            position[pointLightCount + 2*MaxLights] = light->viewspacePos.z;
+
+            // Scatter attenuation factors for vectorization
+            if (light->falloff.x > 0) {
+                // Standard point light source (falloffConstant doesn't vary per light)
+                falloffConstant = light->falloff.x;
+                falloffLinear[pointLightCount] = light->falloff.y;
+                falloffQuadratic[pointLightCount] = light->falloff.z;
+            } else if (light->falloff.z > 0) {
+                // Probably a magic light source patched by Morrowind Code Patch
+                // Patched falloff calculation is quadratic only, which needs to be
+                // modified to account for the standard falloffConstant
+                // Diffuse colour is correctly specified with the patch
+                // Some overbrightness is applied to diffuse to cause glowing
+                diffuse[pointLightCount].x *= falloffConstant;
+                diffuse[pointLightCount].y *= falloffConstant;
+                diffuse[pointLightCount].z *= falloffConstant;
+                ambient[pointLightCount] = 1.0f + 1e-4f / std::sqrt(light->falloff.z);
+                falloffQuadratic[pointLightCount] = falloffConstant * light->falloff.z;
+            } else if (light->falloff.y == 0.10000001f) {
+                // Projectile light source, normally hard coded by Morrowind to { 0, 3 * (1/30), 0 }
+                // This falloff value cannot be produced by other magic effects
+                // Replacement falloff is significantly brighter to look cool
+                // Avoids modifying colour or position
+                falloffQuadratic[pointLightCount] = 5e-5;
+            } else if (light->falloff.y > 0) {
+                // Light magic effect, falloffs calculated by { 0, 3 / (22 * spell magnitude), 0 }
+                // A mix of ambient (falloff but no N.L component) and over-bright diffuse lighting
+                // It is approximated with a half-lambert weight + quadratic falloff
+                // Light colour is altered to avoid variable brightness from Morrowind bugs
+                // The point source is moved up slightly as it is often embedded in the ground
+                float brightness = 0.25f + 1e-4f / light->falloff.y;
+                diffuse[pointLightCount].x = brightness;
+                diffuse[pointLightCount].y = brightness;
+                diffuse[pointLightCount].z = brightness;
+                ambient[pointLightCount] = 1.0;
+                falloffQuadratic[pointLightCount] = 0.5555f * light->falloff.y * light->falloff.y;
+                position[pointLightCount + 2*MaxLights] += 25.0;
+            }
+            ++pointLightCount;
+        } else if (light->type == LightState::TypeDirectional) {
+            hasSun = true;
+            sunDirection = light->viewspacePos;
+            sunDiffuse = vec3(light->diffuse.r, light->diffuse.g, light->diffuse.b);
+            sunAmbient += light->ambient;
+        }
+    }
+}
+
+LightSetKey::LightSetKey(const LightState* lightrs) {
+    count = DWORD(std::min(lightrs->active.size(), MaxLights));
+    std::copy(lightrs->active.begin(), lightrs->active.begin() + count, lights);
+}
+
+bool LightSetKey::operator==(const LightSetKey& other) const {
+    return count == other.count && std::equal(lights, lights + count, other.lights);
+}
+
+std::size_t LightSetKey::hasher::operator()(const LightSetKey& k) const {
+    std::size_t h = k.count;
+    for (DWORD n = 0; n != k.count; ++n) {
+        h = (h << 5) ^ (h >> 27) ^ k.lights[n];
+    }
+    return h;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "support/d3dxportable.h"
+#include "support/vecmath.h"
+
+#include <unordered_map>
+#include <vector>
+
+// Fixed function lighting state captured from Morrowind, and the packed shader constants built from it.
+// Uses plain values instead of D3D types, so that packing can be tested and measured offline.
+
+struct LightState {
+    static constexpr DWORD TypePoint = 1;           // D3DLIGHT_POINT
+    static constexpr DWORD TypeDirectional = 3;     // D3DLIGHT_DIRECTIONAL
+
+    struct Colour {
+        float r, g, b, a;
+    };
+
+    struct Light {
+        DWORD type;
+        Colour diffuse;
+        vec3 position;          // position / normalized direction
+        vec3 viewspacePos;
+        vec3 falloff;           // constant, linear, quadratic
+        vec3 ambient;           // for directional lights
+        DWORD viewspaceStamp;   // viewStamp when viewspacePos was last calculated
+    };
+
+    Colour globalAmbient;
+    std::unordered_map<DWORD, Light> lights;
+    std::vector<DWORD> active;
+    DWORD viewStamp;            // Incremented when the view transform changes
+    DWORD changeStamp;          // Incremented when the view transform or any light parameter changes
+};
+
+// The first MaxLights active lights, which determine a light pack
+struct LightSetKey {
+    static constexpr size_t MaxLights = 8;
+
+    DWORD count;
+    DWORD lights[MaxLights];
+
+    LightSetKey() : count(0) {}
+    LightSetKey(const LightState* lightrs);
+    bool operator==(const LightSetKey& other) const;
+
+    struct hasher {
+        std::size_t operator()(const LightSetKey& k) const;
+    };
+};
+
+// Shader constants for a set of active lights, in the packed layout used by the FFE shaders
+struct LightPack {
+    static constexpr size_t MaxLights = LightSetKey::MaxLights;
+
+    vec4 diffuse[MaxLights];
+    float ambient[MaxLights];
+    float position[3 * MaxLights];
+    float falloffQuadratic[MaxLights], falloffLinear[MaxLights], falloffConstant;
+    bool hasSun;
+    vec3 sunDirection;
+    vec3 sunDiffuse, sunAmbient;
+
+    void pack(LightState* lightrs, const LightSetKey& key, const mat4& view);
+};
+
+// Light packs are valid until LightState::changeStamp changes, usually once per frame
+struct LightPackCache {
+    DWORD changeStamp;
+    LightSetKey lastKey;
+    const LightPack* last;
+    const LightPack* lastUploaded;      // Owned by the renderer, reset along with the cache
+    std::unordered_map<LightSetKey, LightPack, LightSetKey::hasher> packs;
+
+    LightPackCache() : changeStamp(0), last(nullptr), lastUploaded(nullptr) {}
+    void clear();
+    const LightPack* select(LightState* lightrs, const mat4& view);
+};
@@ -7,11 +7,11 @@
 #include "statusoverlay.h"
 #include "distantland.h"
 #include "postshaders.h"
-#include "support/pngsave.h"
+#include "screenshotqueue.h"
 
-#include <cctype>
 #include <cstdio>
 #include <cstring>
+#include <string>
 
 
 
@@ -23,7 +23,6 @@ enum SuffixFormatting {
 };
 
 static void saveScreenshot(IDirect3DSurface9* surface);
-static int nextScreenshotOrdinal(const char* path);
 
 
 void MacroFunctions::TakeScreenshot() {
@@ -82,13 +81,13 @@ static void saveScreenshot(IDirect3DSurface9* surface) {
     }
     break;
     case SuffixFormatting_Ordinal: {
-        int nextOrdinal = nextScreenshotOrdinal(dir);
+        int nextOrdinal = ScreenshotQueue::nextOrdinal(dir);
         std::snprintf(filename, sizeof(filename), "%s%04d", Configuration.SSName, nextOrdinal);
         ++nextOrdinal;
     }
     break;
     case SuffixFormatting_NameOrdinal: {
-        int nextOrdinal = nextScreenshotOrdinal(dir);
+        int nextOrdinal = ScreenshotQueue::nextOrdinal(dir);
         const char* name = MWBridge::get()->getPlayerName();
         if (!name) {
             name = "Menu";
@@ -100,7 +99,7 @@ static void saveScreenshot(IDirect3DSurface9* surface) {
     break;
     case SuffixFormatting_NameGameTimeOrdinal: {
         auto mwBridge = MWBridge::get();
-        int nextOrdinal = nextScreenshotOrdinal(dir);
+        int nextOrdinal = ScreenshotQueue::nextOrdinal(dir);
         const char* name = mwBridge->getPlayerName();
         const char* dayLocalized = *(const char**)mwBridge->getGMSTPointer(0x1e1);
         if (!name) {
@@ -130,64 +129,16 @@ static void saveScreenshot(IDirect3DSurface9* surface) {
         return;
     }
 
-    // Save screenshot to desired format
-    if (Configuration.SSFormat == D3DXIFF_PNG) {
-        // D3DX PNG support does full compression which takes >1 sec to save an image
-        // Use a non-compressing PNG encoder for reasonable screenshot times
-        bool success = false;
-        D3DSURFACE_DESC desc;
-        D3DLOCKED_RECT rect;
-        surface->GetDesc(&desc);
-
-        if (surface->LockRect(&rect, NULL, D3DLOCK_READONLY) == D3D_OK) {
-            success = pngSaveBGRA(path, rect.pBits, desc.Width, desc.Height, rect.Pitch);
-            surface->UnlockRect();
-        }
-
-        StatusOverlay::setStatus(success ? filename : "Screenshot failed");
-    }
-    else {
-        HRESULT hr = D3DXSaveSurfaceToFile(path, formats[Configuration.SSFormat], surface, NULL, NULL);
-        if (SUCCEEDED(hr)) {
-            StatusOverlay::setStatus(filename);
-        } else {
-            std::snprintf(filename, sizeof(filename), "Screenshot failed - D3DX Error %lx", hr);
-            StatusOverlay::setStatus(filename);
-        }
+    // Queue screenshot to be saved in the desired format, status is shown when the file is written
+    std::string status = filename;
+    bool queued = ScreenshotQueue::submit(surface, path, formats[Configuration.SSFormat], [status](bool success) {
+        StatusOverlay::setStatus(success ? status.c_str() : "Screenshot failed");
+    });
+    if (!queued) {
+        StatusOverlay::setStatus("Screenshot failed");
     }
 }
 
-static int nextScreenshotOrdinal(const char* path) {
-    static int nextOrdinal = -1;
-    char findPattern[MAX_PATH];
-    WIN32_FIND_DATA findData;
-
-    if (nextOrdinal > 0) {
-        return ++nextOrdinal;
-    }
-
-    nextOrdinal = 0;
-    std::snprintf(findPattern, sizeof(findPattern), "%s\\*", path);
-
-    HANDLE h = FindFirstFile(findPattern, &findData);
-    if (h != INVALID_HANDLE_VALUE) {
-        do {
-            if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-                continue;
-            }
-
-            const char* lastSpace = std::strrchr(findData.cFileName, ' ');
-            if (lastSpace && std::isdigit(lastSpace[1])) {
-                nextOrdinal = std::max(nextOrdinal, std::atoi(lastSpace + 1));
-            }
-        } while (FindNextFile(h, &findData));
-
-        FindClose(h);
-    }
-
-    return ++nextOrdinal;
-}
-
 static void displayFlag(DWORD flag, const char* en, const char* ds) {
     if (Configuration.MGEFlags & flag) {
         StatusOverlay::setStatus(en);
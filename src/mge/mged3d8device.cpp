@@ -4,84 +4,78 @@
 #include "proxydx/d3d8surface.h"
 
 #include <algorithm>
+#include <cstddef>
 #include "mgeversion.h"
+#include "callrecorder.h"
 #include "configuration.h"
 #include "distantland.h"
+#include "framesequence.h"
 #include "mwbridge.h"
+#include "profiler.h"
+#include "proxystate.h"
+#include "screenshotqueue.h"
 #include "statusoverlay.h"
 #include "userhud.h"
 #include "videobackground.h"
-
-static int sceneCount;
-static bool rendertargetNormal, isHUDready;
-static bool isMainView, isStencilScene, isAmbientWhite;
-static DWORD stencilRef;
-static bool stage0Complete, isFrameComplete, isHUDComplete;
-static bool isWaterMaterial, waterDrawn, distantWater;
+#include "support/log.h"
 
 static bool zoomSensSaved;
 static float zoomSensX, zoomSensY;
 static D3DXMATRIX camEffectsMatrix;
 static float crosshairTimeout;
 
-static RenderedState rs;
-static FragmentState frs;
-static LightState lightrs;
+static_assert(sizeof(ProxyState::Light) == sizeof(D3DLIGHT8), "D3DLIGHT8 layout");
+static_assert(offsetof(ProxyState::Light, attenuation0) == offsetof(D3DLIGHT8, Attenuation0), "D3DLIGHT8 layout");
+static_assert(sizeof(ProxyState::Material) == sizeof(D3DMATERIAL8), "D3DMATERIAL8 layout");
+static_assert(offsetof(ProxyState::Material, power) == offsetof(D3DMATERIAL8, Power), "D3DMATERIAL8 layout");
+
+// Distant land and HUD work called from the forwarding rules
+class DeviceHooks : public ProxyState::Hooks {
+public:
+    void beginFrame() {
+        // Set any custom FOV
+        if (Configuration.ScreenFOV > 0) {
+            MWBridge::get()->SetFOV(Configuration.ScreenFOV);
+        }
+    }
+    void renderStage0() { DistantLand::renderStage0(); }
+    void renderStage1() { DistantLand::renderStage1(); }
+    void renderStageBlend() { DistantLand::renderStageBlend(); }
+    void renderStage2() { DistantLand::renderStage2(); }
+    void renderStageWater() { DistantLand::renderStageWater(); }
+    void postProcess() { DistantLand::postProcess(); }
+    void drawHUD() { MGEhud::draw(); }
+    void endFrame();
+    void setAmbientColour(uint32_t colour) {
+        DistantLand::setAmbientColour(RGBVECTOR(D3DCOLOR(colour)));
+    }
+    bool inspectDraw(int sceneCount, const RenderedState* rs, const FragmentState* frs, LightState* lightrs) {
+        return DistantLand::inspectIndexedPrimitive(sceneCount, rs, frs, lightrs);
+    }
+};
+
+// Forwarding rules, captured state and redundant state filter, see proxystate.h
+static DeviceHooks hooks;
+static ProxyState state(&hooks);
 
 static void initOnLoad();
-static bool detectMenu(const D3DMATRIX* m);
-static void captureRenderState(D3DRENDERSTATETYPE a, DWORD b);
-static void captureFragmentRenderState(DWORD a, D3DTEXTURESTAGESTATETYPE b, DWORD c);
-static void captureTransform(D3DTRANSFORMSTATETYPE a, const D3DMATRIX* b);
-static void captureLight(DWORD a, const D3DLIGHT8* b);
-static void captureMaterial(const D3DMATERIAL8* a);
+static void updateSettings();
 static float calcFPS();
 
 
 
 MGEProxyDevice::MGEProxyDevice(IDirect3DDevice9* real, ProxyD3D* d3d) : ProxyDevice(real, d3d) {
     // Initialize state here, as the device is released and recreated on fullscreen Alt-Tab
-    sceneCount = -1;
-    rendertargetNormal = true;
-    isHUDready = false;
-    isMainView = isStencilScene = isAmbientWhite = stage0Complete = isFrameComplete = isHUDComplete = false;
-    stencilRef = 0;
-    isWaterMaterial = waterDrawn = false;
+    state.reset();
     D3DXMatrixIdentity(&camEffectsMatrix);
 
     Configuration.CameraEffects.zoom = 1.0;
     Configuration.CameraEffects.zoomRate = 0;
     Configuration.CameraEffects.zoomRateTarget = 0;
 
-    // Initialize state recorder to D3D defaults
-    memset(&rs, 0, sizeof(rs));
-    rs.zWrite = true;
-    rs.diffuseMaterial.r = 1.0f;
-    rs.diffuseMaterial.g = 1.0f;
-    rs.diffuseMaterial.b = 1.0f;
-    rs.diffuseMaterial.a = 1.0f;
-    rs.cullMode = D3DCULL_CCW;
-    rs.useLighting = true;
-
-    rs.matSrcDiffuse = D3DMCS_COLOR1;
-    rs.matSrcEmissive = D3DMCS_MATERIAL;
-
-    memset(&frs, 0, sizeof(frs));
-    for (FragmentState::Stage* s = &frs.stage[0]; s != &frs.stage[8]; ++s) {
-        s->colorOp = D3DTOP_DISABLE;
-        s->alphaOp = D3DTOP_DISABLE;
-        s->colorArg1 = s->alphaArg1 = D3DTA_TEXTURE;
-        s->colorArg2 = s->alphaArg2 = D3DTA_CURRENT;
-        s->colorArg0 = s->alphaArg0 = s->resultArg = D3DTA_CURRENT;
-    }
-    frs.stage[0].colorOp = D3DTOP_MODULATE;
-    frs.stage[0].alphaOp = D3DTOP_SELECTARG1;
-
-    lightrs.lights.clear();
-    lightrs.active.clear();
-
     // Store active device in distant land, occurs on startup and after fullscreen alt-tab
     DistantLand::device = realDevice;
+    updateSettings();
 
     // Patch splash screen minor issues
     D3DVIEWPORT9 vp;
@@ -94,6 +88,8 @@ MGEProxyDevice::MGEProxyDevice(IDirect3DDevice9* real, ProxyD3D* d3d) : ProxyDev
 HRESULT _stdcall MGEProxyDevice::Present(const RECT* a, const RECT* b, HWND c, const RGNDATA* d) {
     auto mwBridge = MWBridge::get();
 
+    CallRecorder::present();
+
     // Load Morrowind's dynamic memory pointers
     if (!mwBridge->IsLoaded() && mwBridge->CanLoad()) {
         mwBridge->Load();
@@ -192,11 +188,7 @@ HRESULT _stdcall MGEProxyDevice::Present(const RECT* a, const RECT* b, HWND c, c
     }
 
     // Reset scene identifiers
-    sceneCount = -1;
-    stage0Complete = false;
-    waterDrawn = false;
-    isFrameComplete = false;
-    isHUDComplete = false;
+    state.present();
 
     return ProxyDevice::Present(a, b, c, d);
 }
@@ -207,10 +199,14 @@ HRESULT _stdcall MGEProxyDevice::SetRenderTarget(IDirect3DSurface8* a, IDirect3D
     if (a) {
         IDirect3DSurface9* back;
         realDevice->GetBackBuffer(0, 0, D3DBACKBUFFER_TYPE_MONO, &back);
-        rendertargetNormal = (static_cast<ProxySurface*>(a)->realSurface == back);
+        state.setRenderTarget(static_cast<ProxySurface*>(a)->realSurface == back);
         back->Release();
     }
 
+    if (CallRecorder::recording) {
+        CallRecorder::setRenderTarget(a, b, state.rendertargetNormal);
+    }
+
     return ProxyDevice::SetRenderTarget(a, b);
 }
 
@@ -219,141 +215,88 @@ HRESULT _stdcall MGEProxyDevice::SetRenderTarget(IDirect3DSurface8* a, IDirect3D
 HRESULT _stdcall MGEProxyDevice::BeginScene() {
     auto mwBridge = MWBridge::get();
 
+    if (CallRecorder::recording) {
+        CallRecorder::beginScene();
+    }
+
     HRESULT hr = ProxyDevice::BeginScene();
     if (hr != D3D_OK) {
         return hr;
     }
 
-    if (mwBridge->IsLoaded() && rendertargetNormal) {
-        if (!isHUDready) {
+    if (mwBridge->IsLoaded()) {
+        if (state.rendertargetNormal && !state.hudReady) {
             // Initialize HUD
             StatusOverlay::init(realDevice);
             StatusOverlay::setStatus(XE_VERSION_STRING);
             MGEhud::init(realDevice);
+            Profiler::reset();
+            Profiler::initGPU(realDevice);
 
             // Set scaling on Morrowind's UI system
             if (Configuration.UIScale != 1.0f) {
                 mwBridge->setUIScale(Configuration.UIScale);
             }
 
-            isHUDready = true;
+            state.hudReady = true;
         }
 
-        if (isMainView) {
-            // Track scene count here in BeginScene
-            // isMainView is not always valid at EndScene if Morrowind draws sunglare
-            ++sceneCount;
-
-            // Set any custom FOV and check distant water state
-            if (sceneCount == 0) {
-                if (Configuration.ScreenFOV > 0) {
-                    mwBridge->SetFOV(Configuration.ScreenFOV);
-                }
-                distantWater = (Configuration.MGEFlags & USE_DISTANT_LAND) || (Configuration.MGEFlags & USE_DISTANT_WATER);
-            }
-        } else {
-            // UI scene, apply post-process if there was anything drawn before it
-            // Race menu will render an extra scene past this point
-            if (DistantLand::ready && sceneCount > 0 && !isFrameComplete) {
-                DistantLand::postProcess();
-            }
-
-            // Render user HUD before Morrowind HUD
-            if (isHUDready && !isHUDComplete) {
-                MGEhud::draw();
-            }
-
-            isFrameComplete = true;
-        }
+        updateSettings();
+        state.beginScene();
     }
 
     return D3D_OK;
 }
 
 // EndScene - Multiple scenes per frame, non-alpha / 2x stencil / post-stencil redraw / alpha / 1st person / UI
-// MGE intercepts first scene to draw distant land before it finishes, others it applies shadows to
+// MGE intercepts first scene to draw distant land before it finishes, others it applies shadows to, see ProxyState::endScene
 HRESULT _stdcall MGEProxyDevice::EndScene() {
-    if (DistantLand::ready && rendertargetNormal) {
-        // The following Morrowind scenes get past the filters:
-        // ~ Opaque meshes, plus alpha meshes with 'No Sorter' property (which should use alpha test)
-        // ~ If stencil shadows are active, then shadow casters are deferred to be drawn in a scene after
-        //    shadows are fully applied to avoid self-shadowing problems with simplified shadow meshes
-        // ~ If any alpha meshes are visible, they are sorted and drawn in another scene (except those with 'No Sorter' property)
-        // ~ If 1st person or sunglare is visible, they are drawn in another scene after a Z clear
-        if (sceneCount == 0) {
-            // Edge case, render distant land even if Morrowind has culled everything
-            if (!stage0Complete) {
-                DistantLand::renderStage0();
-                stage0Complete = true;
-            }
-
-            // Opaque features
-            DistantLand::renderStage1();
-
-            // Blend close objects over distant land
-            DistantLand::renderStageBlend();
-        } else if (!isFrameComplete) {
-            // Everything else except UI
-            DistantLand::renderStage2();
-
-            // Draw water if the Morrowind water plane doesn't appear in view
-            // it may be too distant or stencil scene order is non-normative
-            if (distantWater && !waterDrawn && !isStencilScene) {
-                DistantLand::renderStageWater();
-                waterDrawn = true;
-            }
-        }
-    }
-
-    if (isFrameComplete && isHUDready && !isHUDComplete) {
-        // Capture post-UI screenshots here
-        DistantLand::checkCaptureScreenshot(true);
-
-        // Render status overlay
-        StatusOverlay::setFPS(calcFPS());
-        StatusOverlay::show(realDevice);
-
-        isHUDComplete = true;
+    if (CallRecorder::recording) {
+        CallRecorder::endScene();
     }
 
+    state.endScene();
     return ProxyDevice::EndScene();
 }
 
 // Clear - Occurs at start of frame, and also a z-clear before rendering 1st person and sunglare
 // Skybox mesh doesn't extend over whole background; cleared background colour is visible at horizon
 HRESULT _stdcall MGEProxyDevice::Clear(DWORD a, const D3DRECT* b, DWORD c, D3DCOLOR d, float e, DWORD f) {
+    if (CallRecorder::recording) {
+        CallRecorder::clear(a, b, c, d, e, f);
+    }
+
     DistantLand::setHorizonColour(d);
     return ProxyDevice::Clear(a, b, c, d, e, f);
 }
 
 // SetTransform
-// Projection needs modifying to allow room for distant land
+// View is checked for UI rendering, and projection needs modifying to allow room for distant land
 HRESULT _stdcall MGEProxyDevice::SetTransform(D3DTRANSFORMSTATETYPE a, const D3DMATRIX* b) {
-    captureTransform(a, b);
+    if (CallRecorder::recording) {
+        CallRecorder::setTransform(a, b);
+    }
 
-    if (rendertargetNormal) {
-        if (a == D3DTS_VIEW) {
-            // Check for UI view
-            isMainView = !detectMenu(b);
+    if (!state.setTransform(a, &b->_11)) {
+        return D3D_OK;
+    }
 
-            if (isMainView) {
-                D3DXMATRIX view = *b;
-                view *= camEffectsMatrix;
-                return ProxyDevice::SetTransform(a, &view);
-            }
+    if (state.rendertargetNormal && state.isMainView) {
+        if (a == D3DTS_VIEW) {
+            D3DXMATRIX view = *b;
+            view *= camEffectsMatrix;
+            return ProxyDevice::SetTransform(a, &view);
         } else if (a == D3DTS_PROJECTION) {
             // Only screw with main scene projection
-            if (isMainView) {
-                D3DXMATRIX proj = *b;
-                DistantLand::setProjection(&proj);
-
-                if (Configuration.MGEFlags & ZOOM_ASPECT) {
-                    proj._11 *= Configuration.CameraEffects.zoom;
-                    proj._22 *= Configuration.CameraEffects.zoom;
-                }
+            D3DXMATRIX proj = *b;
+            DistantLand::setProjection(&proj);
 
-                return ProxyDevice::SetTransform(a, &proj);
+            if (Configuration.MGEFlags & ZOOM_ASPECT) {
+                proj._11 *= Configuration.CameraEffects.zoom;
+                proj._22 *= Configuration.CameraEffects.zoom;
             }
+
+            return ProxyDevice::SetTransform(a, &proj);
         }
     }
 
@@ -363,8 +306,11 @@ HRESULT _stdcall MGEProxyDevice::SetTransform(D3DTRANSFORMSTATETYPE a, const D3D
 // SetMaterial
 // Check for materials marked for hiding
 HRESULT _stdcall MGEProxyDevice::SetMaterial(const D3DMATERIAL8* a) {
-    captureMaterial(a);
-    isWaterMaterial = (a->Power == 99999.0f);
+    if (CallRecorder::recording) {
+        CallRecorder::setMaterial(a);
+    }
+
+    state.setMaterial(reinterpret_cast<const ProxyState::Material*>(a));
 
     return ProxyDevice::SetMaterial(a);
 }
@@ -372,7 +318,11 @@ HRESULT _stdcall MGEProxyDevice::SetMaterial(const D3DMATERIAL8* a) {
 // SetLight
 // Capture what the sun is doing
 HRESULT _stdcall MGEProxyDevice::SetLight(DWORD a, const D3DLIGHT8* b) {
-    captureLight(a, b);
+    if (CallRecorder::recording) {
+        CallRecorder::setLight(a, b);
+    }
+
+    state.setLight(a, reinterpret_cast<const ProxyState::Light*>(b));
 
     // Exterior sunlight/interior "sun" appears to always be light 6
     if (a == 6 && DistantLand::ready) {
@@ -385,92 +335,45 @@ HRESULT _stdcall MGEProxyDevice::SetLight(DWORD a, const D3DLIGHT8* b) {
 // SetRenderState
 // Ignore Morrowind fog settings, and run stage 0 rendering after lighting setup
 HRESULT _stdcall MGEProxyDevice::SetRenderState(D3DRENDERSTATETYPE a, DWORD b) {
-    captureRenderState(a, b);
-
-    if (a == D3DRS_FOGVERTEXMODE || a == D3DRS_FOGTABLEMODE) {
-        return D3D_OK;
-    }
-    if ((Configuration.MGEFlags & USE_DISTANT_LAND) && (a == D3DRS_FOGSTART || a == D3DRS_FOGEND)) {
-        return D3D_OK;
+    if (CallRecorder::recording) {
+        CallRecorder::setRenderState(a, b);
     }
-    if (a == D3DRS_STENCILENABLE) {
-        isStencilScene = b;
-    }
-    else if (a == D3DRS_STENCILREF) {
-        stencilRef = b;
-    }
-
-    // Ambient is used for scene detection
-    if (a == D3DRS_AMBIENT) {
-        // Pure white ambient occurs with skydome and menu mode rendering
-        // Ambient is also never set properly when high enough outside that Morrowind renders nothing
-        isAmbientWhite = (b == 0xffffffff);
 
-        if (!isAmbientWhite) {
-            // Save real ambient, can be used in future frames if no draw calls are provoked
-            RGBVECTOR amb = D3DCOLOR(b);
-            DistantLand::setAmbientColour(amb);
-            lightrs.globalAmbient.r = amb.r;
-            lightrs.globalAmbient.g = amb.g;
-            lightrs.globalAmbient.b = amb.b;
-        }
+    if (!state.setRenderState(a, b)) {
+        return D3D_OK;
     }
-
     return ProxyDevice::SetRenderState(a, b);
 }
 
 // SetTextureStageState
 // Override some sampler options
 HRESULT _stdcall MGEProxyDevice::SetTextureStageState(DWORD a, D3DTEXTURESTAGESTATETYPE b, DWORD c) {
-    captureFragmentRenderState(a, b, c);
+    if (CallRecorder::recording) {
+        CallRecorder::setTextureStageState(a, b, c);
+    }
 
     // Sampler overrides to ensure trilinear/anisotropic filtering works
     // Note that DX8 had sampling state bound to texture stages instead of samplers
-    if (b == D3DTSS_MINFILTER) {
-        DWORD filter = (c != D3DTEXF_NONE) ? Configuration.ScaleFilter : D3DTEXF_NONE;
-        return realDevice->SetSamplerState(a, D3DSAMP_MINFILTER, filter);
-    } else if (b == D3DTSS_MIPFILTER) {
-        DWORD filter = (c != D3DTEXF_NONE) ? D3DTEXF_LINEAR : D3DTEXF_NONE;
-        return realDevice->SetSamplerState(a, D3DSAMP_MIPFILTER, filter);
+    uint32_t value = c, sampler;
+    if (!state.setTextureStageState(a, b, value, sampler)) {
+        return D3D_OK;
+    }
+    if (sampler) {
+        return realDevice->SetSamplerState(a, D3DSAMPLERSTATETYPE(sampler), value);
     }
-
     return ProxyDevice::SetTextureStageState(a, b, c);
 }
 
 // DrawIndexedPrimitive - Where all the drawing happens
 // Inspect draw calls for re-use later
 HRESULT _stdcall MGEProxyDevice::DrawIndexedPrimitive(D3DPRIMITIVETYPE a, UINT b, UINT c, UINT d, UINT e) {
-    // Allow distant land to inspect draw calls
-    bool isShadowStencil = isStencilScene && stencilRef <= 1;
-    if (DistantLand::ready && rendertargetNormal && isMainView && !isShadowStencil) {
-        rs.primType = a;
-        rs.baseIndex = baseVertexIndex;
-        rs.minIndex = b;
-        rs.vertCount = c;
-        rs.startIndex = d;
-        rs.primCount = e;
-
-        if (!stage0Complete && !isAmbientWhite) {
-            // At this point, only the sky is rendered in exteriors, or nothing in interiors
-            DistantLand::renderStage0();
-            stage0Complete = true;
-        }
+    if (CallRecorder::recording) {
+        CallRecorder::drawIndexedPrimitive(a, b, c, d, e);
+    }
 
-        if (isWaterMaterial) {
-            if (distantWater) {
-                // Call distant land instead of drawing water grid
-                if (!waterDrawn) {
-                    DistantLand::renderStageWater();
-                    waterDrawn = true;
-                }
-                return D3D_OK;
-            }
-        } else {
-            // Let distant land record call and skip if signalled
-            if (!DistantLand::inspectIndexedPrimitive(sceneCount, &rs, &frs, &lightrs)) {
-                return D3D_OK;
-            }
-        }
+    // Allow distant land to inspect draw calls
+    if (!state.drawIndexedPrimitive(a, baseVertexIndex, b, c, d, e)) {
+        return D3D_OK;
     }
 
     return ProxyDevice::DrawIndexedPrimitive(a, b, c, d, e);
@@ -481,9 +384,12 @@ ULONG _stdcall MGEProxyDevice::Release() {
     ULONG r = ProxyDevice::Release();
 
     if (r == 0) {
+        CallRecorder::stop();
+        LOG::logline("-- State filter: %llu calls forwarded, %llu redundant calls dropped", state.stateFilter.forwarded, state.stateFilter.dropped);
         DistantLand::release();
         MGEhud::release();
         StatusOverlay::release();
+        Profiler::releaseGPU();
     }
 
     return r;
@@ -521,228 +427,131 @@ void initOnLoad() {
         StatusOverlay::setStatus("MGE XE serious error condition. Exit Morrowind and check mgeXE.log for details.", StatusOverlay::PriorityError);
     }
 
+    updateSettings();
+
     // Clean up loading bar menu, otherwise it persists in the background
     mwBridge->destroyLoadingBar();
 
     VideoPatch::start(DistantLand::device);
 }
 
-// detectMenu
-// detects if view matrix is for UI / load bars
-// the projection matrix is never set to ortho, making it unusable for detection
-bool detectMenu(const D3DMATRIX* m) {
-    if (m->_41 != 0.0f || !(m->_42 == 0.0f || m->_42 == -600.0f) || m->_43 != 0.0f) {
-        return false;
+// updateSettings
+// Distant land state used by the forwarding rules, which changes on load and through the API
+void updateSettings() {
+    state.distantLandReady = DistantLand::ready;
+    state.distantLandFog = (Configuration.MGEFlags & USE_DISTANT_LAND) != 0;
+    state.distantWaterEnabled = (Configuration.MGEFlags & USE_DISTANT_LAND) || (Configuration.MGEFlags & USE_DISTANT_WATER);
+    state.scaleFilter = Configuration.ScaleFilter;
+}
+
+// DeviceHooks::endFrame
+// Capture post-UI screenshots, progress saving of earlier captures, and render the status overlay
+void DeviceHooks::endFrame() {
+    DistantLand::checkCaptureScreenshot(true);
+    ScreenshotQueue::update();
+    FrameSequence::update();
+
+    // Render status overlay, including this frame's profile
+    Profiler::endFrame();
+    StatusOverlay::setFPS(calcFPS());
+    StatusOverlay::show(DistantLand::device);
+}
+
+// --------------------------------------------------------
+// Resource creation
+// A released resource's address may be reused, the call recorder must not match it to the old resource
+
+HRESULT _stdcall MGEProxyDevice::CreateTexture(UINT a, UINT b, UINT c, DWORD d, D3DFORMAT e, D3DPOOL f, IDirect3DTexture8** g) {
+    HRESULT hr = ProxyDevice::CreateTexture(a, b, c, d, e, f, g);
+    if (hr == D3D_OK && CallRecorder::recording) {
+        CallRecorder::forgetResource(*g);
     }
+    return hr;
+}
 
-    if ((m->_11 == 0.0f || m->_11 == 1.0f) && m->_12 == 0.0f && (m->_13 == 0.0f || m->_13 == 1.0f) &&
-            m->_21 == 0.0f && (m->_22 == 0.0f || m->_22 == 1.0f) && (m->_23 == 0.0f || m->_23 == 1.0f) &&
-            (m->_31 == 0.0f || m->_31 == 1.0f) && (m->_32 == 0.0f || m->_32 == 1.0f) && m->_33 == 0.0f) {
-        return true;
+HRESULT _stdcall MGEProxyDevice::CreateVertexBuffer(UINT a, DWORD b, DWORD c, D3DPOOL d, IDirect3DVertexBuffer8** e) {
+    HRESULT hr = ProxyDevice::CreateVertexBuffer(a, b, c, d, e);
+    if (hr == D3D_OK && CallRecorder::recording) {
+        CallRecorder::forgetResource(*e);
     }
+    return hr;
+}
 
-    return false;
+HRESULT _stdcall MGEProxyDevice::CreateIndexBuffer(UINT a, DWORD b, D3DFORMAT c, D3DPOOL d, IDirect3DIndexBuffer8** e) {
+    HRESULT hr = ProxyDevice::CreateIndexBuffer(a, b, c, d, e);
+    if (hr == D3D_OK && CallRecorder::recording) {
+        CallRecorder::forgetResource(*e);
+    }
+    return hr;
 }
 
 // --------------------------------------------------------
 // State recording
 
 HRESULT _stdcall MGEProxyDevice::SetTexture(DWORD a, IDirect3DBaseTexture8* b) {
-    if (a == 0) {
-        rs.texture = b ? static_cast<ProxyTexture*>(b)->realTexture : NULL;
+    if (CallRecorder::recording) {
+        CallRecorder::setTexture(a, b);
+    }
+
+    IDirect3DTexture9* realTexture = b ? static_cast<ProxyTexture*>(b)->realTexture : NULL;
+    if (!state.setTexture(a, realTexture)) {
+        return D3D_OK;
     }
     return ProxyDevice::SetTexture(a, b);
 }
 
 HRESULT _stdcall MGEProxyDevice::SetVertexShader(DWORD a) {
-    rs.fvf = a;
+    if (CallRecorder::recording) {
+        CallRecorder::setVertexShader(a);
+    }
+
+    state.setFVF(a);
     return ProxyDevice::SetVertexShader(a);
 }
 
 HRESULT _stdcall MGEProxyDevice::SetStreamSource(UINT a, IDirect3DVertexBuffer8* b, UINT c) {
-    if (a == 0) {
-        rs.vb = (IDirect3DVertexBuffer9*)b;
-        rs.vbOffset = 0;
-        rs.vbStride = c;
+    if (CallRecorder::recording) {
+        CallRecorder::setStreamSource(a, (IDirect3DVertexBuffer9*)b, c);
     }
+
+    state.setStreamSource(a, (IDirect3DVertexBuffer9*)b, c);
     return ProxyDevice::SetStreamSource(a, b, c);
 }
 
 HRESULT _stdcall MGEProxyDevice::SetIndices(IDirect3DIndexBuffer8* a, UINT b) {
-    rs.ib = (IDirect3DIndexBuffer9*)a;
+    if (CallRecorder::recording) {
+        CallRecorder::setIndices((IDirect3DIndexBuffer9*)a, b);
+    }
+
+    state.setIndices((IDirect3DIndexBuffer9*)a);
     return ProxyDevice::SetIndices(a, b);
 }
 
 HRESULT _stdcall MGEProxyDevice::LightEnable(DWORD a, BOOL b) {
-    if (b) {
-        if (std::find(lightrs.active.begin(), lightrs.active.end(), a) == lightrs.active.end()) {
-            lightrs.active.push_back(a);
-        }
-    } else {
-        if (std::remove(lightrs.active.begin(), lightrs.active.end(), a) != lightrs.active.end()) {
-            lightrs.active.pop_back();
-        }
+    if (CallRecorder::recording) {
+        CallRecorder::lightEnable(a, b);
     }
-    return ProxyDevice::LightEnable(a, b);
-}
 
-void captureRenderState(D3DRENDERSTATETYPE a, DWORD b) {
-    switch (a) {
-    case D3DRS_VERTEXBLEND:
-        rs.vertexBlendState = b;
-        break;
-    case D3DRS_ZWRITEENABLE:
-        rs.zWrite = b;
-        break;
-    case D3DRS_CULLMODE:
-        rs.cullMode = b;
-        break;
-    case D3DRS_ALPHABLENDENABLE:
-        rs.blendEnable = (BYTE)b;
-        break;
-    case D3DRS_SRCBLEND:
-        rs.srcBlend = (BYTE)b;
-        break;
-    case D3DRS_DESTBLEND:
-        rs.destBlend = (BYTE)b;
-        break;
-    case D3DRS_ALPHATESTENABLE:
-        rs.alphaTest = (BYTE)b;
-        break;
-    case D3DRS_ALPHAFUNC:
-        rs.alphaFunc = (BYTE)b;
-        break;
-    case D3DRS_ALPHAREF:
-        rs.alphaRef = (BYTE)b;
-        break;
-    case D3DRS_LIGHTING:
-        rs.useLighting = (BYTE)b;
-        break;
-    case D3DRS_FOGENABLE:
-        rs.useFog = (BYTE)b;
-        break;
-    case D3DRS_DIFFUSEMATERIALSOURCE:
-        rs.matSrcDiffuse = (BYTE)b;
-        break;
-    case D3DRS_EMISSIVEMATERIALSOURCE:
-        rs.matSrcEmissive = (BYTE)b;
-        break;
-    }
+    state.lightEnable(a, b != FALSE);
+    return ProxyDevice::LightEnable(a, b);
 }
 
-void captureFragmentRenderState(DWORD a, D3DTEXTURESTAGESTATETYPE b, DWORD c) {
-    FragmentState::Stage* s = &frs.stage[a];
-
-    switch (b) {
-    case D3DTSS_COLOROP:
-        s->colorOp = (BYTE)c;
-        break;
-    case D3DTSS_COLORARG1:
-        s->colorArg1 = (BYTE)c;
-        break;
-    case D3DTSS_COLORARG2:
-        s->colorArg2 = (BYTE)c;
-        break;
-    case D3DTSS_ALPHAOP:
-        s->alphaOp = (BYTE)c;
-        break;
-    case D3DTSS_ALPHAARG1:
-        s->alphaArg1 = (BYTE)c;
-        break;
-    case D3DTSS_ALPHAARG2:
-        s->alphaArg2 = (BYTE)c;
-        break;
-    case D3DTSS_BUMPENVMAT00:
-        s->bumpEnvMat[0][0] = reinterpret_cast<float&>(c);
-        break;
-    case D3DTSS_BUMPENVMAT01:
-        s->bumpEnvMat[0][1] = reinterpret_cast<float&>(c);
-        break;
-    case D3DTSS_BUMPENVMAT10:
-        s->bumpEnvMat[1][0] = reinterpret_cast<float&>(c);
-        break;
-    case D3DTSS_BUMPENVMAT11:
-        s->bumpEnvMat[1][1] = reinterpret_cast<float&>(c);
-        break;
-    case D3DTSS_TEXCOORDINDEX:
-        s->texcoordIndex = c;
-        break;
-    case D3DTSS_BUMPENVLSCALE:
-        s->bumpLumiScale = reinterpret_cast<float&>(c);
-        break;
-    case D3DTSS_BUMPENVLOFFSET:
-        s->bumpLumiBias = reinterpret_cast<float&>(c);
-        break;
-    case D3DTSS_TEXTURETRANSFORMFLAGS:
-        s->texTransformFlags = c;
-        break;
-    case D3DTSS_COLORARG0:
-        s->colorArg0 = (BYTE)c;
-        break;
-    case D3DTSS_ALPHAARG0:
-        s->alphaArg0 = (BYTE)c;
-        break;
-    case D3DTSS_RESULTARG:
-        s->resultArg = (BYTE)c;
-        break;
+HRESULT _stdcall MGEProxyDevice::MultiplyTransform(D3DTRANSFORMSTATETYPE a, const D3DMATRIX* b) {
+    if (CallRecorder::recording) {
+        CallRecorder::multiplyTransform(a, b);
     }
-}
 
-void captureTransform(D3DTRANSFORMSTATETYPE a, const D3DMATRIX* b) {
-    switch (a) {
-    case D3DTS_WORLDMATRIX(0):
-        rs.worldTransforms[0] = *b;
-        D3DXMatrixMultiply(&rs.worldViewTransforms[0], static_cast<const D3DXMATRIX*>(b), &rs.viewTransform);
-        break;
-    case D3DTS_WORLDMATRIX(1):
-        rs.worldTransforms[1] = *b;
-        D3DXMatrixMultiply(&rs.worldViewTransforms[1], static_cast<const D3DXMATRIX*>(b), &rs.viewTransform);
-        break;
-    case D3DTS_WORLDMATRIX(2):
-        rs.worldTransforms[2] = *b;
-        D3DXMatrixMultiply(&rs.worldViewTransforms[2], static_cast<const D3DXMATRIX*>(b), &rs.viewTransform);
-        break;
-    case D3DTS_WORLDMATRIX(3):
-        rs.worldTransforms[3] = *b;
-        D3DXMatrixMultiply(&rs.worldViewTransforms[3], static_cast<const D3DXMATRIX*>(b), &rs.viewTransform);
-        break;
-    case D3DTS_VIEW:
-        rs.viewTransform = *b;
-        lightrs.lightsTransformed.clear();
-        break;
-    }
+    state.multiplyTransform();
+    return ProxyDevice::MultiplyTransform(a, b);
 }
 
-void captureLight(DWORD a, const D3DLIGHT8* b) {
-    // Morrowind uses non-contigous light IDs up to a large number (>512)
-    LightState::Light* light = &lightrs.lights[a];
-
-    // Copy values relevant to Morrowind
-    // i.e. Morrowind has no spotlights and always sets range to FLT_MAX
-    // The only light source with ambient is sunlight
-    light->type = b->Type;
-    light->diffuse = b->Diffuse;
-
-    if (b->Type == D3DLIGHT_POINT) {
-        light->position = b->Position;
-        light->falloff.x = b->Attenuation0;
-        light->falloff.y = b->Attenuation1;
-        light->falloff.z = b->Attenuation2;
-    } else {
-        D3DXVec3Normalize((D3DXVECTOR3*)&light->position, (D3DXVECTOR3*)&b->Direction);
-        light->ambient.x = b->Ambient.r;
-        light->ambient.y = b->Ambient.g;
-        light->ambient.z = b->Ambient.b;
+HRESULT _stdcall MGEProxyDevice::ApplyStateBlock(DWORD a) {
+    if (CallRecorder::recording) {
+        CallRecorder::applyStateBlock(a);
     }
-}
 
-void captureMaterial(const D3DMATERIAL8* a) {
-    // Morrowind does not use specular lighting
-    rs.diffuseMaterial = a->Diffuse;
-    frs.material.diffuse = a->Diffuse;
-    frs.material.ambient = a->Ambient;
-    frs.material.emissive = a->Emissive;
-    frs.material.emissive.a = a->Power;
+    state.applyStateBlock();
+    return ProxyDevice::ApplyStateBlock(a);
 }
 
 // --------------------------------------------------------
@@ -10,15 +10,20 @@ public:
     ULONG _stdcall Release(void);
 
     HRESULT _stdcall Present(const RECT* a, const RECT* b, HWND c, const RGNDATA* d);
+    HRESULT _stdcall CreateTexture(UINT a, UINT b, UINT c, DWORD d, D3DFORMAT e, D3DPOOL f, IDirect3DTexture8** g);
+    HRESULT _stdcall CreateVertexBuffer(UINT a, DWORD b, DWORD c, D3DPOOL d, IDirect3DVertexBuffer8** e);
+    HRESULT _stdcall CreateIndexBuffer(UINT a, DWORD b, D3DFORMAT c, D3DPOOL d, IDirect3DIndexBuffer8** e);
     HRESULT _stdcall SetRenderTarget(IDirect3DSurface8* a, IDirect3DSurface8* b);
     HRESULT _stdcall BeginScene();
     HRESULT _stdcall EndScene();
     HRESULT _stdcall Clear(DWORD a, const D3DRECT* b, DWORD c, D3DCOLOR d, float e, DWORD f);
     HRESULT _stdcall SetTransform(D3DTRANSFORMSTATETYPE a, const D3DMATRIX* b);
+    HRESULT _stdcall MultiplyTransform(D3DTRANSFORMSTATETYPE a, const D3DMATRIX* b);
     HRESULT _stdcall SetMaterial(const D3DMATERIAL8* a);
     HRESULT _stdcall SetLight(DWORD a, const D3DLIGHT8* b);
     HRESULT _stdcall LightEnable(DWORD a, BOOL b);
     HRESULT _stdcall SetRenderState(D3DRENDERSTATETYPE a, DWORD b);
+    HRESULT _stdcall ApplyStateBlock(DWORD a);
     HRESULT _stdcall SetTextureStageState(DWORD a, D3DTEXTURESTAGESTATETYPE b, DWORD c);
     HRESULT _stdcall SetTexture(DWORD a, IDirect3DBaseTexture8* b);
     HRESULT _stdcall DrawIndexedPrimitive(D3DPRIMITIVETYPE a, UINT b, UINT c, UINT d, UINT e);
@@ -4,6 +4,7 @@
 #include "support/log.h"
 #include "mgedinput.h"
 #include "configuration.h"
+#include "keymacros.h"
 #include "mgeversion.h"
 #include "mmefunctiondefs.h"
 #include "mwbridge.h"
@@ -16,21 +17,13 @@ int MGEProxyDirectInput::modifierKeys = 0;
 typedef void (*FakeFunc)();
 
 static FakeFunc FakeFuncs[MGEINPUT_GRAPHICSFUNCS];  // See GraphicsFuncs enum
-static sFakeKey FakeKeys[MGEINPUT_MAXMACROS];       // Last 10 reserved for mouse
-static sFakeTrigger Triggers[MGEINPUT_MAXTRIGGERS]; // Up to 4 time delayed triggers
+static KeyMacros Macros;                            // Macros, triggers and forced key states
 static BYTE RemappedKeys[256];
 
 // Input device macro variables
-static BYTE LastBytes[MGEINPUT_MAXMACROS];          // Which keys were pressed last GetData call
-static BYTE FakeStates[MGEINPUT_MAXMACROS];         // Which keys are currently permanently down
-static BYTE HammerStates[MGEINPUT_MAXMACROS];       // Which keys are currently being hammered
-static BYTE AHammerStates[MGEINPUT_MAXMACROS];      // Which keys are currently being ahammered
-static BYTE TapStates[MGEINPUT_MAXMACROS];          // Which keys need to be tapped next frame
-static BYTE DisallowMask[MGEINPUT_MAXMACROS];       // Mask of which keys are disallowed
 static DIDEVICEOBJECTDATA FakeBuffer[256];          // Stores the list of fake keypresses to send to console
 static DWORD FakeBufferStart;                       // The index of the next character to write from FakeBuffer[]
 static DWORD FakeBufferEnd;                         // The index of the last character contained in FakeBuffer[]
-static DWORD TriggerFireTimes[MGEINPUT_MAXTRIGGERS];
 static bool FinishedFake;                           // true to shut down the console
 static bool CloseConsole;                           // true to shut the console after performing a command
 static BYTE MouseIn[10];                            // Used to transfer keypresses to the mouse
@@ -50,8 +43,6 @@ static struct {
 const int altSensitivity = 18;      // How many pixels the mouse must move to register an attack
 const int maxGap = 15;              // If the difference between x and y movement is greater than this, don't use a hacking attack
 
-static bool GlobalHammer;
-
 
 
 static void loadInputSettings();
@@ -62,20 +53,11 @@ void* CreateInputWrapper(void* real) {
     loadInputSettings();
 
     // Initial state
-    GlobalHammer = true;       // Used to hammer keys (alternates between up/down)
-
     FakeBufferStart = 0;
     FakeBufferEnd = 0;
     FinishedFake = false;      // true to shut down the console
     CloseConsole = false;      // true to shut the console after performing a command
 
-    ZeroMemory(&LastBytes, sizeof(LastBytes));
-    memset(DisallowMask, 0xff, sizeof(DisallowMask));
-
-    for (int i = 0; i != MGEINPUT_MAXTRIGGERS; ++i) {
-        TriggerFireTimes[i] = GetTickCount() + Triggers[i].TimeInterval;
-    }
-
     // Initialize the array of macro function pointers
     for (int i = 0; i != MGEINPUT_GRAPHICSFUNCS; ++i) {
         FakeFuncs[i] = stub;
@@ -124,37 +106,35 @@ void* CreateInputWrapper(void* real) {
     FakeFuncs[GF_MoveUp3PC] = MacroFunctions::MoveUp3PCam;
 
     // Force screenshots from PrintScreen
-    FakeKeys[DIK_SYSRQ].type = MT_Graphics;
-    FakeKeys[DIK_SYSRQ].Function.index = GF_Screenshot;
+    Macros.keys[DIK_SYSRQ].type = MT_Graphics;
+    Macros.keys[DIK_SYSRQ].Function.index = GF_Screenshot;
+
+    Macros.reset(GetTickCount());
 
     return new MGEProxyDirectInput((IDirectInput8A*)real);
 }
 
 void MGEProxyDirectInput::changeKeyBehavior(DWORD key, MGEProxyDirectInput::KeyBehavior kb, bool on) {
-    if (key >= MGEINPUT_MAXMACROS) {
-        return;
-    }
-
     switch (kb) {
     case MGEProxyDirectInput::TAP:
-        TapStates[key] = on ? 0x80 : 0;
+        Macros.changeKeyBehavior(key, KeyMacros::Tap, on);
         break;
     case MGEProxyDirectInput::PUSH:
-        FakeStates[key] = on ? 0x80 : 0;
+        Macros.changeKeyBehavior(key, KeyMacros::Push, on);
         break;
     case MGEProxyDirectInput::HAMMER:
-        HammerStates[key] = on ? 0x80 : 0;
+        Macros.changeKeyBehavior(key, KeyMacros::Hammer, on);
         break;
     case MGEProxyDirectInput::AHAMMER:
-        AHammerStates[key] = on ? 0x80 : 0;
+        Macros.changeKeyBehavior(key, KeyMacros::AHammer, on);
         break;
     case MGEProxyDirectInput::DISALLOW:
-        DisallowMask[key] = on ? 0 : 0xff;
+        Macros.changeKeyBehavior(key, KeyMacros::Disallow, on);
         break;
     }
 }
 
-static void FakeString(BYTE chars[], BYTE data[], BYTE length) {
+static void FakeString(const BYTE chars[], const BYTE data[], BYTE length) {
     for (int i = 0; i != length; ++i) {
         FakeBuffer[FakeBufferEnd].dwOfs = chars[i];
         FakeBuffer[FakeBufferEnd].dwData = data[i];
@@ -162,6 +142,19 @@ static void FakeString(BYTE chars[], BYTE data[], BYTE length) {
     }
 }
 
+// MacroActions - Console commands and graphics functions run by keyboard macros
+class MacroActions : public KeyMacros::Actions {
+public:
+    void consoleCommand(const FD_Console& console, bool closeConsole) {
+        FakeString(console.KeyCodes, console.KeyStates, console.Length);
+        CloseConsole = closeConsole;
+    }
+
+    void graphicsFunction(uint8_t index) {
+        (FakeFuncs[index])();
+    }
+};
+
 
 // RemapWrapper: Keyboard remapper
 class RemapWrapper : public ProxyInputDevice {
@@ -235,144 +228,13 @@ public:
         }
         MGEProxyDirectInput::modifierKeys = modifierKeys;
 
-        // Get any extra key presses
-        GlobalHammer = !GlobalHammer;
-        const BYTE* hammer = GlobalHammer ? HammerStates : AHammerStates;
-
-        for (DWORD byte = 0; byte < 256; byte++) {
-            bytes[byte] |= FakeStates[byte];
-            bytes[byte] |= hammer[byte];
-            bytes[byte] &= DisallowMask[byte];
-            bytes[byte] |= TapStates[byte];
-            TapStates[byte] = 0;
-        }
-        for (DWORD byte = 256; byte < MGEINPUT_MAXMACROS; byte++) {
-            bytes[byte] |= FakeStates[byte];
-            bytes[byte] |= hammer[byte];
-        }
+        // Apply forced key states, triggers and macros
+        MacroActions actions;
+        bool closingConsole = FinishedFake;
+        FinishedFake = false;
+        Macros.poll(bytes, GetTickCount(), closingConsole, actions);
 
-        if (FinishedFake) {
-            // Close the console after faking a command (If using console 1 style)
-            FinishedFake = false;
-            bytes[0x29] = 0x80;
-        } else {
-            // Process triggers
-            DWORD time = GetTickCount();
-            for (DWORD trigger = 0; trigger < MGEINPUT_MAXTRIGGERS; trigger++) {
-                if (Triggers[trigger].Active && Triggers[trigger].TimeInterval > 0 && TriggerFireTimes[trigger] < time) {
-                    for (int i = 0; i < MGEINPUT_MAXMACROS; i++) {
-                        bytes[i] |= Triggers[trigger].Data.KeyStates[i];
-                    }
-
-                    TriggerFireTimes[trigger] = time + Triggers[trigger].TimeInterval;
-                }
-            }
-            // Process each key for keypresses
-            for (DWORD key = 0; key < MGEINPUT_MAXMACROS; key++) {
-                if (FakeKeys[key].type != MT_Unused && (bytes[key] & 0x80)) {
-                    BYTE last = LastBytes[key] & 0x80;
-                    switch (FakeKeys[key].type) {
-                    case MT_Console1:
-                        if (!last) {
-                            bytes[0x29] = 0x80;
-                            FakeString(FakeKeys[key].Console.KeyCodes, FakeKeys[key].Console.KeyStates, FakeKeys[key].Console.Length);
-                            CloseConsole = true;
-                        }
-                        break;
-                    case MT_Console2:
-                        if (!last) {
-                            FakeString(FakeKeys[key].Console.KeyCodes, FakeKeys[key].Console.KeyStates, FakeKeys[key].Console.Length);
-                            CloseConsole = false;
-                        }
-                        break;
-                    case MT_Hammer1:
-                        for (DWORD byte = 0; byte < MGEINPUT_MAXMACROS; byte++) {
-                            if (FakeKeys[key].Press.KeyStates[byte] && GlobalHammer) {
-                                bytes[byte] = 0x80;
-                            }
-                        }
-                        break;
-                    case MT_Hammer2:
-                        for (DWORD byte = 0; byte < MGEINPUT_MAXMACROS; byte++) {
-                            if (FakeKeys[key].Press.KeyStates[byte]) {
-                                HammerStates[byte] = 0x80;
-                            }
-                        }
-                        break;
-                    case MT_Unhammer:
-                        for (DWORD byte = 0; byte < MGEINPUT_MAXMACROS; byte++) {
-                            if (FakeKeys[key].Press.KeyStates[byte]) {
-                                HammerStates[byte] = 0x00;
-                            }
-                        }
-                        break;
-                    case MT_AHammer1:
-                        for (DWORD byte = 0; byte < MGEINPUT_MAXMACROS; byte++) {
-                            if (FakeKeys[key].Press.KeyStates[byte] && !GlobalHammer) {
-                                bytes[byte] = 0x80;
-                            }
-                        }
-                        break;
-                    case MT_AHammer2:
-                        for (DWORD byte = 0; byte < MGEINPUT_MAXMACROS; byte++) {
-                            if (FakeKeys[key].Press.KeyStates[byte]) {
-                                AHammerStates[byte] = 0x80;
-                            }
-                        }
-                        break;
-                    case MT_AUnhammer:
-                        for (DWORD byte = 0; byte < MGEINPUT_MAXMACROS; byte++) {
-                            if (FakeKeys[key].Press.KeyStates[byte]) {
-                                AHammerStates[byte] = 0x00;
-                            }
-                        }
-                        break;
-                    case MT_Press1:
-                        for (DWORD byte = 0; byte < MGEINPUT_MAXMACROS; byte++) {
-                            if (FakeKeys[key].Press.KeyStates[byte]) {
-                                bytes[byte] = 0x80;
-                            }
-                        }
-                        break;
-                    case MT_Press2:
-                        for (DWORD byte = 0; byte < MGEINPUT_MAXMACROS; byte++) {
-                            if (FakeKeys[key].Press.KeyStates[byte]) {
-                                FakeStates[byte] = 0x80;
-                            }
-                        }
-                        break;
-                    case MT_Unpress:
-                        for (DWORD byte = 0; byte < MGEINPUT_MAXMACROS; byte++) {
-                            if (FakeKeys[key].Press.KeyStates[byte]) {
-                                FakeStates[byte] = 0x00;
-                            }
-                        }
-                        break;
-                    case MT_BeginTimer:
-                        if (!last) {
-                            Triggers[FakeKeys[key].Timer.TimerID].Active = true;
-                        }
-                        break;
-                    case MT_EndTimer:
-                        if (!last) {
-                            Triggers[FakeKeys[key].Timer.TimerID].Active = false;
-                        }
-                        break;
-                    case MT_Graphics:
-                        // Activate on keydown only, except for certain functions which should repeat
-                        if ((!last)||(FakeKeys[key].Function.index == GF_IncreaseZoom ||
-                                      FakeKeys[key].Function.index == GF_DecreaseZoom ||
-                                      FakeKeys[key].Function.index == GF_IncreaseFOV ||
-                                      FakeKeys[key].Function.index == GF_DecreaseFOV)) {
-                            (FakeFuncs[FakeKeys[key].Function.index])();
-                        }
-                        break;
-                    }
-                }
-            }
-        }
         CopyMemory(b, bytes, a);
-        CopyMemory(LastBytes, bytes, MGEINPUT_MAXMACROS);
         CopyMemory(MouseIn, &bytes[256], 10);
         return DI_OK;
     }
@@ -435,9 +297,12 @@ public:
         for (DWORD i = 0; i < 8; i++) {
             MouseOut[i] = mouseState->rgbButtons[i];
             mouseState->rgbButtons[i] |= MouseIn[i];
-            mouseState->rgbButtons[i] &= DisallowMask[i+256];
-            mouseState->rgbButtons[i] |= TapStates[i+256];
-            TapStates[i+256] = 0;
+            if (Macros.disallowed(i + 256)) {
+                mouseState->rgbButtons[i] = 0;
+            }
+            if (Macros.takeTap(i + 256)) {
+                mouseState->rgbButtons[i] |= 0x80;
+            }
         }
 
         return DI_OK;
@@ -476,7 +341,7 @@ public:
             keyState[forward] = keyState[back] = keyState[left] = keyState[right] = 0;
 
             // Then set appropriate keys to pressed depending on what type of attack is being made
-            if (GlobalHammer) {
+            if (Macros.hammerPhase()) {
                 // AltCombat.attackType == State_CHOP -> no key required
                 if (AltCombat.attackType == State_SLASH) {
                     keyState[left] = 0x80;
@@ -660,7 +525,7 @@ static void loadInputSettings() {
             continue;
         }
 
-        sFakeKey* macro = &FakeKeys[key];
+        sFakeKey* macro = &Macros.keys[key];
         for (const MacroTypeLabel* x = macroTypeLabels; x->label; ++x) {
             if (std::strcmp(values, x->label) == 0) {
                 macro->type = x->type;
@@ -715,7 +580,7 @@ static void loadInputSettings() {
             continue;
         }
 
-        sFakeTrigger* trigger = &Triggers[key];
+        sFakeTrigger* trigger = &Macros.triggers[key];
 
         trigger->Active = (std::strcmp(values, "True") == 0);
         values = entryNextValue(values);
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+
 const size_t MGEINPUT_MAXMACROS = 256 + 10;
 const size_t MGEINPUT_MAXTRIGGERS = 4;
 
@@ -133,22 +136,22 @@ enum GraphicsFuncs {
 };
 
 struct FD_Console {
-    BYTE Length;                        // The size of the string
-    BYTE KeyCodes[MGEINPUT_MAXMACROS];  // A list of keycodes (This can be a byte because there's never more than 256)
-    BYTE KeyStates[MGEINPUT_MAXMACROS]; // A list of keystates
+    uint8_t Length;                         // The size of the string
+    uint8_t KeyCodes[MGEINPUT_MAXMACROS];   // A list of keycodes (This can be a byte because there's never more than 256)
+    uint8_t KeyStates[MGEINPUT_MAXMACROS];  // A list of keystates
 };
 struct FD_Press {
-    BYTE KeyStates[MGEINPUT_MAXMACROS]; // Includes mouse buttons
+    uint8_t KeyStates[MGEINPUT_MAXMACROS];  // Includes mouse buttons
 };
 struct FD_Timer {
-    BYTE TimerID;                       // The timer to activate/deactivate
+    uint8_t TimerID;                        // The timer to activate/deactivate
 };
 struct FD_MGEFunction {
-    BYTE index;                      // The GraphicsFunc to call
+    uint8_t index;                          // The GraphicsFunc to call
 };
 
 struct sFakeKey {
-    BYTE type;
+    uint8_t type;
     union {
         FD_Console Console;
         FD_Press Press;
@@ -158,7 +161,7 @@ struct sFakeKey {
 };
 
 struct sFakeTrigger {
-    DWORD TimeInterval;
-    BYTE Active;
+    uint32_t TimeInterval;
+    uint8_t Active;
     FD_Press Data;
 };
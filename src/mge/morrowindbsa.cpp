@@ -1,11 +1,20 @@
 
 #include "morrowindbsa.h"
+#include "configuration.h"
 #include "proxydx/d3d8header.h"
-
+#include "support/bsaindex.h"
+#include "support/ddsparse.h"
+#include "support/filemapping.h"
+#include "support/log.h"
+#include "support/loosefiles.h"
+#include "support/texturecache.h"
+
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
+#include <string>
 #include <unordered_map>
-#include <memory>
+#include <vector>
 
 
 
@@ -13,177 +22,222 @@ namespace BSA {
 
 using std::unordered_map;
 
-struct CacheEntry {
-    HANDLE file;
-    DWORD position;
-    DWORD size;
-};
+typedef BSAIndex::Entry CacheEntry;
+typedef BSAIndex::Hash BSAHash3;
 
-struct BSAHash3 {
-    union {
-        struct {
-            DWORD value1, value2;
-        };
-        __int64 LValue;
-    };
+struct Archive {
+    std::string name;
+    unsigned __int64 size;
+    FILETIME modified;
+    FileMapping mapping;
 };
 
-struct EntryData {
-    std::unique_ptr<char[]> data;
-    unsigned int size;
+static BSAIndex::Index cacheMap;
+static TextureCache<IDirect3DTexture9> loadedTextures;
+static std::vector<Archive> archives;
 
-    bool valid() const { return bool(data); }
-};
+// Snapshot of loose files in the texture folders, with the negative cache of texture requests
+static LooseTextures looseTextures("Data Files\\distantland\\statics\\", "Data Files\\");
 
-// Note: loadedTextures would ideally store weakRefs, but COM doesn't support those.
-static unordered_map<__int64, CacheEntry> cacheMap;
-static unordered_map<__int64, IDirect3DTexture9*> loadedTextures;
+// Merged index cache, valid while the archive list, sizes and modification times are unchanged
+static const char* indexCachePath = "MGE3\\BSA index.cache";
 
 
 
-// hashString - TES3 BSA Hash function
-static BSAHash3 hashString(const char* str) {
-    BSAHash3 result;
+// mapArchive - Create a read-only mapping of an archive
+static bool mapArchive(Archive& archive) {
+    char path[MAX_PATH];
+    std::snprintf(path, sizeof(path), "Data Files\\%s", archive.name.c_str());
 
-    unsigned int len = (unsigned int)strlen(str);
+    // Entry positions are 32-bit
+    return archive.size >= 12 && archive.size < 0xffffffffull && archive.mapping.open(path);
+}
 
-    // Use GhostWheel's code to hash the string
-    unsigned int l = len >> 1;
-    unsigned int sum, off, temp, i, n;
+// cacheArchives - Archive identities for the index cache
+static std::vector<BSAIndex::CacheArchive> cacheArchives() {
+    std::vector<BSAIndex::CacheArchive> list;
+    for (const auto& archive : archives) {
+        unsigned __int64 modified = (unsigned __int64(archive.modified.dwHighDateTime) << 32) | archive.modified.dwLowDateTime;
+        list.push_back({ archive.name, archive.size, modified });
+    }
+    return list;
+}
 
-    for (sum = off = i = 0; i < l; i++) {
-        sum ^= ((unsigned int)(str[i])) << (off & 0x1F);
-        off += 8;
+// loadIndexCache - Load the merged index with a single read, if it matches the current archives
+static bool loadIndexCache() {
+    HANDLE file = CreateFile(indexCachePath, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
     }
-    result.value1 = sum;
 
-    for (sum = off = 0; i < len; i++) {
-        temp = ((unsigned int)(str[i])) << (off & 0x1F);
-        sum ^= temp;
-        n = temp & 0x1F;
-        sum = (sum << (32-n)) | (sum >> n);  // binary rotate right
-        off += 8;
+    DWORD fileSize = GetFileSize(file, 0), bytesRead = 0;
+    std::vector<char> buf(fileSize != INVALID_FILE_SIZE ? fileSize : 0);
+    if (!buf.empty()) {
+        ReadFile(file, buf.data(), fileSize, &bytesRead, 0);
     }
-    result.value2 = sum;
-    return result;
-}
+    CloseHandle(file);
 
-// open - Read and store a BSA's index
-static void open(const char* path) {
-    HANDLE bsa = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
-    if (bsa == INVALID_HANDLE_VALUE) {
-        return;
+    if (buf.empty() || bytesRead != fileSize) {
+        return false;
     }
+    return BSAIndex::decodeCache(buf.data(), buf.size(), cacheArchives(), cacheMap);
+}
 
-    DWORD hashOffset, numFiles, bytesRead, unused;
-    ReadFile(bsa, &hashOffset, 4, &bytesRead, 0);
-    if (bytesRead != 4 || hashOffset != 0x100) {
-        CloseHandle(bsa);
+// saveIndexCache - Write the merged index, replacing any previous cache only once complete
+static void saveIndexCache() {
+    std::vector<char> buf;
+    BSAIndex::encodeCache(cacheArchives(), cacheMap, buf);
+
+    char tempPath[MAX_PATH];
+    std::snprintf(tempPath, sizeof(tempPath), "%s.tmp", indexCachePath);
+    HANDLE file = CreateFile(tempPath, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, 0, 0);
+    if (file == INVALID_HANDLE_VALUE) {
         return;
     }
 
-    ReadFile(bsa, &hashOffset, 4, &unused, 0);
-    ReadFile(bsa, &numFiles, 4, &unused, 0);
-    for (DWORD i = 0; i < numFiles; i++) {
-        CacheEntry entry;
-        __int64 hash;
-
-        entry.file = bsa;
-        SetFilePointer(bsa, 12 + i*8, 0, FILE_BEGIN);
-        ReadFile(bsa, &entry.size, 4, &unused, 0);
-        ReadFile(bsa, &entry.position, 4, &unused, 0);
-        entry.position += 12 + hashOffset + numFiles*8;
+    DWORD written = 0;
+    WriteFile(file, buf.data(), DWORD(buf.size()), &written, 0);
+    CloseHandle(file);
 
-        SetFilePointer(bsa, 12 + hashOffset + i*8, 0, FILE_BEGIN);
-        ReadFile(bsa, &hash, 8, &unused, 0);
-        cacheMap[hash] = entry;
+    if (written != buf.size() || !MoveFileEx(tempPath, indexCachePath, MOVEFILE_REPLACE_EXISTING)) {
+        DeleteFile(tempPath);
     }
 }
 
 // init - Scan and index all BSA files
 void init() {
-    char path[MAX_PATH];
     WIN32_FIND_DATA data;
 
+    // Drop any previous index, file views are never held across init
+    archives.clear();
+    cacheMap.clear();
+    looseTextures.invalidate();
+
     HANDLE h = FindFirstFile("Data Files\\*.bsa", &data);
     if (h == INVALID_HANDLE_VALUE) {
         return;
     }
 
     do {
-        std::snprintf(path, sizeof(path), "Data Files\\%s", data.cFileName);
-        open(path);
+        unsigned __int64 size = (unsigned __int64(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+        archives.push_back({ data.cFileName, size, data.ftLastWriteTime, FileMapping() });
     } while (FindNextFile(h, &data));
 
     FindClose(h);
+
+    for (auto& archive : archives) {
+        mapArchive(archive);
+    }
+
+    if (loadIndexCache()) {
+        LOG::logline("-- BSA index loaded from cache, %u archives, %u files", DWORD(archives.size()), DWORD(cacheMap.size()));
+        return;
+    }
+
+    for (DWORD i = 0; i != archives.size(); ++i) {
+        if (archives[i].mapping.isOpen()) {
+            BSAIndex::parseArchive(archives[i].mapping, i, cacheMap);
+        }
+    }
+
+    saveIndexCache();
+    LOG::logline("-- BSA index rebuilt, %u archives, %u files", DWORD(archives.size()), DWORD(cacheMap.size()));
 }
 
-// loadFile - Read a single file into memory, identified by hash only
-static EntryData BSALoadFile(BSAHash3 hash) {
-    auto it = cacheMap.find(hash.LValue);
-    if (it == cacheMap.end()) {
-        return EntryData();
+// refreshLooseFiles - Rebuild the loose texture snapshot if it is stale
+static void refreshLooseFiles() {
+    if (looseTextures.refresh()) {
+        LOG::logline("-- Loose texture snapshot, %u distant land files, %u data files",
+                     DWORD(looseTextures.files[LooseTextures::DistantStatics].size()), DWORD(looseTextures.files[LooseTextures::DataFiles].size()));
+    }
+}
+
+// loadFile - View a single file in its archive, identified by hash only
+// Only the file's own range is mapped, to keep 32-bit address space use low
+static FileView BSALoadFile(BSAHash3 hash) {
+    auto it = cacheMap.find(hash.value());
+    if (it == cacheMap.end() || it->second.size == 0) {
+        return FileView();
     }
 
     const CacheEntry& entry = it->second;
-    auto buf = std::make_unique<char[]>(entry.size);
-    DWORD bytesRead;
+    return archives[entry.archive].mapping.view(entry.position, entry.size);
+}
 
-    SetFilePointer(entry.file, entry.position, 0, FILE_BEGIN);
-    ReadFile(entry.file, buf.get(), entry.size, &bytesRead, 0);
+// textureBytes - Exact memory use of a texture, over all mip levels
+static size_t textureBytes(IDirect3DTexture9* tex) {
+    size_t bytes = 0;
 
-    if (bytesRead == entry.size) {
-        return EntryData { std::move(buf), entry.size };
-    } else {
-        return EntryData();
+    for (DWORD i = 0; i != tex->GetLevelCount(); ++i) {
+        D3DSURFACE_DESC desc;
+        tex->GetLevelDesc(i, &desc);
+        bytes += surfaceBytes(desc.Format, desc.Width, desc.Height);
+    }
+    return bytes;
+}
+
+// findCachedTexture - Look up a loaded texture, adding a reference for the caller
+static bool findCachedTexture(__int64 hash, IDirect3DTexture9** tex) {
+    return loadedTextures.find(hash, tex);
+}
+
+// cacheTexture - Add a newly loaded texture, the caller keeps the reference it already has
+static void cacheTexture(__int64 hash, IDirect3DTexture9* tex) {
+    loadedTextures.insert(hash, tex, tex ? textureBytes(tex) : 0);
+}
+
+// trimTextureCache - Evict least recently used textures which are only referenced by the cache, until within budget
+static void trimTextureCache() {
+    int evicted = loadedTextures.trim(size_t(Configuration.TextureCacheBudget) << 20);
+    if (evicted) {
+        LOG::logline("-- Texture cache over budget, %d unused textures released", evicted);
     }
 }
 
 // loadTextureExact - Attempt to load a texture from a prioritized list of sources.
-static IDirect3DTexture9* loadTextureExact(IDirect3DDevice9* dev, const char* filename) {
+// looseRoots has a bit per LooseTextures::Root holding the file.
+static IDirect3DTexture9* loadTextureExact(IDirect3DDevice9* dev, const char* filename, unsigned int looseRoots) {
     char pathbuf[MAX_PATH];
-    BSAHash3 hash = hashString(filename);
+    BSAHash3 hash = BSAIndex::hashString(filename);
     IDirect3DTexture9* tex = nullptr;
 
     // First check if the texture is already loaded
-    auto it = loadedTextures.find(hash.LValue);
-    if (it != loadedTextures.end()) {
-        it->second->AddRef();
-        return it->second;
+    if (findCachedTexture(hash.value(), &tex)) {
+        return tex;
     }
 
     // Next check the distant land folder
-    std::snprintf(pathbuf, sizeof(pathbuf), "Data Files\\distantland\\statics\\%s", filename);
-    if (GetFileAttributes(pathbuf) != INVALID_FILE_ATTRIBUTES) {
+    if (looseRoots & (1u << LooseTextures::DistantStatics)) {
+        std::snprintf(pathbuf, sizeof(pathbuf), "Data Files\\distantland\\statics\\%s", filename);
         HRESULT hr = D3DXCreateTextureFromFileEx(dev, pathbuf, D3DX_FROM_FILE, D3DX_FROM_FILE, D3DX_FROM_FILE, 0, D3DFMT_UNKNOWN,
                      D3DPOOL_DEFAULT, D3DX_FILTER_NONE, D3DX_FILTER_NONE, 0, 0, 0, &tex);
 
         if (hr == D3D_OK) {
-            loadedTextures[hash.LValue] = tex;
+            cacheTexture(hash.value(), tex);
             return tex;
         }
     }
 
     // Then check the normal folder
-    std::snprintf(pathbuf, sizeof(pathbuf), "Data Files\\%s", filename);
-    if (GetFileAttributes(pathbuf) != INVALID_FILE_ATTRIBUTES) {
+    if (looseRoots & (1u << LooseTextures::DataFiles)) {
+        std::snprintf(pathbuf, sizeof(pathbuf), "Data Files\\%s", filename);
         HRESULT hr = D3DXCreateTextureFromFileEx(dev, pathbuf, D3DX_FROM_FILE, D3DX_FROM_FILE, D3DX_FROM_FILE, 0, D3DFMT_UNKNOWN,
                      D3DPOOL_DEFAULT, D3DX_FILTER_NONE, D3DX_FILTER_NONE, 0, 0, 0, &tex);
 
         if (hr == D3D_OK) {
-            loadedTextures[hash.LValue] = tex;
+            cacheTexture(hash.value(), tex);
             return tex;
         }
     }
 
     // Finally check the BSAs
-    EntryData ed = BSALoadFile(hash);
+    FileView ed = BSALoadFile(hash);
     if (ed.valid()) {
-        D3DXCreateTextureFromFileInMemoryEx(dev, ed.data.get(), ed.size, D3DX_FROM_FILE, D3DX_FROM_FILE, D3DX_FROM_FILE,
+        D3DXCreateTextureFromFileInMemoryEx(dev, ed.data(), UINT(ed.size()), D3DX_FROM_FILE, D3DX_FROM_FILE, D3DX_FROM_FILE,
                                             0, D3DFMT_UNKNOWN, D3DPOOL_MANAGED, D3DX_DEFAULT, D3DX_DEFAULT, 0, 0, 0, &tex);
 
         // Cache even if the texture load failed
-        loadedTextures[hash.LValue] = tex;
+        cacheTexture(hash.value(), tex);
         return tex;
     }
 
@@ -193,49 +247,342 @@ static IDirect3DTexture9* loadTextureExact(IDirect3DDevice9* dev, const char* fi
 
 // loadTexture -  Attempt to load a texture from a prioritized list of sources, with extension substitution.
 IDirect3DTexture9* loadTexture(IDirect3DDevice9* dev, const char* filename) {
-    char pathbuf[MAX_PATH];
+    LooseTextureRequest request;
+
+    refreshLooseFiles();
+    if (!looseTextures.resolve(filename, &request)) {
+        return nullptr;
+    }
 
     // Prefer loading file with DDS extension first
-    std::snprintf(pathbuf, sizeof(pathbuf), "textures\\%s", filename);
-    std::strcpy(pathbuf + strlen(pathbuf) - 3, "dds");
+    IDirect3DTexture9* tex = loadTextureExact(dev, request.path[0], request.roots[0]);
+    if (!tex) {
+        // Load file with original extension
+        tex = loadTextureExact(dev, request.path[1], request.roots[1]);
+    }
+    if (!tex) {
+        looseTextures.markMissing(request);
+    }
 
-    IDirect3DTexture9* tex = loadTextureExact(dev, pathbuf);
-    if (tex) {
-        return tex;
+    trimTextureCache();
+    return tex;
+}
+
+// Batch texture loading pipeline
+// Worker threads resolve, read and parse files; textures are only created and filled on the calling thread
+enum TextureSource { SourceNone, SourceDistantStatics, SourceDataFiles, SourceBSA };
+
+struct TextureJob {
+    const char* name;
+    LooseTextureRequest request;
+    BSAHash3 hash[2];
+    int variant;
+    TextureSource source;
+    std::vector<char> fileData;
+    FileView bsaData;
+    const char* data;
+    size_t size;
+    DDSImage image;
+    bool parsed;
+    bool ready;
+    IDirect3DTexture9* tex;
+};
+
+struct TexturePipeline {
+    std::vector<TextureJob> jobs;
+    size_t nextJob, consumed;
+    SRWLOCK lock;
+    CONDITION_VARIABLE jobReady, windowOpen;
+};
+
+// Limits memory held by read-ahead, as staging data can be large compared to the 32-bit address space
+static const size_t pipelineWindow = 32;
+
+// readFile - Read a whole loose file
+static bool readFile(const char* path, std::vector<char>& buf) {
+    HANDLE file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
     }
 
-    // Load file with original extension
-    std::snprintf(pathbuf, sizeof(pathbuf), "textures\\%s", filename);
-    return loadTextureExact(dev, pathbuf);
+    DWORD size = GetFileSize(file, 0), bytesRead = 0;
+    if (size != INVALID_FILE_SIZE) {
+        buf.resize(size);
+        ReadFile(file, buf.data(), size, &bytesRead, 0);
+    }
+    CloseHandle(file);
+    return size != INVALID_FILE_SIZE && bytesRead == size;
 }
 
-// clearTextureCache - Clear texture cache.
-void clearTextureCache() {
-    loadedTextures.clear();
+// resolveTextureJob - Find and read the first matching source, then parse it if it is a DDS file
+// Uses the same source order as loadTextureExact, only reading shared state which is not modified while workers run
+static void resolveTextureJob(TextureJob& job) {
+    char pathbuf[MAX_PATH];
+
+    for (int v = 0; v != 2 && job.source == SourceNone; ++v) {
+        const char* path = job.request.path[v];
+        std::snprintf(pathbuf, sizeof(pathbuf), "Data Files\\distantland\\statics\\%s", path);
+        if (job.request.inRoot(v, LooseTextures::DistantStatics) && readFile(pathbuf, job.fileData)) {
+            job.source = SourceDistantStatics;
+        } else {
+            std::snprintf(pathbuf, sizeof(pathbuf), "Data Files\\%s", path);
+            if (job.request.inRoot(v, LooseTextures::DataFiles) && readFile(pathbuf, job.fileData)) {
+                job.source = SourceDataFiles;
+            } else {
+                job.bsaData = BSALoadFile(job.hash[v]);
+                if (job.bsaData.valid()) {
+                    job.source = SourceBSA;
+                }
+            }
+        }
+        job.variant = v;
+    }
+
+    if (job.source == SourceBSA) {
+        job.data = job.bsaData.data();
+        job.size = job.bsaData.size();
+    } else if (job.source != SourceNone) {
+        job.data = job.fileData.data();
+        job.size = job.fileData.size();
+    }
+
+    if (job.data) {
+        job.parsed = ddsParse(job.data, job.size, &job.image);
+    }
 }
 
-// cacheStats - Returns number of textures cached, and approximate memory use in MB.
-void cacheStats(int* total, int* memuse) {
-    __int64 texMemUsage = 0;
+// textureWorker - Worker thread, processes jobs in order within the read-ahead window
+static DWORD WINAPI textureWorker(void* param) {
+    TexturePipeline* pipeline = reinterpret_cast<TexturePipeline*>(param);
 
-    const auto& loadedTextures_const = loadedTextures;
-    for (const auto& i : loadedTextures_const) {
-        D3DSURFACE_DESC texdesc;
-        i.second->GetLevelDesc(0, &texdesc);
+    for (;;) {
+        AcquireSRWLockExclusive(&pipeline->lock);
+        while (pipeline->nextJob < pipeline->jobs.size() && pipeline->nextJob >= pipeline->consumed + pipelineWindow) {
+            SleepConditionVariableSRW(&pipeline->windowOpen, &pipeline->lock, INFINITE, 0);
+        }
+        if (pipeline->nextJob >= pipeline->jobs.size()) {
+            ReleaseSRWLockExclusive(&pipeline->lock);
+            return 0;
+        }
+        TextureJob& job = pipeline->jobs[pipeline->nextJob++];
+        ReleaseSRWLockExclusive(&pipeline->lock);
+
+        if (!job.ready) {
+            resolveTextureJob(job);
+        }
+
+        AcquireSRWLockExclusive(&pipeline->lock);
+        job.ready = true;
+        ReleaseSRWLockExclusive(&pipeline->lock);
+        WakeAllConditionVariable(&pipeline->jobReady);
+    }
+}
+
+// createParsedTexture - Create a texture from a parsed DDS image, staging through system memory for the default pool
+static IDirect3DTexture9* createParsedTexture(IDirect3DDevice9* dev, const DDSImage& image, D3DPOOL pool) {
+    D3DFORMAT format;
+    switch (image.format) {
+    case DDSFormat::DXT1:
+        format = D3DFMT_DXT1;
+        break;
+    case DDSFormat::DXT3:
+        format = D3DFMT_DXT3;
+        break;
+    case DDSFormat::DXT5:
+        format = D3DFMT_DXT5;
+        break;
+    case DDSFormat::A8R8G8B8:
+        format = D3DFMT_A8R8G8B8;
+        break;
+    case DDSFormat::X8R8G8B8:
+        format = D3DFMT_X8R8G8B8;
+        break;
+    default:
+        return nullptr;
+    }
+
+    UINT levels = UINT(image.levels.size());
+    IDirect3DTexture9* staging, *tex = nullptr;
+    D3DPOOL stagingPool = (pool == D3DPOOL_DEFAULT) ? D3DPOOL_SYSTEMMEM : pool;
+    if (dev->CreateTexture(image.width, image.height, levels, 0, format, stagingPool, &staging, 0) != D3D_OK) {
+        return nullptr;
+    }
+
+    for (UINT i = 0; i != levels; ++i) {
+        const DDSImage::Level& level = image.levels[i];
+        D3DLOCKED_RECT lr;
+        if (staging->LockRect(i, &lr, 0, 0) != D3D_OK) {
+            staging->Release();
+            return nullptr;
+        }
+        for (UINT r = 0; r != level.rows; ++r) {
+            std::memcpy(reinterpret_cast<BYTE*>(lr.pBits) + r * lr.Pitch, level.data + r * level.pitch, level.pitch);
+        }
+        staging->UnlockRect(i);
+    }
+
+    if (pool != D3DPOOL_DEFAULT) {
+        return staging;
+    }
+
+    if (dev->CreateTexture(image.width, image.height, levels, 0, format, D3DPOOL_DEFAULT, &tex, 0) == D3D_OK) {
+        if (dev->UpdateTexture(staging, tex) != D3D_OK) {
+            tex->Release();
+            tex = nullptr;
+        }
+    }
+    staging->Release();
+    return tex;
+}
+
+// finishTextureJob - Create the texture for a resolved job, falling back to the sequential loader on failure
+static IDirect3DTexture9* finishTextureJob(IDirect3DDevice9* dev, TextureJob& job) {
+    IDirect3DTexture9* tex = nullptr;
+
+    // An original extension texture may have been loaded since the job was queued
+    if (job.variant == 1 && findCachedTexture(job.hash[1].value(), &tex)) {
+        return tex;
+    }
+    if (job.source == SourceNone) {
+        return nullptr;
+    }
+
+    D3DPOOL pool = (job.source == SourceBSA) ? D3DPOOL_MANAGED : D3DPOOL_DEFAULT;
+    if (job.parsed) {
+        tex = createParsedTexture(dev, job.image, pool);
+    }
+    if (!tex) {
+        DWORD filter = (job.source == SourceBSA) ? D3DX_DEFAULT : D3DX_FILTER_NONE;
+        D3DXCreateTextureFromFileInMemoryEx(dev, job.data, UINT(job.size), D3DX_FROM_FILE, D3DX_FROM_FILE, D3DX_FROM_FILE,
+                                            0, D3DFMT_UNKNOWN, pool, filter, filter, 0, 0, 0, &tex);
+    }
+    if (!tex) {
+        // Let the sequential loader try the remaining sources
+        return loadTexture(dev, job.name);
+    }
 
-        int bpp = 32;
-        if (texdesc.Format == D3DFMT_DXT1) {
-            bpp = 4;
+    cacheTexture(job.hash[job.variant].value(), tex);
+    return tex;
+}
+
+// loadTextures - Load many textures at once, with the same results and reference counting as calling loadTexture on each
+void loadTextures(IDirect3DDevice9* dev, const std::vector<const char*>& filenames, std::vector<IDirect3DTexture9*>& textures) {
+    TexturePipeline pipeline;
+    std::unordered_map<std::string, size_t> unique;
+    std::vector<size_t> jobIndex;
+
+    refreshLooseFiles();
+
+    // Collect unique names up front
+    jobIndex.reserve(filenames.size());
+    for (const char* name : filenames) {
+        LooseTextureRequest request;
+        bool resolved = looseTextures.resolve(name, &request);
+
+        auto ins = unique.emplace(request.valid ? request.path[1] : name, pipeline.jobs.size());
+        jobIndex.push_back(ins.first->second);
+        if (!ins.second) {
+            continue;
+        }
+
+        pipeline.jobs.emplace_back();
+        TextureJob& job = pipeline.jobs.back();
+        job.name = name;
+        job.request = request;
+        job.hash[0] = BSAIndex::hashString(request.path[0]);
+        job.hash[1] = BSAIndex::hashString(request.path[1]);
+        job.variant = 0;
+        job.source = SourceNone;
+        job.data = nullptr;
+        job.size = 0;
+        job.parsed = false;
+        job.tex = nullptr;
+
+        // Already loaded and known missing textures skip the workers
+        job.ready = !resolved;
+        job.ready = job.ready || (findCachedTexture(job.hash[0].value(), &job.tex) && job.tex);
+    }
+
+    pipeline.nextJob = pipeline.consumed = 0;
+    InitializeSRWLock(&pipeline.lock);
+    InitializeConditionVariable(&pipeline.jobReady);
+    InitializeConditionVariable(&pipeline.windowOpen);
+
+    SYSTEM_INFO sysInfo;
+    GetSystemInfo(&sysInfo);
+    DWORD numWorkers = std::max(1ul, std::min(4ul, sysInfo.dwNumberOfProcessors - 1));
+    std::vector<HANDLE> workers;
+    for (DWORD i = 0; i != numWorkers; ++i) {
+        HANDLE h = CreateThread(0, 0, textureWorker, &pipeline, 0, 0);
+        if (h) {
+            workers.push_back(h);
+        }
+    }
+
+    // Device thread: create textures in order as jobs complete
+    for (size_t i = 0; i != pipeline.jobs.size(); ++i) {
+        TextureJob& job = pipeline.jobs[i];
+
+        AcquireSRWLockExclusive(&pipeline.lock);
+        while (!job.ready && !workers.empty()) {
+            SleepConditionVariableSRW(&pipeline.jobReady, &pipeline.lock, INFINITE, 0);
+        }
+        ReleaseSRWLockExclusive(&pipeline.lock);
+
+        if (workers.empty() && !job.ready) {
+            resolveTextureJob(job);
         }
-        if (texdesc.Format == D3DFMT_DXT3 || texdesc.Format == D3DFMT_DXT5) {
-            bpp = 8;
+        if (!job.tex) {
+            job.tex = finishTextureJob(dev, job);
         }
+        if (!job.tex) {
+            looseTextures.markMissing(job.request);
+        }
+
+        // Release staging data early
+        job.fileData = std::vector<char>();
+        job.bsaData = FileView();
+        job.image.levels = std::vector<DDSImage::Level>();
+
+        AcquireSRWLockExclusive(&pipeline.lock);
+        pipeline.consumed = i + 1;
+        ReleaseSRWLockExclusive(&pipeline.lock);
+        WakeAllConditionVariable(&pipeline.windowOpen);
+    }
 
-        texMemUsage += (texdesc.Width * texdesc.Height * bpp / 8) * 4 / 3;
+    if (!workers.empty()) {
+        WaitForMultipleObjects(DWORD(workers.size()), workers.data(), TRUE, INFINITE);
+        for (HANDLE h : workers) {
+            CloseHandle(h);
+        }
+    }
+
+    // Each job holds one reference, further requests for the same name take another
+    std::vector<bool> taken(pipeline.jobs.size(), false);
+    textures.resize(filenames.size());
+    for (size_t i = 0; i != filenames.size(); ++i) {
+        size_t j = jobIndex[i];
+        IDirect3DTexture9* tex = pipeline.jobs[j].tex;
+        if (tex && taken[j]) {
+            tex->AddRef();
+        }
+        taken[j] = true;
+        textures[i] = tex;
     }
 
-    *total = loadedTextures.size();
-    *memuse = (int)(texMemUsage / 1048576.0);
+    trimTextureCache();
+}
+
+// clearTextureCache - Clear texture cache, releasing the cache's references.
+void clearTextureCache() {
+    loadedTextures.clear();
+    looseTextures.invalidate();
+}
+
+// cacheStats - Returns number of textures cached, and exact memory use in MB.
+void cacheStats(int* total, int* memuse) {
+    *total = int(loadedTextures.size());
+    *memuse = int(loadedTextures.residentBytes() >> 20);
 }
 
 }
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <vector>
+
 struct IDirect3DDevice9;
 struct IDirect3DTexture9;
 
@@ -7,6 +9,7 @@ struct IDirect3DTexture9;
 namespace BSA {
     void init();
     IDirect3DTexture9* loadTexture(IDirect3DDevice9* dev, const char* filename);
+    void loadTextures(IDirect3DDevice9* dev, const std::vector<const char*>& filenames, std::vector<IDirect3DTexture9*>& textures);
     void clearTextureCache();
     void cacheStats(int* total, int* memuse);
 }
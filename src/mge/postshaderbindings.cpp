@@ -0,0 +1,108 @@
+#include "postshaderbindings.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+
+static_assert(EV_count <= 32, "Shared variables are passed as a bit mask");
+
+void PostShaderBindings::clear() {
+    shared.clear();
+}
+
+void PostShaderBindings::bindEffect(ID3DXEffect* effect, const D3DXHANDLE* handles, uint32_t sharedMask, std::vector<Binding>& bindings) {
+    for (int i = 0; i != EV_count; ++i) {
+        // Per-pass textures are bound during rendering, rcpres is constant and set on load
+        if (i == EV_lastshader || i == EV_lastpass || i == EV_rcpres) {
+            continue;
+        }
+        if (!handles[i]) {
+            continue;
+        }
+
+        Binding b = { handles[i], EffectVariableID(i), nullptr };
+        if (sharedMask & (1u << i)) {
+            auto isSame = [=](const SharedBinding& sb) { return sb.binding.id == i; };
+            if (std::none_of(shared.begin(), shared.end(), isSame)) {
+                shared.push_back({ effect, b });
+            }
+        } else {
+            bindings.push_back(b);
+        }
+    }
+}
+
+void PostShaderBindings::uploadShared(const MGEShaderFrameVars& vars) {
+    for (auto& sb : shared) {
+        apply(sb.effect, sb.binding, vars);
+    }
+}
+
+// apply - Set one per-frame variable on an effect
+void PostShaderBindings::apply(ID3DXEffect* effect, Binding& b, const MGEShaderFrameVars& vars) {
+    const MGEShaderFrameVars::Slot& slot = vars.slots[b.id];
+
+    switch (slot.type) {
+    case MGEShaderFrameVars::SlotTexture:
+        // Textures rarely change, only rebind on change
+        if (b.boundTexture != slot.tex) {
+            effect->SetTexture(b.handle, slot.tex);
+            b.boundTexture = slot.tex;
+        }
+        break;
+    case MGEShaderFrameVars::SlotMatrix:
+        effect->SetMatrix(b.handle, reinterpret_cast<const D3DXMATRIX*>(slot.f));
+        break;
+    case MGEShaderFrameVars::SlotFloatArray:
+        effect->SetFloatArray(b.handle, slot.f, slot.count);
+        break;
+    case MGEShaderFrameVars::SlotInt:
+        effect->SetInt(b.handle, slot.i);
+        break;
+    case MGEShaderFrameVars::SlotBool:
+        effect->SetBool(b.handle, slot.b);
+        break;
+    default:
+        break;
+    }
+}
+
+void PostShaderBindings::apply(ID3DXEffect* effect, std::vector<Binding>& bindings, const MGEShaderFrameVars& vars) {
+    for (auto& b : bindings) {
+        apply(effect, b, vars);
+    }
+}
+
+
+
+// Frame variable storage, values are uploaded to shaders by the compiled chain
+void MGEShaderFrameVars::SetTexture(EffectVariableID id, LPDIRECT3DBASETEXTURE9 tex) {
+    slots[id].type = SlotTexture;
+    slots[id].tex = tex;
+}
+
+void MGEShaderFrameVars::SetMatrix(EffectVariableID id, const D3DXMATRIX* m) {
+    slots[id].type = SlotMatrix;
+    std::memcpy(slots[id].f, m, sizeof(D3DXMATRIX));
+}
+
+void MGEShaderFrameVars::SetFloatArray(EffectVariableID id, const float* x, int n) {
+    slots[id].type = SlotFloatArray;
+    slots[id].count = std::min(n, 16);
+    std::memcpy(slots[id].f, x, slots[id].count * sizeof(float));
+}
+
+void MGEShaderFrameVars::SetFloat(EffectVariableID id, float x) {
+    SetFloatArray(id, &x, 1);
+}
+
+void MGEShaderFrameVars::SetInt(EffectVariableID id, int x) {
+    slots[id].type = SlotInt;
+    slots[id].i = x;
+}
+
+void MGEShaderFrameVars::SetBool(EffectVariableID id, bool b) {
+    slots[id].type = SlotBool;
+    slots[id].b = b;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#ifdef _WIN32
+#include "proxydx/d3d9header.h"
+#else
+#include "support/d3dxportable.h"
+#endif
+
+#include <cstdint>
+#include <vector>
+
+
+
+enum EffectVariableID {
+    EV_lastshader, EV_lastpass, EV_depthframe, EV_watertexture,
+    EV_eyevec, EV_eyepos, EV_sunvec, EV_suncol, EV_sunamb, EV_sunpos, EV_sunvis, EV_HDR,
+    EV_mview, EV_mproj, EV_fogcol, EV_fognearcol, EV_fogstart, EV_fogrange, EV_fognearstart, EV_fognearrange,
+    EV_rcpres, EV_fov, EV_time, EV_waterlevel, EV_isinterior, EV_isunderwater,
+    EV_count
+};
+
+// Per-frame environment variables, gathered once per frame and shared by every shader in the chain
+struct MGEShaderFrameVars {
+    enum SlotType : BYTE { SlotUnset, SlotTexture, SlotMatrix, SlotFloatArray, SlotInt, SlotBool };
+
+    struct Slot {
+        SlotType type;
+        int count;
+        union {
+            LPDIRECT3DBASETEXTURE9 tex;
+            float f[16];
+            int i;
+            BOOL b;
+        };
+    } slots[EV_count];
+
+    void SetTexture(EffectVariableID id, LPDIRECT3DBASETEXTURE9 tex);
+    void SetMatrix(EffectVariableID id, const D3DXMATRIX* m);
+    void SetFloatArray(EffectVariableID id, const float* x, int n);
+    void SetFloat(EffectVariableID id, float x);
+    void SetInt(EffectVariableID id, int x);
+    void SetBool(EffectVariableID id, bool b);
+};
+
+// Frame variable bindings of the compiled post shader chain
+// Handles are resolved once when the chain is compiled. Variables declared shared in the effect pool are set
+// once per frame through the first effect declaring them; the rest are set on each effect before it renders.
+class PostShaderBindings {
+public:
+    struct Binding {
+        D3DXHANDLE handle;
+        EffectVariableID id;
+        LPDIRECT3DBASETEXTURE9 boundTexture;
+    };
+
+    struct SharedBinding {
+        ID3DXEffect* effect;
+        Binding binding;
+    };
+
+    std::vector<SharedBinding> shared;
+
+    void clear();
+    // bindEffect - Adds bindings for an effect's variable handles, by EffectVariableID. Variables with their bit set in
+    // sharedMask are pool-shared, and only bound through the first effect that declares them.
+    void bindEffect(ID3DXEffect* effect, const D3DXHANDLE* handles, uint32_t sharedMask, std::vector<Binding>& bindings);
+    // uploadShared - Once per frame, before any effect renders
+    void uploadShared(const MGEShaderFrameVars& vars);
+
+    static void apply(ID3DXEffect* effect, Binding& b, const MGEShaderFrameVars& vars);
+    static void apply(ID3DXEffect* effect, std::vector<Binding>& bindings, const MGEShaderFrameVars& vars);
+};
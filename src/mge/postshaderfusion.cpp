@@ -0,0 +1,462 @@
+
+#include "postshaderfusion.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+
+
+typedef PostShaderFusion::Token Token;
+static const size_t npos = size_t(-1);
+
+static bool isIdent(const Token& t, const char* s) {
+    return t.kind == Token::Ident && t.text == s;
+}
+
+static bool isPunct(const Token& t, const char* s) {
+    return t.kind == Token::Punct && t.text == s;
+}
+
+static bool isIdentNoCase(const Token& t, const char* s) {
+    if (t.kind != Token::Ident || t.text.size() != std::strlen(s)) {
+        return false;
+    }
+    for (size_t i = 0; i != t.text.size(); ++i) {
+        if (std::tolower((unsigned char)t.text[i]) != std::tolower((unsigned char)s[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool isZero(const Token& t) {
+    return t.kind == Token::Number && std::strtod(t.text.c_str(), nullptr) == 0.0;
+}
+
+static bool isAssignment(const Token& t) {
+    static const char* ops[] = { "=", "+=", "-=", "*=", "/=", "%=", "&=", "|=", "^=", "<<=", ">>=", "++", "--" };
+    if (t.kind != Token::Punct) {
+        return false;
+    }
+    for (const char* op : ops) {
+        if (t.text == op) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// findClose - Find the token matching a bracket at position i
+static size_t findClose(const std::vector<Token>& t, size_t i, const char* open, const char* close) {
+    int depth = 0;
+    for (; i < t.size(); ++i) {
+        if (isPunct(t[i], open)) {
+            ++depth;
+        } else if (isPunct(t[i], close)) {
+            if (--depth == 0) {
+                return i;
+            }
+        }
+    }
+    return npos;
+}
+
+// tokenize - Split effect source into tokens, dropping comments and preprocessor markers
+void PostShaderFusion::tokenize(const char* source, size_t length, std::vector<Token>& tokens) {
+    static const char* ops3[] = { "<<=", ">>=" };
+    static const char* ops2[] = {
+        "+=", "-=", "*=", "/=", "%=", "&=", "|=", "^=", "==", "!=", "<=", ">=", "&&", "||", "++", "--", "<<", ">>"
+    };
+    const char* p = source, *end = source + length;
+
+    tokens.clear();
+    while (p < end) {
+        char c = *p;
+
+        if (std::isspace((unsigned char)c)) {
+            ++p;
+        } else if (c == '/' && p + 1 < end && p[1] == '/') {
+            while (p < end && *p != '\n') {
+                ++p;
+            }
+        } else if (c == '/' && p + 1 < end && p[1] == '*') {
+            p += 2;
+            while (p + 1 < end && !(p[0] == '*' && p[1] == '/')) {
+                ++p;
+            }
+            p = (p + 1 < end) ? p + 2 : end;
+        } else if (c == '#') {
+            // Preprocessed source only carries #line and #pragma markers
+            while (p < end && *p != '\n') {
+                ++p;
+            }
+        } else if (std::isalpha((unsigned char)c) || c == '_') {
+            const char* b = p;
+            while (p < end && (std::isalnum((unsigned char)*p) || *p == '_')) {
+                ++p;
+            }
+            tokens.push_back({ Token::Ident, std::string(b, p) });
+        } else if (std::isdigit((unsigned char)c) || (c == '.' && p + 1 < end && std::isdigit((unsigned char)p[1]))) {
+            const char* b = p;
+            while (p < end) {
+                if (std::isalnum((unsigned char)*p) || *p == '.') {
+                    ++p;
+                } else if ((*p == '+' || *p == '-') && (p[-1] == 'e' || p[-1] == 'E') && b[1] != 'x' && b[1] != 'X') {
+                    ++p;
+                } else {
+                    break;
+                }
+            }
+            tokens.push_back({ Token::Number, std::string(b, p) });
+        } else if (c == '"') {
+            const char* b = p++;
+            while (p < end && *p != '"') {
+                p += (*p == '\\' && p + 1 < end) ? 2 : 1;
+            }
+            p = (p < end) ? p + 1 : end;
+            tokens.push_back({ Token::String, std::string(b, p) });
+        } else {
+            // Longest operator first, so that <<= is not split into << =
+            size_t n = 1;
+            if (p + 2 < end) {
+                for (const char* op : ops3) {
+                    if (c == op[0] && p[1] == op[1] && p[2] == op[2]) {
+                        n = 3;
+                        break;
+                    }
+                }
+            }
+            if (n == 1 && p + 1 < end) {
+                for (const char* op : ops2) {
+                    if (c == op[0] && p[1] == op[1]) {
+                        n = 2;
+                        break;
+                    }
+                }
+            }
+            tokens.push_back({ Token::Punct, std::string(p, n) });
+            p += n;
+        }
+    }
+}
+
+// parseTechnique - Check for a single pass which only sets a pixel shader
+static size_t parseTechnique(const std::vector<Token>& t, size_t i, int& passes, bool& simple, std::string& entry) {
+    while (i < t.size() && !isPunct(t[i], "{")) {
+        ++i;
+    }
+    size_t close = findClose(t, i, "{", "}");
+    if (close == npos) {
+        return npos;
+    }
+
+    for (size_t k = i + 1; k < close; ++k) {
+        if (!isIdent(t[k], "pass")) {
+            simple = false;
+            continue;
+        }
+        while (k < close && !isPunct(t[k], "{")) {
+            ++k;
+        }
+        size_t passClose = findClose(t, k, "{", "}");
+        if (passClose == npos) {
+            return npos;
+        }
+
+        // pass { PixelShader = compile profile entry(); }
+        ++passes;
+        if (passClose - k == 9 && isIdentNoCase(t[k+1], "PixelShader") && isPunct(t[k+2], "=")
+            && isIdent(t[k+3], "compile") && t[k+5].kind == Token::Ident
+            && isPunct(t[k+6], "(") && isPunct(t[k+7], ")") && isPunct(t[k+8], ";")) {
+            entry = t[k+5].text;
+        } else {
+            simple = false;
+        }
+        k = passClose;
+    }
+    return close + 1;
+}
+
+// analyze - Find file scope declarations, the entry point and how it reads the input image
+bool PostShaderFusion::analyze(const char* source, size_t length, Analysis& a) {
+    struct Function {
+        size_t name, params, paramsEnd, body, bodyEnd;
+    };
+
+    static const char* follows[] = { "=", ";", "(", ":", "[", "<", ",", "{" };
+    auto& t = a.tokens;
+    std::vector<Function> functions;
+    std::unordered_set<std::string> inputSamplers;
+    std::unordered_set<size_t> declarations;
+    int techniques = 0, passes = 0;
+    bool simple = true;
+    size_t statementBegin = 0;
+
+    tokenize(source, length, t);
+    a.globals.clear();
+    a.uniforms.clear();
+    a.inputSamples.clear();
+    a.techniqueBegin = a.techniqueEnd = 0;
+    a.entry.clear();
+    a.singlePass = a.texelLocal = false;
+
+    for (size_t i = 0; i < t.size(); ++i) {
+        const Token& tk = t[i];
+
+        if (tk.kind == Token::Punct) {
+            size_t close = i;
+            if (tk.text == ";") {
+                statementBegin = i + 1;
+            } else if (tk.text == "{") {
+                close = findClose(t, i, "{", "}");
+            } else if (tk.text == "(") {
+                close = findClose(t, i, "(", ")");
+            } else if (tk.text == "<") {
+                close = findClose(t, i, "<", ">");
+            }
+            if (close == npos) {
+                return false;
+            }
+            i = close;
+            continue;
+        }
+
+        if (isIdent(tk, "technique") || isIdent(tk, "technique9") || isIdent(tk, "technique10")) {
+            size_t end = parseTechnique(t, i, passes, simple, a.entry);
+            if (end == npos) {
+                return false;
+            }
+            a.techniqueBegin = i;
+            a.techniqueEnd = end;
+            ++techniques;
+            i = end - 1;
+            statementBegin = end;
+            continue;
+        }
+
+        // Declarator: preceded by a type or a comma, followed by an initializer, terminator or parameter list
+        if (tk.kind != Token::Ident || i == statementBegin || i + 1 >= t.size()) {
+            continue;
+        }
+        if (t[i-1].kind != Token::Ident && !isPunct(t[i-1], ",")) {
+            continue;
+        }
+        bool declarator = false;
+        for (const char* f : follows) {
+            declarator |= isPunct(t[i+1], f);
+        }
+        if (!declarator) {
+            continue;
+        }
+
+        a.globals.insert(tk.text);
+        declarations.insert(i);
+
+        if (isPunct(t[i+1], "(")) {
+            Function fn = { i, i + 1, findClose(t, i + 1, "(", ")"), npos, npos };
+            if (fn.paramsEnd == npos) {
+                return false;
+            }
+
+            // Skip return semantic to the body, prototypes have none
+            size_t k = fn.paramsEnd + 1;
+            while (k < t.size() && !isPunct(t[k], "{") && !isPunct(t[k], ";")) {
+                ++k;
+            }
+            if (k < t.size() && isPunct(t[k], "{")) {
+                fn.body = k;
+                fn.bodyEnd = findClose(t, k, "{", "}");
+                if (fn.bodyEnd == npos) {
+                    return false;
+                }
+                functions.push_back(fn);
+                i = fn.bodyEnd;
+                statementBegin = i + 1;
+            } else {
+                i = k - 1;
+            }
+            continue;
+        }
+
+        bool isStatic = false, isStruct = isIdent(t[i-1], "struct");
+        for (size_t k = statementBegin; k < i; ++k) {
+            isStatic |= isIdent(t[k], "static");
+        }
+        if (!isStatic && !isStruct) {
+            a.uniforms.push_back(tk.text);
+        }
+
+        // sampler s = sampler_state { texture = <lastshader>; ... };
+        if (isPunct(t[i+1], "=") && i + 3 < t.size() && isIdent(t[i+2], "sampler_state") && isPunct(t[i+3], "{")) {
+            size_t close = findClose(t, i + 3, "{", "}");
+            if (close == npos) {
+                return false;
+            }
+            for (size_t k = i + 4; k + 3 < close; ++k) {
+                if (isIdentNoCase(t[k], "texture") && isPunct(t[k+1], "=")
+                    && (isIdent(t[k+3], "lastshader") || isIdent(t[k+3], "lastpass"))) {
+                    inputSamplers.insert(tk.text);
+                }
+            }
+        }
+    }
+
+    if (techniques != 1 || passes != 1 || !simple || a.entry.empty()) {
+        return true;
+    }
+
+    // Entry point must be float4 entry(float2 tex : TEXCOORD0)
+    const Function* entry = nullptr;
+    for (const auto& fn : functions) {
+        if (t[fn.name].text == a.entry) {
+            entry = &fn;
+        }
+    }
+    if (!entry || !isIdent(t[entry->name - 1], "float4")) {
+        return true;
+    }
+
+    size_t p = entry->params + 1;
+    if (isIdent(t[p], "in")) {
+        ++p;
+    }
+    if (entry->paramsEnd != p + 4 || !isIdent(t[p], "float2") || t[p+1].kind != Token::Ident || !isPunct(t[p+2], ":")
+        || !(isIdentNoCase(t[p+3], "TEXCOORD") || isIdentNoCase(t[p+3], "TEXCOORD0"))) {
+        return true;
+    }
+    const std::string& texcoord = t[p+1].text;
+    a.singlePass = true;
+
+    // Helpers which only forward to a sample at the given coordinate
+    // float4 f(sampler2D s, float2 t) { return tex2D(s, t); } or { return tex2Dlod(s, float4(t, 0, 0)); }
+    std::unordered_set<std::string> helpers, writers;
+    for (const auto& fn : functions) {
+        size_t q = fn.params;
+        for (size_t k = q; k < fn.paramsEnd; ++k) {
+            if (isIdent(t[k], "out") || isIdent(t[k], "inout")) {
+                writers.insert(t[fn.name].text);
+            }
+        }
+        if (fn.paramsEnd - q != 6 || !(isIdent(t[q+1], "sampler2D") || isIdent(t[q+1], "sampler"))
+            || !isPunct(t[q+3], ",") || !isIdent(t[q+4], "float2")) {
+            continue;
+        }
+        const std::string& s = t[q+2].text, &c = t[q+5].text;
+        size_t b = fn.body, n = fn.bodyEnd - fn.body;
+        if (n < 9) {
+            continue;
+        }
+        if (!isIdent(t[b+1], "return") || !isPunct(t[b+3], "(") || t[b+4].text != s || !isPunct(t[b+5], ",")) {
+            continue;
+        }
+        if (n == 9 && isIdent(t[b+2], "tex2D") && t[b+6].text == c && isPunct(t[b+7], ")") && isPunct(t[b+8], ";")) {
+            helpers.insert(t[fn.name].text);
+        }
+        if (n == 16 && isIdent(t[b+2], "tex2Dlod") && isIdent(t[b+6], "float4") && isPunct(t[b+7], "(")
+            && t[b+8].text == c && isPunct(t[b+9], ",") && isZero(t[b+10]) && isPunct(t[b+11], ",")
+            && isZero(t[b+12]) && isPunct(t[b+13], ")") && isPunct(t[b+14], ")") && isPunct(t[b+15], ";")) {
+            helpers.insert(t[fn.name].text);
+        }
+    }
+
+    // Every read of the input must be a sample at the unmodified texcoord, inside the entry point
+    for (size_t i = 0; i < t.size(); ++i) {
+        const Token& tk = t[i];
+        if (tk.kind != Token::Ident || declarations.count(i)) {
+            continue;
+        }
+
+        if (tk.text == "lastshader" || tk.text == "lastpass") {
+            // Only allowed as texture = <lastshader> or texture = (lastshader)
+            if (i < 3 || !(isPunct(t[i-1], "<") || isPunct(t[i-1], "(")) || !isPunct(t[i-2], "=") || !isIdentNoCase(t[i-3], "texture")) {
+                return true;
+            }
+            continue;
+        }
+
+        bool inEntry = i > entry->body && i < entry->bodyEnd;
+        if (inEntry && writers.count(tk.text)) {
+            return true;
+        }
+        if (inEntry && tk.text == texcoord && !isPunct(t[i-1], ".")) {
+            size_t next = i + 1;
+            if (isPunct(t[next], ".")) {
+                next += 2;
+            } else if (isPunct(t[next], "[")) {
+                next = findClose(t, next, "[", "]") + 1;
+            }
+            if (isPunct(t[i-1], "++") || isPunct(t[i-1], "--") || isAssignment(t[next])) {
+                return true;
+            }
+        }
+
+        if (inputSamplers.count(tk.text)) {
+            if (!inEntry || !isPunct(t[i-1], "(") || !isPunct(t[i+1], ",")) {
+                return true;
+            }
+            const std::string& callee = t[i-2].text;
+            if ((callee == "tex2D" || helpers.count(callee)) && t[i+2].text == texcoord && isPunct(t[i+3], ")")) {
+                a.inputSamples.push_back({ i - 2, i + 3 });
+            } else if (callee == "tex2Dlod" && isIdent(t[i+2], "float4") && isPunct(t[i+3], "(") && t[i+4].text == texcoord
+                       && isPunct(t[i+5], ",") && isZero(t[i+6]) && isPunct(t[i+7], ",") && isZero(t[i+8])
+                       && isPunct(t[i+9], ")") && isPunct(t[i+10], ")")) {
+                a.inputSamples.push_back({ i - 2, i + 10 });
+            } else {
+                return true;
+            }
+        }
+    }
+
+    a.texelLocal = true;
+    return true;
+}
+
+// memberPrefix - Name prefix applied to a member's file scope declarations in a fused effect
+std::string PostShaderFusion::memberPrefix(size_t index) {
+    return "fuse" + std::to_string(index) + "_";
+}
+
+// generate - Emit one effect running each member's entry point in sequence
+// The first member reads the input image normally, later members read the previous member's result
+std::string PostShaderFusion::generate(const std::vector<const Analysis*>& members) {
+    std::string out = "// MGE XE generated effect, fused post shaders\n\nstatic float4 fuse_input;\n\n";
+
+    for (size_t m = 0; m != members.size(); ++m) {
+        const Analysis& a = *members[m];
+        std::string prefix = memberPrefix(m);
+        size_t sample = 0;
+
+        for (size_t i = 0; i < a.tokens.size(); ++i) {
+            const Token& tk = a.tokens[i];
+
+            if (i == a.techniqueBegin) {
+                i = a.techniqueEnd - 1;
+                continue;
+            }
+            if (m > 0 && sample < a.inputSamples.size() && a.inputSamples[sample].first == i) {
+                out += "fuse_input ";
+                i = a.inputSamples[sample++].second;
+                continue;
+            }
+
+            if (tk.kind == Token::Ident && a.globals.count(tk.text) && !(i > 0 && isPunct(a.tokens[i-1], "."))) {
+                out += prefix;
+            }
+            out += tk.text;
+            out += (tk.text == ";" || tk.text == "{" || tk.text == "}") ? "\n" : " ";
+        }
+        out += "\n\n";
+    }
+
+    out += "float4 fuse_main(float2 tex : TEXCOORD0) : COLOR0\n{\n";
+    for (size_t m = 0; m != members.size(); ++m) {
+        out += (m + 1 == members.size()) ? "    return " : "    fuse_input = ";
+        out += memberPrefix(m) + members[m]->entry + "(tex);\n";
+    }
+    out += "}\n\n";
+    out += "technique T0 < string MGEinterface = \"MGE XE 0\"; >\n{\n";
+    out += "    pass { PixelShader = compile ps_3_0 fuse_main(); }\n}\n";
+
+    return out;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+
+
+// Text-level fusion of adjacent single-pass post shaders into one generated effect
+// Works on preprocessed effect source; any shader that cannot be shown to be safe to merge is left alone
+class PostShaderFusion {
+public:
+    struct Token {
+        enum Kind { Ident, Number, String, Punct } kind;
+        std::string text;
+    };
+
+    struct Analysis {
+        std::vector<Token> tokens;
+        std::unordered_set<std::string> globals;            // File scope names, prefixed when fused
+        std::vector<std::string> uniforms;                  // Non-static file scope variables
+        std::vector<std::pair<size_t, size_t>> inputSamples; // Token ranges sampling the input at the current texel
+        size_t techniqueBegin = 0, techniqueEnd = 0;
+        std::string entry;
+        bool singlePass = false;    // One technique with one pass, setting only a pixel shader taking a texcoord
+        bool texelLocal = false;    // Reads lastshader/lastpass only at the current texel
+    };
+
+    static void tokenize(const char* source, size_t length, std::vector<Token>& tokens);
+    static bool analyze(const char* source, size_t length, Analysis& a);
+    static std::string memberPrefix(size_t index);
+    static std::string generate(const std::vector<const Analysis*>& members);
+};
@@ -1,9 +1,11 @@
 
 #include "proxydx/d3d8header.h"
 #include "support/log.h"
+#include "support/stringinterner.h"
 #include "configuration.h"
 #include "mwbridge.h"
 #include "postshaders.h"
+#include "profiler.h"
 
 #include <algorithm>
 #include <cstdio>
@@ -11,7 +13,7 @@
 
 
 
-// Must match enum EffectVariableID in postshaders.h
+// Must match enum EffectVariableID in postshaderbindings.h
 const char* effectVariableList[] = {
     "lastshader", "lastpass", "depthframe", "watertexture",
     "eyevec", "eyepos", "sunvec", "suncol", "sunamb", "sunpos", "sunvis", "HDR",
@@ -20,21 +22,49 @@ const char* effectVariableList[] = {
 };
 
 const int effectVariableCount = sizeof(effectVariableList) / sizeof(const char*);
+static_assert(effectVariableCount == EV_count, "effectVariableList must match enum EffectVariableID");
 const char* compatibleShader = "MGE XE 0";
 
 const DWORD fvfPost = D3DFVF_XYZRHW | D3DFVF_TEX2;  // XYZRHW -> skips vertex shader
 const DWORD fvfBlend = D3DFVF_XYZW | D3DFVF_TEX2;
 
+static StringInterner shaderNames;
+static std::vector<MGEShader*> shaderByName;    // Shader for each interned name ID
+
+// LuminanceReadbackBackend on D3D9, with lockable 1x1 surfaces and event queries
+class PostShaders::HDRQueries : public LuminanceReadbackBackend {
+public:
+    IDirect3DSurface9* source = nullptr;     // Frame to sample at the next issue
+
+    bool create(int slots) override;
+    void release() override;
+    void issue(int slot) override;
+    QueryStatus poll(int slot) override;
+    bool read(int slot, float* rgb) override;
+
+private:
+    struct Slot {
+        IDirect3DSurface9* surfQueue;
+        IDirect3DQuery9* query;
+    };
+    std::vector<Slot> slots;
+};
+
 IDirect3DDevice9* PostShaders::device;
+ID3DXEffectPool* PostShaders::effectPool;
 std::vector<std::unique_ptr<MGEShader>> PostShaders::shaders;
 std::vector<D3DXMACRO> PostShaders::features;
 IDirect3DTexture9* PostShaders::texLastShader;
 IDirect3DSurface9* PostShaders::surfaceLastShader;
 SurfaceDoubleBuffer PostShaders::doublebuffer;
 IDirect3DVertexBuffer9* PostShaders::vbPost;
-IDirect3DSurface9* PostShaders::surfReadqueue, *PostShaders::surfReadback;
-D3DXVECTOR4 PostShaders::adaptPoint;
+PostShaders::HDRQueries PostShaders::hdrQueries;
+HDRReadbackRing PostShaders::hdrRing(&PostShaders::hdrQueries);
+HDRAdaptation PostShaders::hdrAdapt;
+
 float PostShaders::rcpRes[2];
+MGEShaderChain PostShaders::chain;
+MGEShaderFrameVars PostShaders::frameVars;
 
 
 
@@ -42,6 +72,12 @@ float PostShaders::rcpRes[2];
 bool PostShaders::init(IDirect3DDevice9* realDevice) {
     device = realDevice;
 
+    // Variables declared shared are common to all post shaders
+    if (!effectPool && D3DXCreateEffectPool(&effectPool) != D3D_OK) {
+        LOG::logline("!! Post shader effect pool could not be created");
+        return false;
+    }
+
     if (!initBuffers()) {
         return false;
     }
@@ -86,7 +122,7 @@ bool PostShaders::initShaderChain() {
             continue;
         }
 
-        HRESULT hr = D3DXCreateEffectFromFile(device, path, &*features.begin(), 0, D3DXFX_LARGEADDRESSAWARE, 0, &newEffect, &errors);
+        HRESULT hr = createEffect(path, &newEffect, &errors);
 
         if (hr == D3D_OK) {
             if (checkShaderVersion(newEffect)) {
@@ -98,6 +134,7 @@ bool PostShaders::initShaderChain() {
 
                 initShader(&*shader);
                 loadShaderDependencies(&*shader);
+                indexShader(&*shader);
 
                 shaders.push_back(std::move(shader));
                 LOG::logline("-- Post shader %s loaded", path);
@@ -142,7 +179,7 @@ bool PostShaders::loadNewShader(const char* name) {
         return false;
     }
 
-    HRESULT hr = D3DXCreateEffectFromFile(device, path, &*features.begin(), 0, D3DXFX_LARGEADDRESSAWARE, 0, &newEffect, &errors);
+    HRESULT hr = createEffect(path, &newEffect, &errors);
 
     if (hr == D3D_OK) {
         if (checkShaderVersion(newEffect)) {
@@ -154,6 +191,7 @@ bool PostShaders::loadNewShader(const char* name) {
 
             initShader(&*shader);
             loadShaderDependencies(&*shader);
+            indexShader(&*shader);
 
             // Insert shader at sorted position
             auto p = shader->priority;
@@ -200,7 +238,7 @@ bool PostShaders::updateShaderChain() {
         }
 
         if (s->effect == nullptr || s->timestamp != fileAttrs.ftLastWriteTime.dwLowDateTime) {
-            HRESULT hr = D3DXCreateEffectFromFile(device, path, &*features.begin(), 0, D3DXFX_LARGEADDRESSAWARE, 0, &newEffect, &errors);
+            HRESULT hr = createEffect(path, &newEffect, &errors);
 
             if (hr == D3D_OK) {
                 if (s->effect) {
@@ -233,6 +271,31 @@ bool PostShaders::updateShaderChain() {
     return updated;
 }
 
+// createEffect - Compile a post shader into the shared effect pool
+// A shader whose shared variables conflict in type with another shader's is compiled standalone instead
+HRESULT PostShaders::createEffect(const char* path, ID3DXEffect** effect, ID3DXBuffer** errors) {
+    HRESULT hr = D3DXCreateEffectFromFile(device, path, &*features.begin(), 0, D3DXFX_LARGEADDRESSAWARE, effectPool, effect, errors);
+
+    if (hr != D3D_OK) {
+        ID3DXBuffer* standaloneErrors;
+        if (D3DXCreateEffectFromFile(device, path, &*features.begin(), 0, D3DXFX_LARGEADDRESSAWARE, 0, effect, &standaloneErrors) == D3D_OK) {
+            LOG::logline("## Post shader %s has shared variables that conflict with another shader, not sharing", path);
+            if (standaloneErrors) {
+                standaloneErrors->Release();
+            }
+            if (*errors) {
+                (*errors)->Release();
+                *errors = nullptr;
+            }
+            return D3D_OK;
+        }
+        if (standaloneErrors) {
+            standaloneErrors->Release();
+        }
+    }
+    return hr;
+}
+
 // checkShaderVersion
 // Checks effect annotation to see if the shader was designed for MGE XE,
 // as MGE shaders use an incompatible set of variables
@@ -285,6 +348,7 @@ void PostShaders::initShader(MGEShader* shader) {
     D3DXHANDLE tech, hdr, glare, category, priorityAdjust;
 
     // Variable handles
+    shader->vars.reset(effect);
     for (int i = 0; i != effectVariableCount; ++i) {
         shader->ehVars[i] = effect->GetParameterByName(0, effectVariableList[i]);
     }
@@ -326,6 +390,9 @@ void PostShaders::initShader(MGEShader* shader) {
 
     // Constants
     shader->SetFloatArray(EV_rcpres, rcpRes, 2);
+
+    // Handles have changed
+    chain.needsCompile = true;
 }
 
 // loadShaderDependencies - Loads textures referenced inside a shader
@@ -389,6 +456,184 @@ void PostShaders::orderShaders() {
     }
 
     std::stable_sort(shaders.begin(), shaders.end(), shaderComparator);
+    chain.needsCompile = true;
+}
+
+// isPooled - Whether an effect was created in the shared effect pool
+static bool isPooled(ID3DXEffect* effect, ID3DXEffectPool* effectPool) {
+    ID3DXEffectPool* pool = nullptr;
+    effect->GetPool(&pool);
+    if (pool) {
+        pool->Release();
+    }
+    return pool && pool == effectPool;
+}
+
+// compileChain - Resolve per-frame variable bindings for each shader in the current order
+void PostShaders::compileChain() {
+    releaseFusions();
+    chain.stages.clear();
+    chain.shared.clear();
+
+    for (auto& s : shaders) {
+        if (!s->effect) {
+            continue;
+        }
+
+        MGEShaderChain::Stage stage;
+        stage.shader = &*s;
+        stage.effect = s->effect;
+        stage.ehLastShader = s->ehVars[EV_lastshader];
+        stage.ehLastPass = s->ehVars[EV_lastpass];
+
+        // Shared variables only need setting through one effect in the pool
+        uint32_t sharedMask = 0;
+        if (isPooled(s->effect, effectPool)) {
+            for (int i = 0; i != EV_count; ++i) {
+                D3DXPARAMETER_DESC desc;
+                if (s->ehVars[i] && s->effect->GetParameterDesc(s->ehVars[i], &desc) == D3D_OK && (desc.Flags & D3DX_PARAMETER_SHARED)) {
+                    sharedMask |= 1u << i;
+                }
+            }
+        }
+        chain.shared.bindEffect(s->effect, s->ehVars, sharedMask, stage.bindings);
+
+        chain.stages.push_back(std::move(stage));
+    }
+
+    fuseChain();
+    chain.needsCompile = false;
+}
+
+// fuseChain - Merge runs of adjacent single-pass shaders into generated effects, saving full-screen passes
+// The first shader of a run may read the input anywhere, the rest must only read it at the current texel
+void PostShaders::fuseChain() {
+    char path[MAX_PATH];
+    std::vector<PostShaderFusion::Analysis> analysis(chain.stages.size());
+    int passesBefore = 0, passesAfter = 0;
+
+    for (size_t i = 0; i != chain.stages.size(); ++i) {
+        MGEShader* s = chain.stages[i].shader;
+        D3DXTECHNIQUE_DESC techDesc;
+        ID3DXBuffer* text, *errors;
+
+        if (s->effect->GetTechniqueDesc(s->effect->GetTechnique(0), &techDesc) == D3D_OK) {
+            passesBefore += techDesc.Passes;
+        }
+
+        // Analyze preprocessed source, so feature macros and includes are already resolved
+        std::snprintf(path, sizeof(path), "Data Files\\shaders\\XEshaders\\%s.fx", s->name.c_str());
+        if (D3DXPreprocessShaderFromFile(path, &*features.begin(), 0, &text, &errors) == D3D_OK) {
+            PostShaderFusion::analyze(reinterpret_cast<const char*>(text->GetBufferPointer()), text->GetBufferSize(), analysis[i]);
+            text->Release();
+        }
+        if (errors) {
+            errors->Release();
+        }
+    }
+
+    passesAfter = passesBefore;
+    for (size_t i = 0; i < chain.stages.size(); ) {
+        size_t n = 1;
+        if (analysis[i].singlePass) {
+            while (i + n < chain.stages.size() && analysis[i + n].singlePass && analysis[i + n].texelLocal) {
+                ++n;
+            }
+        }
+        if (n > 1 && createFusion(i, n, analysis)) {
+            passesAfter -= int(n) - 1;
+        }
+        i += n;
+    }
+
+    LOG::logline("-- Post shader chain: %d full-screen passes, %d after fusion", passesBefore, passesAfter);
+}
+
+// createFusion - Compile a fused effect for a run of shaders and bind it to the member shaders' variables
+bool PostShaders::createFusion(size_t first, size_t count, const std::vector<PostShaderFusion::Analysis>& analysis) {
+    std::vector<const PostShaderFusion::Analysis*> members;
+    std::string names;
+    ID3DXEffect* effect;
+    ID3DXBuffer* errors;
+
+    for (size_t k = 0; k != count; ++k) {
+        members.push_back(&analysis[first + k]);
+        names += (k ? " + " : "") + chain.stages[first + k].shader->name;
+    }
+
+    std::string source = PostShaderFusion::generate(members);
+    HRESULT hr = D3DXCreateEffect(device, source.data(), UINT(source.size()), 0, 0, D3DXFX_LARGEADDRESSAWARE, 0, &effect, &errors);
+    if (errors) {
+        errors->Release();
+    }
+    if (hr != D3D_OK) {
+        LOG::logline("## Post shader fusion of %s failed to compile, rendering separately", names.c_str());
+        return false;
+    }
+
+    MGEShaderChain::Fusion f;
+    std::string prefix = PostShaderFusion::memberPrefix(0);
+    f.first = first;
+    f.count = count;
+    f.stage.shader = chain.stages[first].shader;
+    f.stage.effect = effect;
+    f.stage.ehLastShader = effect->GetParameterByName(0, (prefix + "lastshader").c_str());
+    f.stage.ehLastPass = effect->GetParameterByName(0, (prefix + "lastpass").c_str());
+
+    for (size_t k = 0; k != count; ++k) {
+        MGEShader* s = chain.stages[first + k].shader;
+        prefix = PostShaderFusion::memberPrefix(k);
+
+        // Environment variables, renamed per member
+        for (int i = 0; i != EV_count; ++i) {
+            if (i == EV_lastshader || i == EV_lastpass || !s->ehVars[i]) {
+                continue;
+            }
+            D3DXHANDLE h = effect->GetParameterByName(0, (prefix + effectVariableList[i]).c_str());
+            if (!h) {
+                continue;
+            }
+            if (i == EV_rcpres) {
+                effect->SetFloatArray(h, rcpRes, 2);
+            } else {
+                f.stage.bindings.push_back({ h, EffectVariableID(i), nullptr });
+            }
+        }
+
+        // Other variables may be set by scripts or loaded textures, and are mirrored each frame
+        for (const auto& name : analysis[first + k].uniforms) {
+            if (std::find_if(effectVariableList, effectVariableList + effectVariableCount,
+                             [&](const char* ev) { return name == ev; }) != effectVariableList + effectVariableCount) {
+                continue;
+            }
+
+            D3DXHANDLE from = s->effect->GetParameterByName(0, name.c_str());
+            D3DXHANDLE to = effect->GetParameterByName(0, (prefix + name).c_str());
+            D3DXPARAMETER_DESC desc;
+            if (!from || !to || s->effect->GetParameterDesc(from, &desc) != D3D_OK) {
+                continue;
+            }
+
+            bool texture = desc.Type >= D3DXPT_TEXTURE && desc.Type <= D3DXPT_TEXTURECUBE;
+            if (desc.Class == D3DXPC_OBJECT && !texture) {
+                continue;
+            }
+            f.copies.push_back({ s->effect, from, to, texture, desc.Bytes });
+            chain.copyBuffer.resize(std::max(chain.copyBuffer.size(), size_t(desc.Bytes)));
+        }
+    }
+
+    chain.fusions.push_back(std::move(f));
+    LOG::logline("-- Post shaders fused: %s", names.c_str());
+    return true;
+}
+
+// releaseFusions - Release generated effects
+void PostShaders::releaseFusions() {
+    for (auto& f : chain.fusions) {
+        f.stage.effect->Release();
+    }
+    chain.fusions.clear();
 }
 
 // initBuffers - Create ping-pong buffers and HDR resolve surfaces
@@ -451,17 +696,11 @@ bool PostShaders::initBuffers() {
     vbPost->Unlock();
 
     // HDR readback system
-    hr = device->CreateRenderTarget(1, 1, D3DFMT_A8R8G8B8, D3DMULTISAMPLE_NONE, 0, false, &surfReadqueue, NULL);
-    if (hr != D3D_OK) {
-        LOG::logline("!! Failed to create HDR surface queue");
-        return false;
-    }
-    hr = device->CreateOffscreenPlainSurface(1, 1, D3DFMT_A8R8G8B8, D3DPOOL_SYSTEMMEM, &surfReadback, NULL);
-    if (hr != D3D_OK) {
+    if (!hdrRing.init()) {
         LOG::logline("!! Failed to create HDR surface queue");
         return false;
     }
-    adaptPoint = D3DXVECTOR4(1.0, 1.0, 1.0, 1.0);
+    hdrAdapt.reset();
 
     return true;
 }
@@ -473,6 +712,7 @@ void PostShaders::release() {
         s->effect->Release();
         s->effect = nullptr;
         s->timestamp = 0;
+        s->vars.reset(nullptr);
     }
 
     surfaceLastShader->Release();
@@ -482,37 +722,57 @@ void PostShaders::release() {
     doublebuffer.sinkSurface()->Release();
     doublebuffer.sinkTexture()->Release();
     vbPost->Release();
-    surfReadqueue->Release();
-    surfReadback->Release();
+    hdrRing.release();
+
+    releaseFusions();
+    chain.stages.clear();
+    chain.shared.clear();
+    chain.needsCompile = true;
+
+    if (effectPool) {
+        effectPool->Release();
+        effectPool = nullptr;
+    }
 }
 
 // evalAdaptHDR - Downsample and readback a frame to get an averaged luminance for HDR
+// Readback is latency tolerant; completed results are collected from a ring, without waiting on the GPU
 void PostShaders::evalAdaptHDR(IDirect3DSurface9* source, int environmentFlags, float dt) {
-    D3DLOCKED_RECT lock;
+    hdrQueries.source = source;
+    hdrRing.frame(dt, &hdrAdapt, environmentFlags, Configuration.HDRReactionSpeed);
+}
+
+bool PostShaders::HDRQueries::create(int n) {
+    slots.assign(n, Slot { nullptr, nullptr });
+    for (auto& s : slots) {
+        // Lockable, so completed entries can be read without a pipeline-synchronizing copy
+        if (device->CreateRenderTarget(1, 1, D3DFMT_A8R8G8B8, D3DMULTISAMPLE_NONE, 0, true, &s.surfQueue, NULL) != D3D_OK) {
+            return false;
+        }
+
+        // Without event queries, the ring assumes entries are complete after it has cycled
+        device->CreateQuery(D3DQUERYTYPE_EVENT, &s.query);
+    }
+    return true;
+}
+
+void PostShaders::HDRQueries::release() {
+    for (auto& s : slots) {
+        if (s.surfQueue) {
+            s.surfQueue->Release();
+        }
+        if (s.query) {
+            s.query->Release();
+        }
+    }
+    slots.clear();
+}
+
+// issue - Shrink the source frame down to 1x1 and queue a copy for readback
+void PostShaders::HDRQueries::issue(int slot) {
     RECT rectSrc = { 0, 0, 0, 0 };
-    RECT rectDownsample = { 0, 0, 0, 0 };
-    float r, g, b;
+    RECT rectDownsample = { 0, 0, 512, 512 };
 
-    // Read resolved data from last frame
-    surfReadback->LockRect(&lock, NULL, D3DLOCK_READONLY);
-    BYTE* data = (BYTE*)lock.pBits;
-    r = data[0] / 255.0f;
-    g = data[1] / 255.0f;
-    b = data[2] / 255.0f;
-    surfReadback->UnlockRect();
-
-    // Convert to environment-weighted luminance and average over time
-    // x = normalized weighted lumi, y = unweighted lumi, z = unnormalized weighted lumi, w = immediate unweighted lumi
-    float environmentScaling = (environmentFlags & 6) ? 2.5f : 1.0f;
-    float lambda = exp(-dt / Configuration.HDRReactionSpeed);
-    adaptPoint.w = 0.27f*r + 0.67f*g + 0.06f*b;
-    adaptPoint.z = adaptPoint.w * environmentScaling + (adaptPoint.z - adaptPoint.w * environmentScaling) * lambda;
-    adaptPoint.y = adaptPoint.w + (adaptPoint.y - adaptPoint.w) * lambda;
-    adaptPoint.x = adaptPoint.z / environmentScaling;
-
-    // Shrink this frame down to a 1x1 texture
-    rectDownsample.right = 512;
-    rectDownsample.bottom = 512;
     device->StretchRect(source, 0, doublebuffer.sinkSurface(), &rectDownsample, D3DTEXF_LINEAR);
     doublebuffer.cycle();
 
@@ -524,13 +784,37 @@ void PostShaders::evalAdaptHDR(IDirect3DSurface9* source, int environmentFlags,
         doublebuffer.cycle();
     }
 
-    // Copy and queue readback
-    device->StretchRect(doublebuffer.sourceSurface(), &rectDownsample, surfReadqueue, 0, D3DTEXF_NONE);
-    device->GetRenderTargetData(surfReadqueue, surfReadback);
+    device->StretchRect(doublebuffer.sourceSurface(), &rectDownsample, slots[slot].surfQueue, 0, D3DTEXF_NONE);
+    if (slots[slot].query) {
+        slots[slot].query->Issue(D3DISSUE_END);
+    }
+}
+
+LuminanceReadbackBackend::QueryStatus PostShaders::HDRQueries::poll(int slot) {
+    if (!slots[slot].query) {
+        return Unsupported;
+    }
+    return slots[slot].query->GetData(NULL, 0, 0) == S_OK ? Complete : Pending;
+}
+
+bool PostShaders::HDRQueries::read(int slot, float* rgb) {
+    D3DLOCKED_RECT lock;
+
+    if (slots[slot].surfQueue->LockRect(&lock, NULL, D3DLOCK_READONLY) != D3D_OK) {
+        return false;
+    }
+
+    BYTE* data = (BYTE*)lock.pBits;
+    rgb[0] = data[0] / 255.0f;
+    rgb[1] = data[1] / 255.0f;
+    rgb[2] = data[2] / 255.0f;
+    slots[slot].surfQueue->UnlockRect();
+    return true;
 }
 
 // shaderTime - Applies all post processing shaders for the current frame
 void PostShaders::shaderTime(MGEShaderUpdateFunc updateVarsFunc, int environmentFlags, float frameTime) {
+    Profiler::Scope profile(Profiler::ZonePostShaders);
     IDirect3DSurface9* backbuffer, *depthstencil;
 
     // Turn off depth stencil use
@@ -570,38 +854,58 @@ void PostShaders::shaderTime(MGEShaderUpdateFunc updateVarsFunc, int environment
         evalAdaptHDR(surfaceLastShader, environmentFlags, frameTime);
     }
 
-    // Render all those shaders
-    for (auto& s : shaders) {
-        ID3DXEffect* effect = s->effect;
-        UINT passes;
+    // Gather environment variables once for the whole chain
+    if (chain.needsCompile) {
+        compileChain();
+    }
+    updateVarsFunc(&frameVars);
+    frameVars.SetFloatArray(EV_HDR, hdrAdapt.point, 4);
+    chain.shared.uploadShared(frameVars);
 
-        if (!s->enabled) {
-            continue;
-        }
-        if (s->disableFlags & environmentFlags) {
-            continue;
-        }
+    // Apply script variable writes made since the last frame, before fused effects copy them
+    for (auto& s : shaders) {
+        s->vars.flush();
+    }
 
-        updateVarsFunc(&*s);
-        s->SetFloatArray(EV_HDR, adaptPoint, 4);
-        s->SetTexture(EV_lastshader, texLastShader);
-        effect->Begin(&passes, 0);
+    // Render all those shaders, using fused effects where every member of a run is active
+    auto isActive = [=](const MGEShader* s) {
+        return s->enabled && !(s->disableFlags & environmentFlags);
+    };
+    size_t nextFusion = 0;
 
-        for (UINT p = 0; p != passes; ++p) {
-            device->SetRenderTarget(0, doublebuffer.sinkSurface());
-            s->SetTexture(EV_lastpass, doublebuffer.sourceTexture());
+    for (size_t i = 0; i < chain.stages.size(); ) {
+        if (nextFusion < chain.fusions.size() && chain.fusions[nextFusion].first == i) {
+            auto& f = chain.fusions[nextFusion++];
+            bool allActive = true;
 
-            effect->BeginPass(p);
-            device->DrawPrimitive(D3DPT_TRIANGLESTRIP, 0, 2);
-            effect->EndPass();
+            for (size_t k = f.first; k != f.first + f.count; ++k) {
+                allActive = allActive && isActive(chain.stages[k].shader);
+            }
+            if (allActive) {
+                for (const auto& c : f.copies) {
+                    if (c.texture) {
+                        LPDIRECT3DBASETEXTURE9 tex = nullptr;
+                        c.source->GetTexture(c.from, &tex);
+                        f.stage.effect->SetTexture(c.to, tex);
+                        if (tex) {
+                            tex->Release();
+                        }
+                    } else if (c.bytes) {
+                        c.source->GetValue(c.from, &chain.copyBuffer[0], c.bytes);
+                        f.stage.effect->SetValue(c.to, &chain.copyBuffer[0], c.bytes);
+                    }
+                }
 
-            doublebuffer.cycle();
+                renderStage(f.stage);
+                i += f.count;
+                continue;
+            }
         }
 
-        effect->End();
-
-        // Avoid another copy by exchanging which surfaces are buffers
-        doublebuffer.exchangeSource(&texLastShader, &surfaceLastShader);
+        if (isActive(chain.stages[i].shader)) {
+            renderStage(chain.stages[i]);
+        }
+        ++i;
     }
 
     // Copy result to back buffer
@@ -614,6 +918,37 @@ void PostShaders::shaderTime(MGEShaderUpdateFunc updateVarsFunc, int environment
     depthstencil->Release();
 }
 
+// renderStage - Renders all passes of one shader or fused effect, then makes its output the next input
+void PostShaders::renderStage(MGEShaderChain::Stage& stage) {
+    ID3DXEffect* effect = stage.effect;
+    UINT passes;
+
+    PostShaderBindings::apply(effect, stage.bindings, frameVars);
+
+    if (stage.ehLastShader) {
+        effect->SetTexture(stage.ehLastShader, texLastShader);
+    }
+    effect->Begin(&passes, 0);
+
+    for (UINT p = 0; p != passes; ++p) {
+        device->SetRenderTarget(0, doublebuffer.sinkSurface());
+        if (stage.ehLastPass) {
+            effect->SetTexture(stage.ehLastPass, doublebuffer.sourceTexture());
+        }
+
+        effect->BeginPass(p);
+        device->DrawPrimitive(D3DPT_TRIANGLESTRIP, 0, 2);
+        effect->EndPass();
+
+        doublebuffer.cycle();
+    }
+
+    effect->End();
+
+    // Avoid another copy by exchanging which surfaces are buffers
+    doublebuffer.exchangeSource(&texLastShader, &surfaceLastShader);
+}
+
 // borrowBuffer - Utility function for distant land to temporarily use a ping-pong buffer
 IDirect3DTexture9* PostShaders::borrowBuffer(int n) {
     IDirect3DSurface9* backbuffer;
@@ -639,11 +974,19 @@ void PostShaders::applyBlend() {
 
 
 // Scripting interface for shaders
+// indexShader - Make a shader findable by name. Shaders are never unloaded, so entries stay valid.
+void PostShaders::indexShader(MGEShader* shader) {
+    int id = shaderNames.intern(shader->name.c_str());
+    if (id == int(shaderByName.size())) {
+        shaderByName.push_back(shader);
+    }
+}
+
+// findShader - Shader by name, through the interned name ID
 MGEShader* PostShaders::findShader(const char* shaderName) {
-    for (auto& s : shaders) {
-        if (s->name == shaderName) {
-            return &*s;
-        }
+    int id = shaderNames.find(shaderName);
+    if (id != StringInterner::invalid_id) {
+        return shaderByName[id];
     }
     return nullptr;
 }
@@ -658,13 +1001,7 @@ bool PostShaders::setShaderVar(const char* shaderName, const char* varName, bool
         return false;
     }
 
-    D3DXHANDLE ehVar = shader->effect->GetParameterByName(0, varName);
-    if (!ehVar) {
-        return false;
-    }
-
-    shader->effect->SetBool(ehVar, b);
-    return true;
+    return shader->vars.setBool(varName, b);
 }
 
 bool PostShaders::setShaderVar(const char* shaderName, const char* varName, int x) {
@@ -673,13 +1010,7 @@ bool PostShaders::setShaderVar(const char* shaderName, const char* varName, int
         return false;
     }
 
-    D3DXHANDLE ehVar = shader->effect->GetParameterByName(0, varName);
-    if (!ehVar) {
-        return false;
-    }
-
-    shader->effect->SetInt(ehVar, x);
-    return true;
+    return shader->vars.setInt(varName, x);
 }
 
 bool PostShaders::setShaderVar(const char* shaderName, const char* varName, float x) {
@@ -688,13 +1019,7 @@ bool PostShaders::setShaderVar(const char* shaderName, const char* varName, floa
         return false;
     }
 
-    D3DXHANDLE ehVar = shader->effect->GetParameterByName(0, varName);
-    if (!ehVar) {
-        return false;
-    }
-
-    shader->effect->SetFloat(ehVar, x);
-    return true;
+    return shader->vars.setFloat(varName, x);
 }
 
 bool PostShaders::setShaderVar(const char* shaderName, const char* varName, float* v) {
@@ -703,13 +1028,7 @@ bool PostShaders::setShaderVar(const char* shaderName, const char* varName, floa
         return false;
     }
 
-    D3DXHANDLE ehVar = shader->effect->GetParameterByName(0, varName);
-    if (!ehVar) {
-        return false;
-    }
-
-    shader->effect->SetFloatArray(ehVar, v, 4);
-    return true;
+    return shader->vars.setFloatArray(varName, v, 4);
 }
 
 bool PostShaders::setShaderEnable(const char* shaderName, bool enable) {
@@ -1,6 +1,10 @@
 #pragma once
 
 #include "doublesurface.h"
+#include "effectvariables.h"
+#include "postshaderbindings.h"
+#include "postshaderfusion.h"
+#include "support/hdrreadback.h"
 
 #include <memory>
 #include <string>
@@ -8,13 +12,6 @@
 
 
 
-enum EffectVariableID {
-    EV_lastshader, EV_lastpass, EV_depthframe, EV_watertexture,
-    EV_eyevec, EV_eyepos, EV_sunvec, EV_suncol, EV_sunamb, EV_sunpos, EV_sunvis, EV_HDR,
-    EV_mview, EV_mproj, EV_fogcol, EV_fognearcol, EV_fogstart, EV_fogrange, EV_fognearstart, EV_fognearrange,
-    EV_rcpres, EV_fov, EV_time, EV_waterlevel, EV_isinterior, EV_isunderwater
-};
-
 struct MGEShader {
     ID3DXEffect* effect;
     bool enabled;
@@ -22,7 +19,8 @@ struct MGEShader {
     int priority;
     DWORD timestamp;
     std::string name;
-    D3DXHANDLE ehVars[32];
+    D3DXHANDLE ehVars[EV_count];
+    EffectVariables vars;       // Script-set variables
 
     void SetTexture(EffectVariableID id, LPDIRECT3DBASETEXTURE9 tex);
     void SetMatrix(EffectVariableID id, const D3DXMATRIX* m);
@@ -32,19 +30,66 @@ struct MGEShader {
     void SetBool(EffectVariableID id, bool b);
 };
 
-typedef void (*MGEShaderUpdateFunc)(MGEShader*);
+typedef void (*MGEShaderUpdateFunc)(MGEShaderFrameVars*);
+
+// Shader chain compiled for rendering, with parameter bindings resolved to handles
+// Rebuilt only when shaders are loaded, reloaded or reordered
+struct MGEShaderChain {
+    typedef PostShaderBindings::Binding Binding;
+
+    struct Stage {
+        MGEShader* shader;
+        ID3DXEffect* effect;
+        D3DXHANDLE ehLastShader, ehLastPass;
+        std::vector<Binding> bindings;
+    };
+
+    // Script-set and texture variables mirrored from a member shader into a fused effect
+    struct ParamCopy {
+        ID3DXEffect* source;
+        D3DXHANDLE from, to;
+        bool texture;
+        UINT bytes;
+    };
+
+    // Adjacent single-pass shaders merged into one generated effect, used while every member is active
+    struct Fusion {
+        size_t first, count;
+        Stage stage;
+        std::vector<ParamCopy> copies;
+    };
+
+    std::vector<Stage> stages;
+    std::vector<Fusion> fusions;
+    PostShaderBindings shared;
+    std::vector<BYTE> copyBuffer;
+    bool needsCompile;
+};
 
 class PostShaders {
     static IDirect3DDevice9* device;
+    static ID3DXEffectPool* effectPool;
     static std::vector<std::unique_ptr<MGEShader>> shaders;
     static std::vector<D3DXMACRO> features;
     static IDirect3DTexture9* texLastShader;
     static IDirect3DSurface9* surfaceLastShader;
     static SurfaceDoubleBuffer doublebuffer;
     static IDirect3DVertexBuffer9* vbPost;
-    static IDirect3DSurface9* surfReadqueue, *surfReadback;
-    static D3DXVECTOR4 adaptPoint;
+    // HDR luminance readback ring, read back only once the GPU has finished each entry
+    class HDRQueries;
+    static HDRQueries hdrQueries;
+    static HDRReadbackRing hdrRing;
+    static HDRAdaptation hdrAdapt;
     static float rcpRes[2];
+    static MGEShaderChain chain;
+    static MGEShaderFrameVars frameVars;
+
+    static HRESULT createEffect(const char* path, ID3DXEffect** effect, ID3DXBuffer** errors);
+    static void compileChain();
+    static void fuseChain();
+    static bool createFusion(size_t first, size_t count, const std::vector<PostShaderFusion::Analysis>& analysis);
+    static void releaseFusions();
+    static void renderStage(MGEShaderChain::Stage& stage);
 
 public:
     static bool init(IDirect3DDevice9* realDevice);
@@ -54,6 +99,7 @@ public:
     static bool checkShaderVersion(ID3DXEffect* effect);
     static void initShader(MGEShader* shader);
     static void loadShaderDependencies(MGEShader* shader);
+    static void indexShader(MGEShader* shader);
     static void orderShaders();
     static bool initBuffers();
     static void release();
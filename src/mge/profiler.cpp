@@ -0,0 +1,288 @@
+
+#include "profiler.h"
+#include "proxydx/d3d9header.h"
+#include "support/gputimestamps.h"
+#include "support/log.h"
+#include "support/timing.h"
+
+#include <cstdio>
+#include <vector>
+
+
+
+namespace Profiler {
+    struct ZoneState {
+        int64_t start, total;   // Ticks; total is for the current frame
+        int depth;              // Nesting depth when last entered, the frame being depth 0
+        RollingStats stats;     // Microseconds per frame
+    };
+
+    static const char* zoneNames[ZoneCount] = {
+        "Frame",
+        "Render stage 0", "Shadow map", "Cull statics", "Dynamic waves",
+        "Render stage 1", "Cull grass",
+        "Render stage 2",
+        "Post shaders",
+        "User HUD",
+        "FFE compile"
+    };
+
+    // Zones that only do CPU work are not given GPU timestamps
+    static const bool zoneUsesGPU[ZoneCount] = {
+        true,
+        true, true, false, true,
+        true, false,
+        true,
+        true,
+        true,
+        false
+    };
+
+    // TimestampQueryBackend on D3D9 queries
+    class D3D9TimestampQueries : public TimestampQueryBackend {
+    public:
+        IDirect3DDevice9* device = nullptr;
+
+        bool create(int frameSlots, int timestampsPerFrame) override;
+        void release() override;
+        void beginFrame(int frame) override;
+        void endFrame(int frame) override;
+        void timestamp(int frame, int index) override;
+        bool frameResult(int frame, bool* disjoint, uint64_t* frequency) override;
+        bool timestampResult(int frame, int index, uint64_t* ticks) override;
+
+    private:
+        struct Slot {
+            IDirect3DQuery9* disjoint;
+            IDirect3DQuery9* frequency;
+            std::vector<IDirect3DQuery9*> timestamps;
+        };
+        std::vector<Slot> slots;
+    };
+
+    static ZoneState zones[ZoneCount];
+    static RollingStats gpuStats[ZoneCount];
+    static int currentDepth = 0;
+    static int64_t frameStart = 0;
+
+    static D3D9TimestampQueries gpuQueries;
+    static GpuTimestampRing gpuRing(&gpuQueries, ZoneCount, ZoneFrame);
+}
+
+// initGPU - Create timestamp queries; GPU statistics stay empty if they are not supported
+bool Profiler::initGPU(IDirect3DDevice9* device) {
+    gpuQueries.device = device;
+    if (!gpuRing.init()) {
+        LOG::logline("-- Profiler: GPU timestamp queries not supported");
+        return false;
+    }
+    return true;
+}
+
+void Profiler::releaseGPU() {
+    gpuRing.release();
+    gpuQueries.device = nullptr;
+}
+
+void Profiler::begin(Zone z) {
+    ZoneState& s = zones[z];
+    if (zoneUsesGPU[z]) {
+        gpuRing.beginZone(z);
+    }
+    s.depth = ++currentDepth;
+    s.start = HighResolutionTimer::getTicks();
+}
+
+void Profiler::end(Zone z) {
+    ZoneState& s = zones[z];
+    s.total += HighResolutionTimer::getTicks() - s.start;
+    --currentDepth;
+    if (zoneUsesGPU[z]) {
+        gpuRing.endZone(z);
+    }
+}
+
+// endFrame - Close the frame zone and move per-frame totals into the statistics
+// Zones that did not run this frame record zero, so averages are per-frame costs
+void Profiler::endFrame() {
+    int64_t now = HighResolutionTimer::getTicks();
+    bool firstFrame = (frameStart == 0);
+
+    zones[ZoneFrame].total = now - frameStart;
+    frameStart = now;
+    currentDepth = 0;
+
+    for (ZoneState& s : zones) {
+        if (!firstFrame) {
+            s.stats.add(HighResolutionTimer::ticksToMicroseconds(s.total));
+        }
+        s.total = 0;
+    }
+
+    // GPU frames are delimited here as well, and results arrive some frames later
+    gpuRing.endFrame();
+    gpuRing.collect(gpuStats);
+    gpuRing.beginFrame();
+}
+
+// reset - Clear statistics, e.g. after a device reset or loading, which would skew them
+void Profiler::reset() {
+    for (ZoneState& s : zones) {
+        s.total = 0;
+        s.stats.clear();
+    }
+    for (RollingStats& s : gpuStats) {
+        s.clear();
+    }
+    frameStart = 0;
+    currentDepth = 0;
+}
+
+const char* Profiler::zoneName(Zone z) {
+    return zoneNames[z];
+}
+
+int Profiler::zoneDepth(Zone z) {
+    return zones[z].depth;
+}
+
+float Profiler::lastSample(Zone z) {
+    return zones[z].stats.last();
+}
+
+RollingStats::Summary Profiler::summarise(Zone z) {
+    return zones[z].stats.summarise();
+}
+
+float Profiler::lastSampleGPU(Zone z) {
+    return gpuStats[z].last();
+}
+
+RollingStats::Summary Profiler::summariseGPU(Zone z) {
+    return gpuStats[z].summarise();
+}
+
+// dump - Write a table of all zones in microseconds, indented by nesting
+// Returns the number of chars written excluding the null; output is truncated to fit
+size_t Profiler::dump(char* buffer, size_t size) {
+    size_t n = 0;
+
+    if (size == 0) {
+        return 0;
+    }
+    buffer[0] = 0;
+
+    auto append = [&](const char* fmt, auto... args) {
+        if (n < size) {
+            int r = std::snprintf(buffer + n, size - n, fmt, args...);
+            if (r > 0) {
+                n += size_t(r);
+            }
+        }
+    };
+
+    append("%-22s %8s %8s %8s %8s %8s %8s %8s\n", "Zone (us)", "last", "min", "avg", "max", "p99", "gpu avg", "gpu p99");
+    for (int i = 0; i != ZoneCount; ++i) {
+        const ZoneState& s = zones[i];
+        RollingStats::Summary sum = s.stats.summarise();
+        RollingStats::Summary gpu = gpuStats[i].summarise();
+        int indent = (i == ZoneFrame) ? 0 : 2 * (s.depth > 0 ? s.depth : 1);
+
+        append("%*s%-*s %8.0f %8.0f %8.0f %8.0f %8.0f", indent, "", 22 - indent, zoneNames[i],
+               s.stats.last(), sum.min, sum.avg, sum.max, sum.p99);
+        if (gpu.samples > 0) {
+            append(" %8.0f %8.0f\n", gpu.avg, gpu.p99);
+        } else {
+            append(" %8s %8s\n", "-", "-");
+        }
+    }
+
+    return (n < size) ? n : size - 1;
+}
+
+
+
+bool Profiler::D3D9TimestampQueries::create(int frameSlots, int timestampsPerFrame) {
+    if (!device || device->CreateQuery(D3DQUERYTYPE_TIMESTAMP, NULL) != D3D_OK) {
+        return false;
+    }
+
+    slots.resize(frameSlots);
+    for (Slot& s : slots) {
+        s.disjoint = s.frequency = nullptr;
+        s.timestamps.assign(timestampsPerFrame, nullptr);
+    }
+
+    for (Slot& s : slots) {
+        if (device->CreateQuery(D3DQUERYTYPE_TIMESTAMPDISJOINT, &s.disjoint) != D3D_OK
+            || device->CreateQuery(D3DQUERYTYPE_TIMESTAMPFREQ, &s.frequency) != D3D_OK) {
+            return false;
+        }
+        for (auto& q : s.timestamps) {
+            if (device->CreateQuery(D3DQUERYTYPE_TIMESTAMP, &q) != D3D_OK) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void Profiler::D3D9TimestampQueries::release() {
+    for (Slot& s : slots) {
+        if (s.disjoint) {
+            s.disjoint->Release();
+        }
+        if (s.frequency) {
+            s.frequency->Release();
+        }
+        for (auto q : s.timestamps) {
+            if (q) {
+                q->Release();
+            }
+        }
+    }
+    slots.clear();
+}
+
+void Profiler::D3D9TimestampQueries::beginFrame(int frame) {
+    slots[frame].disjoint->Issue(D3DISSUE_BEGIN);
+}
+
+void Profiler::D3D9TimestampQueries::endFrame(int frame) {
+    slots[frame].disjoint->Issue(D3DISSUE_END);
+    slots[frame].frequency->Issue(D3DISSUE_END);
+}
+
+void Profiler::D3D9TimestampQueries::timestamp(int frame, int index) {
+    slots[frame].timestamps[index]->Issue(D3DISSUE_END);
+}
+
+// frameResult - Polls without D3DGETDATA_FLUSH, queries are old enough that Present has submitted them
+// A lost device never completes queries, so its frames are reported as disjoint to free the ring
+bool Profiler::D3D9TimestampQueries::frameResult(int frame, bool* disjoint, uint64_t* frequency) {
+    BOOL d;
+    UINT64 f;
+    HRESULT hr = slots[frame].disjoint->GetData(&d, sizeof(d), 0);
+
+    if (hr == D3DERR_DEVICELOST) {
+        *disjoint = true;
+        *frequency = 0;
+        return true;
+    }
+    if (hr != S_OK || slots[frame].frequency->GetData(&f, sizeof(f), 0) != S_OK) {
+        return false;
+    }
+    *disjoint = d != FALSE;
+    *frequency = f;
+    return true;
+}
+
+bool Profiler::D3D9TimestampQueries::timestampResult(int frame, int index, uint64_t* ticks) {
+    UINT64 t;
+
+    if (slots[frame].timestamps[index]->GetData(&t, sizeof(t), 0) != S_OK) {
+        return false;
+    }
+    *ticks = t;
+    return true;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "support/profilestats.h"
+
+#include <stddef.h>
+
+struct IDirect3DDevice9;
+
+// Per-stage CPU and GPU frame profiler
+// Zones may nest and may run several times a frame; each zone's time is totalled per frame,
+// and frame totals are kept as rolling statistics. Render thread only.
+// GPU times come from timestamp queries read back a few frames later, for zones that submit GPU work.
+namespace Profiler {
+    // Display order, children following their parent
+    enum Zone {
+        ZoneFrame,
+        ZoneRenderStage0, ZoneShadowMap, ZoneCullDistantStatics, ZoneDynamicWaves,
+        ZoneRenderStage1, ZoneCullGrass,
+        ZoneRenderStage2,
+        ZonePostShaders,
+        ZoneUserHUD,
+        ZoneFFECompile,
+        ZoneCount
+    };
+
+    bool initGPU(IDirect3DDevice9* device);
+    void releaseGPU();
+
+    void begin(Zone z);
+    void end(Zone z);
+    void endFrame();
+    void reset();
+
+    const char* zoneName(Zone z);
+    int zoneDepth(Zone z);
+    float lastSample(Zone z);
+    float lastSampleGPU(Zone z);
+    RollingStats::Summary summarise(Zone z);
+    RollingStats::Summary summariseGPU(Zone z);
+    size_t dump(char* buffer, size_t size);
+
+    // Scope - Times a zone for the lifetime of the object
+    class Scope {
+    public:
+        explicit Scope(Zone z) : zone(z) { begin(z); }
+        ~Scope() { end(zone); }
+
+    private:
+        Zone zone;
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+};
@@ -0,0 +1,604 @@
+
+#include "proxystate.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+
+// D3D enum values used by the forwarding rules, from d3d8types.h / d3d9types.h
+// Scoped, as Windows builds also see the D3D headers
+namespace D3DEnum {
+    enum : uint32_t {
+        TS_VIEW = 2,
+
+        RS_ZWRITEENABLE = 14, RS_ALPHATESTENABLE = 15, RS_SRCBLEND = 19, RS_DESTBLEND = 20,
+        RS_CULLMODE = 22, RS_ALPHAREF = 24, RS_ALPHAFUNC = 25, RS_ALPHABLENDENABLE = 27,
+        RS_FOGENABLE = 28, RS_FOGTABLEMODE = 35, RS_FOGSTART = 36, RS_FOGEND = 37,
+        RS_STENCILENABLE = 52, RS_STENCILREF = 57, RS_LIGHTING = 137, RS_AMBIENT = 139,
+        RS_FOGVERTEXMODE = 140, RS_DIFFUSEMATERIALSOURCE = 145, RS_EMISSIVEMATERIALSOURCE = 148,
+        RS_VERTEXBLEND = 151,
+
+        TSS_COLOROP = 1, TSS_COLORARG1 = 2, TSS_COLORARG2 = 3, TSS_ALPHAOP = 4,
+        TSS_ALPHAARG1 = 5, TSS_ALPHAARG2 = 6, TSS_BUMPENVMAT00 = 7, TSS_BUMPENVMAT01 = 8,
+        TSS_BUMPENVMAT10 = 9, TSS_BUMPENVMAT11 = 10, TSS_TEXCOORDINDEX = 11,
+        TSS_ADDRESSU = 13, TSS_ADDRESSV = 14, TSS_BORDERCOLOR = 15, TSS_MAGFILTER = 16,
+        TSS_MINFILTER = 17, TSS_MIPFILTER = 18, TSS_MIPMAPLODBIAS = 19, TSS_MAXMIPLEVEL = 20,
+        TSS_MAXANISOTROPY = 21, TSS_BUMPENVLSCALE = 22, TSS_BUMPENVLOFFSET = 23,
+        TSS_TEXTURETRANSFORMFLAGS = 24, TSS_ADDRESSW = 25, TSS_COLORARG0 = 26,
+        TSS_ALPHAARG0 = 27, TSS_RESULTARG = 28,
+
+        SAMP_ADDRESSU = 1, SAMP_ADDRESSV = 2, SAMP_ADDRESSW = 3, SAMP_BORDERCOLOR = 4,
+        SAMP_MAGFILTER = 5, SAMP_MINFILTER = 6, SAMP_MIPFILTER = 7, SAMP_MIPMAPLODBIAS = 8,
+        SAMP_MAXMIPLEVEL = 9, SAMP_MAXANISOTROPY = 10,
+
+        TEXF_NONE = 0, TEXF_LINEAR = 2,
+        CULL_CCW = 3,
+        MCS_MATERIAL = 0, MCS_COLOR1 = 1,
+        TOP_DISABLE = 1, TOP_SELECTARG1 = 2, TOP_MODULATE = 4,
+        TA_CURRENT = 1, TA_TEXTURE = 2
+    };
+}
+
+using namespace D3DEnum;
+
+static float asFloat(uint32_t x) {
+    float f;
+    std::memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+// multiply - Row major 4x4 product, out = a * b
+static void multiply(float* out, const float* a, const float* b) {
+    for (int i = 0; i != 4; ++i) {
+        for (int j = 0; j != 4; ++j) {
+            out[4*i + j] = a[4*i] * b[j] + a[4*i + 1] * b[4 + j] + a[4*i + 2] * b[8 + j] + a[4*i + 3] * b[12 + j];
+        }
+    }
+}
+
+
+
+ProxyState::ProxyState(Hooks* hooks) : hooks(hooks) {
+    distantLandReady = distantLandFog = distantWaterEnabled = false;
+    scaleFilter = TEXF_LINEAR;
+    reset();
+}
+
+// reset - State of a newly created device
+// Occurs on startup, and on fullscreen Alt-Tab as the device is released and recreated
+void ProxyState::reset() {
+    sceneCount = -1;
+    rendertargetNormal = true;
+    hudReady = false;
+    isMainView = isStencilScene = isAmbientWhite = stage0Complete = isFrameComplete = isHUDComplete = false;
+    stencilRef = 0;
+    isWaterMaterial = waterDrawn = distantWater = false;
+
+    // Initialize state recorder to D3D defaults
+    rs = RenderedState();
+    rs.zWrite = true;
+    rs.diffuseMaterial.r = 1.0f;
+    rs.diffuseMaterial.g = 1.0f;
+    rs.diffuseMaterial.b = 1.0f;
+    rs.diffuseMaterial.a = 1.0f;
+    rs.cullMode = CULL_CCW;
+    rs.useLighting = true;
+
+    rs.matSrcDiffuse = MCS_COLOR1;
+    rs.matSrcEmissive = MCS_MATERIAL;
+
+    frs = FragmentState();
+    for (FragmentState::Stage* s = &frs.stage[0]; s != &frs.stage[8]; ++s) {
+        s->colorOp = TOP_DISABLE;
+        s->alphaOp = TOP_DISABLE;
+        s->colorArg1 = s->alphaArg1 = TA_TEXTURE;
+        s->colorArg2 = s->alphaArg2 = TA_CURRENT;
+        s->colorArg0 = s->alphaArg0 = s->resultArg = TA_CURRENT;
+    }
+    frs.stage[0].colorOp = TOP_MODULATE;
+    frs.stage[0].alphaOp = TOP_SELECTARG1;
+
+    lightrs.lights.clear();
+    lightrs.active.clear();
+    lightrs.viewStamp = 1;
+    ++lightrs.changeStamp;
+
+    // Nothing is known about the state of a new device
+    stateFilter.invalidate();
+    stateFilter.forwarded = stateFilter.dropped = 0;
+    swallowed = 0;
+}
+
+// present - End of frame, reset scene identifiers
+void ProxyState::present() {
+    // MGE init, API calls and scripts may alter device state between frames
+    stateFilter.invalidate();
+
+    sceneCount = -1;
+    stage0Complete = false;
+    waterDrawn = false;
+    isFrameComplete = false;
+    isHUDComplete = false;
+}
+
+// setRenderTarget - Remember if MW is rendering to back buffer
+void ProxyState::setRenderTarget(bool normal) {
+    rendertargetNormal = normal;
+}
+
+// beginScene - Multiple scenes per frame, non-alpha / 2x stencil / post-stencil redraw / alpha / 1st person / UI
+void ProxyState::beginScene() {
+    if (!rendertargetNormal) {
+        return;
+    }
+
+    if (isMainView) {
+        // Track scene count here in BeginScene
+        // isMainView is not always valid at EndScene if Morrowind draws sunglare
+        ++sceneCount;
+
+        // Check distant water state once per frame
+        if (sceneCount == 0) {
+            hooks->beginFrame();
+            distantWater = distantWaterEnabled;
+        }
+    } else {
+        // UI scene, apply post-process if there was anything drawn before it
+        // Race menu will render an extra scene past this point
+        if (distantLandReady && sceneCount > 0 && !isFrameComplete) {
+            hooks->postProcess();
+        }
+
+        // Render user HUD before Morrowind HUD
+        if (hudReady && !isHUDComplete) {
+            hooks->drawHUD();
+        }
+
+        stateFilter.invalidate();
+        isFrameComplete = true;
+    }
+}
+
+// endScene - Distant land is drawn before the first scene finishes, later scenes have shadows applied
+void ProxyState::endScene() {
+    if (distantLandReady && rendertargetNormal) {
+        // The following Morrowind scenes get past the filters:
+        // ~ Opaque meshes, plus alpha meshes with 'No Sorter' property (which should use alpha test)
+        // ~ If stencil shadows are active, then shadow casters are deferred to be drawn in a scene after
+        //    shadows are fully applied to avoid self-shadowing problems with simplified shadow meshes
+        // ~ If any alpha meshes are visible, they are sorted and drawn in another scene (except those with 'No Sorter' property)
+        // ~ If 1st person or sunglare is visible, they are drawn in another scene after a Z clear
+        if (sceneCount == 0) {
+            // Edge case, render distant land even if Morrowind has culled everything
+            if (!stage0Complete) {
+                hooks->renderStage0();
+                stage0Complete = true;
+            }
+
+            // Opaque features
+            hooks->renderStage1();
+
+            // Blend close objects over distant land
+            hooks->renderStageBlend();
+        } else if (!isFrameComplete) {
+            // Everything else except UI
+            hooks->renderStage2();
+
+            // Draw water if the Morrowind water plane doesn't appear in view
+            // it may be too distant or stencil scene order is non-normative
+            if (distantWater && !waterDrawn && !isStencilScene) {
+                hooks->renderStageWater();
+                waterDrawn = true;
+            }
+        }
+
+        stateFilter.invalidate();
+    }
+
+    if (isFrameComplete && hudReady && !isHUDComplete) {
+        hooks->endFrame();
+        isHUDComplete = true;
+
+        // Status overlay draws through the device, and Morrowind may draw again before Present
+        stateFilter.invalidate();
+    }
+}
+
+// setTransform - Returns false if the call is redundant and should be dropped
+bool ProxyState::setTransform(uint32_t a, const float* m) {
+    if (stateFilter.filterTransform(a, m)) {
+        return false;
+    }
+
+    captureTransform(a, m);
+
+    // Check for UI view
+    if (rendertargetNormal && a == TS_VIEW) {
+        isMainView = !detectMenu(m);
+    }
+    return true;
+}
+
+// multiplyTransform - Result is only known to the device, drop cached transforms
+void ProxyState::multiplyTransform() {
+    stateFilter.invalidateWorldTransforms();
+    stateFilter.invalidateTextureTransforms();
+}
+
+// setMaterial - Capture material, and check for the water material marked by MWBridge::markWaterNode
+void ProxyState::setMaterial(const Material* m) {
+    // Morrowind does not use specular lighting
+    rs.diffuseMaterial.r = m->diffuse.r;
+    rs.diffuseMaterial.g = m->diffuse.g;
+    rs.diffuseMaterial.b = m->diffuse.b;
+    rs.diffuseMaterial.a = m->diffuse.a;
+    frs.material.diffuse = rs.diffuseMaterial;
+    frs.material.ambient.r = m->ambient.r;
+    frs.material.ambient.g = m->ambient.g;
+    frs.material.ambient.b = m->ambient.b;
+    frs.material.ambient.a = m->ambient.a;
+    frs.material.emissive.r = m->emissive.r;
+    frs.material.emissive.g = m->emissive.g;
+    frs.material.emissive.b = m->emissive.b;
+    frs.material.emissive.a = m->power;
+
+    isWaterMaterial = (m->power == 99999.0f);
+}
+
+void ProxyState::setLight(uint32_t index, const Light* light) {
+    captureLight(index, light);
+}
+
+void ProxyState::lightEnable(uint32_t index, bool enable) {
+    if (enable) {
+        if (std::find(lightrs.active.begin(), lightrs.active.end(), index) == lightrs.active.end()) {
+            lightrs.active.push_back(index);
+        }
+    } else {
+        if (std::remove(lightrs.active.begin(), lightrs.active.end(), index) != lightrs.active.end()) {
+            lightrs.active.pop_back();
+        }
+    }
+}
+
+// setRenderState - Returns false if the call is dropped, as redundant or because MGE overrides Morrowind's fog
+bool ProxyState::setRenderState(uint32_t a, uint32_t b) {
+    if (stateFilter.filterRenderState(a, b)) {
+        return false;
+    }
+
+    captureRenderState(a, b);
+
+    if (a == RS_FOGVERTEXMODE || a == RS_FOGTABLEMODE) {
+        ++swallowed;
+        return false;
+    }
+    if (distantLandFog && (a == RS_FOGSTART || a == RS_FOGEND)) {
+        ++swallowed;
+        return false;
+    }
+    if (a == RS_STENCILENABLE) {
+        isStencilScene = b;
+    }
+    else if (a == RS_STENCILREF) {
+        stencilRef = b;
+    }
+
+    // Ambient is used for scene detection
+    if (a == RS_AMBIENT) {
+        // Pure white ambient occurs with skydome and menu mode rendering
+        // Ambient is also never set properly when high enough outside that Morrowind renders nothing
+        isAmbientWhite = (b == 0xffffffff);
+
+        if (!isAmbientWhite) {
+            // Save real ambient, can be used in future frames if no draw calls are provoked
+            const float f = 1.0f / 255.0f;
+            hooks->setAmbientColour(b);
+            lightrs.globalAmbient.r = f * float((b >> 16) & 0xff);
+            lightrs.globalAmbient.g = f * float((b >> 8) & 0xff);
+            lightrs.globalAmbient.b = f * float(b & 0xff);
+        }
+    }
+
+    // Only record states that reach the device, swallowed states leave the device value unchanged
+    stateFilter.recordRenderState(a, b);
+    return true;
+}
+
+// setTextureStageState - Returns false if the call is redundant and should be dropped
+// DX8 had sampling state bound to texture stages instead of samplers; for these states, sampler is set
+// to the DX9 sampler state to use instead, otherwise it is 0. MGE sampler overrides are applied to value.
+bool ProxyState::setTextureStageState(uint32_t stage, uint32_t state, uint32_t& value, uint32_t& sampler) {
+    if (stateFilter.filterStageState(stage, state, value)) {
+        return false;
+    }
+
+    captureFragmentRenderState(stage, state, value);
+
+    switch (state) {
+    case TSS_ADDRESSU:
+        sampler = SAMP_ADDRESSU;
+        break;
+    case TSS_ADDRESSV:
+        sampler = SAMP_ADDRESSV;
+        break;
+    case TSS_BORDERCOLOR:
+        sampler = SAMP_BORDERCOLOR;
+        break;
+    case TSS_MAGFILTER:
+        sampler = SAMP_MAGFILTER;
+        break;
+    case TSS_MINFILTER:
+        // Sampler overrides to ensure trilinear/anisotropic filtering works
+        sampler = SAMP_MINFILTER;
+        value = (value != TEXF_NONE) ? scaleFilter : TEXF_NONE;
+        break;
+    case TSS_MIPFILTER:
+        sampler = SAMP_MIPFILTER;
+        value = (value != TEXF_NONE) ? TEXF_LINEAR : TEXF_NONE;
+        break;
+    case TSS_MIPMAPLODBIAS:
+        sampler = SAMP_MIPMAPLODBIAS;
+        break;
+    case TSS_MAXMIPLEVEL:
+        sampler = SAMP_MAXMIPLEVEL;
+        break;
+    case TSS_MAXANISOTROPY:
+        sampler = SAMP_MAXANISOTROPY;
+        break;
+    case TSS_ADDRESSW:
+        sampler = SAMP_ADDRESSW;
+        break;
+    default:
+        sampler = 0;
+        break;
+    }
+    return true;
+}
+
+// setTexture - Returns false if the call is redundant and should be dropped
+bool ProxyState::setTexture(uint32_t stage, IDirect3DTexture9* texture) {
+    if (stateFilter.filterTexture(stage, texture)) {
+        return false;
+    }
+
+    if (stage == 0) {
+        rs.texture = texture;
+    }
+    return true;
+}
+
+void ProxyState::setFVF(uint32_t fvf) {
+    rs.fvf = fvf;
+}
+
+void ProxyState::setStreamSource(uint32_t stream, IDirect3DVertexBuffer9* vb, uint32_t stride) {
+    if (stream == 0) {
+        rs.vb = vb;
+        rs.vbOffset = 0;
+        rs.vbStride = stride;
+    }
+}
+
+void ProxyState::setIndices(IDirect3DIndexBuffer9* ib) {
+    rs.ib = ib;
+}
+
+// drawIndexedPrimitive - Where all the drawing happens
+// Lets distant land inspect draw calls for re-use later. Returns false if the call should not reach the device.
+bool ProxyState::drawIndexedPrimitive(uint32_t type, uint32_t baseVertexIndex, uint32_t minIndex, uint32_t vertCount, uint32_t startIndex, uint32_t primCount) {
+    bool isShadowStencil = isStencilScene && stencilRef <= 1;
+    if (!distantLandReady || !rendertargetNormal || !isMainView || isShadowStencil) {
+        return true;
+    }
+
+    rs.primType = D3DPRIMITIVETYPE(type);
+    rs.baseIndex = baseVertexIndex;
+    rs.minIndex = minIndex;
+    rs.vertCount = vertCount;
+    rs.startIndex = startIndex;
+    rs.primCount = primCount;
+
+    if (!stage0Complete && !isAmbientWhite) {
+        // At this point, only the sky is rendered in exteriors, or nothing in interiors
+        hooks->renderStage0();
+        stage0Complete = true;
+        stateFilter.invalidate();
+    }
+
+    if (isWaterMaterial) {
+        if (distantWater) {
+            // Call distant land instead of drawing water grid
+            if (!waterDrawn) {
+                hooks->renderStageWater();
+                waterDrawn = true;
+                stateFilter.invalidate();
+            }
+            return false;
+        }
+    } else {
+        // Let distant land record call and skip if signalled
+        if (!hooks->inspectDraw(sceneCount, &rs, &frs, &lightrs)) {
+            // Replacement shaders rebind samplers through the effect system
+            stateFilter.invalidateTextures();
+            return false;
+        }
+    }
+    return true;
+}
+
+// applyStateBlock - Not used by Morrowind, but any state block application makes the filter cache stale
+void ProxyState::applyStateBlock() {
+    stateFilter.invalidate();
+}
+
+// detectMenu
+// detects if view matrix (row major) is for UI / load bars
+// the projection matrix is never set to ortho, making it unusable for detection
+bool ProxyState::detectMenu(const float* m) {
+    if (m[12] != 0.0f || !(m[13] == 0.0f || m[13] == -600.0f) || m[14] != 0.0f) {
+        return false;
+    }
+
+    if ((m[0] == 0.0f || m[0] == 1.0f) && m[1] == 0.0f && (m[2] == 0.0f || m[2] == 1.0f) &&
+            m[4] == 0.0f && (m[5] == 0.0f || m[5] == 1.0f) && (m[6] == 0.0f || m[6] == 1.0f) &&
+            (m[8] == 0.0f || m[8] == 1.0f) && (m[9] == 0.0f || m[9] == 1.0f) && m[10] == 0.0f) {
+        return true;
+    }
+
+    return false;
+}
+
+void ProxyState::captureRenderState(uint32_t a, uint32_t b) {
+    switch (a) {
+    case RS_VERTEXBLEND:
+        rs.vertexBlendState = b;
+        break;
+    case RS_ZWRITEENABLE:
+        rs.zWrite = b;
+        break;
+    case RS_CULLMODE:
+        rs.cullMode = b;
+        break;
+    case RS_ALPHABLENDENABLE:
+        rs.blendEnable = (BYTE)b;
+        break;
+    case RS_SRCBLEND:
+        rs.srcBlend = (BYTE)b;
+        break;
+    case RS_DESTBLEND:
+        rs.destBlend = (BYTE)b;
+        break;
+    case RS_ALPHATESTENABLE:
+        rs.alphaTest = (BYTE)b;
+        break;
+    case RS_ALPHAFUNC:
+        rs.alphaFunc = (BYTE)b;
+        break;
+    case RS_ALPHAREF:
+        rs.alphaRef = (BYTE)b;
+        break;
+    case RS_LIGHTING:
+        rs.useLighting = (BYTE)b;
+        break;
+    case RS_FOGENABLE:
+        rs.useFog = (BYTE)b;
+        break;
+    case RS_DIFFUSEMATERIALSOURCE:
+        rs.matSrcDiffuse = (BYTE)b;
+        break;
+    case RS_EMISSIVEMATERIALSOURCE:
+        rs.matSrcEmissive = (BYTE)b;
+        break;
+    }
+}
+
+void ProxyState::captureFragmentRenderState(uint32_t a, uint32_t b, uint32_t c) {
+    if (a >= 8) {
+        return;
+    }
+    FragmentState::Stage* s = &frs.stage[a];
+
+    switch (b) {
+    case TSS_COLOROP:
+        s->colorOp = (BYTE)c;
+        break;
+    case TSS_COLORARG1:
+        s->colorArg1 = (BYTE)c;
+        break;
+    case TSS_COLORARG2:
+        s->colorArg2 = (BYTE)c;
+        break;
+    case TSS_ALPHAOP:
+        s->alphaOp = (BYTE)c;
+        break;
+    case TSS_ALPHAARG1:
+        s->alphaArg1 = (BYTE)c;
+        break;
+    case TSS_ALPHAARG2:
+        s->alphaArg2 = (BYTE)c;
+        break;
+    case TSS_BUMPENVMAT00:
+        s->bumpEnvMat[0][0] = asFloat(c);
+        break;
+    case TSS_BUMPENVMAT01:
+        s->bumpEnvMat[0][1] = asFloat(c);
+        break;
+    case TSS_BUMPENVMAT10:
+        s->bumpEnvMat[1][0] = asFloat(c);
+        break;
+    case TSS_BUMPENVMAT11:
+        s->bumpEnvMat[1][1] = asFloat(c);
+        break;
+    case TSS_TEXCOORDINDEX:
+        s->texcoordIndex = c;
+        break;
+    case TSS_BUMPENVLSCALE:
+        s->bumpLumiScale = asFloat(c);
+        break;
+    case TSS_BUMPENVLOFFSET:
+        s->bumpLumiBias = asFloat(c);
+        break;
+    case TSS_TEXTURETRANSFORMFLAGS:
+        s->texTransformFlags = c;
+        break;
+    case TSS_COLORARG0:
+        s->colorArg0 = (BYTE)c;
+        break;
+    case TSS_ALPHAARG0:
+        s->alphaArg0 = (BYTE)c;
+        break;
+    case TSS_RESULTARG:
+        s->resultArg = (BYTE)c;
+        break;
+    }
+}
+
+void ProxyState::captureTransform(uint32_t a, const float* m) {
+    if (a >= StateFilter::TransformWorld0 && a < StateFilter::TransformWorld0 + 4) {
+        uint32_t i = a - StateFilter::TransformWorld0;
+        std::memcpy(rs.worldTransforms[i].m, m, sizeof(rs.worldTransforms[i].m));
+        multiply(rs.worldViewTransforms[i].m[0], m, rs.viewTransform.m[0]);
+    } else if (a == TS_VIEW) {
+        std::memcpy(rs.viewTransform.m, m, sizeof(rs.viewTransform.m));
+        ++lightrs.viewStamp;
+        ++lightrs.changeStamp;
+        // World-view transforms are derived on capture, so world transforms must be captured again
+        stateFilter.invalidateWorldTransforms();
+    }
+}
+
+void ProxyState::captureLight(uint32_t a, const Light* b) {
+    // Morrowind uses non-contigous light IDs up to a large number (>512)
+    LightState::Light* light = &lightrs.lights[a];
+    LightState::Light updated = *light;
+
+    // Copy values relevant to Morrowind
+    // i.e. Morrowind has no spotlights and always sets range to FLT_MAX
+    // The only light source with ambient is sunlight
+    updated.type = b->type;
+    updated.diffuse.r = b->diffuse.r;
+    updated.diffuse.g = b->diffuse.g;
+    updated.diffuse.b = b->diffuse.b;
+    updated.diffuse.a = b->diffuse.a;
+
+    if (b->type == LightState::TypePoint) {
+        updated.position = vec3(b->position.x, b->position.y, b->position.z);
+        updated.falloff.x = b->attenuation0;
+        updated.falloff.y = b->attenuation1;
+        updated.falloff.z = b->attenuation2;
+    } else {
+        updated.position = normalize(vec3(b->direction.x, b->direction.y, b->direction.z));
+        updated.ambient.x = b->ambient.r;
+        updated.ambient.y = b->ambient.g;
+        updated.ambient.z = b->ambient.b;
+    }
+
+    // Lights are often re-sent unchanged, only invalidate packed lighting on a real change
+    if (std::memcmp(&updated, light, sizeof(updated)) != 0) {
+        *light = updated;
+        light->viewspaceStamp = 0;
+        ++lightrs.changeStamp;
+    }
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "support/d3dxportable.h"
+#include "lightpack.h"
+#include "statefilter.h"
+
+#include <stdint.h>
+
+
+
+struct RenderedState {
+    IDirect3DTexture9* texture;
+    IDirect3DVertexBuffer9* vb;
+    UINT vbOffset, vbStride;
+    IDirect3DIndexBuffer9* ib;
+    DWORD ibBase;
+    DWORD fvf;
+    DWORD zWrite, cullMode;
+    DWORD vertexBlendState;
+    D3DXMATRIX worldTransforms[4];
+    D3DXMATRIX viewTransform;
+    D3DXMATRIX worldViewTransforms[4];
+    D3DCOLORVALUE diffuseMaterial;
+    BYTE blendEnable, srcBlend, destBlend;
+    BYTE alphaTest, alphaFunc, alphaRef;
+    BYTE useLighting, useFog, matSrcDiffuse, matSrcEmissive;
+
+    D3DPRIMITIVETYPE primType;
+    UINT baseIndex, minIndex, vertCount, startIndex, primCount;
+};
+
+struct FragmentState {
+    struct Stage {
+        BYTE colorOp, colorArg1, colorArg2;
+        BYTE alphaOp, alphaArg1, alphaArg2;
+        BYTE colorArg0, alphaArg0, resultArg;
+        DWORD texcoordIndex;
+        DWORD texTransformFlags;
+        float bumpEnvMat[2][2];
+        float bumpLumiScale, bumpLumiBias;
+    } stage[8];
+
+    struct Material {
+        D3DCOLORVALUE diffuse, ambient, emissive;
+    } material;
+};
+
+// Proxy device forwarding rules
+// Decides which of Morrowind's D3D8 calls reach the device, captures the render state distant land
+// needs to redraw meshes, and tracks which of Morrowind's scenes is being drawn.
+// Work that needs the game or a device is called through Hooks. Uses plain D3D enum values, so that
+// mgetrace replays call traces through the same rules as MGEProxyDevice.
+class ProxyState {
+public:
+    // Layouts of D3DLIGHT8 and D3DMATERIAL8
+    struct Colour {
+        float r, g, b, a;
+    };
+    struct Vector {
+        float x, y, z;
+    };
+    struct Light {
+        uint32_t type;
+        Colour diffuse, specular, ambient;
+        Vector position, direction;
+        float range, falloff, attenuation0, attenuation1, attenuation2, theta, phi;
+    };
+    struct Material {
+        Colour diffuse, ambient, specular, emissive;
+        float power;
+    };
+
+    // Distant land and HUD work at fixed points of Morrowind's frame, by default doing nothing
+    class Hooks {
+    public:
+        virtual ~Hooks() {}
+        virtual void beginFrame() {}                    // First main view scene of a frame
+        virtual void renderStage0() {}
+        virtual void renderStage1() {}
+        virtual void renderStageBlend() {}
+        virtual void renderStage2() {}
+        virtual void renderStageWater() {}
+        virtual void postProcess() {}
+        virtual void drawHUD() {}
+        virtual void endFrame() {}                      // After the UI scene, for overlays and captures
+        virtual void setAmbientColour(uint32_t) {}
+        // inspectDraw - Returns false if the draw call should not reach the device
+        virtual bool inspectDraw(int, const RenderedState*, const FragmentState*, LightState*) { return true; }
+    };
+
+    // Settings, refreshed by the device as they can change between frames
+    bool distantLandReady;          // Distant land is loaded and renders in the main view
+    bool distantLandFog;            // Distant land sets the fog range, Morrowind's is ignored
+    bool distantWaterEnabled;       // Distant land or distant water replaces Morrowind's water
+    uint32_t scaleFilter;           // Minification filter for filtered textures
+
+    RenderedState rs;
+    FragmentState frs;
+    LightState lightrs;
+    StateFilter stateFilter;
+    unsigned long long swallowed;   // Fog states that never reach the device
+
+    // Scene tracking
+    int sceneCount;
+    bool rendertargetNormal, hudReady;
+    bool isMainView, isStencilScene, isAmbientWhite;
+    uint32_t stencilRef;
+    bool stage0Complete, isFrameComplete, isHUDComplete;
+    bool isWaterMaterial, waterDrawn, distantWater;
+
+    explicit ProxyState(Hooks* hooks);
+
+    void reset();
+    void present();
+    void setRenderTarget(bool normal);
+    void beginScene();
+    void endScene();
+    bool setTransform(uint32_t a, const float* m);
+    void multiplyTransform();
+    void setMaterial(const Material* m);
+    void setLight(uint32_t index, const Light* light);
+    void lightEnable(uint32_t index, bool enable);
+    bool setRenderState(uint32_t a, uint32_t b);
+    bool setTextureStageState(uint32_t stage, uint32_t state, uint32_t& value, uint32_t& sampler);
+    bool setTexture(uint32_t stage, IDirect3DTexture9* texture);
+    void setFVF(uint32_t fvf);
+    void setStreamSource(uint32_t stream, IDirect3DVertexBuffer9* vb, uint32_t stride);
+    void setIndices(IDirect3DIndexBuffer9* ib);
+    bool drawIndexedPrimitive(uint32_t type, uint32_t baseVertexIndex, uint32_t minIndex, uint32_t vertCount, uint32_t startIndex, uint32_t primCount);
+    void applyStateBlock();
+
+    static bool detectMenu(const float* m);
+
+private:
+    Hooks* hooks;
+
+    void captureRenderState(uint32_t a, uint32_t b);
+    void captureFragmentRenderState(uint32_t a, uint32_t b, uint32_t c);
+    void captureTransform(uint32_t a, const float* m);
+    void captureLight(uint32_t a, const Light* b);
+};
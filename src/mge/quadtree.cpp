@@ -16,7 +16,7 @@ static const float QUADTREE_MIN_DIST = 20.0f;
 QuadTreeMesh::QuadTreeMesh(
     const BoundingSphere& sphere,
     const BoundingBox& box,
-    const D3DXMATRIX& transform,
+    const mat4x3& transform,
     bool hasAlpha,
     bool animateUV,
     IDirect3DTexture9* tex,
@@ -104,6 +104,8 @@ void VisibleSet::RemoveAll() {
 
 //-----------------------------------------------------------------------------
 
+// Rendering needs D3D; culling and sorting are portable for use by offline tools
+#ifdef _WIN32
 void VisibleSet::Render(IDirect3DDevice9* device,
                         unsigned int vertex_size) {
 
@@ -171,12 +173,14 @@ void VisibleSet::Render(IDirect3DDevice9* device,
         }
 
         // Set transform matrix
-        effectPool->SetMatrix(*world_matrix_handle, &mesh->transform);
+        mat4 world(mesh->transform);
+        effectPool->SetMatrix(*world_matrix_handle, toD3DX(&world));
 
         effect->CommitChanges();
         device->DrawIndexedPrimitive(D3DPT_TRIANGLELIST, 0, 0, mesh->verts, 0, mesh->faces);
     }
 }
+#endif
 
 //-----------------------------------------------------------------------------
 
@@ -198,7 +202,7 @@ void VisibleSet::SortByTexture() {
 // QuadTreeNode class
 //-----------------------------------------------------------------------------
 
-void QuadTreeNode::GetVisibleMeshes(const ViewFrustum& frustum, const D3DXVECTOR4& viewsphere, VisibleSet& visible_set, bool inside) {
+void QuadTreeNode::GetVisibleMeshes(const ViewFrustum& frustum, const vec4& viewsphere, VisibleSet& visible_set, bool inside) {
     // Check if this node is fully outside the frustum.
     // If inside = true then that means it has already been determined that this entire branch is visible
     if (inside == false) {
@@ -230,7 +234,7 @@ void QuadTreeNode::GetVisibleMeshes(const ViewFrustum& frustum, const D3DXVECTOR
     }
 
     // If this node has any meshes, check each of their visibility and add them to the list if they're not completely outside the frustum
-    D3DXVECTOR3 eyepos(viewsphere.x, viewsphere.y, viewsphere.z);
+    vec3 eyepos(viewsphere.x, viewsphere.y, viewsphere.z);
 
     for (const QuadTreeMesh* mesh : meshes) {
         if (!mesh->enabled) {
@@ -252,7 +256,7 @@ void QuadTreeNode::GetVisibleMeshes(const ViewFrustum& frustum, const D3DXVECTOR
 
         // Avoid camera rotation dependent clipping by using a spherical far clip plane
         // Test mesh against view sphere (eyepos.xyz, radius)
-        D3DXVECTOR3 d = mesh->sphere.center - eyepos;
+        vec3 d = mesh->sphere.center - eyepos;
         float range_squared = d.x*d.x + d.y*d.y + d.z*d.z;
         float view_limit = viewsphere.w + mesh->sphere.radius;
 
@@ -327,8 +331,8 @@ void QuadTreeNode::AddMesh(QuadTreeMesh* new_mesh, int depth) {
 
     // If there are already meshes at this node, add it anyway if it's close enough to the first one
     if (meshes_size > 0) {
-        D3DXVECTOR3 diff = new_mesh->sphere.center - meshes[0]->sphere.center;
-        if (D3DXVec3Length(&diff) <= QUADTREE_MIN_DIST) {
+        vec3 diff = new_mesh->sphere.center - meshes[0]->sphere.center;
+        if (length(diff) <= QUADTREE_MIN_DIST) {
             meshes.push_back(new_mesh);
             return;
         }
@@ -536,7 +540,7 @@ QuadTree::~QuadTree() {
 QuadTreeMesh* QuadTree::AddMesh(
     const BoundingSphere& sphere,
     const BoundingBox& box,
-    const D3DXMATRIX& transform,
+    const mat4x3& transform,
     bool hasAlpha,
     bool animateUV,
     IDirect3DTexture9* tex,
@@ -580,7 +584,7 @@ void QuadTree::Clear() {
 
 //-----------------------------------------------------------------------------
 
-void QuadTree::GetVisibleMeshes(const ViewFrustum& frustum, const D3DXVECTOR4& sphere, VisibleSet& visible_set) {
+void QuadTree::GetVisibleMeshes(const ViewFrustum& frustum, const vec4& sphere, VisibleSet& visible_set) {
     m_root_node->GetVisibleMeshes(frustum, sphere, visible_set);
 }
 
@@ -590,7 +594,7 @@ void QuadTree::GetVisibleMeshesCoarse(const ViewFrustum& frustum, VisibleSet& vi
 
 //-----------------------------------------------------------------------------
 
-void QuadTree::SetBox(float size, const D3DXVECTOR2& center) {
+void QuadTree::SetBox(float size, const vec2& center) {
     m_root_node->box_size = size;
     m_root_node->box_center = center;
 }
@@ -616,7 +620,7 @@ QuadTreeNode* QuadTree::CreateNode() {
 QuadTreeMesh* QuadTree::CreateMesh(
     const BoundingSphere& sphere,
     const BoundingBox& box,
-    const D3DXMATRIX& transform,
+    const mat4x3& transform,
     bool hasAlpha,
     bool animateUV,
     IDirect3DTexture9* tex,
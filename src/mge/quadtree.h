@@ -12,7 +12,7 @@ struct QuadTreeMesh {
     bool enabled, hasAlpha, animateUV;
 
     IDirect3DTexture9* tex;
-    D3DXMATRIX transform;
+    mat4x3 transform;
     int verts;
     IDirect3DVertexBuffer9* vBuffer;
     int faces;
@@ -21,7 +21,7 @@ struct QuadTreeMesh {
     QuadTreeMesh(
         const BoundingSphere& b_sphere,
         const BoundingBox& b_box,
-        const D3DXMATRIX& transform,
+        const mat4x3& transform,
         bool hasAlpha,
         bool animateUV,
         IDirect3DTexture9* tex,
@@ -48,6 +48,7 @@ public:
     VisibleSet() {}
     ~VisibleSet() {}
 
+#ifdef _WIN32
     void Render(IDirect3DDevice9* device,
                 unsigned int vertex_size);
 
@@ -59,6 +60,7 @@ public:
                 const D3DXHANDLE* animate_uv_handle,
                 const D3DXHANDLE* world_matrix_handle,
                 unsigned int vertex_size);
+#endif
 
     void SortByState();
     void SortByTexture();
@@ -79,14 +81,14 @@ struct QuadTreeNode {
     QuadTree* m_owner;
     QuadTreeNode* children[4];
     float box_size;
-    D3DXVECTOR2 box_center;
+    vec2 box_center;
     BoundingSphere sphere;
     std::vector<QuadTreeMesh*> meshes;
 
     QuadTreeNode(QuadTree* owner);
     ~QuadTreeNode();
 
-    void GetVisibleMeshes(const ViewFrustum& frustum, const D3DXVECTOR4& viewsphere, VisibleSet& visible_set, bool inside = false);
+    void GetVisibleMeshes(const ViewFrustum& frustum, const vec4& viewsphere, VisibleSet& visible_set, bool inside = false);
     void GetVisibleMeshesCoarse(const ViewFrustum& frustum, VisibleSet& visible_set, bool inside = false);
 
     void AddMesh(QuadTreeMesh* new_mesh, int depth);
@@ -107,7 +109,7 @@ public:
     QuadTreeMesh* AddMesh(
         const BoundingSphere& sphere,
         const BoundingBox& box,
-        const D3DXMATRIX& transform,
+        const mat4x3& transform,
         bool hasAlpha,
         bool animateUV,
         IDirect3DTexture9* tex,
@@ -119,9 +121,9 @@ public:
 
     bool Optimize();
     void Clear();
-    void GetVisibleMeshes(const ViewFrustum& frustum, const D3DXVECTOR4& viewsphere, VisibleSet& visible_set);
+    void GetVisibleMeshes(const ViewFrustum& frustum, const vec4& viewsphere, VisibleSet& visible_set);
     void GetVisibleMeshesCoarse(const ViewFrustum& frustum, VisibleSet& visible_set);
-    void SetBox(float size, const D3DXVECTOR2& center);
+    void SetBox(float size, const vec2& center);
     void CalcVolume();
 
     QuadTreeNode* m_root_node;
@@ -135,7 +137,7 @@ protected:
     QuadTreeMesh* CreateMesh(
         const BoundingSphere& sphere,
         const BoundingBox& box,
-        const D3DXMATRIX& transform,
+        const mat4x3& transform,
         bool hasAlpha,
         bool animateUV,
         IDirect3DTexture9* tex,
@@ -3,6 +3,7 @@
 #include "distantshader.h"
 #include "configuration.h"
 #include "mwbridge.h"
+#include "profiler.h"
 #include "proxydx/d3d8header.h"
 
 #include <algorithm>
@@ -85,8 +86,9 @@ void DistantLand::renderSky() {
 }
 
 void DistantLand::renderDistantLand(ID3DXEffect* e, const D3DXMATRIX* view, const D3DXMATRIX* proj) {
-    D3DXMATRIX world, viewproj = (*view) * (*proj);
-    D3DXVECTOR4 viewsphere(eyePos.x, eyePos.y, eyePos.z, Configuration.DL.DrawDist * kCellSize);
+    D3DXMATRIX world;
+    mat4 viewproj = *fromD3DX(view) * *fromD3DX(proj);
+    vec4 viewsphere(eyePos.x, eyePos.y, eyePos.z, Configuration.DL.DrawDist * kCellSize);
 
     D3DXMatrixIdentity(&world);
     effect->SetMatrix(ehWorld, &world);
@@ -97,7 +99,7 @@ void DistantLand::renderDistantLand(ID3DXEffect* e, const D3DXMATRIX* view, cons
     e->CommitChanges();
 
     // Cull and draw
-    ViewFrustum frustum(&viewproj);
+    ViewFrustum frustum(viewproj);
     visLand.RemoveAll();
     LandQuadTree.GetVisibleMeshes(frustum, viewsphere, visLand);
 
@@ -117,42 +119,33 @@ void DistantLand::renderDistantLandZ() {
     visLand.Render(device, SIZEOFLANDVERT);
 }
 
-void DistantLand::cullDistantStatics(const D3DXMATRIX* view, const D3DXMATRIX* proj) {
-    D3DXMATRIX ds_proj = *proj, ds_viewproj;
-    D3DXVECTOR4 viewsphere(eyePos.x, eyePos.y, eyePos.z, 0);
-    float zn = nearViewRange - 768.0f, zf = zn;
-    float cullDist = fogEnd;
-
-    visDistant.RemoveAll();
-
-    zf = std::min(Configuration.DL.NearStaticEnd * kCellSize, cullDist);
-    if (zn < zf) {
-        editProjectionZ(&ds_proj, zn, zf);
-        ds_viewproj = (*view) * ds_proj;
-        ViewFrustum range_frustum(&ds_viewproj);
-        viewsphere.w = zf;
-        currentWorldSpace->NearStatics->GetVisibleMeshes(range_frustum, viewsphere, visDistant);
-    }
-
-    zf = std::min(Configuration.DL.FarStaticEnd * kCellSize, cullDist);
-    if (zn < zf) {
-        editProjectionZ(&ds_proj, zn, zf);
-        ds_viewproj = (*view) * ds_proj;
-        ViewFrustum range_frustum(&ds_viewproj);
-        viewsphere.w = zf;
-        currentWorldSpace->FarStatics->GetVisibleMeshes(range_frustum, viewsphere, visDistant);
-    }
+// currentStaticTrees - Distant static trees of the current worldspace
+DistantStaticTrees DistantLand::currentStaticTrees() {
+    DistantStaticTrees trees = {
+        currentWorldSpace->NearStatics.get(),
+        currentWorldSpace->FarStatics.get(),
+        currentWorldSpace->VeryFarStatics.get(),
+        currentWorldSpace->GrassStatics.get()
+    };
+    return trees;
+}
 
-    zf = std::min(Configuration.DL.VeryFarStaticEnd * kCellSize, cullDist);
-    if (zn < zf) {
-        editProjectionZ(&ds_proj, zn, zf);
-        ds_viewproj = (*view) * ds_proj;
-        ViewFrustum range_frustum(&ds_viewproj);
-        viewsphere.w = zf;
-        currentWorldSpace->VeryFarStatics->GetVisibleMeshes(range_frustum, viewsphere, visDistant);
-    }
+// cullRanges - Draw distances for this frame's culling, from settings and the current fog
+DistantCullRanges DistantLand::cullRanges() {
+    DistantCullRanges ranges = {
+        nearViewRange,
+        fogEnd,
+        Configuration.DL.NearStaticEnd * kCellSize,
+        Configuration.DL.FarStaticEnd * kCellSize,
+        Configuration.DL.VeryFarStaticEnd * kCellSize,
+        (Configuration.MGEFlags & EXP_FOG) != 0
+    };
+    return ranges;
+}
 
-    visDistant.SortByState();
+void DistantLand::cullDistantStatics(const D3DXMATRIX* view, const D3DXMATRIX* proj) {
+    Profiler::Scope profile(Profiler::ZoneCullDistantStatics);
+    cullDistantStaticRanges(currentStaticTrees(), cullRanges(), eyePos, *fromD3DX(view), *fromD3DX(proj), visDistant);
 }
 
 void DistantLand::renderDistantStatics() {
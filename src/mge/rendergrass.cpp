@@ -3,6 +3,7 @@
 #include "distantshader.h"
 #include "configuration.h"
 #include "mged3d8device.h"
+#include "profiler.h"
 #include "support/log.h"
 
 #include <algorithm>
@@ -10,28 +11,10 @@
 
 
 void DistantLand::cullGrass(const D3DXMATRIX* view, const D3DXMATRIX* proj) {
-    D3DXMATRIX ds_proj = *proj, ds_viewproj;
-    float zn = 4.0f, zf = nearViewRange;
-
-    // Don't draw beyond fully fogged distance; early out if frustum is empty
-    if (~Configuration.MGEFlags & EXP_FOG) {
-        zf = std::min(fogEnd, zf);
-    }
-    if (zf <= zn) {
-        return;
+    Profiler::Scope profile(Profiler::ZoneCullGrass);
+    if (cullGrassRange(currentStaticTrees(), cullRanges(), *fromD3DX(view), *fromD3DX(proj), visGrass)) {
+        buildGrassInstanceVB();
     }
-
-    // Create a clipping frustum for visibility determination
-    editProjectionZ(&ds_proj, zn, zf);
-    ds_viewproj = (*view) * ds_proj;
-
-    // Cull and sort
-    ViewFrustum range_frustum(&ds_viewproj);
-    visGrass.RemoveAll();
-    currentWorldSpace->GrassStatics->GetVisibleMeshesCoarse(range_frustum, visGrass);
-    visGrass.SortByState();
-
-    buildGrassInstanceVB();
 }
 
 
@@ -72,7 +55,7 @@ void DistantLand::buildGrassInstanceVB() {
         }
 
         // Pack into 4x3 transposed matrix
-        const D3DMATRIX* world = &m->transform;
+        const mat4x3* world = &m->transform;
         vbwrite[0] = world->_11;
         vbwrite[1] = world->_21;
         vbwrite[2] = world->_31;
@@ -3,6 +3,7 @@
 #include "distantshader.h"
 #include "configuration.h"
 #include "mwbridge.h"
+#include "profiler.h"
 #include "proxydx/d3d8header.h"
 #include "support/log.h"
 
@@ -20,6 +21,7 @@ static const float shadowFarRadius = 4000.0;
 // Applies filtering to soften shadow edges
 // This *must* restore render state on return
 void DistantLand::renderShadowMap() {
+    Profiler::Scope profile(Profiler::ZoneShadowMap);
     IDirect3DSurface9* target, *targetSoft;
     texShadow->GetSurfaceLevel(0, &target);
     texSoftShadow->GetSurfaceLevel(0, &targetSoft);
@@ -48,11 +50,17 @@ void DistantLand::renderShadowMap() {
     D3DXMatrixMultiply(&cameraViewProj, &mwView, &mwProj);
     D3DXMatrixInverse(&inverseCameraProj, NULL, &cameraViewProj);
 
+    // Set up both layers, and extract their culling frusta together
+    plane layerPlanes[2][6];
+    calcShadowLayer(0, shadowNearRadius);
+    calcShadowLayer(1, shadowFarRadius);
+    extractFrustumPlanes(fromD3DX(smViewproj), layerPlanes, 2);
+
     // Render near layer (changes viewport)
-    renderShadowLayer(0, shadowNearRadius, &inverseCameraProj);
+    renderShadowLayer(0, ViewFrustum(layerPlanes[0]), &inverseCameraProj);
 
     // Render far layer (changes viewport)
-    renderShadowLayer(1, shadowFarRadius, &inverseCameraProj);
+    renderShadowLayer(1, ViewFrustum(layerPlanes[1]), &inverseCameraProj);
 
     // Reset viewport
     device->SetViewport(&vp);
@@ -81,9 +89,8 @@ void DistantLand::renderShadowMap() {
     targetSoft->Release();
 }
 
-// renderShadowLayer - Calculates projection for, and renders, one shadow layer
-void DistantLand::renderShadowLayer(int layer, float radius, const D3DXMATRIX* inverseCameraProj) {
-    auto mwBridge = MWBridge::get();
+// calcShadowLayer - Calculates view and projection for one shadow layer
+void DistantLand::calcShadowLayer(int layer, float radius) {
     D3DXVECTOR3 lookAt, lookAtEye, shadowCameraPos, up(0, 0, 1);
     D3DXMATRIX* view = &smView[layer], *proj = &smProj[layer], *viewproj = &smViewproj[layer];
 
@@ -123,17 +130,22 @@ void DistantLand::renderShadowLayer(int layer, float radius, const D3DXMATRIX* i
     viewproj->_41 += quantizer * floor(dv.x / quantizer);
     viewproj->_42 += quantizer * floor(dv.y / quantizer);
     viewproj->_43 += dv.z;
+}
+
+// renderShadowLayer - Renders one shadow layer, culled to the frustum of its calculated projection
+void DistantLand::renderShadowLayer(int layer, const ViewFrustum& frustum, const D3DXMATRIX* inverseCameraProj) {
+    auto mwBridge = MWBridge::get();
+    D3DXMATRIX* view = &smView[layer], *proj = &smProj[layer], *viewproj = &smViewproj[layer];
 
     effect->SetMatrixArray(ehShadowViewproj, viewproj, 1);
     effectShadow->CommitChanges();
 
     // Cull
-    ViewFrustum range_frustum(viewproj);
     VisibleSet visible_set;
 
-    currentWorldSpace->NearStatics->GetVisibleMeshesCoarse(range_frustum, visible_set);
-    currentWorldSpace->FarStatics->GetVisibleMeshesCoarse(range_frustum, visible_set);
-    currentWorldSpace->VeryFarStatics->GetVisibleMeshesCoarse(range_frustum, visible_set);
+    currentWorldSpace->NearStatics->GetVisibleMeshesCoarse(frustum, visible_set);
+    currentWorldSpace->FarStatics->GetVisibleMeshesCoarse(frustum, visible_set);
+    currentWorldSpace->VeryFarStatics->GetVisibleMeshesCoarse(frustum, visible_set);
 
     // Clip to atlas region with viewport
     const DWORD res = Configuration.DL.ShadowResolution;
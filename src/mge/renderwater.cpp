@@ -5,6 +5,7 @@
 #include "doublesurface.h"
 #include "mwbridge.h"
 #include "postshaders.h"
+#include "profiler.h"
 
 
 
@@ -192,7 +193,7 @@ void DistantLand::renderReflectedSky() {
 
 void DistantLand::renderReflectedStatics(const D3DXMATRIX* view, const D3DXMATRIX* proj) {
     // Select appropriate static clipping distance
-    D3DXMATRIX ds_proj = *proj, ds_viewproj;
+    mat4 ds_proj = *fromD3DX(proj), ds_viewproj;
     float zn = 4.0f, zf = Configuration.DL.NearStaticEnd * kCellSize;
 
     // Don't draw beyond fully fogged distance; early out if frustum is empty
@@ -203,12 +204,12 @@ void DistantLand::renderReflectedStatics(const D3DXMATRIX* view, const D3DXMATRI
 
     // Create a clipping frustum for visibility determination
     editProjectionZ(&ds_proj, zn, zf);
-    ds_viewproj = (*view) * ds_proj;
+    ds_viewproj = *fromD3DX(view) * ds_proj;
 
     // Cull sort and draw
     VisibleSet visReflected;
-    ViewFrustum range_frustum(&ds_viewproj);
-    D3DXVECTOR4 viewsphere(eyePos.x, eyePos.y, eyePos.z, zf);
+    ViewFrustum range_frustum(ds_viewproj);
+    vec4 viewsphere(eyePos.x, eyePos.y, eyePos.z, zf);
 
     currentWorldSpace->NearStatics->GetVisibleMeshes(range_frustum, viewsphere, visReflected);
     currentWorldSpace->FarStatics->GetVisibleMeshes(range_frustum, viewsphere, visReflected);
@@ -241,6 +242,7 @@ void DistantLand::clearReflection() {
 }
 
 void DistantLand::simulateDynamicWaves() {
+    Profiler::Scope profile(Profiler::ZoneDynamicWaves);
     auto mwBridge = MWBridge::get();
 
     static bool resetRippleSurface = true;
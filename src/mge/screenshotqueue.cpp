@@ -0,0 +1,378 @@
+
+#include "screenshotqueue.h"
+#include "support/capturequeue.h"
+#include "support/log.h"
+#include "support/pngsave.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+
+
+namespace ScreenshotQueue {
+    struct Slot {
+        IDirect3DSurface9* copy;        // Default pool copy of the back buffer
+        IDirect3DSurface9* readback;    // System memory surface, locked while a worker encodes it
+        IDirect3DQuery9* query;
+        UINT width, height;
+        std::string path;
+        D3DXIMAGE_FILEFORMAT format;
+        ImageFileFormat fileFormat;     // Format for workers, when the D3DX format has a portable encoder
+        RawSink sink;
+        D3DLOCKED_RECT locked;
+        bool isLocked;
+        bool encoded, success;          // Written by workers while holding queueLock
+    };
+
+    // CaptureBackend on D3D9 surfaces and event queries, with encoding on worker threads
+    class D3D9Captures : public CaptureBackend {
+    public:
+        IDirect3DSurface9* source = nullptr;     // Surface to copy at the next issue
+
+        bool copy(int slot) override;
+        QueryStatus poll(int slot) override;
+        void startEncode(int slot, const std::string& path) override;
+        bool encoded(int slot, bool wait) override;
+        bool finish(int slot) override;
+    };
+
+    Slot slots[CaptureQueue::maxDepth];
+    D3D9Captures captures;
+    CaptureQueue queue(&captures);
+
+    std::vector<HANDLE> workers;
+    std::vector<int> encodeQueue;
+    SRWLOCK queueLock = SRWLOCK_INIT;
+    CONDITION_VARIABLE workReady = CONDITION_VARIABLE_INIT, workDone = CONDITION_VARIABLE_INIT;
+    bool exiting;
+
+    CaptureOrdinals ordinals;
+    bool loggedRenderThreadEncode;
+}
+
+// portableFormat - Find a worker thread encoder for a D3DX file format. Only JPG has none, and stays with D3DX.
+static bool portableFormat(D3DXIMAGE_FILEFORMAT format, ImageFileFormat* out) {
+    switch (format) {
+    case D3DXIFF_PNG:
+        *out = ImageFileFormat::PNG;
+        return true;
+    case D3DXIFF_BMP:
+        *out = ImageFileFormat::BMP;
+        return true;
+    case D3DXIFF_TGA:
+        *out = ImageFileFormat::TGA;
+        return true;
+    case D3DXIFF_DDS:
+        *out = ImageFileFormat::DDS;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// encodeWorker - Worker thread, encodes locked readback surfaces to files or passes them to sinks
+static DWORD WINAPI encodeWorker(void*) {
+    using namespace ScreenshotQueue;
+
+    for (;;) {
+        AcquireSRWLockExclusive(&queueLock);
+        while (encodeQueue.empty() && !exiting) {
+            SleepConditionVariableSRW(&workReady, &queueLock, INFINITE, 0);
+        }
+        if (encodeQueue.empty()) {
+            ReleaseSRWLockExclusive(&queueLock);
+            return 0;
+        }
+        Slot& s = slots[encodeQueue.front()];
+        encodeQueue.erase(encodeQueue.begin());
+        ReleaseSRWLockExclusive(&queueLock);
+
+        bool success;
+        if (s.sink) {
+            success = s.sink(s.locked.pBits, s.width, s.height, s.locked.Pitch);
+        } else {
+            success = imageSaveBGRA(s.path.c_str(), s.fileFormat, s.locked.pBits, s.width, s.height, s.locked.Pitch);
+        }
+
+        AcquireSRWLockExclusive(&queueLock);
+        s.success = success;
+        s.encoded = true;
+        ReleaseSRWLockExclusive(&queueLock);
+        WakeAllConditionVariable(&workDone);
+    }
+}
+
+// startWorkers - Create the encoder threads on first use
+static void startWorkers() {
+    using namespace ScreenshotQueue;
+
+    if (!workers.empty()) {
+        return;
+    }
+
+    SYSTEM_INFO sysInfo;
+    GetSystemInfo(&sysInfo);
+    DWORD numWorkers = std::max(1ul, std::min(2ul, sysInfo.dwNumberOfProcessors - 1));
+
+    exiting = false;
+    for (DWORD i = 0; i != numWorkers; ++i) {
+        HANDLE h = CreateThread(0, 0, encodeWorker, 0, 0, 0);
+        if (h) {
+            workers.push_back(h);
+        }
+    }
+}
+
+// allocateSlot - Create or resize the surfaces of a free slot
+static bool allocateSlot(ScreenshotQueue::Slot& s, IDirect3DDevice9* device, UINT width, UINT height) {
+    if (s.copy && s.width == width && s.height == height) {
+        return true;
+    }
+
+    if (s.copy) {
+        s.copy->Release();
+        s.copy = nullptr;
+    }
+    if (s.readback) {
+        s.readback->Release();
+        s.readback = nullptr;
+    }
+
+    if (device->CreateRenderTarget(width, height, D3DFMT_A8R8G8B8, D3DMULTISAMPLE_NONE, 0, FALSE, &s.copy, NULL) != D3D_OK) {
+        s.copy = nullptr;
+        return false;
+    }
+    if (device->CreateOffscreenPlainSurface(width, height, D3DFMT_A8R8G8B8, D3DPOOL_SYSTEMMEM, &s.readback, NULL) != D3D_OK) {
+        s.copy->Release();
+        s.copy = nullptr;
+        s.readback = nullptr;
+        return false;
+    }
+
+    // Without event queries, copies are assumed complete after two frames
+    if (!s.query && device->CreateQuery(D3DQUERYTYPE_EVENT, &s.query) != D3D_OK) {
+        s.query = nullptr;
+    }
+
+    s.width = width;
+    s.height = height;
+    return true;
+}
+
+// copy - Copy the source into a slot on the GPU
+bool ScreenshotQueue::D3D9Captures::copy(int index) {
+    Slot& s = slots[index];
+    IDirect3DDevice9* device;
+    D3DSURFACE_DESC desc;
+
+    source->GetDesc(&desc);
+    source->GetDevice(&device);
+
+    HRESULT hr = D3DERR_INVALIDCALL;
+    if (allocateSlot(s, device, desc.Width, desc.Height)) {
+        hr = device->StretchRect(source, NULL, s.copy, NULL, D3DTEXF_NONE);
+    }
+    device->Release();
+
+    if (hr != D3D_OK) {
+        return false;
+    }
+    if (s.query) {
+        s.query->Issue(D3DISSUE_END);
+    }
+
+    s.isLocked = false;
+    s.encoded = false;
+    s.success = false;
+    return true;
+}
+
+// poll - Check if the GPU has finished the copy, without flushing
+CaptureBackend::QueryStatus ScreenshotQueue::D3D9Captures::poll(int index) {
+    const Slot& s = slots[index];
+    if (!s.query) {
+        return Unsupported;
+    }
+    return s.query->GetData(NULL, 0, 0) == S_OK ? Complete : Pending;
+}
+
+// startEncode - Read back a completed copy, then hand files and raw sinks to the workers
+// JPG has no portable encoder, so it is saved by D3DX here on the render thread, which costs a frame hitch.
+void ScreenshotQueue::D3D9Captures::startEncode(int index, const std::string& path) {
+    Slot& s = slots[index];
+    IDirect3DDevice9* device;
+
+    s.path = path;
+    s.copy->GetDevice(&device);
+    HRESULT hr = device->GetRenderTargetData(s.copy, s.readback);
+    device->Release();
+
+    if (hr != D3D_OK) {
+        s.encoded = true;
+        s.success = false;
+        return;
+    }
+
+    if (s.sink || portableFormat(s.format, &s.fileFormat)) {
+        if (s.readback->LockRect(&s.locked, NULL, D3DLOCK_READONLY) != D3D_OK) {
+            s.encoded = true;
+            s.success = false;
+            return;
+        }
+
+        s.isLocked = true;
+        if (!workers.empty()) {
+            AcquireSRWLockExclusive(&queueLock);
+            encodeQueue.push_back(index);
+            ReleaseSRWLockExclusive(&queueLock);
+            WakeConditionVariable(&workReady);
+        } else if (s.sink) {
+            s.success = s.sink(s.locked.pBits, s.width, s.height, s.locked.Pitch);
+            s.encoded = true;
+        } else {
+            s.success = imageSaveBGRA(s.path.c_str(), s.fileFormat, s.locked.pBits, s.width, s.height, s.locked.Pitch);
+            s.encoded = true;
+        }
+    } else {
+        if (!loggedRenderThreadEncode) {
+            LOG::logline("## Screenshots in this format are encoded on the render thread, use PNG, BMP, TGA or DDS to avoid stutter");
+            loggedRenderThreadEncode = true;
+        }
+        hr = D3DXSaveSurfaceToFile(s.path.c_str(), s.format, s.readback, NULL, NULL);
+        if (FAILED(hr)) {
+            LOG::logline("!! Screenshot %s failed - D3DX Error %lx", s.path.c_str(), hr);
+        }
+        s.success = SUCCEEDED(hr);
+        s.encoded = true;
+    }
+}
+
+// encoded - Check if a slot's file has been written, waiting for the workers if required
+bool ScreenshotQueue::D3D9Captures::encoded(int index, bool wait) {
+    const Slot& s = slots[index];
+
+    AcquireSRWLockExclusive(&queueLock);
+    while (wait && !s.encoded) {
+        SleepConditionVariableSRW(&workDone, &queueLock, INFINITE, 0);
+    }
+    bool encoded = s.encoded;
+    ReleaseSRWLockExclusive(&queueLock);
+    return encoded;
+}
+
+// finish - Unlock an encoded slot's readback surface
+bool ScreenshotQueue::D3D9Captures::finish(int index) {
+    Slot& s = slots[index];
+
+    if (s.isLocked) {
+        s.readback->UnlockRect();
+        s.isLocked = false;
+    }
+
+    s.sink = nullptr;
+    s.path.clear();
+    return s.success;
+}
+
+// submit - Queue a copy of a render target surface to be saved to a file
+// Only costs a GPU copy, unless all slots are busy, in which case the oldest capture is completed first
+bool ScreenshotQueue::submit(IDirect3DSurface9* source, const char* path, D3DXIMAGE_FILEFORMAT format, Completion onComplete) {
+    // Reject a path that is still being written
+    if (queue.pathPending(path)) {
+        return false;
+    }
+
+    startWorkers();
+    int index = queue.acquire();
+    captures.source = source;
+    if (!queue.issue(index, path, std::move(onComplete))) {
+        return false;
+    }
+
+    Slot& s = slots[index];
+    s.format = format;
+    s.sink = nullptr;
+    return true;
+}
+
+// submitRaw - Queue a copy of a render target surface, to be passed to a sink function on a worker thread
+bool ScreenshotQueue::submitRaw(IDirect3DSurface9* source, RawSink sink, Completion onComplete) {
+    startWorkers();
+    int index = queue.acquire();
+    captures.source = source;
+    if (!queue.issue(index, std::string(), std::move(onComplete))) {
+        return false;
+    }
+
+    Slot& s = slots[index];
+    s.format = D3DXIFF_PNG;
+    s.sink = std::move(sink);
+    return true;
+}
+
+// preallocate - Create surfaces for up to depth slots matching the source, so that continuous capture does not allocate
+// A depth of zero returns to the default, keeping only surfaces that are already allocated
+void ScreenshotQueue::preallocate(IDirect3DSurface9* source, int requestDepth) {
+    queue.setDepth(requestDepth);
+    if (requestDepth <= 0 || !source) {
+        return;
+    }
+
+    IDirect3DDevice9* device;
+    D3DSURFACE_DESC desc;
+    int depth = queue.usableDepth();
+    source->GetDesc(&desc);
+    source->GetDevice(&device);
+    for (int i = 0; i != depth; ++i) {
+        if (queue.slotFree(i) && !allocateSlot(slots[i], device, desc.Width, desc.Height)) {
+            LOG::logline("!! Screenshot queue could only allocate %d of %d slots", i, depth);
+            queue.setDepth(std::max(1, i));
+            break;
+        }
+    }
+    device->Release();
+}
+
+// update - Called once per frame. Starts readback of finished copies and reports finished files in order.
+void ScreenshotQueue::update() {
+    queue.update();
+}
+
+// release - Finish all pending captures, then free threads and surfaces
+void ScreenshotQueue::release() {
+    queue.flush();
+
+    if (!workers.empty()) {
+        AcquireSRWLockExclusive(&queueLock);
+        exiting = true;
+        ReleaseSRWLockExclusive(&queueLock);
+        WakeAllConditionVariable(&workReady);
+
+        WaitForMultipleObjects(DWORD(workers.size()), workers.data(), TRUE, INFINITE);
+        for (HANDLE h : workers) {
+            CloseHandle(h);
+        }
+        workers.clear();
+    }
+
+    for (auto& s : slots) {
+        if (s.copy) {
+            s.copy->Release();
+        }
+        if (s.readback) {
+            s.readback->Release();
+        }
+        if (s.query) {
+            s.query->Release();
+        }
+        s.copy = s.readback = nullptr;
+        s.query = nullptr;
+    }
+    queue.setDepth(0);
+}
+
+// nextOrdinal - Allocate the next screenshot number for a directory
+int ScreenshotQueue::nextOrdinal(const char* dir) {
+    return ordinals.next(dir);
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "proxydx/d3d9header.h"
+
+#include <functional>
+
+// Asynchronous screenshot saving
+// Captures are copied on the GPU, read back once the copy has completed, and encoded on worker threads.
+// JPG is the exception, as only D3DX can write it, and is saved on the render thread when read back.
+namespace ScreenshotQueue {
+    // Called on the render thread once the file is written, or has failed
+    typedef std::function<void(bool success)> Completion;
+    // Called on a worker thread with the read back BGRA pixels, instead of saving to a file
+    typedef std::function<bool(const void* pixels, UINT width, UINT height, UINT pitch)> RawSink;
+
+    bool submit(IDirect3DSurface9* source, const char* path, D3DXIMAGE_FILEFORMAT format, Completion onComplete);
+    bool submitRaw(IDirect3DSurface9* source, RawSink sink, Completion onComplete);
+    void preallocate(IDirect3DSurface9* source, int depth);
+    void update();
+    void release();
+    int nextOrdinal(const char* dir);
+};
@@ -0,0 +1,107 @@
+
+#include "statefilter.h"
+
+#include <cstring>
+
+
+
+void StateFilter::invalidate() {
+    std::memset(renderStateValid, 0, sizeof(renderStateValid));
+    std::memset(stageStateValid, 0, sizeof(stageStateValid));
+    std::memset(textureValid, 0, sizeof(textureValid));
+    std::memset(worldTransformValid, 0, sizeof(worldTransformValid));
+    std::memset(textureTransformValid, 0, sizeof(textureTransformValid));
+}
+
+void StateFilter::invalidateTextures() {
+    std::memset(textureValid, 0, sizeof(textureValid));
+}
+
+void StateFilter::invalidateWorldTransforms() {
+    std::memset(worldTransformValid, 0, sizeof(worldTransformValid));
+}
+
+void StateFilter::invalidateTextureTransforms() {
+    std::memset(textureTransformValid, 0, sizeof(textureTransformValid));
+}
+
+// filter* functions return true if the call is redundant and should be dropped
+bool StateFilter::filterRenderState(uint32_t a, uint32_t b) {
+    if (enabled && a < MaxRenderStates && renderStateValid[a] && renderState[a] == b) {
+        ++dropped;
+        return true;
+    }
+    return false;
+}
+
+void StateFilter::recordRenderState(uint32_t a, uint32_t b) {
+    if (a < MaxRenderStates) {
+        renderState[a] = b;
+        renderStateValid[a] = true;
+    }
+    ++forwarded;
+}
+
+bool StateFilter::filterStageState(uint32_t a, uint32_t b, uint32_t c) {
+    if (!enabled || a >= MaxStages || b >= MaxStageStates) {
+        ++forwarded;
+        return false;
+    }
+    if (stageStateValid[a][b] && stageState[a][b] == c) {
+        ++dropped;
+        return true;
+    }
+
+    stageState[a][b] = c;
+    stageStateValid[a][b] = true;
+    ++forwarded;
+    return false;
+}
+
+bool StateFilter::filterTexture(uint32_t a, const void* b) {
+    // Compare D3D9 textures, the device holds a reference to a bound texture so its address cannot be reused
+    if (!enabled || a >= MaxStages) {
+        ++forwarded;
+        return false;
+    }
+    if (textureValid[a] && texture[a] == b) {
+        ++dropped;
+        return true;
+    }
+
+    texture[a] = b;
+    textureValid[a] = true;
+    ++forwarded;
+    return false;
+}
+
+bool StateFilter::filterTransform(uint32_t a, const float* b) {
+    // View and projection are modified by MGE before forwarding and are not filtered
+    Matrix* cached;
+    bool* valid;
+
+    if (a >= TransformWorld0 && a < TransformWorld0 + MaxWorldTransforms) {
+        cached = &worldTransform[a - TransformWorld0];
+        valid = &worldTransformValid[a - TransformWorld0];
+    } else if (a >= TransformTexture0 && a < TransformTexture0 + MaxStages) {
+        cached = &textureTransform[a - TransformTexture0];
+        valid = &textureTransformValid[a - TransformTexture0];
+    } else {
+        ++forwarded;
+        return false;
+    }
+
+    if (!enabled) {
+        ++forwarded;
+        return false;
+    }
+    if (*valid && std::memcmp(cached->m, b, sizeof(cached->m)) == 0) {
+        ++dropped;
+        return true;
+    }
+
+    std::memcpy(cached->m, b, sizeof(cached->m));
+    *valid = true;
+    ++forwarded;
+    return false;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+
+// Redundant state filter
+// Morrowind re-sends a lot of unchanged state between draw calls. The last value forwarded to the
+// device is cached, so that no-op sets can be dropped before capture and forwarding.
+// The cache only tracks what passes through the proxy; it must be invalidated whenever MGE touches
+// device state directly, or on device recreation.
+// Uses plain D3D enum values rather than D3D types, so that offline replay can share it.
+struct StateFilter {
+    static constexpr uint32_t MaxRenderStates = 256;
+    static constexpr uint32_t MaxStages = 8;
+    static constexpr uint32_t MaxStageStates = 33;
+    static constexpr uint32_t MaxWorldTransforms = 4;
+    static constexpr uint32_t TransformTexture0 = 16;       // D3DTS_TEXTURE0
+    static constexpr uint32_t TransformWorld0 = 256;        // D3DTS_WORLDMATRIX(0)
+
+    struct Matrix {
+        float m[16];
+    };
+
+    uint32_t renderState[MaxRenderStates];
+    uint32_t stageState[MaxStages][MaxStageStates];
+    const void* texture[MaxStages];
+    Matrix worldTransform[MaxWorldTransforms];
+    Matrix textureTransform[MaxStages];
+
+    bool renderStateValid[MaxRenderStates];
+    bool stageStateValid[MaxStages][MaxStageStates];
+    bool textureValid[MaxStages];
+    bool worldTransformValid[MaxWorldTransforms];
+    bool textureTransformValid[MaxStages];
+
+    unsigned long long forwarded, dropped;
+    bool enabled = true;            // Off forwards every call, to compare against unfiltered replay
+
+    void invalidate();
+    void invalidateTextures();
+    void invalidateWorldTransforms();
+    void invalidateTextureTransforms();
+    bool filterRenderState(uint32_t a, uint32_t b);
+    bool filterStageState(uint32_t a, uint32_t b, uint32_t c);
+    bool filterTexture(uint32_t a, const void* b);
+    bool filterTransform(uint32_t a, const float* b);
+    void recordRenderState(uint32_t a, uint32_t b);
+};
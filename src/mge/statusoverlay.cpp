@@ -2,6 +2,7 @@
 #include "statusoverlay.h"
 #include "configuration.h"
 #include "mged3d8device.h"
+#include "profiler.h"
 #include "proxydx/d3d9header.h"
 
 #include <cstdio>
@@ -11,13 +12,15 @@
 namespace StatusOverlay {
     char statusText[512];
     char fpsText[16];
+    char profileText[2048];
+    DWORD profileRefresh;
     DWORD statusTimeout;
     int currentPriority;
     D3DCOLOR statusColour;
 
     ID3DXFont* font;
     ID3DXSprite* sprite;
-    RECT statusRect, shadowRect, fpsRect;
+    RECT statusRect, shadowRect, fpsRect, profileRect, profileShadowRect;
 }
 
 const D3DCOLOR colWhite = 0xffffffff, colRed = 0xffff2222, colShadow = 0xc0000000;
@@ -32,6 +35,8 @@ bool StatusOverlay::init(IDirect3DDevice9* device) {
     statusRect = {8, 10, 635, 25};
     shadowRect = {statusRect.left+1, statusRect.top+1, statusRect.right+1, statusRect.bottom+1};
     fpsRect = {8, 35, 160, 50};
+    profileRect = {8, 60, 635, 260};
+    profileShadowRect = {profileRect.left+1, profileRect.top+1, profileRect.right+1, profileRect.bottom+1};
     return true;
 }
 
@@ -45,12 +50,23 @@ void StatusOverlay::show(IDirect3DDevice9* device) {
         return;
     }
 
-    if ((Configuration.MGEFlags & FPS_COUNTER) || statusTimeout) {
+    if ((Configuration.MGEFlags & FPS_COUNTER) || statusTimeout || Configuration.ProfilerOverlay) {
         sprite->Begin(D3DXSPRITE_ALPHABLEND);
         if (Configuration.MGEFlags & FPS_COUNTER) {
             font->DrawTextA(sprite, fpsText, -1, &fpsRect, DT_NOCLIP, colWhite);
         }
 
+        // Profiler page, refreshed at the same rate as the FPS counter so that it is readable
+        if (Configuration.ProfilerOverlay) {
+            DWORD now = GetTickCount();
+            if (now - profileRefresh >= 500) {
+                Profiler::dump(profileText, sizeof(profileText));
+                profileRefresh = now;
+            }
+            font->DrawTextA(sprite, profileText, -1, &profileShadowRect, DT_NOCLIP, colShadow);
+            font->DrawTextA(sprite, profileText, -1, &profileRect, DT_NOCLIP, colWhite);
+        }
+
         if (statusText[0] != 0) {
             if (GetTickCount() < statusTimeout) {
                 font->DrawTextA(sprite, statusText, -1, &shadowRect, DT_NOCLIP, colShadow);
@@ -1,11 +1,12 @@
 
 #include "userhud.h"
 #include "morrowindbsa.h"
+#include "profiler.h"
 #include "proxydx/d3d8header.h"
 #include "support/log.h"
+#include "support/stringinterner.h"
 
 #include <cstdio>
-#include <unordered_map>
 #include <string>
 #include <vector>
 
@@ -14,14 +15,20 @@
 const DWORD fvfHUD = D3DFVF_XYZRHW | D3DFVF_TEX2;
 
 static IDirect3DVertexBuffer9* vbHUD;
+static IDirect3DStateBlock9* stateSaved;
 static ID3DXEffect* effectStandard;
+static D3DXHANDLE ehStandardTex;
 static D3DVIEWPORT9 vp;
+static bool drawListDirty, geometryDirty;
 
 IDirect3DDevice9* MGEhud::device = 0;
 MGEhud::Element MGEhud::elements[MGEhud::max_elements];
+HudBatch::Item MGEhud::drawList[MGEhud::max_elements];
+int MGEhud::drawCount = 0;
 
 static std::vector<MGEhud::hud_id> elements_free;
-static std::unordered_map<std::string, MGEhud::hud_id> element_names;
+static StringInterner element_names;
+static std::vector<MGEhud::hud_id> element_by_name;     // Element for each interned name ID
 
 
 
@@ -29,12 +36,21 @@ bool MGEhud::init(IDirect3DDevice9* d) {
     device = d;
     device->GetViewport(&vp);
 
-    HRESULT hr = device->CreateVertexBuffer(max_elements * 4 * 32, D3DUSAGE_DYNAMIC|D3DUSAGE_WRITEONLY, fvfHUD, D3DPOOL_DEFAULT, &vbHUD, 0);
+    HRESULT hr = device->CreateVertexBuffer(max_elements * 6 * 32, D3DUSAGE_DYNAMIC|D3DUSAGE_WRITEONLY, fvfHUD, D3DPOOL_DEFAULT, &vbHUD, 0);
     if (hr != D3D_OK) {
         LOG::logline("!! Failed to create HUD verts");
         return false;
     }
 
+    // Reused every frame with Capture/Apply
+    hr = device->CreateStateBlock(D3DSBT_ALL, &stateSaved);
+    if (hr != D3D_OK) {
+        LOG::logline("!! Failed to create HUD state block");
+        vbHUD->Release();
+        vbHUD = 0;
+        return false;
+    }
+
     ID3DXBuffer* errors = nullptr;
     hr = D3DXCreateEffectFromFile(device, "Data Files\\shaders\\core\\XE HUD.fx", 0, 0, D3DXFX_LARGEADDRESSAWARE, 0, &effectStandard, &errors);
     if (hr != D3D_OK) {
@@ -48,10 +64,17 @@ bool MGEhud::init(IDirect3DDevice9* d) {
             LOG::logline("!! Ensure that the file exists. Note: This file does not currently support Mod Organizer 2. Install it manually.");
         }
         LOG::flush();
+        stateSaved->Release();
+        vbHUD->Release();
+        stateSaved = 0;
+        vbHUD = 0;
+        effectStandard = 0;
         return false;
     }
+    ehStandardTex = effectStandard->GetParameterByName(0, "tex");
+    drawListDirty = geometryDirty = true;
 
-    if (element_names.empty()) {
+    if (element_by_name.empty()) {
         reset();
     } else {
         reload();
@@ -60,74 +83,103 @@ bool MGEhud::init(IDirect3DDevice9* d) {
     return true;
 }
 
+// buildDrawList - Collect enabled elements, grouped by effect and texture
+void MGEhud::buildDrawList() {
+    drawCount = 0;
+    for (hud_id hud : element_by_name) {
+        const Element& e = elements[hud];
+        if (e.enabled) {
+            drawList[drawCount++] = HudBatch::Item { hud, e.effect, e.texture };
+        }
+    }
+
+    HudBatch::sort(drawList, drawCount);
+    drawListDirty = false;
+    geometryDirty = true;
+}
+
+// HUDTarget - Runs HUD batches on the device, with the element's own effect or the standard effect
+class MGEhud::HUDTarget : public HudBatch::Target {
+    ID3DXEffect* effect;
+    D3DXHANDLE ehTex;
+
+public:
+    void beginEffect(const HudBatch::Item& first) {
+        Element* e = &elements[first.id];
+        UINT passes;
+
+        effect = e->effect ? e->effect : effectStandard;
+        ehTex = e->effect ? e->ehTex : ehStandardTex;
+
+        // Custom effects are never shared, so this is the only element using it
+        if (e->effect) {
+            e->vars.flush();
+        }
+
+        effect->Begin(&passes, D3DXFX_DONOTSAVESTATE);
+        effect->BeginPass(0);
+    }
+
+    void draw(const HudBatch::Item& first, int firstQuad, int quads) {
+        effect->SetTexture(ehTex, elements[first.id].texture);
+        effect->CommitChanges();
+        device->DrawPrimitive(D3DPT_TRIANGLELIST, 6 * firstQuad, 2 * quads);
+    }
+
+    void endEffect() {
+        effect->EndPass();
+        effect->End();
+    }
+};
+
 void MGEhud::draw() {
-    IDirect3DStateBlock9* stateSaved;
-    device->CreateStateBlock(D3DSBT_ALL, &stateSaved);
+    Profiler::Scope profile(Profiler::ZoneUserHUD);
 
-    D3DXVECTOR4* vbase;
-    HRESULT hr = vbHUD->Lock(0, 0, (void**)&vbase, D3DLOCK_DISCARD);
-    if (hr != D3D_OK || vbase == 0) {
+    if (!effectStandard) {
+        return;
+    }
+    if (drawListDirty) {
+        buildDrawList();
+    }
+    if (drawCount == 0) {
         return;
     }
 
-    for (const auto& i : element_names) {
-        const Element* e = &elements[i.second];
-
-        if (e->enabled) {
-            float x0 = e->x, x1 = e->x + e->xscale * e->w;
-            float y0 = e->y, y1 = e->y + e->yscale * e->h;
-
-            // Correct for D3D9 pixel offset
-            x0 -= 0.5;
-            y0 -= 0.5;
-            x1 -= 0.5;
-            y1 -= 0.5;
-
-            D3DXVECTOR4* v = vbase + 8 * i.second;
-            v[0] = D3DXVECTOR4(x0, y1, 0, 1);
-            v[1] = D3DXVECTOR4(0, 1, 0, 0);
-            v[2] = D3DXVECTOR4(x0, y0, 0, 1);
-            v[3] = D3DXVECTOR4(0, 0, 0, 0);
-            v[4] = D3DXVECTOR4(x1, y1, 0, 1);
-            v[5] = D3DXVECTOR4(1, 1, 0, 0);
-            v[6] = D3DXVECTOR4(x1, y0, 0, 1);
-            v[7] = D3DXVECTOR4(1, 0, 0, 0);
+    // Vertices stay valid in the dynamic buffer until an element moves or the draw list changes
+    if (geometryDirty) {
+        float* v;
+        HRESULT hr = vbHUD->Lock(0, 0, (void**)&v, D3DLOCK_DISCARD);
+        if (hr != D3D_OK || v == 0) {
+            return;
+        }
+
+        for (int i = 0; i != drawCount; ++i) {
+            const Element* e = &elements[drawList[i].id];
+            HudBatch::writeQuad(e->x, e->y, e->x + e->xscale * e->w, e->y + e->yscale * e->h, v + i * HudBatch::VertexFloats);
         }
+
+        vbHUD->Unlock();
+        geometryDirty = false;
     }
 
-    vbHUD->Unlock();
+    stateSaved->Capture();
 
     device->SetFVF(fvfHUD);
     device->SetStreamSource(0, vbHUD, 0, 32);
     device->SetRenderState(D3DRS_CULLMODE, D3DCULL_NONE);
     device->SetRenderState(D3DRS_ZWRITEENABLE, FALSE);
 
-    for (const auto& i : element_names) {
-        const Element* e = &elements[i.second];
-
-        if (e->enabled) {
-            ID3DXEffect* effect = e->effect ? e->effect : effectStandard;
-            D3DXHANDLE ehTex = effect->GetParameterByName(0, "tex");
-            UINT passes;
-
-            effect->SetTexture(ehTex, e->texture);
-            effect->Begin(&passes, D3DXFX_DONOTSAVESTATE);
-            effect->BeginPass(0);
-            device->DrawPrimitive(D3DPT_TRIANGLESTRIP, 4 * i.second, 2);
-            effect->EndPass();
-            effect->End();
-        }
-    }
+    HUDTarget target;
+    HudBatch::submit(drawList, drawCount, target);
 
     stateSaved->Apply();
-    stateSaved->Release();
 }
 
 void MGEhud::release() {
     // Only release D3D resources
     // HUD status must be remembered if the device restarts on alt-tab
-    for (const auto& i : element_names) {
-        Element* e = &elements[i.second];
+    for (hud_id hud : element_by_name) {
+        Element* e = &elements[hud];
 
         if (e->texture) {
             e->texture->Release();
@@ -139,10 +191,19 @@ void MGEhud::release() {
 
         e->texture = 0;
         e->effect = 0;
+        e->ehTex = 0;
+        e->vars.reset(nullptr);
     }
 
-    effectStandard->Release();
-    vbHUD->Release();
+    if (effectStandard) {
+        effectStandard->Release();
+        stateSaved->Release();
+        vbHUD->Release();
+    }
+    effectStandard = 0;
+    stateSaved = 0;
+    vbHUD = 0;
+    drawListDirty = true;
 }
 
 int MGEhud::getScreenWidth() {
@@ -154,12 +215,14 @@ int MGEhud::getScreenHeight() {
 }
 
 void MGEhud::reset() {
-    for (auto& i : element_names) {
-        MGEhud::free(i.second);
+    for (hud_id hud : element_by_name) {
+        MGEhud::free(hud);
     }
 
     element_names.clear();
+    element_by_name.clear();
     elements_free.clear();
+    drawListDirty = true;
 
     for (int i = max_elements; i-- > 0; ) {
         elements_free.push_back(i);
@@ -169,8 +232,7 @@ void MGEhud::reset() {
 void MGEhud::reload() {
     LOG::logline("-- HUD reloading assets");
 
-    for (auto& i : element_names) {
-        hud_id hud = i.second;
+    for (hud_id hud : element_by_name) {
         Element* e = &elements[hud];
 
         // Reload assets from source files
@@ -189,7 +251,8 @@ MGEhud::hud_id MGEhud::load(const char* name, const char* texture) {
     if (hud == MGEhud::invalid_hud_id) {
         hud = elements_free.back();
         elements_free.pop_back();
-        element_names[name] = hud;
+        element_names.intern(name);
+        element_by_name.push_back(hud);
     }
 
     Element* e = &elements[hud];
@@ -198,16 +261,20 @@ MGEhud::hud_id MGEhud::load(const char* name, const char* texture) {
     e->xscale = e->yscale = 1.0;
     e->texture = 0;
     e->effect = 0;
+    e->ehTex = 0;
+    e->vars.reset(nullptr);
     e->effectFilename.clear();
 
     setTexture(hud, texture);
+    drawListDirty = true;
     return hud;
 }
 
+// resolveName - Element by name, through the interned name ID
 MGEhud::hud_id MGEhud::resolveName(const char* name) {
-    auto i = element_names.find(name);
-    if (i != element_names.end()) {
-        return i->second;
+    int id = element_names.find(name);
+    if (id != StringInterner::invalid_id) {
+        return element_by_name[id];
     }
 
     return MGEhud::invalid_hud_id;
@@ -228,7 +295,10 @@ void MGEhud::free(hud_id hud) {
     e->texture = 0;
     e->textureFilename.clear();
     e->effect = 0;
+    e->ehTex = 0;
+    e->vars.reset(nullptr);
     e->effectFilename.clear();
+    drawListDirty = true;
 }
 
 bool MGEhud::getEnabled(hud_id hud) {
@@ -238,19 +308,24 @@ bool MGEhud::getEnabled(hud_id hud) {
 
 void MGEhud::setEnabled(hud_id hud, bool enable) {
     Element* e = &elements[hud];
-    e->enabled = enable;
+    if (e->enabled != enable) {
+        e->enabled = enable;
+        drawListDirty = true;
+    }
 }
 
 void MGEhud::setPosition(hud_id hud, float x, float y) {
     Element* e = &elements[hud];
     e->x = x;
     e->y = y;
+    geometryDirty = true;
 }
 
 void MGEhud::setScale(hud_id hud, float xscale, float yscale) {
     Element* e = &elements[hud];
     e->xscale = xscale;
     e->yscale = yscale;
+    geometryDirty = true;
 }
 
 void MGEhud::setFullscreen(hud_id hud) {
@@ -259,6 +334,7 @@ void MGEhud::setFullscreen(hud_id hud) {
     e->x = e->y = 0;
     e->xscale = vp.Width / e->w;
     e->yscale = vp.Height / e->h;
+    geometryDirty = true;
 }
 
 void MGEhud::setTexture(hud_id hud, const char* texturePath) {
@@ -277,16 +353,13 @@ void MGEhud::setTexture(hud_id hud, const char* texturePath) {
         e->w = float(desc.Width);
         e->h = float(desc.Height);
         e->texture = tex;
-
-        // As the BSA cache cannot reload a texture after it is released, (it returns a pointer to the released texture)
-        // we have to add a loose reference to keep the texture in memory and avoid a crash
-        tex->AddRef();
         e->textureFilename = texturePath;
     } else {
         LOG::logline("LoadHUDTexture : Cannot load texture %s", texturePath);
         e->texture = 0;
         e->textureFilename.clear();
     }
+    drawListDirty = true;
 }
 
 void MGEhud::setEffect(hud_id hud, const char* effectPath) {
@@ -300,7 +373,10 @@ void MGEhud::setEffect(hud_id hud, const char* effectPath) {
     }
 
     e->effect = 0;
+    e->ehTex = 0;
+    e->vars.reset(nullptr);
     e->effectFilename.clear();
+    drawListDirty = true;
 
     // Load new effect if string is not empty
     if (*effectPath) {
@@ -310,6 +386,8 @@ void MGEhud::setEffect(hud_id hud, const char* effectPath) {
         if (hr == D3D_OK) {
             LOG::logline("-- HUD shader %s loaded", path);
             e->effectFilename = effectPath;
+            e->ehTex = e->effect->GetParameterByName(0, "tex");
+            e->vars.reset(e->effect);
         } else {
             e->effect = 0;
 
@@ -326,34 +404,13 @@ void MGEhud::setEffect(hud_id hud, const char* effectPath) {
 }
 
 void MGEhud::setEffectInt(hud_id hud, const char* varName, int x) {
-    ID3DXEffect* effect = elements[hud].effect;
-
-    if (effect) {
-        D3DXHANDLE ehVar = effect->GetParameterByName(0, varName);
-        if (ehVar) {
-            effect->SetInt(ehVar, x);
-        }
-    }
+    elements[hud].vars.setInt(varName, x);
 }
 
 void MGEhud::setEffectFloat(hud_id hud, const char* varName, float x) {
-    ID3DXEffect* effect = elements[hud].effect;
-
-    if (effect) {
-        D3DXHANDLE ehVar = effect->GetParameterByName(0, varName);
-        if (ehVar) {
-            effect->SetFloat(ehVar, x);
-        }
-    }
+    elements[hud].vars.setFloat(varName, x);
 }
 
 void MGEhud::setEffectVec4(hud_id hud, const char* varName, const float* v) {
-    ID3DXEffect* effect = elements[hud].effect;
-
-    if (effect) {
-        D3DXHANDLE ehVar = effect->GetParameterByName(0, varName);
-        if (ehVar) {
-            effect->SetFloatArray(ehVar, v, 4);
-        }
-    }
+    elements[hud].vars.setFloatArray(varName, v, 4);
 }
@@ -1,5 +1,8 @@
 #pragma once
 
+#include "effectvariables.h"
+#include "hudbatch.h"
+
 #include <string>
 
 
@@ -16,12 +19,19 @@ private:
         float xscale, yscale;
         IDirect3DTexture9* texture;
         ID3DXEffect* effect;
+        D3DXHANDLE ehTex;           // Cached on effect load
+        EffectVariables vars;       // Script-set effect variables
         std::string textureFilename, effectFilename;
     };
 
     static IDirect3DDevice9* device;
     static const int max_elements = 256;
     static Element elements[max_elements];
+    static HudBatch::Item drawList[max_elements];   // Enabled elements, sorted by effect then texture
+    static int drawCount;
+
+    class HUDTarget;
+    static void buildDrawList();
 
 public:
     typedef int hud_id;
@@ -0,0 +1,210 @@
+
+#include "bsaindex.h"
+#include "filemapping.h"
+
+#include <cctype>
+#include <cstring>
+
+
+
+namespace BSAIndex {
+
+static const uint32_t cacheMagic = 0x43494253;  // 'BSIC'
+static const uint32_t cacheVersion = 1;
+
+#pragma pack(push, 4)
+struct CacheHeader {
+    uint32_t magic, version;
+    uint32_t archiveCount, entryCount, namesSize;
+    uint32_t checksum;
+};
+
+struct CacheArchiveRecord {
+    uint64_t size;
+    uint64_t modified;
+    uint32_t nameOffset;
+};
+
+struct CacheEntry {
+    int64_t hash;
+    Entry entry;
+};
+#pragma pack(pop)
+
+// hashString - TES3 BSA Hash function
+Hash hashString(const char* str) {
+    Hash result;
+
+    unsigned int len = (unsigned int)std::strlen(str);
+
+    // Use GhostWheel's code to hash the string
+    unsigned int l = len >> 1;
+    unsigned int sum, off, temp, i, n;
+
+    for (sum = off = i = 0; i < l; i++) {
+        sum ^= ((unsigned int)(str[i])) << (off & 0x1F);
+        off += 8;
+    }
+    result.value1 = sum;
+
+    for (sum = off = 0; i < len; i++) {
+        temp = ((unsigned int)(str[i])) << (off & 0x1F);
+        sum ^= temp;
+        n = temp & 0x1F;
+        if (n) {
+            sum = (sum << (32-n)) | (sum >> n);  // binary rotate right
+        }
+        off += 8;
+    }
+    result.value2 = sum;
+    return result;
+}
+
+// parseArchive - Read and store a BSA's index
+// Only the index is viewed, in a single linear pass
+bool parseArchive(const FileMapping& archive, uint32_t archiveIndex, Index& index) {
+    uint64_t fileSize = archive.size();
+
+    // Header: version, hash table offset (relative to end of header), file count
+    uint32_t header[3];
+    FileView view = archive.view(0, sizeof(header));
+    if (!view.valid()) {
+        return false;
+    }
+    std::memcpy(header, view.data(), sizeof(header));
+
+    uint32_t hashOffset = header[1], numFiles = header[2];
+    uint64_t dataStart = 12ull + hashOffset + numFiles * 8ull;
+    if (header[0] != 0x100 || dataStart > fileSize || hashOffset < numFiles * 8ull) {
+        return false;
+    }
+
+    view = archive.view(0, size_t(dataStart));
+    if (!view.valid()) {
+        return false;
+    }
+
+    // File records (size, offset) and hashes are parallel arrays, walked together
+    const char* records = view.data() + 12;
+    const char* hashes = view.data() + 12 + hashOffset;
+    index.reserve(index.size() + numFiles);
+
+    for (uint32_t i = 0; i < numFiles; i++) {
+        uint32_t record[2];
+        int64_t hash;
+        std::memcpy(record, records + i*8, 8);
+        std::memcpy(&hash, hashes + i*8, 8);
+
+        uint64_t position = dataStart + record[1];
+        if (position + record[0] > fileSize || position > UINT32_MAX) {
+            continue;
+        }
+
+        // Later archives override earlier ones
+        index[hash] = Entry { archiveIndex, uint32_t(position), record[0] };
+    }
+
+    return true;
+}
+
+// cacheChecksum - FNV-1a over the cache body
+uint32_t cacheChecksum(const char* p, size_t n) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i != n; ++i) {
+        h = (h ^ (unsigned char)p[i]) * 16777619u;
+    }
+    return h;
+}
+
+// append - Add a plain record to a byte buffer
+template<typename T>
+static void append(std::vector<char>& buf, const T& x) {
+    size_t at = buf.size();
+    buf.resize(at + sizeof(x));
+    std::memcpy(&buf[at], &x, sizeof(x));
+}
+
+// sameName - Archive names compare case insensitively, as on Windows
+static bool sameName(const char* a, const char* b) {
+    for (; *a && *b; ++a, ++b) {
+        if (std::tolower((unsigned char)*a) != std::tolower((unsigned char)*b)) {
+            return false;
+        }
+    }
+    return *a == *b;
+}
+
+// encodeCache - Header, archive records, archive names, then index entries
+void encodeCache(const std::vector<CacheArchive>& archives, const Index& index, std::vector<char>& out) {
+    std::string names;
+    CacheHeader header = { cacheMagic, cacheVersion, uint32_t(archives.size()), uint32_t(index.size()), 0, 0 };
+
+    out.assign(sizeof(header), 0);
+    for (const auto& archive : archives) {
+        CacheArchiveRecord a = { archive.size, archive.modified, uint32_t(names.size()) };
+        names.append(archive.name.c_str(), archive.name.size() + 1);
+        append(out, a);
+    }
+    out.insert(out.end(), names.begin(), names.end());
+    header.namesSize = uint32_t(names.size());
+
+    out.reserve(out.size() + index.size() * sizeof(CacheEntry));
+    for (const auto& i : index) {
+        CacheEntry e = { i.first, i.second };
+        append(out, e);
+    }
+
+    header.checksum = cacheChecksum(out.data() + sizeof(header), out.size() - sizeof(header));
+    std::memcpy(out.data(), &header, sizeof(header));
+}
+
+// decodeCache - Validate everything before adding any entries to the index
+bool decodeCache(const char* data, size_t size, const std::vector<CacheArchive>& archives, Index& index) {
+    CacheHeader header;
+    if (size < sizeof(header)) {
+        return false;
+    }
+    std::memcpy(&header, data, sizeof(header));
+
+    uint64_t archivesSize = uint64_t(header.archiveCount) * sizeof(CacheArchiveRecord);
+    uint64_t entriesSize = uint64_t(header.entryCount) * sizeof(CacheEntry);
+    if (header.magic != cacheMagic || header.version != cacheVersion || header.archiveCount != archives.size()
+        || sizeof(header) + archivesSize + header.namesSize + entriesSize != size
+        || header.checksum != cacheChecksum(data + sizeof(header), size - sizeof(header))) {
+        return false;
+    }
+
+    // Archive list must match exactly, including order, as it determines override order
+    const char* records = data + sizeof(header);
+    const char* names = records + archivesSize;
+    for (uint32_t i = 0; i != header.archiveCount; ++i) {
+        CacheArchiveRecord a;
+        std::memcpy(&a, records + i * sizeof(a), sizeof(a));
+
+        if (a.nameOffset >= header.namesSize || !std::memchr(names + a.nameOffset, 0, header.namesSize - a.nameOffset)) {
+            return false;
+        }
+        if (a.size != archives[i].size || a.modified != archives[i].modified || !sameName(names + a.nameOffset, archives[i].name.c_str())) {
+            return false;
+        }
+    }
+
+    const char* entries = names + header.namesSize;
+    for (uint32_t i = 0; i != header.entryCount; ++i) {
+        CacheEntry e;
+        std::memcpy(&e, entries + i * sizeof(e), sizeof(e));
+        if (e.entry.archive >= archives.size() || e.entry.position + uint64_t(e.entry.size) > archives[e.entry.archive].size) {
+            return false;
+        }
+    }
+
+    index.reserve(index.size() + header.entryCount);
+    for (uint32_t i = 0; i != header.entryCount; ++i) {
+        CacheEntry e;
+        std::memcpy(&e, entries + i * sizeof(e), sizeof(e));
+        index.emplace(e.hash, e.entry);
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class FileMapping;
+
+// TES3 BSA archive index parsing
+// Files are identified by the hash of their lower case, backslash separated path only.
+namespace BSAIndex {
+    struct Hash {
+        uint32_t value1, value2;
+
+        int64_t value() const { return int64_t((uint64_t(value2) << 32) | value1); }
+    };
+
+    // Location of a file in one of a list of archives
+    struct Entry {
+        uint32_t archive;
+        uint32_t position;
+        uint32_t size;
+    };
+
+    typedef std::unordered_map<int64_t, Entry> Index;
+
+    Hash hashString(const char* str);
+
+    // parseArchive - Add all files in an archive to an index, overriding entries from earlier archives
+    // Returns false if the archive header is invalid. Records which point outside the archive are skipped.
+    bool parseArchive(const FileMapping& archive, uint32_t archiveIndex, Index& index);
+
+    // Archive identity recorded in the merged index cache
+    struct CacheArchive {
+        std::string name;
+        uint64_t size;
+        uint64_t modified;      // Modification time, FILETIME on Windows
+    };
+
+    // encodeCache - Serialize a merged index, with the archive list it was built from
+    void encodeCache(const std::vector<CacheArchive>& archives, const Index& index, std::vector<char>& out);
+    // decodeCache - Load a merged index, only if the cache is intact and was built from exactly the same archives
+    bool decodeCache(const char* data, size_t size, const std::vector<CacheArchive>& archives, Index& index);
+    // cacheChecksum - FNV-1a over the cache body, to reject truncated or corrupted caches
+    uint32_t cacheChecksum(const char* p, size_t n);
+}
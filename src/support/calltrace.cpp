@@ -0,0 +1,171 @@
+
+#include "calltrace.h"
+
+#include <cstring>
+
+
+
+static const std::size_t flushThreshold = 1 << 20;
+
+static std::size_t padded(uint32_t n) {
+    return (std::size_t(n) + 3) & ~std::size_t(3);
+}
+
+float CallRecord::argFloat(int i) const {
+    uint32_t x = arg(i);
+    float f;
+    std::memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+// open - Create a trace file; the header is rewritten with final counts on close
+bool CallTraceWriter::open(const char* path) {
+    close();
+
+    file = std::fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+
+    CallTraceHeader header = { callTraceMagic, callTraceVersion, 0, 0, 0, 0 };
+    buffer.clear();
+    buffer.reserve(flushThreshold + 65536);
+    buffer.resize(sizeof(header));
+    std::memcpy(buffer.data(), &header, sizeof(header));
+    ids.clear();
+    nextId = 1;
+    frames = calls = 0;
+    writeFailed = false;
+    return true;
+}
+
+// close - Write out buffered records and the final header. Returns false if any write failed.
+bool CallTraceWriter::close() {
+    if (!file) {
+        return !writeFailed;
+    }
+
+    flush();
+
+    CallTraceHeader header = { callTraceMagic, callTraceVersion, frames, calls, nextId - 1, 0 };
+    if (std::fseek(file, 0, SEEK_SET) != 0 || std::fwrite(&header, sizeof(header), 1, file) != 1) {
+        writeFailed = true;
+    }
+    if (std::fclose(file) != 0) {
+        writeFailed = true;
+    }
+    file = nullptr;
+    ids.clear();
+    return !writeFailed;
+}
+
+void CallTraceWriter::flush() {
+    if (file && !buffer.empty()) {
+        if (std::fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size()) {
+            writeFailed = true;
+        }
+    }
+    buffer.clear();
+}
+
+void CallTraceWriter::write(CallOp op, std::initializer_list<uint32_t> args, const void* data, uint32_t dataSize) {
+    if (!file) {
+        return;
+    }
+
+    CallRecordHeader rec = { uint8_t(op), uint8_t(args.size()), 0, data ? dataSize : 0 };
+    std::size_t start = buffer.size();
+    std::size_t argBytes = args.size() * sizeof(uint32_t);
+
+    buffer.resize(start + sizeof(rec) + argBytes + padded(rec.dataSize));
+    uint8_t* p = buffer.data() + start;
+    std::memcpy(p, &rec, sizeof(rec));
+    p += sizeof(rec);
+    if (argBytes) {
+        std::memcpy(p, args.begin(), argBytes);
+        p += argBytes;
+    }
+    if (rec.dataSize) {
+        std::memcpy(p, data, rec.dataSize);
+        std::memset(p + rec.dataSize, 0, padded(rec.dataSize) - rec.dataSize);
+    }
+
+    if (op < CallOp::DefineVertexBuffer) {
+        ++calls;
+    }
+    if (buffer.size() >= flushThreshold) {
+        flush();
+    }
+}
+
+uint32_t CallTraceWriter::resourceId(const void* p, bool& isNew) {
+    if (!p) {
+        isNew = false;
+        return 0;
+    }
+
+    auto r = ids.emplace(p, nextId);
+    isNew = r.second;
+    if (isNew) {
+        ++nextId;
+    }
+    return r.first->second;
+}
+
+// open - Load and validate a trace file
+bool CallTraceReader::open(const char* path) {
+    std::FILE* f = std::fopen(path, "rb");
+    data.clear();
+    pos = 0;
+    isTruncated = false;
+
+    if (!f) {
+        return false;
+    }
+
+    uint8_t chunk[65536];
+    std::size_t n;
+    while ((n = std::fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        data.insert(data.end(), chunk, chunk + n);
+    }
+    std::fclose(f);
+
+    if (data.size() < sizeof(CallTraceHeader)) {
+        return false;
+    }
+    std::memcpy(&head, data.data(), sizeof(head));
+    if (head.magic != callTraceMagic || head.version != callTraceVersion) {
+        return false;
+    }
+
+    pos = sizeof(CallTraceHeader);
+    return true;
+}
+
+// next - Decode the next record. Returns false at the end of the trace, or on a truncated or corrupt record.
+bool CallTraceReader::next(CallRecord& r) {
+    CallRecordHeader rec;
+
+    if (pos + sizeof(rec) > data.size()) {
+        isTruncated = pos != data.size();
+        return false;
+    }
+    std::memcpy(&rec, data.data() + pos, sizeof(rec));
+
+    std::size_t argBytes = std::size_t(rec.argCount) * sizeof(uint32_t);
+    std::size_t size = sizeof(rec) + argBytes + padded(rec.dataSize);
+    if (rec.op == 0 || rec.op >= uint8_t(CallOp::Count) || rec.argCount > CallRecord::maxArgs || size > data.size() - pos) {
+        isTruncated = true;
+        return false;
+    }
+
+    const uint8_t* p = data.data() + pos + sizeof(rec);
+    r.op = CallOp(rec.op);
+    r.argCount = rec.argCount;
+    std::memcpy(r.args, p, argBytes);
+    r.data = rec.dataSize ? p + argBytes : nullptr;
+    r.dataSize = rec.dataSize;
+
+    pos += size;
+    return true;
+}
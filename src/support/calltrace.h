@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <initializer_list>
+#include <unordered_map>
+#include <vector>
+
+// D3D8 call trace, recorded from the calls Morrowind makes through the proxy device and replayed offline
+// Layout: CallTraceHeader, then records in call order. Each record is a CallRecordHeader followed by
+// argCount uint32 arguments, then dataSize bytes of data padded to a multiple of 4 bytes.
+// Resources are referenced by ID, 0 being null. A Define record holding the resource description and
+// contents precedes the first use of each ID; contents are captured once. All fields are little endian.
+const uint32_t callTraceMagic = 0x5443474D;     // 'MGCT'
+const uint32_t callTraceVersion = 1;
+
+enum class CallOp : uint8_t {
+    Present = 1,            // -
+    BeginScene,             // -
+    EndScene,               // -
+    Clear,                  // flags, colour, z (float), stencil; data: D3DRECT array
+    SetRenderTarget,        // colour surface ID, depth surface ID, is back buffer
+    SetTransform,           // state; data: matrix
+    MultiplyTransform,      // state; data: matrix
+    SetMaterial,            // data: D3DMATERIAL8
+    SetLight,               // index; data: D3DLIGHT8
+    LightEnable,            // index, enable
+    SetRenderState,         // state, value
+    SetTextureStageState,   // stage, state, value
+    SetTexture,             // stage, texture ID
+    SetVertexShader,        // FVF
+    SetStreamSource,        // stream, vertex buffer ID, stride
+    SetIndices,             // index buffer ID, base vertex index
+    DrawIndexedPrimitive,   // primitive type, min index, vertex count, start index, primitive count
+    ApplyStateBlock,        // token
+    DefineVertexBuffer,     // ID, length, usage, FVF, pool; data: contents, empty if not readable
+    DefineIndexBuffer,      // ID, length, usage, format, pool; data: contents, empty if not readable
+    DefineTexture,          // ID, width, height, levels, usage, format, pool
+    Count
+};
+
+#pragma pack(push, 4)
+struct CallTraceHeader {
+    uint32_t magic, version;
+    uint32_t frameCount;        // Written when the trace is closed, zero if recording did not finish cleanly
+    uint32_t callCount;         // Records, excluding Define records
+    uint32_t resourceCount;
+    uint32_t reserved;
+};
+
+struct CallRecordHeader {
+    uint8_t op;
+    uint8_t argCount;
+    uint16_t reserved;
+    uint32_t dataSize;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(CallTraceHeader) == 24, "Call trace header layout");
+static_assert(sizeof(CallRecordHeader) == 8, "Call record header layout");
+
+// One decoded record; data points into the reader's buffer and is valid until the reader is reopened
+struct CallRecord {
+    static const int maxArgs = 8;
+
+    CallOp op;
+    int argCount;
+    uint32_t args[maxArgs];
+    const uint8_t* data;
+    uint32_t dataSize;
+
+    uint32_t arg(int i) const { return i < argCount ? args[i] : 0; }
+    float argFloat(int i) const;
+};
+
+// Buffered trace writer. Not thread safe, calls are recorded on the render thread.
+class CallTraceWriter {
+public:
+    ~CallTraceWriter() { close(); }
+
+    bool open(const char* path);
+    bool close();
+    bool isOpen() const { return file != nullptr; }
+    bool failed() const { return writeFailed; }
+
+    void write(CallOp op, std::initializer_list<uint32_t> args, const void* data = nullptr, uint32_t dataSize = 0);
+    void endFrame() { ++frames; }
+    uint32_t frameCount() const { return frames; }
+
+    // resourceId - ID for a resource pointer, assigning a new one if the pointer has not been seen
+    uint32_t resourceId(const void* p, bool& isNew);
+    // forget - Drop a pointer whose address may be reused by a new resource
+    void forget(const void* p) { ids.erase(p); }
+
+private:
+    std::FILE* file = nullptr;
+    std::vector<uint8_t> buffer;
+    std::unordered_map<const void*, uint32_t> ids;
+    uint32_t nextId = 1, frames = 0, calls = 0;
+    bool writeFailed = false;
+
+    void flush();
+};
+
+// Trace reader, loads the whole trace so that replay timing does not include file access
+class CallTraceReader {
+public:
+    bool open(const char* path);
+    const CallTraceHeader& header() const { return head; }
+    bool next(CallRecord& r);
+    void rewind() { pos = sizeof(CallTraceHeader); }
+    bool truncated() const { return isTruncated; }
+
+private:
+    std::vector<uint8_t> data;
+    CallTraceHeader head = {};
+    std::size_t pos = 0;
+    bool isTruncated = false;
+};
@@ -0,0 +1,212 @@
+
+#include "capturequeue.h"
+
+#ifdef _WIN32
+#include "winheader.h"
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+
+
+CaptureQueue::CaptureQueue(CaptureBackend* b)
+    : backend(b), depth(defaultDepth), frameCount(0) {
+    for (Slot& s : slots) {
+        s.state = SlotFree;
+        s.frameIssued = 0;
+    }
+}
+
+// acquire - Find a free slot for a new capture, completing the oldest capture if none are free
+int CaptureQueue::acquire() {
+    for (;;) {
+        for (int i = 0; i != depth; ++i) {
+            if (slots[i].state == SlotFree) {
+                return i;
+            }
+        }
+        completeOldest(true);
+    }
+}
+
+// issue - Copy the source into an acquired slot on the GPU, and add it to the pending list
+// A failed copy leaves the slot free, and onComplete is not called
+bool CaptureQueue::issue(int slot, const std::string& path, Completion onComplete) {
+    Slot& s = slots[slot];
+
+    if (!backend->copy(slot)) {
+        return false;
+    }
+
+    s.frameIssued = frameCount;
+    s.state = SlotCopying;
+    s.path = path;
+    s.onComplete = std::move(onComplete);
+    pending.push_back(slot);
+    return true;
+}
+
+// pathPending - Check if a path is still being written, ignoring case as Windows paths do
+bool CaptureQueue::pathPending(const char* path) const {
+    auto sameChar = [](char a, char b) {
+        return std::tolower((unsigned char)a) == std::tolower((unsigned char)b);
+    };
+    size_t n = std::strlen(path);
+
+    for (int i : pending) {
+        const std::string& p = slots[i].path;
+        if (p.size() == n && std::equal(p.begin(), p.end(), path, sameChar)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// update - Called once per frame. Starts readback of finished copies and reports finished captures in order.
+void CaptureQueue::update() {
+    ++frameCount;
+
+    for (int i : pending) {
+        if (slots[i].state == SlotCopying && copyReady(i)) {
+            startEncode(i);
+        }
+    }
+
+    while (!pending.empty() && slots[pending.front()].state == SlotEncoding && backend->encoded(pending.front(), false)) {
+        completeOldest(false);
+    }
+}
+
+// flush - Finish all pending captures, waiting for each
+void CaptureQueue::flush() {
+    while (!pending.empty()) {
+        completeOldest(true);
+    }
+}
+
+// setDepth - Number of slots that may be in use; zero or less returns to the default
+void CaptureQueue::setDepth(int requestDepth) {
+    depth = requestDepth > 0 ? std::min(requestDepth, int(maxDepth)) : int(defaultDepth);
+}
+
+// copyReady - Check if the GPU has finished the copy, without flushing
+// Without completion queries, copies are assumed complete after two frames
+bool CaptureQueue::copyReady(int slot) {
+    switch (backend->poll(slot)) {
+    case CaptureBackend::Complete:
+        return true;
+    case CaptureBackend::Pending:
+        return false;
+    default:
+        return frameCount - slots[slot].frameIssued >= 2;
+    }
+}
+
+void CaptureQueue::startEncode(int slot) {
+    slots[slot].state = SlotEncoding;
+    backend->startEncode(slot, slots[slot].path);
+}
+
+// completeOldest - Finish the oldest capture, waiting for it if required, and report its result
+void CaptureQueue::completeOldest(bool wait) {
+    int index = pending.front();
+    Slot& s = slots[index];
+
+    if (s.state == SlotCopying) {
+        startEncode(index);
+    }
+    if (wait) {
+        backend->encoded(index, true);
+    }
+
+    bool success = backend->finish(index);
+    Completion onComplete = std::move(s.onComplete);
+    s.onComplete = nullptr;
+    s.path.clear();
+    s.state = SlotFree;
+    pending.pop_front();
+
+    if (onComplete) {
+        onComplete(success);
+    }
+}
+
+
+
+// next - Allocate the next screenshot number for a directory
+int CaptureOrdinals::next(const char* dir) {
+    auto it = ordinals.find(dir);
+
+    if (it == ordinals.end()) {
+        it = ordinals.emplace(dir, highestInFolder(dir)).first;
+    }
+    return ++it->second;
+}
+
+// ordinalOf - Number following the last space in a file name, or 0 if there is none
+int CaptureOrdinals::ordinalOf(const char* filename) {
+    const char* lastSpace = std::strrchr(filename, ' ');
+    if (lastSpace && std::isdigit((unsigned char)lastSpace[1])) {
+        return std::atoi(lastSpace + 1);
+    }
+    return 0;
+}
+
+#ifdef _WIN32
+
+// highestInFolder - Windows backend, highest ordinal of the files directly in a directory
+int CaptureOrdinals::highestInFolder(const char* dir) {
+    WIN32_FIND_DATA findData;
+    std::string pattern = std::string(dir) + "\\*";
+    int highest = 0;
+
+    HANDLE h = FindFirstFile(pattern.c_str(), &findData);
+    if (h == INVALID_HANDLE_VALUE) {
+        return 0;
+    }
+
+    do {
+        if (!(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+            highest = std::max(highest, ordinalOf(findData.cFileName));
+        }
+    } while (FindNextFile(h, &findData));
+
+    FindClose(h);
+    return highest;
+}
+
+#else
+
+// highestInFolder - POSIX backend, with backslash separators translated
+int CaptureOrdinals::highestInFolder(const char* dir) {
+    std::string path = dir;
+    int highest = 0;
+
+    std::replace(path.begin(), path.end(), '\\', '/');
+    DIR* d = opendir(path.c_str());
+    if (!d) {
+        return 0;
+    }
+
+    while (dirent* e = readdir(d)) {
+        bool isDir = e->d_type == DT_DIR;
+        if (e->d_type == DT_UNKNOWN || e->d_type == DT_LNK) {
+            struct stat st;
+            isDir = stat((path + "/" + e->d_name).c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+        }
+        if (!isDir) {
+            highest = std::max(highest, ordinalOf(e->d_name));
+        }
+    }
+
+    closedir(d);
+    return highest;
+}
+
+#endif
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+// Capture device and encoder interface, so that the capture queue can run against a simulated GPU
+// Captures are addressed by slot
+class CaptureBackend {
+public:
+    enum QueryStatus { Pending, Complete, Unsupported };
+
+    virtual ~CaptureBackend() {}
+
+    // Copies the current source into a slot on the GPU, followed by a completion query if supported
+    virtual bool copy(int slot) = 0;
+    // Must not wait for the GPU. Slots without a completion query return Unsupported.
+    virtual QueryStatus poll(int slot) = 0;
+    // Reads back a completed copy and starts encoding it to path, or to the slot's raw sink if path is empty
+    virtual void startEncode(int slot, const std::string& path) = 0;
+    // Checks if encoding has finished, waiting for it if requested
+    virtual bool encoded(int slot, bool wait) = 0;
+    // Releases an encoded slot's readback, returning whether it succeeded
+    virtual bool finish(int slot) = 0;
+};
+
+// Bookkeeping for asynchronous captures
+// Captures complete in submission order. When all usable slots are busy, a new capture waits for the oldest.
+// Free slots are reused lowest first, so that occasional screenshots only keep one slot's surfaces.
+class CaptureQueue {
+public:
+    // Called on the render thread once the capture is written, or has failed
+    typedef std::function<void(bool success)> Completion;
+
+    static const int defaultDepth = 3, maxDepth = 6;
+
+    CaptureQueue(CaptureBackend* b);
+
+    int acquire();
+    bool issue(int slot, const std::string& path, Completion onComplete);
+    bool pathPending(const char* path) const;
+    void update();
+    void flush();
+
+    void setDepth(int requestDepth);
+    int usableDepth() const { return depth; }
+    bool slotFree(int slot) const { return slots[slot].state == SlotFree; }
+    int pendingCount() const { return int(pending.size()); }
+
+private:
+    enum SlotState { SlotFree, SlotCopying, SlotEncoding };
+
+    struct Slot {
+        SlotState state;
+        uint32_t frameIssued;
+        std::string path;
+        Completion onComplete;
+    };
+
+    CaptureBackend* backend;
+    Slot slots[maxDepth];
+    std::deque<int> pending;
+    int depth;
+    uint32_t frameCount;
+
+    bool copyReady(int slot);
+    void startEncode(int slot);
+    void completeOldest(bool wait);
+};
+
+// Screenshot numbering by directory
+// The directory is only scanned on first use; numbers given to pending captures are never reused
+class CaptureOrdinals {
+public:
+    int next(const char* dir);
+    void clear() { ordinals.clear(); }
+
+    static int highestInFolder(const char* dir);
+    static int ordinalOf(const char* filename);
+
+private:
+    std::unordered_map<std::string, int> ordinals;
+};
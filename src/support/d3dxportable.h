@@ -0,0 +1,59 @@
+#pragma once
+
+// D3D declarations needed by the CPU-side distant land code (bounds, frustum culling, quadtrees).
+// On Windows this is the real D3DX header. Elsewhere the math is provided by support/vecmath.h alone,
+// and D3D resources, which that code only references by pointer, are left as incomplete types.
+// The effect parameter calls used by EffectVariables and PostShaderBindings are declared as an interface, so tests can supply a mock effect.
+// The value types in the proxy's captured render state are defined with the same layouts as D3D's.
+
+#ifdef _WIN32
+
+#define D3DXFX_LARGEADDRESS_HANDLE
+
+#include "d3dx9math.h"
+
+#else
+
+#include "vecmath.h"
+
+#include <cstdint>
+
+typedef uint8_t BYTE;
+typedef unsigned int UINT;
+typedef uint32_t DWORD;
+typedef int BOOL;
+typedef long HRESULT;
+typedef const char* D3DXHANDLE;
+
+const HRESULT D3D_OK = 0;
+
+typedef mat4 D3DXMATRIX;
+
+struct D3DCOLORVALUE {
+    float r, g, b, a;
+};
+
+enum D3DPRIMITIVETYPE {
+    D3DPT_TRIANGLELIST = 4,
+    D3DPT_TRIANGLESTRIP = 5
+};
+
+struct IDirect3DBaseTexture9;
+struct IDirect3DTexture9;
+struct IDirect3DVertexBuffer9;
+struct IDirect3DIndexBuffer9;
+
+typedef IDirect3DBaseTexture9* LPDIRECT3DBASETEXTURE9;
+
+struct ID3DXEffect {
+    virtual ~ID3DXEffect() {}
+    virtual D3DXHANDLE GetParameterByName(D3DXHANDLE parent, const char* name) = 0;
+    virtual HRESULT SetBool(D3DXHANDLE parameter, BOOL b) = 0;
+    virtual HRESULT SetInt(D3DXHANDLE parameter, int n) = 0;
+    virtual HRESULT SetFloat(D3DXHANDLE parameter, float f) = 0;
+    virtual HRESULT SetFloatArray(D3DXHANDLE parameter, const float* f, unsigned int count) = 0;
+    virtual HRESULT SetMatrix(D3DXHANDLE parameter, const D3DXMATRIX* m) = 0;
+    virtual HRESULT SetTexture(D3DXHANDLE parameter, LPDIRECT3DBASETEXTURE9 texture) = 0;
+};
+
+#endif
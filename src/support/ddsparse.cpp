@@ -0,0 +1,123 @@
+
+#include "ddsparse.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+
+static const uint32_t DDS_MAGIC = 0x20534444;   // "DDS "
+static const uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+static const uint32_t DDPF_ALPHAPIXELS = 0x1;
+static const uint32_t DDPF_FOURCC = 0x4;
+static const uint32_t DDPF_RGB = 0x40;
+static const uint32_t DDSCAPS2_CUBEMAP = 0x200;
+static const uint32_t DDSCAPS2_VOLUME = 0x200000;
+
+static uint32_t makeFourCC(char a, char b, char c, char d) {
+    return uint32_t(uint8_t(a)) | (uint32_t(uint8_t(b)) << 8) | (uint32_t(uint8_t(c)) << 16) | (uint32_t(uint8_t(d)) << 24);
+}
+
+struct DDSPixelFormat {
+    uint32_t size, flags, fourCC, rgbBitCount;
+    uint32_t rMask, gMask, bMask, aMask;
+};
+
+struct DDSHeader {
+    uint32_t size, flags, height, width, pitchOrLinearSize, depth, mipMapCount;
+    uint32_t reserved1[11];
+    DDSPixelFormat pf;
+    uint32_t caps, caps2, caps3, caps4, reserved2;
+};
+
+static_assert(sizeof(DDSHeader) == 124, "DDS header layout");
+
+// ddsFormat - Identify supported pixel formats
+static DDSFormat ddsFormat(const DDSPixelFormat& pf) {
+    if (pf.flags & DDPF_FOURCC) {
+        if (pf.fourCC == makeFourCC('D', 'X', 'T', '1')) {
+            return DDSFormat::DXT1;
+        }
+        if (pf.fourCC == makeFourCC('D', 'X', 'T', '3')) {
+            return DDSFormat::DXT3;
+        }
+        if (pf.fourCC == makeFourCC('D', 'X', 'T', '5')) {
+            return DDSFormat::DXT5;
+        }
+        return DDSFormat::Unknown;
+    }
+
+    if ((pf.flags & DDPF_RGB) && pf.rgbBitCount == 32 && pf.rMask == 0xff0000 && pf.gMask == 0xff00 && pf.bMask == 0xff) {
+        if ((pf.flags & DDPF_ALPHAPIXELS) && pf.aMask == 0xff000000) {
+            return DDSFormat::A8R8G8B8;
+        }
+        return DDSFormat::X8R8G8B8;
+    }
+    return DDSFormat::Unknown;
+}
+
+// ddsParse - Parses a 2D DDS file in memory without copying. Supports DXT1/3/5 and 32-bit RGB with full mip chains.
+bool ddsParse(const void* data, size_t size, DDSImage* image) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+    uint32_t magic;
+    DDSHeader header;
+
+    if (size < 4 + sizeof(header)) {
+        return false;
+    }
+    std::memcpy(&magic, p, 4);
+    std::memcpy(&header, p + 4, sizeof(header));
+    if (magic != DDS_MAGIC || header.size != sizeof(header) || header.pf.size != sizeof(DDSPixelFormat)) {
+        return false;
+    }
+    if (header.caps2 & (DDSCAPS2_CUBEMAP | DDSCAPS2_VOLUME)) {
+        return false;
+    }
+    if (header.width == 0 || header.height == 0 || header.width > 16384 || header.height > 16384) {
+        return false;
+    }
+
+    image->format = ddsFormat(header.pf);
+    if (image->format == DDSFormat::Unknown) {
+        return false;
+    }
+
+    bool compressed = image->format != DDSFormat::A8R8G8B8 && image->format != DDSFormat::X8R8G8B8;
+    unsigned int blockBytes = (image->format == DDSFormat::DXT1) ? 8 : 16;
+    unsigned int mipLevels = (header.flags & DDSD_MIPMAPCOUNT) ? std::max(1u, header.mipMapCount) : 1;
+    unsigned int w = header.width, h = header.height;
+    size_t offset = 4 + sizeof(header);
+
+    image->width = w;
+    image->height = h;
+    image->levels.clear();
+
+    for (unsigned int i = 0; i != mipLevels; ++i) {
+        DDSImage::Level level;
+        level.width = w;
+        level.height = h;
+        if (compressed) {
+            level.pitch = std::max(1u, (w + 3) / 4) * blockBytes;
+            level.rows = std::max(1u, (h + 3) / 4);
+        } else {
+            level.pitch = w * 4;
+            level.rows = h;
+        }
+        level.size = size_t(level.pitch) * level.rows;
+
+        if (offset + level.size > size) {
+            return false;
+        }
+        level.data = p + offset;
+        offset += level.size;
+        image->levels.push_back(level);
+
+        if (w == 1 && h == 1) {
+            break;
+        }
+        w = std::max(1u, w / 2);
+        h = std::max(1u, h / 2);
+    }
+
+    return true;
+}
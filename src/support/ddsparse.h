@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+enum struct DDSFormat {
+    Unknown, DXT1, DXT3, DXT5, A8R8G8B8, X8R8G8B8
+};
+
+struct DDSImage {
+    struct Level {
+        const uint8_t* data;
+        size_t size;
+        unsigned int width, height;
+        unsigned int pitch, rows;   // Bytes per row of pixels or compressed blocks, and number of such rows
+    };
+
+    DDSFormat format;
+    unsigned int width, height;
+    std::vector<Level> levels;
+};
+
+// ddsParse - Parses a 2D DDS file in memory without copying. Supports DXT1/3/5 and 32-bit RGB with full mip chains.
+bool ddsParse(const void* data, size_t size, DDSImage* image);
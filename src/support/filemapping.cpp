@@ -0,0 +1,195 @@
+
+#include "filemapping.h"
+
+#ifdef _WIN32
+#include "winheader.h"
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+
+FileView::FileView(FileView&& x) : base(x.base), baseLength(x.baseLength), ptr(x.ptr), length(x.length) {
+    x.base = nullptr;
+    x.ptr = nullptr;
+}
+
+FileView& FileView::operator=(FileView&& x) {
+    if (this != &x) {
+        release();
+        base = x.base;
+        baseLength = x.baseLength;
+        ptr = x.ptr;
+        length = x.length;
+        x.base = nullptr;
+        x.ptr = nullptr;
+    }
+    return *this;
+}
+
+FileMapping::FileMapping(FileMapping&& x) : FileMapping() {
+    *this = static_cast<FileMapping&&>(x);
+}
+
+#ifdef _WIN32
+
+// Windows backend, file mapping objects
+
+void FileView::release() {
+    if (base) {
+        UnmapViewOfFile(base);
+        base = nullptr;
+        ptr = nullptr;
+    }
+}
+
+FileMapping::FileMapping() : mapping(nullptr), fileSize(0) {}
+
+FileMapping& FileMapping::operator=(FileMapping&& x) {
+    if (this != &x) {
+        close();
+        mapping = x.mapping;
+        fileSize = x.fileSize;
+        x.mapping = nullptr;
+        x.fileSize = 0;
+    }
+    return *this;
+}
+
+bool FileMapping::open(const char* path) {
+    close();
+
+    HANDLE file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+        mapping = CreateFileMapping(file, 0, PAGE_READONLY, 0, 0, 0);
+        fileSize = mapping ? uint64_t(size.QuadPart) : 0;
+    }
+    CloseHandle(file);
+    return mapping != nullptr;
+}
+
+void FileMapping::close() {
+    if (mapping) {
+        CloseHandle(mapping);
+        mapping = nullptr;
+    }
+    fileSize = 0;
+}
+
+bool FileMapping::isOpen() const {
+    return mapping != nullptr;
+}
+
+static uint64_t mapGranularity() {
+    static DWORD granularity = 0;
+    if (!granularity) {
+        SYSTEM_INFO sysInfo;
+        GetSystemInfo(&sysInfo);
+        granularity = sysInfo.dwAllocationGranularity;
+    }
+    return granularity;
+}
+
+#else
+
+// POSIX backend, mmap, so that portable tools and tests can share archive parsing
+
+void FileView::release() {
+    if (base) {
+        munmap(base, baseLength);
+        base = nullptr;
+        ptr = nullptr;
+    }
+}
+
+FileMapping::FileMapping() : fd(-1), fileSize(0) {}
+
+FileMapping& FileMapping::operator=(FileMapping&& x) {
+    if (this != &x) {
+        close();
+        fd = x.fd;
+        fileSize = x.fileSize;
+        x.fd = -1;
+        x.fileSize = 0;
+    }
+    return *this;
+}
+
+bool FileMapping::open(const char* path) {
+    close();
+
+    fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close();
+        return false;
+    }
+    fileSize = uint64_t(st.st_size);
+    return true;
+}
+
+void FileMapping::close() {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    fileSize = 0;
+}
+
+bool FileMapping::isOpen() const {
+    return fd >= 0;
+}
+
+static uint64_t mapGranularity() {
+    static long granularity = 0;
+    if (!granularity) {
+        granularity = sysconf(_SC_PAGESIZE);
+    }
+    return uint64_t(granularity);
+}
+
+#endif
+
+FileView FileMapping::view(uint64_t offset, size_t length) const {
+    FileView v;
+    if (!isOpen() || length == 0 || offset > fileSize || length > fileSize - offset) {
+        return v;
+    }
+
+    // Views must start on a granularity boundary
+    uint64_t base = offset & ~(mapGranularity() - 1);
+    uint64_t skip = offset - base;
+    if (skip + length < length || skip + length > SIZE_MAX) {
+        return v;
+    }
+
+#ifdef _WIN32
+    void* p = MapViewOfFile(mapping, FILE_MAP_READ, DWORD(base >> 32), DWORD(base), SIZE_T(skip + length));
+    if (!p) {
+        return v;
+    }
+#else
+    void* p = mmap(nullptr, size_t(skip + length), PROT_READ, MAP_PRIVATE, fd, off_t(base));
+    if (p == MAP_FAILED) {
+        return v;
+    }
+#endif
+
+    v.base = p;
+    v.baseLength = size_t(skip + length);
+    v.ptr = reinterpret_cast<const char*>(p) + skip;
+    v.length = length;
+    return v;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// A range of a mapped file, unmapped on destruction
+class FileView {
+    void* base;
+    size_t baseLength;
+    const char* ptr;
+    size_t length;
+
+    friend class FileMapping;
+    void release();
+
+public:
+    FileView() : base(nullptr), baseLength(0), ptr(nullptr), length(0) {}
+    FileView(FileView&& x);
+    FileView& operator=(FileView&& x);
+    FileView(const FileView&) = delete;
+    FileView& operator=(const FileView&) = delete;
+    ~FileView() { release(); }
+
+    const char* data() const { return ptr; }
+    size_t size() const { return length; }
+    bool valid() const { return ptr != nullptr; }
+};
+
+// Read-only file mapping, viewed in ranges
+// Only the ranges being read are mapped, to keep 32-bit address space use low. Views may be taken from
+// several threads at once. Uses file mapping objects on Windows and mmap elsewhere.
+class FileMapping {
+#ifdef _WIN32
+    void* mapping;
+#else
+    int fd;
+#endif
+    uint64_t fileSize;
+
+public:
+    FileMapping();
+    FileMapping(FileMapping&& x);
+    FileMapping& operator=(FileMapping&& x);
+    FileMapping(const FileMapping&) = delete;
+    FileMapping& operator=(const FileMapping&) = delete;
+    ~FileMapping() { close(); }
+
+    bool open(const char* path);
+    void close();
+    bool isOpen() const;
+    uint64_t size() const { return fileSize; }
+
+    // view - Map a range of the file, or return an invalid view if it is out of bounds or mapping fails
+    FileView view(uint64_t offset, size_t length) const;
+};
@@ -0,0 +1,194 @@
+
+#include "gputimestamps.h"
+
+
+
+GpuTimestampRing::GpuTimestampRing(TimestampQueryBackend* b, int zones, int frameZone_)
+    : backend(b), zoneCount(zones), frameZone(frameZone_), initialized(false),
+      head(0), tail(0), recording(-1), dropped(0) {
+}
+
+bool GpuTimestampRing::init() {
+    release();
+    if (!backend->create(frameSlots, timestampsPerFrame)) {
+        backend->release();
+        return false;
+    }
+
+    for (Frame& f : frames) {
+        f.state = Free;
+        f.used = 0;
+        f.spans.clear();
+        f.spans.reserve(timestampsPerFrame / 2);
+    }
+    head = tail = 0;
+    recording = -1;
+    dropped = 0;
+    openSpan.assign(zoneCount, -1);
+    zoneTicks.assign(zoneCount, 0);
+    initialized = true;
+    return true;
+}
+
+void GpuTimestampRing::release() {
+    if (initialized) {
+        backend->release();
+    }
+    initialized = false;
+    recording = -1;
+}
+
+// beginFrame - Start recording into the next slot, unless the GPU has not yet finished with it
+void GpuTimestampRing::beginFrame() {
+    recording = -1;
+    if (!initialized) {
+        return;
+    }
+
+    Frame& f = frames[head];
+    if (f.state != Free) {
+        ++dropped;
+        return;
+    }
+
+    f.state = Recording;
+    f.used = 2;
+    f.spans.clear();
+    for (int& i : openSpan) {
+        i = -1;
+    }
+
+    backend->beginFrame(head);
+    backend->timestamp(head, 0);
+    recording = head;
+}
+
+// endFrame - Issue the frame end. Spans still open are discarded.
+void GpuTimestampRing::endFrame() {
+    if (recording < 0) {
+        return;
+    }
+
+    Frame& f = frames[recording];
+    for (int i : openSpan) {
+        if (i >= 0) {
+            f.spans[i].zone = -1;
+        }
+    }
+
+    backend->timestamp(recording, 1);
+    backend->endFrame(recording);
+    f.state = Issued;
+    head = (head + 1) % frameSlots;
+    recording = -1;
+}
+
+// beginZone - Open a span. Recursive entry to an open zone is counted in the outer span.
+void GpuTimestampRing::beginZone(int zone) {
+    if (recording < 0 || openSpan[zone] >= 0) {
+        return;
+    }
+
+    Frame& f = frames[recording];
+    if (f.used >= timestampsPerFrame) {
+        return;
+    }
+
+    backend->timestamp(recording, f.used);
+    openSpan[zone] = int(f.spans.size());
+    f.spans.push_back(Span { zone, f.used, -1 });
+    ++f.used;
+}
+
+// endZone - Close a span, which is discarded if the frame has run out of timestamps
+void GpuTimestampRing::endZone(int zone) {
+    if (recording < 0 || openSpan[zone] < 0) {
+        return;
+    }
+
+    Frame& f = frames[recording];
+    Span& s = f.spans[openSpan[zone]];
+    openSpan[zone] = -1;
+
+    if (f.used >= timestampsPerFrame) {
+        s.zone = -1;
+        return;
+    }
+
+    backend->timestamp(recording, f.used);
+    s.end = f.used;
+    ++f.used;
+}
+
+// collect - Read back completed frames, oldest first, stopping at the first frame still in flight
+// Returns the number of frames released
+int GpuTimestampRing::collect(RollingStats* zoneStats) {
+    int n = 0;
+
+    while (initialized && frames[tail].state == Issued) {
+        if (!readFrame(tail, zoneStats)) {
+            break;
+        }
+
+        frames[tail].state = Free;
+        tail = (tail + 1) % frameSlots;
+        ++n;
+    }
+    return n;
+}
+
+// readFrame - Add a frame's results to the statistics. Returns false if results are not yet available.
+// Frames where the timestamp frequency changed (disjoint) are released without adding samples.
+// Spans that do not fit within the frame are ignored.
+bool GpuTimestampRing::readFrame(int slot, RollingStats* zoneStats) {
+    const Frame& f = frames[slot];
+    bool disjoint;
+    uint64_t frequency, frameBegin, frameEnd;
+
+    if (!backend->frameResult(slot, &disjoint, &frequency)) {
+        return false;
+    }
+    if (disjoint || frequency == 0) {
+        return true;
+    }
+    if (!backend->timestampResult(slot, 0, &frameBegin) || !backend->timestampResult(slot, 1, &frameEnd)) {
+        return false;
+    }
+
+    // Tick differences are taken modulo 2^64, so that spans across a counter wrap are measured correctly.
+    // A frame end before its start means the counter is unreliable, and the frame is released without samples.
+    uint64_t frameTicks = frameEnd - frameBegin;
+    if (int64_t(frameTicks) < 0) {
+        return true;
+    }
+
+    for (uint64_t& t : zoneTicks) {
+        t = 0;
+    }
+
+    for (const Span& s : f.spans) {
+        uint64_t begin, end;
+
+        if (s.zone < 0 || s.end < 0) {
+            continue;
+        }
+        if (!backend->timestampResult(slot, s.begin, &begin) || !backend->timestampResult(slot, s.end, &end)) {
+            return false;
+        }
+        if (end - begin <= frameTicks) {
+            zoneTicks[s.zone] += end - begin;
+        }
+    }
+
+    // Ticks are converted from signed values, which avoids unsigned 64-bit conversion helpers on 32-bit targets
+    double toMicroseconds = 1000000.0 / double(int64_t(frequency));
+    for (int z = 0; z != zoneCount; ++z) {
+        if (z != frameZone) {
+            zoneStats[z].add(float(double(int64_t(zoneTicks[z])) * toMicroseconds));
+        }
+    }
+    if (frameZone >= 0) {
+        zoneStats[frameZone].add(float(double(int64_t(frameTicks)) * toMicroseconds));
+    }
+    return true;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "profilestats.h"
+
+#include <stdint.h>
+#include <vector>
+
+// Timestamp query device interface, so that the query ring can run against a simulated device
+// Queries are addressed by frame slot and by timestamp index within the frame slot
+class TimestampQueryBackend {
+public:
+    virtual ~TimestampQueryBackend() {}
+
+    virtual bool create(int frameSlots, int timestampsPerFrame) = 0;
+    virtual void release() = 0;
+
+    // Brackets a frame with a disjoint query and requests the tick frequency
+    virtual void beginFrame(int frame) = 0;
+    virtual void endFrame(int frame) = 0;
+    virtual void timestamp(int frame, int index) = 0;
+
+    // Results must not wait for the GPU, returning false if not yet available
+    virtual bool frameResult(int frame, bool* disjoint, uint64_t* frequency) = 0;
+    virtual bool timestampResult(int frame, int index, uint64_t* ticks) = 0;
+};
+
+// Ring of in-flight frames of GPU timestamp queries
+// Frames are read back a few frames after issue, oldest first, and never stall: if the ring is still
+// full at the start of a frame, that frame is not measured. Zones may run several times per frame
+// and may nest; each completed frame adds every zone's total GPU time to its statistics,
+// with the whole frame's GPU time going to frameZone.
+class GpuTimestampRing {
+public:
+    static const int frameSlots = 4;
+    static const int timestampsPerFrame = 64;
+
+    GpuTimestampRing(TimestampQueryBackend* b, int zones, int frameZone);
+
+    bool init();
+    void release();
+    bool ready() const { return initialized; }
+
+    void beginFrame();
+    void endFrame();
+    void beginZone(int zone);
+    void endZone(int zone);
+
+    int collect(RollingStats* zoneStats);
+    int droppedFrames() const { return dropped; }
+
+private:
+    enum FrameState { Free, Recording, Issued };
+
+    struct Span {
+        int zone;
+        int begin, end;         // Timestamp indices, end is -1 while open
+    };
+
+    struct Frame {
+        FrameState state;
+        int used;               // Timestamp indices 0 and 1 bracket the frame
+        std::vector<Span> spans;
+    };
+
+    TimestampQueryBackend* backend;
+    int zoneCount, frameZone;
+    bool initialized;
+    Frame frames[frameSlots];
+    int head, tail;             // Next slot to record, oldest slot in flight
+    int recording;              // Slot being recorded, or -1
+    int dropped;
+    std::vector<int> openSpan;  // By zone, index into the recording frame's spans or -1
+    std::vector<uint64_t> zoneTicks;
+
+    bool readFrame(int slot, RollingStats* zoneStats);
+};
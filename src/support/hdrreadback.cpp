@@ -0,0 +1,110 @@
+
+#include "hdrreadback.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+
+void HDRAdaptation::reset() {
+    for (float& x : point) {
+        x = 1.0f;
+    }
+}
+
+// addSample - Convert a sample to environment-weighted luminance and average over time
+// Filtering is exponential in the time since the previous sample, so any sample rate converges alike
+void HDRAdaptation::addSample(float r, float g, float b, int environmentFlags, float dt, float reactionTime) {
+    // Exterior-like environments are weighted up
+    float environmentScaling = (environmentFlags & 6) ? 2.5f : 1.0f;
+    float lambda = std::exp(-std::max(0.0f, dt) / reactionTime);
+    point[3] = 0.27f*r + 0.67f*g + 0.06f*b;
+    point[2] = point[3] * environmentScaling + (point[2] - point[3] * environmentScaling) * lambda;
+    point[1] = point[3] + (point[1] - point[3]) * lambda;
+    point[0] = point[2] / environmentScaling;
+}
+
+
+
+HDRReadbackRing::HDRReadbackRing(LuminanceReadbackBackend* b)
+    : backend(b), initialized(false), head(0), tail(0), frameCount(0), time(0), lastSampleTime(0), skipped(0) {
+}
+
+bool HDRReadbackRing::init() {
+    release();
+    if (!backend->create(slots)) {
+        backend->release();
+        return false;
+    }
+
+    for (Entry& e : entries) {
+        e.pending = false;
+    }
+    head = tail = 0;
+    frameCount = 0;
+    time = lastSampleTime = 0;
+    skipped = 0;
+    initialized = true;
+    return true;
+}
+
+void HDRReadbackRing::release() {
+    if (initialized) {
+        backend->release();
+    }
+    initialized = false;
+}
+
+// frame - Collect completed samples into the adaptation, oldest first, then sample this frame if a slot is free
+// Returns the number of samples collected
+int HDRReadbackRing::frame(float dt, HDRAdaptation* adapt, int environmentFlags, float reactionTime) {
+    int n = 0;
+
+    if (!initialized) {
+        return 0;
+    }
+
+    time += dt;
+    ++frameCount;
+
+    while (entries[tail].pending && entryReady(tail)) {
+        Entry& e = entries[tail];
+        float rgb[3];
+
+        if (backend->read(tail, rgb)) {
+            adapt->addSample(rgb[0], rgb[1], rgb[2], environmentFlags, float(e.timestamp - lastSampleTime), reactionTime);
+            lastSampleTime = e.timestamp;
+            ++n;
+        }
+
+        e.pending = false;
+        tail = (tail + 1) % slots;
+    }
+
+    // Skip sampling this frame if the GPU is too far behind to have a free entry
+    Entry& next = entries[head];
+    if (next.pending) {
+        ++skipped;
+        return n;
+    }
+
+    backend->issue(head);
+    next.timestamp = time;
+    next.frameIssued = frameCount;
+    next.pending = true;
+    head = (head + 1) % slots;
+    return n;
+}
+
+// entryReady - Check if the GPU has finished writing an entry
+// Without completion queries, entries are assumed complete after the ring has cycled
+bool HDRReadbackRing::entryReady(int slot) {
+    switch (backend->poll(slot)) {
+    case LuminanceReadbackBackend::Complete:
+        return true;
+    case LuminanceReadbackBackend::Pending:
+        return false;
+    default:
+        return frameCount - entries[slot].frameIssued >= uint32_t(slots - 1);
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+
+// Luminance readback device interface, so that the readback ring can run against a simulated GPU
+// Samples are addressed by ring slot
+class LuminanceReadbackBackend {
+public:
+    enum QueryStatus { Pending, Complete, Unsupported };
+
+    virtual ~LuminanceReadbackBackend() {}
+
+    virtual bool create(int slots) = 0;
+    virtual void release() = 0;
+
+    // Queues a 1x1 average of the current frame into a slot, followed by a completion query if supported
+    virtual void issue(int slot) = 0;
+    // Must not wait for the GPU. Slots without a completion query return Unsupported.
+    virtual QueryStatus poll(int slot) = 0;
+    // Reads a completed slot as normalized rgb, false if it could not be read
+    virtual bool read(int slot, float* rgb) = 0;
+};
+
+// Time-filtered scene luminance for HDR
+// point: x = normalized weighted lumi, y = unweighted lumi, z = unnormalized weighted lumi, w = immediate unweighted lumi
+struct HDRAdaptation {
+    float point[4];
+
+    void reset();
+    void addSample(float r, float g, float b, int environmentFlags, float dt, float reactionTime);
+};
+
+// Ring of in-flight luminance readbacks
+// Results are collected a few frames after issue, oldest first, and never stall: if the ring is still
+// full at a frame, that frame is not sampled. Each sample is filtered by the time elapsed since the
+// previous sample was taken, so adaptation speed does not depend on frame rate or readback latency.
+class HDRReadbackRing {
+public:
+    static const int slots = 3;
+
+    HDRReadbackRing(LuminanceReadbackBackend* b);
+
+    bool init();
+    void release();
+    bool ready() const { return initialized; }
+
+    int frame(float dt, HDRAdaptation* adapt, int environmentFlags, float reactionTime);
+    int skippedFrames() const { return skipped; }
+
+private:
+    struct Entry {
+        double timestamp;       // Accumulated in double, a float loses frame time precision within hours
+        uint32_t frameIssued;
+        bool pending;
+    };
+
+    LuminanceReadbackBackend* backend;
+    bool initialized;
+    Entry entries[slots];
+    int head, tail;             // Next slot to issue, oldest slot in flight
+    uint32_t frameCount;
+    double time, lastSampleTime;
+    int skipped;
+
+    bool entryReady(int slot);
+};
@@ -0,0 +1,128 @@
+
+#include "imageencode.h"
+
+#include <cstring>
+
+
+
+static void writeUint16LE(uint8_t* dest, uint32_t x) {
+    dest[0] = uint8_t(x);
+    dest[1] = uint8_t(x >> 8);
+}
+
+static void writeUint32LE(uint8_t* dest, uint32_t x) {
+    dest[0] = uint8_t(x);
+    dest[1] = uint8_t(x >> 8);
+    dest[2] = uint8_t(x >> 16);
+    dest[3] = uint8_t(x >> 24);
+}
+
+// copyRowBGR - Drop alpha from one row
+static void copyRowBGR(const uint8_t* src, unsigned int width, uint8_t* dest) {
+    for (unsigned int x = 0; x != width; ++x, src += 4, dest += 3) {
+        dest[0] = src[0];
+        dest[1] = src[1];
+        dest[2] = src[2];
+    }
+}
+
+// bmpEncodeBGRA - 24-bit bottom-up BMP
+bool bmpEncodeBGRA(const void* data, unsigned int width, unsigned int height, unsigned int stride, std::vector<uint8_t>& bmp) {
+    const uint32_t headerSize = 14 + 40;
+    uint64_t rowBytes = (3 * uint64_t(width) + 3) & ~uint64_t(3);
+    uint64_t fileSize = headerSize + rowBytes * height;
+
+    if (width == 0 || height == 0 || width > 0x7FFFFFFF || height > 0x7FFFFFFF || fileSize > 0xFFFFFFFF) {
+        return false;
+    }
+
+    bmp.assign(size_t(fileSize), 0);
+    uint8_t* p = bmp.data();
+
+    // BITMAPFILEHEADER
+    p[0] = 'B';
+    p[1] = 'M';
+    writeUint32LE(p + 2, uint32_t(fileSize));
+    writeUint32LE(p + 10, headerSize);
+
+    // BITMAPINFOHEADER, positive height for bottom-up rows, 72 dpi
+    writeUint32LE(p + 14, 40);
+    writeUint32LE(p + 18, width);
+    writeUint32LE(p + 22, height);
+    writeUint16LE(p + 26, 1);
+    writeUint16LE(p + 28, 24);
+    writeUint32LE(p + 34, uint32_t(rowBytes * height));
+    writeUint32LE(p + 38, 2835);
+    writeUint32LE(p + 42, 2835);
+
+    auto src = reinterpret_cast<const uint8_t*>(data);
+    for (unsigned int y = 0; y != height; ++y) {
+        copyRowBGR(src + size_t(stride) * y, width, p + headerSize + size_t(rowBytes) * (height - 1 - y));
+    }
+    return true;
+}
+
+// tgaEncodeBGRA - 24-bit uncompressed top-down TGA
+bool tgaEncodeBGRA(const void* data, unsigned int width, unsigned int height, unsigned int stride, std::vector<uint8_t>& tga) {
+    const size_t headerSize = 18;
+    size_t rowBytes = 3 * size_t(width);
+
+    if (width == 0 || height == 0 || width > 0xFFFF || height > 0xFFFF) {
+        return false;
+    }
+
+    tga.assign(headerSize + rowBytes * height, 0);
+    uint8_t* p = tga.data();
+
+    p[2] = 2;               // Uncompressed true colour
+    writeUint16LE(p + 12, width);
+    writeUint16LE(p + 14, height);
+    p[16] = 24;
+    p[17] = 0x20;           // Top-left origin, no alpha bits
+
+    auto src = reinterpret_cast<const uint8_t*>(data);
+    for (unsigned int y = 0; y != height; ++y) {
+        copyRowBGR(src + size_t(stride) * y, width, p + headerSize + rowBytes * y);
+    }
+    return true;
+}
+
+// ddsEncodeBGRA - X8R8G8B8 DDS with a single level
+bool ddsEncodeBGRA(const void* data, unsigned int width, unsigned int height, unsigned int stride, std::vector<uint8_t>& dds) {
+    const size_t headerSize = 4 + 124;
+    size_t rowBytes = 4 * size_t(width);
+
+    if (width == 0 || height == 0 || width > 0x3FFFFFFF) {
+        return false;
+    }
+
+    dds.assign(headerSize + rowBytes * height, 0);
+    uint8_t* p = dds.data();
+
+    std::memcpy(p, "DDS ", 4);
+    writeUint32LE(p + 4, 124);
+    writeUint32LE(p + 8, 0x100F);           // DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PITCH | DDSD_PIXELFORMAT
+    writeUint32LE(p + 12, height);
+    writeUint32LE(p + 16, width);
+    writeUint32LE(p + 20, uint32_t(rowBytes));
+    writeUint32LE(p + 76, 32);              // DDS_PIXELFORMAT
+    writeUint32LE(p + 80, 0x40);            // DDPF_RGB
+    writeUint32LE(p + 88, 32);
+    writeUint32LE(p + 92, 0xFF0000);
+    writeUint32LE(p + 96, 0xFF00);
+    writeUint32LE(p + 100, 0xFF);
+    writeUint32LE(p + 108, 0x1000);         // DDSCAPS_TEXTURE
+
+    auto src = reinterpret_cast<const uint8_t*>(data);
+    for (unsigned int y = 0; y != height; ++y) {
+        const uint8_t* s = src + size_t(stride) * y;
+        uint8_t* d = p + headerSize + rowBytes * y;
+        for (unsigned int x = 0; x != width; ++x, s += 4, d += 4) {
+            d[0] = s[0];
+            d[1] = s[1];
+            d[2] = s[2];
+            d[3] = 0xFF;
+        }
+    }
+    return true;
+}
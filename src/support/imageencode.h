@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Uncompressed screenshot encoders, portable so that they can run on worker threads and in tests.
+// Accept BGRA data like pngEncodeBGRA, and do not save alpha. Return false for sizes the format cannot store.
+
+// bmpEncodeBGRA - 24-bit bottom-up BMP
+bool bmpEncodeBGRA(const void* data, unsigned int width, unsigned int height, unsigned int stride, std::vector<uint8_t>& bmp);
+// tgaEncodeBGRA - 24-bit uncompressed top-down TGA
+bool tgaEncodeBGRA(const void* data, unsigned int width, unsigned int height, unsigned int stride, std::vector<uint8_t>& tga);
+// ddsEncodeBGRA - X8R8G8B8 DDS with a single level
+bool ddsEncodeBGRA(const void* data, unsigned int width, unsigned int height, unsigned int stride, std::vector<uint8_t>& dds);
@@ -0,0 +1,332 @@
+
+#include "inifile.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+
+
+static const std::size_t npos = std::size_t(-1);
+
+static bool isBlank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+static std::string lowercase(const char* s, std::size_t n) {
+    std::string r(s, n);
+    for (char& c : r) {
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+    }
+    return r;
+}
+
+static std::string lowercase(const char* s) {
+    return lowercase(s, std::strlen(s));
+}
+
+// trim - Narrow [begin, end) to exclude surrounding spaces and tabs
+static void trim(const std::string& text, std::size_t& begin, std::size_t& end) {
+    while (begin < end && isBlank(text[begin])) {
+        ++begin;
+    }
+    while (end > begin && isBlank(text[end - 1])) {
+        --end;
+    }
+}
+
+// indexKey - Hash map key for a section/key pair, with the section identified by index
+static std::string indexKey(std::size_t section, const std::string& lowerKey) {
+    std::string r = std::to_string(section);
+    r += '\n';
+    r += lowerKey;
+    return r;
+}
+
+// load - Read and parse a file. A missing file parses as empty, and saving will create it.
+bool IniFile::load(const char* path) {
+    std::FILE* f = std::fopen(path, "rb");
+    std::string data;
+
+    if (f) {
+        char buffer[16384];
+        std::size_t n;
+        while ((n = std::fread(buffer, 1, sizeof(buffer), f)) > 0) {
+            data.append(buffer, n);
+        }
+        std::fclose(f);
+    }
+
+    parse(data.data(), data.size());
+    return f != nullptr;
+}
+
+// parse - Build the section and key index in a single pass over the text
+void IniFile::parse(const char* data, std::size_t size) {
+    text.assign(data, size);
+    entries.clear();
+    sections.clear();
+    sectionIndex.clear();
+    keyIndex.clear();
+    edits.clear();
+
+    newline = (text.find("\r\n") != npos || text.find('\n') == npos) ? "\r\n" : "\n";
+
+    std::size_t pos = 0, current = npos;
+    bool primary = false;
+
+    // Skip UTF-8 BOM
+    if (text.compare(0, 3, "\xEF\xBB\xBF") == 0) {
+        pos = 3;
+    }
+
+    while (pos < text.size()) {
+        std::size_t lineEnd = text.find('\n', pos);
+        std::size_t next = (lineEnd == npos) ? text.size() : lineEnd + 1;
+        std::size_t begin = pos, end = (lineEnd == npos) ? text.size() : lineEnd;
+
+        if (end > begin && text[end - 1] == '\r') {
+            --end;
+        }
+        std::size_t contentEnd = end;
+        trim(text, begin, end);
+        pos = next;
+
+        if (begin == end) {
+            continue;
+        }
+
+        if (text[begin] == '[') {
+            std::size_t nameBegin = begin + 1, nameEnd = text.find(']', nameBegin);
+            if (nameEnd == npos || nameEnd > end) {
+                nameEnd = end;
+            }
+            trim(text, nameBegin, nameEnd);
+
+            Section s;
+            s.name = text.substr(nameBegin, nameEnd - nameBegin);
+            s.insertAt = contentEnd;
+            s.edit = npos;
+            s.created = false;
+            current = sections.size();
+            sections.push_back(s);
+
+            // Only the first of several same-named sections is visible to lookups
+            primary = sectionIndex.emplace(lowercase(s.name.c_str()), current).second;
+            continue;
+        }
+
+        if (current == npos) {
+            continue;
+        }
+        sections[current].insertAt = contentEnd;
+
+        if (text[begin] == ';') {
+            continue;
+        }
+
+        Entry e;
+        std::size_t eq = text.find('=', begin);
+        std::size_t keyEnd = (eq != npos && eq < end) ? eq : end;
+        std::size_t keyBegin = begin;
+        trim(text, keyBegin, keyEnd);
+
+        e.key = text.substr(keyBegin, keyEnd - keyBegin);
+        e.section = current;
+        e.edit = npos;
+        e.hasValue = (eq != npos && eq < end);
+        if (e.hasValue) {
+            e.valueBegin = eq + 1;
+            e.valueEnd = end;
+            trim(text, e.valueBegin, e.valueEnd);
+
+            std::size_t vb = e.valueBegin, ve = e.valueEnd;
+            if (ve - vb >= 2 && (text[vb] == '"' || text[vb] == '\'') && text[ve - 1] == text[vb]) {
+                ++vb;
+                --ve;
+            }
+            e.value = text.substr(vb, ve - vb);
+        } else {
+            e.valueBegin = e.valueEnd = keyEnd;
+        }
+
+        std::size_t index = entries.size();
+        entries.push_back(e);
+        sections[current].entries.push_back(index);
+
+        if (primary) {
+            keyIndex.emplace(indexKey(current, lowercase(e.key.c_str())), index);
+        }
+    }
+}
+
+// get - Value of a key, or nullptr if the section or key is missing
+const char* IniFile::get(const char* section, const char* key) const {
+    auto s = sectionIndex.find(lowercase(section));
+    if (s == sectionIndex.end()) {
+        return nullptr;
+    }
+
+    auto k = keyIndex.find(indexKey(s->second, lowercase(key)));
+    if (k == keyIndex.end()) {
+        return nullptr;
+    }
+    return entries[k->second].value.c_str();
+}
+
+// getSection - Same output as GetPrivateProfileSection, "key=value" strings followed by an empty string.
+// Returns the number of chars written excluding the final null; output is truncated to fit.
+std::size_t IniFile::getSection(const char* section, char* buffer, std::size_t size) const {
+    std::size_t n = 0;
+
+    if (size < 2) {
+        if (size) {
+            buffer[0] = 0;
+        }
+        return 0;
+    }
+
+    auto s = sectionIndex.find(lowercase(section));
+    if (s != sectionIndex.end()) {
+        for (std::size_t i : sections[s->second].entries) {
+            const Entry& e = entries[i];
+            std::string line = e.hasValue ? e.key + "=" + e.value : e.key;
+
+            if (n + line.size() + 2 > size) {
+                std::size_t fit = size - 2 - n;
+                std::memcpy(buffer + n, line.data(), fit);
+                n += fit;
+                buffer[n++] = 0;
+                buffer[n] = 0;
+                return size - 2;
+            }
+
+            std::memcpy(buffer + n, line.c_str(), line.size() + 1);
+            n += line.size() + 1;
+        }
+    }
+
+    buffer[n] = 0;
+    return n;
+}
+
+// set - Change a value. Returns true if the value differed, in which case an edit is queued for save.
+bool IniFile::set(const char* section, const char* key, const char* value) {
+    std::string lowerSection = lowercase(section);
+    auto s = sectionIndex.find(lowerSection);
+    std::size_t si;
+
+    if (s == sectionIndex.end()) {
+        Section fresh;
+        fresh.name = section;
+        fresh.insertAt = text.size();
+        fresh.edit = npos;
+        fresh.created = true;
+        si = sections.size();
+        sections.push_back(fresh);
+        sectionIndex.emplace(lowerSection, si);
+    } else {
+        si = s->second;
+    }
+
+    std::string lowerKey = lowercase(key);
+    auto k = keyIndex.find(indexKey(si, lowerKey));
+
+    if (k != keyIndex.end()) {
+        Entry& e = entries[k->second];
+        if (e.hasValue && e.value == value) {
+            return false;
+        }
+
+        e.value = value;
+        if (std::find(sections[si].appended.begin(), sections[si].appended.end(), k->second) != sections[si].appended.end()) {
+            rebuildAppended(sections[si]);
+        } else {
+            std::string replacement = e.hasValue ? e.value : "=" + e.value;
+            if (e.edit == npos) {
+                e.edit = edits.size();
+                edits.push_back(Edit { e.valueBegin, e.valueEnd, replacement });
+            } else {
+                edits[e.edit].replacement = replacement;
+            }
+        }
+        return true;
+    }
+
+    Entry e;
+    e.key = key;
+    e.value = value;
+    e.valueBegin = e.valueEnd = npos;
+    e.section = si;
+    e.edit = npos;
+    e.hasValue = true;
+
+    std::size_t index = entries.size();
+    entries.push_back(e);
+    sections[si].entries.push_back(index);
+    sections[si].appended.push_back(index);
+    keyIndex.emplace(indexKey(si, lowerKey), index);
+
+    rebuildAppended(sections[si]);
+    return true;
+}
+
+// rebuildAppended - Regenerate the inserted text for keys (and possibly the header) added to a section
+void IniFile::rebuildAppended(Section& s) {
+    std::string r;
+
+    if (s.created) {
+        if (!text.empty() && text.back() != '\n') {
+            r += newline;
+        }
+        r += "[" + s.name + "]" + newline;
+        for (std::size_t i : s.appended) {
+            r += entries[i].key + "=" + entries[i].value + newline;
+        }
+    } else {
+        for (std::size_t i : s.appended) {
+            r += newline + entries[i].key + "=" + entries[i].value;
+        }
+    }
+
+    if (s.edit == npos) {
+        s.edit = edits.size();
+        edits.push_back(Edit { s.insertAt, s.insertAt, r });
+    } else {
+        edits[s.edit].replacement = r;
+    }
+}
+
+// save - Write the file with pending edits applied. Does nothing if no value changed.
+bool IniFile::save(const char* path) {
+    if (edits.empty()) {
+        return true;
+    }
+
+    std::vector<Edit> sorted = edits;
+    std::stable_sort(sorted.begin(), sorted.end(), [](const Edit& a, const Edit& b) { return a.begin < b.begin; });
+
+    std::string out;
+    std::size_t pos = 0;
+    out.reserve(text.size() + 1024);
+    for (const Edit& e : sorted) {
+        out.append(text, pos, e.begin - pos);
+        out += e.replacement;
+        pos = e.end;
+    }
+    out.append(text, pos, npos);
+
+    std::FILE* f = std::fopen(path, "wb");
+    if (!f) {
+        return false;
+    }
+    bool success = std::fwrite(out.data(), 1, out.size(), f) == out.size();
+    success = (std::fclose(f) == 0) && success;
+
+    if (success) {
+        parse(out.data(), out.size());
+    }
+    return success;
+}
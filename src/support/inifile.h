@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// One-pass INI reader/writer following GetPrivateProfileString conventions:
+// case-insensitive sections and keys, first duplicate wins, values trimmed and unquoted, ';' comment lines.
+// Saving splices changed values into the original text, so comments and layout are preserved.
+// Portable, so that offline tools can share it.
+class IniFile {
+public:
+    bool load(const char* path);
+    void parse(const char* data, std::size_t size);
+    bool save(const char* path);
+
+    const char* get(const char* section, const char* key) const;
+    std::size_t getSection(const char* section, char* buffer, std::size_t size) const;
+    std::size_t sectionCount() const { return sections.size(); }
+    const char* sectionName(std::size_t i) const { return sections[i].name.c_str(); }
+
+    bool set(const char* section, const char* key, const char* value);
+    bool modified() const { return !edits.empty(); }
+
+private:
+    struct Entry {
+        std::string key, value;
+        std::size_t valueBegin, valueEnd;   // Raw value span in text, including quotes
+        std::size_t section;
+        std::size_t edit;                   // Pending edit, or npos
+        bool hasValue;
+    };
+
+    struct Section {
+        std::string name;
+        std::vector<std::size_t> entries;
+        std::vector<std::size_t> appended;  // Entries added by set, written at insertAt
+        std::size_t insertAt;               // End of the last non-blank line in the section
+        std::size_t edit;                   // Pending edit holding appended entries, or npos
+        bool created;                       // Section did not exist in the file
+    };
+
+    struct Edit {
+        std::size_t begin, end;
+        std::string replacement;
+    };
+
+    std::string text;
+    std::vector<Entry> entries;
+    std::vector<Section> sections;
+    std::unordered_map<std::string, std::size_t> sectionIndex;
+    std::unordered_map<std::string, std::size_t> keyIndex;
+    std::vector<Edit> edits;
+    const char* newline = "\r\n";
+
+    void rebuildAppended(Section& s);
+};
@@ -1,5 +1,6 @@
 
 #include "log.h"
+#include "logring.h"
 
 #include <cstdarg>
 #include <cctype>
@@ -8,11 +9,57 @@
 #include "winheader.h"
 
 
+
+// Log lines are formatted on the calling thread and queued in a LogRing, which keeps lines from all threads
+// in the order they were queued. A writer thread drains the ring in batches; flush, overflow and shutdown
+// drain synchronously on the calling thread.
+
 namespace LOG {
 
+    static const DWORD WriterIdleMs = 20;
+
     static HANDLE handle = INVALID_HANDLE_VALUE;
+    static HANDLE writerThread = NULL, wakeEvent = NULL;
+    static volatile LONG running = 0;
+    static LPTOP_LEVEL_EXCEPTION_FILTER previousFilter = NULL;
+    static bool filterInstalled = false;
+
+    static thread_local char scratch[4096];
+
+    static void writeOut(const char* data, size_t sz);
+    static LogRing queue(writeOut);
+
+    static void stopWriter();
+    static DWORD WINAPI writerMain(void*);
+    static LONG WINAPI crashFilter(EXCEPTION_POINTERS* info);
 
 
+    // writeOut - Synchronous file write
+    void writeOut(const char* data, size_t sz) {
+        DWORD written;
+
+        if (handle != INVALID_HANDLE_VALUE && sz > 0) {
+            BOOL result = WriteFile(handle, data, (DWORD)sz, &written, NULL);
+
+            if (!result) {
+                char errormsg[512] = "\0";
+                FormatMessage(FORMAT_MESSAGE_FROM_SYSTEM, 0, GetLastError(), 0, errormsg, sizeof(errormsg), 0);
+                std::printf("LOG: write error: %s\n", errormsg);
+            }
+        }
+    }
+
+    // submit - Queue text, waking the writer once a batch is pending
+    static void submit(const char* text, size_t sz) {
+        if (handle == INVALID_HANDLE_VALUE) {
+            return;
+        }
+
+        if (queue.submit(text, sz) && wakeEvent) {
+            SetEvent(wakeEvent);
+        }
+    }
+
     bool open(const char* filename) {
         close();
         handle = CreateFile(filename, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
@@ -22,25 +69,39 @@ namespace LOG {
             FormatMessage(FORMAT_MESSAGE_FROM_SYSTEM, NULL, GetLastError(), 0, errormsg, sizeof(errormsg), NULL);
             std::printf("LOG: cannot open log file %s: %s\n", filename, errormsg);
             fflush(stdout);
+            return false;
+        }
+
+        // Start the writer; without it all writes stay synchronous
+        queue.reset();
+        wakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+        if (wakeEvent) {
+            running = 1;
+            queue.setQueueing(true);
+            writerThread = CreateThread(NULL, 0, writerMain, NULL, 0, NULL);
+            if (!writerThread) {
+                running = 0;
+                queue.setQueueing(false);
+                CloseHandle(wakeEvent);
+                wakeEvent = NULL;
+            }
+        }
+
+        if (!filterInstalled) {
+            previousFilter = SetUnhandledExceptionFilter(crashFilter);
+            filterInstalled = true;
         }
 
-        return handle != INVALID_HANDLE_VALUE;
+        return true;
     }
 
     std::size_t write(const char* str) {
         std::size_t sz = 0;
-        DWORD written;
 
         if (handle != INVALID_HANDLE_VALUE) {
             if (str) {
                 sz = std::strlen(str);
-                BOOL result = WriteFile(handle, str, (DWORD)sz, &written, NULL);
-
-                if (!result) {
-                    char errormsg[512] = "\0";
-                    FormatMessage(FORMAT_MESSAGE_FROM_SYSTEM, 0, GetLastError(), 0, errormsg, sizeof(errormsg), 0);
-                    std::printf("LOG: write error: %s\n", errormsg);
-                }
+                submit(str, sz);
             }
         }
 
@@ -48,41 +109,46 @@ namespace LOG {
     }
 
     std::size_t log(const char* fmt, ...) {
-        char buf[4096] = "\0";
-        std::size_t result = 0;
+        std::size_t result = 0, length;
 
         va_list args;
         va_start(args, fmt);
 
         if (fmt) {
-            result = std::vsnprintf(buf, sizeof(buf), fmt, args);
+            int n = std::vsnprintf(scratch, sizeof(scratch), fmt, args);
+            result = (n > 0) ? std::size_t(n) : 0;
+            length = (result < sizeof(scratch)) ? result : sizeof(scratch) - 1;
         } else {
             result = 4;
-            std::strcpy(buf, "LOG::log(null)\r\n");
+            std::strcpy(scratch, "LOG::log(null)\r\n");
+            length = std::strlen(scratch);
         }
 
-        LOG::write(buf);
+        submit(scratch, length);
 
         va_end(args);
         return result;
     }
 
     std::size_t logline(const char* fmt, ...) {
-        char buf[4096] = "\0";
-        std::size_t result = 0;
+        std::size_t result = 0, length;
 
         va_list args;
         va_start(args, fmt);
 
         if (fmt) {
-            result = std::vsnprintf(buf, sizeof(buf) - 4, fmt, args);
-            std::strcat(buf + result, "\r\n");
+            int n = std::vsnprintf(scratch, sizeof(scratch) - 4, fmt, args);
+            result = (n > 0) ? std::size_t(n) : 0;
+            length = (result < sizeof(scratch) - 4) ? result : sizeof(scratch) - 5;
+            std::strcpy(scratch + length, "\r\n");
+            length += 2;
         } else {
             result = 4;
-            std::strcpy(buf, "LOG::log(null)\r\n");
+            std::strcpy(scratch, "LOG::log(null)\r\n");
+            length = std::strlen(scratch);
         }
 
-        write(buf);
+        submit(scratch, length);
 
         va_end(args);
         return result;
@@ -117,16 +183,61 @@ namespace LOG {
         return sz;
     }
 
+    // flush - Synchronously write everything queued so far and flush the file
     void flush() {
+        queue.drainAll();
         FlushFileBuffers(handle);
     }
 
     void close() {
+        stopWriter();
+
         if (handle != INVALID_HANDLE_VALUE) {
+            queue.drainAll(1000);
             CloseHandle(handle);
         }
 
         handle = INVALID_HANDLE_VALUE;
     }
 
+    // stopWriter - Signal the writer to exit after a final drain. At process exit the thread
+    // has already been terminated, so the wait returns immediately.
+    void stopWriter() {
+        if (writerThread) {
+            InterlockedExchange(&running, 0);
+            queue.setQueueing(false);
+            SetEvent(wakeEvent);
+            WaitForSingleObject(writerThread, 1000);
+            CloseHandle(writerThread);
+            writerThread = NULL;
+        }
+        if (wakeEvent) {
+            CloseHandle(wakeEvent);
+            wakeEvent = NULL;
+        }
+    }
+
+    // writerMain - Drains the ring when woken by producers, or periodically to bound log latency
+    DWORD WINAPI writerMain(void*) {
+        while (running) {
+            WaitForSingleObject(wakeEvent, WriterIdleMs);
+            if (queue.pending()) {
+                queue.drainAll();
+            }
+        }
+
+        queue.drainAll();
+        return 0;
+    }
+
+    // crashFilter - Write out queued lines before the process dies, then defer to any previous filter
+    LONG WINAPI crashFilter(EXCEPTION_POINTERS* info) {
+        if (handle != INVALID_HANDLE_VALUE) {
+            queue.drainAll(250);
+            FlushFileBuffers(handle);
+        }
+
+        return previousFilter ? previousFilter(info) : EXCEPTION_CONTINUE_SEARCH;
+    }
+
 }
@@ -9,6 +9,6 @@ namespace LOG {
     std::size_t log(const char* fmt, ...);
     std::size_t logline(const char* fmt, ...);
     std::size_t logbinary(void* addr, std::size_t sz);
-    void flush();
+    void flush();                   // Synchronous, writes all queued lines
     void close();
 };
@@ -0,0 +1,168 @@
+
+#include "logring.h"
+
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+
+
+// Text written synchronously waits this long at most for slots reserved before it to be published.
+// Producers only copy text between reserving and publishing, so this only expires at process exit,
+// where a producer may have been terminated in between.
+static const unsigned int SyncOrderTimeoutMs = 1000;
+
+// backoff - Yield, then sleep, while spinning on another thread
+static void backoff(int spins) {
+    if (spins < 16) {
+        std::this_thread::yield();
+    } else {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+static unsigned int elapsedMs(std::chrono::steady_clock::time_point start) {
+    using namespace std::chrono;
+    return unsigned(duration_cast<milliseconds>(steady_clock::now() - start).count());
+}
+
+LogRing::LogRing(Sink sink) : sink(sink), head(0), tail(0), drainLock(false), queueing(false) {
+    reset();
+}
+
+void LogRing::reset() {
+    for (uint32_t i = 0; i != Slots; ++i) {
+        ring[i].sequence.store(0, std::memory_order_relaxed);
+    }
+    head.store(0, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_release);
+}
+
+void LogRing::setQueueing(bool enable) {
+    queueing.store(enable, std::memory_order_release);
+}
+
+// lockDrain - Spin lock for the consumer side. Returns false if the timeout expired.
+bool LogRing::lockDrain(unsigned int timeoutMs) {
+    auto start = std::chrono::steady_clock::now();
+
+    for (int spins = 0; drainLock.exchange(true, std::memory_order_acquire); ++spins) {
+        if (timeoutMs != NoTimeout && elapsedMs(start) >= timeoutMs) {
+            return false;
+        }
+        backoff(spins);
+    }
+    return true;
+}
+
+void LogRing::unlockDrain() {
+    drainLock.store(false, std::memory_order_release);
+}
+
+// drain - Write out contiguously published slots, up to the limit ticket. Slots are released only after
+// their batch has been written, so an interrupted drain repeats lines rather than losing them.
+void LogRing::drain(uint32_t limit) {
+    for (;;) {
+        uint32_t t = tail.load(std::memory_order_relaxed), end = t;
+        size_t n = 0;
+
+        for (; end != limit; ++end) {
+            const Slot& s = ring[end & (Slots - 1)];
+            if (s.sequence.load(std::memory_order_acquire) != end + 1) {
+                break;
+            }
+            if (n + s.length > sizeof(batch)) {
+                break;
+            }
+            std::memcpy(batch + n, s.text, s.length);
+            n += s.length;
+        }
+
+        if (end == t) {
+            return;
+        }
+
+        sink(batch, n);
+        tail.store(end, std::memory_order_release);
+    }
+}
+
+// enqueue - Copy text into the ring. Returns false if the text must be written synchronously.
+bool LogRing::enqueue(const char* text, size_t sz, bool* wake) {
+    uint32_t count = uint32_t((sz + SlotText - 1) / SlotText);
+    uint32_t ticket;
+
+    if (!queueing.load(std::memory_order_acquire) || sz > MaxQueuedSlots * SlotText) {
+        return false;
+    }
+
+    for (;;) {
+        ticket = head.load(std::memory_order_relaxed);
+        if (ticket - tail.load(std::memory_order_acquire) + count <= Slots) {
+            if (head.compare_exchange_weak(ticket, ticket + count, std::memory_order_relaxed)) {
+                break;
+            }
+            continue;
+        }
+
+        // Ring is full. Drain it on this thread instead of waiting, which also covers
+        // the writer not having started yet (threads do not run during DllMain).
+        lockDrain();
+        drain(head.load(std::memory_order_acquire));
+        unlockDrain();
+    }
+
+    // The first slot is published last, so a drain never stops partway through a line
+    for (uint32_t i = 0; i != count; ++i) {
+        Slot& s = ring[(ticket + i) & (Slots - 1)];
+        size_t n = (sz > SlotText) ? SlotText : sz;
+
+        std::memcpy(s.text, text, n);
+        s.length = uint32_t(n);
+        text += n;
+        sz -= n;
+        if (i != 0) {
+            s.sequence.store(ticket + i + 1, std::memory_order_release);
+        }
+    }
+    ring[ticket & (Slots - 1)].sequence.store(ticket + 1, std::memory_order_release);
+
+    uint32_t pending = ticket + count - tail.load(std::memory_order_acquire);
+    *wake = pending >= WakeThreshold && pending - count < WakeThreshold;
+    return true;
+}
+
+bool LogRing::submit(const char* text, size_t sz) {
+    bool wake = false;
+
+    if (sz == 0 || enqueue(text, sz, &wake)) {
+        return wake;
+    }
+
+    // Written in place, but only after every slot reserved before now has been written,
+    // including slots other threads have reserved and not yet published, to keep reservation order.
+    // Draining stops there, as later slots may hold the start of a line that is still being copied.
+    uint32_t reserved = head.load(std::memory_order_acquire);
+    auto start = std::chrono::steady_clock::now();
+
+    for (int spins = 0;; ++spins) {
+        lockDrain();
+        drain(reserved);
+        if (int32_t(tail.load(std::memory_order_relaxed) - reserved) >= 0 || elapsedMs(start) >= SyncOrderTimeoutMs) {
+            sink(text, sz);
+            unlockDrain();
+            return false;
+        }
+        unlockDrain();
+        backoff(spins);
+    }
+}
+
+bool LogRing::drainAll(unsigned int timeoutMs) {
+    bool locked = lockDrain(timeoutMs);
+    drain(head.load(std::memory_order_acquire));
+    if (locked) {
+        unlockDrain();
+    }
+    return locked;
+}
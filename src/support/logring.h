@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Ordered multi-producer queue of log text, written out in batches to a sink.
+// Text is copied into a fixed ring of slots. Producers reserve consecutive slots with a CAS on the head ticket,
+// so text from all threads is written in the order it was reserved. Anyone may drain while holding the drain lock,
+// which is how flush, overflow and shutdown stay synchronous. The sink is only called by the drain lock holder.
+class LogRing {
+public:
+    typedef void (*Sink)(const char* data, size_t sz);
+
+    static const uint32_t Slots = 1024;                 // Power of two
+    static const size_t SlotText = 120;
+    static const uint32_t WakeThreshold = Slots / 8;
+    static const uint32_t MaxQueuedSlots = Slots / 4;   // Longer text is written synchronously
+    static const unsigned int NoTimeout = ~0u;
+
+    explicit LogRing(Sink sink);
+
+    // reset - Empty the ring. No other thread may be using it.
+    void reset();
+
+    // setQueueing - While queueing is off, all text is written synchronously on the calling thread
+    void setQueueing(bool enable);
+
+    // submit - Queue text, or write it in order on this thread if it cannot be queued.
+    // Returns true when enough text is pending that the writer should be woken.
+    bool submit(const char* text, size_t sz);
+
+    // drainAll - Write out everything published so far. With a timeout, used on crash and exit paths where the
+    // lock holder may have been terminated, drains without the lock after it expires and returns false.
+    bool drainAll(unsigned int timeoutMs = NoTimeout);
+
+    bool pending() const { return head.load(std::memory_order_acquire) != tail.load(std::memory_order_acquire); }
+
+private:
+    struct Slot {
+        std::atomic<uint32_t> sequence;                 // ticket + 1 when published
+        uint32_t length;
+        char text[SlotText];
+    };
+
+    Sink sink;
+    std::atomic<uint32_t> head, tail;
+    std::atomic<bool> drainLock, queueing;
+    Slot ring[Slots];
+    char batch[65536];                                  // Only touched by the drain lock holder
+
+    bool enqueue(const char* text, size_t sz, bool* wake);
+    void drain(uint32_t limit);
+    bool lockDrain(unsigned int timeoutMs = NoTimeout);
+    void unlockDrain();
+};
@@ -0,0 +1,186 @@
+
+#include "loosefiles.h"
+
+#ifdef _WIN32
+#include "winheader.h"
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#include <cstring>
+
+
+
+// normalizePath - Lower case, backslash separated path with no repeated or leading separators
+bool normalizePath(const char* path, char* out, size_t outSize) {
+    size_t n = 0;
+
+    if (outSize == 0) {
+        return false;
+    }
+    for (const char* p = path; *p; ++p) {
+        char c = *p;
+        if (c == '/' || c == '\\') {
+            if (n == 0 || out[n - 1] == '\\') {
+                continue;
+            }
+            c = '\\';
+        } else if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        if (n + 1 >= outSize) {
+            return false;
+        }
+        out[n++] = c;
+    }
+    out[n] = 0;
+    return true;
+}
+
+#ifdef _WIN32
+
+// scanFolder - Windows backend, large fetch directory enumeration
+void scanFolder(const std::string& root, const std::string& relative, std::unordered_set<std::string>& files) {
+    WIN32_FIND_DATA data;
+    char name[MAX_PATH];
+    std::string pattern = root + relative + "\\*";
+
+    HANDLE h = FindFirstFileEx(pattern.c_str(), FindExInfoBasic, &data, FindExSearchNameMatch, 0, FIND_FIRST_EX_LARGE_FETCH);
+    if (h == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    do {
+        if (!normalizePath(data.cFileName, name, sizeof(name))) {
+            continue;
+        }
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            if (std::strcmp(name, ".") != 0 && std::strcmp(name, "..") != 0) {
+                scanFolder(root, relative + "\\" + name, files);
+            }
+        } else {
+            files.insert(relative + "\\" + name);
+        }
+    } while (FindNextFile(h, &data));
+
+    FindClose(h);
+}
+
+#else
+
+// scanDirectory - POSIX backend, readdir with stat where the file type is not reported
+// The on-disk path keeps original names, as the file system may be case sensitive.
+static void scanDirectory(const std::string& path, const std::string& relative, std::unordered_set<std::string>& files) {
+    char name[256];
+
+    DIR* dir = opendir(path.c_str());
+    if (!dir) {
+        return;
+    }
+
+    while (dirent* d = readdir(dir)) {
+        if (std::strcmp(d->d_name, ".") == 0 || std::strcmp(d->d_name, "..") == 0) {
+            continue;
+        }
+        if (!normalizePath(d->d_name, name, sizeof(name))) {
+            continue;
+        }
+
+        std::string child = path + "/" + d->d_name;
+        bool isDir = d->d_type == DT_DIR;
+        if (d->d_type == DT_UNKNOWN || d->d_type == DT_LNK) {
+            struct stat st;
+            isDir = stat(child.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+        }
+
+        if (isDir) {
+            scanDirectory(child, relative + "\\" + name, files);
+        } else {
+            files.insert(relative + "\\" + name);
+        }
+    }
+
+    closedir(dir);
+}
+
+// scanFolder - Translates separators for the POSIX backend
+void scanFolder(const std::string& root, const std::string& relative, std::unordered_set<std::string>& files) {
+    std::string path = root + relative;
+    for (char& c : path) {
+        if (c == '\\') {
+            c = '/';
+        }
+    }
+    scanDirectory(path, relative, files);
+}
+
+#endif
+
+
+
+// texturePaths - Normalized path with DDS extension substituted, and with the original extension
+bool texturePaths(const char* filename, char* ddsPath, char* originalPath, size_t size) {
+    // Leading separators of the name are dropped, as normalizing the joined path would
+    if (size < 10) {
+        return false;
+    }
+    std::memcpy(originalPath, "textures\\", 9);
+    if (!normalizePath(filename, originalPath + 9, size - 9) || std::strlen(originalPath) < 12) {
+        return false;
+    }
+    std::strcpy(ddsPath, originalPath);
+    std::strcpy(ddsPath + std::strlen(ddsPath) - 3, "dds");
+    return true;
+}
+
+LooseTextures::LooseTextures(const std::string& distantStaticsRoot, const std::string& dataFilesRoot) {
+    roots[DistantStatics] = distantStaticsRoot;
+    roots[DataFiles] = dataFilesRoot;
+}
+
+// refresh - Rebuild the snapshot if it is stale, returning true if it was rebuilt
+bool LooseTextures::refresh() {
+    if (!stale) {
+        return false;
+    }
+
+    for (int r = 0; r != RootCount; ++r) {
+        files[r].clear();
+        scanFolder(roots[r], "textures", files[r]);
+    }
+    missing.clear();
+    stale = false;
+    return true;
+}
+
+// resolve - Normalize a texture name, and find which loose roots hold each variant
+// Returns false if the name is invalid or is known to be missing from every source
+bool LooseTextures::resolve(const char* filename, LooseTextureRequest* request) const {
+    request->roots[0] = request->roots[1] = 0;
+    request->valid = texturePaths(filename, request->path[0], request->path[1], LooseTextureRequest::maxPath);
+    request->missing = request->valid && missing.find(request->path[1]) != missing.end();
+    if (!request->valid) {
+        request->path[0][0] = request->path[1][0] = 0;
+        return false;
+    }
+    if (request->missing) {
+        return false;
+    }
+
+    for (int v = 0; v != 2; ++v) {
+        for (int r = 0; r != RootCount; ++r) {
+            if (files[r].find(request->path[v]) != files[r].end()) {
+                request->roots[v] |= 1u << r;
+            }
+        }
+    }
+    return true;
+}
+
+// markMissing - Remember a request that no source could provide, until the next refresh
+void LooseTextures::markMissing(const LooseTextureRequest& request) {
+    if (request.valid) {
+        missing.insert(request.path[1]);
+    }
+}
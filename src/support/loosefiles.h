@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <unordered_set>
+
+// normalizePath - Lower case, backslash separated path with no repeated or leading separators
+// Returns false if the result does not fit in outSize, including the terminator.
+bool normalizePath(const char* path, char* out, size_t outSize);
+
+// scanFolder - Add all files below root + relative to a snapshot of loose files
+// Paths are normalized and relative to root, starting with relative. Both use backslash separators,
+// which are translated on platforms that need it. A missing folder adds nothing.
+void scanFolder(const std::string& root, const std::string& relative, std::unordered_set<std::string>& files);
+
+// texturePaths - Normalized path below textures\ of a texture name, with DDS extension substituted, and with the original
+// extension. Returns false for names too short to have an extension, or too long for size.
+bool texturePaths(const char* filename, char* ddsPath, char* originalPath, size_t size);
+
+// Texture request resolved against the loose file snapshot
+struct LooseTextureRequest {
+    static const size_t maxPath = 260;
+
+    char path[2][maxPath];      // DDS substituted, and original extension
+    unsigned int roots[2];      // Bit per LooseTextures::Root holding each path
+    bool valid, missing;
+
+    bool inRoot(int variant, int root) const { return (roots[variant] >> root) & 1; }
+};
+
+// Snapshot of loose files in the texture folders, so that resolving a texture makes no filesystem calls
+// Paths are normalized and relative to each root. Rebuilt on first use after invalidate, which also
+// forgets requests that no source could provide, as new files may have been added.
+struct LooseTextures {
+    enum Root { DistantStatics, DataFiles, RootCount };
+
+    std::string roots[RootCount];
+    std::unordered_set<std::string> files[RootCount];
+    std::unordered_set<std::string> missing;    // Original extension paths of requests no source could provide
+    bool stale = true;
+
+    LooseTextures(const std::string& distantStaticsRoot, const std::string& dataFilesRoot);
+
+    void invalidate() { stale = true; }
+    bool refresh();
+    bool resolve(const char* filename, LooseTextureRequest* request) const;
+    void markMissing(const LooseTextureRequest& request);
+};
@@ -0,0 +1,725 @@
+
+#include "pngencode.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <queue>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PNG_ENCODE_SSE2
+#endif
+
+
+
+// Slice-by-8 CRC32, as used by PNG chunks
+struct CRC32 {
+    struct Tables {
+        uint32_t t[8][256];
+
+        Tables() {
+            for (uint32_t n = 0; n < 256; n++) {
+                uint32_t c = n;
+                for (int k = 0; k < 8; k++) {
+                    c = (c & 1) ? (UINT32_C(0xEDB88320) ^ (c >> 1)) : (c >> 1);
+                }
+                t[0][n] = c;
+            }
+            for (uint32_t n = 0; n < 256; n++) {
+                for (int k = 1; k < 8; k++) {
+                    t[k][n] = (t[k - 1][n] >> 8) ^ t[0][t[k - 1][n] & 0xFF];
+                }
+            }
+        }
+    };
+
+    uint32_t crc;
+
+    CRC32() {
+        reset();
+    }
+
+    void reset() {
+        crc = UINT32_C(0xFFFFFFFF);
+    }
+
+    void update(const uint8_t* buffer, size_t length) {
+        const auto& t = tables().t;
+        uint32_t c = crc;
+
+        for (; length >= 8; buffer += 8, length -= 8) {
+            uint32_t lo, hi;
+            std::memcpy(&lo, buffer, 4);
+            std::memcpy(&hi, buffer + 4, 4);
+            lo ^= c;
+            c = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24]
+                ^ t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+        }
+        for (size_t n = 0; n < length; n++) {
+            c = t[0][(c ^ buffer[n]) & 0xFF] ^ (c >> 8);
+        }
+        crc = c;
+    }
+
+    uint32_t get() const {
+        return ~crc;
+    }
+
+    static const Tables& tables() {
+        static const Tables instance;
+        return instance;
+    }
+};
+
+// Adler-32 with the modulo deferred over the longest run that cannot overflow, summing 16 bytes at a time with SSE2 where available
+struct Adler {
+    static constexpr uint32_t mod_adler = 65521;
+    static constexpr size_t nmax = 5552;
+    uint32_t adler;
+
+    Adler() : adler(1) {}
+
+    void reset() {
+        adler = 1;
+    }
+
+    void update(const uint8_t* buffer, size_t length) {
+#ifdef PNG_ENCODE_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i weightsLo = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+        const __m128i weightsHi = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+#endif
+        uint32_t a = adler & 0xFFFF, b = adler >> 16;
+
+        while (length) {
+            size_t n = std::min(length, nmax);
+            length -= n;
+
+#ifdef PNG_ENCODE_SSE2
+            size_t blocks = n / 16;
+            if (blocks) {
+                // For each block, b gains 16 * (a before the block) plus the position weighted byte sum
+                __m128i s1 = zero, prefix = zero, s2 = zero;
+                for (size_t i = 0; i != blocks; ++i, buffer += 16) {
+                    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buffer));
+                    prefix = _mm_add_epi32(prefix, s1);
+                    s1 = _mm_add_epi32(s1, _mm_sad_epu8(x, zero));
+                    s2 = _mm_add_epi32(s2, _mm_madd_epi16(_mm_unpacklo_epi8(x, zero), weightsLo));
+                    s2 = _mm_add_epi32(s2, _mm_madd_epi16(_mm_unpackhi_epi8(x, zero), weightsHi));
+                }
+
+                uint64_t sum1 = horizontalSum(s1), sumPrefix = horizontalSum(prefix), sum2 = horizontalSum(s2);
+                b = uint32_t((b + 16 * uint64_t(blocks) * a + 16 * sumPrefix + sum2) % mod_adler);
+                a = uint32_t((a + sum1) % mod_adler);
+                n -= 16 * blocks;
+            }
+#endif
+
+            for (; n; --n) {
+                a += *buffer++;
+                b += a;
+            }
+            a %= mod_adler;
+            b %= mod_adler;
+        }
+        adler = (b << 16) | a;
+    }
+
+    uint32_t get() const {
+        return adler;
+    }
+
+#ifdef PNG_ENCODE_SSE2
+    static uint64_t horizontalSum(__m128i v) {
+        alignas(16) uint32_t lanes[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(lanes), v);
+        return uint64_t(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+    }
+#endif
+};
+
+static void writeUint32BE(uint8_t* dest, uint32_t x) {
+    dest[0] = uint8_t(x >> 24);
+    dest[1] = uint8_t(x >> 16);
+    dest[2] = uint8_t(x >> 8);
+    dest[3] = uint8_t(x >> 0);
+}
+
+
+
+// Fast single pass deflate encoder
+// Greedy LZ77 matching on a short hash chain, with dynamic Huffman blocks, or stored blocks where those are smaller
+class DeflateEncoder {
+public:
+    explicit DeflateEncoder(std::vector<uint8_t>& output) : out(output), bitBuffer(0), bitCount(0) {}
+
+    void compress(const uint8_t* data, size_t size);
+
+private:
+    static constexpr int windowSize = 32768;
+    static constexpr int hashBits = 15;
+    static constexpr int minMatch = 3, maxMatch = 258;
+    static constexpr int maxChain = 16, niceMatch = 128;
+    static constexpr size_t blockTokens = 65536;
+    static constexpr int litLenCodes = 286, distCodes = 30, codeLenCodes = 19;
+
+    struct Token {
+        uint16_t length;    // Literal byte value when distance is 0
+        uint16_t distance;
+    };
+
+    struct Tables {
+        uint8_t lengthCode[maxMatch + 1];
+        uint8_t distCode[windowSize + 1];
+        static const uint16_t lengthBase[29], distBase[30];
+        static const uint8_t lengthExtra[29], distExtra[30];
+
+        Tables() {
+            for (int c = 0; c != 29; ++c) {
+                for (int l = lengthBase[c]; l < lengthBase[c] + (1 << lengthExtra[c]) && l <= maxMatch; ++l) {
+                    lengthCode[l] = uint8_t(c);
+                }
+            }
+            for (int c = 0; c != 30; ++c) {
+                for (int d = distBase[c]; d < distBase[c] + (1 << distExtra[c]) && d <= windowSize; ++d) {
+                    distCode[d] = uint8_t(c);
+                }
+            }
+        }
+    };
+
+    std::vector<uint8_t>& out;
+    uint64_t bitBuffer;
+    int bitCount;
+    std::vector<Token> tokens;
+
+    static const Tables& tables() {
+        static const Tables instance;
+        return instance;
+    }
+
+    static uint32_t hash3(const uint8_t* p) {
+        uint32_t x = uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16);
+        return (x * UINT32_C(2654435761)) >> (32 - hashBits);
+    }
+
+    void putBits(uint32_t bits, int count) {
+        bitBuffer |= uint64_t(bits) << bitCount;
+        bitCount += count;
+        while (bitCount >= 32) {
+            uint8_t bytes[4] = { uint8_t(bitBuffer), uint8_t(bitBuffer >> 8), uint8_t(bitBuffer >> 16), uint8_t(bitBuffer >> 24) };
+            out.insert(out.end(), bytes, bytes + 4);
+            bitBuffer >>= 32;
+            bitCount -= 32;
+        }
+    }
+
+    void alignToByte() {
+        while (bitCount > 0) {
+            out.push_back(uint8_t(bitBuffer));
+            bitBuffer >>= 8;
+            bitCount = std::max(0, bitCount - 8);
+        }
+        bitBuffer = 0;
+    }
+
+    void flushBlock(const uint8_t* data, size_t start, size_t end, bool final);
+    void writeStored(const uint8_t* data, size_t start, size_t end, bool final);
+
+    static void buildLengths(const uint32_t* freq, int n, int maxBits, uint8_t* lengths);
+    static void buildCodes(const uint8_t* lengths, int n, uint16_t* codes);
+};
+
+const uint16_t DeflateEncoder::Tables::lengthBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+const uint8_t DeflateEncoder::Tables::lengthExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+const uint16_t DeflateEncoder::Tables::distBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+    1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+const uint8_t DeflateEncoder::Tables::distExtra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static inline int matchLength(const uint8_t* a, const uint8_t* b, int maxLength) {
+    int n = 0;
+    for (; n + 4 <= maxLength; n += 4) {
+        uint32_t x, y;
+        std::memcpy(&x, a + n, 4);
+        std::memcpy(&y, b + n, 4);
+        if (x != y) {
+            break;
+        }
+    }
+    while (n < maxLength && a[n] == b[n]) {
+        ++n;
+    }
+    return n;
+}
+
+// compress - Write a complete deflate stream for the data
+void DeflateEncoder::compress(const uint8_t* data, size_t size) {
+    const int32_t mask = windowSize - 1;
+    std::vector<int32_t> head(size_t(1) << hashBits, -1), prev(windowSize, -1);
+    size_t blockStart = 0, pos = 0;
+
+    tokens.clear();
+    tokens.reserve(blockTokens);
+
+    while (pos < size) {
+        int best = 0, bestDistance = 0;
+
+        if (pos + minMatch <= size) {
+            int32_t p = int32_t(pos);
+            int maxLength = int(std::min(size - pos, size_t(maxMatch)));
+            uint32_t h = hash3(data + pos);
+            int32_t candidate = head[h];
+
+            for (int chain = maxChain; candidate >= 0 && p - candidate <= windowSize && chain; --chain) {
+                if (data[candidate + best] == data[pos + best]) {
+                    int length = matchLength(data + candidate, data + pos, maxLength);
+                    if (length > best) {
+                        best = length;
+                        bestDistance = p - candidate;
+                        if (length >= niceMatch || length == maxLength) {
+                            break;
+                        }
+                    }
+                }
+                int32_t next = prev[candidate & mask];
+                if (next >= candidate) {
+                    break;
+                }
+                candidate = next;
+            }
+
+            prev[p & mask] = head[h];
+            head[h] = p;
+        }
+
+        if (best >= minMatch) {
+            tokens.push_back({ uint16_t(best), uint16_t(bestDistance) });
+            for (size_t i = pos + 1, e = std::min(pos + best, size - minMatch + 1); i < e; ++i) {
+                uint32_t h = hash3(data + i);
+                prev[i & mask] = head[h];
+                head[h] = int32_t(i);
+            }
+            pos += best;
+        } else {
+            tokens.push_back({ data[pos], 0 });
+            ++pos;
+        }
+
+        if (tokens.size() == blockTokens) {
+            flushBlock(data, blockStart, pos, pos == size);
+            blockStart = pos;
+            tokens.clear();
+        }
+    }
+
+    if (!tokens.empty() || blockStart == 0) {
+        flushBlock(data, blockStart, pos, true);
+    }
+    alignToByte();
+}
+
+// flushBlock - Encode the pending tokens covering data[start, end)
+void DeflateEncoder::flushBlock(const uint8_t* data, size_t start, size_t end, bool final) {
+    static const uint8_t codeLenOrder[codeLenCodes] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    const Tables& t = tables();
+    uint32_t litFreq[litLenCodes] = {}, distFreq[distCodes] = {};
+    uint64_t extraBits = 0;
+
+    for (const Token& k : tokens) {
+        if (k.distance == 0) {
+            litFreq[k.length]++;
+        } else {
+            int lc = t.lengthCode[k.length], dc = t.distCode[k.distance];
+            litFreq[257 + lc]++;
+            distFreq[dc]++;
+            extraBits += Tables::lengthExtra[lc] + Tables::distExtra[dc];
+        }
+    }
+    litFreq[256] = 1;
+
+    // Code lengths. Each tree is given at least two codes so that every decoder accepts it.
+    uint8_t lengths[litLenCodes + distCodes] = {};
+    uint8_t* litLengths = lengths;
+    uint8_t* distLengths = lengths + litLenCodes;
+    uint32_t litBuild[litLenCodes], distBuild[distCodes];
+    std::copy(litFreq, litFreq + litLenCodes, litBuild);
+    std::copy(distFreq, distFreq + distCodes, distBuild);
+    while (std::count_if(litBuild, litBuild + litLenCodes, [](uint32_t f) { return f != 0; }) < 2) {
+        litBuild[litBuild[0] ? 1 : 0] = 1;
+    }
+    while (std::count_if(distBuild, distBuild + distCodes, [](uint32_t f) { return f != 0; }) < 2) {
+        distBuild[distBuild[0] ? 1 : 0] = 1;
+    }
+    buildLengths(litBuild, litLenCodes, 15, litLengths);
+    buildLengths(distBuild, distCodes, 15, distLengths);
+
+    int numLit = litLenCodes, numDist = distCodes;
+    while (numLit > 257 && litLengths[numLit - 1] == 0) {
+        --numLit;
+    }
+    while (numDist > 1 && distLengths[numDist - 1] == 0) {
+        --numDist;
+    }
+
+    // Run length encode both code length sets as one sequence
+    uint8_t sequence[litLenCodes + distCodes];
+    std::copy(litLengths, litLengths + numLit, sequence);
+    std::copy(distLengths, distLengths + numDist, sequence + numLit);
+    int sequenceLength = numLit + numDist;
+
+    std::vector<std::pair<uint8_t, uint8_t>> rle;
+    uint32_t codeLenFreq[codeLenCodes] = {};
+    for (int i = 0; i < sequenceLength;) {
+        uint8_t len = sequence[i];
+        int run = 1;
+        while (i + run < sequenceLength && sequence[i + run] == len) {
+            ++run;
+        }
+        i += run;
+
+        if (len == 0) {
+            while (run >= 11) {
+                int r = std::min(run, 138);
+                rle.push_back({ 18, uint8_t(r - 11) });
+                run -= r;
+            }
+            if (run >= 3) {
+                rle.push_back({ 17, uint8_t(run - 3) });
+                run = 0;
+            }
+        } else {
+            rle.push_back({ len, 0 });
+            --run;
+            while (run >= 3) {
+                int r = std::min(run, 6);
+                rle.push_back({ 16, uint8_t(r - 3) });
+                run -= r;
+            }
+        }
+        for (; run > 0; --run) {
+            rle.push_back({ len, 0 });
+        }
+    }
+    for (const auto& r : rle) {
+        codeLenFreq[r.first]++;
+    }
+
+    uint8_t codeLenLengths[codeLenCodes] = {};
+    uint32_t codeLenBuild[codeLenCodes];
+    std::copy(codeLenFreq, codeLenFreq + codeLenCodes, codeLenBuild);
+    while (std::count_if(codeLenBuild, codeLenBuild + codeLenCodes, [](uint32_t f) { return f != 0; }) < 2) {
+        codeLenBuild[codeLenBuild[0] ? 1 : 0] = 1;
+    }
+    buildLengths(codeLenBuild, codeLenCodes, 7, codeLenLengths);
+    int numCodeLen = codeLenCodes;
+    while (numCodeLen > 4 && codeLenLengths[codeLenOrder[numCodeLen - 1]] == 0) {
+        --numCodeLen;
+    }
+
+    // Compare against storing the block as is
+    uint64_t dynamicBits = 3 + 14 + 3 * numCodeLen + extraBits;
+    for (int i = 0; i != codeLenCodes; ++i) {
+        dynamicBits += uint64_t(codeLenFreq[i]) * codeLenLengths[i];
+    }
+    dynamicBits += 2 * codeLenFreq[16] + 3 * codeLenFreq[17] + 7 * codeLenFreq[18];
+    for (int i = 0; i != litLenCodes; ++i) {
+        dynamicBits += uint64_t(litFreq[i]) * litLengths[i];
+    }
+    for (int i = 0; i != distCodes; ++i) {
+        dynamicBits += uint64_t(distFreq[i]) * distLengths[i];
+    }
+    uint64_t storedBits = 8 * uint64_t(end - start) + 40 * ((end - start) / 65535 + 1) + 10;
+
+    if (storedBits <= dynamicBits) {
+        writeStored(data, start, end, final);
+        return;
+    }
+
+    uint16_t litCodes[litLenCodes], distCodesOut[distCodes], codeLenCodesOut[codeLenCodes];
+    buildCodes(litLengths, litLenCodes, litCodes);
+    buildCodes(distLengths, distCodes, distCodesOut);
+    buildCodes(codeLenLengths, codeLenCodes, codeLenCodesOut);
+
+    putBits(final ? 1 : 0, 1);
+    putBits(2, 2);
+    putBits(numLit - 257, 5);
+    putBits(numDist - 1, 5);
+    putBits(numCodeLen - 4, 4);
+    for (int i = 0; i != numCodeLen; ++i) {
+        putBits(codeLenLengths[codeLenOrder[i]], 3);
+    }
+    for (const auto& r : rle) {
+        putBits(codeLenCodesOut[r.first], codeLenLengths[r.first]);
+        if (r.first == 16) {
+            putBits(r.second, 2);
+        } else if (r.first == 17) {
+            putBits(r.second, 3);
+        } else if (r.first == 18) {
+            putBits(r.second, 7);
+        }
+    }
+
+    for (const Token& k : tokens) {
+        if (k.distance == 0) {
+            putBits(litCodes[k.length], litLengths[k.length]);
+        } else {
+            int lc = t.lengthCode[k.length], dc = t.distCode[k.distance];
+            putBits(litCodes[257 + lc], litLengths[257 + lc]);
+            putBits(k.length - Tables::lengthBase[lc], Tables::lengthExtra[lc]);
+            putBits(distCodesOut[dc], distLengths[dc]);
+            putBits(k.distance - Tables::distBase[dc], Tables::distExtra[dc]);
+        }
+    }
+    putBits(litCodes[256], litLengths[256]);
+}
+
+// writeStored - Write data[start, end) as uncompressed blocks
+void DeflateEncoder::writeStored(const uint8_t* data, size_t start, size_t end, bool final) {
+    do {
+        size_t length = std::min(end - start, size_t(0xFFFF));
+        bool last = start + length == end;
+
+        putBits((final && last) ? 1 : 0, 1);
+        putBits(0, 2);
+        alignToByte();
+
+        uint8_t header[4] = { uint8_t(length), uint8_t(length >> 8), uint8_t(~length), uint8_t(~length >> 8) };
+        out.insert(out.end(), header, header + 4);
+        out.insert(out.end(), data + start, data + start + length);
+        start += length;
+    } while (start != end);
+}
+
+// buildLengths - Huffman code lengths limited to maxBits, zero for unused symbols
+void DeflateEncoder::buildLengths(const uint32_t* freq, int n, int maxBits, uint8_t* lengths) {
+    typedef std::pair<uint64_t, int> Item;
+    std::priority_queue<Item, std::vector<Item>, std::greater<Item>> queue;
+    std::vector<int> parent, symbols;
+
+    std::fill(lengths, lengths + n, 0);
+    for (int i = 0; i != n; ++i) {
+        if (freq[i]) {
+            queue.push({ freq[i], int(parent.size()) });
+            parent.push_back(-1);
+            symbols.push_back(i);
+        }
+    }
+    if (symbols.size() < 2) {
+        if (!symbols.empty()) {
+            lengths[symbols[0]] = 1;
+        }
+        return;
+    }
+
+    while (queue.size() > 1) {
+        Item a = queue.top();
+        queue.pop();
+        Item b = queue.top();
+        queue.pop();
+        int node = int(parent.size());
+        parent.push_back(-1);
+        parent[a.second] = node;
+        parent[b.second] = node;
+        queue.push({ a.first + b.first, node });
+    }
+
+    // Parents are created after their children, so depths resolve walking back from the root
+    std::vector<int> depth(parent.size(), 0);
+    for (int i = int(parent.size()) - 2; i >= 0; --i) {
+        depth[i] = depth[parent[i]] + 1;
+    }
+
+    // Move over-long codes up to the limit, then lengthen shorter codes until the code is complete again
+    int count[64] = {};
+    for (size_t i = 0; i != symbols.size(); ++i) {
+        count[std::min(depth[i], 63)]++;
+    }
+    for (int i = maxBits + 1; i < 64; ++i) {
+        count[maxBits] += count[i];
+        count[i] = 0;
+    }
+    uint32_t total = 0;
+    for (int i = maxBits; i > 0; --i) {
+        total += uint32_t(count[i]) << (maxBits - i);
+    }
+    while (total != (1u << maxBits)) {
+        count[maxBits]--;
+        for (int i = maxBits - 1; i > 0; --i) {
+            if (count[i]) {
+                count[i]--;
+                count[i + 1] += 2;
+                break;
+            }
+        }
+        total--;
+    }
+
+    // Longest codes go to the least frequent symbols
+    std::stable_sort(symbols.begin(), symbols.end(), [freq](int a, int b) { return freq[a] < freq[b]; });
+    size_t next = 0;
+    for (int len = maxBits; len > 0; --len) {
+        for (int k = 0; k != count[len]; ++k) {
+            lengths[symbols[next++]] = uint8_t(len);
+        }
+    }
+}
+
+// buildCodes - Canonical Huffman codes, bit reversed for LSB first output
+void DeflateEncoder::buildCodes(const uint8_t* lengths, int n, uint16_t* codes) {
+    uint16_t count[16] = {}, next[16] = {};
+    for (int i = 0; i != n; ++i) {
+        count[lengths[i]]++;
+    }
+    count[0] = 0;
+
+    uint16_t code = 0;
+    for (int bits = 1; bits < 16; ++bits) {
+        code = uint16_t((code + count[bits - 1]) << 1);
+        next[bits] = code;
+    }
+
+    for (int i = 0; i != n; ++i) {
+        int len = lengths[i];
+        codes[i] = 0;
+        if (len) {
+            uint16_t c = next[len]++, r = 0;
+            for (int b = 0; b != len; ++b) {
+                r = uint16_t((r << 1) | ((c >> b) & 1));
+            }
+            codes[i] = r;
+        }
+    }
+}
+
+
+
+// filterRow - Apply the PNG filter with the smallest sum of absolute signed residuals, a standard heuristic
+static void filterRow(const uint8_t* cur, const uint8_t* prev, size_t rowBytes, uint8_t* out) {
+    const size_t bpp = 3;
+    uint32_t cost[5] = {};
+
+    for (size_t i = 0; i != rowBytes; ++i) {
+        int x = cur[i], a = i >= bpp ? cur[i - bpp] : 0, b = prev[i], c = i >= bpp ? prev[i - bpp] : 0;
+        int p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+        int paeth = (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+
+        cost[0] += std::abs(int(int8_t(x)));
+        cost[1] += std::abs(int(int8_t(x - a)));
+        cost[2] += std::abs(int(int8_t(x - b)));
+        cost[3] += std::abs(int(int8_t(x - ((a + b) >> 1))));
+        cost[4] += std::abs(int(int8_t(x - paeth)));
+    }
+
+    int filter = int(std::min_element(cost, cost + 5) - cost);
+    *out++ = uint8_t(filter);
+
+    for (size_t i = 0; i != rowBytes; ++i) {
+        int x = cur[i], a = i >= bpp ? cur[i - bpp] : 0, b = prev[i], c = i >= bpp ? prev[i - bpp] : 0;
+        int predict = 0;
+
+        switch (filter) {
+        case 1:
+            predict = a;
+            break;
+        case 2:
+            predict = b;
+            break;
+        case 3:
+            predict = (a + b) >> 1;
+            break;
+        case 4: {
+            int p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+            predict = (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+            break;
+        }
+        }
+        out[i] = uint8_t(x - predict);
+    }
+}
+
+// appendChunk - Append a PNG chunk with its length and CRC
+static void appendChunk(std::vector<uint8_t>& png, const char* type, const uint8_t* data, size_t size) {
+    uint8_t header[8], footer[4];
+    CRC32 crc;
+
+    writeUint32BE(header, uint32_t(size));
+    std::memcpy(header + 4, type, 4);
+    crc.update(header + 4, 4);
+    crc.update(data, size);
+    writeUint32BE(footer, crc.get());
+
+    png.insert(png.end(), header, header + 8);
+    png.insert(png.end(), data, data + size);
+    png.insert(png.end(), footer, footer + 4);
+}
+
+const std::array<uint8_t, 0x8> PNGheader = { 0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A };
+
+
+// pngEncodeBGRA - PNG encoder with per-row filtering and deflate compression. Accepts BGRA data but does not save alpha.
+bool pngEncodeBGRA(const void* imageData, unsigned int width, unsigned int height, unsigned int stride, std::vector<uint8_t>& png) {
+    size_t rowBytes = 3 * size_t(width);
+
+    if (width == 0 || height == 0) {
+        return false;
+    }
+
+    // Convert BGRA -> RGB and filter one scanline at a time.
+    std::vector<uint8_t> filtered((rowBytes + 1) * height);
+    std::vector<uint8_t> rows[2] = { std::vector<uint8_t>(rowBytes, 0), std::vector<uint8_t>(rowBytes, 0) };
+
+    auto pScanline = reinterpret_cast<const uint8_t*>(imageData);
+    for (unsigned int y = 0; y < height; y++, pScanline += stride) {
+        auto& cur = rows[y & 1];
+        auto& prev = rows[(y & 1) ^ 1];
+        auto p = pScanline;
+        auto it = cur.begin();
+
+        for (unsigned int x = 0; x < width; x++, p += 4) {
+            *it++ = p[2];
+            *it++ = p[1];
+            *it++ = p[0];
+        }
+        filterRow(cur.data(), prev.data(), rowBytes, &filtered[(rowBytes + 1) * y]);
+    }
+
+    // zlib stream: header for a 32KB window, deflate data, then Adler-32 of the filtered image.
+    std::vector<uint8_t> zlib;
+    zlib.reserve(filtered.size() / 2 + 64);
+    zlib.push_back(0x78);
+    zlib.push_back(0x01);
+
+    DeflateEncoder deflate(zlib);
+    deflate.compress(filtered.data(), filtered.size());
+
+    Adler adler;
+    adler.update(filtered.data(), filtered.size());
+    zlib.resize(zlib.size() + 4);
+    writeUint32BE(&zlib[zlib.size() - 4], adler.get());
+
+    filtered = std::vector<uint8_t>();
+
+    uint8_t IHDR[13] = { 0, 0, 0, 0, 0, 0, 0, 0, 8, 2, 0, 0, 0 };
+    writeUint32BE(&IHDR[0], width);
+    writeUint32BE(&IHDR[4], height);
+
+    png.clear();
+    png.reserve(PNGheader.size() + zlib.size() + 64);
+    png.insert(png.end(), PNGheader.begin(), PNGheader.end());
+    appendChunk(png, "IHDR", IHDR, sizeof(IHDR));
+    appendChunk(png, "IDAT", zlib.data(), zlib.size());
+    appendChunk(png, "IEND", nullptr, 0);
+    return true;
+}
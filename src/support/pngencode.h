@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// pngEncodeBGRA - PNG encoder with per-row filtering and deflate compression. Accepts BGRA data but does not save alpha.
+// Portable, so that offline tools can share it.
+bool pngEncodeBGRA(const void* data, unsigned int width, unsigned int height, unsigned int stride, std::vector<uint8_t>& png);
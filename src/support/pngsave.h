@@ -1,4 +1,12 @@
 #pragma once
 
-// pngSaveBGRA - Non-compressing PNG encoder. Accepts BGRA data but does not save alpha.
+// pngSaveBGRA - PNG encoder with per-row filtering and deflate compression. Accepts BGRA data but does not save alpha.
 bool pngSaveBGRA(const char* path, const void* data, unsigned int width, unsigned int height, unsigned int stride);
+
+// File formats that can be saved without D3DX, and so off the render thread
+enum struct ImageFileFormat {
+    PNG, BMP, TGA, DDS
+};
+
+// imageSaveBGRA - Encode BGRA data without alpha, and write it to a new file
+bool imageSaveBGRA(const char* path, ImageFileFormat format, const void* data, unsigned int width, unsigned int height, unsigned int stride);
@@ -0,0 +1,46 @@
+
+#include "profilestats.h"
+
+#include <algorithm>
+
+
+
+void RollingStats::add(float x) {
+    samples[next] = x;
+    next = (next + 1) % window;
+    if (count < window) {
+        ++count;
+    }
+}
+
+void RollingStats::clear() {
+    next = count = 0;
+}
+
+float RollingStats::last() const {
+    return count ? samples[(next + window - 1) % window] : 0.0f;
+}
+
+// summarise - Statistics over the window. p99 is the nearest-rank percentile, at most the max.
+RollingStats::Summary RollingStats::summarise() const {
+    Summary s = { 0, 0, 0, 0, count };
+    if (count == 0) {
+        return s;
+    }
+
+    float sorted[window];
+    double sum = 0;
+    std::copy(samples, samples + count, sorted);
+    s.min = s.max = sorted[0];
+    for (int i = 0; i != count; ++i) {
+        sum += sorted[i];
+        s.min = std::min(s.min, sorted[i]);
+        s.max = std::max(s.max, sorted[i]);
+    }
+    s.avg = float(sum / count);
+
+    int rank = (99 * count + 99) / 100 - 1;
+    std::nth_element(sorted, sorted + rank, sorted + count);
+    s.p99 = sorted[rank];
+    return s;
+}
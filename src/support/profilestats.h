@@ -0,0 +1,22 @@
+#pragma once
+
+// Rolling window of per-frame timings for one profiled zone, summarised on demand.
+// Portable, so that the aggregation can be exercised outside the game.
+class RollingStats {
+public:
+    static const int window = 256;
+
+    struct Summary {
+        float min, avg, max, p99;
+        int samples;
+    };
+
+    void add(float x);
+    void clear();
+    float last() const;
+    Summary summarise() const;
+
+private:
+    float samples[window];
+    int next = 0, count = 0;
+};
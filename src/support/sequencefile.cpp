@@ -0,0 +1,101 @@
+
+#include "sequencefile.h"
+
+
+
+// create - Create a new file, failing if it already exists
+bool SequenceWriter::create(const char* path) {
+    close();
+
+    file = std::fopen(path, "wbx");
+    if (!file) {
+        return false;
+    }
+
+    // Size is filled in when the header is rewritten on close
+    SequenceFileHeader header = { sequenceFileMagic, sequenceFileVersion, 0, 0, 0, 0 };
+    framesWritten = 0;
+    if (std::fwrite(&header, sizeof(header), 1, file) != 1) {
+        std::fclose(file);
+        file = nullptr;
+        std::remove(path);
+        return false;
+    }
+    return true;
+}
+
+// close - Write the final header and close the file
+bool SequenceWriter::close() {
+    if (!file) {
+        return false;
+    }
+
+    SequenceFileHeader header = { sequenceFileMagic, sequenceFileVersion, frameWidth, frameHeight, framesWritten, 0 };
+    bool success = std::fseek(file, 0, SEEK_SET) == 0 && std::fwrite(&header, sizeof(header), 1, file) == 1;
+    success = std::fclose(file) == 0 && success;
+    file = nullptr;
+    return success;
+}
+
+// writeFrame - Append one frame of BGRA pixels with a row pitch; fails if the size does not match
+bool SequenceWriter::writeFrame(uint32_t index, int64_t timestamp, const void* pixels, uint32_t width, uint32_t height, uint32_t pitch) {
+    SequenceFrameHeader header = { index, 0, timestamp };
+    const uint8_t* row = reinterpret_cast<const uint8_t*>(pixels);
+    size_t rowBytes = 4 * size_t(width);
+
+    if (!file || width != frameWidth || height != frameHeight) {
+        return false;
+    }
+
+    bool success = std::fwrite(&header, sizeof(header), 1, file) == 1;
+    if (pitch == rowBytes) {
+        success = success && std::fwrite(row, rowBytes * height, 1, file) == 1;
+    } else {
+        for (uint32_t y = 0; success && y != height; ++y, row += pitch) {
+            success = std::fwrite(row, rowBytes, 1, file) == 1;
+        }
+    }
+    if (success) {
+        ++framesWritten;
+    }
+    return success;
+}
+
+SequenceReader::Status SequenceReader::open(const char* path) {
+    close();
+
+    file = std::fopen(path, "rb");
+    if (!file) {
+        return CannotOpen;
+    }
+    if (std::fread(&fileHeader, sizeof(fileHeader), 1, file) != 1 || fileHeader.magic != sequenceFileMagic) {
+        return NotSequence;
+    }
+    if (fileHeader.version != sequenceFileVersion) {
+        return UnsupportedVersion;
+    }
+    if (fileHeader.width == 0 || fileHeader.height == 0 || fileHeader.width > 16384 || fileHeader.height > 16384) {
+        return NoFrames;
+    }
+    return Ok;
+}
+
+void SequenceReader::close() {
+    if (file) {
+        std::fclose(file);
+        file = nullptr;
+    }
+}
+
+// next - Read the next frame, with tightly packed rows
+SequenceReader::FrameStatus SequenceReader::next(SequenceFrameHeader& frame, std::vector<uint8_t>& pixels) {
+    if (!file || std::fread(&frame, sizeof(frame), 1, file) != 1) {
+        return End;
+    }
+
+    pixels.resize(frameBytes());
+    if (std::fread(pixels.data(), 1, pixels.size(), file) != pixels.size()) {
+        return Truncated;
+    }
+    return Frame;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// Raw frame sequence file, written during capture and encoded to images afterwards
+// Layout: SequenceFileHeader, then frames in completion order, each a SequenceFrameHeader
+// followed by height rows of width * 4 bytes of BGRA pixels. All fields are little endian.
+const uint32_t sequenceFileMagic = 0x5153474D;   // 'MGSQ'
+const uint32_t sequenceFileVersion = 1;
+
+#pragma pack(push, 4)
+struct SequenceFileHeader {
+    uint32_t magic, version;
+    uint32_t width, height;
+    uint32_t frameCount;        // Written when the sequence is closed, zero if capture did not finish cleanly
+    uint32_t reserved;
+};
+
+struct SequenceFrameHeader {
+    uint32_t index;             // Capture order, frames may be stored out of order
+    uint32_t reserved;
+    int64_t timestamp;          // Microseconds since the first frame was captured
+};
+#pragma pack(pop)
+
+static_assert(sizeof(SequenceFileHeader) == 24, "Sequence file header layout");
+static_assert(sizeof(SequenceFrameHeader) == 16, "Sequence frame header layout");
+
+// Sequence file writer. Not thread safe, callers serialise frames.
+// The frame size is set before the first frame; the header is rewritten with the frame count on close.
+class SequenceWriter {
+    FILE* file;
+    uint32_t frameWidth, frameHeight, framesWritten;
+
+public:
+    SequenceWriter() : file(nullptr), frameWidth(0), frameHeight(0), framesWritten(0) {}
+    SequenceWriter(const SequenceWriter&) = delete;
+    SequenceWriter& operator=(const SequenceWriter&) = delete;
+    ~SequenceWriter() { close(); }
+
+    // create - Create a new file, failing if it already exists
+    bool create(const char* path);
+    bool close();
+    bool isOpen() const { return file != nullptr; }
+
+    void setSize(uint32_t width, uint32_t height) { frameWidth = width; frameHeight = height; }
+    uint32_t width() const { return frameWidth; }
+    uint32_t height() const { return frameHeight; }
+    uint32_t frames() const { return framesWritten; }
+
+    // writeFrame - Append one frame of BGRA pixels with a row pitch; fails if the size does not match
+    bool writeFrame(uint32_t index, int64_t timestamp, const void* pixels, uint32_t width, uint32_t height, uint32_t pitch);
+};
+
+// Sequence file reader, returning frames in file order
+class SequenceReader {
+    FILE* file;
+    SequenceFileHeader fileHeader;
+
+public:
+    enum Status { Ok, CannotOpen, NotSequence, UnsupportedVersion, NoFrames };
+    enum FrameStatus { Frame, End, Truncated };
+
+    SequenceReader() : file(nullptr), fileHeader() {}
+    SequenceReader(const SequenceReader&) = delete;
+    SequenceReader& operator=(const SequenceReader&) = delete;
+    ~SequenceReader() { close(); }
+
+    Status open(const char* path);
+    void close();
+
+    const SequenceFileHeader& header() const { return fileHeader; }
+    bool closedCleanly() const { return fileHeader.frameCount != 0; }
+    size_t frameBytes() const { return size_t(fileHeader.width) * fileHeader.height * 4; }
+
+    // next - Read the next frame, with tightly packed rows
+    FrameStatus next(SequenceFrameHeader& frame, std::vector<uint8_t>& pixels);
+};
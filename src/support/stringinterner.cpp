@@ -0,0 +1,90 @@
+
+#include "stringinterner.h"
+
+#include <cstring>
+
+
+
+// hash - FNV-1a, also measuring the string
+uint32_t StringInterner::hash(const char* s, std::size_t& length) {
+    uint32_t h = 2166136261u;
+    const char* p = s;
+
+    for (; *p; ++p) {
+        h = (h ^ uint8_t(*p)) * 16777619u;
+    }
+    length = std::size_t(p - s);
+    return h;
+}
+
+// probe - Slot holding the string, or the empty slot where it would be inserted
+std::size_t StringInterner::probe(const char* s, std::size_t length, uint32_t h) const {
+    std::size_t mask = slots.size() - 1;
+
+    for (std::size_t i = h & mask; ; i = (i + 1) & mask) {
+        int id = slots[i];
+        if (id == invalid_id) {
+            return i;
+        }
+        if (hashes[id] == h && names[id].size() == length && std::memcmp(names[id].data(), s, length) == 0) {
+            return i;
+        }
+    }
+}
+
+// find - ID of a previously interned string, or invalid_id
+int StringInterner::find(const char* s) const {
+    if (slots.empty()) {
+        return invalid_id;
+    }
+
+    std::size_t length;
+    uint32_t h = hash(s, length);
+    return slots[probe(s, length, h)];
+}
+
+// intern - ID of a string, assigning the next ID if it has not been seen
+int StringInterner::intern(const char* s) {
+    std::size_t length;
+    uint32_t h = hash(s, length);
+
+    if (!slots.empty()) {
+        int id = slots[probe(s, length, h)];
+        if (id != invalid_id) {
+            return id;
+        }
+    }
+
+    // Keep load at or below 1/2, growing only when a new name is added
+    if ((names.size() + 1) * 2 > slots.size()) {
+        grow();
+    }
+
+    std::size_t i = probe(s, length, h);
+    slots[i] = int(names.size());
+    names.emplace_back(s, length);
+    hashes.push_back(h);
+    return slots[i];
+}
+
+// grow - Double the table and reinsert IDs using their stored hashes
+void StringInterner::grow() {
+    std::size_t n = slots.empty() ? 64 : slots.size() * 2;
+    std::size_t mask = n - 1;
+
+    slots.assign(n, invalid_id);
+    for (int id = 0; id != int(names.size()); ++id) {
+        std::size_t i = hashes[id] & mask;
+        while (slots[i] != invalid_id) {
+            i = (i + 1) & mask;
+        }
+        slots[i] = id;
+    }
+}
+
+// clear - Forget all names, invalidating every ID handed out so far
+void StringInterner::clear() {
+    names.clear();
+    hashes.clear();
+    slots.clear();
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+// Maps distinct strings to small integer IDs, so that per-name data can live in directly indexed arrays.
+// IDs are assigned in order from 0 and stay valid until clear(); names are case-sensitive.
+// Interning a name that was seen before allocates nothing, so load/free cycles on the same names do not grow the table.
+class StringInterner {
+public:
+    static constexpr int invalid_id = -1;
+
+    int intern(const char* s);
+    int find(const char* s) const;
+    const char* name(int id) const { return names[id].c_str(); }
+    int size() const { return int(names.size()); }
+    void clear();
+
+private:
+    std::deque<std::string> names;      // By ID, deque keeps name() pointers stable
+    std::vector<uint32_t> hashes;       // By ID
+    std::vector<int> slots;             // Open addressed table of IDs, power of two size
+
+    static uint32_t hash(const char* s, std::size_t& length);
+    std::size_t probe(const char* s, std::size_t length, uint32_t h) const;
+    void grow();
+};
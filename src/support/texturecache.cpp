@@ -0,0 +1,51 @@
+
+#include "texturecache.h"
+
+
+
+static constexpr uint32_t fourCC(char a, char b, char c, char d) {
+    return uint32_t(uint8_t(a)) | (uint32_t(uint8_t(b)) << 8) | (uint32_t(uint8_t(c)) << 16) | (uint32_t(uint8_t(d)) << 24);
+}
+
+// D3DFORMAT codes with other than 32 bits per pixel
+static constexpr uint32_t FormatR5G6B5 = 23;    // D3DFMT_R5G6B5
+static constexpr uint32_t FormatX1R5G5B5 = 24;  // D3DFMT_X1R5G5B5
+static constexpr uint32_t FormatA1R5G5B5 = 25;  // D3DFMT_A1R5G5B5
+static constexpr uint32_t FormatA4R4G4B4 = 26;  // D3DFMT_A4R4G4B4
+static constexpr uint32_t FormatA8 = 28;        // D3DFMT_A8
+static constexpr uint32_t FormatP8 = 41;        // D3DFMT_P8
+static constexpr uint32_t FormatL8 = 50;        // D3DFMT_L8
+static constexpr uint32_t FormatA8L8 = 51;      // D3DFMT_A8L8
+static constexpr uint32_t FormatDXT1 = fourCC('D', 'X', 'T', '1');
+static constexpr uint32_t FormatDXT2 = fourCC('D', 'X', 'T', '2');
+static constexpr uint32_t FormatDXT3 = fourCC('D', 'X', 'T', '3');
+static constexpr uint32_t FormatDXT4 = fourCC('D', 'X', 'T', '4');
+static constexpr uint32_t FormatDXT5 = fourCC('D', 'X', 'T', '5');
+
+// surfaceBytes - Exact memory use of one surface, from its D3DFORMAT code and dimensions
+size_t surfaceBytes(uint32_t format, unsigned int width, unsigned int height) {
+    size_t blocks = size_t(std::max(1u, (width + 3) / 4)) * std::max(1u, (height + 3) / 4);
+    size_t pixels = size_t(width) * height;
+
+    switch (format) {
+    case FormatDXT1:
+        return blocks * 8;
+    case FormatDXT2:
+    case FormatDXT3:
+    case FormatDXT4:
+    case FormatDXT5:
+        return blocks * 16;
+    case FormatR5G6B5:
+    case FormatX1R5G5B5:
+    case FormatA1R5G5B5:
+    case FormatA4R4G4B4:
+    case FormatA8L8:
+        return pixels * 2;
+    case FormatA8:
+    case FormatL8:
+    case FormatP8:
+        return pixels;
+    default:
+        return pixels * 4;
+    }
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// surfaceBytes - Exact memory use of one surface, from its D3DFORMAT code and dimensions
+size_t surfaceBytes(uint32_t format, unsigned int width, unsigned int height);
+
+// Loaded texture cache with a memory budget and least recently used eviction.
+// Texture is any COM style type, AddRef and Release returning the new reference count.
+// The cache holds its own reference on every entry, so an entry is never left dangling, and only
+// textures with no references outside the cache are evicted. Failed loads are cached as null.
+// Destruction does not release textures, as the device may already be gone; use clear() while it is alive.
+template<typename Texture>
+class TextureCache {
+public:
+    // find - Look up a texture, adding a reference for the caller. Returns false if the key was never cached.
+    bool find(int64_t key, Texture** tex) {
+        auto it = entries.find(key);
+        if (it == entries.end()) {
+            return false;
+        }
+
+        it->second.lastUse = ++useClock;
+        *tex = it->second.tex;
+        if (*tex) {
+            (*tex)->AddRef();
+        }
+        return true;
+    }
+
+    // insert - Add a newly loaded texture of a known size, the caller keeps the reference it already has
+    void insert(int64_t key, Texture* tex, size_t bytes) {
+        Entry& entry = entries[key];
+        if (entry.tex) {
+            resident -= entry.bytes;
+            entry.tex->Release();
+        }
+
+        entry.tex = tex;
+        entry.bytes = 0;
+        entry.lastUse = ++useClock;
+        if (tex) {
+            tex->AddRef();
+            entry.bytes = bytes;
+            resident += bytes;
+        }
+    }
+
+    // trim - Evict least recently used textures which are only referenced by the cache, until within budget
+    // Returns the number of textures evicted.
+    int trim(size_t budget) {
+        if (resident <= budget) {
+            return 0;
+        }
+
+        std::vector<std::pair<uint64_t, int64_t>> candidates;
+        for (const auto& i : entries) {
+            Texture* tex = i.second.tex;
+            if (tex) {
+                tex->AddRef();
+                if (tex->Release() == 1) {
+                    candidates.push_back({ i.second.lastUse, i.first });
+                }
+            }
+        }
+        std::sort(candidates.begin(), candidates.end());
+
+        int evicted = 0;
+        for (const auto& c : candidates) {
+            if (resident <= budget) {
+                break;
+            }
+            auto it = entries.find(c.second);
+            resident -= it->second.bytes;
+            it->second.tex->Release();
+            entries.erase(it);
+            ++evicted;
+        }
+        return evicted;
+    }
+
+    // clear - Forget all entries, releasing the cache's references
+    void clear() {
+        for (auto& i : entries) {
+            if (i.second.tex) {
+                i.second.tex->Release();
+            }
+        }
+        entries.clear();
+        resident = 0;
+    }
+
+    size_t size() const { return entries.size(); }
+    size_t residentBytes() const { return resident; }
+
+private:
+    struct Entry {
+        Texture* tex = nullptr;
+        size_t bytes = 0;
+        uint64_t lastUse = 0;
+    };
+
+    std::unordered_map<int64_t, Entry> entries;
+    size_t resident = 0;
+    uint64_t useClock = 0;
+};
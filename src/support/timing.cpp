@@ -1,34 +1,69 @@
 
 #include "stdint.h"
 #include "timing.h"
+
+#ifdef _WIN32
 #include "winheader.h"
+#else
+#include <time.h>
+#endif
 
 
 
 // Calculations use doubles, as int64 ops bring in an excessive amount of library code on a 32-bit target
 
 static double reciprocalFreq;
-static LARGE_INTEGER initialTime;
+static int64_t initialTime;
 
-void HighResolutionTimer::init() {
+#ifdef _WIN32
+
+// Windows backend, performance counter
+static int64_t readCounter() {
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return t.QuadPart;
+}
+
+static double counterFrequency() {
     LARGE_INTEGER frequency;
     QueryPerformanceFrequency(&frequency);
-    QueryPerformanceCounter(&initialTime);
-    reciprocalFreq = 1.0 / frequency.QuadPart;
+    return double(frequency.QuadPart);
 }
 
-int HighResolutionTimer::getMicroseconds() {
-    LARGE_INTEGER t;
-    QueryPerformanceCounter(&t);
+#else
+
+// POSIX backend, monotonic clock in nanoseconds, so that portable tools and tests can share the timer
+static int64_t readCounter() {
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return int64_t(t.tv_sec) * 1000000000 + t.tv_nsec;
+}
+
+static double counterFrequency() {
+    return 1e9;
+}
+
+#endif
 
-    double x = 1000000 * (double(t.QuadPart - initialTime.QuadPart) * reciprocalFreq);
+void HighResolutionTimer::init() {
+    initialTime = readCounter();
+    reciprocalFreq = 1.0 / counterFrequency();
+}
+
+int HighResolutionTimer::getMicroseconds() {
+    double x = 1000000 * (double(readCounter() - initialTime) * reciprocalFreq);
     return int(int64_t(x));
 }
 
 int HighResolutionTimer::getMilliseconds() {
-    LARGE_INTEGER t;
-    QueryPerformanceCounter(&t);
-
-    double x = 1000 * (double(t.QuadPart - initialTime.QuadPart) * reciprocalFreq);
+    double x = 1000 * (double(readCounter() - initialTime) * reciprocalFreq);
     return int(int64_t(x));
 }
+
+int64_t HighResolutionTimer::getTicks() {
+    return readCounter();
+}
+
+float HighResolutionTimer::ticksToMicroseconds(int64_t ticks) {
+    return float(1000000 * (double(ticks) * reciprocalFreq));
+}
@@ -1,8 +1,14 @@
 #pragma once
 
+#include <stdint.h>
+
 class HighResolutionTimer {
 public:
     static void init();
     static int getMicroseconds();
     static int getMilliseconds();
+
+    // Raw counter for interval measurement; only differences between ticks are meaningful
+    static int64_t getTicks();
+    static float ticksToMicroseconds(int64_t ticks);
 };
@@ -0,0 +1,197 @@
+
+#include "vecmath.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VECMATH_SSE2
+#include <emmintrin.h>
+#endif
+
+
+// --------------------------------------------------------
+// mat4
+
+mat4::mat4(const mat4x3& a) :
+    _11(a._11), _12(a._12), _13(a._13), _14(0),
+    _21(a._21), _22(a._22), _23(a._23), _24(0),
+    _31(a._31), _32(a._32), _33(a._33), _34(0),
+    _41(a._41), _42(a._42), _43(a._43), _44(1) {
+}
+
+mat4 mat4::operator*(const mat4& b) const {
+    mat4 r;
+    for (int i = 0; i != 4; ++i) {
+        for (int j = 0; j != 4; ++j) {
+            r.m[i][j] = m[i][0] * b.m[0][j] + m[i][1] * b.m[1][j] + m[i][2] * b.m[2][j] + m[i][3] * b.m[3][j];
+        }
+    }
+    return r;
+}
+
+vec3 mat4::transformCoord(const vec3& v) const {
+    float x = v.x * _11 + v.y * _21 + v.z * _31 + _41;
+    float y = v.x * _12 + v.y * _22 + v.z * _32 + _42;
+    float z = v.x * _13 + v.y * _23 + v.z * _33 + _43;
+    float w = v.x * _14 + v.y * _24 + v.z * _34 + _44;
+    return vec3(x / w, y / w, z / w);
+}
+
+vec3 mat4::transformNormal(const vec3& v) const {
+    return vec3(v.x * _11 + v.y * _21 + v.z * _31,
+                v.x * _12 + v.y * _22 + v.z * _32,
+                v.x * _13 + v.y * _23 + v.z * _33);
+}
+
+mat4 mat4::identity() {
+    return mat4(1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1);
+}
+
+// lookAtLH - Left handed view matrix, same as D3DXMatrixLookAtLH
+mat4 mat4::lookAtLH(const vec3& eye, const vec3& at, const vec3& up) {
+    vec3 zaxis = normalize(at - eye);
+    vec3 xaxis = normalize(cross(up, zaxis));
+    vec3 yaxis = cross(zaxis, xaxis);
+
+    return mat4(xaxis.x, yaxis.x, zaxis.x, 0,
+                xaxis.y, yaxis.y, zaxis.y, 0,
+                xaxis.z, yaxis.z, zaxis.z, 0,
+                -dot(xaxis, eye), -dot(yaxis, eye), -dot(zaxis, eye), 1);
+}
+
+// perspectiveFovLH - Left handed projection matrix, same as D3DXMatrixPerspectiveFovLH
+mat4 mat4::perspectiveFovLH(float fovy, float aspect, float zn, float zf) {
+    float yscale = 1.0f / std::tan(0.5f * fovy), xscale = yscale / aspect;
+    return mat4(xscale, 0, 0, 0, 0, yscale, 0, 0, 0, 0, zf / (zf - zn), 1, 0, 0, -zn * zf / (zf - zn), 0);
+}
+
+// --------------------------------------------------------
+// mat4x3
+
+mat4x3 mat4x3::operator*(const mat4x3& b) const {
+    return mat4x3(_11 * b._11 + _12 * b._21 + _13 * b._31,
+                  _11 * b._12 + _12 * b._22 + _13 * b._32,
+                  _11 * b._13 + _12 * b._23 + _13 * b._33,
+                  _21 * b._11 + _22 * b._21 + _23 * b._31,
+                  _21 * b._12 + _22 * b._22 + _23 * b._32,
+                  _21 * b._13 + _22 * b._23 + _23 * b._33,
+                  _31 * b._11 + _32 * b._21 + _33 * b._31,
+                  _31 * b._12 + _32 * b._22 + _33 * b._32,
+                  _31 * b._13 + _32 * b._23 + _33 * b._33,
+                  _41 * b._11 + _42 * b._21 + _43 * b._31 + b._41,
+                  _41 * b._12 + _42 * b._22 + _43 * b._32 + b._42,
+                  _41 * b._13 + _42 * b._23 + _43 * b._33 + b._43);
+}
+
+mat4x3 mat4x3::identity() {
+    return mat4x3(1, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0);
+}
+
+mat4x3 mat4x3::translation(float x, float y, float z) {
+    return mat4x3(1, 0, 0, 0, 1, 0, 0, 0, 1, x, y, z);
+}
+
+mat4x3 mat4x3::scaling(float s) {
+    return mat4x3(s, 0, 0, 0, s, 0, 0, 0, s, 0, 0, 0);
+}
+
+// Rotations follow D3DXMatrixRotationX/Y/Z, clockwise when looking along the axis towards the origin
+mat4x3 mat4x3::rotationX(float angle) {
+    float s = std::sin(angle), c = std::cos(angle);
+    return mat4x3(1, 0, 0, 0, c, s, 0, -s, c, 0, 0, 0);
+}
+
+mat4x3 mat4x3::rotationY(float angle) {
+    float s = std::sin(angle), c = std::cos(angle);
+    return mat4x3(c, 0, -s, 0, 1, 0, s, 0, c, 0, 0, 0);
+}
+
+mat4x3 mat4x3::rotationZ(float angle) {
+    float s = std::sin(angle), c = std::cos(angle);
+    return mat4x3(c, s, 0, -s, c, 0, 0, 0, 1, 0, 0, 0);
+}
+
+// --------------------------------------------------------
+
+// extractFrustumPlanes - Gribb/Hartmann plane extraction from the columns of the matrix
+void extractFrustumPlanes(const mat4& vp, plane out[6]) {
+    // Near plane
+    out[0] = plane(vp._13, vp._23, vp._33, vp._43);
+    // Far plane
+    out[1] = plane(vp._14 - vp._13, vp._24 - vp._23, vp._34 - vp._33, vp._44 - vp._43);
+    // Left plane
+    out[2] = plane(vp._14 + vp._11, vp._24 + vp._21, vp._34 + vp._31, vp._44 + vp._41);
+    // Right plane
+    out[3] = plane(vp._14 - vp._11, vp._24 - vp._21, vp._34 - vp._31, vp._44 - vp._41);
+    // Top plane
+    out[4] = plane(vp._14 - vp._12, vp._24 - vp._22, vp._34 - vp._32, vp._44 - vp._42);
+    // Bottom plane
+    out[5] = plane(vp._14 + vp._12, vp._24 + vp._22, vp._34 + vp._32, vp._44 + vp._42);
+
+    for (int f = 0; f != 6; ++f) {
+        out[f] = out[f].normalized();
+    }
+}
+
+#ifdef VECMATH_SSE2
+// storePlanes - Normalize four planes held as a, b, c, d vectors with the same arithmetic as
+// plane::normalized, and store them to one frustum slot of up to four outputs
+static void storePlanes(__m128 a, __m128 b, __m128 c, __m128 d, plane (*out)[6], int f, size_t lanes) {
+    __m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(a, a), _mm_mul_ps(b, b)), _mm_mul_ps(c, c)));
+    __m128 k = _mm_and_ps(_mm_div_ps(_mm_set1_ps(1.0f), len), _mm_cmpneq_ps(len, _mm_setzero_ps()));
+    a = _mm_mul_ps(a, k);
+    b = _mm_mul_ps(b, k);
+    c = _mm_mul_ps(c, k);
+    d = _mm_mul_ps(d, k);
+
+    _MM_TRANSPOSE4_PS(a, b, c, d);
+    _mm_storeu_ps(&out[0][f].a, a);
+    if (lanes > 1) {
+        _mm_storeu_ps(&out[1][f].a, b);
+    }
+    if (lanes > 2) {
+        _mm_storeu_ps(&out[2][f].a, c);
+    }
+    if (lanes > 3) {
+        _mm_storeu_ps(&out[3][f].a, d);
+    }
+}
+#endif
+
+// extractFrustumPlanes - Batch version, four matrices at a time with one matrix per SIMD lane
+void extractFrustumPlanes(const mat4* viewProj, plane (*out)[6], size_t count) {
+#ifdef VECMATH_SSE2
+    for (size_t n = 0; n < count; n += 4) {
+        size_t lanes = std::min<size_t>(count - n, 4);
+        const mat4& m0 = viewProj[n];
+        const mat4& m1 = viewProj[n + std::min<size_t>(1, lanes - 1)];
+        const mat4& m2 = viewProj[n + std::min<size_t>(2, lanes - 1)];
+        const mat4& m3 = viewProj[n + std::min<size_t>(3, lanes - 1)];
+
+        // Transpose so that c1[i] .. c4[i] hold _i1 .. _i4 of the four matrices
+        __m128 c1[4], c2[4], c3[4], c4[4];
+        for (int i = 0; i != 4; ++i) {
+            __m128 r0 = _mm_loadu_ps(m0.m[i]), r1 = _mm_loadu_ps(m1.m[i]);
+            __m128 r2 = _mm_loadu_ps(m2.m[i]), r3 = _mm_loadu_ps(m3.m[i]);
+            _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+            c1[i] = r0;
+            c2[i] = r1;
+            c3[i] = r2;
+            c4[i] = r3;
+        }
+
+        // Same planes and order as the single matrix version
+        plane (*dest)[6] = out + n;
+        storePlanes(c3[0], c3[1], c3[2], c3[3], dest, 0, lanes);
+        storePlanes(_mm_sub_ps(c4[0], c3[0]), _mm_sub_ps(c4[1], c3[1]), _mm_sub_ps(c4[2], c3[2]), _mm_sub_ps(c4[3], c3[3]), dest, 1, lanes);
+        storePlanes(_mm_add_ps(c4[0], c1[0]), _mm_add_ps(c4[1], c1[1]), _mm_add_ps(c4[2], c1[2]), _mm_add_ps(c4[3], c1[3]), dest, 2, lanes);
+        storePlanes(_mm_sub_ps(c4[0], c1[0]), _mm_sub_ps(c4[1], c1[1]), _mm_sub_ps(c4[2], c1[2]), _mm_sub_ps(c4[3], c1[3]), dest, 3, lanes);
+        storePlanes(_mm_sub_ps(c4[0], c2[0]), _mm_sub_ps(c4[1], c2[1]), _mm_sub_ps(c4[2], c2[2]), _mm_sub_ps(c4[3], c2[3]), dest, 4, lanes);
+        storePlanes(_mm_add_ps(c4[0], c2[0]), _mm_add_ps(c4[1], c2[1]), _mm_add_ps(c4[2], c2[2]), _mm_add_ps(c4[3], c2[3]), dest, 5, lanes);
+    }
+#else
+    for (size_t n = 0; n != count; ++n) {
+        extractFrustumPlanes(viewProj[n], out[n]);
+    }
+#endif
+}
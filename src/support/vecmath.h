@@ -0,0 +1,177 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+
+// Small vector math library for the CPU-side culling, bounds and transform code.
+// Row vector convention (v * M) and member layouts match D3DX, so data can be handed to D3D without
+// copying; see the conversions in mge/dlmath.h. Types are plain floats with no alignment requirement,
+// so that arrays pack tightly; SIMD code loads them unaligned or transposes them as needed.
+// Portable, so that offline tools and tests can share the game's culling code.
+
+struct vec2 {
+    float x, y;
+
+    vec2() {}
+    vec2(float x_, float y_) : x(x_), y(y_) {}
+
+    vec2 operator+(const vec2& v) const { return vec2(x + v.x, y + v.y); }
+    vec2 operator-(const vec2& v) const { return vec2(x - v.x, y - v.y); }
+    vec2 operator*(float f) const { return vec2(x * f, y * f); }
+};
+
+inline vec2 operator*(float f, const vec2& v) { return v * f; }
+
+struct vec3 {
+    float x, y, z;
+
+    vec3() {}
+    vec3(float x_, float y_, float z_) : x(x_), y(y_), z(z_) {}
+
+    vec3& operator+=(const vec3& v) { x += v.x; y += v.y; z += v.z; return *this; }
+    vec3& operator-=(const vec3& v) { x -= v.x; y -= v.y; z -= v.z; return *this; }
+    vec3& operator*=(float f) { x *= f; y *= f; z *= f; return *this; }
+    vec3 operator-() const { return vec3(-x, -y, -z); }
+    vec3 operator+(const vec3& v) const { return vec3(x + v.x, y + v.y, z + v.z); }
+    vec3 operator-(const vec3& v) const { return vec3(x - v.x, y - v.y, z - v.z); }
+    vec3 operator*(float f) const { return vec3(x * f, y * f, z * f); }
+};
+
+inline vec3 operator*(float f, const vec3& v) { return v * f; }
+
+inline float dot(const vec3& a, const vec3& b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+inline vec3 cross(const vec3& a, const vec3& b) {
+    return vec3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+inline float lengthSquared(const vec3& v) {
+    return dot(v, v);
+}
+
+inline float length(const vec3& v) {
+    return std::sqrt(dot(v, v));
+}
+
+// normalize - Unit vector, or zero for a zero length vector
+inline vec3 normalize(const vec3& v) {
+    float len = length(v);
+    return (len == 0.0f) ? vec3(0, 0, 0) : v * (1.0f / len);
+}
+
+struct vec4 {
+    float x, y, z, w;
+
+    vec4() {}
+    vec4(float x_, float y_, float z_, float w_) : x(x_), y(y_), z(z_), w(w_) {}
+    vec4(const vec3& v, float w_) : x(v.x), y(v.y), z(v.z), w(w_) {}
+
+    vec3 xyz() const { return vec3(x, y, z); }
+};
+
+// Plane as ax + by + cz + d = 0, positive on the side the normal faces
+struct plane {
+    float a, b, c, d;
+
+    plane() {}
+    plane(float a_, float b_, float c_, float d_) : a(a_), b(b_), c(c_), d(d_) {}
+
+    float dotCoord(const vec3& v) const { return a * v.x + b * v.y + c * v.z + d; }
+    float dotNormal(const vec3& v) const { return a * v.x + b * v.y + c * v.z; }
+
+    // normalized - Scaled to a unit normal, so that dotCoord is a signed distance
+    plane normalized() const {
+        float len = std::sqrt(a * a + b * b + c * c);
+        float k = (len == 0.0f) ? 0.0f : 1.0f / len;
+        return plane(a * k, b * k, c * k, d * k);
+    }
+};
+
+struct mat4x3;
+
+// 4x4 matrix, for projections
+struct mat4 {
+    union {
+        struct {
+            float _11, _12, _13, _14;
+            float _21, _22, _23, _24;
+            float _31, _32, _33, _34;
+            float _41, _42, _43, _44;
+        };
+        float m[4][4];
+    };
+
+    mat4() {}
+    mat4(float m11, float m12, float m13, float m14,
+         float m21, float m22, float m23, float m24,
+         float m31, float m32, float m33, float m34,
+         float m41, float m42, float m43, float m44) :
+        _11(m11), _12(m12), _13(m13), _14(m14),
+        _21(m21), _22(m22), _23(m23), _24(m24),
+        _31(m31), _32(m32), _33(m33), _34(m34),
+        _41(m41), _42(m42), _43(m43), _44(m44) {}
+    explicit mat4(const mat4x3& a);
+
+    mat4 operator*(const mat4& b) const;
+
+    // transformCoord - Transform a point, with perspective divide
+    vec3 transformCoord(const vec3& v) const;
+    // transformNormal - Transform a direction, ignoring translation
+    vec3 transformNormal(const vec3& v) const;
+
+    static mat4 identity();
+    static mat4 lookAtLH(const vec3& eye, const vec3& at, const vec3& up);
+    static mat4 perspectiveFovLH(float fovy, float aspect, float zn, float zf);
+};
+
+// Affine transform, a 4x4 matrix with the constant fourth column (0, 0, 0, 1) dropped.
+// Rows 1-3 are the basis, row 4 the translation. Used for world transforms of placed objects.
+struct mat4x3 {
+    float _11, _12, _13;
+    float _21, _22, _23;
+    float _31, _32, _33;
+    float _41, _42, _43;
+
+    mat4x3() {}
+    mat4x3(float m11, float m12, float m13,
+           float m21, float m22, float m23,
+           float m31, float m32, float m33,
+           float m41, float m42, float m43) :
+        _11(m11), _12(m12), _13(m13),
+        _21(m21), _22(m22), _23(m23),
+        _31(m31), _32(m32), _33(m33),
+        _41(m41), _42(m42), _43(m43) {}
+
+    mat4x3 operator*(const mat4x3& b) const;
+
+    vec3 transformPoint(const vec3& v) const {
+        return vec3(v.x * _11 + v.y * _21 + v.z * _31 + _41,
+                    v.x * _12 + v.y * _22 + v.z * _32 + _42,
+                    v.x * _13 + v.y * _23 + v.z * _33 + _43);
+    }
+    vec3 transformNormal(const vec3& v) const {
+        return vec3(v.x * _11 + v.y * _21 + v.z * _31,
+                    v.x * _12 + v.y * _22 + v.z * _32,
+                    v.x * _13 + v.y * _23 + v.z * _33);
+    }
+
+    static mat4x3 identity();
+    static mat4x3 translation(float x, float y, float z);
+    static mat4x3 scaling(float s);
+    static mat4x3 rotationX(float angle);
+    static mat4x3 rotationY(float angle);
+    static mat4x3 rotationZ(float angle);
+};
+
+static_assert(sizeof(vec3) == 12 && sizeof(vec4) == 16 && sizeof(plane) == 16, "vector layout");
+static_assert(sizeof(mat4) == 64 && sizeof(mat4x3) == 48, "matrix layout");
+
+// extractFrustumPlanes - Normalized clip planes of a view-projection matrix, facing inwards.
+// Order is near, far, left, right, top, bottom; clip space z range is [0, 1] as in D3D.
+void extractFrustumPlanes(const mat4& viewProj, plane out[6]);
+
+// extractFrustumPlanes - Batch version, planes for count view-projection matrices in one pass.
+// Results are identical to extracting each matrix separately.
+void extractFrustumPlanes(const mat4* viewProj, plane (*out)[6], size_t count);
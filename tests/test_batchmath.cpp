@@ -0,0 +1,164 @@
+
+// Batch math - Batch bounds transforms and frustum extraction against the per-object code
+
+#include "testing.h"
+#include "mge/dlmath.h"
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+
+
+// Double precision reference for mat4x3 placements, written from the D3DX definitions
+struct RefMat {
+    double m[4][4];
+};
+
+static RefMat ref(const mat4x3& a) {
+    RefMat r = {{
+        { a._11, a._12, a._13, 0 },
+        { a._21, a._22, a._23, 0 },
+        { a._31, a._32, a._33, 0 },
+        { a._41, a._42, a._43, 1 }
+    }};
+    return r;
+}
+
+// Row vector (x, y, z, w) times matrix
+static void transform(const RefMat& a, const double v[4], double out[4]) {
+    for (int j = 0; j != 4; ++j) {
+        out[j] = v[0] * a.m[0][j] + v[1] * a.m[1][j] + v[2] * a.m[2][j] + v[3] * a.m[3][j];
+    }
+}
+
+struct RandomMath {
+    std::mt19937 rng;
+
+    explicit RandomMath(uint32_t seed) : rng(seed) {}
+
+    float uniform(float lo, float hi) {
+        return std::uniform_real_distribution<float>(lo, hi)(rng);
+    }
+    vec3 point(float range) {
+        return vec3(uniform(-range, range), uniform(-range, range), uniform(-range, range));
+    }
+    mat4 matrix(float range) {
+        mat4 m;
+        for (int i = 0; i != 4; ++i) {
+            for (int j = 0; j != 4; ++j) {
+                m.m[i][j] = uniform(-range, range);
+            }
+        }
+        return m;
+    }
+    // Placement as the game builds it: scale, then rotations, then translation
+    mat4x3 placement(float range) {
+        const float pi = 3.14159265f;
+        return mat4x3::scaling(uniform(0.25f, 4.0f)) * mat4x3::rotationX(uniform(-pi, pi))
+             * mat4x3::rotationY(uniform(-pi, pi)) * mat4x3::rotationZ(uniform(-pi, pi))
+             * mat4x3::translation(uniform(-range, range), uniform(-range, range), uniform(-range, range));
+    }
+    // Camera in a worldspace, looking in any direction but straight up or down
+    mat4 view(const vec3& eye) {
+        vec3 look(uniform(-1, 1), uniform(-1, 1), uniform(-0.9f, 0.9f));
+        if (lengthSquared(look) < 1e-4f) {
+            look = vec3(1, 0, 0);
+        }
+        return mat4::lookAtLH(eye, eye + look, vec3(0, 0, 1));
+    }
+    mat4 projection() {
+        float zn = uniform(1.0f, 64.0f), zf = zn + uniform(100.0f, 300000.0f);
+        return mat4::perspectiveFovLH(uniform(0.5f, 2.0f), uniform(1.0f, 2.4f), zn, zf);
+    }
+};
+
+static BoundingSphere sphere(float x, float y, float z, float radius) {
+    BoundingSphere s;
+    s.center = vec3(x, y, z);
+    s.radius = radius;
+    return s;
+}
+
+static bool near(float got, double want, double tolerance) {
+    return std::fabs(double(got) - want) <= tolerance;
+}
+
+TEST(batch_extraction) {
+    // Every batch size and lane position must match the single matrix version bit for bit
+    RandomMath r(8);
+    int wrong = 0;
+    for (size_t count = 0; count != 13; ++count) {
+        std::vector<mat4> vp(count);
+        for (size_t i = 0; i != count; ++i) {
+            vp[i] = (i % 3 == 2) ? r.matrix(1e4f) : r.view(r.point(1e5f)) * r.projection();
+        }
+        if (count == 5) {
+            // Degenerate matrix, all planes zero
+            for (int k = 0; k != 16; ++k) {
+                vp[1].m[k / 4][k % 4] = 0;
+            }
+        }
+
+        std::vector<plane> single(6 * count + 6), batch(6 * count + 6, plane(7, 7, 7, 7));
+        for (size_t i = 0; i != count; ++i) {
+            extractFrustumPlanes(vp[i], &single[6 * i]);
+        }
+        extractFrustumPlanes(vp.data(), reinterpret_cast<plane (*)[6]>(batch.data()), count);
+
+        for (size_t i = 0; i != 6 * count; ++i) {
+            wrong += single[i].a != batch[i].a || single[i].b != batch[i].b || single[i].c != batch[i].c || single[i].d != batch[i].d;
+        }
+        // Nothing written past the last output
+        for (size_t i = 6 * count; i != 6 * count + 6; ++i) {
+            wrong += batch[i].a != 7 || batch[i].d != 7;
+        }
+        if (count == 5) {
+            wrong += batch[6].a != 0 || batch[6].b != 0 || batch[6].c != 0 || batch[6].d != 0;
+        }
+    }
+    CHECK_EQ(wrong, 0);
+}
+
+TEST(batch_bounds) {
+    // Batch transforms against the per-object code and the double reference
+    RandomMath r(11);
+    const size_t count = 1000;
+    std::vector<BoundingSphere> base(count), spheres(count);
+    std::vector<vec3> lo(count), hi(count);
+    std::vector<mat4x3> transforms(count);
+    std::vector<float> scales(count);
+    std::vector<BoundingBox> boxes(count);
+
+    for (size_t i = 0; i != count; ++i) {
+        base[i] = sphere(r.uniform(-50, 50), r.uniform(-50, 50), r.uniform(-50, 50), r.uniform(0, 500));
+        lo[i] = r.point(300.0f);
+        hi[i] = lo[i] + vec3(r.uniform(0, 600), r.uniform(0, 600), r.uniform(0, 600));
+        transforms[i] = r.placement(200000.0f);
+        scales[i] = r.uniform(0.25f, 4.0f);
+    }
+    transformBoundingSpheres(base.data(), transforms.data(), scales.data(), spheres.data(), count);
+    transformBoundingBoxes(lo.data(), hi.data(), transforms.data(), boxes.data(), count);
+
+    int wrong = 0;
+    for (size_t i = 0; i != count; ++i) {
+        vec3 c = transforms[i].transformPoint(base[i].center);
+        wrong += spheres[i].center.x != c.x || spheres[i].center.y != c.y || spheres[i].center.z != c.z;
+        wrong += spheres[i].radius != base[i].radius * scales[i];
+
+        BoundingBox b(lo[i], hi[i]);
+        b.Transform(transforms[i]);
+        const vec3* got[4] = { &boxes[i].center, &boxes[i].vx, &boxes[i].vy, &boxes[i].vz };
+        const vec3* want[4] = { &b.center, &b.vx, &b.vy, &b.vz };
+        for (int k = 0; k != 4; ++k) {
+            wrong += got[k]->x != want[k]->x || got[k]->y != want[k]->y || got[k]->z != want[k]->z;
+        }
+
+        RefMat m = ref(transforms[i]);
+        double p[4] = { base[i].center.x, base[i].center.y, base[i].center.z, 1 }, t[4];
+        transform(m, p, t);
+        double tol = 1e-6 * (std::fabs(t[0]) + std::fabs(t[1]) + std::fabs(t[2]) + 4 * 50 * 4);
+        wrong += !near(c.x, t[0], tol) || !near(c.y, t[1], tol) || !near(c.z, t[2], tol);
+    }
+    CHECK_EQ(wrong, 0);
+}
@@ -0,0 +1,490 @@
+
+// BSAIndex - Hashing, index parsing of synthetic archives, rejection of truncated or corrupt archives,
+// and the merged index cache
+
+#include "testing.h"
+#include "support/bsaindex.h"
+#include "support/filemapping.h"
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+
+// A file written for the duration of a test
+struct TempFile {
+    std::string path;
+
+    TempFile(const char* name, const std::vector<char>& contents) : path(std::string("bsaindex_") + name + ".tmp") {
+        FILE* f = std::fopen(path.c_str(), "wb");
+        if (f) {
+            if (!contents.empty()) {
+                std::fwrite(contents.data(), 1, contents.size(), f);
+            }
+            std::fclose(f);
+        }
+    }
+    ~TempFile() { std::remove(path.c_str()); }
+};
+
+struct ArchiveFile {
+    const char* name;
+    std::string data;
+};
+
+static void put32(std::vector<char>& buf, size_t at, uint32_t x) {
+    std::memcpy(&buf[at], &x, 4);
+}
+
+// buildArchive - TES3 BSA layout: header, records, name offsets, names, hash table, then file data
+static std::vector<char> buildArchive(const std::vector<ArchiveFile>& files) {
+    uint32_t n = uint32_t(files.size()), namesSize = 0;
+    for (const auto& f : files) {
+        namesSize += uint32_t(std::strlen(f.name) + 1);
+    }
+
+    uint32_t hashOffset = n * 8 + n * 4 + namesSize;
+    size_t dataStart = 12 + hashOffset + n * 8;
+    std::vector<char> buf(dataStart);
+    put32(buf, 0, 0x100);
+    put32(buf, 4, hashOffset);
+    put32(buf, 8, n);
+
+    uint32_t nameOffset = 0;
+    for (uint32_t i = 0; i != n; ++i) {
+        const ArchiveFile& f = files[i];
+        put32(buf, 12 + i * 8, uint32_t(f.data.size()));
+        put32(buf, 12 + i * 8 + 4, uint32_t(buf.size() - dataStart));
+        put32(buf, 12 + n * 8 + i * 4, nameOffset);
+        std::strcpy(&buf[12 + n * 12 + nameOffset], f.name);
+        nameOffset += uint32_t(std::strlen(f.name) + 1);
+
+        BSAIndex::Hash h = BSAIndex::hashString(f.name);
+        put32(buf, 12 + hashOffset + i * 8, h.value1);
+        put32(buf, 12 + hashOffset + i * 8 + 4, h.value2);
+
+        buf.insert(buf.end(), f.data.begin(), f.data.end());
+    }
+    return buf;
+}
+
+static const BSAIndex::Entry* find(const BSAIndex::Index& index, const char* name) {
+    auto it = index.find(BSAIndex::hashString(name).value());
+    return it != index.end() ? &it->second : nullptr;
+}
+
+static std::string read(const FileMapping& m, const BSAIndex::Entry* e) {
+    FileView v = m.view(e->position, e->size);
+    return v.valid() ? std::string(v.data(), v.size()) : std::string();
+}
+
+TEST(hash_values) {
+    // Hand computed: first half xor-shifted into value1, second half xor-rotated into value2
+    BSAIndex::Hash h = BSAIndex::hashString("");
+    CHECK(h.value1 == 0 && h.value2 == 0);
+
+    h = BSAIndex::hashString("a");
+    CHECK_EQ(h.value1, 0u);
+    CHECK_EQ(h.value2, 0x80000030u);
+
+    h = BSAIndex::hashString("ab");
+    CHECK_EQ(h.value1, 97u);
+    CHECK_EQ(h.value2, 0x80000018u);
+
+    // '@' has a rotate count of zero
+    h = BSAIndex::hashString("a@");
+    CHECK_EQ(h.value1, 97u);
+    CHECK_EQ(h.value2, 64u);
+
+    h = BSAIndex::hashString("textures\\tx_a.dds");
+    CHECK_EQ(uint64_t(h.value()), (uint64_t(h.value2) << 32) | h.value1);
+    CHECK(h.value() != BSAIndex::hashString("textures\\tx_b.dds").value());
+}
+
+TEST(parse_archive) {
+    std::vector<ArchiveFile> files = {
+        { "textures\\tx_a.dds", "first file" },
+        { "textures\\tx_b.dds", std::string(70000, 'b') },     // Crosses mapping granularity
+        { "meshes\\x.nif", "nif" },
+        { "textures\\empty.dds", "" },
+    };
+    TempFile f("parse", buildArchive(files));
+    FileMapping m;
+    CHECK(m.open(f.path.c_str()));
+
+    BSAIndex::Index index;
+    CHECK(BSAIndex::parseArchive(m, 3, index));
+    CHECK_EQ(index.size(), size_t(4));
+
+    for (const auto& file : files) {
+        const BSAIndex::Entry* e = find(index, file.name);
+        CHECK(e != nullptr);
+        if (e) {
+            CHECK_EQ(e->archive, 3u);
+            CHECK_EQ(e->size, uint32_t(file.data.size()));
+            if (e->size) {
+                CHECK(read(m, e) == file.data);
+            }
+        }
+    }
+    CHECK(find(index, "textures\\missing.dds") == nullptr);
+}
+
+TEST(later_archives_override) {
+    TempFile a("override_a", buildArchive({ { "shared.dds", "from a" }, { "only_a.dds", "a" } }));
+    TempFile b("override_b", buildArchive({ { "shared.dds", "from b!" } }));
+    FileMapping ma, mb;
+    CHECK(ma.open(a.path.c_str()) && mb.open(b.path.c_str()));
+
+    BSAIndex::Index index;
+    CHECK(BSAIndex::parseArchive(ma, 0, index));
+    CHECK(BSAIndex::parseArchive(mb, 1, index));
+    CHECK_EQ(index.size(), size_t(2));
+
+    const BSAIndex::Entry* e = find(index, "shared.dds");
+    CHECK(e && e->archive == 1 && read(mb, e) == "from b!");
+    e = find(index, "only_a.dds");
+    CHECK(e && e->archive == 0 && read(ma, e) == "a");
+}
+
+TEST(truncated_archives) {
+    std::vector<char> good = buildArchive({ { "a.dds", "aaaa" }, { "b.dds", "bbbbbbbb" } });
+
+    // Shorter than the header
+    {
+        TempFile f("short", std::vector<char>(good.begin(), good.begin() + 8));
+        FileMapping m;
+        BSAIndex::Index index;
+        CHECK(m.open(f.path.c_str()));
+        CHECK(!BSAIndex::parseArchive(m, 0, index));
+        CHECK(index.empty());
+    }
+
+    // Cut inside the hash table
+    {
+        size_t dataStart = good.size() - 12;
+        TempFile f("cut_index", std::vector<char>(good.begin(), good.begin() + dataStart - 4));
+        FileMapping m;
+        BSAIndex::Index index;
+        CHECK(m.open(f.path.c_str()));
+        CHECK(!BSAIndex::parseArchive(m, 0, index));
+        CHECK(index.empty());
+    }
+
+    // Cut inside file data: the index is intact, files past the end are skipped
+    {
+        TempFile f("cut_data", std::vector<char>(good.begin(), good.end() - 2));
+        FileMapping m;
+        BSAIndex::Index index;
+        CHECK(m.open(f.path.c_str()));
+        CHECK(BSAIndex::parseArchive(m, 0, index));
+        CHECK(find(index, "a.dds") != nullptr);
+        CHECK(find(index, "b.dds") == nullptr);
+    }
+}
+
+TEST(corrupt_archives) {
+    std::vector<char> good = buildArchive({ { "a.dds", "aaaa" }, { "b.dds", "bbbbbbbb" } });
+
+    std::vector<char> version = good;
+    put32(version, 0, 0x200);
+
+    std::vector<char> hugeCount = good;
+    put32(hugeCount, 8, 0x40000000);
+
+    std::vector<char> smallHashOffset = good;
+    put32(smallHashOffset, 4, 8);
+
+    std::vector<char> hugeHashOffset = good;
+    put32(hugeHashOffset, 4, 0xfffffff0);
+
+    const std::vector<char>* bad[] = { &version, &hugeCount, &smallHashOffset, &hugeHashOffset };
+    for (const auto* b : bad) {
+        TempFile f("corrupt", *b);
+        FileMapping m;
+        BSAIndex::Index index;
+        CHECK(m.open(f.path.c_str()));
+        CHECK(!BSAIndex::parseArchive(m, 0, index));
+        CHECK(index.empty());
+    }
+
+    // A record pointing past the end is skipped, the rest of the archive is still indexed
+    std::vector<char> badRecord = good;
+    put32(badRecord, 12 + 4, 0x7fffffff);
+    TempFile f("bad_record", badRecord);
+    FileMapping m;
+    BSAIndex::Index index;
+    CHECK(m.open(f.path.c_str()));
+    CHECK(BSAIndex::parseArchive(m, 0, index));
+    CHECK(find(index, "a.dds") == nullptr);
+    CHECK(find(index, "b.dds") != nullptr);
+}
+
+TEST(file_mapping) {
+    std::vector<char> contents(3 * 65536 + 100);
+    for (size_t i = 0; i != contents.size(); ++i) {
+        contents[i] = char(i * 7);
+    }
+    TempFile f("mapping", contents);
+
+    FileMapping m;
+    CHECK(!m.isOpen());
+    CHECK(!m.view(0, 1).valid());
+    CHECK(m.open(f.path.c_str()));
+    CHECK_EQ(m.size(), uint64_t(contents.size()));
+
+    // Unaligned views, including one ending exactly at the end of the file
+    size_t offsets[] = { 0, 1, 4095, 4096, 65535, 65536 + 13, contents.size() - 10 };
+    for (size_t off : offsets) {
+        FileView v = m.view(off, 10);
+        CHECK(v.valid() && v.size() == 10);
+        CHECK(v.valid() && std::memcmp(v.data(), &contents[off], 10) == 0);
+    }
+
+    // Out of range and empty views
+    CHECK(!m.view(contents.size() - 9, 10).valid());
+    CHECK(!m.view(contents.size() + 1, 1).valid());
+    CHECK(!m.view(~0ull, 2).valid());
+    CHECK(!m.view(0, 0).valid());
+
+    // Views and mappings are movable
+    FileView a = m.view(100, 4), b;
+    b = std::move(a);
+    CHECK(!a.valid() && b.valid() && b.data()[0] == contents[100]);
+
+    FileMapping moved(std::move(m));
+    CHECK(!m.isOpen() && moved.isOpen());
+    CHECK(moved.view(5, 1).valid());
+
+    moved.close();
+    CHECK(!moved.isOpen() && moved.size() == 0);
+}
+
+TEST(file_mapping_open_failures) {
+    FileMapping m;
+    CHECK(!m.open("bsaindex_does_not_exist.tmp"));
+    CHECK(!m.isOpen());
+
+    TempFile empty("empty", std::vector<char>());
+    CHECK(!m.open(empty.path.c_str()));
+    CHECK(!m.isOpen());
+}
+
+// syntheticArchive - An archive of count small files under a directory, their names returned in names
+static std::vector<char> syntheticArchive(const char* dir, uint32_t count, std::vector<std::string>& names) {
+    // The archive hash collides easily on names differing only by a counter, so names are scrambled as well
+    names.clear();
+    for (uint32_t i = 0; i != count; ++i) {
+        char name[64];
+        std::snprintf(name, sizeof(name), "%s\\tx_%08x_%u.dds", dir, i * 2654435761u, i);
+        names.push_back(name);
+    }
+
+    std::vector<ArchiveFile> files;
+    for (uint32_t i = 0; i != count; ++i) {
+        files.push_back({ names[i].c_str(), std::string(1 + i % 61, char(i)) });
+    }
+    return buildArchive(files);
+}
+
+BENCH(index_build) {
+    const uint32_t count = 100000;
+    std::vector<std::string> names;
+    TempFile f("bench_index", syntheticArchive("textures", count, names));
+    FileMapping m;
+    CHECK(m.open(f.path.c_str()));
+
+    double t0 = Testing::seconds();
+    BSAIndex::Index index;
+    bool ok = BSAIndex::parseArchive(m, 0, index);
+    double t1 = Testing::seconds();
+    CHECK(ok);
+    CHECK_EQ(index.size(), size_t(count));
+
+    // Lookups hash the requested path as the texture loader does, hits and misses
+    size_t hits = 0;
+    for (const auto& name : names) {
+        hits += find(index, name.c_str()) != nullptr;
+    }
+    double t2 = Testing::seconds();
+    size_t misses = 0;
+    for (const auto& name : names) {
+        std::string missing = name;
+        missing[missing.size() - 5] = '_';
+        misses += find(index, missing.c_str()) == nullptr;
+    }
+    double t3 = Testing::seconds();
+    CHECK_EQ(hits, size_t(count));
+    CHECK_EQ(misses, size_t(count));
+
+    std::printf("   %u files, %.1f MB archive, indexed in %.2f ms\n", count, m.size() / 1048576.0, 1e3 * (t1 - t0));
+    std::printf("   lookup %.0f ns per hit, %.0f ns per miss\n", 1e9 * (t2 - t1) / count, 1e9 * (t3 - t2) / count);
+}
+
+// Index cache
+
+static BSAIndex::Index sampleIndex() {
+    BSAIndex::Index index;
+    for (uint32_t i = 0; i != 500; ++i) {
+        std::string name = "textures\\tx_" + std::to_string(i) + ".dds";
+        index[BSAIndex::hashString(name.c_str()).value()] = BSAIndex::Entry { i % 3, 1000 + i * 16, 16 };
+    }
+    return index;
+}
+
+static std::vector<BSAIndex::CacheArchive> sampleArchives() {
+    return {
+        { "Morrowind.bsa", 1 << 20, 0x01d0000012345678ull },
+        { "Tribunal.bsa", 1 << 19, 0x01d0000012345679ull },
+        { "Bloodmoon.bsa", 1 << 18, 0x01d000001234567aull },
+    };
+}
+
+TEST(cache_checksum) {
+    // FNV-1a reference values
+    CHECK_EQ(BSAIndex::cacheChecksum("", 0), 0x811c9dc5u);
+    CHECK_EQ(BSAIndex::cacheChecksum("a", 1), 0xe40c292cu);
+    CHECK_EQ(BSAIndex::cacheChecksum("foobar", 6), 0xbf9cf968u);
+}
+
+TEST(cache_round_trip) {
+    BSAIndex::Index index = sampleIndex(), loaded;
+    std::vector<char> buf;
+    BSAIndex::encodeCache(sampleArchives(), index, buf);
+
+    CHECK(BSAIndex::decodeCache(buf.data(), buf.size(), sampleArchives(), loaded));
+    CHECK_EQ(loaded.size(), index.size());
+    bool same = true;
+    for (const auto& i : index) {
+        auto it = loaded.find(i.first);
+        same = same && it != loaded.end() && it->second.archive == i.second.archive
+               && it->second.position == i.second.position && it->second.size == i.second.size;
+    }
+    CHECK(same);
+
+    // Archive names are matched case insensitively
+    auto renamed = sampleArchives();
+    renamed[0].name = "MORROWIND.BSA";
+    loaded.clear();
+    CHECK(BSAIndex::decodeCache(buf.data(), buf.size(), renamed, loaded));
+
+    // An empty archive list round trips
+    std::vector<char> empty;
+    BSAIndex::encodeCache({}, BSAIndex::Index(), empty);
+    loaded.clear();
+    CHECK(BSAIndex::decodeCache(empty.data(), empty.size(), {}, loaded));
+    CHECK(loaded.empty());
+}
+
+TEST(cache_invalidation) {
+    BSAIndex::Index index = sampleIndex();
+    std::vector<char> buf;
+    BSAIndex::encodeCache(sampleArchives(), index, buf);
+
+    std::vector<std::vector<BSAIndex::CacheArchive>> changed;
+    changed.push_back(sampleArchives());
+    changed.back()[1].size += 1;                        // Archive replaced
+    changed.push_back(sampleArchives());
+    changed.back()[2].modified += 1;                    // Archive touched
+    changed.push_back(sampleArchives());
+    changed.back()[0].name = "Morrowind2.bsa";          // Different archive
+    changed.push_back(sampleArchives());
+    std::swap(changed.back()[1], changed.back()[2]);    // Load order changed
+    changed.push_back(sampleArchives());
+    changed.back().pop_back();                          // Archive removed
+    changed.push_back(sampleArchives());
+    changed.back().push_back({ "Extra.bsa", 100, 1 });  // Archive added
+
+    for (const auto& archives : changed) {
+        BSAIndex::Index loaded;
+        CHECK(!BSAIndex::decodeCache(buf.data(), buf.size(), archives, loaded));
+        CHECK(loaded.empty());
+    }
+}
+
+TEST(cache_corruption) {
+    BSAIndex::Index index = sampleIndex();
+    std::vector<char> buf;
+    BSAIndex::encodeCache(sampleArchives(), index, buf);
+
+    // Any changed byte is rejected, in the header by field checks and in the body by the checksum
+    int accepted = 0;
+    for (size_t i = 0; i < buf.size(); i += 7) {
+        std::vector<char> bad = buf;
+        bad[i] ^= 0x10;
+        BSAIndex::Index loaded;
+        if (BSAIndex::decodeCache(bad.data(), bad.size(), sampleArchives(), loaded)) {
+            ++accepted;
+        }
+    }
+    CHECK_EQ(accepted, 0);
+
+    // Truncated and extended caches
+    for (size_t n : { size_t(0), size_t(10), size_t(24), buf.size() / 2, buf.size() - 1 }) {
+        BSAIndex::Index loaded;
+        CHECK(!BSAIndex::decodeCache(buf.data(), n, sampleArchives(), loaded));
+        CHECK(loaded.empty());
+    }
+    std::vector<char> extended = buf;
+    extended.push_back(0);
+    BSAIndex::Index loaded;
+    CHECK(!BSAIndex::decodeCache(extended.data(), extended.size(), sampleArchives(), loaded));
+}
+
+TEST(cache_entry_bounds) {
+    // A well formed cache whose entries do not fit the archives is rejected as a whole
+    BSAIndex::Index index = sampleIndex();
+    index[12345] = BSAIndex::Entry { 2, (1 << 18) - 8, 16 };
+    std::vector<char> buf;
+    BSAIndex::encodeCache(sampleArchives(), index, buf);
+
+    BSAIndex::Index loaded;
+    CHECK(!BSAIndex::decodeCache(buf.data(), buf.size(), sampleArchives(), loaded));
+    CHECK(loaded.empty());
+
+    index.erase(12345);
+    index[12345] = BSAIndex::Entry { 3, 0, 1 };
+    BSAIndex::encodeCache(sampleArchives(), index, buf);
+    CHECK(!BSAIndex::decodeCache(buf.data(), buf.size(), sampleArchives(), loaded));
+    CHECK(loaded.empty());
+}
+
+BENCH(cache_decode) {
+    // Three archives as at startup, then the merged index either rebuilt from them or loaded from the cache
+    // The archives were just written, so re-indexing is timed with them in the OS file cache, its best case
+    const char* dirs[] = { "textures", "meshes", "icons" };
+    const uint32_t counts[] = { 60000, 30000, 10000 };
+    std::vector<std::unique_ptr<TempFile>> files;
+    std::vector<std::string> names;
+    for (int i = 0; i != 3; ++i) {
+        files.emplace_back(new TempFile(dirs[i], syntheticArchive(dirs[i], counts[i], names)));
+    }
+
+    double t0 = Testing::seconds();
+    BSAIndex::Index index;
+    std::vector<BSAIndex::CacheArchive> archives;
+    bool ok = true;
+    for (uint32_t i = 0; i != 3; ++i) {
+        FileMapping m;
+        ok = ok && m.open(files[i]->path.c_str()) && BSAIndex::parseArchive(m, i, index);
+        archives.push_back({ files[i]->path, m.size(), 1 });
+    }
+    double t1 = Testing::seconds();
+    CHECK(ok);
+
+    std::vector<char> buf;
+    BSAIndex::encodeCache(archives, index, buf);
+
+    double t2 = Testing::seconds();
+    BSAIndex::Index loaded;
+    ok = BSAIndex::decodeCache(buf.data(), buf.size(), archives, loaded);
+    double t3 = Testing::seconds();
+    CHECK(ok);
+    CHECK_EQ(loaded.size(), index.size());
+
+    std::printf("   %u entries, full re-index of 3 archives in %.2f ms\n", unsigned(index.size()), 1e3 * (t1 - t0));
+    std::printf("   %.1f KB cache, decoded in %.2f ms\n", buf.size() / 1024.0, 1e3 * (t3 - t2));
+}
@@ -0,0 +1,486 @@
+
+// Call trace - Writer and reader round trips, resource IDs, and rejection of truncated, corrupt and mismatched traces
+
+#include "testing.h"
+#include "support/calltrace.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+
+
+// Temporary directory, removed on destruction
+struct TempDir {
+    std::string root;
+
+    TempDir() {
+        char pattern[] = "/tmp/mgetraceXXXXXX";
+        const char* dir = mkdtemp(pattern);
+        root = dir ? dir : "";
+    }
+    ~TempDir() {
+        if (!root.empty()) {
+            std::system(("rm -rf '" + root + "'").c_str());
+        }
+    }
+
+    std::string path(const char* name) const { return root + "/" + name; }
+};
+
+static std::vector<uint8_t> readFile(const std::string& path) {
+    std::vector<uint8_t> data;
+    FILE* f = std::fopen(path.c_str(), "rb");
+    if (f) {
+        uint8_t buf[4096];
+        size_t n;
+        while ((n = std::fread(buf, 1, sizeof(buf), f)) != 0) {
+            data.insert(data.end(), buf, buf + n);
+        }
+        std::fclose(f);
+    }
+    return data;
+}
+
+static void writeFile(const std::string& path, const std::vector<uint8_t>& data, size_t size) {
+    FILE* f = std::fopen(path.c_str(), "wb");
+    if (f) {
+        std::fwrite(data.data(), 1, size, f);
+        std::fclose(f);
+    }
+}
+
+static uint32_t floatBits(float f) {
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+    return x;
+}
+
+// One record as written, for comparison with what is read back
+struct Expected {
+    CallOp op;
+    std::vector<uint32_t> args;
+    std::vector<uint8_t> data;
+};
+
+static std::vector<uint8_t> bytes(size_t n, uint8_t seed) {
+    std::vector<uint8_t> b(n);
+    for (size_t i = 0; i != n; ++i) {
+        b[i] = uint8_t(seed + 7 * i);
+    }
+    return b;
+}
+
+// A record of every kind, with data sizes that exercise padding
+static std::vector<Expected> everyKind() {
+    return {
+        { CallOp::Present, {}, {} },
+        { CallOp::BeginScene, {}, {} },
+        { CallOp::EndScene, {}, {} },
+        { CallOp::Clear, { 3, 0xff204060, floatBits(1.0f), 0 }, bytes(16, 1) },
+        { CallOp::SetRenderTarget, { 1, 2, 1 }, {} },
+        { CallOp::SetTransform, { 256 }, bytes(64, 2) },
+        { CallOp::MultiplyTransform, { 2 }, bytes(64, 3) },
+        { CallOp::SetMaterial, {}, bytes(68, 4) },
+        { CallOp::SetLight, { 5 }, bytes(103, 5) },
+        { CallOp::LightEnable, { 5, 1 }, {} },
+        { CallOp::SetRenderState, { 7, 1 }, {} },
+        { CallOp::SetTextureStageState, { 1, 4, 2 }, {} },
+        { CallOp::SetTexture, { 0, 3 }, {} },
+        { CallOp::SetVertexShader, { 0x152 }, {} },
+        { CallOp::SetStreamSource, { 0, 4, 32 }, {} },
+        { CallOp::SetIndices, { 5, 0 }, {} },
+        { CallOp::DrawIndexedPrimitive, { 4, 0, 24, 0, 12 }, {} },
+        { CallOp::ApplyStateBlock, { 0x1234 }, {} },
+        { CallOp::DefineVertexBuffer, { 4, 768, 8, 0x152, 1 }, bytes(1, 6) },
+        { CallOp::DefineIndexBuffer, { 5, 72, 8, 101, 1 }, bytes(2, 7) },
+        { CallOp::DefineTexture, { 3, 256, 128, 9, 0, 21, 1 }, {} },
+        { CallOp::SetLight, { 0, 1, 2, 3, 4, 5, 6, 7 }, bytes(3, 8) },
+    };
+}
+
+// writeExpected - Writes one record; initializer lists cannot be built at run time, so arguments go by count
+static void writeExpected(CallTraceWriter& w, const Expected& e) {
+    const uint32_t* a = e.args.data();
+    const void* d = e.data.empty() ? nullptr : e.data.data();
+    uint32_t n = uint32_t(e.data.size());
+
+    switch (e.args.size()) {
+    case 0: w.write(e.op, {}, d, n); break;
+    case 1: w.write(e.op, { a[0] }, d, n); break;
+    case 2: w.write(e.op, { a[0], a[1] }, d, n); break;
+    case 3: w.write(e.op, { a[0], a[1], a[2] }, d, n); break;
+    case 4: w.write(e.op, { a[0], a[1], a[2], a[3] }, d, n); break;
+    case 5: w.write(e.op, { a[0], a[1], a[2], a[3], a[4] }, d, n); break;
+    case 7: w.write(e.op, { a[0], a[1], a[2], a[3], a[4], a[5], a[6] }, d, n); break;
+    case 8: w.write(e.op, { a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7] }, d, n); break;
+    default: break;
+    }
+}
+
+static bool matches(const CallRecord& r, const Expected& e) {
+    if (r.op != e.op || r.argCount != int(e.args.size()) || r.dataSize != e.data.size()) {
+        return false;
+    }
+    for (int i = 0; i != r.argCount; ++i) {
+        if (r.arg(i) != e.args[i]) {
+            return false;
+        }
+    }
+    if (e.data.empty()) {
+        return r.data == nullptr;
+    }
+    return std::memcmp(r.data, e.data.data(), r.dataSize) == 0;
+}
+
+static std::string writeTrace(const TempDir& t, const char* name, const std::vector<Expected>& records, int frames) {
+    std::string path = t.path(name);
+    CallTraceWriter w;
+    if (!w.open(path.c_str())) {
+        return "";
+    }
+    for (const Expected& e : records) {
+        writeExpected(w, e);
+    }
+    for (int i = 0; i != frames; ++i) {
+        w.endFrame();
+    }
+    w.close();
+    return path;
+}
+
+// readCount - Records read before the reader stops
+static int readCount(CallTraceReader& r) {
+    CallRecord rec;
+    int n = 0;
+    while (r.next(rec)) {
+        ++n;
+    }
+    return n;
+}
+
+TEST(round_trip) {
+    TempDir t;
+    std::vector<Expected> records = everyKind();
+    CHECK(!t.root.empty());
+
+    CallTraceWriter w;
+    CHECK(w.open(t.path("a.trace").c_str()));
+    CHECK(w.isOpen());
+    for (const Expected& e : records) {
+        writeExpected(w, e);
+    }
+    w.endFrame();
+    w.endFrame();
+    CHECK_EQ(w.frameCount(), 2u);
+    CHECK(w.close());
+    CHECK(!w.isOpen());
+    CHECK(!w.failed());
+
+    CallTraceReader r;
+    CHECK(r.open(t.path("a.trace").c_str()));
+    CHECK_EQ(r.header().magic, callTraceMagic);
+    CHECK_EQ(r.header().version, callTraceVersion);
+    CHECK_EQ(r.header().frameCount, 2u);
+    CHECK_EQ(r.header().callCount, uint32_t(records.size() - 3));     // Define records are not calls
+    CHECK_EQ(r.header().resourceCount, 0u);
+
+    // Every kind decodes to what was written, in order
+    CallRecord rec;
+    size_t n = 0;
+    bool allMatch = true;
+    while (r.next(rec)) {
+        allMatch = allMatch && n < records.size() && matches(rec, records[n]);
+        ++n;
+    }
+    CHECK(allMatch);
+    CHECK_EQ(n, records.size());
+    CHECK(!r.truncated());
+
+    // Float arguments, and arguments beyond the count
+    r.rewind();
+    for (int i = 0; i != 4; ++i) {
+        CHECK(r.next(rec));
+    }
+    CHECK_EQ(rec.op, CallOp::Clear);
+    CHECK_EQ(rec.argFloat(2), 1.0f);
+    CHECK_EQ(rec.arg(4), 0u);
+
+    // Records are 4-byte aligned, with data padded
+    size_t expectedSize = sizeof(CallTraceHeader);
+    for (const Expected& e : records) {
+        expectedSize += sizeof(CallRecordHeader) + 4 * e.args.size() + ((e.data.size() + 3) & ~size_t(3));
+    }
+    CHECK_EQ(readFile(t.path("a.trace")).size(), expectedSize);
+}
+
+TEST(empty_trace) {
+    TempDir t;
+    std::string path = writeTrace(t, "empty.trace", {}, 0);
+    CallTraceReader r;
+    CHECK(r.open(path.c_str()));
+    CHECK_EQ(r.header().callCount, 0u);
+    CHECK_EQ(readCount(r), 0);
+    CHECK(!r.truncated());
+}
+
+TEST(large_trace) {
+    // Records beyond the writer's flush threshold are written out in order
+    TempDir t;
+    std::vector<Expected> records;
+    for (int i = 0; i != 3000; ++i) {
+        records.push_back({ CallOp::SetTransform, { uint32_t(i) }, bytes(1000 + i % 7, uint8_t(i)) });
+    }
+    std::string path = writeTrace(t, "large.trace", records, 1000);
+    CHECK(readFile(path).size() > (2u << 20));
+
+    CallTraceReader r;
+    CallRecord rec;
+    CHECK(r.open(path.c_str()));
+    CHECK_EQ(r.header().frameCount, 1000u);
+    CHECK_EQ(r.header().callCount, 3000u);
+    size_t n = 0;
+    bool allMatch = true;
+    while (r.next(rec)) {
+        allMatch = allMatch && n < records.size() && matches(rec, records[n]);
+        ++n;
+    }
+    CHECK(allMatch);
+    CHECK_EQ(n, records.size());
+}
+
+TEST(resource_ids) {
+    CallTraceWriter w;
+    TempDir t;
+    int a, b, c;
+    bool isNew;
+    CHECK(w.open(t.path("ids.trace").c_str()));
+
+    // IDs are assigned from 1 in order of first use, null is 0
+    CHECK_EQ(w.resourceId(&a, isNew), 1u);
+    CHECK(isNew);
+    CHECK_EQ(w.resourceId(&b, isNew), 2u);
+    CHECK(isNew);
+    CHECK_EQ(w.resourceId(&a, isNew), 1u);
+    CHECK(!isNew);
+    CHECK_EQ(w.resourceId(nullptr, isNew), 0u);
+    CHECK(!isNew);
+
+    // A forgotten address gets a new ID when reused
+    w.forget(&a);
+    CHECK_EQ(w.resourceId(&a, isNew), 3u);
+    CHECK(isNew);
+    CHECK_EQ(w.resourceId(&c, isNew), 4u);
+    CHECK(w.close());
+
+    CallTraceReader r;
+    CHECK(r.open(t.path("ids.trace").c_str()));
+    CHECK_EQ(r.header().resourceCount, 4u);
+
+    // Reopening starts numbering again
+    CHECK(w.open(t.path("ids2.trace").c_str()));
+    CHECK_EQ(w.resourceId(&c, isNew), 1u);
+    CHECK(isNew);
+}
+
+TEST(resource_references) {
+    // As the recorder writes them: a Define record precedes the first reference to each ID
+    TempDir t;
+    CallTraceWriter w;
+    int textures[3], vb;
+    CHECK(w.open(t.path("refs.trace").c_str()));
+
+    auto setTexture = [&](uint32_t stage, const void* tex) {
+        bool isNew;
+        uint32_t id = w.resourceId(tex, isNew);
+        if (isNew) {
+            w.write(CallOp::DefineTexture, { id, 64, 64, 1, 0, 21, 1 });
+        }
+        w.write(CallOp::SetTexture, { stage, id });
+    };
+    setTexture(0, &textures[0]);
+    setTexture(1, &textures[1]);
+    setTexture(0, &textures[0]);
+    setTexture(1, nullptr);
+    {
+        bool isNew;
+        uint32_t id = w.resourceId(&vb, isNew);
+        std::vector<uint8_t> contents = bytes(96, 9);
+        w.write(CallOp::DefineVertexBuffer, { id, 96, 8, 0x152, 1 }, contents.data(), uint32_t(contents.size()));
+        w.write(CallOp::SetStreamSource, { 0, id, 32 });
+    }
+    w.forget(&textures[1]);
+    setTexture(2, &textures[1]);
+    setTexture(3, &textures[2]);
+    CHECK(w.close());
+
+    CallTraceReader r;
+    CallRecord rec;
+    std::vector<bool> defined(r.header().resourceCount + 16, false);
+    std::vector<uint32_t> referenced;
+    bool definedBeforeUse = true, definedOnce = true;
+    CHECK(r.open(t.path("refs.trace").c_str()));
+    CHECK_EQ(r.header().resourceCount, 5u);
+    CHECK_EQ(r.header().callCount, 7u);
+    while (r.next(rec)) {
+        switch (rec.op) {
+        case CallOp::DefineTexture:
+        case CallOp::DefineVertexBuffer:
+            definedOnce = definedOnce && !defined[rec.arg(0)];
+            defined[rec.arg(0)] = true;
+            break;
+        case CallOp::SetTexture:
+            referenced.push_back(rec.arg(1));
+            definedBeforeUse = definedBeforeUse && (rec.arg(1) == 0 || defined[rec.arg(1)]);
+            break;
+        case CallOp::SetStreamSource:
+            referenced.push_back(rec.arg(1));
+            definedBeforeUse = definedBeforeUse && defined[rec.arg(1)];
+            CHECK_EQ(rec.dataSize, 0u);
+            break;
+        default:
+            break;
+        }
+    }
+    CHECK(definedBeforeUse);
+    CHECK(definedOnce);
+    CHECK(referenced == std::vector<uint32_t>({ 1, 2, 1, 0, 3, 4, 5 }));
+    CHECK(!r.truncated());
+}
+
+TEST(truncated) {
+    // Cut at every length: records before the cut decode, and a cut within a record is reported
+    TempDir t;
+    std::vector<Expected> records = everyKind();
+    std::string path = writeTrace(t, "full.trace", records, 1);
+    std::vector<uint8_t> full = readFile(path);
+
+    std::vector<size_t> boundaries = { sizeof(CallTraceHeader) };
+    for (const Expected& e : records) {
+        boundaries.push_back(boundaries.back() + sizeof(CallRecordHeader) + 4 * e.args.size() + ((e.data.size() + 3) & ~size_t(3)));
+    }
+    CHECK_EQ(boundaries.back(), full.size());
+
+    std::string cutPath = t.path("cut.trace");
+    bool countsMatch = true, flagsMatch = true, headersRejected = true;
+    for (size_t size = 0; size <= full.size(); ++size) {
+        writeFile(cutPath, full, size);
+        CallTraceReader r;
+        bool opened = r.open(cutPath.c_str());
+        if (size < sizeof(CallTraceHeader)) {
+            headersRejected = headersRejected && !opened;
+            continue;
+        }
+
+        int complete = 0;
+        while (complete + 1 < int(boundaries.size()) && boundaries[complete + 1] <= size) {
+            ++complete;
+        }
+        bool onBoundary = boundaries[complete] == size;
+        countsMatch = countsMatch && opened && readCount(r) == complete;
+        flagsMatch = flagsMatch && r.truncated() == !onBoundary;
+    }
+    CHECK(headersRejected);
+    CHECK(countsMatch);
+    CHECK(flagsMatch);
+}
+
+TEST(corrupt) {
+    TempDir t;
+    std::vector<Expected> records = {
+        { CallOp::BeginScene, {}, {} },
+        { CallOp::SetRenderState, { 7, 1 }, {} },
+        { CallOp::EndScene, {}, {} },
+    };
+    std::string path = writeTrace(t, "good.trace", records, 1);
+    std::vector<uint8_t> good = readFile(path);
+    const size_t second = sizeof(CallTraceHeader) + sizeof(CallRecordHeader);
+
+    // Patches the second record's header; the first record still decodes
+    auto patched = [&](size_t offset, std::vector<uint8_t> value) {
+        std::vector<uint8_t> bad = good;
+        std::memcpy(bad.data() + second + offset, value.data(), value.size());
+        writeFile(t.path("bad.trace"), bad, bad.size());
+
+        CallTraceReader r;
+        CallRecord rec;
+        bool ok = r.open(t.path("bad.trace").c_str()) && r.next(rec) && rec.op == CallOp::BeginScene;
+        return ok && !r.next(rec) && r.truncated();
+    };
+    CHECK(patched(0, { 0 }));                                   // Op 0
+    CHECK(patched(0, { uint8_t(CallOp::Count) }));              // Unknown op
+    CHECK(patched(0, { 0xff }));
+    CHECK(patched(1, { CallRecord::maxArgs + 1 }));             // Too many arguments
+    CHECK(patched(4, { 0xf0, 0xff, 0xff, 0xff }));              // Data beyond the end of the trace
+    CHECK(patched(4, { 0xff, 0xff, 0xff, 0xff }));              // Padded size wraps
+
+    // The unpatched trace reads through
+    CallTraceReader r;
+    CHECK(r.open(path.c_str()));
+    CHECK_EQ(readCount(r), 3);
+    CHECK(!r.truncated());
+}
+
+TEST(header_mismatch) {
+    TempDir t;
+    std::string path = writeTrace(t, "good.trace", { { CallOp::Present, {}, {} } }, 1);
+    std::vector<uint8_t> good = readFile(path);
+    std::string badPath = t.path("bad.trace");
+    CallTraceReader r;
+
+    // Other versions and files that are not traces are rejected when opened
+    std::vector<uint8_t> bad = good;
+    uint32_t version = callTraceVersion + 1;
+    std::memcpy(bad.data() + 4, &version, 4);
+    writeFile(badPath, bad, bad.size());
+    CHECK(!r.open(badPath.c_str()));
+
+    bad = good;
+    version = 0;
+    std::memcpy(bad.data() + 4, &version, 4);
+    writeFile(badPath, bad, bad.size());
+    CHECK(!r.open(badPath.c_str()));
+
+    bad = good;
+    bad[0] ^= 0x20;
+    writeFile(badPath, bad, bad.size());
+    CHECK(!r.open(badPath.c_str()));
+
+    CHECK(!r.open(t.path("missing.trace").c_str()));
+    CHECK(r.open(path.c_str()));
+    CHECK_EQ(readCount(r), 1);
+
+    // A failed open leaves nothing to read
+    CHECK(!r.open(badPath.c_str()));
+    CHECK_EQ(readCount(r), 0);
+}
+
+TEST(writer_states) {
+    TempDir t;
+    CallTraceWriter w;
+
+    // Writes without an open trace are ignored, and a path that cannot be created fails to open
+    w.write(CallOp::Present, {});
+    CHECK(w.close());
+    CHECK(!w.open(t.path("missing/dir.trace").c_str()));
+    CHECK(!w.isOpen());
+
+    // Reopening discards the previous trace's counts
+    CHECK(w.open(t.path("a.trace").c_str()));
+    w.write(CallOp::Present, {});
+    w.endFrame();
+    CHECK(w.open(t.path("b.trace").c_str()));
+    w.write(CallOp::BeginScene, {});
+    CHECK(w.close());
+
+    CallTraceReader r;
+    CHECK(r.open(t.path("a.trace").c_str()));
+    CHECK_EQ(r.header().frameCount, 1u);
+    CHECK_EQ(r.header().callCount, 1u);
+    CHECK(r.open(t.path("b.trace").c_str()));
+    CHECK_EQ(r.header().frameCount, 0u);
+    CHECK_EQ(r.header().callCount, 1u);
+}
@@ -0,0 +1,341 @@
+
+// Capture queue - Screenshot slot bookkeeping against a simulated GPU and encoder, and ordinal numbering against a temporary directory
+
+#include "testing.h"
+#include "support/capturequeue.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+
+
+// Simulated captures. Copies complete once the GPU has run latency more frames; encodes finish after the
+// slot's encode time in frames, as workers would, or at once when waited for. A capture completed before
+// its copy has finished forces a synchronous readback, which is counted as a stall.
+// Misuse by the queue, such as copying into a busy slot or finishing an unencoded slot, is counted.
+struct SimCaptures : CaptureBackend {
+    enum SlotState { Idle, Copying, Encoding, Encoded };
+
+    struct Slot {
+        SlotState state = Idle;
+        long copyFrame = 0, encodeDone = 0;
+        std::string path;
+    };
+
+    int latency = 1;
+    bool queries = true;
+    bool failCopy = false;
+    std::vector<int> encodeFrames;     // By submission, frames each encode takes; 0 when not listed
+
+    long frame = 0, submitted = 0;
+    int errors = 0, stalls = 0, waits = 0;
+    Slot slots[CaptureQueue::maxDepth];
+    std::vector<std::string> encodes, finishes;
+
+    bool copy(int slot) {
+        Slot& s = slots[slot];
+        if (s.state != Idle) {
+            ++errors;
+        }
+        if (failCopy) {
+            return false;
+        }
+        s.state = Copying;
+        s.copyFrame = frame;
+        ++submitted;
+        return true;
+    }
+    QueryStatus poll(int slot) {
+        if (!queries) {
+            return Unsupported;
+        }
+        return copied(slot) ? Complete : Pending;
+    }
+    void startEncode(int slot, const std::string& path) {
+        Slot& s = slots[slot];
+        if (s.state != Copying) {
+            ++errors;
+        }
+        if (!copied(slot)) {
+            ++stalls;
+        }
+        size_t n = encodes.size();
+        s.state = Encoding;
+        s.encodeDone = frame + (n < encodeFrames.size() ? encodeFrames[n] : 0);
+        s.path = path;
+        encodes.push_back(path);
+    }
+    bool encoded(int slot, bool wait) {
+        Slot& s = slots[slot];
+        if (s.state == Encoding && (wait || frame >= s.encodeDone)) {
+            waits += frame < s.encodeDone;
+            s.state = Encoded;
+        }
+        return s.state == Encoded;
+    }
+    bool finish(int slot) {
+        Slot& s = slots[slot];
+        if (s.state != Encoded) {
+            ++errors;
+        }
+        s.state = Idle;
+        finishes.push_back(s.path);
+        return s.path.find("fail") == std::string::npos;
+    }
+
+    bool copied(int slot) const {
+        return frame >= slots[slot].copyFrame + latency;
+    }
+};
+
+struct Run {
+    SimCaptures gpu;
+    CaptureQueue queue;
+    std::vector<std::string> completions;
+
+    Run() : queue(&gpu) {
+    }
+
+    // submit - As ScreenshotQueue::submit, returns the slot used or -1
+    int submit(const std::string& path) {
+        if (queue.pathPending(path.c_str())) {
+            return -1;
+        }
+        int slot = queue.acquire();
+        bool issued = queue.issue(slot, path, [this, path](bool success) {
+            completions.push_back(path + (success ? "" : " failed"));
+        });
+        return issued ? slot : -1;
+    }
+
+    void frames(int n) {
+        for (int i = 0; i != n; ++i) {
+            ++gpu.frame;
+            queue.update();
+        }
+    }
+};
+
+TEST(callback_order) {
+    // Later captures that encode faster are still reported after earlier ones
+    Run r;
+    r.gpu.encodeFrames = { 5, 1, 0 };
+    CHECK_EQ(r.submit("a.png"), 0);
+    CHECK_EQ(r.submit("b.png"), 1);
+    CHECK_EQ(r.submit("c fail.png"), 2);
+
+    r.frames(3);
+    CHECK(r.completions.empty());
+    CHECK_EQ(r.gpu.encodes.size(), size_t(3));
+
+    r.frames(3);
+    CHECK_EQ(r.completions.size(), size_t(3));
+    CHECK(r.completions[0] == "a.png");
+    CHECK(r.completions[1] == "b.png");
+    CHECK(r.completions[2] == "c fail.png failed");
+    CHECK(r.gpu.finishes == std::vector<std::string>({ "a.png", "b.png", "c fail.png" }));
+    CHECK_EQ(r.gpu.errors, 0);
+    CHECK_EQ(r.gpu.stalls + r.gpu.waits, 0);
+    CHECK_EQ(r.queue.pendingCount(), 0);
+}
+
+TEST(back_pressure) {
+    // With every slot busy, a new capture completes the oldest first, stalling on its copy and encode
+    Run r;
+    r.gpu.latency = 100;
+    r.gpu.encodeFrames = { 50 };
+    CHECK_EQ(r.submit("0.png"), 0);
+    CHECK_EQ(r.submit("1.png"), 1);
+    CHECK_EQ(r.submit("2.png"), 2);
+    r.frames(1);
+    CHECK(r.completions.empty());
+
+    CHECK_EQ(r.submit("3.png"), 0);
+    CHECK(r.completions == std::vector<std::string>({ "0.png" }));
+    CHECK_EQ(r.gpu.stalls, 1);
+    CHECK_EQ(r.gpu.waits, 1);
+    CHECK_EQ(r.queue.pendingCount(), 3);
+
+    // The rest still complete in submission order
+    r.frames(100);
+    CHECK(r.completions == std::vector<std::string>({ "0.png", "1.png", "2.png", "3.png" }));
+    CHECK_EQ(r.gpu.errors, 0);
+}
+
+TEST(reuse_lowest) {
+    // Occasional captures keep using slot 0, so other slots never allocate surfaces
+    Run r;
+    for (int i = 0; i != 5; ++i) {
+        CHECK_EQ(r.submit("shot " + std::to_string(i) + ".png"), 0);
+        r.frames(2);
+    }
+    CHECK_EQ(r.completions.size(), size_t(5));
+
+    // Overlapping captures take the lowest free slot
+    r.gpu.latency = 3;
+    CHECK_EQ(r.submit("a.png"), 0);
+    CHECK_EQ(r.submit("b.png"), 1);
+    r.frames(3);
+    CHECK_EQ(r.submit("c.png"), 0);
+    CHECK_EQ(r.submit("d.png"), 1);
+    CHECK_EQ(r.submit("e.png"), 2);
+    r.frames(5);
+    CHECK_EQ(r.completions.size(), size_t(10));
+    CHECK_EQ(r.gpu.errors, 0);
+}
+
+TEST(path_pending) {
+    // A path is rejected while it is being written, ignoring case
+    Run r;
+    r.gpu.latency = 2;
+    CHECK_EQ(r.submit("Shots\\MGE 0001.png"), 0);
+    CHECK(r.queue.pathPending("shots\\mge 0001.PNG"));
+    CHECK(!r.queue.pathPending("shots\\mge 0001.png.png"));
+    CHECK(!r.queue.pathPending("shots\\mge 0001"));
+    CHECK_EQ(r.submit("SHOTS\\mge 0001.png"), -1);
+
+    r.frames(2);
+    CHECK(!r.queue.pathPending("shots\\mge 0001.png"));
+    CHECK_EQ(r.submit("SHOTS\\mge 0001.png"), 0);
+}
+
+TEST(copy_failure) {
+    // A failed copy leaves the slot free and is never reported
+    Run r;
+    r.gpu.failCopy = true;
+    CHECK_EQ(r.submit("a.png"), -1);
+    CHECK(r.queue.slotFree(0));
+    CHECK_EQ(r.queue.pendingCount(), 0);
+
+    r.gpu.failCopy = false;
+    CHECK_EQ(r.submit("a.png"), 0);
+    r.frames(2);
+    CHECK(r.completions == std::vector<std::string>({ "a.png" }));
+}
+
+TEST(no_queries) {
+    // Without completion queries, copies are read back two frames after issue
+    Run r;
+    r.gpu.queries = false;
+    r.gpu.latency = 2;
+    CHECK_EQ(r.submit("a.png"), 0);
+    r.frames(1);
+    CHECK(r.gpu.encodes.empty());
+    r.frames(1);
+    CHECK_EQ(r.gpu.encodes.size(), size_t(1));
+    CHECK_EQ(r.completions.size(), size_t(1));
+    CHECK_EQ(r.gpu.stalls, 0);
+}
+
+TEST(flush) {
+    // Flushing completes everything in order, waiting as needed
+    Run r;
+    r.gpu.latency = 10;
+    r.gpu.encodeFrames = { 20, 20, 20 };
+    r.submit("a.png");
+    r.submit("b.png");
+    r.submit("c.png");
+    r.queue.flush();
+    CHECK(r.completions == std::vector<std::string>({ "a.png", "b.png", "c.png" }));
+    CHECK_EQ(r.gpu.stalls, 3);
+    CHECK_EQ(r.queue.pendingCount(), 0);
+    CHECK(r.queue.slotFree(0) && r.queue.slotFree(1) && r.queue.slotFree(2));
+    CHECK_EQ(r.gpu.errors, 0);
+}
+
+TEST(depth) {
+    Run r;
+    CHECK_EQ(r.queue.usableDepth(), int(CaptureQueue::defaultDepth));
+    r.queue.setDepth(100);
+    CHECK_EQ(r.queue.usableDepth(), int(CaptureQueue::maxDepth));
+    r.queue.setDepth(0);
+    CHECK_EQ(r.queue.usableDepth(), int(CaptureQueue::defaultDepth));
+
+    // A depth of one serializes captures
+    r.queue.setDepth(1);
+    r.gpu.latency = 5;
+    CHECK_EQ(r.submit("a.png"), 0);
+    CHECK_EQ(r.submit("b.png"), 0);
+    CHECK(r.completions == std::vector<std::string>({ "a.png" }));
+    CHECK_EQ(r.gpu.stalls, 1);
+
+    // Deeper, captures overlap without stalling
+    r.queue.flush();
+    r.queue.setDepth(6);
+    for (int i = 0; i != 6; ++i) {
+        CHECK_EQ(r.submit(std::to_string(i) + ".png"), i);
+    }
+    r.frames(6);
+    CHECK_EQ(r.completions.size(), size_t(8));
+    CHECK_EQ(r.gpu.stalls, 2);
+}
+
+
+
+// Temporary directory, removed on destruction
+struct TempDir {
+    std::string root;
+
+    TempDir() {
+        char pattern[] = "/tmp/mgeshotsXXXXXX";
+        const char* dir = mkdtemp(pattern);
+        root = dir ? dir : "";
+    }
+    ~TempDir() {
+        if (!root.empty()) {
+            std::system(("rm -rf '" + root + "'").c_str());
+        }
+    }
+
+    void dir(const char* path) { mkdir((root + "/" + path).c_str(), 0755); }
+    void file(const char* path) {
+        FILE* f = std::fopen((root + "/" + path).c_str(), "wb");
+        if (f) {
+            std::fclose(f);
+        }
+    }
+};
+
+TEST(ordinal_of) {
+    CHECK_EQ(CaptureOrdinals::ordinalOf("MGE Screenshot 0012.png"), 12);
+    CHECK_EQ(CaptureOrdinals::ordinalOf("Nerevar, Day 4, 10.30 0099.jpg"), 99);
+    CHECK_EQ(CaptureOrdinals::ordinalOf("MGE Screenshot 2024-01-05 10.20.30.123.png"), 10);
+    CHECK_EQ(CaptureOrdinals::ordinalOf("noordinal.png"), 0);
+    CHECK_EQ(CaptureOrdinals::ordinalOf("trailing .png"), 0);
+    CHECK_EQ(CaptureOrdinals::ordinalOf("ends with space "), 0);
+    CHECK_EQ(CaptureOrdinals::ordinalOf(""), 0);
+}
+
+TEST(ordinal_scan) {
+    TempDir t;
+    CHECK(!t.root.empty());
+    t.file("MGE Screenshot 0012.png");
+    t.file("Other 3.bmp");
+    t.file("Nerevar, Day 4, 10.30 0099.jpg");
+    t.file("noordinal.png");
+    t.dir("Old 0500");      // Directories are not screenshots
+
+    CHECK_EQ(CaptureOrdinals::highestInFolder(t.root.c_str()), 99);
+    CHECK_EQ(CaptureOrdinals::highestInFolder((t.root + "/missing").c_str()), 0);
+
+    CaptureOrdinals ordinals;
+    CHECK_EQ(ordinals.next(t.root.c_str()), 100);
+    CHECK_EQ(ordinals.next(t.root.c_str()), 101);
+
+    // The directory is scanned once; numbers handed out are not reused, even before their files exist
+    t.file("Late 0300.png");
+    CHECK_EQ(ordinals.next(t.root.c_str()), 102);
+
+    // Each directory is numbered separately, and a missing one starts at 1
+    CHECK_EQ(ordinals.next((t.root + "/missing").c_str()), 1);
+    CHECK_EQ(ordinals.next((t.root + "/missing").c_str()), 2);
+    CHECK_EQ(ordinals.next(t.root.c_str()), 103);
+
+    // Clearing rescans
+    ordinals.clear();
+    CHECK_EQ(ordinals.next(t.root.c_str()), 301);
+}
@@ -0,0 +1,409 @@
+
+// ddsParse - Supported formats, mip chain layout, rejection of truncated or unsupported files, and the
+// texture pipeline stages that feed it
+
+#include "testing.h"
+#include "support/ddsparse.h"
+#include "support/filemapping.h"
+#include "support/loosefiles.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+
+
+static const uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+static const uint32_t DDPF_ALPHAPIXELS = 0x1;
+static const uint32_t DDPF_FOURCC = 0x4;
+static const uint32_t DDPF_RGB = 0x40;
+
+// Header field offsets in 32-bit words, counted from the magic
+enum Field {
+    Magic = 0, Size = 1, Flags = 2, Height = 3, Width = 4, MipMapCount = 7,
+    PfSize = 19, PfFlags = 20, PfFourCC = 21, PfBitCount = 22, PfRMask = 23, PfGMask = 24, PfBMask = 25, PfAMask = 26,
+    Caps2 = 28
+};
+
+static uint32_t fourCC(const char* s) {
+    return uint32_t(uint8_t(s[0])) | (uint32_t(uint8_t(s[1])) << 8) | (uint32_t(uint8_t(s[2])) << 16) | (uint32_t(uint8_t(s[3])) << 24);
+}
+
+static void set(std::vector<uint8_t>& f, Field field, uint32_t x) {
+    std::memcpy(&f[field * 4], &x, 4);
+}
+
+// levelSize - Bytes in one mip level, as D3D lays them out
+static size_t levelSize(DDSFormat format, unsigned int w, unsigned int h) {
+    switch (format) {
+    case DDSFormat::DXT1:
+        return size_t((w + 3) / 4) * ((h + 3) / 4) * 8;
+    case DDSFormat::DXT3:
+    case DDSFormat::DXT5:
+        return size_t((w + 3) / 4) * ((h + 3) / 4) * 16;
+    default:
+        return size_t(w) * h * 4;
+    }
+}
+
+static size_t chainSize(DDSFormat format, unsigned int w, unsigned int h, unsigned int levels) {
+    size_t n = 0;
+    for (unsigned int i = 0; i != levels; ++i) {
+        n += levelSize(format, w, h);
+        w = w > 1 ? w / 2 : 1;
+        h = h > 1 ? h / 2 : 1;
+    }
+    return n;
+}
+
+// makeDDS - A DDS file with a given header and pixel data sized for a number of levels
+static std::vector<uint8_t> makeDDS(DDSFormat format, unsigned int w, unsigned int h, unsigned int mipCount, unsigned int dataLevels) {
+    std::vector<uint8_t> f(128 + chainSize(format, w, h, dataLevels));
+    for (size_t i = 128; i != f.size(); ++i) {
+        f[i] = uint8_t(i * 31);
+    }
+
+    set(f, Magic, fourCC("DDS "));
+    set(f, Size, 124);
+    set(f, Flags, 0x1007 | (mipCount ? DDSD_MIPMAPCOUNT : 0));
+    set(f, Height, h);
+    set(f, Width, w);
+    set(f, MipMapCount, mipCount);
+    set(f, PfSize, 32);
+
+    switch (format) {
+    case DDSFormat::DXT1:
+        set(f, PfFlags, DDPF_FOURCC);
+        set(f, PfFourCC, fourCC("DXT1"));
+        break;
+    case DDSFormat::DXT3:
+        set(f, PfFlags, DDPF_FOURCC);
+        set(f, PfFourCC, fourCC("DXT3"));
+        break;
+    case DDSFormat::DXT5:
+        set(f, PfFlags, DDPF_FOURCC);
+        set(f, PfFourCC, fourCC("DXT5"));
+        break;
+    case DDSFormat::A8R8G8B8:
+    case DDSFormat::X8R8G8B8:
+        set(f, PfFlags, DDPF_RGB | (format == DDSFormat::A8R8G8B8 ? DDPF_ALPHAPIXELS : 0));
+        set(f, PfBitCount, 32);
+        set(f, PfRMask, 0xff0000);
+        set(f, PfGMask, 0xff00);
+        set(f, PfBMask, 0xff);
+        set(f, PfAMask, format == DDSFormat::A8R8G8B8 ? 0xff000000 : 0);
+        break;
+    default:
+        break;
+    }
+    return f;
+}
+
+static unsigned int fullChain(unsigned int w, unsigned int h) {
+    unsigned int n = 1;
+    while (w > 1 || h > 1) {
+        w = w > 1 ? w / 2 : 1;
+        h = h > 1 ? h / 2 : 1;
+        ++n;
+    }
+    return n;
+}
+
+// checkLayout - Levels are contiguous after the header, halving down to 1x1
+static bool checkLayout(const std::vector<uint8_t>& f, const DDSImage& image, DDSFormat format, unsigned int w, unsigned int h) {
+    const uint8_t* expect = f.data() + 128;
+    for (const auto& level : image.levels) {
+        bool compressed = format == DDSFormat::DXT1 || format == DDSFormat::DXT3 || format == DDSFormat::DXT5;
+        unsigned int blockBytes = format == DDSFormat::DXT1 ? 8 : 16;
+        if (level.width != w || level.height != h || level.data != expect || level.size != levelSize(format, w, h)) {
+            return false;
+        }
+        if (compressed && (level.pitch != ((w + 3) / 4) * blockBytes || level.rows != (h + 3) / 4)) {
+            return false;
+        }
+        if (!compressed && (level.pitch != w * 4 || level.rows != h)) {
+            return false;
+        }
+        expect += level.size;
+        w = w > 1 ? w / 2 : 1;
+        h = h > 1 ? h / 2 : 1;
+    }
+    return true;
+}
+
+TEST(formats_full_chain) {
+    DDSFormat formats[] = { DDSFormat::DXT1, DDSFormat::DXT3, DDSFormat::DXT5, DDSFormat::A8R8G8B8, DDSFormat::X8R8G8B8 };
+    for (DDSFormat format : formats) {
+        std::vector<uint8_t> f = makeDDS(format, 256, 64, 9, 9);
+        DDSImage image;
+        CHECK(ddsParse(f.data(), f.size(), &image));
+        CHECK(image.format == format);
+        CHECK_EQ(image.width, 256u);
+        CHECK_EQ(image.height, 64u);
+        CHECK_EQ(image.levels.size(), size_t(9));
+        CHECK(checkLayout(f, image, format, 256, 64));
+        CHECK(image.levels.back().width == 1 && image.levels.back().height == 1);
+    }
+}
+
+TEST(single_level) {
+    // No mip count flag means one level, whatever the count field holds
+    std::vector<uint8_t> f = makeDDS(DDSFormat::DXT5, 128, 128, 0, 1);
+    set(f, MipMapCount, 8);
+    DDSImage image;
+    CHECK(ddsParse(f.data(), f.size(), &image));
+    CHECK_EQ(image.levels.size(), size_t(1));
+
+    // A mip count of zero with the flag set is also one level
+    f = makeDDS(DDSFormat::DXT1, 16, 16, 0, 1);
+    set(f, Flags, 0x1007 | DDSD_MIPMAPCOUNT);
+    CHECK(ddsParse(f.data(), f.size(), &image));
+    CHECK_EQ(image.levels.size(), size_t(1));
+}
+
+TEST(partial_chain) {
+    std::vector<uint8_t> f = makeDDS(DDSFormat::A8R8G8B8, 64, 64, 3, 3);
+    DDSImage image;
+    CHECK(ddsParse(f.data(), f.size(), &image));
+    CHECK_EQ(image.levels.size(), size_t(3));
+    CHECK(checkLayout(f, image, DDSFormat::A8R8G8B8, 64, 64));
+    CHECK_EQ(image.levels.back().width, 16u);
+}
+
+TEST(excessive_mip_count) {
+    // Levels stop at 1x1, whatever the header claims
+    unsigned int counts[] = { 12, 100, 0xffffffff };
+    for (unsigned int count : counts) {
+        std::vector<uint8_t> f = makeDDS(DDSFormat::DXT1, 512, 512, count, fullChain(512, 512));
+        DDSImage image;
+        CHECK(ddsParse(f.data(), f.size(), &image));
+        CHECK_EQ(image.levels.size(), size_t(10));
+        CHECK(checkLayout(f, image, DDSFormat::DXT1, 512, 512));
+    }
+}
+
+TEST(non_power_of_two) {
+    struct Size { unsigned int w, h; } sizes[] = { { 100, 37 }, { 3, 5 }, { 1, 7 }, { 640, 1 }, { 1, 1 } };
+    DDSFormat formats[] = { DDSFormat::DXT1, DDSFormat::DXT5, DDSFormat::X8R8G8B8 };
+
+    for (DDSFormat format : formats) {
+        for (const Size& s : sizes) {
+            unsigned int levels = fullChain(s.w, s.h);
+            std::vector<uint8_t> f = makeDDS(format, s.w, s.h, levels, levels);
+            DDSImage image;
+            CHECK(ddsParse(f.data(), f.size(), &image));
+            CHECK_EQ(image.levels.size(), size_t(levels));
+            CHECK(checkLayout(f, image, format, s.w, s.h));
+        }
+    }
+
+    // Compressed levels smaller than a block still take a whole block
+    std::vector<uint8_t> f = makeDDS(DDSFormat::DXT3, 2, 2, 2, 2);
+    DDSImage image;
+    CHECK(ddsParse(f.data(), f.size(), &image));
+    CHECK(image.levels.size() == 2 && image.levels[0].size == 16 && image.levels[1].size == 16);
+}
+
+TEST(truncated) {
+    std::vector<uint8_t> f = makeDDS(DDSFormat::DXT5, 64, 64, 7, 7);
+    DDSImage image;
+
+    // Inside the header, and inside or at the end of each level
+    CHECK(!ddsParse(f.data(), 0, &image));
+    CHECK(!ddsParse(f.data(), 4, &image));
+    CHECK(!ddsParse(f.data(), 127, &image));
+    CHECK(!ddsParse(f.data(), 128, &image));
+    CHECK(!ddsParse(f.data(), 128 + levelSize(DDSFormat::DXT5, 64, 64), &image));
+    CHECK(!ddsParse(f.data(), f.size() - 1, &image));
+    CHECK(ddsParse(f.data(), f.size(), &image));
+
+    // Trailing data is ignored
+    f.resize(f.size() + 100);
+    CHECK(ddsParse(f.data(), f.size(), &image));
+    CHECK_EQ(image.levels.size(), size_t(7));
+}
+
+TEST(rejected_headers) {
+    std::vector<uint8_t> good = makeDDS(DDSFormat::DXT1, 32, 32, 1, 1);
+    DDSImage image;
+    CHECK(ddsParse(good.data(), good.size(), &image));
+
+    auto rejected = [&](Field field, uint32_t value) {
+        std::vector<uint8_t> f = good;
+        set(f, field, value);
+        return !ddsParse(f.data(), f.size(), &image);
+    };
+
+    CHECK(rejected(Magic, fourCC("DDS_")));
+    CHECK(rejected(Size, 120));
+    CHECK(rejected(PfSize, 24));
+    CHECK(rejected(Width, 0));
+    CHECK(rejected(Height, 0));
+    CHECK(rejected(Width, 16385));
+    CHECK(rejected(Height, 0x80000000));
+    CHECK(rejected(Caps2, 0x200));          // Cube map
+    CHECK(rejected(Caps2, 0x200000));       // Volume
+    CHECK(rejected(PfFourCC, fourCC("DXT2")));
+    CHECK(rejected(PfFourCC, fourCC("ATI2")));
+    CHECK(rejected(PfFlags, 0));
+
+    // Only 32-bit RGB with standard masks is supported uncompressed
+    std::vector<uint8_t> rgb = makeDDS(DDSFormat::X8R8G8B8, 8, 8, 1, 1);
+    std::vector<uint8_t> f = rgb;
+    set(f, PfBitCount, 24);
+    CHECK(!ddsParse(f.data(), f.size(), &image));
+    f = rgb;
+    set(f, PfRMask, 0xff);
+    set(f, PfBMask, 0xff0000);
+    CHECK(!ddsParse(f.data(), f.size(), &image));
+
+    // Alpha flag with a non-standard alpha mask falls back to X8R8G8B8
+    f = rgb;
+    set(f, PfFlags, DDPF_RGB | DDPF_ALPHAPIXELS);
+    set(f, PfAMask, 0x0f000000);
+    CHECK(ddsParse(f.data(), f.size(), &image));
+    CHECK(image.format == DDSFormat::X8R8G8B8);
+}
+
+TEST(huge_dimensions_truncated) {
+    // Largest accepted size, with no data, must fail on bounds rather than overflow
+    std::vector<uint8_t> f = makeDDS(DDSFormat::A8R8G8B8, 1, 1, 1, 1);
+    set(f, Width, 16384);
+    set(f, Height, 16384);
+    DDSImage image;
+    CHECK(!ddsParse(f.data(), f.size(), &image));
+}
+
+BENCH(parse) {
+    std::vector<uint8_t> f = makeDDS(DDSFormat::DXT1, 2048, 2048, 12, 12);
+    DDSImage image;
+    const int n = 200000;
+    int ok = 0;
+
+    double t0 = Testing::seconds();
+    for (int i = 0; i != n; ++i) {
+        ok += ddsParse(f.data(), f.size(), &image) ? 1 : 0;
+    }
+    double t1 = Testing::seconds();
+    CHECK_EQ(ok, n);
+    std::printf("   2048x2048 DXT1 with 12 levels, %.0f ns per parse\n", 1e9 * (t1 - t0) / n);
+}
+
+// Temporary texture tree, removed on destruction
+struct TempTree {
+    std::string root;
+
+    TempTree() {
+        char pattern[] = "/tmp/mgeddsXXXXXX";
+        const char* dir = mkdtemp(pattern);
+        root = dir ? dir : "";
+    }
+    ~TempTree() {
+        if (!root.empty()) {
+            std::system(("rm -rf '" + root + "'").c_str());
+        }
+    }
+
+    void dir(const std::string& path) { mkdir((root + "/" + path).c_str(), 0755); }
+    void file(const std::string& path, const std::vector<uint8_t>& contents) {
+        FILE* f = std::fopen((root + "/" + path).c_str(), "wb");
+        if (f) {
+            std::fwrite(contents.data(), 1, contents.size(), f);
+            std::fclose(f);
+        }
+    }
+};
+
+BENCH(pipeline_stages) {
+    // The distant land texture pipeline's worker stages, run one after another on a loose file tree:
+    // resolve names against the snapshot, read each file into staging memory, then parse it
+    const int count = 2000;
+    TempTree t;
+    char name[128];
+    t.dir("statics");
+    t.dir("statics/textures");
+    t.dir("data");
+    t.dir("data/textures");
+    for (int i = 0; i != count / 20; ++i) {
+        std::snprintf(name, sizeof(name), "data/textures/dir%02d", i);
+        t.dir(name);
+    }
+
+    // A quarter in the distant statics folder, the rest in Data Files, in a mix of formats and sizes
+    const DDSFormat formats[] = { DDSFormat::DXT1, DDSFormat::DXT5, DDSFormat::DXT1, DDSFormat::A8R8G8B8 };
+    std::vector<std::string> requests;
+    size_t totalBytes = 0;
+    for (int i = 0; i != count; ++i) {
+        unsigned int size = (i % 8 == 0) ? 256 : 128;
+        std::vector<uint8_t> f = makeDDS(formats[i % 4], size, size, fullChain(size, size), fullChain(size, size));
+        if (i % 4 == 0) {
+            std::snprintf(name, sizeof(name), "statics/textures/tx_static_%04d.dds", i);
+        } else {
+            std::snprintf(name, sizeof(name), "data/textures/dir%02d/tx_file_%04d.dds", i / 20, i);
+        }
+        t.file(name, f);
+        totalBytes += f.size();
+
+        // Requested as the game names them, with the original extension and case
+        if (i % 4 == 0) {
+            std::snprintf(name, sizeof(name), "Tx_Static_%04d.tga", i);
+        } else {
+            std::snprintf(name, sizeof(name), "Dir%02d\\Tx_File_%04d.tga", i / 20, i);
+        }
+        requests.push_back(name);
+    }
+
+    double t0 = Testing::seconds();
+    LooseTextures loose(t.root + "/statics/", t.root + "/data/");
+    loose.refresh();
+
+    double t1 = Testing::seconds();
+    std::vector<LooseTextureRequest> resolved(count);
+    int found = 0;
+    for (int i = 0; i != count; ++i) {
+        found += loose.resolve(requests[i].c_str(), &resolved[i]) && resolved[i].roots[0];
+    }
+
+    double t2 = Testing::seconds();
+    std::vector<std::vector<char>> staging(count);
+    std::string path;
+    int loaded = 0;
+    for (int i = 0; i != count; ++i) {
+        const LooseTextureRequest& r = resolved[i];
+        bool distant = r.inRoot(0, LooseTextures::DistantStatics);
+        path = loose.roots[distant ? LooseTextures::DistantStatics : LooseTextures::DataFiles] + r.path[0];
+        std::replace(path.begin(), path.end(), '\\', '/');
+
+        FileMapping m;
+        if (m.open(path.c_str())) {
+            FileView v = m.view(0, size_t(m.size()));
+            if (v.valid()) {
+                staging[i].assign(v.data(), v.data() + v.size());
+                ++loaded;
+            }
+        }
+    }
+
+    double t3 = Testing::seconds();
+    int parsed = 0;
+    for (int i = 0; i != count; ++i) {
+        DDSImage image;
+        parsed += ddsParse(staging[i].data(), staging[i].size(), &image);
+    }
+    double t4 = Testing::seconds();
+
+    CHECK_EQ(found, count);
+    CHECK_EQ(loaded, count);
+    CHECK_EQ(parsed, count);
+    std::printf("   %d textures, %.1f MB, files in the OS cache\n", count, totalBytes / 1048576.0);
+    std::printf("   snapshot  %.2f ms\n", 1e3 * (t1 - t0));
+    std::printf("   resolve   %.2f ms, %.0f ns per name\n", 1e3 * (t2 - t1), 1e9 * (t2 - t1) / count);
+    std::printf("   read      %.2f ms, %.1f us per file\n", 1e3 * (t3 - t2), 1e6 * (t3 - t2) / count);
+    std::printf("   parse     %.2f ms, %.0f ns per file\n", 1e3 * (t4 - t3), 1e9 * (t4 - t3) / count);
+}
@@ -0,0 +1,234 @@
+
+// Effect variables - Handle lookups, deferred writes and reloads, against a mock effect
+
+#include "testing.h"
+#include "mge/effectvariables.h"
+
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+
+
+// Mock effect with named float4 parameters, counting lookups and writes
+struct MockEffect : ID3DXEffect {
+    struct Parameter {
+        std::string name;
+        float value[4];
+    };
+
+    std::vector<Parameter> parameters;
+    std::map<std::string, int> lookups;
+    int writes = 0;
+
+    explicit MockEffect(std::initializer_list<const char*> names) {
+        // Reserved up front, as handles point into the parameter list
+        parameters.reserve(names.size());
+        for (const char* name : names) {
+            parameters.push_back(Parameter { name, { 0, 0, 0, 0 } });
+        }
+    }
+
+    Parameter* parameter(D3DXHANDLE h) {
+        return reinterpret_cast<Parameter*>(const_cast<char*>(h));
+    }
+    float value(const char* name) {
+        for (Parameter& p : parameters) {
+            if (p.name == name) {
+                return p.value[0];
+            }
+        }
+        return -1;
+    }
+
+    D3DXHANDLE GetParameterByName(D3DXHANDLE, const char* name) {
+        ++lookups[name];
+        for (Parameter& p : parameters) {
+            if (p.name == name) {
+                return reinterpret_cast<D3DXHANDLE>(&p);
+            }
+        }
+        return nullptr;
+    }
+    HRESULT SetBool(D3DXHANDLE h, BOOL b) {
+        ++writes;
+        parameter(h)->value[0] = b ? 1.0f : 0.0f;
+        return D3D_OK;
+    }
+    HRESULT SetInt(D3DXHANDLE h, int n) {
+        ++writes;
+        parameter(h)->value[0] = float(n);
+        return D3D_OK;
+    }
+    HRESULT SetFloat(D3DXHANDLE h, float f) {
+        ++writes;
+        parameter(h)->value[0] = f;
+        return D3D_OK;
+    }
+    HRESULT SetFloatArray(D3DXHANDLE h, const float* f, unsigned int count) {
+        ++writes;
+        std::memcpy(parameter(h)->value, f, (count < 4 ? count : 4) * sizeof(float));
+        return D3D_OK;
+    }
+    HRESULT SetMatrix(D3DXHANDLE, const D3DXMATRIX*) {
+        ++writes;
+        return D3D_OK;
+    }
+    HRESULT SetTexture(D3DXHANDLE, LPDIRECT3DBASETEXTURE9) {
+        ++writes;
+        return D3D_OK;
+    }
+};
+
+TEST(lookup_once) {
+    // Each name is looked up in the effect once, including names the effect does not have
+    MockEffect effect { "alpha", "beta" };
+    EffectVariables vars;
+    vars.reset(&effect);
+
+    for (int i = 0; i != 100; ++i) {
+        CHECK(vars.setFloat("alpha", float(i)));
+        CHECK(vars.setInt("beta", i));
+        CHECK(!vars.setFloat("missing", 1.0f));
+        CHECK(vars.find("alpha") != nullptr);
+        vars.flush();
+    }
+    CHECK_EQ(effect.lookups["alpha"], 1);
+    CHECK_EQ(effect.lookups["beta"], 1);
+    CHECK_EQ(effect.lookups["missing"], 1);
+    CHECK_EQ(effect.writes, 200);
+}
+
+TEST(last_write_wins) {
+    // Writes are deferred to flush, with one effect write per variable carrying the last value
+    MockEffect effect { "alpha", "beta", "gamma" };
+    EffectVariables vars;
+    vars.reset(&effect);
+
+    vars.setFloat("alpha", 1.0f);
+    vars.setInt("beta", 2);
+    vars.setFloat("alpha", 3.0f);
+    vars.setBool("gamma", true);
+    vars.setInt("alpha", 5);
+    const float v[4] = { 7, 8, 9, 10 };
+    vars.setFloatArray("beta", v, 4);
+    CHECK_EQ(effect.writes, 0);
+    CHECK_EQ(effect.value("alpha"), 0.0f);
+
+    vars.flush();
+    CHECK_EQ(effect.writes, 3);
+    CHECK_EQ(effect.value("alpha"), 5.0f);
+    CHECK_EQ(effect.value("beta"), 7.0f);
+    CHECK_EQ(effect.value("gamma"), 1.0f);
+
+    // Nothing pending after a flush
+    vars.flush();
+    CHECK_EQ(effect.writes, 3);
+}
+
+TEST(access_flushes) {
+    // The API getters and direct setters use access(), which applies pending writes first
+    MockEffect effect { "alpha", "beta" };
+    EffectVariables vars;
+    vars.reset(&effect);
+
+    vars.setFloat("alpha", 4.0f);
+    vars.setFloat("beta", 6.0f);
+    D3DXHANDLE h = vars.access("alpha");
+    CHECK(h != nullptr);
+    CHECK_EQ(effect.parameter(h)->value[0], 4.0f);
+    CHECK_EQ(effect.value("beta"), 6.0f);
+
+    // A direct write after access is not overwritten by the earlier deferred write
+    effect.SetFloat(h, 9.0f);
+    vars.flush();
+    CHECK_EQ(effect.value("alpha"), 9.0f);
+
+    CHECK(vars.access("missing") == nullptr);
+    CHECK_EQ(effect.lookups["alpha"], 1);
+}
+
+TEST(large_arrays) {
+    // Arrays over 4 floats are written through at once, after pending writes
+    MockEffect effect { "alpha", "big" };
+    EffectVariables vars;
+    vars.reset(&effect);
+
+    const float v[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+    vars.setFloat("alpha", 2.0f);
+    CHECK(vars.setFloatArray("big", v, 8));
+    CHECK_EQ(effect.writes, 2);
+    CHECK_EQ(effect.value("alpha"), 2.0f);
+    CHECK_EQ(effect.value("big"), 1.0f);
+    CHECK(!vars.setFloatArray("missing", v, 8));
+}
+
+TEST(reset_on_reload) {
+    // Reloading drops cached handles and pending writes; names resolve again in the new effect
+    MockEffect first { "alpha", "beta" };
+    MockEffect second { "beta", "alpha", "gamma" };
+    EffectVariables vars;
+    vars.reset(&first);
+
+    vars.setFloat("alpha", 1.0f);
+    vars.setFloat("gamma", 1.0f);
+    vars.reset(&second);
+    vars.flush();
+    CHECK_EQ(first.writes, 0);
+    CHECK_EQ(second.writes, 0);
+
+    CHECK(vars.setFloat("alpha", 2.0f));
+    CHECK(vars.setFloat("gamma", 3.0f));
+    vars.flush();
+    CHECK_EQ(second.value("alpha"), 2.0f);
+    CHECK_EQ(second.value("gamma"), 3.0f);
+    CHECK_EQ(second.lookups["alpha"], 1);
+    CHECK_EQ(first.value("alpha"), 0.0f);
+
+    // Released effects accept no writes
+    vars.reset(nullptr);
+    CHECK(!vars.setFloat("alpha", 4.0f));
+    CHECK(vars.find("alpha") == nullptr);
+    vars.flush();
+    CHECK_EQ(second.value("alpha"), 2.0f);
+}
+
+TEST(shared_names) {
+    // Name IDs are shared by all effects; caches grow as other effects intern new names
+    MockEffect a { "alpha" }, b { "beta" };
+    EffectVariables va, vb;
+    va.reset(&a);
+    vb.reset(&b);
+
+    CHECK(va.setFloat("alpha", 1.0f));
+    for (int i = 0; i != 50; ++i) {
+        std::string name = "shared_names_" + std::to_string(i);
+        CHECK(!vb.setFloat(name.c_str(), 1.0f));
+    }
+    CHECK(vb.setFloat("beta", 2.0f));
+    CHECK(va.setFloat("alpha", 3.0f));
+    va.flush();
+    vb.flush();
+    CHECK_EQ(a.value("alpha"), 3.0f);
+    CHECK_EQ(b.value("beta"), 2.0f);
+}
+
+BENCH(frame_writes) {
+    // A script setting 16 variables each frame, some several times
+    MockEffect effect { "v0", "v1", "v2", "v3", "v4", "v5", "v6", "v7", "v8", "v9", "v10", "v11", "v12", "v13", "v14", "v15" };
+    const char* names[16] = { "v0", "v1", "v2", "v3", "v4", "v5", "v6", "v7", "v8", "v9", "v10", "v11", "v12", "v13", "v14", "v15" };
+    EffectVariables vars;
+    vars.reset(&effect);
+
+    const int frames = 100000;
+    double t0 = Testing::seconds();
+    for (int f = 0; f != frames; ++f) {
+        for (int i = 0; i != 32; ++i) {
+            vars.setFloat(names[i & 15], float(f));
+        }
+        vars.flush();
+    }
+    double t1 = Testing::seconds();
+    std::printf("   %.0f ns per frame of 32 writes, %d effect writes\n", 1e9 * (t1 - t0) / frames, effect.writes);
+}
@@ -0,0 +1,363 @@
+
+// GPU timestamp ring - Readback against a simulated GPU with result latency, disjoint frames, stalls and counter wrap
+
+#include "testing.h"
+#include "support/gputimestamps.h"
+
+#include <cstdint>
+#include <set>
+#include <vector>
+
+
+
+// Simulated timestamp queries. Each timestamp takes the current GPU clock when issued; results become available
+// once the GPU has completed the frame, which is latency presents later unless the GPU is stalled.
+// The GPU keeps completing frames whether or not the ring measured them.
+// Misuse by the ring, such as reusing a slot the GPU has not finished or reading unissued queries, is counted.
+struct SimGpu : TimestampQueryBackend {
+    struct Slot {
+        long serial;            // Frame number issued in this slot, 0 if never issued
+        bool recording;
+        std::vector<uint64_t> ticks;
+        std::vector<bool> written;
+    };
+
+    int latency = 1;
+    bool stalled = false;
+    bool failCreate = false;
+    uint64_t clock = 0, frequency = 1000000;    // 1 tick per microsecond
+    std::set<long> disjointFrames, backwardsFrames;
+
+    int creates = 0, releases = 0, errors = 0;
+    long frame = 1, issued = 0, completed = 0;
+    std::vector<Slot> slots;
+
+    bool create(int frameSlots, int timestampsPerFrame) {
+        ++creates;
+        slots.assign(frameSlots, Slot { 0, false, std::vector<uint64_t>(timestampsPerFrame), std::vector<bool>(timestampsPerFrame) });
+        return !failCreate;
+    }
+    void release() {
+        ++releases;
+    }
+
+    void beginFrame(int slot) {
+        Slot& s = slots[slot];
+        if (s.recording || s.serial > completed) {
+            ++errors;
+        }
+        s.recording = true;
+        s.written.assign(s.written.size(), false);
+    }
+    void endFrame(int slot) {
+        Slot& s = slots[slot];
+        if (!s.recording) {
+            ++errors;
+        }
+        s.recording = false;
+        s.serial = frame;
+        ++issued;
+        if (backwardsFrames.count(s.serial)) {
+            s.ticks[1] = s.ticks[0] - 1;
+        }
+    }
+    void timestamp(int slot, int index) {
+        Slot& s = slots[slot];
+        if (!s.recording || index < 0 || index >= int(s.ticks.size())) {
+            ++errors;
+            return;
+        }
+        s.ticks[index] = clock;
+        s.written[index] = true;
+    }
+
+    bool frameResult(int slot, bool* disjoint, uint64_t* f) {
+        const Slot& s = slots[slot];
+        if (s.recording || s.serial == 0) {
+            ++errors;
+            return false;
+        }
+        if (stalled || s.serial > completed) {
+            return false;
+        }
+        *disjoint = disjointFrames.count(s.serial) != 0;
+        *f = frequency;
+        return true;
+    }
+    bool timestampResult(int slot, int index, uint64_t* ticks) {
+        const Slot& s = slots[slot];
+        if (s.recording || !s.written[index]) {
+            ++errors;
+            return false;
+        }
+        if (stalled || s.serial > completed) {
+            return false;
+        }
+        *ticks = s.ticks[index];
+        return true;
+    }
+
+    // End of a frame on the GPU side
+    void present() {
+        if (!stalled && frame - latency > completed) {
+            completed = frame - latency;
+        }
+        ++frame;
+    }
+
+    // Let the GPU finish everything issued so far
+    void drain() {
+        stalled = false;
+        completed = frame;
+    }
+};
+
+enum { ZoneFrame, ZoneA, ZoneB, ZoneCount };
+
+// One frame of work: zone A for a ticks, then zone B twice for b ticks each, with 10 ticks outside zones
+static void runFrame(GpuTimestampRing& ring, SimGpu& gpu, uint64_t a, uint64_t b) {
+    ring.beginFrame();
+    gpu.clock += 10;
+    ring.beginZone(ZoneA);
+    gpu.clock += a;
+    ring.endZone(ZoneA);
+    for (int i = 0; i != 2; ++i) {
+        ring.beginZone(ZoneB);
+        gpu.clock += b;
+        ring.endZone(ZoneB);
+    }
+    ring.endFrame();
+    gpu.present();
+    gpu.clock += 1000;          // CPU time between frames, not measured
+}
+
+TEST(latency) {
+    // Results are read back latency frames late, in order, with exact zone times
+    for (int latency = 0; latency != GpuTimestampRing::frameSlots; ++latency) {
+        SimGpu gpu;
+        gpu.latency = latency;
+        GpuTimestampRing ring(&gpu, ZoneCount, ZoneFrame);
+        RollingStats stats[ZoneCount];
+        CHECK(ring.init());
+
+        int collected = 0, wrong = 0;
+        for (int frame = 1; frame <= 40; ++frame) {
+            runFrame(ring, gpu, 100 + frame, 30);
+            int n = ring.collect(stats);
+            collected += n;
+
+            // The frame read last is the one issued latency frames ago
+            int expect = frame - latency;
+            if (expect >= 1) {
+                wrong += n != 1;
+                wrong += stats[ZoneA].last() != float(100 + expect);
+                wrong += stats[ZoneB].last() != 60.0f;
+                wrong += stats[ZoneFrame].last() != float(10 + 100 + expect + 60);
+            } else {
+                wrong += n != 0;
+            }
+        }
+        CHECK_EQ(wrong, 0);
+        CHECK_EQ(collected, 40 - latency);
+        CHECK_EQ(ring.droppedFrames(), 0);
+        CHECK_EQ(gpu.errors, 0);
+
+        // Frames still in flight are collected once the GPU catches up
+        gpu.drain();
+        CHECK_EQ(ring.collect(stats), latency);
+        CHECK_EQ(stats[ZoneA].summarise().samples, 40);
+    }
+}
+
+TEST(latency_beyond_ring) {
+    // With results later than the ring can cover, frames are skipped rather than waited on
+    SimGpu gpu;
+    gpu.latency = GpuTimestampRing::frameSlots + 2;
+    GpuTimestampRing ring(&gpu, ZoneCount, ZoneFrame);
+    RollingStats stats[ZoneCount];
+    CHECK(ring.init());
+
+    int collected = 0;
+    for (int frame = 1; frame <= 60; ++frame) {
+        runFrame(ring, gpu, 200, 20);
+        collected += ring.collect(stats);
+    }
+    gpu.drain();
+    collected += ring.collect(stats);
+    CHECK(ring.droppedFrames() > 0);
+    CHECK_EQ(collected + ring.droppedFrames(), 60);
+    CHECK_EQ(gpu.errors, 0);
+    RollingStats::Summary a = stats[ZoneA].summarise();
+    CHECK(a.min == 200.0f && a.max == 200.0f);
+}
+
+TEST(disjoint_frames) {
+    // Disjoint frames, or frames without a frequency, are released without samples
+    SimGpu gpu;
+    gpu.disjointFrames = { 3, 4, 9 };
+    GpuTimestampRing ring(&gpu, ZoneCount, ZoneFrame);
+    RollingStats stats[ZoneCount];
+    CHECK(ring.init());
+
+    int collected = 0;
+    for (int frame = 1; frame <= 12; ++frame) {
+        runFrame(ring, gpu, 100, 25);
+        collected += ring.collect(stats);
+    }
+    gpu.drain();
+    collected += ring.collect(stats);
+
+    CHECK_EQ(collected, 12);
+    CHECK_EQ(stats[ZoneA].summarise().samples, 9);
+    CHECK_EQ(stats[ZoneFrame].summarise().samples, 9);
+    CHECK_EQ(stats[ZoneB].summarise().max, 50.0f);
+
+    gpu.frequency = 0;
+    runFrame(ring, gpu, 100, 25);
+    gpu.drain();
+    CHECK_EQ(ring.collect(stats), 1);
+    CHECK_EQ(stats[ZoneA].summarise().samples, 9);
+    CHECK_EQ(gpu.errors, 0);
+}
+
+TEST(stalled_gpu) {
+    // A GPU that stops completing work fills the ring; later frames are dropped without blocking,
+    // and measurement resumes in order once it recovers
+    SimGpu gpu;
+    GpuTimestampRing ring(&gpu, ZoneCount, ZoneFrame);
+    RollingStats stats[ZoneCount];
+    CHECK(ring.init());
+
+    for (int frame = 1; frame <= 3; ++frame) {
+        runFrame(ring, gpu, 100, 10);
+        ring.collect(stats);
+    }
+    CHECK_EQ(stats[ZoneA].summarise().samples, 2);
+
+    gpu.stalled = true;
+    int collected = 0;
+    for (int frame = 4; frame <= 20; ++frame) {
+        runFrame(ring, gpu, 500 + frame, 10);
+        collected += ring.collect(stats);
+    }
+    CHECK_EQ(collected, 0);
+    CHECK_EQ(ring.droppedFrames(), 17 - (GpuTimestampRing::frameSlots - 1));
+    CHECK_EQ(gpu.errors, 0);
+
+    // Frame 3 was in flight before the stall, then frames 4-6 filled the ring
+    gpu.drain();
+    CHECK_EQ(ring.collect(stats), GpuTimestampRing::frameSlots);
+    CHECK_EQ(stats[ZoneA].last(), float(500 + 6));
+    CHECK_EQ(stats[ZoneA].summarise().samples, 2 + GpuTimestampRing::frameSlots);
+
+    int dropped = ring.droppedFrames();
+    runFrame(ring, gpu, 700, 10);
+    gpu.drain();
+    CHECK_EQ(ring.collect(stats), 1);
+    CHECK_EQ(stats[ZoneA].last(), 700.0f);
+    CHECK_EQ(ring.droppedFrames(), dropped);
+    CHECK_EQ(gpu.errors, 0);
+}
+
+TEST(counter_wrap) {
+    // Frames and spans across the 64-bit counter wrap are measured as if the counter had not wrapped
+    SimGpu gpu;
+    gpu.latency = 0;
+    GpuTimestampRing ring(&gpu, ZoneCount, ZoneFrame);
+    RollingStats stats[ZoneCount];
+    CHECK(ring.init());
+
+    int wrong = 0;
+    for (uint64_t start : { ~uint64_t(0) - 5, ~uint64_t(0) - 50, ~uint64_t(0) - 115, ~uint64_t(0) - 140, ~uint64_t(0) }) {
+        gpu.clock = start;
+        runFrame(ring, gpu, 100, 20);
+        wrong += ring.collect(stats) != 1;
+        wrong += stats[ZoneA].last() != 100.0f;
+        wrong += stats[ZoneB].last() != 40.0f;
+        wrong += stats[ZoneFrame].last() != 150.0f;
+    }
+    CHECK_EQ(wrong, 0);
+    CHECK_EQ(gpu.errors, 0);
+}
+
+TEST(backwards_timestamps) {
+    // A frame that ends before it starts is unreliable, and is released without samples instead of as a huge time
+    SimGpu gpu;
+    gpu.latency = 0;
+    gpu.backwardsFrames = { 2 };
+    GpuTimestampRing ring(&gpu, ZoneCount, ZoneFrame);
+    RollingStats stats[ZoneCount];
+    CHECK(ring.init());
+
+    for (int frame = 1; frame <= 3; ++frame) {
+        runFrame(ring, gpu, 100, 20);
+        CHECK_EQ(ring.collect(stats), 1);
+    }
+    CHECK_EQ(stats[ZoneFrame].summarise().samples, 2);
+    CHECK_EQ(stats[ZoneFrame].summarise().max, 150.0f);
+    CHECK_EQ(stats[ZoneA].summarise().samples, 2);
+}
+
+TEST(zone_rules) {
+    // Recursive entry counts in the outer span, spans open at frame end are dropped, and unused zones record zero
+    SimGpu gpu;
+    gpu.latency = 0;
+    GpuTimestampRing ring(&gpu, ZoneCount, ZoneFrame);
+    RollingStats stats[ZoneCount];
+    CHECK(ring.init());
+
+    ring.beginFrame();
+    ring.beginZone(ZoneA);
+    gpu.clock += 10;
+    ring.beginZone(ZoneA);
+    gpu.clock += 10;
+    ring.endZone(ZoneA);
+    gpu.clock += 10;
+    ring.endZone(ZoneA);
+    ring.beginZone(ZoneB);
+    gpu.clock += 10;
+    ring.endFrame();
+    gpu.present();
+    CHECK_EQ(ring.collect(stats), 1);
+    CHECK_EQ(stats[ZoneA].last(), 20.0f);
+    CHECK_EQ(stats[ZoneB].last(), 0.0f);
+    CHECK_EQ(stats[ZoneFrame].last(), 40.0f);
+
+    // Running out of timestamps drops the spans that do not fit
+    ring.beginFrame();
+    for (int i = 0; i != GpuTimestampRing::timestampsPerFrame; ++i) {
+        ring.beginZone(ZoneB);
+        gpu.clock += 1;
+        ring.endZone(ZoneB);
+    }
+    ring.endFrame();
+    gpu.present();
+    CHECK_EQ(ring.collect(stats), 1);
+    CHECK_EQ(stats[ZoneB].last(), float((GpuTimestampRing::timestampsPerFrame - 2) / 2));
+    CHECK_EQ(gpu.errors, 0);
+}
+
+TEST(init_failure) {
+    // Without queries, every call is a no-op
+    SimGpu gpu;
+    gpu.failCreate = true;
+    GpuTimestampRing ring(&gpu, ZoneCount, ZoneFrame);
+    RollingStats stats[ZoneCount];
+    CHECK(!ring.init());
+    CHECK(!ring.ready());
+    CHECK_EQ(gpu.releases, 1);
+
+    runFrame(ring, gpu, 100, 10);
+    CHECK_EQ(ring.collect(stats), 0);
+    CHECK_EQ(gpu.issued, 0);
+
+    // Reinitialised after a device reset, the ring starts empty
+    gpu.failCreate = false;
+    CHECK(ring.init());
+    gpu.latency = 0;
+    runFrame(ring, gpu, 100, 10);
+    CHECK_EQ(ring.collect(stats), 1);
+    ring.release();
+    CHECK_EQ(gpu.releases, 2);
+    CHECK_EQ(gpu.errors, 0);
+}
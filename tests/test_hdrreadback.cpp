@@ -0,0 +1,278 @@
+
+// HDR readback ring - Luminance readback against a simulated GPU with result latency and stalls, and adaptation over time
+
+#include "testing.h"
+#include "support/hdrreadback.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+
+
+// Simulated readback. Each issue samples the current scene luminance; results complete once the GPU has
+// presented latency more frames, unless the GPU is stalled. Misuse by the ring, such as issuing into a slot
+// the GPU has not finished, or reading a result before it completes, is counted.
+struct SimReadback : LuminanceReadbackBackend {
+    struct Slot {
+        long serial;            // Sample number issued in this slot, 0 if never issued
+    };
+    struct Sample {
+        long frame;
+        double time;
+        float luminance;
+    };
+
+    int latency = 1;
+    bool stalled = false;
+    bool queries = true;
+    bool failCreate = false;
+    long failRead = -1;         // Sample serial that cannot be read
+
+    double time = 0;            // Scene time, at which the next issue samples
+    float scene = 1.0f;         // Grey level of the current frame
+
+    int creates = 0, releases = 0, errors = 0;
+    long frame = 0, completed = 0;
+    std::vector<Slot> slots;
+    std::vector<Sample> samples;
+    std::vector<long> reads;
+    double lastReadTime = 0;
+
+    bool create(int n) {
+        ++creates;
+        slots.assign(n, Slot { 0 });
+        return !failCreate;
+    }
+    void release() {
+        ++releases;
+    }
+
+    void issue(int slot) {
+        Slot& s = slots[slot];
+        if (s.serial > completed) {
+            ++errors;
+        }
+        samples.push_back(Sample { frame, time, scene });
+        s.serial = long(samples.size());
+    }
+    QueryStatus poll(int slot) {
+        if (!queries) {
+            return Unsupported;
+        }
+        return slots[slot].serial <= completed ? Complete : Pending;
+    }
+    bool read(int slot, float* rgb) {
+        long serial = slots[slot].serial;
+        if (serial == 0 || serial > completed) {
+            ++errors;
+        }
+        reads.push_back(serial);
+        if (serial == failRead) {
+            return false;
+        }
+
+        const Sample& s = samples[serial - 1];
+        rgb[0] = rgb[1] = rgb[2] = s.luminance;
+        lastReadTime = s.time;
+        return true;
+    }
+
+    // present - End of frame; the GPU completes work issued latency frames ago, in order
+    void present() {
+        ++frame;
+        if (stalled) {
+            return;
+        }
+        while (completed < long(samples.size()) && samples[completed].frame + latency <= frame) {
+            ++completed;
+        }
+    }
+};
+
+// Runs frames of dt seconds, the scene changing to luminance for frames after stepTime
+struct Run {
+    SimReadback gpu;
+    HDRReadbackRing ring;
+    HDRAdaptation adapt;
+    int collected = 0;
+
+    Run() : ring(&gpu) {
+        adapt.reset();
+    }
+
+    void frames(int n, double dt, double stepTime = 1e9, float luminance = 0, int environmentFlags = 0, float reactionTime = 0.5f) {
+        for (int i = 0; i != n; ++i) {
+            gpu.time += dt;
+            if (gpu.time > stepTime) {
+                gpu.scene = luminance;
+            }
+            collected += ring.frame(float(dt), &adapt, environmentFlags, reactionTime);
+            gpu.present();
+        }
+    }
+
+    bool readInOrder() const {
+        for (size_t i = 1; i < gpu.reads.size(); ++i) {
+            if (gpu.reads[i] != gpu.reads[i - 1] + 1) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+TEST(in_order) {
+    Run r;
+    CHECK(r.ring.init());
+    CHECK_EQ(r.gpu.creates, 1);
+    CHECK_EQ(r.gpu.slots.size(), size_t(HDRReadbackRing::slots));
+
+    r.frames(200, 1.0 / 60);
+    CHECK_EQ(r.gpu.errors, 0);
+    CHECK_EQ(r.ring.skippedFrames(), 0);
+    CHECK_EQ(r.gpu.samples.size(), size_t(200));
+    CHECK_EQ(r.collected, 199);
+    CHECK(r.readInOrder());
+    CHECK_EQ(r.gpu.reads.front(), 1L);
+
+    r.ring.release();
+    CHECK_EQ(r.gpu.releases, 1);
+    CHECK_EQ(r.ring.frame(0.1f, &r.adapt, 0, 0.5f), 0);
+}
+
+TEST(full_ring) {
+    // A GPU further behind than the ring is deep: frames without a free slot are not sampled, and nothing waits
+    Run r;
+    r.gpu.latency = 4;
+    CHECK(r.ring.init());
+
+    r.frames(300, 1.0 / 60);
+    CHECK_EQ(r.gpu.errors, 0);
+    CHECK(r.ring.skippedFrames() > 0);
+    CHECK_EQ(long(r.gpu.samples.size()) + r.ring.skippedFrames(), 300L);
+    CHECK(r.readInOrder());
+    CHECK(r.collected > 50);
+}
+
+TEST(stall) {
+    Run r;
+    CHECK(r.ring.init());
+    r.frames(20, 1.0 / 60);
+
+    // Stalled, the ring collects what completed before the stall, then fills and skips every frame without reading
+    r.gpu.stalled = true;
+    r.frames(1, 1.0 / 60);
+    int collectedBefore = r.collected;
+    r.frames(29, 1.0 / 60);
+    CHECK_EQ(r.collected, collectedBefore);
+    CHECK(r.ring.skippedFrames() >= 30 - HDRReadbackRing::slots);
+    CHECK_EQ(long(r.gpu.samples.size()) + r.ring.skippedFrames(), 50L);
+
+    // Recovered, everything in flight is collected in order and sampling resumes
+    // The frame in which the GPU catches up still finds the ring full
+    int skipped = r.ring.skippedFrames();
+    r.gpu.stalled = false;
+    r.frames(30, 1.0 / 60);
+    CHECK_EQ(r.gpu.errors, 0);
+    CHECK(r.readInOrder());
+    CHECK_EQ(r.ring.skippedFrames(), skipped + 1);
+    CHECK_EQ(long(r.gpu.reads.size()), long(r.gpu.samples.size()) - 1);
+}
+
+TEST(no_queries) {
+    // Without completion queries, entries are read once the ring has cycled, which is safe for short latencies
+    Run r;
+    r.gpu.queries = false;
+    r.gpu.latency = HDRReadbackRing::slots - 1;
+    CHECK(r.ring.init());
+
+    r.frames(100, 1.0 / 60);
+    CHECK_EQ(r.gpu.errors, 0);
+    CHECK_EQ(r.ring.skippedFrames(), 0);
+    CHECK(r.readInOrder());
+    CHECK_EQ(long(r.gpu.reads.size()), 100L - (HDRReadbackRing::slots - 1));
+}
+
+TEST(failed_read) {
+    // An unreadable sample is released without adapting; the next sample filters over both intervals
+    Run a, b;
+    b.gpu.failRead = 10;
+    CHECK(a.ring.init());
+    CHECK(b.ring.init());
+    a.frames(11, 1.0 / 64, 0.0, 0.25f);
+    b.frames(11, 1.0 / 64, 0.0, 0.25f);
+    CHECK_EQ(b.collected, a.collected - 1);
+
+    a.frames(50, 1.0 / 64, 0.0, 0.25f);
+    b.frames(50, 1.0 / 64, 0.0, 0.25f);
+    CHECK(b.readInOrder());
+    CHECK_NEAR(a.adapt.point[1], b.adapt.point[1], 1e-5f);
+}
+
+TEST(init_failure) {
+    Run r;
+    r.gpu.failCreate = true;
+    CHECK(!r.ring.init());
+    CHECK(!r.ring.ready());
+    CHECK_EQ(r.gpu.releases, 1);
+    CHECK_EQ(r.ring.frame(0.1f, &r.adapt, 0, 0.5f), 0);
+    CHECK_EQ(r.adapt.point[1], 1.0f);
+}
+
+// Luminance after a step from 1.0 to low at 1 second, by exact exponential decay
+static float expectedAfterStep(double t, float low, float reactionTime) {
+    return low + (1.0f - low) * float(std::exp(-(t - 1.0) / reactionTime));
+}
+
+TEST(convergence_frame_rate) {
+    // With frame times exact in binary, every sample rate and latency gives the exact adaptation at a sample time
+    const float low = 0.1f, reactionTime = 0.5f;
+    const double rates[] = { 16, 64, 256 };
+    for (double fps : rates) {
+        for (int latency = 1; latency <= HDRReadbackRing::slots; ++latency) {
+            Run r;
+            r.gpu.latency = latency;
+            CHECK(r.ring.init());
+            r.frames(int(1.75 * fps), 1.0 / fps, 1.0, low, 0, reactionTime);
+
+            CHECK_EQ(r.gpu.errors, 0);
+            CHECK(r.gpu.lastReadTime > 1.25);
+            CHECK_NEAR(r.adapt.point[1], expectedAfterStep(r.gpu.lastReadTime, low, reactionTime), 1e-4f);
+            CHECK_NEAR(r.adapt.point[0], r.adapt.point[1], 1e-6f);
+        }
+    }
+
+    // Uneven frame times are within one frame's decay of the exact curve
+    Run r;
+    CHECK(r.ring.init());
+    double maxDt = 0;
+    for (int i = 0; i != 200; ++i) {
+        double dt = (i % 3 == 0) ? 0.004 : (i % 3 == 1) ? 0.011 : 0.023;
+        maxDt = std::max(maxDt, dt);
+        r.frames(1, dt, 1.0, low, 0, reactionTime);
+    }
+    CHECK(r.gpu.lastReadTime > 1.5);
+    CHECK_NEAR(r.adapt.point[1], expectedAfterStep(r.gpu.lastReadTime, low, reactionTime), float((1.0f - low) * maxDt / reactionTime));
+
+    // A GPU behind the ring skips samples, the step then landing within a longer sample interval
+    for (double fps : rates) {
+        Run s;
+        s.gpu.latency = HDRReadbackRing::slots + 1;
+        CHECK(s.ring.init());
+        s.frames(int(1.75 * fps), 1.0 / fps, 1.0, low, 0, reactionTime);
+        CHECK(s.ring.skippedFrames() > 0);
+        CHECK_NEAR(s.adapt.point[1], expectedAfterStep(s.gpu.lastReadTime, low, reactionTime), float((1.0f - low) * 2.0 / fps / reactionTime));
+    }
+}
+
+TEST(environment_weighting) {
+    // Exterior-like environments scale the weighted luminance, which still normalizes to the scene luminance
+    Run r;
+    CHECK(r.ring.init());
+    r.frames(600, 1.0 / 60, 0.0, 0.4f, 2, 0.5f);
+    CHECK_NEAR(r.adapt.point[3], 0.4f, 1e-6f);
+    CHECK_NEAR(r.adapt.point[2], 1.0f, 1e-4f);
+    CHECK_NEAR(r.adapt.point[0], 0.4f, 1e-4f);
+    CHECK_NEAR(r.adapt.point[1], 0.4f, 1e-4f);
+}
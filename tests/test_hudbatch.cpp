@@ -0,0 +1,239 @@
+
+// HUD batching - Effect and draw call counts for full HUDs, against a mock device that records calls
+
+#include "testing.h"
+#include "mge/hudbatch.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+
+
+static const int MaxElements = 256;
+
+// Mock device and effects, counting calls as MGEhud's target would make them
+struct MockDevice : HudBatch::Target {
+    struct Draw {
+        const void* effect;
+        const void* texture;
+        int startVertex, primitives;
+    };
+
+    const void* standardEffect = &standardEffect;
+    const void* current = nullptr;
+    bool inPass = false;
+    int begins = 0, beginPasses = 0, endPasses = 0, ends = 0;
+    int setTextures = 0, commits = 0, flushes = 0;
+    int badNesting = 0;
+    std::vector<Draw> draws;
+
+    void beginEffect(const HudBatch::Item& first) {
+        if (inPass) {
+            ++badNesting;
+        }
+        current = first.effect ? first.effect : standardEffect;
+        if (first.effect) {
+            ++flushes;
+        }
+        ++begins;
+        ++beginPasses;
+        inPass = true;
+    }
+
+    void draw(const HudBatch::Item& first, int firstQuad, int quads) {
+        if (!inPass) {
+            ++badNesting;
+        }
+        ++setTextures;
+        ++commits;
+        draws.push_back(Draw { current, first.texture, 6 * firstQuad, 2 * quads });
+    }
+
+    void endEffect() {
+        if (!inPass) {
+            ++badNesting;
+        }
+        ++endPasses;
+        ++ends;
+        inPass = false;
+    }
+
+    int primitives() const {
+        int n = 0;
+        for (const Draw& d : draws) {
+            n += d.primitives;
+        }
+        return n;
+    }
+};
+
+// Fake resource handles
+static char effects[MaxElements], textures[MaxElements];
+
+static int distinct(std::vector<const void*> v) {
+    std::sort(v.begin(), v.end());
+    return int(std::unique(v.begin(), v.end()) - v.begin());
+}
+
+// Draw a HUD and check that every element is covered once, by a draw with its own effect and texture
+static bool drawHud(std::vector<HudBatch::Item> items, MockDevice& device) {
+    std::vector<HudBatch::Item> unsorted = items;
+    HudBatch::sort(items.data(), int(items.size()));
+    HudBatch::submit(items.data(), int(items.size()), device);
+
+    std::vector<int> covered(MaxElements, 0);
+    int vertex = 0;
+    for (const MockDevice::Draw& d : device.draws) {
+        if (d.startVertex != vertex) {
+            return false;
+        }
+        for (int q = d.startVertex / 6; q != (d.startVertex + 3 * d.primitives) / 6; ++q) {
+            const HudBatch::Item& item = items[q];
+            const void* effect = item.effect ? item.effect : device.standardEffect;
+            if (effect != d.effect || item.texture != d.texture) {
+                return false;
+            }
+            ++covered[item.id];
+        }
+        vertex += 3 * d.primitives;
+    }
+    for (const HudBatch::Item& item : unsorted) {
+        if (covered[item.id] != 1) {
+            return false;
+        }
+    }
+    return device.badNesting == 0 && device.begins == device.ends && device.beginPasses == device.endPasses;
+}
+
+TEST(same_texture) {
+    // 256 standard elements sharing a texture draw in one call
+    std::vector<HudBatch::Item> items;
+    for (int i = 0; i != MaxElements; ++i) {
+        items.push_back(HudBatch::Item { i, nullptr, &textures[0] });
+    }
+    MockDevice device;
+    CHECK(drawHud(items, device));
+    CHECK_EQ(device.begins, 1);
+    CHECK_EQ(device.flushes, 0);
+    CHECK_EQ(device.draws.size(), size_t(1));
+    CHECK_EQ(device.setTextures, 1);
+    CHECK_EQ(device.primitives(), 2 * MaxElements);
+}
+
+TEST(distinct_textures) {
+    // Standard elements with their own textures share the effect pass, with a draw each
+    std::vector<HudBatch::Item> items;
+    for (int i = 0; i != MaxElements; ++i) {
+        items.push_back(HudBatch::Item { i, nullptr, &textures[MaxElements - 1 - i] });
+    }
+    MockDevice device;
+    CHECK(drawHud(items, device));
+    CHECK_EQ(device.begins, 1);
+    CHECK_EQ(device.draws.size(), size_t(MaxElements));
+    CHECK_EQ(device.commits, MaxElements);
+}
+
+TEST(custom_effects) {
+    // Custom effects are per element, so each needs its own pass and variable flush
+    std::vector<HudBatch::Item> items;
+    for (int i = 0; i != MaxElements; ++i) {
+        items.push_back(HudBatch::Item { i, &effects[i], &textures[i % 4] });
+    }
+    MockDevice device;
+    CHECK(drawHud(items, device));
+    CHECK_EQ(device.begins, MaxElements);
+    CHECK_EQ(device.flushes, MaxElements);
+    CHECK_EQ(device.draws.size(), size_t(MaxElements));
+}
+
+TEST(interleaved) {
+    // Elements created in alternating texture order are regrouped, one draw per texture
+    std::vector<HudBatch::Item> items;
+    for (int i = 0; i != MaxElements; ++i) {
+        items.push_back(HudBatch::Item { i, nullptr, &textures[i % 8] });
+    }
+    MockDevice device;
+    CHECK(drawHud(items, device));
+    CHECK_EQ(device.begins, 1);
+    CHECK_EQ(device.draws.size(), size_t(8));
+    CHECK_EQ(device.primitives(), 2 * MaxElements);
+}
+
+TEST(random_huds) {
+    // Random mixes of standard and custom effects, with shared textures: effect passes and draws are the minimum
+    int failures = 0;
+    for (uint32_t seed = 1; seed != 201; ++seed) {
+        std::mt19937 rng(seed);
+        int count = 1 + int(rng() % MaxElements);
+        int textureCount = 1 + int(rng() % 16);
+        std::vector<HudBatch::Item> items;
+        std::vector<const void*> customEffects, standardTextures;
+
+        for (int i = 0; i != count; ++i) {
+            int id = int(rng() % MaxElements);
+            while (std::any_of(items.begin(), items.end(), [&](const HudBatch::Item& it) { return it.id == id; })) {
+                id = (id + 1) % MaxElements;
+            }
+            const void* effect = (rng() % 4) == 0 ? &effects[id] : nullptr;
+            const void* texture = &textures[rng() % textureCount];
+            items.push_back(HudBatch::Item { id, effect, texture });
+            if (effect) {
+                customEffects.push_back(effect);
+            } else {
+                standardTextures.push_back(texture);
+            }
+        }
+
+        MockDevice device;
+        if (!drawHud(items, device)) {
+            ++failures;
+            continue;
+        }
+        int standardDraws = distinct(standardTextures);
+        int passes = int(customEffects.size()) + (standardDraws ? 1 : 0);
+        failures += device.begins != passes;
+        failures += int(device.draws.size()) != standardDraws + int(customEffects.size());
+        failures += device.primitives() != 2 * count;
+    }
+    CHECK_EQ(failures, 0);
+}
+
+TEST(quad_vertices) {
+    float v[HudBatch::VertexFloats];
+    HudBatch::writeQuad(10, 20, 110, 70, v);
+
+    // Two triangles covering the pixel-offset rectangle, with matching texcoords
+    const float expect[6][4] = {
+        { 9.5f, 69.5f, 0, 1 }, { 9.5f, 19.5f, 0, 0 }, { 109.5f, 69.5f, 1, 1 },
+        { 109.5f, 69.5f, 1, 1 }, { 9.5f, 19.5f, 0, 0 }, { 109.5f, 19.5f, 1, 0 }
+    };
+    for (int i = 0; i != 6; ++i) {
+        const float* p = v + 8 * i;
+        CHECK_EQ(p[0], expect[i][0]);
+        CHECK_EQ(p[1], expect[i][1]);
+        CHECK_EQ(p[2], 0.0f);
+        CHECK_EQ(p[3], 1.0f);
+        CHECK_EQ(p[4], expect[i][2]);
+        CHECK_EQ(p[5], expect[i][3]);
+    }
+}
+
+BENCH(sort_and_submit) {
+    std::vector<HudBatch::Item> items, sorted(MaxElements);
+    for (int i = 0; i != MaxElements; ++i) {
+        items.push_back(HudBatch::Item { i, i % 16 == 0 ? &effects[i] : nullptr, &textures[i % 8] });
+    }
+
+    const int n = 20000;
+    MockDevice device;
+    double t0 = Testing::seconds();
+    for (int i = 0; i != n; ++i) {
+        sorted = items;
+        HudBatch::sort(sorted.data(), MaxElements);
+        device.draws.clear();
+        HudBatch::submit(sorted.data(), MaxElements, device);
+    }
+    double t1 = Testing::seconds();
+    std::printf("   %.2f us per rebuild and submit of 256 elements, %zu draws\n", 1e6 * (t1 - t0) / n, device.draws.size());
+}
@@ -0,0 +1,150 @@
+
+// BMP, TGA and DDS screenshot encoders - Header fields, row order and padding, and pixels without alpha
+
+#include "testing.h"
+#include "support/ddsparse.h"
+#include "support/imageencode.h"
+
+#include <cstring>
+#include <vector>
+
+
+
+static uint32_t readUint16LE(const uint8_t* p) {
+    return uint32_t(p[0]) | (uint32_t(p[1]) << 8);
+}
+
+static uint32_t readUint32LE(const uint8_t* p) {
+    return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+// BGRA test image with padded rows; alpha and padding hold values that must not appear in the output
+struct Image {
+    unsigned int width, height, stride;
+    std::vector<uint8_t> bgra;
+
+    Image(unsigned int w, unsigned int h) : width(w), height(h), stride(4 * w + 8), bgra(size_t(stride) * h, 0xEE) {
+        for (unsigned int y = 0; y != h; ++y) {
+            for (unsigned int x = 0; x != w; ++x) {
+                uint8_t* p = pixel(x, y);
+                p[0] = uint8_t(x * 7 + y);
+                p[1] = uint8_t(y * 13);
+                p[2] = uint8_t(x ^ y);
+                p[3] = 0x42;
+            }
+        }
+    }
+
+    const uint8_t* pixel(unsigned int x, unsigned int y) const { return &bgra[size_t(stride) * y + 4 * x]; }
+    uint8_t* pixel(unsigned int x, unsigned int y) { return &bgra[size_t(stride) * y + 4 * x]; }
+};
+
+TEST(bmp_layout) {
+    unsigned int sizes[][2] = { { 1, 1 }, { 2, 3 }, { 3, 2 }, { 4, 4 }, { 5, 7 } };
+    for (auto& sz : sizes) {
+        Image img(sz[0], sz[1]);
+        std::vector<uint8_t> bmp;
+        CHECK(bmpEncodeBGRA(img.bgra.data(), img.width, img.height, img.stride, bmp));
+
+        size_t rowBytes = (3 * img.width + 3) & ~3u;
+        CHECK(bmp[0] == 'B' && bmp[1] == 'M');
+        CHECK_EQ(readUint32LE(&bmp[2]), uint32_t(bmp.size()));
+        CHECK_EQ(bmp.size(), 54 + rowBytes * img.height);
+        CHECK_EQ(readUint32LE(&bmp[10]), 54u);
+        CHECK_EQ(readUint32LE(&bmp[14]), 40u);
+        CHECK_EQ(readUint32LE(&bmp[18]), img.width);
+        CHECK_EQ(readUint32LE(&bmp[22]), img.height);      // Positive, bottom-up
+        CHECK_EQ(readUint16LE(&bmp[26]), 1u);
+        CHECK_EQ(readUint16LE(&bmp[28]), 24u);
+        CHECK_EQ(readUint32LE(&bmp[30]), 0u);              // BI_RGB
+
+        bool pixelsMatch = true, paddingZero = true;
+        for (unsigned int y = 0; y != img.height; ++y) {
+            const uint8_t* row = &bmp[54 + rowBytes * (img.height - 1 - y)];
+            for (unsigned int x = 0; x != img.width; ++x) {
+                pixelsMatch &= std::memcmp(row + 3 * x, img.pixel(x, y), 3) == 0;
+            }
+            for (size_t i = 3 * img.width; i != rowBytes; ++i) {
+                paddingZero &= row[i] == 0;
+            }
+        }
+        CHECK(pixelsMatch);
+        CHECK(paddingZero);
+    }
+}
+
+TEST(tga_layout) {
+    Image img(5, 3);
+    std::vector<uint8_t> tga;
+    CHECK(tgaEncodeBGRA(img.bgra.data(), img.width, img.height, img.stride, tga));
+
+    CHECK_EQ(tga.size(), size_t(18 + 3 * 5 * 3));
+    CHECK_EQ(tga[0], 0);        // No image ID
+    CHECK_EQ(tga[1], 0);        // No colour map
+    CHECK_EQ(tga[2], 2);        // Uncompressed true colour
+    CHECK_EQ(readUint16LE(&tga[12]), 5u);
+    CHECK_EQ(readUint16LE(&tga[14]), 3u);
+    CHECK_EQ(tga[16], 24);
+    CHECK_EQ(tga[17], 0x20);    // Top-down
+
+    bool pixelsMatch = true;
+    for (unsigned int y = 0; y != img.height; ++y) {
+        for (unsigned int x = 0; x != img.width; ++x) {
+            pixelsMatch &= std::memcmp(&tga[18 + 3 * (5 * y + x)], img.pixel(x, y), 3) == 0;
+        }
+    }
+    CHECK(pixelsMatch);
+
+    // TGA dimensions are 16-bit
+    CHECK(!tgaEncodeBGRA(img.bgra.data(), 65536, 1, 0, tga));
+}
+
+TEST(dds_parses) {
+    Image img(6, 5);
+    std::vector<uint8_t> dds;
+    CHECK(ddsEncodeBGRA(img.bgra.data(), img.width, img.height, img.stride, dds));
+
+    // The texture loader's parser must accept it as a single level X8R8G8B8 image
+    DDSImage parsed;
+    CHECK(ddsParse(dds.data(), dds.size(), &parsed));
+    CHECK(parsed.format == DDSFormat::X8R8G8B8);
+    CHECK_EQ(parsed.width, 6u);
+    CHECK_EQ(parsed.height, 5u);
+    CHECK_EQ(parsed.levels.size(), size_t(1));
+    CHECK_EQ(readUint32LE(&dds[20]), 24u);            // Pitch
+
+    bool pixelsMatch = true;
+    const uint8_t* p = parsed.levels[0].data;
+    for (unsigned int y = 0; y != img.height; ++y) {
+        for (unsigned int x = 0; x != img.width; ++x, p += 4) {
+            pixelsMatch &= std::memcmp(p, img.pixel(x, y), 3) == 0 && p[3] == 0xFF;
+        }
+    }
+    CHECK(pixelsMatch);
+}
+
+TEST(empty_rejected) {
+    uint8_t pixel[4] = {};
+    std::vector<uint8_t> out;
+    CHECK(!bmpEncodeBGRA(pixel, 0, 1, 4, out));
+    CHECK(!bmpEncodeBGRA(pixel, 1, 0, 4, out));
+    CHECK(!tgaEncodeBGRA(pixel, 0, 1, 4, out));
+    CHECK(!ddsEncodeBGRA(pixel, 1, 0, 4, out));
+}
+
+BENCH(encode) {
+    Image img(1920, 1080);
+    std::vector<uint8_t> out;
+    const int n = 20;
+
+    double t0 = Testing::seconds();
+    for (int i = 0; i != n; ++i) {
+        bmpEncodeBGRA(img.bgra.data(), img.width, img.height, img.stride, out);
+    }
+    double t1 = Testing::seconds();
+    for (int i = 0; i != n; ++i) {
+        ddsEncodeBGRA(img.bgra.data(), img.width, img.height, img.stride, out);
+    }
+    double t2 = Testing::seconds();
+    std::printf("   1920x1080, BMP %.2f ms, DDS %.2f ms per encode\n", 1e3 * (t1 - t0) / n, 1e3 * (t2 - t1) / n);
+}
@@ -0,0 +1,373 @@
+
+// INI files - Lookup rules as GetPrivateProfileString applies them, and saving that splices edits into the original text
+
+#include "testing.h"
+#include "support/inifile.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+
+
+
+static IniFile parsed(const char* text) {
+    IniFile ini;
+    ini.parse(text, std::strlen(text));
+    return ini;
+}
+
+static bool valueIs(const IniFile& ini, const char* section, const char* key, const char* expected) {
+    const char* v = ini.get(section, key);
+    return v && std::strcmp(v, expected) == 0;
+}
+
+// Temporary file, removed on destruction
+struct TempFile {
+    std::string dir, path;
+
+    TempFile() {
+        char pattern[] = "/tmp/mgeiniXXXXXX";
+        const char* d = mkdtemp(pattern);
+        dir = d ? d : "";
+        path = dir + "/MGE.ini";
+    }
+    ~TempFile() {
+        if (!dir.empty()) {
+            std::system(("rm -rf '" + dir + "'").c_str());
+        }
+    }
+
+    void write(const std::string& data) const {
+        FILE* f = std::fopen(path.c_str(), "wb");
+        if (f) {
+            std::fwrite(data.data(), 1, data.size(), f);
+            std::fclose(f);
+        }
+    }
+
+    std::string read() const {
+        std::string data;
+        FILE* f = std::fopen(path.c_str(), "rb");
+        if (f) {
+            char buf[4096];
+            size_t n;
+            while ((n = std::fread(buf, 1, sizeof(buf), f)) != 0) {
+                data.append(buf, n);
+            }
+            std::fclose(f);
+        }
+        return data;
+    }
+
+    bool exists() const { return access(path.c_str(), F_OK) == 0; }
+};
+
+// Saves an edited file and returns the result
+static std::string saveEdited(const std::string& original, void (*edit)(IniFile&)) {
+    TempFile f;
+    f.write(original);
+    IniFile ini;
+    ini.load(f.path.c_str());
+    edit(ini);
+    ini.save(f.path.c_str());
+    return f.read();
+}
+
+TEST(lookup_rules) {
+    IniFile ini = parsed(
+        "orphan=ignored\r\n"
+        "[Main]\r\n"
+        "Key=value\r\n"
+        "  Spaced Key  \t=  \t spaced value \t \r\n"
+        "Empty=\r\n"
+        "Equals=a=b=c\r\n"
+        "NoValue\r\n"
+        "Inline=1 ; not a comment\r\n"
+        "#Hash=not a comment either\r\n"
+        ";Commented=1\r\n"
+        "  ; Indented=1\r\n");
+
+    CHECK(ini.get("", "orphan") == nullptr);                // Keys before any section belong to none
+    CHECK(valueIs(ini, "Main", "Key", "value"));
+    CHECK(valueIs(ini, "Main", "Spaced Key", "spaced value"));
+    CHECK(valueIs(ini, "Main", "Empty", ""));
+    CHECK(valueIs(ini, "Main", "Equals", "a=b=c"));         // Split at the first '='
+    CHECK(valueIs(ini, "Main", "NoValue", ""));
+    CHECK(valueIs(ini, "Main", "Inline", "1 ; not a comment"));
+    CHECK(valueIs(ini, "Main", "#Hash", "not a comment either"));
+    CHECK(ini.get("Main", "Commented") == nullptr);
+    CHECK(ini.get("Main", ";Commented") == nullptr);
+    CHECK(ini.get("Main", "Indented") == nullptr);
+    CHECK(ini.get("Main", "Missing") == nullptr);
+    CHECK(ini.get("Missing", "Key") == nullptr);
+}
+
+TEST(case_insensitive) {
+    IniFile ini = parsed("[Distant Land]\nDraw Distance=5\n");
+    CHECK(valueIs(ini, "distant land", "draw distance", "5"));
+    CHECK(valueIs(ini, "DISTANT LAND", "DRAW DISTANCE", "5"));
+    CHECK(valueIs(ini, "dIsTaNt LaNd", "Draw Distance", "5"));
+    CHECK(ini.get("Distant  Land", "Draw Distance") == nullptr);   // Inner whitespace is significant
+}
+
+TEST(quotes) {
+    IniFile ini = parsed(
+        "[Q]\n"
+        "Double=\"quoted value\"\n"
+        "Single='quoted value'\n"
+        "Padded=  \" keep inner space \"  \n"
+        "Mismatched=\"open\n"
+        "Mixed=\"a'\n"
+        "Lone=\"\n"
+        "Empty=\"\"\n"
+        "Middle=a \"b\" c\n");
+
+    // A matching pair around the whole value is removed, and only that
+    CHECK(valueIs(ini, "Q", "Double", "quoted value"));
+    CHECK(valueIs(ini, "Q", "Single", "quoted value"));
+    CHECK(valueIs(ini, "Q", "Padded", " keep inner space "));
+    CHECK(valueIs(ini, "Q", "Mismatched", "\"open"));
+    CHECK(valueIs(ini, "Q", "Mixed", "\"a'"));
+    CHECK(valueIs(ini, "Q", "Lone", "\""));
+    CHECK(valueIs(ini, "Q", "Empty", ""));
+    CHECK(valueIs(ini, "Q", "Middle", "a \"b\" c"));
+}
+
+TEST(duplicates_first_wins) {
+    IniFile ini = parsed(
+        "[A]\n"
+        "x=1\n"
+        "x=2\n"
+        "X=3\n"
+        "[B]\n"
+        "y=1\n"
+        "[a]\n"
+        "x=4\n"
+        "z=5\n");
+
+    // The first duplicate key, and the first of several same-named sections, are the ones seen
+    CHECK(valueIs(ini, "A", "x", "1"));
+    CHECK(ini.get("A", "z") == nullptr);
+    CHECK(valueIs(ini, "B", "y", "1"));
+    CHECK_EQ(ini.sectionCount(), size_t(3));
+    CHECK(std::strcmp(ini.sectionName(2), "a") == 0);
+}
+
+TEST(section_headers) {
+    IniFile ini = parsed(
+        "[ Spaced ]\n"
+        "a=1\n"
+        "  [Indented]  \n"
+        "b=2\n"
+        "[Trailing] junk\n"
+        "c=3\n"
+        "[]\n"
+        "d=4\n");
+
+    CHECK(valueIs(ini, "Spaced", "a", "1"));
+    CHECK(valueIs(ini, "Indented", "b", "2"));
+    CHECK(valueIs(ini, "Trailing", "c", "3"));
+    CHECK(valueIs(ini, "", "d", "4"));
+}
+
+TEST(line_endings_and_bom) {
+    IniFile lf = parsed("[S]\na=1\nb=2");
+    CHECK(valueIs(lf, "S", "a", "1"));
+    CHECK(valueIs(lf, "S", "b", "2"));              // No final newline
+
+    IniFile crlf = parsed("[S]\r\na=1\r\n\r\nb=2\r\n");
+    CHECK(valueIs(crlf, "S", "a", "1"));            // No stray '\r'
+    CHECK(valueIs(crlf, "S", "b", "2"));
+
+    IniFile bom = parsed("\xEF\xBB\xBF[S]\r\na=1\r\n");
+    CHECK(valueIs(bom, "S", "a", "1"));
+    CHECK_EQ(bom.sectionCount(), size_t(1));
+
+    IniFile empty = parsed("");
+    CHECK_EQ(empty.sectionCount(), size_t(0));
+    CHECK(empty.get("S", "a") == nullptr);
+}
+
+TEST(get_section) {
+    IniFile ini = parsed("[S]\nA = 1\n;skip\nFlag\nB=\"two\"\n[T]\nC=3\n");
+    char buf[64];
+
+    // GetPrivateProfileSection format, trimmed and unquoted
+    size_t n = ini.getSection("s", buf, sizeof(buf));
+    CHECK_EQ(n, size_t(15));           // Including the separating nulls, excluding the final one
+    CHECK(std::memcmp(buf, "A=1\0Flag\0B=two\0\0", 16) == 0);
+
+    CHECK_EQ(ini.getSection("Missing", buf, sizeof(buf)), size_t(0));
+    CHECK(buf[0] == 0);
+
+    // Truncated output returns size - 2 and stays double null terminated
+    n = ini.getSection("S", buf, 8);
+    CHECK_EQ(n, size_t(6));
+    CHECK(std::memcmp(buf, "A=1\0Fl\0\0", 8) == 0);
+    CHECK_EQ(ini.getSection("S", buf, 1), size_t(0));
+    CHECK(buf[0] == 0);
+}
+
+TEST(load_missing_file) {
+    TempFile f;
+    IniFile ini;
+    CHECK(!ini.load(f.path.c_str()));
+    CHECK_EQ(ini.sectionCount(), size_t(0));
+
+    // Saving creates it
+    CHECK(ini.set("New", "Key", "1"));
+    CHECK(ini.save(f.path.c_str()));
+    CHECK(f.read() == "[New]\r\nKey=1\r\n");
+}
+
+TEST(unchanged_save_writes_nothing) {
+    TempFile f;
+    IniFile ini;
+    f.write("[S]\r\na = 1\r\n");
+    ini.load(f.path.c_str());
+    CHECK(!ini.set("s", "A", "1"));
+    CHECK(!ini.modified());
+    std::remove(f.path.c_str());
+    CHECK(ini.save(f.path.c_str()));
+    CHECK(!f.exists());
+}
+
+TEST(splice_existing_values) {
+    // Only the value span changes; comments, spacing, case and unrelated lines are kept byte for byte.
+    // As with GetPrivateProfileString, text after ';' on a key line is part of the value and is replaced.
+    std::string out = saveEdited(
+        "; MGE XE settings\r\n"
+        "[Distant Land]\r\n"
+        "Draw Distance  =  5   ; cells\r\n"
+        "Quoted = \"old value\" \r\n"
+        "Flag\r\n"
+        "\r\n"
+        "[Other]\r\n"
+        "Draw Distance=5\r\n",
+        [](IniFile& ini) {
+            ini.set("distant land", "draw distance", "12");
+            ini.set("Distant Land", "Quoted", "new");
+            ini.set("Distant Land", "Flag", "True");
+        });
+    CHECK(out ==
+        "; MGE XE settings\r\n"
+        "[Distant Land]\r\n"
+        "Draw Distance  =  12\r\n"
+        "Quoted = new \r\n"
+        "Flag=True\r\n"
+        "\r\n"
+        "[Other]\r\n"
+        "Draw Distance=5\r\n");
+}
+
+TEST(splice_new_keys_and_sections) {
+    // New keys follow the last non-blank line of their section; new sections go at the end
+    std::string out = saveEdited(
+        "[A]\n"
+        "x=1\n"
+        "; trailing comment\n"
+        "\n"
+        "[B]\n"
+        "y=2",
+        [](IniFile& ini) {
+            ini.set("a", "New", "n1");
+            ini.set("A", "Second", "n2");
+            ini.set("B", "z", "3");
+            ini.set("C", "w", "4");
+            ini.set("C", "v", "5");
+        });
+    CHECK(out ==
+        "[A]\n"
+        "x=1\n"
+        "; trailing comment\n"
+        "New=n1\n"
+        "Second=n2\n"
+        "\n"
+        "[B]\n"
+        "y=2\n"
+        "z=3\n"
+        "[C]\n"
+        "w=4\n"
+        "v=5\n");
+}
+
+TEST(repeated_sets) {
+    // The last set wins, including for keys that were added and not yet saved
+    std::string out = saveEdited("[S]\r\na=1\r\n", [](IniFile& ini) {
+        ini.set("S", "a", "2");
+        ini.set("S", "a", "3");
+        ini.set("S", "b", "x");
+        ini.set("S", "B", "y");
+        CHECK(valueIs(ini, "S", "a", "3"));
+        CHECK(valueIs(ini, "S", "b", "y"));
+    });
+    CHECK(out == "[S]\r\na=3\r\nb=y\r\n");
+}
+
+TEST(duplicate_section_edits_first) {
+    std::string out = saveEdited("[S]\nk=1\n[T]\n[s]\nk=2\n", [](IniFile& ini) {
+        ini.set("S", "k", "9");
+        ini.set("S", "n", "new");
+    });
+    CHECK(out == "[S]\nk=9\nn=new\n[T]\n[s]\nk=2\n");
+}
+
+TEST(save_reparses) {
+    TempFile f;
+    f.write("\xEF\xBB\xBF[S]\r\na=1\r\n");
+    IniFile ini;
+    ini.load(f.path.c_str());
+    ini.set("S", "a", "2");
+    ini.set("S", "b", "3");
+    CHECK(ini.save(f.path.c_str()));
+    CHECK(!ini.modified());
+    CHECK(f.read() == "\xEF\xBB\xBF[S]\r\na=2\r\nb=3\r\n");
+
+    // Edits after a save splice into the saved text
+    ini.set("S", "b", "4");
+    CHECK(ini.save(f.path.c_str()));
+    CHECK(f.read() == "\xEF\xBB\xBF[S]\r\na=2\r\nb=4\r\n");
+
+    IniFile reloaded;
+    reloaded.load(f.path.c_str());
+    CHECK(valueIs(reloaded, "S", "a", "2"));
+    CHECK(valueIs(reloaded, "S", "b", "4"));
+}
+
+BENCH(parse) {
+    // About the size of a full MGE.ini with macros and shader settings
+    std::string text = "; Benchmark\r\n";
+    char line[128];
+    for (int s = 0; s != 24; ++s) {
+        std::snprintf(line, sizeof(line), "\r\n[Section Number %d]\r\n", s);
+        text += line;
+        for (int k = 0; k != 60; ++k) {
+            std::snprintf(line, sizeof(line), "Setting Key %d = %d.%03d  ; comment\r\n", k, s * k, k);
+            text += line;
+        }
+    }
+
+    const int n = 2000;
+    IniFile ini;
+    double t0 = Testing::seconds();
+    for (int i = 0; i != n; ++i) {
+        ini.parse(text.data(), text.size());
+    }
+    double t1 = Testing::seconds();
+
+    int found = 0;
+    for (int s = 0; s != 24; ++s) {
+        char section[32], key[32];
+        std::snprintf(section, sizeof(section), "section number %d", s);
+        for (int k = 0; k != 60; ++k) {
+            std::snprintf(key, sizeof(key), "SETTING KEY %d", k);
+            found += ini.get(section, key) != nullptr;
+        }
+    }
+    double t2 = Testing::seconds();
+    CHECK_EQ(found, 24 * 60);
+    std::printf("   %zu bytes, 1440 keys: %.1f us per parse, %.0f ns per lookup\n", text.size(),
+                1e6 * (t1 - t0) / n, 1e9 * (t2 - t1) / found);
+}
@@ -0,0 +1,553 @@
+
+// Keyboard macros - Equivalence with the per-poll loop they replaced, over random settings and synthetic key streams
+
+#include "testing.h"
+#include "mge/keymacros.h"
+
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+
+
+static const uint32_t MaxKeys = MGEINPUT_MAXMACROS;
+
+// Macro side effect, as seen by the caller
+struct Event {
+    bool console;
+    uint32_t value;             // Console string length, or graphics function
+    bool closeConsole;
+
+    bool operator==(const Event& e) const {
+        return console == e.console && value == e.value && closeConsole == e.closeConsole;
+    }
+};
+
+struct Recorder : KeyMacros::Actions {
+    std::vector<Event> events;
+
+    void consoleCommand(const FD_Console& console, bool closeConsole) {
+        events.push_back(Event { true, console.Length, closeConsole });
+    }
+    void graphicsFunction(uint8_t index) {
+        events.push_back(Event { false, index, false });
+    }
+};
+
+// Reference - The loop KeyMacros replaced, over byte arrays, scanning every key and trigger on each poll
+struct Reference {
+    sFakeKey keys[MaxKeys];
+    sFakeTrigger triggers[MGEINPUT_MAXTRIGGERS];
+    uint8_t lastBytes[MaxKeys], fakeStates[MaxKeys], hammerStates[MaxKeys], aHammerStates[MaxKeys];
+    uint8_t tapStates[MaxKeys], disallowMask[MaxKeys];
+    uint32_t triggerFireTimes[MGEINPUT_MAXTRIGGERS];
+    bool globalHammer;
+    std::vector<Event> events;
+
+    Reference() {
+        std::memset(fakeStates, 0, sizeof(fakeStates));
+        std::memset(hammerStates, 0, sizeof(hammerStates));
+        std::memset(aHammerStates, 0, sizeof(aHammerStates));
+        std::memset(tapStates, 0, sizeof(tapStates));
+    }
+
+    void reset(uint32_t time) {
+        globalHammer = true;
+        std::memset(lastBytes, 0, sizeof(lastBytes));
+        std::memset(disallowMask, 0xff, sizeof(disallowMask));
+        for (uint32_t i = 0; i != MGEINPUT_MAXTRIGGERS; ++i) {
+            triggerFireTimes[i] = time + triggers[i].TimeInterval;
+        }
+    }
+
+    void changeKeyBehavior(uint32_t key, KeyMacros::Behavior kb, bool on) {
+        if (key >= MaxKeys) {
+            return;
+        }
+        switch (kb) {
+        case KeyMacros::Tap:
+            tapStates[key] = on ? 0x80 : 0;
+            break;
+        case KeyMacros::Push:
+            fakeStates[key] = on ? 0x80 : 0;
+            break;
+        case KeyMacros::Hammer:
+            hammerStates[key] = on ? 0x80 : 0;
+            break;
+        case KeyMacros::AHammer:
+            aHammerStates[key] = on ? 0x80 : 0;
+            break;
+        case KeyMacros::Disallow:
+            disallowMask[key] = on ? 0 : 0xff;
+            break;
+        }
+    }
+
+    bool takeTap(uint32_t key) {
+        bool tap = tapStates[key] != 0;
+        tapStates[key] = 0;
+        return tap;
+    }
+
+    void poll(uint8_t* bytes, uint32_t time, bool closingConsole) {
+        globalHammer = !globalHammer;
+        const uint8_t* hammer = globalHammer ? hammerStates : aHammerStates;
+
+        for (uint32_t byte = 0; byte < 256; byte++) {
+            bytes[byte] |= fakeStates[byte];
+            bytes[byte] |= hammer[byte];
+            bytes[byte] &= disallowMask[byte];
+            bytes[byte] |= tapStates[byte];
+            tapStates[byte] = 0;
+        }
+        for (uint32_t byte = 256; byte < MaxKeys; byte++) {
+            bytes[byte] |= fakeStates[byte];
+            bytes[byte] |= hammer[byte];
+        }
+
+        if (closingConsole) {
+            bytes[0x29] = 0x80;
+        } else {
+            for (uint32_t trigger = 0; trigger < MGEINPUT_MAXTRIGGERS; trigger++) {
+                if (triggers[trigger].Active && triggers[trigger].TimeInterval > 0 && triggerFireTimes[trigger] < time) {
+                    for (uint32_t i = 0; i < MaxKeys; i++) {
+                        bytes[i] |= triggers[trigger].Data.KeyStates[i];
+                    }
+                    triggerFireTimes[trigger] = time + triggers[trigger].TimeInterval;
+                }
+            }
+
+            for (uint32_t key = 0; key < MaxKeys; key++) {
+                if (keys[key].type == MT_Unused || !(bytes[key] & 0x80)) {
+                    continue;
+                }
+                uint8_t last = lastBytes[key] & 0x80;
+                const uint8_t* targets = keys[key].Press.KeyStates;
+
+                switch (keys[key].type) {
+                case MT_Console1:
+                    if (!last) {
+                        bytes[0x29] = 0x80;
+                        events.push_back(Event { true, keys[key].Console.Length, true });
+                    }
+                    break;
+                case MT_Console2:
+                    if (!last) {
+                        events.push_back(Event { true, keys[key].Console.Length, false });
+                    }
+                    break;
+                case MT_Hammer1:
+                    for (uint32_t byte = 0; byte < MaxKeys; byte++) {
+                        if (targets[byte] && globalHammer) {
+                            bytes[byte] = 0x80;
+                        }
+                    }
+                    break;
+                case MT_Hammer2:
+                    for (uint32_t byte = 0; byte < MaxKeys; byte++) {
+                        if (targets[byte]) {
+                            hammerStates[byte] = 0x80;
+                        }
+                    }
+                    break;
+                case MT_Unhammer:
+                    for (uint32_t byte = 0; byte < MaxKeys; byte++) {
+                        if (targets[byte]) {
+                            hammerStates[byte] = 0;
+                        }
+                    }
+                    break;
+                case MT_AHammer1:
+                    for (uint32_t byte = 0; byte < MaxKeys; byte++) {
+                        if (targets[byte] && !globalHammer) {
+                            bytes[byte] = 0x80;
+                        }
+                    }
+                    break;
+                case MT_AHammer2:
+                    for (uint32_t byte = 0; byte < MaxKeys; byte++) {
+                        if (targets[byte]) {
+                            aHammerStates[byte] = 0x80;
+                        }
+                    }
+                    break;
+                case MT_AUnhammer:
+                    for (uint32_t byte = 0; byte < MaxKeys; byte++) {
+                        if (targets[byte]) {
+                            aHammerStates[byte] = 0;
+                        }
+                    }
+                    break;
+                case MT_Press1:
+                    for (uint32_t byte = 0; byte < MaxKeys; byte++) {
+                        if (targets[byte]) {
+                            bytes[byte] = 0x80;
+                        }
+                    }
+                    break;
+                case MT_Press2:
+                    for (uint32_t byte = 0; byte < MaxKeys; byte++) {
+                        if (targets[byte]) {
+                            fakeStates[byte] = 0x80;
+                        }
+                    }
+                    break;
+                case MT_Unpress:
+                    for (uint32_t byte = 0; byte < MaxKeys; byte++) {
+                        if (targets[byte]) {
+                            fakeStates[byte] = 0;
+                        }
+                    }
+                    break;
+                case MT_BeginTimer:
+                    if (!last) {
+                        triggers[keys[key].Timer.TimerID].Active = true;
+                    }
+                    break;
+                case MT_EndTimer:
+                    if (!last) {
+                        triggers[keys[key].Timer.TimerID].Active = false;
+                    }
+                    break;
+                case MT_Graphics:
+                    if (!last || keys[key].Function.index == GF_IncreaseZoom || keys[key].Function.index == GF_DecreaseZoom ||
+                                 keys[key].Function.index == GF_IncreaseFOV || keys[key].Function.index == GF_DecreaseFOV) {
+                        events.push_back(Event { false, keys[key].Function.index, false });
+                    }
+                    break;
+                }
+            }
+        }
+        std::memcpy(lastBytes, bytes, MaxKeys);
+    }
+};
+
+// Both implementations, loaded with the same settings and fed the same input
+struct Pair {
+    std::unique_ptr<KeyMacros> macros;
+    std::unique_ptr<Reference> reference;
+    Recorder recorder;
+
+    Pair() : macros(new KeyMacros()), reference(new Reference()) {
+        std::memset(macros->keys, 0, sizeof(macros->keys));
+        std::memset(macros->triggers, 0, sizeof(macros->triggers));
+    }
+
+    sFakeKey& key(uint32_t k) { return macros->keys[k]; }
+    sFakeTrigger& trigger(uint32_t t) { return macros->triggers[t]; }
+
+    void reset(uint32_t time) {
+        std::memcpy(reference->keys, macros->keys, sizeof(macros->keys));
+        std::memcpy(reference->triggers, macros->triggers, sizeof(macros->triggers));
+        macros->reset(time);
+        reference->reset(time);
+    }
+
+    void changeKeyBehavior(uint32_t key, KeyMacros::Behavior kb, bool on) {
+        macros->changeKeyBehavior(key, kb, on);
+        reference->changeKeyBehavior(key, kb, on);
+    }
+
+    // poll - Poll both with the same input; returns true if output, side effects and state all match
+    bool poll(const uint8_t* input, uint32_t time, bool closingConsole, uint8_t* out = nullptr) {
+        uint8_t a[MaxKeys], b[MaxKeys];
+        std::memcpy(a, input, MaxKeys);
+        std::memcpy(b, input, MaxKeys);
+        recorder.events.clear();
+        reference->events.clear();
+
+        macros->poll(a, time, closingConsole, recorder);
+        reference->poll(b, time, closingConsole);
+        if (out) {
+            std::memcpy(out, a, MaxKeys);
+        }
+
+        bool same = std::memcmp(a, b, MaxKeys) == 0 && recorder.events == reference->events;
+        same &= macros->hammerPhase() == reference->globalHammer;
+        for (uint32_t t = 0; t != MGEINPUT_MAXTRIGGERS; ++t) {
+            same &= macros->triggers[t].Active == reference->triggers[t].Active;
+        }
+        return same;
+    }
+
+    // Mouse side, polled separately from the keyboard
+    bool mouse() {
+        bool same = true;
+        for (uint32_t k = 256; k != 264; ++k) {
+            same &= macros->disallowed(k) == (reference->disallowMask[k] == 0);
+            same &= macros->takeTap(k) == reference->takeTap(k);
+        }
+        return same;
+    }
+};
+
+static void pressTargets(FD_Press& press, std::initializer_list<uint32_t> keys) {
+    for (uint32_t k : keys) {
+        press.KeyStates[k] = 0x80;
+    }
+}
+
+TEST(keyset) {
+    KeySet s;
+    s.clear();
+    CHECK_EQ(s.next(0), uint32_t(MaxKeys));
+    s.set(0);
+    s.set(31);
+    s.set(32);
+    s.set(265);
+    CHECK_EQ(s.next(0), 0u);
+    CHECK_EQ(s.next(1), 31u);
+    CHECK_EQ(s.next(32), 32u);
+    CHECK_EQ(s.next(33), 265u);
+    CHECK_EQ(s.next(266), uint32_t(MaxKeys));
+    s.reset(265);
+    CHECK_EQ(s.next(33), uint32_t(MaxKeys));
+
+    uint8_t states[MaxKeys] = {};
+    states[3] = 0x80;
+    states[4] = 0x7F;           // Only the pressed bit counts
+    states[200] = 0xFF;
+    states[263] = 0x80;
+    s.fromStates(states);
+    CHECK(s.test(3) && !s.test(4) && s.test(200) && s.test(263));
+    CHECK_EQ(s.next(4), 200u);
+    CHECK_EQ(s.next(201), 263u);
+}
+
+TEST(macro_order) {
+    // A macro pressing a later key runs that key's macro in the same poll; an earlier key waits for the next poll
+    Pair p;
+    p.key(10).type = MT_Press1;
+    pressTargets(p.key(10).Press, { 20, 5 });
+    p.key(20).type = MT_Graphics;
+    p.key(20).Function.index = GF_ToggleText;
+    p.key(5).type = MT_Graphics;
+    p.key(5).Function.index = GF_ToggleFps;
+    p.reset(1000);
+
+    uint8_t input[MaxKeys] = {}, out[MaxKeys];
+    input[10] = 0x80;
+    CHECK(p.poll(input, 1010, false, out));
+    CHECK(out[5] == 0x80 && out[20] == 0x80);
+    CHECK_EQ(p.recorder.events.size(), size_t(1));
+    CHECK_EQ(p.recorder.events[0].value, uint32_t(GF_ToggleText));
+
+    // Held down: neither fires again, as both were down last poll
+    CHECK(p.poll(input, 1020, false));
+    CHECK(p.recorder.events.empty());
+}
+
+TEST(console_macros) {
+    Pair p;
+    p.key(30).type = MT_Console1;
+    p.key(30).Console.Length = 3;
+    p.key(31).type = MT_Console2;
+    p.key(31).Console.Length = 4;
+    p.reset(0);
+
+    uint8_t input[MaxKeys] = {}, out[MaxKeys];
+    input[30] = input[31] = 0x80;
+    CHECK(p.poll(input, 1, false, out));
+    CHECK_EQ(out[0x29], 0x80);
+    CHECK_EQ(p.recorder.events.size(), size_t(2));
+    CHECK(p.recorder.events[0].console && p.recorder.events[0].closeConsole);
+    CHECK(p.recorder.events[1].console && !p.recorder.events[1].closeConsole);
+
+    // Closing the console only presses the console key
+    uint8_t none[MaxKeys] = {};
+    CHECK(p.poll(none, 2, true, out));
+    CHECK_EQ(out[0x29], 0x80);
+    CHECK(p.recorder.events.empty());
+}
+
+TEST(trigger_parking) {
+    // A trigger that comes due while inactive fires as soon as it is activated, then keeps its interval
+    Pair p;
+    p.trigger(1).TimeInterval = 100;
+    p.trigger(1).Active = false;
+    pressTargets(p.trigger(1).Data, { 44 });
+    p.key(2).type = MT_BeginTimer;
+    p.key(2).Timer.TimerID = 1;
+    p.key(3).type = MT_EndTimer;
+    p.key(3).Timer.TimerID = 1;
+    p.reset(0);
+
+    uint8_t none[MaxKeys] = {}, begin[MaxKeys] = {}, end[MaxKeys] = {}, out[MaxKeys];
+    begin[2] = 0x80;
+    end[3] = 0x80;
+
+    CHECK(p.poll(none, 500, false, out));       // Due, parked
+    CHECK_EQ(out[44], 0);
+    CHECK(p.poll(begin, 510, false, out));      // Activated during the macro scan
+    CHECK_EQ(out[44], 0);
+    CHECK(p.poll(none, 520, false, out));       // Fires next poll
+    CHECK_EQ(out[44], 0x80);
+    CHECK(p.poll(none, 600, false, out));
+    CHECK_EQ(out[44], 0);
+    CHECK(p.poll(none, 621, false, out));       // 520 + 100
+    CHECK_EQ(out[44], 0x80);
+
+    // Deactivated before due, then reactivated before the fire time: waits for the fire time
+    CHECK(p.poll(end, 630, false, out));
+    CHECK(p.poll(none, 640, false));
+    CHECK(p.poll(begin, 650, false));
+    CHECK(p.poll(none, 700, false, out));
+    CHECK_EQ(out[44], 0);
+    CHECK(p.poll(none, 722, false, out));
+    CHECK_EQ(out[44], 0x80);
+}
+
+TEST(trigger_time_wrap) {
+    // Fire times that wrap past 2^32 ms must not fire repeatedly within one poll, or hang
+    Pair p;
+    p.trigger(0).TimeInterval = 50;
+    p.trigger(0).Active = true;
+    pressTargets(p.trigger(0).Data, { 17 });
+    p.trigger(3).TimeInterval = 20;
+    p.trigger(3).Active = true;
+    pressTargets(p.trigger(3).Data, { 18 });
+
+    uint32_t time = 0xFFFFFF00u;
+    p.reset(time);
+    uint8_t none[MaxKeys] = {};
+    bool same = true;
+    for (int i = 0; i != 100; ++i) {
+        time += 7;
+        same &= p.poll(none, time, false);
+    }
+    CHECK(same);
+}
+
+TEST(forced_states) {
+    Pair p;
+    p.reset(0);
+    p.changeKeyBehavior(50, KeyMacros::Push, true);
+    p.changeKeyBehavior(51, KeyMacros::Hammer, true);
+    p.changeKeyBehavior(52, KeyMacros::AHammer, true);
+    p.changeKeyBehavior(53, KeyMacros::Tap, true);
+    p.changeKeyBehavior(50, KeyMacros::Disallow, true);
+    p.changeKeyBehavior(54, KeyMacros::Disallow, true);
+    p.changeKeyBehavior(258, KeyMacros::Push, true);
+    p.changeKeyBehavior(259, KeyMacros::Tap, true);
+    p.changeKeyBehavior(260, KeyMacros::Disallow, true);
+    p.changeKeyBehavior(MaxKeys, KeyMacros::Push, true);   // Ignored
+
+    uint8_t input[MaxKeys] = {}, out[MaxKeys];
+    input[54] = 0x80;
+    CHECK(p.poll(input, 1, false, out));
+    CHECK(out[50] == 0 && out[54] == 0 && out[53] == 0x80 && out[258] == 0x80);
+    CHECK(out[51] != out[52]);
+    CHECK(p.mouse());
+    CHECK(p.poll(input, 2, false, out));
+    CHECK(out[53] == 0 && out[51] != out[52]);
+}
+
+// Random settings: a few dozen macros of every type, press sets that include mouse keys, and triggers
+static void randomSettings(Pair& p, std::mt19937& rng) {
+    auto pick = [&](uint32_t n) { return uint32_t(rng() % n); };
+
+    int macros = 5 + pick(40);
+    for (int i = 0; i != macros; ++i) {
+        sFakeKey& m = p.key(pick(MaxKeys));
+        std::memset(&m, 0, sizeof(m));
+        m.type = uint8_t(1 + pick(MT_Graphics));
+        switch (m.type) {
+        case MT_Console1:
+        case MT_Console2:
+            m.Console.Length = uint8_t(1 + pick(20));
+            break;
+        case MT_BeginTimer:
+        case MT_EndTimer:
+            m.Timer.TimerID = uint8_t(pick(MGEINPUT_MAXTRIGGERS));
+            break;
+        case MT_Graphics:
+            m.Function.index = uint8_t(pick(MGEINPUT_GRAPHICSFUNCS));
+            break;
+        default:
+            for (uint32_t n = 1 + pick(4); n; --n) {
+                m.Press.KeyStates[pick(8) == 0 ? 256 + pick(10) : pick(256)] = 0x80;
+            }
+            break;
+        }
+    }
+
+    for (uint32_t t = 0; t != MGEINPUT_MAXTRIGGERS; ++t) {
+        sFakeTrigger& trigger = p.trigger(t);
+        trigger.Active = pick(2);
+        trigger.TimeInterval = pick(4) == 0 ? 0 : 1 + pick(300);
+        for (uint32_t n = pick(4); n; --n) {
+            trigger.Data.KeyStates[pick(MaxKeys)] = 0x80;
+        }
+    }
+}
+
+TEST(random_streams) {
+    // Random settings and key streams with held keys, forced states, mouse polls, console closes and clock wrap
+    int mismatches = 0, polls = 0;
+    for (uint32_t seed = 1; seed != 301; ++seed) {
+        std::mt19937 rng(seed);
+        auto pick = [&](uint32_t n) { return uint32_t(rng() % n); };
+        Pair p;
+        randomSettings(p, rng);
+
+        uint32_t time = (seed % 3 == 0) ? 0xFFFFF000u + pick(4096) : pick(100000);
+        p.reset(time);
+
+        uint8_t input[MaxKeys] = {};
+        for (int i = 0; i != 400; ++i, ++polls) {
+            // Keys go down and stay down for a while, biased towards keys with macros
+            for (uint32_t n = pick(4); n; --n) {
+                uint32_t k = pick(3) ? pick(MaxKeys) : 0;
+                for (uint32_t tries = 0; tries != 8 && pick(2) && p.key(k).type == MT_Unused; ++tries) {
+                    k = pick(MaxKeys);
+                }
+                input[k] ^= 0x80;
+            }
+            if (pick(10) == 0) {
+                p.changeKeyBehavior(pick(MaxKeys + 2), KeyMacros::Behavior(pick(5)), pick(2) != 0);
+            }
+
+            time += pick(60);
+            if (!p.poll(input, time, pick(20) == 0)) {
+                ++mismatches;
+            }
+            if (pick(2) && !p.mouse()) {
+                ++mismatches;
+            }
+        }
+    }
+    CHECK_EQ(mismatches, 0);
+    CHECK_EQ(polls, 300 * 400);
+}
+
+BENCH(poll) {
+    // A typical setup: a dozen macros, two triggers, a few keys held
+    Pair p;
+    std::mt19937 rng(7);
+    for (uint32_t k : { 2u, 3u, 4u, 5u, 59u, 60u, 61u, 62u, 87u, 88u, 257u, 258u }) {
+        p.key(k).type = MT_Press1;
+        pressTargets(p.key(k).Press, { k + 1 });
+    }
+    p.trigger(0).TimeInterval = 1000;
+    p.trigger(0).Active = true;
+    pressTargets(p.trigger(0).Data, { 30 });
+    p.reset(0);
+
+    uint8_t input[MaxKeys] = {}, bytes[MaxKeys];
+    input[17] = input[30] = input[59] = 0x80;
+    const int n = 200000;
+
+    double t0 = Testing::seconds();
+    for (int i = 0; i != n; ++i) {
+        std::memcpy(bytes, input, MaxKeys);
+        p.macros->poll(bytes, uint32_t(i), false, p.recorder);
+    }
+    double t1 = Testing::seconds();
+    for (int i = 0; i != n; ++i) {
+        std::memcpy(bytes, input, MaxKeys);
+        p.reference->poll(bytes, uint32_t(i), false);
+    }
+    double t2 = Testing::seconds();
+    std::printf("   KeyMacros %.0f ns, per-key loop %.0f ns per poll\n", 1e9 * (t1 - t0) / n, 1e9 * (t2 - t1) / n);
+}
@@ -0,0 +1,457 @@
+
+// LightPack - Cached light packs against the previous per-draw packing, and cache reuse/invalidation
+
+#include "testing.h"
+#include "mge/lightpack.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <vector>
+
+
+
+// Per-draw packing as renderMorrowind did it before light packs were cached
+struct ReferencePack {
+    static constexpr size_t MaxLights = 8;
+
+    vec4 diffuse[MaxLights];
+    float ambient[MaxLights];
+    float position[3 * MaxLights];
+    float falloffQuadratic[MaxLights], falloffLinear[MaxLights], falloffConstant;
+    bool hasSun;
+    vec3 sunDirection, sunDiffuse, sunAmbient;
+
+    ReferencePack(const LightState& lightrs, const mat4& view) {
+        std::memset(&diffuse, 0, sizeof(diffuse));
+        std::memset(&ambient, 0, sizeof(ambient));
+        std::memset(&position, 0, sizeof(position));
+        std::memset(&falloffQuadratic, 0, sizeof(falloffQuadratic));
+        std::memset(&falloffLinear, 0, sizeof(falloffLinear));
+        falloffConstant = 0.33;
+        hasSun = false;
+        sunDirection = sunDiffuse = sunAmbient = vec3(0, 0, 0);
+
+        size_t n = std::min(lightrs.active.size(), MaxLights), pointLightCount = 0;
+        for (; n --> 0; ) {
+            const LightState::Light* light = &lightrs.lights.find(lightrs.active[n])->second;
+            vec3 viewspacePos;
+
+            if (light->type == LightState::TypeDirectional) {
+                viewspacePos = view.transformNormal(light->position);
+            } else {
+                viewspacePos = view.transformCoord(light->position);
+            }
+
+            if (light->type == LightState::TypePoint) {
+                diffuse[pointLightCount] = vec4(light->diffuse.r, light->diffuse.g, light->diffuse.b, light->diffuse.a);
+                position[pointLightCount] = viewspacePos.x;
+                position[pointLightCount + MaxLights] = viewspacePos.y;
+                position[pointLightCount + 2*MaxLights] = viewspacePos.z;
+
+                if (light->falloff.x > 0) {
+                    falloffConstant = light->falloff.x;
+                    falloffLinear[pointLightCount] = light->falloff.y;
+                    falloffQuadratic[pointLightCount] = light->falloff.z;
+                } else if (light->falloff.z > 0) {
+                    diffuse[pointLightCount].x *= falloffConstant;
+                    diffuse[pointLightCount].y *= falloffConstant;
+                    diffuse[pointLightCount].z *= falloffConstant;
+                    ambient[pointLightCount] = 1.0f + 1e-4f / std::sqrt(light->falloff.z);
+                    falloffQuadratic[pointLightCount] = falloffConstant * light->falloff.z;
+                } else if (light->falloff.y == 0.10000001f) {
+                    falloffQuadratic[pointLightCount] = 5e-5;
+                } else if (light->falloff.y > 0) {
+                    float brightness = 0.25f + 1e-4f / light->falloff.y;
+                    diffuse[pointLightCount].x = brightness;
+                    diffuse[pointLightCount].y = brightness;
+                    diffuse[pointLightCount].z = brightness;
+                    ambient[pointLightCount] = 1.0;
+                    falloffQuadratic[pointLightCount] = 0.5555f * light->falloff.y * light->falloff.y;
+                    position[pointLightCount + 2*MaxLights] += 25.0;
+                }
+                ++pointLightCount;
+            } else if (light->type == LightState::TypeDirectional) {
+                hasSun = true;
+                sunDirection = viewspacePos;
+                sunDiffuse = vec3(light->diffuse.r, light->diffuse.g, light->diffuse.b);
+                sunAmbient += light->ambient;
+            }
+        }
+    }
+};
+
+static bool sameVec(const vec3& a, const vec3& b) {
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+// samePack - Everything renderMorrowind uploads must match exactly
+static bool samePack(const LightPack& p, const ReferencePack& r) {
+    for (size_t i = 0; i != LightPack::MaxLights; ++i) {
+        if (p.diffuse[i].x != r.diffuse[i].x || p.diffuse[i].y != r.diffuse[i].y
+            || p.diffuse[i].z != r.diffuse[i].z || p.diffuse[i].w != r.diffuse[i].w) {
+            return false;
+        }
+    }
+    if (std::memcmp(p.ambient, r.ambient, sizeof(r.ambient)) != 0
+        || std::memcmp(p.position, r.position, sizeof(r.position)) != 0
+        || std::memcmp(p.falloffQuadratic, r.falloffQuadratic, sizeof(r.falloffQuadratic)) != 0
+        || std::memcmp(p.falloffLinear, r.falloffLinear, sizeof(r.falloffLinear)) != 0) {
+        return false;
+    }
+    if (p.falloffConstant != r.falloffConstant || p.hasSun != r.hasSun) {
+        return false;
+    }
+    if (r.hasSun && !sameVec(p.sunDirection, r.sunDirection)) {
+        return false;
+    }
+    return sameVec(p.sunDiffuse, r.sunDiffuse) && sameVec(p.sunAmbient, r.sunAmbient);
+}
+
+static void resetState(LightState& lightrs) {
+    lightrs.lights.clear();
+    lightrs.active.clear();
+    lightrs.globalAmbient = LightState::Colour{0.1f, 0.1f, 0.1f, 1.0f};
+    lightrs.viewStamp = 1;
+    lightrs.changeStamp = 1;
+}
+
+// setLight - Same change detection as captureLight in the proxy device
+static void setLight(LightState& lightrs, DWORD id, const LightState::Light& l) {
+    LightState::Light* light = &lightrs.lights[id];
+    LightState::Light updated = *light;
+    updated.type = l.type;
+    updated.diffuse = l.diffuse;
+    if (l.type == LightState::TypePoint) {
+        updated.position = l.position;
+        updated.falloff = l.falloff;
+    } else {
+        updated.position = normalize(l.position);
+        updated.ambient = l.ambient;
+    }
+
+    if (std::memcmp(&updated, light, sizeof(updated)) != 0) {
+        *light = updated;
+        light->viewspaceStamp = 0;
+        ++lightrs.changeStamp;
+    }
+}
+
+// setView - View changes invalidate view space positions as well as packs
+static void setView(LightState& lightrs) {
+    ++lightrs.viewStamp;
+    ++lightrs.changeStamp;
+}
+
+static LightState::Light pointLight(float x, float y, float z, vec3 falloff) {
+    LightState::Light l = LightState::Light();
+    l.type = LightState::TypePoint;
+    l.diffuse = LightState::Colour{0.8f, 0.6f, 0.4f, 1.0f};
+    l.position = vec3(x, y, z);
+    l.falloff = falloff;
+    return l;
+}
+
+static LightState::Light sunLight(float x, float y, float z) {
+    LightState::Light l = LightState::Light();
+    l.type = LightState::TypeDirectional;
+    l.diffuse = LightState::Colour{1.0f, 0.9f, 0.7f, 1.0f};
+    l.position = vec3(x, y, z);
+    l.ambient = vec3(0.2f, 0.25f, 0.3f);
+    return l;
+}
+
+// randomLight - Mix of every falloff case Morrowind and its patches produce
+static LightState::Light randomLight(std::mt19937& rng) {
+    std::uniform_real_distribution<float> pos(-4096.0f, 4096.0f), unit(0.0f, 1.0f);
+    float x = pos(rng), y = pos(rng), z = pos(rng);
+    LightState::Light l;
+
+    switch (rng() % 6) {
+    case 0:
+        l = sunLight(x, y, z);
+        break;
+    case 1:
+        l = pointLight(x, y, z, vec3(0, 0, 1e-5f + 1e-4f * unit(rng)));  // MCP magic light
+        break;
+    case 2:
+        l = pointLight(x, y, z, vec3(0, 0.10000001f, 0));                 // Projectile
+        break;
+    case 3:
+        l = pointLight(x, y, z, vec3(0, 3.0f / (22.0f * (1 + rng() % 50)), 0));    // Light spell
+        break;
+    default:
+        l = pointLight(x, y, z, vec3(0.1f + unit(rng), unit(rng) * 1e-3f, unit(rng) * 1e-5f));
+        break;
+    }
+    l.diffuse = LightState::Colour{unit(rng), unit(rng), unit(rng), 1.0f};
+    return l;
+}
+
+static mat4 randomView(std::mt19937& rng) {
+    std::uniform_real_distribution<float> pos(-8192.0f, 8192.0f);
+    vec3 eye(pos(rng), pos(rng), pos(rng) * 0.1f);
+    vec3 at(pos(rng), pos(rng), pos(rng) * 0.1f);
+    return mat4::lookAtLH(eye, at, vec3(0, 0, 1));
+}
+
+static void randomActive(LightState& lightrs, std::mt19937& rng, DWORD lightCount) {
+    lightrs.active.clear();
+    size_t n = rng() % 12;      // Sometimes over MaxLights, which must be truncated
+    while (lightrs.active.size() < n) {
+        DWORD id = rng() % lightCount;
+        if (std::find(lightrs.active.begin(), lightrs.active.end(), id) == lightrs.active.end()) {
+            lightrs.active.push_back(id);
+        }
+    }
+}
+
+TEST(falloff_cases) {
+    LightState lightrs;
+    resetState(lightrs);
+    LightPackCache cache;
+    mat4 view = mat4::identity();
+
+    setLight(lightrs, 10, pointLight(1, 2, 3, vec3(0.5f, 0.01f, 0.001f)));      // Standard
+    setLight(lightrs, 11, pointLight(4, 5, 6, vec3(0, 0, 1e-4f)));              // MCP magic
+    setLight(lightrs, 12, pointLight(7, 8, 9, vec3(0, 0.10000001f, 0)));        // Projectile
+    setLight(lightrs, 13, pointLight(0, 0, 0, vec3(0, 0.05f, 0)));              // Light spell
+    lightrs.active = { 13, 12, 11, 10 };
+
+    // Lights are packed in reverse active order, so the standard light sets falloffConstant first
+    const LightPack* lp = cache.select(&lightrs, view);
+    CHECK(!lp->hasSun);
+    CHECK_EQ(lp->falloffConstant, 0.5f);
+    CHECK_EQ(lp->falloffLinear[0], 0.01f);
+    CHECK_EQ(lp->falloffQuadratic[0], 0.001f);
+    CHECK_EQ(lp->position[0], 1.0f);
+    CHECK_EQ(lp->position[LightPack::MaxLights], 2.0f);
+    CHECK_EQ(lp->position[2 * LightPack::MaxLights], 3.0f);
+
+    CHECK_EQ(lp->diffuse[1].x, 0.8f * 0.5f);
+    CHECK_EQ(lp->falloffQuadratic[1], 0.5f * 1e-4f);
+    CHECK_NEAR(lp->ambient[1], 1.01f, 1e-6f);
+
+    CHECK_EQ(lp->falloffQuadratic[2], 5e-5f);
+    CHECK_EQ(lp->diffuse[2].x, 0.8f);
+
+    CHECK_NEAR(lp->diffuse[3].x, 0.25f + 1e-4f / 0.05f, 1e-6f);
+    CHECK_EQ(lp->ambient[3], 1.0f);
+    CHECK_EQ(lp->position[3 + 2 * LightPack::MaxLights], 25.0f);
+
+    // Unused slots stay zeroed
+    for (size_t i = 4; i != LightPack::MaxLights; ++i) {
+        CHECK_EQ(lp->diffuse[i].x, 0.0f);
+        CHECK_EQ(lp->falloffQuadratic[i], 0.0f);
+    }
+    CHECK(samePack(*lp, ReferencePack(lightrs, view)));
+}
+
+TEST(sun_is_not_a_point_light) {
+    LightState lightrs;
+    resetState(lightrs);
+    LightPackCache cache;
+    mat4 view = mat4::identity();
+
+    setLight(lightrs, 1, sunLight(0, 0, 2));
+    setLight(lightrs, 2, pointLight(1, 2, 3, vec3(0.5f, 0, 0)));
+    lightrs.active = { 1, 2 };
+
+    const LightPack* lp = cache.select(&lightrs, view);
+    CHECK(lp->hasSun);
+    CHECK(sameVec(lp->sunDirection, vec3(0, 0, 1)));    // Normalized on capture
+    CHECK(sameVec(lp->sunAmbient, vec3(0.2f, 0.25f, 0.3f)));
+    CHECK_EQ(lp->sunDiffuse.y, 0.9f);
+    CHECK_EQ(lp->position[0], 1.0f);                     // The point light takes the first slot
+    CHECK_EQ(lp->diffuse[1].x, 0.0f);
+    CHECK(samePack(*lp, ReferencePack(lightrs, view)));
+}
+
+TEST(only_first_max_lights) {
+    LightState lightrs;
+    resetState(lightrs);
+    LightPackCache cache;
+    mat4 view = mat4::identity();
+
+    for (DWORD i = 0; i != 12; ++i) {
+        setLight(lightrs, i, pointLight(float(i), 0, 0, vec3(0.5f, 0, 0)));
+        lightrs.active.push_back(i);
+    }
+
+    const LightPack* lp = cache.select(&lightrs, view);
+    CHECK(samePack(*lp, ReferencePack(lightrs, view)));
+
+    // Lights past MaxLights do not affect the key or the pack
+    LightSetKey a(&lightrs);
+    lightrs.active.resize(LightSetKey::MaxLights);
+    LightSetKey b(&lightrs);
+    CHECK_EQ(a.count, DWORD(LightSetKey::MaxLights));
+    CHECK(a == b);
+    CHECK_EQ(LightSetKey::hasher()(a), LightSetKey::hasher()(b));
+    CHECK(cache.select(&lightrs, view) == lp);
+}
+
+TEST(key_is_ordered) {
+    LightState lightrs;
+    resetState(lightrs);
+    lightrs.active = { 1, 2, 3 };
+    LightSetKey a(&lightrs);
+    lightrs.active = { 3, 2, 1 };
+    LightSetKey b(&lightrs);
+    lightrs.active = { 1, 2 };
+    LightSetKey c(&lightrs);
+
+    // Pack slot order follows active order, so reordered sets are distinct packs
+    CHECK(!(a == b));
+    CHECK(!(a == c));
+    CHECK(LightSetKey() == LightSetKey());
+}
+
+TEST(cache_reuse) {
+    LightState lightrs;
+    resetState(lightrs);
+    LightPackCache cache;
+    mat4 view = mat4::identity();
+
+    for (DWORD i = 0; i != 4; ++i) {
+        setLight(lightrs, i, pointLight(float(i), 1, 2, vec3(0.5f, 0, 0)));
+    }
+
+    lightrs.active = { 0, 1 };
+    const LightPack* a = cache.select(&lightrs, view);
+    CHECK(cache.select(&lightrs, view) == a);           // Consecutive draws
+
+    lightrs.active = { 2, 3 };
+    const LightPack* b = cache.select(&lightrs, view);
+    CHECK(b != a);
+
+    lightrs.active = { 0, 1 };
+    CHECK(cache.select(&lightrs, view) == a);           // Earlier set found in the map
+    CHECK_EQ(cache.packs.size(), size_t(2));
+
+    // Re-sending an unchanged light does not invalidate
+    DWORD stamp = lightrs.changeStamp;
+    setLight(lightrs, 0, pointLight(0, 1, 2, vec3(0.5f, 0, 0)));
+    CHECK_EQ(lightrs.changeStamp, stamp);
+    CHECK(cache.select(&lightrs, view) == a);
+}
+
+TEST(cache_invalidation) {
+    LightState lightrs;
+    resetState(lightrs);
+    LightPackCache cache;
+    mat4 view = mat4::identity();
+
+    setLight(lightrs, 0, pointLight(1, 2, 3, vec3(0.5f, 0, 0)));
+    lightrs.active = { 0 };
+    cache.select(&lightrs, view);
+    cache.lastUploaded = cache.last;
+
+    // A light change rebuilds the pack, and forces an upload
+    setLight(lightrs, 0, pointLight(4, 5, 6, vec3(0.5f, 0, 0)));
+    const LightPack* lp = cache.select(&lightrs, view);
+    CHECK(cache.lastUploaded == nullptr);
+    CHECK_EQ(cache.packs.size(), size_t(1));
+    CHECK_EQ(lp->position[0], 4.0f);
+
+    // A view change re-transforms to view space
+    mat4 moved = mat4::identity();
+    moved._41 = 100.0f;
+    setView(lightrs);
+    lp = cache.select(&lightrs, moved);
+    CHECK_EQ(lp->position[0], 104.0f);
+    CHECK(samePack(*lp, ReferencePack(lightrs, moved)));
+
+    // clear() is used on device reset
+    cache.clear();
+    CHECK(cache.last == nullptr && cache.lastUploaded == nullptr);
+    CHECK(cache.packs.empty());
+}
+
+TEST(random_equivalence) {
+    // Frames of draws with random light sets, view changes and light changes between and within frames
+    std::mt19937 rng(1234);
+    const DWORD lightCount = 64;
+    LightState lightrs;
+    resetState(lightrs);
+    LightPackCache cache;
+
+    for (DWORD i = 0; i != lightCount; ++i) {
+        setLight(lightrs, i * 7 + 3, randomLight(rng));
+    }
+
+    int mismatches = 0, draws = 0;
+    for (int frame = 0; frame != 200; ++frame) {
+        mat4 view = randomView(rng);
+        setView(lightrs);
+
+        for (int draw = 0; draw != 100; ++draw) {
+            if (rng() % 4 != 0) {
+                randomActive(lightrs, rng, lightCount);
+                for (DWORD& id : lightrs.active) {
+                    id = id * 7 + 3;
+                }
+            }
+            if (rng() % 50 == 0) {
+                setLight(lightrs, (rng() % lightCount) * 7 + 3, randomLight(rng));
+            }
+
+            const LightPack* lp = cache.select(&lightrs, view);
+            mismatches += samePack(*lp, ReferencePack(lightrs, view)) ? 0 : 1;
+            ++draws;
+        }
+    }
+    CHECK_EQ(mismatches, 0);
+    CHECK_EQ(draws, 20000);
+}
+
+BENCH(per_draw_vs_cached) {
+    // Typical exterior frame: many draws sharing a handful of light sets
+    std::mt19937 rng(99);
+    const DWORD lightCount = 32;
+    const int frames = 200, drawsPerFrame = 2000, setsPerFrame = 16;
+    LightState lightrs;
+    resetState(lightrs);
+
+    for (DWORD i = 0; i != lightCount; ++i) {
+        setLight(lightrs, i, randomLight(rng));
+    }
+
+    std::vector<std::vector<DWORD>> sets(setsPerFrame);
+    for (auto& s : sets) {
+        randomActive(lightrs, rng, lightCount);
+        s = lightrs.active;
+    }
+    std::vector<mat4> views;
+    for (int frame = 0; frame != frames; ++frame) {
+        views.push_back(randomView(rng));
+    }
+
+    // Draws are grouped by light set a few at a time, as Morrowind's scene graph order produces
+    volatile float sink = 0;
+    double t0 = Testing::seconds();
+    for (int frame = 0; frame != frames; ++frame) {
+        for (int draw = 0; draw != drawsPerFrame; ++draw) {
+            lightrs.active = sets[(draw / 8) % setsPerFrame];
+            ReferencePack r(lightrs, views[frame]);
+            sink += r.position[0];
+        }
+    }
+    double t1 = Testing::seconds();
+
+    LightPackCache cache;
+    for (int frame = 0; frame != frames; ++frame) {
+        setView(lightrs);
+        for (int draw = 0; draw != drawsPerFrame; ++draw) {
+            lightrs.active = sets[(draw / 8) % setsPerFrame];
+            const LightPack* lp = cache.select(&lightrs, views[frame]);
+            sink += lp->position[0];
+        }
+    }
+    double t2 = Testing::seconds();
+
+    double draws = double(frames) * drawsPerFrame;
+    std::printf("   per-draw packing %.1f ns/draw, cached packs %.1f ns/draw (%.1fx)\n",
+                1e9 * (t1 - t0) / draws, 1e9 * (t2 - t1) / draws, (t1 - t0) / (t2 - t1));
+}
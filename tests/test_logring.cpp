@@ -0,0 +1,328 @@
+
+// Log ring - Ordering across threads, overflow drained by producers, in-order synchronous writes, and throughput
+
+#include "testing.h"
+#include "support/logring.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+
+// Sink output; the ring only calls the sink while holding its drain lock
+static std::string output;
+static size_t outputBytes = 0;
+
+static void appendSink(const char* data, size_t sz) {
+    output.append(data, sz);
+}
+
+static void countSink(const char*, size_t sz) {
+    outputBytes += sz;
+}
+
+// Keeps all but noise lines, tagged 'n', which may be too many to store
+static bool inNoise = false, atLineStart = true;
+
+static void filterSink(const char* data, size_t sz) {
+    const char* end = data + sz;
+    while (data != end) {
+        if (atLineStart) {
+            inNoise = *data == 'n';
+        }
+        const char* eol = static_cast<const char*>(std::memchr(data, '\n', end - data));
+        const char* next = eol ? eol + 1 : end;
+        if (!inNoise) {
+            output.append(data, next);
+        }
+        atLineStart = eol != nullptr;
+        data = next;
+    }
+}
+
+// Writer thread, draining as the log writer does
+struct Writer {
+    LogRing& ring;
+    std::atomic<bool> running;
+    std::thread thread;
+
+    explicit Writer(LogRing& r) : ring(r), running(true), thread([this] { run(); }) {}
+    ~Writer() {
+        running = false;
+        thread.join();
+        ring.drainAll();
+    }
+
+    void run() {
+        while (running) {
+            if (ring.pending()) {
+                ring.drainAll();
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+};
+
+// Line "<tag> <thread> <sequence> <padding>\n" with a length that varies from one slot to several
+static std::string makeLine(char tag, int thread, int sequence, size_t length) {
+    char head[32];
+    int n = std::snprintf(head, sizeof(head), "%c %d %d ", tag, thread, sequence);
+    std::string line(head, n);
+    line.resize(length > line.size() + 1 ? length - 1 : line.size(), char('a' + sequence % 26));
+    line += '\n';
+    return line;
+}
+
+// Splits output into lines, checking each is intact: padding all of one letter, and the expected length
+struct Parsed {
+    char tag;
+    int thread, sequence;
+    size_t length;
+};
+
+static bool parseOutput(std::vector<Parsed>& lines) {
+    size_t pos = 0;
+    while (pos < output.size()) {
+        size_t end = output.find('\n', pos);
+        if (end == std::string::npos) {
+            return false;
+        }
+
+        Parsed p;
+        int consumed = 0;
+        if (std::sscanf(output.c_str() + pos, "%c %d %d %n", &p.tag, &p.thread, &p.sequence, &consumed) != 3) {
+            return false;
+        }
+        for (size_t i = pos + consumed; i != end; ++i) {
+            if (output[i] != char('a' + p.sequence % 26)) {
+                return false;
+            }
+        }
+        p.length = end + 1 - pos;
+        lines.push_back(p);
+        pos = end + 1;
+    }
+    return true;
+}
+
+static size_t lineLength(int thread, int sequence) {
+    return 20 + size_t(thread * 131 + sequence * 37) % 600;
+}
+
+TEST(synchronous_without_queueing) {
+    std::unique_ptr<LogRing> ring(new LogRing(appendSink));
+    output.clear();
+
+    // Queueing starts off, as before the writer thread exists
+    ring->submit("one\n", 4);
+    CHECK(output == "one\n");
+    CHECK(!ring->pending());
+
+    ring->setQueueing(true);
+    ring->submit("two\n", 4);
+    CHECK(output == "one\n");
+    CHECK(ring->pending());
+    ring->submit("", 0);
+    ring->drainAll();
+    CHECK(output == "one\ntwo\n");
+    CHECK(!ring->pending());
+}
+
+TEST(slot_boundaries) {
+    std::unique_ptr<LogRing> ring(new LogRing(appendSink));
+    ring->setQueueing(true);
+    output.clear();
+
+    // Lengths around slot multiples, and the largest queued text
+    std::string expected;
+    size_t lengths[] = { 8, LogRing::SlotText - 1, LogRing::SlotText, LogRing::SlotText + 1, 2 * LogRing::SlotText,
+                         LogRing::MaxQueuedSlots * LogRing::SlotText };
+    int sequence = 0;
+    for (size_t length : lengths) {
+        std::string line = makeLine('s', 0, sequence++, length);
+        ring->submit(line.data(), line.size());
+        expected += line;
+    }
+    ring->drainAll();
+    CHECK(output == expected);
+}
+
+TEST(wake_threshold) {
+    std::unique_ptr<LogRing> ring(new LogRing(appendSink));
+    ring->setQueueing(true);
+    output.clear();
+
+    // Wakes exactly once, when pending slots cross the threshold
+    int wakes = 0;
+    for (uint32_t i = 0; i != LogRing::WakeThreshold * 3; ++i) {
+        wakes += ring->submit("x", 1);
+    }
+    CHECK_EQ(wakes, 1);
+    ring->drainAll();
+    CHECK_EQ(output.size(), size_t(LogRing::WakeThreshold * 3));
+}
+
+TEST(overflow_drained_by_producer) {
+    // No writer, so a full ring must be drained by the producer without losing or reordering lines
+    std::unique_ptr<LogRing> ring(new LogRing(appendSink));
+    ring->setQueueing(true);
+    output.clear();
+
+    std::string expected;
+    for (int i = 0; i != 20000; ++i) {
+        std::string line = makeLine('o', 0, i, lineLength(0, i));
+        ring->submit(line.data(), line.size());
+        expected += line;
+    }
+    CHECK(output.size() < expected.size());
+    CHECK(expected.compare(0, output.size(), output) == 0);
+    ring->drainAll();
+    CHECK(output == expected);
+}
+
+TEST(threads_keep_order) {
+    // Lines from each thread come out whole and in that thread's order, including oversized lines
+    std::unique_ptr<LogRing> ring(new LogRing(appendSink));
+    ring->setQueueing(true);
+    output.clear();
+
+    const int threads = 6, perThread = 4000;
+    {
+        Writer writer(*ring);
+        std::vector<std::thread> producers;
+        for (int t = 0; t != threads; ++t) {
+            producers.emplace_back([&ring, t] {
+                for (int i = 0; i != perThread; ++i) {
+                    size_t length = (i % 500 == 499) ? 40000 : lineLength(t, i);
+                    std::string line = makeLine('t', t, i, length);
+                    ring->submit(line.data(), line.size());
+                }
+            });
+        }
+        for (auto& p : producers) {
+            p.join();
+        }
+    }
+
+    std::vector<Parsed> lines;
+    CHECK(parseOutput(lines));
+    CHECK_EQ(lines.size(), size_t(threads * perThread));
+
+    std::vector<int> next(threads, 0);
+    bool ordered = true;
+    for (const Parsed& p : lines) {
+        ordered &= p.tag == 't' && p.thread >= 0 && p.thread < threads && p.sequence == next[p.thread]++;
+        ordered &= p.length == ((p.sequence % 500 == 499) ? 40000 : lineLength(p.thread, p.sequence));
+    }
+    CHECK(ordered);
+}
+
+TEST(synchronous_write_waits_for_reserved) {
+    // A line queued by "b" completes before "A" writes an oversized line, so it must come out first, even when
+    // a slot reserved before it by a noise thread is still being copied when the oversized line is written.
+    std::unique_ptr<LogRing> ring(new LogRing(filterSink));
+    ring->setQueueing(true);
+    output.clear();
+
+    const int rounds = 300, noiseThreads = 3;
+    std::atomic<int> published(-1);
+    std::atomic<bool> stop(false);
+    {
+        Writer writer(*ring);
+        std::vector<std::thread> noise;
+        for (int t = 0; t != noiseThreads; ++t) {
+            noise.emplace_back([&ring, &stop, t] {
+                for (int i = 0; !stop; ++i) {
+                    // Large multi-slot lines keep reserved slots unpublished for a while
+                    std::string line = makeLine('n', t, i, 10000 + (i % 7) * 2000);
+                    ring->submit(line.data(), line.size());
+                }
+            });
+        }
+        std::thread b([&ring, &published] {
+            for (int k = 0; k != rounds; ++k) {
+                std::string line = makeLine('b', 0, k, 30);
+                ring->submit(line.data(), line.size());
+                published.store(k, std::memory_order_release);
+                while (published.load(std::memory_order_acquire) != -2 - k) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+        std::thread a([&ring, &published] {
+            for (int k = 0; k != rounds; ++k) {
+                while (published.load(std::memory_order_acquire) != k) {
+                    std::this_thread::yield();
+                }
+                std::string line = makeLine('A', 0, k, 40000);
+                ring->submit(line.data(), line.size());
+                published.store(-2 - k, std::memory_order_release);
+            }
+        });
+        a.join();
+        b.join();
+        stop = true;
+        for (auto& n : noise) {
+            n.join();
+        }
+    }
+
+    std::vector<Parsed> lines;
+    CHECK(parseOutput(lines));
+    int nextB = 0, nextA = 0;
+    bool ordered = true;
+    for (const Parsed& p : lines) {
+        if (p.tag == 'b') {
+            ordered &= p.sequence == nextB++ && nextB == nextA + 1;
+        } else if (p.tag == 'A') {
+            ordered &= p.sequence == nextA++ && nextA == nextB;
+        }
+    }
+    CHECK(ordered);
+    CHECK_EQ(nextA, rounds);
+    CHECK_EQ(nextB, rounds);
+}
+
+BENCH(throughput) {
+    // The same workload queued for the writer thread, and written synchronously to the sink by each producer
+    // Times are producer side. The sink only counts bytes, so synchronous writes show the locking cost without file I/O.
+    std::unique_ptr<LogRing> ring(new LogRing(countSink));
+    const char line[] = "-- Distant land: loaded 1234 statics in 56 ms, 789 MB\r\n";
+    const size_t sz = sizeof(line) - 1;
+
+    for (bool queueing : { true, false }) {
+        ring->setQueueing(queueing);
+        std::printf("   %s\n", queueing ? "queued" : "synchronous");
+
+        for (int threads : { 1, 2, 4 }) {
+            const int perThread = 400000;
+            outputBytes = 0;
+            double t0, t1;
+            {
+                std::unique_ptr<Writer> writer(queueing ? new Writer(*ring) : nullptr);
+                std::vector<std::thread> producers;
+                t0 = Testing::seconds();
+                for (int t = 0; t != threads; ++t) {
+                    producers.emplace_back([&ring, line, sz] {
+                        for (int i = 0; i != perThread; ++i) {
+                            ring->submit(line, sz);
+                        }
+                    });
+                }
+                for (auto& p : producers) {
+                    p.join();
+                }
+                t1 = Testing::seconds();
+            }
+            CHECK_EQ(outputBytes, size_t(threads) * perThread * sz);
+            std::printf("   %d producer(s), %.1f ns per line, %.2f M lines/s\n", threads,
+                        1e9 * (t1 - t0) / perThread, threads * perThread / (1e6 * (t1 - t0)));
+        }
+    }
+}
@@ -0,0 +1,294 @@
+
+// Loose files - Path normalization and folder snapshots, against a temporary directory tree
+
+#include "testing.h"
+#include "support/loosefiles.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+
+
+static std::string normalized(const char* path, size_t outSize = 260) {
+    char out[260];
+    if (!normalizePath(path, out, outSize)) {
+        return "<fail>";
+    }
+    return out;
+}
+
+TEST(normalize_path) {
+    CHECK(normalized("Textures\\Tx_Rock_01.DDS") == "textures\\tx_rock_01.dds");
+    CHECK(normalized("textures/a/b.tga") == "textures\\a\\b.tga");
+    CHECK(normalized("\\\\textures//a\\/\\b") == "textures\\a\\b");     // Leading and repeated separators
+    CHECK(normalized("/") == "");
+    CHECK(normalized("") == "");
+    CHECK(normalized("a\\") == "a\\");                                 // A trailing separator is kept
+    CHECK(normalized("MiXeD_123-.~") == "mixed_123-.~");               // Only ASCII letters change
+    CHECK(normalized("\xC4\xD6.dds") == "\xC4\xD6.dds");
+}
+
+TEST(normalize_path_bounds) {
+    // The terminator must fit
+    CHECK(normalized("abcd", 5) == "abcd");
+    CHECK(normalized("abcd", 4) == "<fail>");
+    CHECK(normalized("", 1) == "");
+    CHECK(normalized("a", 0) == "<fail>");
+
+    // Skipped separators do not count against the limit
+    CHECK(normalized("//a//b", 4) == "a\\b");
+}
+
+TEST(normalize_path_in_place_prefix) {
+    // The output never runs ahead of the input, so normalizing a buffer onto itself is safe
+    char buf[64];
+    std::strcpy(buf, "//Textures\\\\Sub/File.DDS");
+    CHECK(normalizePath(buf, buf, sizeof(buf)));
+    CHECK(std::strcmp(buf, "textures\\sub\\file.dds") == 0);
+}
+
+// Temporary directory tree, removed on destruction
+struct TempTree {
+    std::string root;
+
+    TempTree() {
+        char pattern[] = "/tmp/mgelooseXXXXXX";
+        const char* dir = mkdtemp(pattern);
+        root = dir ? dir : "";
+    }
+    ~TempTree() {
+        if (!root.empty()) {
+            std::system(("rm -rf '" + root + "'").c_str());
+        }
+    }
+
+    void dir(const char* path) { mkdir((root + "/" + path).c_str(), 0755); }
+    void file(const char* path) {
+        FILE* f = std::fopen((root + "/" + path).c_str(), "wb");
+        if (f) {
+            std::fputs("x", f);
+            std::fclose(f);
+        }
+    }
+};
+
+TEST(scan_folder) {
+    TempTree t;
+    CHECK(!t.root.empty());
+
+    t.dir("Textures");
+    t.dir("Textures/Sub");
+    t.dir("Textures/Sub/Deeper");
+    t.dir("Textures/Empty");
+    t.dir("Meshes");
+    t.file("Textures/Tx_A.dds");
+    t.file("Textures/tx_b.TGA");
+    t.file("Textures/Sub/C.dds");
+    t.file("Textures/Sub/Deeper/d.bmp");
+    t.file("Meshes/m.nif");
+    t.file("top.txt");
+
+    std::unordered_set<std::string> files;
+    scanFolder(t.root + "\\", "Textures", files);
+
+    // Everything below the folder, normalized below the given relative path, and nothing else
+    CHECK_EQ(files.size(), size_t(4));
+    CHECK(files.count("Textures\\tx_a.dds"));
+    CHECK(files.count("Textures\\tx_b.tga"));
+    CHECK(files.count("Textures\\sub\\c.dds"));
+    CHECK(files.count("Textures\\sub\\deeper\\d.bmp"));
+
+    // Scans accumulate, and a missing folder adds nothing
+    scanFolder(t.root + "\\", "Meshes", files);
+    scanFolder(t.root + "\\", "Missing", files);
+    CHECK_EQ(files.size(), size_t(5));
+    CHECK(files.count("Meshes\\m.nif"));
+}
+
+TEST(scan_folder_symlinked_directory) {
+    TempTree t;
+    t.dir("textures");
+    t.dir("shared");
+    t.file("shared/Linked.dds");
+    CHECK(symlink((t.root + "/shared").c_str(), (t.root + "/textures/Link").c_str()) == 0);
+
+    std::unordered_set<std::string> files;
+    scanFolder(t.root + "/", "textures", files);
+    CHECK_EQ(files.size(), size_t(1));
+    CHECK(files.count("textures\\link\\linked.dds"));
+}
+
+BENCH(snapshot) {
+    TempTree t;
+    char path[128];
+    t.dir("textures");
+    for (int d = 0; d != 20; ++d) {
+        std::snprintf(path, sizeof(path), "textures/Dir%02d", d);
+        t.dir(path);
+        for (int f = 0; f != 250; ++f) {
+            std::snprintf(path, sizeof(path), "textures/Dir%02d/Tx_File_%03d.dds", d, f);
+            t.file(path);
+        }
+    }
+
+    std::unordered_set<std::string> files;
+    double t0 = Testing::seconds();
+    scanFolder(t.root + "/", "textures", files);
+    double t1 = Testing::seconds();
+    CHECK_EQ(files.size(), size_t(5000));
+    std::printf("   5000 files in 20 folders, %.2f ms to snapshot\n", 1e3 * (t1 - t0));
+}
+
+static std::string ddsPathOf(const char* name) {
+    char dds[260], original[260];
+    if (!texturePaths(name, dds, original, sizeof(dds))) {
+        return "<fail>";
+    }
+    return std::string(dds) + "|" + original;
+}
+
+TEST(texture_paths) {
+    // Normalized below textures\, with the extension substituted by DDS
+    CHECK(ddsPathOf("Tx_Rock_01.TGA") == "textures\\tx_rock_01.dds|textures\\tx_rock_01.tga");
+    CHECK(ddsPathOf("sub/Dir\\a.bmp") == "textures\\sub\\dir\\a.dds|textures\\sub\\dir\\a.bmp");
+    CHECK(ddsPathOf("a.dds") == "textures\\a.dds|textures\\a.dds");
+    CHECK(ddsPathOf("\\\\lead.tga") == "textures\\lead.dds|textures\\lead.tga");
+
+    // Too short for an extension, or too long for the output
+    CHECK(ddsPathOf("") == "<fail>");
+    CHECK(ddsPathOf("ab") == "<fail>");
+    CHECK(ddsPathOf("abc") == "textures\\dds|textures\\abc");      // The last three characters are always replaced
+    CHECK(ddsPathOf(std::string(300, 'a').c_str()) == "<fail>");
+
+    char dds[16], original[16];
+    CHECK(texturePaths("abcdef", dds, original, sizeof(dds)));
+    CHECK(!texturePaths("abcdefg", dds, original, sizeof(dds)));
+    CHECK(!texturePaths("abc", dds, original, 9));
+}
+
+TEST(resolve_texture) {
+    // Folder names are matched as given on case sensitive file systems, file names are normalized
+    TempTree t;
+    t.dir("statics");
+    t.dir("statics/textures");
+    t.dir("data");
+    t.dir("data/textures");
+    t.dir("data/textures/Sub");
+    t.file("statics/textures/Rock.dds");
+    t.file("data/textures/Rock.dds");
+    t.file("data/textures/Rock.tga");
+    t.file("data/textures/Sub/Grass.TGA");
+
+    LooseTextures loose(t.root + "/statics/", t.root + "/data/");
+    CHECK(loose.refresh());
+    CHECK(!loose.refresh());
+    CHECK_EQ(loose.files[LooseTextures::DistantStatics].size(), size_t(1));
+    CHECK_EQ(loose.files[LooseTextures::DataFiles].size(), size_t(3));
+
+    // Each variant lists every root holding it, so that a failed load can fall through to the next
+    LooseTextureRequest r;
+    CHECK(loose.resolve("ROCK.tga", &r));
+    CHECK(r.valid && !r.missing);
+    CHECK(std::strcmp(r.path[0], "textures\\rock.dds") == 0);
+    CHECK(std::strcmp(r.path[1], "textures\\rock.tga") == 0);
+    CHECK(r.inRoot(0, LooseTextures::DistantStatics) && r.inRoot(0, LooseTextures::DataFiles));
+    CHECK(!r.inRoot(1, LooseTextures::DistantStatics) && r.inRoot(1, LooseTextures::DataFiles));
+
+    // Only the original extension exists
+    CHECK(loose.resolve("sub/grass.tga", &r));
+    CHECK_EQ(r.roots[0], 0u);
+    CHECK_EQ(r.roots[1], 1u << LooseTextures::DataFiles);
+
+    // Not loose, possibly in an archive
+    CHECK(loose.resolve("archived.tga", &r));
+    CHECK_EQ(r.roots[0] | r.roots[1], 0u);
+
+    CHECK(!loose.resolve("a", &r));
+    CHECK(!r.valid && !r.missing);
+    CHECK_EQ(r.path[0][0], '\0');
+}
+
+TEST(negative_cache) {
+    TempTree t;
+    t.dir("data");
+    t.dir("data/textures");
+    LooseTextures loose(t.root + "/missing/", t.root + "/data/");
+    loose.refresh();
+
+    // Requests no source provided are rejected by either extension's name, keeping their paths for keying
+    LooseTextureRequest r;
+    CHECK(loose.resolve("New.tga", &r));
+    loose.markMissing(r);
+    CHECK(!loose.resolve("new.TGA", &r));
+    CHECK(r.valid && r.missing);
+    CHECK(std::strcmp(r.path[1], "textures\\new.tga") == 0);
+    CHECK(loose.resolve("new.dds", &r));
+    CHECK(loose.resolve("new.bmp", &r));
+
+    // Invalid requests are not remembered
+    CHECK(!loose.resolve("x", &r));
+    loose.markMissing(r);
+    CHECK_EQ(loose.missing.size(), size_t(1));
+
+    // A refresh without invalidation keeps the negative cache
+    loose.refresh();
+    CHECK(!loose.resolve("new.tga", &r));
+
+    // Added files are found after invalidation, which forgets every missing request
+    t.file("data/textures/new.tga");
+    CHECK(!loose.resolve("new.tga", &r));
+    loose.invalidate();
+    CHECK(loose.refresh());
+    CHECK(loose.missing.empty());
+    CHECK(loose.resolve("new.tga", &r));
+    CHECK(r.inRoot(1, LooseTextures::DataFiles));
+}
+
+BENCH(resolve_100k) {
+    // 100k requests against a 20k file snapshot, half found loose, half missing
+    const int snapshotFiles = 20000, requests = 100000;
+    LooseTextures loose("", "");
+    char name[128];
+    loose.stale = false;
+    for (int i = 0; i != snapshotFiles; ++i) {
+        std::snprintf(name, sizeof(name), "textures\\dir%02d\\tx_file_%05d.dds", i % 20, i);
+        loose.files[LooseTextures::DataFiles].insert(name);
+    }
+
+    std::vector<std::string> hits, misses;
+    for (int i = 0; i != requests / 2; ++i) {
+        std::snprintf(name, sizeof(name), "Dir%02d\\Tx_File_%05d.tga", i % 20, i % snapshotFiles);
+        hits.push_back(name);
+        std::snprintf(name, sizeof(name), "Dir%02d\\Tx_Missing_%05d.tga", i % 20, i);
+        misses.push_back(name);
+    }
+
+    LooseTextureRequest r;
+    int found = 0, rejected = 0;
+    double t0 = Testing::seconds();
+    for (const auto& n : hits) {
+        found += loose.resolve(n.c_str(), &r) && r.roots[0];
+    }
+    double t1 = Testing::seconds();
+    for (const auto& n : misses) {
+        if (loose.resolve(n.c_str(), &r) && !(r.roots[0] | r.roots[1])) {
+            loose.markMissing(r);
+        }
+    }
+    double t2 = Testing::seconds();
+    for (const auto& n : misses) {
+        rejected += !loose.resolve(n.c_str(), &r) && r.missing;
+    }
+    double t3 = Testing::seconds();
+
+    CHECK_EQ(found, requests / 2);
+    CHECK_EQ(rejected, requests / 2);
+    std::printf("   %d loose hits       %.1f ns/name\n", requests / 2, 1e9 * (t1 - t0) / (requests / 2));
+    std::printf("   %d first misses     %.1f ns/name\n", requests / 2, 1e9 * (t2 - t1) / (requests / 2));
+    std::printf("   %d cached misses    %.1f ns/name\n", requests / 2, 1e9 * (t3 - t2) / (requests / 2));
+}
@@ -0,0 +1,610 @@
+
+// pngEncodeBGRA - Round trip through an independent PNG decoder, checking chunk CRCs, Adler-32 and pixels
+
+#include "testing.h"
+#include "support/pngencode.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+
+
+// Reference CRC-32, bit at a time
+static uint32_t referenceCRC(const uint8_t* p, size_t n) {
+    uint32_t c = 0xFFFFFFFF;
+    for (size_t i = 0; i != n; ++i) {
+        c ^= p[i];
+        for (int k = 0; k != 8; ++k) {
+            c = (c >> 1) ^ (0xEDB88320 & (0 - (c & 1)));
+        }
+    }
+    return ~c;
+}
+
+// Reference Adler-32, modulo every byte
+static uint32_t referenceAdler(const uint8_t* p, size_t n) {
+    uint32_t a = 1, b = 0;
+    for (size_t i = 0; i != n; ++i) {
+        a = (a + p[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    return (b << 16) | a;
+}
+
+static uint32_t readUint32BE(const uint8_t* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+// Minimal inflate, after the structure of zlib's puff.c, failing on any malformed input
+class Inflate {
+    const uint8_t* in;
+    size_t inSize, pos = 0;
+    uint32_t bitBuf = 0;
+    int bitCount = 0;
+    std::vector<uint8_t>& out;
+
+    struct Huffman {
+        short count[16];
+        short symbol[320];
+    };
+
+    bool bits(int need, int& value) {
+        uint32_t v = bitBuf;
+        while (bitCount < need) {
+            if (pos == inSize) {
+                return false;
+            }
+            v |= uint32_t(in[pos++]) << bitCount;
+            bitCount += 8;
+        }
+        bitBuf = v >> need;
+        bitCount -= need;
+        value = int(v & ((1u << need) - 1));
+        return true;
+    }
+
+    bool decode(const Huffman& h, int& symbol) {
+        int code = 0, first = 0, index = 0;
+        for (int len = 1; len <= 15; ++len) {
+            int b;
+            if (!bits(1, b)) {
+                return false;
+            }
+            code |= b;
+            int count = h.count[len];
+            if (code - count < first) {
+                symbol = h.symbol[index + (code - first)];
+                return true;
+            }
+            index += count;
+            first += count;
+            first <<= 1;
+            code <<= 1;
+        }
+        return false;
+    }
+
+    // construct - Canonical code from lengths; rejects over-subscribed codes
+    static bool construct(Huffman& h, const short* length, int n) {
+        short offs[16];
+        std::memset(h.count, 0, sizeof(h.count));
+        for (int i = 0; i != n; ++i) {
+            h.count[length[i]]++;
+        }
+        int left = 1;
+        for (int len = 1; len <= 15; ++len) {
+            left <<= 1;
+            left -= h.count[len];
+            if (left < 0) {
+                return false;
+            }
+        }
+        offs[1] = 0;
+        for (int len = 1; len < 15; ++len) {
+            offs[len + 1] = offs[len] + h.count[len];
+        }
+        for (int i = 0; i != n; ++i) {
+            if (length[i]) {
+                h.symbol[offs[length[i]]++] = short(i);
+            }
+        }
+        return true;
+    }
+
+    bool codes(const Huffman& lencode, const Huffman& distcode) {
+        static const short lbase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+        static const short lext[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+        static const short dbase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+        static const short dext[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+        for (;;) {
+            int symbol, extra;
+            if (!decode(lencode, symbol)) {
+                return false;
+            }
+            if (symbol < 256) {
+                out.push_back(uint8_t(symbol));
+            } else if (symbol == 256) {
+                return true;
+            } else {
+                symbol -= 257;
+                if (symbol >= 29 || !bits(lext[symbol], extra)) {
+                    return false;
+                }
+                size_t len = size_t(lbase[symbol] + extra);
+                if (!decode(distcode, symbol) || symbol >= 30 || !bits(dext[symbol], extra)) {
+                    return false;
+                }
+                size_t dist = size_t(dbase[symbol] + extra);
+                if (dist > out.size() || dist > 32768) {
+                    return false;
+                }
+                for (size_t i = 0; i != len; ++i) {
+                    out.push_back(out[out.size() - dist]);
+                }
+            }
+        }
+    }
+
+    bool stored() {
+        bitBuf = 0;
+        bitCount = 0;
+        if (inSize - pos < 4) {
+            return false;
+        }
+        unsigned int len = in[pos] | (in[pos + 1] << 8);
+        unsigned int nlen = in[pos + 2] | (in[pos + 3] << 8);
+        pos += 4;
+        if (len != (~nlen & 0xFFFF) || inSize - pos < len) {
+            return false;
+        }
+        out.insert(out.end(), in + pos, in + pos + len);
+        pos += len;
+        return true;
+    }
+
+    bool fixed() {
+        Huffman lencode, distcode;
+        short lengths[288];
+        for (int i = 0; i != 288; ++i) {
+            lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+        }
+        construct(lencode, lengths, 288);
+        for (int i = 0; i != 30; ++i) {
+            lengths[i] = 5;
+        }
+        construct(distcode, lengths, 30);
+        ++fixedBlocks;
+        return codes(lencode, distcode);
+    }
+
+    bool dynamic() {
+        static const short order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+        short lengths[320];
+        int nlen, ndist, ncode;
+        Huffman lencode, distcode;
+
+        if (!bits(5, nlen) || !bits(5, ndist) || !bits(4, ncode)) {
+            return false;
+        }
+        nlen += 257;
+        ndist += 1;
+        ncode += 4;
+        if (nlen > 286 || ndist > 30) {
+            return false;
+        }
+
+        std::memset(lengths, 0, sizeof(lengths));
+        for (int i = 0; i != ncode; ++i) {
+            int v;
+            if (!bits(3, v)) {
+                return false;
+            }
+            lengths[order[i]] = short(v);
+        }
+        if (!construct(lencode, lengths, 19)) {
+            return false;
+        }
+
+        for (int index = 0; index < nlen + ndist;) {
+            int symbol, len = 0, repeat;
+            if (!decode(lencode, symbol)) {
+                return false;
+            }
+            if (symbol < 16) {
+                lengths[index++] = short(symbol);
+                continue;
+            }
+            if (symbol == 16) {
+                if (index == 0 || !bits(2, repeat)) {
+                    return false;
+                }
+                len = lengths[index - 1];
+                repeat += 3;
+            } else if (symbol == 17) {
+                if (!bits(3, repeat)) {
+                    return false;
+                }
+                repeat += 3;
+            } else {
+                if (!bits(7, repeat)) {
+                    return false;
+                }
+                repeat += 11;
+            }
+            if (index + repeat > nlen + ndist) {
+                return false;
+            }
+            while (repeat--) {
+                lengths[index++] = short(len);
+            }
+        }
+        if (lengths[256] == 0) {
+            return false;
+        }
+        if (!construct(lencode, lengths, nlen) || !construct(distcode, lengths + nlen, ndist)) {
+            return false;
+        }
+        ++dynamicBlocks;
+        return codes(lencode, distcode);
+    }
+
+public:
+    int storedBlocks = 0, fixedBlocks = 0, dynamicBlocks = 0;
+
+    Inflate(const uint8_t* in, size_t size, std::vector<uint8_t>& out) : in(in), inSize(size), out(out) {}
+
+    // run - Decode the whole stream; returns the bytes consumed, or 0 on error
+    size_t run() {
+        int last, type;
+        do {
+            if (!bits(1, last) || !bits(2, type)) {
+                return 0;
+            }
+            bool ok = false;
+            if (type == 0) {
+                ok = stored();
+                ++storedBlocks;
+            } else if (type == 1) {
+                ok = fixed();
+            } else if (type == 2) {
+                ok = dynamic();
+            }
+            if (!ok) {
+                return 0;
+            }
+        } while (!last);
+        return pos;
+    }
+};
+
+// Decoded image and what was checked on the way
+struct Decoded {
+    unsigned int width = 0, height = 0;
+    std::vector<uint8_t> rgb;
+    std::vector<uint8_t> raw;       // Filtered scanlines
+    std::string error;
+    int storedBlocks = 0, compressedBlocks = 0;
+};
+
+static bool unfilter(Decoded& d) {
+    size_t rowBytes = size_t(d.width) * 3;
+    if (d.raw.size() != (rowBytes + 1) * d.height) {
+        d.error = "image data size";
+        return false;
+    }
+
+    d.rgb.assign(rowBytes * d.height, 0);
+    std::vector<uint8_t> zero(rowBytes, 0);
+    for (unsigned int y = 0; y != d.height; ++y) {
+        const uint8_t* src = &d.raw[(rowBytes + 1) * y];
+        uint8_t* cur = &d.rgb[rowBytes * y];
+        const uint8_t* prev = y ? cur - rowBytes : zero.data();
+        int filter = *src++;
+        if (filter > 4) {
+            d.error = "filter type";
+            return false;
+        }
+
+        for (size_t i = 0; i != rowBytes; ++i) {
+            int a = i >= 3 ? cur[i - 3] : 0, b = prev[i], c = i >= 3 ? prev[i - 3] : 0;
+            int predict = 0;
+            switch (filter) {
+            case 1:
+                predict = a;
+                break;
+            case 2:
+                predict = b;
+                break;
+            case 3:
+                predict = (a + b) >> 1;
+                break;
+            case 4: {
+                int p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+                predict = (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+                break;
+            }
+            }
+            cur[i] = uint8_t(src[i] + predict);
+        }
+    }
+    return true;
+}
+
+// decodePNG - Parse chunks, verifying every CRC, then inflate and verify the zlib stream
+static bool decodePNG(const std::vector<uint8_t>& png, Decoded& d) {
+    static const uint8_t signature[8] = { 0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A };
+    std::vector<uint8_t> zlib;
+    bool seenIHDR = false, seenIEND = false;
+
+    if (png.size() < 8 || std::memcmp(png.data(), signature, 8) != 0) {
+        d.error = "signature";
+        return false;
+    }
+
+    size_t pos = 8;
+    while (!seenIEND) {
+        if (png.size() - pos < 12) {
+            d.error = "truncated chunk";
+            return false;
+        }
+        uint32_t length = readUint32BE(&png[pos]);
+        if (png.size() - pos - 12 < length) {
+            d.error = "chunk length";
+            return false;
+        }
+        const uint8_t* type = &png[pos + 4];
+        const uint8_t* data = &png[pos + 8];
+        if (readUint32BE(data + length) != referenceCRC(type, length + 4)) {
+            d.error = "chunk CRC";
+            return false;
+        }
+
+        if (std::memcmp(type, "IHDR", 4) == 0) {
+            static const uint8_t rgb8[5] = { 8, 2, 0, 0, 0 };    // 8 bit RGB, deflate, adaptive filters, no interlace
+            if (seenIHDR || pos != 8 || length != 13 || std::memcmp(data + 8, rgb8, 5) != 0) {
+                d.error = "IHDR";
+                return false;
+            }
+            d.width = readUint32BE(data);
+            d.height = readUint32BE(data + 4);
+            seenIHDR = true;
+        } else if (std::memcmp(type, "IDAT", 4) == 0) {
+            zlib.insert(zlib.end(), data, data + length);
+        } else if (std::memcmp(type, "IEND", 4) == 0) {
+            seenIEND = length == 0;
+        }
+        pos += 12 + length;
+    }
+    if (!seenIHDR || pos != png.size()) {
+        d.error = "chunk order";
+        return false;
+    }
+
+    // zlib header: deflate with a window of at most 32KB, no dictionary, check bits valid
+    if (zlib.size() < 6 || (zlib[0] & 0x0F) != 8 || (zlib[0] >> 4) > 7 || (zlib[1] & 0x20) || ((zlib[0] << 8) | zlib[1]) % 31 != 0) {
+        d.error = "zlib header";
+        return false;
+    }
+
+    Inflate inflate(zlib.data() + 2, zlib.size() - 6, d.raw);
+    size_t used = inflate.run();
+    if (used == 0 || used != zlib.size() - 6) {
+        d.error = "deflate stream";
+        return false;
+    }
+    d.storedBlocks = inflate.storedBlocks;
+    d.compressedBlocks = inflate.fixedBlocks + inflate.dynamicBlocks;
+
+    if (readUint32BE(&zlib[zlib.size() - 4]) != referenceAdler(d.raw.data(), d.raw.size())) {
+        d.error = "Adler-32";
+        return false;
+    }
+    return unfilter(d);
+}
+
+// BGRA test image, with a row stride that may include padding
+struct Image {
+    unsigned int width, height, stride;
+    std::vector<uint8_t> bgra;
+
+    Image(unsigned int w, unsigned int h, unsigned int padding = 0) : width(w), height(h), stride(4 * w + padding), bgra(size_t(stride) * h, 0xEE) {}
+
+    uint8_t* pixel(unsigned int x, unsigned int y) { return &bgra[size_t(stride) * y + 4 * x]; }
+};
+
+static uint32_t lcg(uint32_t& state) {
+    state = state * 1664525u + 1013904223u;
+    return state >> 8;
+}
+
+static Image gradient(unsigned int w, unsigned int h) {
+    Image img(w, h);
+    for (unsigned int y = 0; y != h; ++y) {
+        for (unsigned int x = 0; x != w; ++x) {
+            uint8_t* p = img.pixel(x, y);
+            p[0] = uint8_t(x + y);
+            p[1] = uint8_t(2 * y);
+            p[2] = uint8_t(3 * x);
+            p[3] = 0xFF;
+        }
+    }
+    return img;
+}
+
+static Image noise(unsigned int w, unsigned int h, uint32_t seed) {
+    Image img(w, h);
+    for (unsigned int y = 0; y != h; ++y) {
+        for (unsigned int x = 0; x != w; ++x) {
+            uint32_t r = lcg(seed);
+            std::memcpy(img.pixel(x, y), &r, 4);
+        }
+    }
+    return img;
+}
+
+// roundTrip - Encode, decode independently, and compare pixels ignoring alpha and padding
+static bool roundTrip(Image& img, Decoded* info = nullptr) {
+    std::vector<uint8_t> png;
+    Decoded d;
+
+    if (!pngEncodeBGRA(img.bgra.data(), img.width, img.height, img.stride, png)) {
+        return false;
+    }
+    if (!decodePNG(png, d)) {
+        std::printf("   %ux%u: %s\n", img.width, img.height, d.error.c_str());
+        return false;
+    }
+    if (d.width != img.width || d.height != img.height) {
+        return false;
+    }
+    for (unsigned int y = 0; y != img.height; ++y) {
+        for (unsigned int x = 0; x != img.width; ++x) {
+            const uint8_t* p = img.pixel(x, y);
+            const uint8_t* q = &d.rgb[3 * (size_t(img.width) * y + x)];
+            if (q[0] != p[2] || q[1] != p[1] || q[2] != p[0]) {
+                std::printf("   %ux%u: pixel %u,%u differs\n", img.width, img.height, x, y);
+                return false;
+            }
+        }
+    }
+    if (info) {
+        *info = static_cast<Decoded&&>(d);
+    }
+    return true;
+}
+
+TEST(reference_checksums) {
+    // Known values, so the reference implementations themselves are trusted
+    const uint8_t* s = reinterpret_cast<const uint8_t*>("123456789");
+    CHECK_EQ(referenceCRC(s, 9), 0xCBF43926u);
+    CHECK_EQ(referenceAdler(reinterpret_cast<const uint8_t*>("Wikipedia"), 9), 0x11E60398u);
+    CHECK_EQ(referenceCRC(reinterpret_cast<const uint8_t*>("IEND"), 4), 0xAE426082u);
+}
+
+TEST(round_trip_small) {
+    unsigned int sizes[][2] = { { 1, 1 }, { 2, 1 }, { 1, 5 }, { 3, 3 }, { 7, 13 }, { 64, 1 }, { 17, 31 } };
+    for (auto& s : sizes) {
+        Image g = gradient(s[0], s[1]);
+        Image n = noise(s[0], s[1], s[0] * 100 + s[1]);
+        CHECK(roundTrip(g));
+        CHECK(roundTrip(n));
+    }
+}
+
+TEST(round_trip_content) {
+    // Compressible content uses compressed blocks, random content may fall back to stored blocks
+    Decoded info;
+    Image g = gradient(640, 480);
+    CHECK(roundTrip(g, &info));
+    CHECK(info.compressedBlocks > 0);
+
+    Image n = noise(320, 240, 12345);
+    CHECK(roundTrip(n, &info));
+
+    Image flat(500, 300);
+    for (unsigned int y = 0; y != flat.height; ++y) {
+        for (unsigned int x = 0; x != flat.width; ++x) {
+            std::memcpy(flat.pixel(x, y), "\x10\x80\xF0\xFF", 4);
+        }
+    }
+    CHECK(roundTrip(flat, &info));
+
+    // Half noise, half gradient, so blocks switch type mid-stream
+    Image mixed = gradient(400, 400);
+    uint32_t seed = 7;
+    for (unsigned int y = 200; y != 400; ++y) {
+        for (unsigned int x = 0; x != 400; ++x) {
+            uint32_t r = lcg(seed);
+            std::memcpy(mixed.pixel(x, y), &r, 4);
+        }
+    }
+    CHECK(roundTrip(mixed));
+}
+
+TEST(round_trip_long_matches) {
+    // Repeated rows at a distance beyond the match window and exact multiples of the maximum match length
+    Image img(258, 200);
+    uint32_t seed = 99;
+    std::vector<uint8_t> row(4 * 258);
+    for (auto& b : row) {
+        b = uint8_t(lcg(seed));
+    }
+    for (unsigned int y = 0; y != img.height; ++y) {
+        std::memcpy(img.pixel(0, y), row.data(), row.size());
+    }
+    CHECK(roundTrip(img));
+
+    Image wide = gradient(12000, 3);
+    CHECK(roundTrip(wide));
+}
+
+TEST(stride_and_alpha_ignored) {
+    Image a = noise(37, 11, 1), b(37, 11, 12);
+    for (unsigned int y = 0; y != a.height; ++y) {
+        for (unsigned int x = 0; x != a.width; ++x) {
+            std::memcpy(b.pixel(x, y), a.pixel(x, y), 4);
+            b.pixel(x, y)[3] = uint8_t(x * y);
+        }
+    }
+
+    std::vector<uint8_t> pa, pb;
+    CHECK(pngEncodeBGRA(a.bgra.data(), a.width, a.height, a.stride, pa));
+    CHECK(pngEncodeBGRA(b.bgra.data(), b.width, b.height, b.stride, pb));
+    CHECK(pa == pb);
+    CHECK(roundTrip(b));
+}
+
+TEST(corruption_detected) {
+    // The decoder's checks are live: single bit flips in a chunk body or in the image data are caught
+    Image g = gradient(50, 50);
+    std::vector<uint8_t> png;
+    Decoded d;
+    CHECK(pngEncodeBGRA(g.bgra.data(), g.width, g.height, g.stride, png));
+    CHECK(decodePNG(png, d));
+
+    std::vector<uint8_t> bad = png;
+    bad[8 + 8 + 2] ^= 1;                        // IHDR width
+    CHECK(!decodePNG(bad, d) && d.error == "chunk CRC");
+
+    // Adler-32 at the end of the IDAT zlib stream, with the chunk CRC fixed up
+    bad = png;
+    size_t idat = 8 + 25;
+    uint32_t length = readUint32BE(&bad[idat]);
+    CHECK(std::memcmp(&bad[idat + 4], "IDAT", 4) == 0);
+    bad[idat + 8 + length - 1] ^= 1;
+    uint32_t crc = referenceCRC(&bad[idat + 4], length + 4);
+    for (int i = 0; i != 4; ++i) {
+        bad[idat + 8 + length + i] = uint8_t(crc >> (24 - 8 * i));
+    }
+    CHECK(!decodePNG(bad, d) && d.error == "Adler-32");
+}
+
+TEST(empty_rejected) {
+    std::vector<uint8_t> png;
+    uint8_t pixel[4] = {};
+    CHECK(!pngEncodeBGRA(pixel, 0, 1, 4, png));
+    CHECK(!pngEncodeBGRA(pixel, 1, 0, 4, png));
+}
+
+BENCH(encode) {
+    Image img = gradient(1920, 1080);
+    uint32_t seed = 3;
+    for (unsigned int y = 0; y < img.height; y += 7) {
+        for (unsigned int x = 0; x != img.width; ++x) {
+            img.pixel(x, y)[0] ^= uint8_t(lcg(seed) & 7);
+        }
+    }
+
+    std::vector<uint8_t> png;
+    const int n = 5;
+    double t0 = Testing::seconds();
+    for (int i = 0; i != n; ++i) {
+        pngEncodeBGRA(img.bgra.data(), img.width, img.height, img.stride, png);
+    }
+    double t1 = Testing::seconds();
+    CHECK(roundTrip(img));
+    std::printf("   1920x1080, %.1f ms per encode, %.2f MB\n", 1e3 * (t1 - t0) / n, png.size() / 1048576.0);
+}
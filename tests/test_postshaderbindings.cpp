@@ -0,0 +1,276 @@
+
+// Post shader bindings - Parameter sets per frame for a compiled chain of mock effects, with pool-shared variables
+
+#include "testing.h"
+#include "mge/postshaderbindings.h"
+
+#include <cstring>
+#include <vector>
+
+
+
+// Mock effect with one parameter per environment variable, counting the sets each receives
+struct MockEffect : ID3DXEffect {
+    struct Parameter {
+        int sets = 0;
+        float value[16] = {};
+        LPDIRECT3DBASETEXTURE9 texture = nullptr;
+    };
+
+    Parameter parameters[EV_count];
+    D3DXHANDLE handles[EV_count];
+    int sets = 0;
+
+    explicit MockEffect(std::initializer_list<EffectVariableID> declared) {
+        std::memset(handles, 0, sizeof(handles));
+        for (EffectVariableID id : declared) {
+            handles[id] = reinterpret_cast<D3DXHANDLE>(&parameters[id]);
+        }
+    }
+
+    Parameter* parameter(D3DXHANDLE h) {
+        ++sets;
+        Parameter* p = reinterpret_cast<Parameter*>(const_cast<char*>(h));
+        ++p->sets;
+        return p;
+    }
+    int setsOf(EffectVariableID id) const {
+        return parameters[id].sets;
+    }
+
+    D3DXHANDLE GetParameterByName(D3DXHANDLE, const char*) {
+        return nullptr;
+    }
+    HRESULT SetBool(D3DXHANDLE h, BOOL b) {
+        parameter(h)->value[0] = b ? 1.0f : 0.0f;
+        return D3D_OK;
+    }
+    HRESULT SetInt(D3DXHANDLE h, int n) {
+        parameter(h)->value[0] = float(n);
+        return D3D_OK;
+    }
+    HRESULT SetFloat(D3DXHANDLE h, float f) {
+        parameter(h)->value[0] = f;
+        return D3D_OK;
+    }
+    HRESULT SetFloatArray(D3DXHANDLE h, const float* f, unsigned int count) {
+        std::memcpy(parameter(h)->value, f, count * sizeof(float));
+        return D3D_OK;
+    }
+    HRESULT SetMatrix(D3DXHANDLE h, const D3DXMATRIX* m) {
+        std::memcpy(parameter(h)->value, m->m, sizeof(parameter(h)->value));
+        return D3D_OK;
+    }
+    HRESULT SetTexture(D3DXHANDLE h, LPDIRECT3DBASETEXTURE9 texture) {
+        parameter(h)->texture = texture;
+        return D3D_OK;
+    }
+};
+
+// Variables declared shared in the test effects, as in the bundled shaders' common include
+static const uint32_t sharedMask = (1u << EV_mview) | (1u << EV_mproj) | (1u << EV_time) | (1u << EV_depthframe) | (1u << EV_HDR);
+
+static LPDIRECT3DBASETEXTURE9 fakeTexture(uintptr_t n) {
+    return reinterpret_cast<LPDIRECT3DBASETEXTURE9>(0x1000 + 16 * n);
+}
+
+// Chain as PostShaders::compileChain builds it, one stage per effect
+struct Chain {
+    struct Stage {
+        MockEffect* effect;
+        std::vector<PostShaderBindings::Binding> bindings;
+        bool active;
+    };
+
+    PostShaderBindings shared;
+    std::vector<Stage> stages;
+
+    void add(MockEffect* effect, bool pooled) {
+        Stage stage = { effect, {}, true };
+        shared.bindEffect(effect, effect->handles, pooled ? sharedMask : 0, stage.bindings);
+        stages.push_back(std::move(stage));
+    }
+
+    // One frame of PostShaders::shaderTime: shared variables first, then each active stage before it renders
+    void frame(const MGEShaderFrameVars& vars) {
+        shared.uploadShared(vars);
+        for (Stage& s : stages) {
+            if (s.active) {
+                PostShaderBindings::apply(s.effect, s.bindings, vars);
+            }
+        }
+    }
+};
+
+// Environment as DistantLand::updatePostShader sets it each frame
+static void updateVars(MGEShaderFrameVars& vars, int frame, LPDIRECT3DBASETEXTURE9 depth) {
+    D3DXMATRIX view, proj;
+    for (int k = 0; k != 16; ++k) {
+        view.m[k / 4][k % 4] = float(frame + k);
+        proj.m[k / 4][k % 4] = float(2 * frame - k);
+    }
+    float eye[4] = { 1.0f, 2.0f, float(frame), 0 }, fog[4] = { 0.5f, 0.5f, 0.5f, 1.0f }, hdr[4] = { 0.25f, 0, 0, 0 };
+
+    vars.SetTexture(EV_depthframe, depth);
+    vars.SetTexture(EV_watertexture, fakeTexture(9));
+    vars.SetMatrix(EV_mview, &view);
+    vars.SetMatrix(EV_mproj, &proj);
+    vars.SetFloatArray(EV_eyevec, eye, 4);
+    vars.SetFloatArray(EV_fogcol, fog, 4);
+    vars.SetFloat(EV_time, 0.016f * frame);
+    vars.SetFloat(EV_fov, 75.0f);
+    vars.SetBool(EV_isinterior, frame % 2);
+    vars.SetInt(EV_waterlevel, frame);
+    vars.SetFloatArray(EV_HDR, hdr, 4);
+}
+
+static MGEShaderFrameVars emptyVars() {
+    MGEShaderFrameVars vars;
+    std::memset(&vars, 0, sizeof(vars));
+    return vars;
+}
+
+TEST(shared_once_per_frame) {
+    // Four pooled effects all declaring the shared matrices and time; each is set once per frame, not once per shader
+    MockEffect a { EV_lastshader, EV_mview, EV_mproj, EV_time, EV_eyevec, EV_rcpres };
+    MockEffect b { EV_lastshader, EV_lastpass, EV_mview, EV_mproj, EV_time, EV_fogcol, EV_depthframe };
+    MockEffect c { EV_lastshader, EV_mview, EV_time, EV_fogcol, EV_isinterior, EV_HDR };
+    MockEffect d { EV_lastshader, EV_mproj, EV_time, EV_eyevec, EV_fov, EV_waterlevel };
+    Chain chain;
+    for (MockEffect* e : { &a, &b, &c, &d }) {
+        chain.add(e, true);
+    }
+    CHECK_EQ(chain.shared.shared.size(), size_t(5));
+
+    MGEShaderFrameVars vars = emptyVars();
+    const int frames = 60;
+    int setsPerFrame = -1;
+    bool steady = true;
+    for (int f = 0; f != frames; ++f) {
+        int before = a.sets + b.sets + c.sets + d.sets;
+        updateVars(vars, f, fakeTexture(1));
+        chain.frame(vars);
+
+        // After the first frame, every frame costs the same number of sets
+        int n = a.sets + b.sets + c.sets + d.sets - before;
+        if (f == 1) {
+            setsPerFrame = n;
+        } else if (f > 1) {
+            steady = steady && n == setsPerFrame;
+        }
+    }
+    CHECK(steady);
+
+    // Shared: once per frame in total, through the first effect declaring each
+    CHECK_EQ(a.setsOf(EV_mview), frames);
+    CHECK_EQ(a.setsOf(EV_mproj), frames);
+    CHECK_EQ(a.setsOf(EV_time), frames);
+    CHECK_EQ(b.setsOf(EV_mview) + c.setsOf(EV_mview), 0);
+    CHECK_EQ(b.setsOf(EV_mproj) + d.setsOf(EV_mproj), 0);
+    CHECK_EQ(b.setsOf(EV_time) + c.setsOf(EV_time) + d.setsOf(EV_time), 0);
+    CHECK_EQ(c.setsOf(EV_HDR), frames);
+
+    // Shared texture: bound once, as it never changed
+    CHECK_EQ(b.setsOf(EV_depthframe), 1);
+
+    // Per-effect variables: once per frame on each effect declaring them
+    CHECK_EQ(a.setsOf(EV_eyevec), frames);
+    CHECK_EQ(d.setsOf(EV_eyevec), frames);
+    CHECK_EQ(b.setsOf(EV_fogcol), frames);
+    CHECK_EQ(c.setsOf(EV_fogcol), frames);
+    CHECK_EQ(c.setsOf(EV_isinterior), frames);
+    CHECK_EQ(d.setsOf(EV_fov), frames);
+    CHECK_EQ(d.setsOf(EV_waterlevel), frames);
+
+    // Per-pass textures and rcpres are never set through bindings
+    CHECK_EQ(a.setsOf(EV_lastshader) + b.setsOf(EV_lastpass) + a.setsOf(EV_rcpres), 0);
+
+    // 4 shared (the depth texture is unchanged) + 7 per-effect per frame, where setting every declared
+    // variable on every shader would take 19
+    CHECK_EQ(setsPerFrame, 4 + 7);
+
+    // Values are this frame's
+    CHECK_EQ(a.parameters[EV_mview].value[0], float(frames - 1));
+    CHECK_EQ(a.parameters[EV_time].value[0], 0.016f * (frames - 1));
+    CHECK_EQ(d.parameters[EV_waterlevel].value[0], float(frames - 1));
+    CHECK_EQ(c.parameters[EV_isinterior].value[0], float((frames - 1) % 2));
+}
+
+TEST(unpooled_effects) {
+    // Effects outside the pool do not share storage, so each gets its own binding for every variable
+    MockEffect a { EV_mview, EV_time };
+    MockEffect b { EV_mview, EV_time };
+    Chain chain;
+    chain.add(&a, true);
+    chain.add(&b, false);
+    CHECK_EQ(chain.shared.shared.size(), size_t(2));
+    CHECK_EQ(chain.stages[1].bindings.size(), size_t(2));
+
+    MGEShaderFrameVars vars = emptyVars();
+    for (int f = 0; f != 10; ++f) {
+        updateVars(vars, f, fakeTexture(1));
+        chain.frame(vars);
+    }
+    CHECK_EQ(a.setsOf(EV_mview), 10);
+    CHECK_EQ(b.setsOf(EV_mview), 10);
+    CHECK_EQ(b.setsOf(EV_time), 10);
+}
+
+TEST(inactive_stages) {
+    // Shared variables are uploaded even when the effect they bind through is disabled, per-effect ones are not
+    MockEffect a { EV_mview, EV_eyevec };
+    MockEffect b { EV_mview, EV_eyevec };
+    Chain chain;
+    chain.add(&a, true);
+    chain.add(&b, true);
+    chain.stages[0].active = false;
+
+    MGEShaderFrameVars vars = emptyVars();
+    for (int f = 0; f != 10; ++f) {
+        updateVars(vars, f, fakeTexture(1));
+        chain.frame(vars);
+    }
+    CHECK_EQ(a.setsOf(EV_mview), 10);
+    CHECK_EQ(b.setsOf(EV_mview), 0);
+    CHECK_EQ(a.setsOf(EV_eyevec), 0);
+    CHECK_EQ(b.setsOf(EV_eyevec), 10);
+}
+
+TEST(texture_changes) {
+    // Textures are rebound only when the frame's texture changes, per binding
+    MockEffect a { EV_depthframe, EV_watertexture };
+    MockEffect b { EV_depthframe, EV_watertexture };
+    Chain chain;
+    chain.add(&a, true);
+    chain.add(&b, true);
+
+    MGEShaderFrameVars vars = emptyVars();
+    const LPDIRECT3DBASETEXTURE9 depth[] = { fakeTexture(1), fakeTexture(1), fakeTexture(2), fakeTexture(2), nullptr, fakeTexture(1) };
+    for (int f = 0; f != 6; ++f) {
+        updateVars(vars, f, depth[f]);
+        chain.frame(vars);
+    }
+    CHECK_EQ(a.setsOf(EV_depthframe), 4);
+    CHECK(a.parameters[EV_depthframe].texture == fakeTexture(1));
+    CHECK_EQ(b.setsOf(EV_depthframe), 0);
+    CHECK_EQ(a.setsOf(EV_watertexture), 1);
+    CHECK_EQ(b.setsOf(EV_watertexture), 1);
+}
+
+TEST(unset_variables) {
+    // Variables the environment has not provided are left alone
+    MockEffect a { EV_mview, EV_sunvec, EV_fogstart };
+    Chain chain;
+    chain.add(&a, true);
+
+    MGEShaderFrameVars vars = emptyVars();
+    updateVars(vars, 0, fakeTexture(1));
+    chain.frame(vars);
+    CHECK_EQ(a.setsOf(EV_mview), 1);
+    CHECK_EQ(a.setsOf(EV_sunvec), 0);
+    CHECK_EQ(a.setsOf(EV_fogstart), 0);
+
+    // Recompiling after a shader reload starts from a clean shared list
+    chain.shared.clear();
+    CHECK(chain.shared.shared.empty());
+}
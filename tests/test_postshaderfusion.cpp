@@ -0,0 +1,190 @@
+
+// PostShaderFusion - Tokenizing, fusion analysis and generated effect source
+
+#include "testing.h"
+#include "mge/postshaderfusion.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+
+
+typedef PostShaderFusion::Token Token;
+
+static std::vector<Token> tokens(const char* source) {
+    std::vector<Token> t;
+    PostShaderFusion::tokenize(source, std::strlen(source), t);
+    return t;
+}
+
+static bool analyze(const std::string& source, PostShaderFusion::Analysis& a) {
+    return PostShaderFusion::analyze(source.data(), source.size(), a);
+}
+
+static bool contains(const std::string& s, const char* x) {
+    return s.find(x) != std::string::npos;
+}
+
+// Single pass shader which only samples the input at the current texel
+static const char* texelShader =
+    "texture lastshader;\n"
+    "float3 eyevec;\n"
+    "float brightness = 1.0;\n"
+    "static const float k = 0.5;\n"
+    "sampler s0 = sampler_state { texture = <lastshader>; addressu = clamp; };\n"
+    "float4 tint(float2 tex : TEXCOORD0) : COLOR0 {\n"
+    "    float4 c = tex2D(s0, tex);\n"
+    "    return c * brightness * k;\n"
+    "}\n"
+    "technique T0 < string MGEinterface = \"MGE XE 0\"; > {\n"
+    "    pass { PixelShader = compile ps_3_0 tint(); }\n"
+    "}\n";
+
+// A texel local shader with its entry point body replaced
+static std::string withBody(const char* body) {
+    return std::string(
+        "texture lastshader;\n"
+        "int mask;\n"
+        "sampler s0 = sampler_state { texture = <lastshader>; };\n"
+        "float4 main(float2 tex : TEXCOORD0) : COLOR0 {\n") + body +
+        "}\n"
+        "technique T0 < string MGEinterface = \"MGE XE 0\"; > {\n"
+        "    pass { PixelShader = compile ps_3_0 main(); }\n"
+        "}\n";
+}
+
+TEST(tokenize_kinds) {
+    auto t = tokens("float4 x = 1.5e-3 + .5; // comment\n/* block */ \"str\\\"ing\" #line 4\ny");
+    CHECK_EQ(t.size(), size_t(9));
+    CHECK(t[0].kind == Token::Ident && t[0].text == "float4");
+    CHECK(t[2].kind == Token::Punct && t[2].text == "=");
+    CHECK(t[3].kind == Token::Number && t[3].text == "1.5e-3");
+    CHECK(t[5].kind == Token::Number && t[5].text == ".5");
+    CHECK(t[7].kind == Token::String && t[7].text == "\"str\\\"ing\"");
+    CHECK(t[8].kind == Token::Ident && t[8].text == "y");
+}
+
+TEST(tokenize_operators) {
+    static const char* ops[] = {
+        "+=", "-=", "*=", "/=", "%=", "&=", "|=", "^=", "<<=", ">>=",
+        "==", "!=", "<=", ">=", "&&", "||", "++", "--", "<<", ">>"
+    };
+    for (const char* op : ops) {
+        std::string source = std::string("a ") + op + " b";
+        auto t = tokens(source.c_str());
+        CHECK_EQ(t.size(), size_t(3));
+        if (t.size() == 3) {
+            CHECK(t[1].kind == Token::Punct && t[1].text == op);
+        }
+    }
+
+    // Without spaces, the longest operator wins
+    auto t = tokens("a<<=b>>c|d");
+    CHECK_EQ(t.size(), size_t(7));
+    CHECK(t[1].text == "<<=" && t[3].text == ">>" && t[5].text == "|");
+}
+
+TEST(analyze_texel_local) {
+    PostShaderFusion::Analysis a;
+    CHECK(analyze(texelShader, a));
+    CHECK(a.singlePass);
+    CHECK(a.texelLocal);
+    CHECK(a.entry == "tint");
+    CHECK_EQ(a.inputSamples.size(), size_t(1));
+
+    // Static constants are file scope, but not uniforms
+    CHECK(a.globals.count("k") && a.globals.count("s0") && a.globals.count("tint"));
+    bool hasK = false, hasBrightness = false;
+    for (const auto& u : a.uniforms) {
+        hasK |= u == "k";
+        hasBrightness |= u == "brightness";
+    }
+    CHECK(!hasK && hasBrightness);
+}
+
+TEST(analyze_not_texel_local) {
+    static const char* bodies[] = {
+        "return tex2D(s0, tex + float2(0.001, 0));\n",      // Offset sample
+        "tex.x += 0.1; return tex2D(s0, tex);\n",           // Modified texcoord
+        "tex *= 2; return tex2D(s0, tex);\n",
+        "++tex; return tex2D(s0, tex);\n",
+    };
+    for (const char* body : bodies) {
+        PostShaderFusion::Analysis a;
+        CHECK(analyze(withBody(body), a));
+        CHECK(a.singlePass);
+        CHECK(!a.texelLocal);
+    }
+}
+
+TEST(analyze_compound_assignment_to_texcoord) {
+    // Every compound assignment is a write, including the bitwise and shift forms
+    static const char* ops[] = { "+=", "-=", "*=", "/=", "%=", "&=", "|=", "^=", "<<=", ">>=" };
+    for (const char* op : ops) {
+        std::string body = std::string("tex.x ") + op + " mask; return tex2D(s0, tex);\n";
+        PostShaderFusion::Analysis a;
+        CHECK(analyze(withBody(body.c_str()), a));
+        CHECK(!a.texelLocal);
+    }
+
+    // Compound assignment to other variables is fine
+    PostShaderFusion::Analysis a;
+    CHECK(analyze(withBody("int m = 3; m |= mask; m <<= 1; return tex2D(s0, tex) * m;\n"), a));
+    CHECK(a.texelLocal);
+}
+
+TEST(analyze_multipass) {
+    std::string source = std::string(texelShader);
+    size_t at = source.find("    pass");
+    source.insert(at, "    pass { PixelShader = compile ps_3_0 tint(); }\n");
+
+    PostShaderFusion::Analysis a;
+    CHECK(analyze(source, a));
+    CHECK(!a.singlePass);
+}
+
+TEST(analyze_unbalanced) {
+    PostShaderFusion::Analysis a;
+    CHECK(!analyze("float4 main(float2 tex : TEXCOORD0) : COLOR0 { return 0;", a));
+    CHECK(!a.singlePass);
+}
+
+TEST(generate_fused) {
+    PostShaderFusion::Analysis a, b;
+    CHECK(analyze(texelShader, a));
+    CHECK(analyze(withBody("int m = 3; m |= mask; m <<= 1; m >>= 1; m &= 7; m ^= 1; return tex2D(s0, tex) * m;\n"), b));
+
+    std::string out = PostShaderFusion::generate({ &a, &b });
+
+    // Member declarations are prefixed, and only the first member reads the input image
+    CHECK(contains(out, "fuse0_brightness"));
+    CHECK(contains(out, "fuse1_mask"));
+    CHECK(contains(out, "fuse0_tint"));
+    CHECK(contains(out, "tex2D ( fuse0_s0 , tex )"));
+    CHECK(!contains(out, "tex2D ( fuse1_s0 , tex )"));
+    CHECK(contains(out, "fuse_input * m"));
+    CHECK(contains(out, "fuse_input = fuse0_tint(tex);"));
+    CHECK(contains(out, "return fuse1_main(tex);"));
+
+    // Compound operators are emitted intact
+    CHECK(contains(out, "m |= fuse1_mask"));
+    CHECK(contains(out, "m <<= 1"));
+    CHECK(contains(out, "m >>= 1"));
+    CHECK(contains(out, "m &= 7"));
+    CHECK(contains(out, "m ^= 1"));
+    CHECK(!contains(out, "| ="));
+    CHECK(!contains(out, "<< ="));
+
+    // Member techniques are dropped in favour of the single fused technique
+    size_t techniques = 0;
+    for (size_t p = out.find("technique"); p != std::string::npos; p = out.find("technique", p + 1)) {
+        ++techniques;
+    }
+    CHECK_EQ(techniques, size_t(1));
+}
+
+TEST(member_prefix) {
+    CHECK(PostShaderFusion::memberPrefix(0) == "fuse0_");
+    CHECK(PostShaderFusion::memberPrefix(12) == "fuse12_");
+}
@@ -0,0 +1,149 @@
+
+// Profiler statistics - Rolling window summaries, checked against a full sort of the expected window
+
+#include "testing.h"
+#include "support/profilestats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+
+
+// Reference summary of the last samples, with p99 as the nearest rank ceil(0.99 n) of the sorted window
+static RollingStats::Summary reference(const std::vector<float>& all) {
+    int n = std::min(int(all.size()), RollingStats::window);
+    std::vector<float> w(all.end() - n, all.end());
+    RollingStats::Summary s = { 0, 0, 0, 0, n };
+    if (n == 0) {
+        return s;
+    }
+
+    std::sort(w.begin(), w.end());
+    double sum = 0;
+    for (float x : w) {
+        sum += x;
+    }
+    s.min = w.front();
+    s.max = w.back();
+    s.avg = float(sum / n);
+    s.p99 = w[int(std::ceil(0.99 * n)) - 1];
+    return s;
+}
+
+static bool same(const RollingStats::Summary& a, const RollingStats::Summary& b) {
+    return a.samples == b.samples && a.min == b.min && a.max == b.max && a.p99 == b.p99 && std::fabs(a.avg - b.avg) <= 1e-6f * std::fabs(b.avg);
+}
+
+TEST(empty) {
+    RollingStats stats;
+    stats.clear();
+    RollingStats::Summary s = stats.summarise();
+    CHECK_EQ(s.samples, 0);
+    CHECK(s.min == 0 && s.avg == 0 && s.max == 0 && s.p99 == 0);
+    CHECK_EQ(stats.last(), 0.0f);
+
+    // Cleared after use
+    stats.add(5.0f);
+    stats.clear();
+    CHECK_EQ(stats.summarise().samples, 0);
+    CHECK_EQ(stats.last(), 0.0f);
+}
+
+TEST(single) {
+    RollingStats stats;
+    stats.add(2.5f);
+    RollingStats::Summary s = stats.summarise();
+    CHECK_EQ(s.samples, 1);
+    CHECK(s.min == 2.5f && s.avg == 2.5f && s.max == 2.5f && s.p99 == 2.5f);
+    CHECK_EQ(stats.last(), 2.5f);
+}
+
+TEST(nearest_rank) {
+    // Values 1..n in shuffled order: p99 is ceil(0.99 n), so the max up to n = 100 and one below it after
+    std::mt19937 rng(3);
+    for (int n : { 1, 2, 50, 99, 100, 101, 150, 199, 200, 201, 255, 256 }) {
+        std::vector<float> v;
+        for (int i = 1; i <= n; ++i) {
+            v.push_back(float(i));
+        }
+        std::shuffle(v.begin(), v.end(), rng);
+
+        RollingStats stats;
+        for (float x : v) {
+            stats.add(x);
+        }
+        RollingStats::Summary s = stats.summarise();
+        CHECK_EQ(s.p99, std::ceil(0.99f * n));
+        CHECK(s.p99 <= s.max);
+        CHECK_EQ(s.max, float(n));
+        CHECK_EQ(s.min, 1.0f);
+    }
+
+    // One spike in a full window is the p99 only while it is in the top 1%
+    RollingStats stats;
+    for (int i = 0; i != 255; ++i) {
+        stats.add(10.0f);
+    }
+    stats.add(100.0f);
+    CHECK_EQ(stats.summarise().p99, 10.0f);
+    CHECK_EQ(stats.summarise().max, 100.0f);
+}
+
+TEST(window_wrap) {
+    // Old samples leave the window as new ones arrive, across several wraps and at every offset
+    RollingStats stats;
+    std::vector<float> all;
+    int wrong = 0;
+    for (int i = 0; i != 4 * RollingStats::window + 17; ++i) {
+        float x = float((i * 37) % 101) + (i >= 600 ? 1000.0f : 0.0f);
+        stats.add(x);
+        all.push_back(x);
+        wrong += !same(stats.summarise(), reference(all));
+        wrong += stats.last() != x;
+    }
+    CHECK_EQ(wrong, 0);
+
+    // Once a full window of new values has arrived, nothing of the old values remains
+    RollingStats::Summary s = stats.summarise();
+    CHECK_EQ(s.samples, RollingStats::window);
+    CHECK(s.min >= 1000.0f);
+}
+
+TEST(random_windows) {
+    int wrong = 0;
+    for (uint32_t seed = 1; seed != 51; ++seed) {
+        std::mt19937 rng(seed);
+        std::exponential_distribution<float> frameTime(1.0f / 16.0f);
+        RollingStats stats;
+        std::vector<float> all;
+        int n = int(rng() % 1000);
+        for (int i = 0; i != n; ++i) {
+            float x = frameTime(rng);
+            stats.add(x);
+            all.push_back(x);
+        }
+        wrong += !same(stats.summarise(), reference(all));
+    }
+    CHECK_EQ(wrong, 0);
+}
+
+BENCH(summarise) {
+    RollingStats stats;
+    std::mt19937 rng(1);
+    std::exponential_distribution<float> frameTime(1.0f / 16.0f);
+    for (int i = 0; i != RollingStats::window; ++i) {
+        stats.add(frameTime(rng));
+    }
+
+    const int n = 100000;
+    float sink = 0;
+    double t0 = Testing::seconds();
+    for (int i = 0; i != n; ++i) {
+        stats.add(float(i & 63));
+        sink += stats.summarise().p99;
+    }
+    double t1 = Testing::seconds();
+    std::printf("   %.0f ns per summary of a full window (%g)\n", 1e9 * (t1 - t0) / n, sink > 0 ? 1.0 : 0.0);
+}
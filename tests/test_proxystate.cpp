@@ -0,0 +1,625 @@
+
+// Proxy forwarding rules - Scene tracking, distant land hooks, fog and sampler overrides and state capture,
+// driven by Morrowind-like call sequences against hooks that record what distant land would be asked to do
+
+#include "testing.h"
+#include "mge/proxystate.h"
+
+#include <cstring>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+
+
+// D3D values used by the call sequences
+enum {
+    TS_VIEW = 2, TS_WORLD = 256,
+    RS_ZWRITEENABLE = 14, RS_FOGSTART = 36, RS_FOGEND = 37, RS_FOGTABLEMODE = 35, RS_FOGVERTEXMODE = 140,
+    RS_STENCILENABLE = 52, RS_STENCILREF = 57, RS_AMBIENT = 139,
+    TSS_COLOROP = 1, TSS_BUMPENVMAT01 = 8, TSS_ADDRESSU = 13, TSS_MINFILTER = 17, TSS_MIPFILTER = 18,
+    SAMP_ADDRESSU = 1, SAMP_MINFILTER = 6, SAMP_MIPFILTER = 7,
+    TEXF_NONE = 0, TEXF_POINT = 1, TEXF_LINEAR = 2, TEXF_ANISOTROPIC = 3,
+    LIGHT_POINT = 1, LIGHT_DIRECTIONAL = 3, PT_TRIANGLELIST = 4
+};
+
+// Hooks recording the calls distant land would receive, as a string of single letters
+struct RecordingHooks : ProxyState::Hooks {
+    std::string calls;
+    bool skipDraws = false;
+    uint32_t ambient = 0;
+    int lastScene = -2;
+
+    void beginFrame() { calls += 'F'; }
+    void renderStage0() { calls += '0'; }
+    void renderStage1() { calls += '1'; }
+    void renderStageBlend() { calls += 'B'; }
+    void renderStage2() { calls += '2'; }
+    void renderStageWater() { calls += 'W'; }
+    void postProcess() { calls += 'P'; }
+    void drawHUD() { calls += 'H'; }
+    void endFrame() { calls += 'E'; }
+    void setAmbientColour(uint32_t colour) { ambient = colour; }
+    bool inspectDraw(int sceneCount, const RenderedState*, const FragmentState*, LightState*) {
+        calls += 'i';
+        lastScene = sceneCount;
+        return !skipDraws;
+    }
+};
+
+static const float identity[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+static const float worldView[16] = { 1, 0, 0, 0, 0, 0, 1, 0, 0, 1, 0, 0, 100, 200, 300, 1 };
+
+// UI view matrix, as detected by detectMenu
+static const float menuView[16] = { 1, 0, 0, 0, 0, 0, 1, 0, 0, 1, 0, 0, 0, 0, 0, 1 };
+
+static void setupDistantLand(ProxyState& state) {
+    state.distantLandReady = state.distantLandFog = state.distantWaterEnabled = true;
+    state.scaleFilter = TEXF_ANISOTROPIC;
+    state.hudReady = true;
+}
+
+static bool draw(ProxyState& state) {
+    return state.drawIndexedPrimitive(PT_TRIANGLELIST, 0, 0, 3, 0, 1);
+}
+
+// A typical exterior frame: main view scenes for opaque and alpha meshes, then the UI scene
+static void frame(ProxyState& state, bool water) {
+    state.setTransform(TS_VIEW, worldView);
+    state.beginScene();
+    draw(state);
+    draw(state);
+    state.endScene();
+
+    state.beginScene();
+    if (water) {
+        ProxyState::Material m;
+        std::memset(&m, 0, sizeof(m));
+        m.power = 99999.0f;
+        state.setMaterial(&m);
+        draw(state);
+        m.power = 0.0f;
+        state.setMaterial(&m);
+    }
+    draw(state);
+    state.endScene();
+
+    state.setTransform(TS_VIEW, menuView);
+    state.beginScene();
+    draw(state);
+    state.endScene();
+    state.present();
+}
+
+TEST(scene_hooks) {
+    // Stage 0 before the first draw, stage 1 and blend at the end of the first scene, stage 2 and water later,
+    // then post-process and HUD on the UI scene, and end of frame work after it
+    RecordingHooks hooks;
+    ProxyState state(&hooks);
+    setupDistantLand(state);
+
+    frame(state, false);
+    CHECK(hooks.calls == "F0ii1Bi2WPHE");
+    CHECK_EQ(hooks.lastScene, 1);
+
+    // Morrowind's water plane in view is replaced by distant water, once
+    hooks.calls.clear();
+    frame(state, true);
+    CHECK(hooks.calls == "F0ii1BWi2PHE");
+
+    // Without distant land only the HUD work remains
+    hooks.calls.clear();
+    state.distantLandReady = state.distantWaterEnabled = false;
+    frame(state, true);
+    CHECK(hooks.calls == "FHE");
+}
+
+TEST(draw_forwarding) {
+    RecordingHooks hooks;
+    ProxyState state(&hooks);
+    setupDistantLand(state);
+
+    state.setTransform(TS_VIEW, worldView);
+    state.beginScene();
+    CHECK(draw(state));
+
+    // Water draws never reach the device while distant water is on
+    ProxyState::Material m;
+    std::memset(&m, 0, sizeof(m));
+    m.power = 99999.0f;
+    state.setMaterial(&m);
+    CHECK(!draw(state));
+    CHECK(!draw(state));
+    m.power = 1.0f;
+    state.setMaterial(&m);
+
+    // Draws taken over by distant land are dropped, and forget bound textures
+    IDirect3DTexture9* texture = reinterpret_cast<IDirect3DTexture9*>(uintptr_t(0x1000));
+    CHECK(state.setTexture(0, texture));
+    CHECK(!state.setTexture(0, texture));
+    hooks.skipDraws = true;
+    CHECK(!draw(state));
+    CHECK(state.setTexture(0, texture));
+
+    // Shadow stencil draws are not inspected
+    hooks.calls.clear();
+    state.setRenderState(RS_STENCILENABLE, 1);
+    state.setRenderState(RS_STENCILREF, 1);
+    CHECK(draw(state));
+    CHECK(hooks.calls.empty());
+    state.setRenderState(RS_STENCILREF, 2);
+    CHECK(!draw(state));
+    CHECK(hooks.calls == "i");
+
+    // Nor are draws to other render targets
+    hooks.calls.clear();
+    state.setRenderTarget(false);
+    CHECK(draw(state));
+    CHECK(hooks.calls.empty());
+}
+
+TEST(fog_override) {
+    RecordingHooks hooks;
+    ProxyState state(&hooks);
+
+    // Fog modes are always MGE's; the fog range only while distant land sets it
+    CHECK(!state.setRenderState(RS_FOGTABLEMODE, 3));
+    CHECK(!state.setRenderState(RS_FOGVERTEXMODE, 0));
+    CHECK(state.setRenderState(RS_FOGSTART, 100));
+    state.distantLandFog = true;
+    CHECK(!state.setRenderState(RS_FOGEND, 200));
+    CHECK(!state.setRenderState(RS_FOGSTART, 300));
+    CHECK_EQ(state.swallowed, 4ull);
+
+    // Swallowed states are not recorded as reaching the device
+    state.distantLandFog = false;
+    CHECK(state.setRenderState(RS_FOGSTART, 300));
+    CHECK(!state.setRenderState(RS_FOGSTART, 300));
+}
+
+TEST(sampler_mapping) {
+    RecordingHooks hooks;
+    ProxyState state(&hooks);
+    state.scaleFilter = TEXF_ANISOTROPIC;
+
+    uint32_t value = TEXF_POINT, sampler = 99;
+    CHECK(state.setTextureStageState(0, TSS_MINFILTER, value, sampler));
+    CHECK_EQ(sampler, uint32_t(SAMP_MINFILTER));
+    CHECK_EQ(value, uint32_t(TEXF_ANISOTROPIC));
+
+    value = TEXF_POINT;
+    CHECK(state.setTextureStageState(1, TSS_MIPFILTER, value, sampler));
+    CHECK_EQ(sampler, uint32_t(SAMP_MIPFILTER));
+    CHECK_EQ(value, uint32_t(TEXF_LINEAR));
+
+    value = TEXF_NONE;
+    CHECK(state.setTextureStageState(2, TSS_MINFILTER, value, sampler));
+    CHECK_EQ(value, uint32_t(TEXF_NONE));
+
+    value = 3;
+    CHECK(state.setTextureStageState(0, TSS_ADDRESSU, value, sampler));
+    CHECK_EQ(sampler, uint32_t(SAMP_ADDRESSU));
+    CHECK_EQ(value, 3u);
+
+    // Texture stage states stay as they are, and are captured
+    value = 7;
+    CHECK(state.setTextureStageState(1, TSS_COLOROP, value, sampler));
+    CHECK_EQ(sampler, 0u);
+    CHECK_EQ(value, 7u);
+    CHECK_EQ(state.frs.stage[1].colorOp, 7);
+
+    float bump = 0.25f;
+    std::memcpy(&value, &bump, sizeof(value));
+    CHECK(state.setTextureStageState(2, TSS_BUMPENVMAT01, value, sampler));
+    CHECK_EQ(state.frs.stage[2].bumpEnvMat[0][1], 0.25f);
+
+    // Redundant sets are dropped on the value Morrowind sent, before overrides
+    value = TEXF_POINT;
+    CHECK(!state.setTextureStageState(0, TSS_MINFILTER, value, sampler));
+}
+
+TEST(transform_capture) {
+    RecordingHooks hooks;
+    ProxyState state(&hooks);
+
+    // World-view is derived from the last view, and world transforms are captured again after a view change
+    float world[16];
+    std::memcpy(world, identity, sizeof(world));
+    world[12] = 5.0f;
+    CHECK(state.setTransform(TS_VIEW, worldView));
+    CHECK(state.setTransform(TS_WORLD, world));
+    CHECK(!state.setTransform(TS_WORLD, world));
+    CHECK_EQ(state.rs.worldViewTransforms[0]._41, 105.0f);
+    CHECK_EQ(state.rs.worldViewTransforms[0]._42, 200.0f);
+    CHECK_EQ(state.rs.worldViewTransforms[0]._32, 1.0f);
+    CHECK(state.isMainView);
+
+    CHECK(state.setTransform(TS_VIEW, identity));
+    CHECK(state.setTransform(TS_WORLD, world));
+    CHECK_EQ(state.rs.worldViewTransforms[0]._41, 5.0f);
+    CHECK_EQ(state.rs.worldViewTransforms[0]._32, 0.0f);
+
+    // Menu views are only detected on the back buffer
+    CHECK(state.setTransform(TS_VIEW, menuView));
+    CHECK(!state.isMainView);
+    state.setRenderTarget(false);
+    CHECK(state.setTransform(TS_VIEW, worldView));
+    CHECK(!state.isMainView);
+}
+
+TEST(light_capture) {
+    RecordingHooks hooks;
+    ProxyState state(&hooks);
+
+    ProxyState::Light sun;
+    std::memset(&sun, 0, sizeof(sun));
+    sun.type = LIGHT_DIRECTIONAL;
+    sun.diffuse = ProxyState::Colour { 0.5f, 0.6f, 0.7f, 0.8f };
+    sun.ambient = ProxyState::Colour { 0.1f, 0.2f, 0.3f, 1.0f };
+    sun.direction = ProxyState::Vector { 0, 0, -4 };
+    sun.attenuation0 = 9.0f;
+
+    DWORD stamp = state.lightrs.changeStamp;
+    state.setLight(6, &sun);
+    const LightState::Light& l = state.lightrs.lights[6];
+    CHECK_EQ(l.type, DWORD(LIGHT_DIRECTIONAL));
+    CHECK_EQ(l.diffuse.a, 0.8f);
+    CHECK_EQ(l.position.z, -1.0f);
+    CHECK_EQ(l.ambient.y, 0.2f);
+    CHECK_EQ(l.falloff.x, 0.0f);
+    CHECK(state.lightrs.changeStamp != stamp);
+
+    // Re-sending an unchanged light does not invalidate packed lighting
+    stamp = state.lightrs.changeStamp;
+    state.setLight(6, &sun);
+    CHECK_EQ(state.lightrs.changeStamp, stamp);
+
+    ProxyState::Light lamp = sun;
+    lamp.type = LIGHT_POINT;
+    lamp.position = ProxyState::Vector { 1, 2, 3 };
+    state.setLight(600, &lamp);
+    CHECK_EQ(state.lightrs.lights[600].falloff.x, 9.0f);
+    CHECK_EQ(state.lightrs.lights[600].position.y, 2.0f);
+
+    state.lightEnable(600, true);
+    state.lightEnable(6, true);
+    state.lightEnable(600, true);
+    CHECK_EQ(state.lightrs.active.size(), size_t(2));
+    state.lightEnable(600, false);
+    CHECK_EQ(state.lightrs.active.size(), size_t(1));
+    CHECK_EQ(state.lightrs.active[0], DWORD(6));
+
+    // Real ambient is passed on and kept for lighting, pure white is a scene marker
+    state.setRenderState(RS_AMBIENT, 0xff336699);
+    CHECK_EQ(hooks.ambient, 0xff336699u);
+    CHECK_NEAR(state.lightrs.globalAmbient.r, 0x33 / 255.0, 1e-6);
+    CHECK(!state.isAmbientWhite);
+    state.setRenderState(RS_AMBIENT, 0xffffffff);
+    CHECK_EQ(hooks.ambient, 0xff336699u);
+    CHECK(state.isAmbientWhite);
+}
+
+TEST(reset_defaults) {
+    RecordingHooks hooks;
+    ProxyState state(&hooks);
+    state.setRenderState(RS_ZWRITEENABLE, 0);
+    state.setTransform(TS_VIEW, worldView);
+    state.reset();
+
+    CHECK_EQ(state.rs.zWrite, DWORD(1));
+    CHECK_EQ(state.rs.diffuseMaterial.a, 1.0f);
+    CHECK_EQ(state.frs.stage[0].colorOp, 4);
+    CHECK_EQ(state.frs.stage[3].colorOp, 1);
+    CHECK_EQ(state.sceneCount, -1);
+    CHECK(!state.hudReady);
+
+    // The filter forgets what it saw before the device was recreated
+    CHECK(state.setRenderState(RS_ZWRITEENABLE, 0));
+    CHECK(state.setTransform(TS_VIEW, worldView));
+}
+
+// --------------------------------------------------------
+// Filtered replay
+// The same call stream through ProxyState with and without the redundant state filter must leave the
+// device in the same state. Hooks write over device state as distant land and the HUD do, so that any
+// invalidation point the filter misses shows up as a dropped call the device needed.
+
+enum {
+    TS_PROJECTION = 3, TS_TEXTURE0 = 16,
+    RS_CULLMODE = 22, RS_ALPHAREF = 24, RS_LIGHTING = 137,
+    TSS_TEXCOORDINDEX = 11
+};
+
+// Device state that the proxy forwards to, recorded by a null device
+struct NullDevice {
+    std::map<uint32_t, uint32_t> renderState, stageState, samplerState;
+    std::map<uint32_t, const void*> texture;
+    std::map<uint32_t, std::vector<float>> transform;
+    size_t draws = 0;
+
+    bool operator==(const NullDevice& b) const {
+        return renderState == b.renderState && stageState == b.stageState && samplerState == b.samplerState
+            && texture == b.texture && transform == b.transform && draws == b.draws;
+    }
+};
+
+static const void* fakeTexture(uintptr_t n) {
+    return reinterpret_cast<const void*>(0x1000 + 16 * n);
+}
+
+static std::vector<float> matrix(const float* m) {
+    return std::vector<float>(m, m + 16);
+}
+
+// Hooks that draw through the device, leaving their own state behind
+struct ClobberingHooks : ProxyState::Hooks {
+    NullDevice* device;
+    int inspected = 0;
+    std::string calls;
+
+    void clobberTextures(uint32_t tag) {
+        for (uint32_t stage = 0; stage != 8; ++stage) {
+            device->texture[stage] = fakeTexture(100 + tag);
+        }
+    }
+    void clobber(char tag) {
+        float m[16];
+        std::memcpy(m, identity, sizeof(m));
+        m[12] = float(tag);
+
+        device->renderState[RS_ZWRITEENABLE] = tag;
+        device->renderState[RS_CULLMODE] = tag;
+        device->renderState[RS_LIGHTING] = tag;
+        device->stageState[TSS_COLOROP] = tag;
+        device->stageState[(1 << 8) | TSS_TEXCOORDINDEX] = tag;
+        device->samplerState[SAMP_MINFILTER] = tag;
+        device->samplerState[(2 << 8) | SAMP_ADDRESSU] = tag;
+        device->transform[TS_WORLD] = matrix(m);
+        device->transform[TS_TEXTURE0] = matrix(m);
+        clobberTextures(tag);
+        calls += tag;
+    }
+
+    void renderStage0() { clobber('0'); }
+    void renderStage1() { clobber('1'); }
+    void renderStageBlend() { clobber('B'); }
+    void renderStage2() { clobber('2'); }
+    void renderStageWater() { clobber('W'); }
+    void postProcess() { clobber('P'); }
+    void drawHUD() { clobber('H'); }
+    void endFrame() { clobber('E'); }
+    bool inspectDraw(int, const RenderedState*, const FragmentState*, LightState*) {
+        // Every third draw is taken over by a replacement shader, which only rebinds textures
+        if (++inspected % 3 == 0) {
+            clobberTextures('i');
+            calls += 'i';
+            return false;
+        }
+        return true;
+    }
+};
+
+// MGEProxyDevice's forwarding, onto a null device
+struct Replay {
+    NullDevice device;
+    ClobberingHooks hooks;
+    ProxyState state;
+    unsigned long long dropped = 0;     // Before the last reset
+
+    explicit Replay(bool filtered) : state(&hooks) {
+        hooks.device = &device;
+        state.stateFilter.enabled = filtered;
+        setupDistantLand(state);
+    }
+
+    void reset() {
+        dropped += state.stateFilter.dropped;
+        size_t draws = device.draws;
+        device = NullDevice();
+        device.draws = draws;
+        state.reset();
+        setupDistantLand(state);
+    }
+    void present() {
+        // Captures and API calls between frames
+        hooks.clobber('F');
+        state.present();
+    }
+    void setRenderState(uint32_t a, uint32_t b) {
+        if (state.setRenderState(a, b)) {
+            device.renderState[a] = b;
+        }
+    }
+    void setTextureStageState(uint32_t stage, uint32_t a, uint32_t b) {
+        uint32_t value = b, sampler;
+        if (state.setTextureStageState(stage, a, value, sampler)) {
+            if (sampler) {
+                device.samplerState[(stage << 8) | sampler] = value;
+            } else {
+                device.stageState[(stage << 8) | a] = value;
+            }
+        }
+    }
+    void setTexture(uint32_t stage, const void* texture) {
+        if (state.setTexture(stage, (IDirect3DTexture9*)texture)) {
+            device.texture[stage] = texture;
+        }
+    }
+    void setTransform(uint32_t a, const float* m) {
+        if (state.setTransform(a, m)) {
+            device.transform[a] = matrix(m);
+        }
+    }
+    void multiplyTransform(uint32_t a, const float* m) {
+        // Only the device knows the result; a translation stands in for the product
+        state.multiplyTransform();
+        std::vector<float>& t = device.transform[a];
+        if (t.empty()) {
+            t = matrix(identity);
+        }
+        t[12] += m[12];
+        t[13] += m[13];
+    }
+    void applyStateBlock() {
+        hooks.clobber('S');
+        state.applyStateBlock();
+    }
+    void draw() {
+        if (::draw(state)) {
+            ++device.draws;
+        }
+    }
+};
+
+// Random Morrowind-like call stream with small value pools, so that many calls are redundant.
+// Applies each call to both replays and counts steps where the devices differ.
+static int replayRandomStream(uint32_t seed, Replay& filtered, Replay& unfiltered, std::string* events) {
+    std::mt19937 rng(seed);
+    const uint32_t renderStates[] = { RS_ZWRITEENABLE, RS_CULLMODE, RS_ALPHAREF, RS_LIGHTING, RS_FOGSTART, RS_FOGEND,
+                                      RS_FOGTABLEMODE, RS_STENCILENABLE, RS_STENCILREF, RS_AMBIENT };
+    const uint32_t stageStates[] = { TSS_COLOROP, TSS_TEXCOORDINDEX, TSS_ADDRESSU, TSS_MINFILTER, TSS_MIPFILTER, TSS_BUMPENVMAT01 };
+    const uint32_t transforms[] = { TS_WORLD, TS_WORLD + 1, TS_TEXTURE0, TS_TEXTURE0 + 1, TS_PROJECTION };
+    float world[3][16];
+    for (int i = 0; i != 3; ++i) {
+        std::memcpy(world[i], identity, sizeof(world[i]));
+        world[i][12] = float(i);
+    }
+    Replay* replays[] = { &filtered, &unfiltered };
+    bool inScene = false;
+    int differences = 0;
+
+    for (int step = 0; step != 20000; ++step) {
+        uint32_t op = rng() % 1000, r1 = rng(), r2 = rng();
+        for (Replay* replay : replays) {
+            Replay& d = *replay;
+            if (op < 300) {
+                uint32_t a = renderStates[r1 % 10];
+                uint32_t b = (a == RS_AMBIENT) ? (r2 % 2 ? 0xffffffff : 0xff336699) : r2 % 3;
+                d.setRenderState(a, b);
+            } else if (op < 480) {
+                d.setTextureStageState(r1 % 3, stageStates[(r1 >> 8) % 6], r2 % 3);
+            } else if (op < 620) {
+                d.setTexture(r1 % 3, (r2 % 4) ? fakeTexture(r2 % 4) : nullptr);
+            } else if (op < 700) {
+                d.setTransform(transforms[r1 % 5], world[r2 % 3]);
+            } else if (op < 730) {
+                // View changes, including to and from the UI view
+                d.setTransform(TS_VIEW, (r2 % 3 == 0) ? menuView : (r2 % 3 == 1) ? worldView : identity);
+            } else if (op < 745) {
+                d.multiplyTransform((r1 % 2) ? uint32_t(TS_WORLD) : uint32_t(TS_TEXTURE0), world[r2 % 3]);
+            } else if (op < 765) {
+                ProxyState::Material m;
+                std::memset(&m, 0, sizeof(m));
+                m.power = (r2 % 4 == 0) ? 99999.0f : 0.0f;
+                d.state.setMaterial(&m);
+            } else if (op < 900) {
+                d.draw();
+            } else if (op < 960) {
+                if (inScene) {
+                    d.state.endScene();
+                } else {
+                    d.state.beginScene();
+                }
+            } else if (op < 970) {
+                d.state.setRenderTarget(r2 % 4 != 0);
+            } else if (op < 990) {
+                if (!inScene) {
+                    d.present();
+                }
+            } else if (op < 998) {
+                d.applyStateBlock();
+            } else {
+                d.reset();
+            }
+        }
+        if (op >= 900 && op < 960) {
+            inScene = !inScene;
+        }
+        if (op >= 998) {
+            inScene = false;
+        }
+        differences += !(filtered.device == unfiltered.device);
+    }
+
+    *events = filtered.hooks.calls;
+    return differences;
+}
+
+TEST(filtered_replay) {
+    for (uint32_t seed = 1; seed != 11; ++seed) {
+        Replay filtered(true), unfiltered(false);
+        std::string events;
+        CHECK_EQ(replayRandomStream(seed, filtered, unfiltered, &events), 0);
+        CHECK(filtered.device == unfiltered.device);
+
+        // Same forwarding decisions for everything but redundant state
+        CHECK(filtered.hooks.calls == unfiltered.hooks.calls);
+        CHECK(filtered.dropped + filtered.state.stateFilter.dropped > 500);
+        CHECK_EQ(unfiltered.dropped + unfiltered.state.stateFilter.dropped, 0ull);
+
+        // Every invalidation point was reached: resets, scenes with distant land, UI scenes and
+        // end of frame, replaced draws, state blocks and frames
+        for (char e : std::string("012BWPHEiSF")) {
+            CHECK(events.find(e) != std::string::npos);
+        }
+    }
+}
+
+// Scripted state, set before and after each invalidation point
+static void setScriptedState(Replay& d) {
+    float world[16];
+    std::memcpy(world, identity, sizeof(world));
+    world[12] = 7.0f;
+    d.setRenderState(RS_ZWRITEENABLE, 1);
+    d.setRenderState(RS_CULLMODE, 1);
+    d.setTextureStageState(0, TSS_COLOROP, 4);
+    d.setTextureStageState(1, TSS_TEXCOORDINDEX, 1);
+    d.setTextureStageState(0, TSS_MINFILTER, TEXF_LINEAR);
+    d.setTexture(0, fakeTexture(1));
+    d.setTexture(5, fakeTexture(2));
+    d.setTransform(TS_WORLD, world);
+    d.setTransform(TS_TEXTURE0, world);
+}
+
+TEST(filtered_replay_invalidation_points) {
+    // Scripted: set state, let each invalidation point write over it, then set the same state again
+    typedef void (*Point)(Replay&);
+    const Point points[] = {
+        [](Replay& d) { d.reset(); },
+        [](Replay& d) { d.present(); },
+        [](Replay& d) { d.applyStateBlock(); },
+        // Stage 0 before the first draw, stages 1 and blend at the end of the first scene
+        [](Replay& d) { d.state.beginScene(); d.draw(); d.state.endScene(); },
+        // Stage 2 in a later scene
+        [](Replay& d) { d.state.beginScene(); d.state.endScene(); d.state.beginScene(); setScriptedState(d); d.state.endScene(); },
+        // UI scene: post-process and HUD on begin, end of frame work on end, with or without distant land
+        [](Replay& d) {
+            d.state.beginScene(); d.draw(); d.state.endScene();
+            d.setTransform(TS_VIEW, menuView);
+            d.state.beginScene(); setScriptedState(d); d.draw(); d.state.endScene();
+        },
+        [](Replay& d) {
+            d.state.distantLandReady = false;
+            d.setTransform(TS_VIEW, menuView);
+            d.state.beginScene(); setScriptedState(d); d.draw(); d.state.endScene();
+        },
+        // Draws taken over by distant land
+        [](Replay& d) { d.state.beginScene(); d.draw(); d.draw(); d.draw(); },
+        // View change, then the world transform again
+        [](Replay& d) { d.setTransform(TS_VIEW, identity); },
+        [](Replay& d) { d.multiplyTransform(TS_WORLD, worldView); },
+    };
+
+    for (Point point : points) {
+        Replay filtered(true), unfiltered(false);
+        for (Replay* d : { &filtered, &unfiltered }) {
+            d->setTransform(TS_VIEW, worldView);
+            setScriptedState(*d);
+            point(*d);
+            setScriptedState(*d);
+            d->draw();
+        }
+        CHECK(filtered.device == unfiltered.device);
+    }
+}
@@ -0,0 +1,311 @@
+
+// Frame sequence files - Writer and reader round trip, unclean and damaged files, and mgeseq conversion
+
+#include "testing.h"
+#include "support/pngencode.h"
+#include "support/sequencefile.h"
+#include "../tools/mgeseq/seqconvert.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+
+
+// Temporary directory, removed on destruction
+struct TempDir {
+    std::string root;
+
+    TempDir() {
+        char pattern[] = "/tmp/mgeseqXXXXXX";
+        const char* dir = mkdtemp(pattern);
+        root = dir ? dir : "";
+    }
+    ~TempDir() {
+        if (!root.empty()) {
+            std::system(("rm -rf '" + root + "'").c_str());
+        }
+    }
+
+    std::string path(const char* name) const { return root + "/" + name; }
+};
+
+static std::vector<uint8_t> readFile(const std::string& path) {
+    std::vector<uint8_t> data;
+    FILE* f = std::fopen(path.c_str(), "rb");
+    if (f) {
+        uint8_t buf[4096];
+        size_t n;
+        while ((n = std::fread(buf, 1, sizeof(buf), f)) != 0) {
+            data.insert(data.end(), buf, buf + n);
+        }
+        std::fclose(f);
+    }
+    return data;
+}
+
+static void writeFile(const std::string& path, const std::vector<uint8_t>& data) {
+    FILE* f = std::fopen(path.c_str(), "wb");
+    if (f) {
+        std::fwrite(data.data(), 1, data.size(), f);
+        std::fclose(f);
+    }
+}
+
+// Frame pixels with a padded pitch, as locked surfaces are returned; padding bytes must not be stored
+static std::vector<uint8_t> framePixels(uint32_t w, uint32_t h, uint32_t pitch, uint32_t seed) {
+    std::vector<uint8_t> p(size_t(pitch) * h, 0xCD);
+    for (uint32_t y = 0; y != h; ++y) {
+        for (uint32_t x = 0; x != 4 * w; ++x) {
+            p[size_t(pitch) * y + x] = uint8_t(seed * 31 + y * 7 + x);
+        }
+    }
+    return p;
+}
+
+static std::vector<uint8_t> packed(const std::vector<uint8_t>& p, uint32_t w, uint32_t h, uint32_t pitch) {
+    std::vector<uint8_t> out;
+    for (uint32_t y = 0; y != h; ++y) {
+        out.insert(out.end(), p.begin() + size_t(pitch) * y, p.begin() + size_t(pitch) * y + 4 * w);
+    }
+    return out;
+}
+
+TEST(round_trip) {
+    TempDir dir;
+    std::string path = dir.path("capture.mgeseq");
+    const uint32_t w = 13, h = 7;
+
+    SequenceWriter writer;
+    CHECK(writer.create(path.c_str()));
+    writer.setSize(w, h);
+
+    // Frames complete out of order on the workers, with both padded and tight pitches
+    uint32_t order[] = { 0, 2, 1, 3 };
+    for (uint32_t i : order) {
+        uint32_t pitch = (i & 1) ? 4 * w : 4 * w + 12;
+        std::vector<uint8_t> p = framePixels(w, h, pitch, i);
+        CHECK(writer.writeFrame(i, int64_t(i) * 16667 + (int64_t(1) << 33), p.data(), w, h, pitch));
+    }
+    CHECK_EQ(writer.frames(), 4u);
+    CHECK(writer.close());
+    CHECK(!writer.isOpen());
+
+    SequenceReader reader;
+    CHECK(reader.open(path.c_str()) == SequenceReader::Ok);
+    CHECK(reader.closedCleanly());
+    CHECK_EQ(reader.header().width, w);
+    CHECK_EQ(reader.header().height, h);
+    CHECK_EQ(reader.header().frameCount, 4u);
+
+    SequenceFrameHeader frame;
+    std::vector<uint8_t> pixels;
+    for (uint32_t i : order) {
+        CHECK(reader.next(frame, pixels) == SequenceReader::Frame);
+        CHECK_EQ(frame.index, i);
+        CHECK_EQ(frame.timestamp, int64_t(i) * 16667 + (int64_t(1) << 33));
+        uint32_t pitch = (i & 1) ? 4 * w : 4 * w + 12;
+        CHECK(pixels == packed(framePixels(w, h, pitch, i), w, h, pitch));
+    }
+    CHECK(reader.next(frame, pixels) == SequenceReader::End);
+
+    // Layout is exactly as documented
+    CHECK_EQ(readFile(path).size(), sizeof(SequenceFileHeader) + 4 * (sizeof(SequenceFrameHeader) + 4 * w * h));
+}
+
+TEST(writer_rejects) {
+    TempDir dir;
+    std::string path = dir.path("capture.mgeseq");
+    std::vector<uint8_t> p = framePixels(4, 4, 16, 0);
+
+    SequenceWriter writer;
+    CHECK(!writer.writeFrame(0, 0, p.data(), 4, 4, 16));       // Not open
+    CHECK(writer.create(path.c_str()));
+    writer.setSize(4, 4);
+    CHECK(!writer.writeFrame(0, 0, p.data(), 4, 3, 16));       // Resolution changed
+    CHECK_EQ(writer.frames(), 0u);
+    CHECK(writer.close());
+
+    // Never overwrites an existing file
+    SequenceWriter second;
+    CHECK(!second.create(path.c_str()));
+}
+
+TEST(unclean_close) {
+    // A crash leaves the initial header, with no size or frame count
+    TempDir dir;
+    std::string path = dir.path("crash.mgeseq");
+    std::vector<uint8_t> p = framePixels(2, 2, 8, 1);
+
+    {
+        SequenceWriter writer;
+        CHECK(writer.create(path.c_str()));
+        writer.setSize(2, 2);
+        CHECK(writer.writeFrame(0, 0, p.data(), 2, 2, 8));
+        CHECK(writer.writeFrame(1, 5, p.data(), 2, 2, 8));
+    }
+
+    // Clean close, then restore the header as a crash would have left it
+    std::vector<uint8_t> data = readFile(path);
+    SequenceFileHeader header;
+    std::memcpy(&header, data.data(), sizeof(header));
+    header.frameCount = 0;
+    std::memcpy(data.data(), &header, sizeof(header));
+    writeFile(path, data);
+
+    SequenceReader reader;
+    CHECK(reader.open(path.c_str()) == SequenceReader::Ok);
+    CHECK(!reader.closedCleanly());
+    SequenceFrameHeader frame;
+    std::vector<uint8_t> pixels;
+    int frames = 0;
+    while (reader.next(frame, pixels) == SequenceReader::Frame) {
+        ++frames;
+    }
+    CHECK_EQ(frames, 2);
+}
+
+TEST(reader_rejects) {
+    TempDir dir;
+    SequenceReader reader;
+    CHECK(reader.open(dir.path("missing").c_str()) == SequenceReader::CannotOpen);
+
+    SequenceFileHeader header = { sequenceFileMagic, sequenceFileVersion, 4, 4, 1, 0 };
+    auto withHeader = [&](const SequenceFileHeader& h) {
+        std::vector<uint8_t> data(sizeof(h));
+        std::memcpy(data.data(), &h, sizeof(h));
+        writeFile(dir.path("f"), data);
+        return reader.open(dir.path("f").c_str());
+    };
+
+    CHECK(withHeader(header) == SequenceReader::Ok);
+    SequenceFileHeader h = header;
+    h.magic = 0x12345678;
+    CHECK(withHeader(h) == SequenceReader::NotSequence);
+    h = header;
+    h.version = 2;
+    CHECK(withHeader(h) == SequenceReader::UnsupportedVersion);
+    h = header;
+    h.width = 0;        // Stopped before the first frame
+    CHECK(withHeader(h) == SequenceReader::NoFrames);
+    h = header;
+    h.height = 16385;
+    CHECK(withHeader(h) == SequenceReader::NoFrames);
+
+    writeFile(dir.path("f"), std::vector<uint8_t>(10, 0));
+    CHECK(reader.open(dir.path("f").c_str()) == SequenceReader::NotSequence);
+}
+
+TEST(truncated_frame) {
+    TempDir dir;
+    std::string path = dir.path("t.mgeseq");
+    std::vector<uint8_t> p = framePixels(3, 3, 12, 2);
+    {
+        SequenceWriter writer;
+        CHECK(writer.create(path.c_str()));
+        writer.setSize(3, 3);
+        writer.writeFrame(0, 0, p.data(), 3, 3, 12);
+        writer.writeFrame(1, 1, p.data(), 3, 3, 12);
+    }
+    std::vector<uint8_t> data = readFile(path);
+    data.resize(data.size() - 5);
+    writeFile(path, data);
+
+    SequenceReader reader;
+    SequenceFrameHeader frame;
+    std::vector<uint8_t> pixels;
+    CHECK(reader.open(path.c_str()) == SequenceReader::Ok);
+    CHECK(reader.next(frame, pixels) == SequenceReader::Frame);
+    CHECK(reader.next(frame, pixels) == SequenceReader::Truncated);
+    CHECK_EQ(frame.index, 1u);
+}
+
+TEST(output_prefix) {
+    CHECK(outputPrefix("capture.mgeseq") == "capture");
+    CHECK(outputPrefix("dir.v2/capture") == "dir.v2/capture");
+    CHECK(outputPrefix("dir.v2\\capture.seq") == "dir.v2\\capture");
+    CHECK(outputPrefix("a.b.c") == "a.b");
+}
+
+TEST(mgeseq_convert) {
+    TempDir dir;
+    std::string path = dir.path("run.mgeseq");
+    const uint32_t w = 9, h = 5;
+
+    {
+        SequenceWriter writer;
+        CHECK(writer.create(path.c_str()));
+        writer.setSize(w, h);
+        for (uint32_t i : { 1u, 0u, 2u }) {
+            std::vector<uint8_t> p = framePixels(w, h, 4 * w + 4, i);
+            CHECK(writer.writeFrame(i, int64_t(i) * 1000, p.data(), w, h, 4 * w + 4));
+        }
+    }
+
+    uint32_t converted = 0;
+    FILE* err = std::tmpfile();
+    CHECK_EQ(convertSequence(path.c_str(), dir.path("out"), err, &converted), 0);
+    CHECK_EQ(converted, 3u);
+
+    // Each PNG is exactly what the encoder makes from the packed frame
+    for (uint32_t i = 0; i != 3; ++i) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "out %05u.png", i);
+        std::vector<uint8_t> expected, frame = packed(framePixels(w, h, 4 * w + 4, i), w, h, 4 * w + 4);
+        CHECK(pngEncodeBGRA(frame.data(), w, h, 4 * w, expected));
+        CHECK(readFile(dir.path(name)) == expected);
+    }
+
+    // Timestamps in file order
+    std::vector<uint8_t> csv = readFile(dir.path("out timestamps.csv"));
+    CHECK(std::string(csv.begin(), csv.end()) == "frame,microseconds\n1,1000\n0,0\n2,2000\n");
+    std::fclose(err);
+}
+
+TEST(mgeseq_errors) {
+    TempDir dir;
+    std::string path = dir.path("bad.mgeseq");
+    uint32_t converted = 0;
+    FILE* err = std::tmpfile();
+
+    // Truncated last frame converts what it can, and fails
+    {
+        SequenceWriter writer;
+        std::vector<uint8_t> p = framePixels(2, 2, 8, 0);
+        CHECK(writer.create(path.c_str()));
+        writer.setSize(2, 2);
+        writer.writeFrame(0, 0, p.data(), 2, 2, 8);
+        writer.writeFrame(1, 1, p.data(), 2, 2, 8);
+    }
+    std::vector<uint8_t> data = readFile(path);
+    data.resize(data.size() - 1);
+    writeFile(path, data);
+    CHECK_EQ(convertSequence(path.c_str(), dir.path("bad"), err, &converted), 1);
+    CHECK_EQ(converted, 1u);
+
+    // Missing frames against the recorded count
+    data.resize(sizeof(SequenceFileHeader) + sizeof(SequenceFrameHeader) + 16);
+    writeFile(path, data);
+    CHECK_EQ(convertSequence(path.c_str(), dir.path("bad"), err, &converted), 1);
+    CHECK_EQ(converted, 1u);
+
+    // Not a sequence
+    CHECK_EQ(convertSequence(dir.path("missing").c_str(), dir.path("x"), err, &converted), 1);
+    CHECK_EQ(converted, 0u);
+
+    // Output folder missing
+    CHECK_EQ(convertSequence(path.c_str(), dir.path("nodir/out"), err, &converted), 1);
+
+    std::rewind(err);
+    char line[256];
+    int messages = 0;
+    while (std::fgets(line, sizeof(line), err)) {
+        CHECK(std::strncmp(line, "mgeseq: ", 8) == 0);
+        ++messages;
+    }
+    CHECK(messages >= 4);
+    std::fclose(err);
+}
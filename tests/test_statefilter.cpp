@@ -0,0 +1,230 @@
+
+// StateFilter - Redundant and non-redundant decisions, and what each invalidation forgets
+
+#include "testing.h"
+#include "mge/statefilter.h"
+
+#include <cstring>
+
+
+
+// New device state, as MGEProxyDevice sets up on creation
+static void reset(StateFilter& f) {
+    f.invalidate();
+    f.forwarded = f.dropped = 0;
+}
+
+// setRenderState - Device call sequence: filter, then record only when forwarded
+static bool setRenderState(StateFilter& f, uint32_t a, uint32_t b) {
+    if (f.filterRenderState(a, b)) {
+        return false;
+    }
+    f.recordRenderState(a, b);
+    return true;
+}
+
+static StateFilter::Matrix matrix(float diagonal) {
+    StateFilter::Matrix m;
+    std::memset(&m, 0, sizeof(m));
+    m.m[0] = m.m[5] = m.m[10] = diagonal;
+    m.m[15] = 1.0f;
+    return m;
+}
+
+static const void* fakeTexture(uintptr_t n) {
+    return reinterpret_cast<const void*>(0x1000 + 16 * n);
+}
+
+TEST(render_state_redundancy) {
+    StateFilter f;
+    reset(f);
+
+    CHECK(setRenderState(f, 7, 1));     // First set is always forwarded
+    CHECK(!setRenderState(f, 7, 1));    // Same value dropped
+    CHECK(setRenderState(f, 7, 0));     // Changed value forwarded
+    CHECK(!setRenderState(f, 7, 0));
+    CHECK(setRenderState(f, 8, 0));     // Other states are independent
+    CHECK_EQ(f.forwarded, 3ull);
+    CHECK_EQ(f.dropped, 2ull);
+}
+
+TEST(render_state_filter_does_not_record) {
+    // A filtered-but-failed forward must not be cached, so filterRenderState alone changes nothing
+    StateFilter f;
+    reset(f);
+
+    CHECK(!f.filterRenderState(20, 5));
+    CHECK(!f.filterRenderState(20, 5));
+    f.recordRenderState(20, 5);
+    CHECK(f.filterRenderState(20, 5));
+}
+
+TEST(render_state_out_of_range) {
+    StateFilter f;
+    reset(f);
+
+    for (int i = 0; i != 3; ++i) {
+        CHECK(setRenderState(f, StateFilter::MaxRenderStates, 1));
+        CHECK(setRenderState(f, 0xFFFFFFFF, 1));
+    }
+    CHECK_EQ(f.dropped, 0ull);
+}
+
+TEST(stage_state_redundancy) {
+    StateFilter f;
+    reset(f);
+
+    CHECK(!f.filterStageState(0, 1, 4));
+    CHECK(f.filterStageState(0, 1, 4));
+    CHECK(!f.filterStageState(1, 1, 4));    // Same state on another stage is independent
+    CHECK(!f.filterStageState(0, 2, 4));
+    CHECK(!f.filterStageState(0, 1, 5));
+    CHECK(f.filterStageState(0, 1, 5));
+
+    // Out of range stages and states are always forwarded
+    CHECK(!f.filterStageState(StateFilter::MaxStages, 1, 4));
+    CHECK(!f.filterStageState(StateFilter::MaxStages, 1, 4));
+    CHECK(!f.filterStageState(0, StateFilter::MaxStageStates, 4));
+    CHECK(!f.filterStageState(0, StateFilter::MaxStageStates, 4));
+    CHECK_EQ(f.dropped, 2ull);
+    CHECK_EQ(f.forwarded, 8ull);
+}
+
+TEST(texture_redundancy) {
+    StateFilter f;
+    reset(f);
+
+    CHECK(!f.filterTexture(0, fakeTexture(1)));
+    CHECK(f.filterTexture(0, fakeTexture(1)));
+    CHECK(!f.filterTexture(0, nullptr));    // Unbinding is a change
+    CHECK(f.filterTexture(0, nullptr));
+    CHECK(!f.filterTexture(1, nullptr));    // Unknown stage binding is never assumed
+    CHECK(!f.filterTexture(StateFilter::MaxStages, fakeTexture(1)));
+    CHECK(!f.filterTexture(StateFilter::MaxStages, fakeTexture(1)));
+}
+
+TEST(transform_redundancy) {
+    StateFilter f;
+    reset(f);
+    StateFilter::Matrix a = matrix(1.0f), b = matrix(2.0f);
+
+    // World and texture transforms are filtered by value
+    CHECK(!f.filterTransform(StateFilter::TransformWorld0, a.m));
+    CHECK(f.filterTransform(StateFilter::TransformWorld0, a.m));
+    CHECK(!f.filterTransform(StateFilter::TransformWorld0, b.m));
+    CHECK(!f.filterTransform(StateFilter::TransformWorld0 + 3, b.m));
+    CHECK(f.filterTransform(StateFilter::TransformWorld0 + 3, b.m));
+    CHECK(!f.filterTransform(StateFilter::TransformTexture0 + 2, a.m));
+    CHECK(f.filterTransform(StateFilter::TransformTexture0 + 2, a.m));
+
+    // One changed element is enough
+    StateFilter::Matrix c = b;
+    c.m[14] = 0.5f;
+    CHECK(!f.filterTransform(StateFilter::TransformWorld0, c.m));
+
+    // View (2), projection (3) and out of range world/texture indices are never filtered
+    for (int i = 0; i != 2; ++i) {
+        CHECK(!f.filterTransform(2, a.m));
+        CHECK(!f.filterTransform(3, a.m));
+        CHECK(!f.filterTransform(StateFilter::TransformWorld0 + StateFilter::MaxWorldTransforms, a.m));
+        CHECK(!f.filterTransform(StateFilter::TransformTexture0 + StateFilter::MaxStages, a.m));
+    }
+}
+
+// Fills every cache, so that invalidation tests can see exactly what was forgotten
+static void fillAll(StateFilter& f, const StateFilter::Matrix& m) {
+    setRenderState(f, 7, 1);
+    f.filterStageState(0, 1, 4);
+    f.filterTexture(0, fakeTexture(1));
+    f.filterTransform(StateFilter::TransformWorld0, m.m);
+    f.filterTransform(StateFilter::TransformTexture0, m.m);
+}
+
+struct Redundant {
+    bool renderState, stageState, texture, world, textureTransform;
+};
+
+static Redundant probe(StateFilter& f, const StateFilter::Matrix& m) {
+    Redundant r;
+    r.renderState = f.filterRenderState(7, 1);
+    r.stageState = f.filterStageState(0, 1, 4);
+    r.texture = f.filterTexture(0, fakeTexture(1));
+    r.world = f.filterTransform(StateFilter::TransformWorld0, m.m);
+    r.textureTransform = f.filterTransform(StateFilter::TransformTexture0, m.m);
+    return r;
+}
+
+TEST(invalidate_all) {
+    // Device creation, frame start, MGE rendering and state block application
+    StateFilter f;
+    StateFilter::Matrix m = matrix(1.0f);
+    reset(f);
+    fillAll(f, m);
+
+    Redundant before = probe(f, m);
+    CHECK(before.renderState && before.stageState && before.texture && before.world && before.textureTransform);
+
+    f.invalidate();
+    Redundant after = probe(f, m);
+    CHECK(!after.renderState);
+    CHECK(!after.stageState);
+    CHECK(!after.texture);
+    CHECK(!after.world);
+    CHECK(!after.textureTransform);
+
+    // Invalidation forgets values but not counters
+    CHECK(f.forwarded > 0 && f.dropped > 0);
+}
+
+TEST(invalidate_textures) {
+    // Replacement shaders rebinding samplers through the effect system
+    StateFilter f;
+    StateFilter::Matrix m = matrix(1.0f);
+    reset(f);
+    fillAll(f, m);
+
+    f.invalidateTextures();
+    Redundant r = probe(f, m);
+    CHECK(!r.texture);
+    CHECK(r.renderState && r.stageState && r.world && r.textureTransform);
+}
+
+TEST(invalidate_world_transforms) {
+    // View change, which requires the world-view capture to be redone
+    StateFilter f;
+    StateFilter::Matrix m = matrix(1.0f);
+    reset(f);
+    fillAll(f, m);
+
+    f.invalidateWorldTransforms();
+    Redundant r = probe(f, m);
+    CHECK(!r.world);
+    CHECK(r.renderState && r.stageState && r.texture && r.textureTransform);
+}
+
+TEST(invalidate_multiply_transform) {
+    // MultiplyTransform leaves the result only known to the device
+    StateFilter f;
+    StateFilter::Matrix m = matrix(1.0f);
+    reset(f);
+    fillAll(f, m);
+
+    f.invalidateWorldTransforms();
+    f.invalidateTextureTransforms();
+    Redundant r = probe(f, m);
+    CHECK(!r.world && !r.textureTransform);
+    CHECK(r.renderState && r.stageState && r.texture);
+}
+
+TEST(disabled) {
+    // A disabled filter forwards everything and drops nothing
+    StateFilter f;
+    StateFilter::Matrix m = matrix(1.0f);
+    reset(f);
+    f.enabled = false;
+    fillAll(f, m);
+
+    Redundant r = probe(f, m);
+    CHECK(!r.renderState && !r.stageState && !r.texture && !r.world && !r.textureTransform);
+    CHECK_EQ(f.dropped, 0ull);
+}
@@ -0,0 +1,166 @@
+
+// String interner - ID assignment, churn from repeated load/free cycles, and lookup cost against a linear search
+
+#include "testing.h"
+#include "support/stringinterner.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+
+
+// Count heap allocations, to check that re-interning known names allocates nothing
+static std::atomic<long> allocations(0);
+
+void* operator new(std::size_t sz) {
+    ++allocations;
+    if (void* p = std::malloc(sz ? sz : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+static std::vector<std::string> makeNames(int n, const char* prefix) {
+    std::vector<std::string> names;
+    for (int i = 0; i != n; ++i) {
+        names.push_back(prefix + std::to_string(i));
+    }
+    return names;
+}
+
+TEST(ids_in_order) {
+    StringInterner si;
+    CHECK_EQ(si.find("a"), StringInterner::invalid_id);
+    CHECK_EQ(si.intern("a"), 0);
+    CHECK_EQ(si.intern("b"), 1);
+    CHECK_EQ(si.intern("A"), 2);            // Case-sensitive
+    CHECK_EQ(si.intern(""), 3);
+    CHECK_EQ(si.intern("a"), 0);
+    CHECK_EQ(si.find(""), 3);
+    CHECK_EQ(si.find("ab"), StringInterner::invalid_id);
+    CHECK_EQ(si.size(), 4);
+    CHECK(std::string(si.name(2)) == "A");
+}
+
+TEST(growth) {
+    // IDs and name pointers stay valid as the table grows
+    StringInterner si;
+    std::vector<std::string> names = makeNames(5000, "shader_");
+    std::vector<const char*> pointers;
+    for (int i = 0; i != int(names.size()); ++i) {
+        CHECK_EQ(si.intern(names[i].c_str()), i);
+        pointers.push_back(si.name(i));
+    }
+
+    int wrong = 0;
+    for (int i = 0; i != int(names.size()); ++i) {
+        wrong += si.find(names[i].c_str()) != i;
+        wrong += si.name(i) != pointers[i];
+    }
+    CHECK_EQ(wrong, 0);
+    CHECK_EQ(si.size(), 5000);
+}
+
+TEST(churn) {
+    // HUD elements and shaders are loaded and freed by name repeatedly; known names must not allocate or grow the table,
+    // including when the table is exactly at its growth threshold
+    for (int count : { 31, 32, 33, 100, 1000 }) {
+        StringInterner si;
+        std::vector<std::string> names = makeNames(count, "element");
+        for (const std::string& n : names) {
+            si.intern(n.c_str());
+        }
+
+        std::mt19937 rng(count);
+        long before = allocations.load();
+        int wrong = 0;
+        for (int cycle = 0; cycle != 20000; ++cycle) {
+            int i = int(rng() % count);
+            wrong += si.intern(names[i].c_str()) != i;
+            wrong += si.find(names[i].c_str()) != i;
+        }
+        CHECK_EQ(allocations.load() - before, 0);
+        CHECK_EQ(wrong, 0);
+        CHECK_EQ(si.size(), count);
+    }
+}
+
+TEST(clear_and_reuse) {
+    // After clear, as on HUD reset, IDs restart from 0 and old names are gone
+    StringInterner si;
+    std::vector<std::string> names = makeNames(200, "hud");
+    for (int round = 0; round != 10; ++round) {
+        for (int i = 0; i != 200; ++i) {
+            int k = (i + round * 7) % 200;
+            CHECK_EQ(si.intern(names[k].c_str()), i);
+        }
+        si.clear();
+        CHECK_EQ(si.size(), 0);
+        CHECK_EQ(si.find(names[0].c_str()), StringInterner::invalid_id);
+    }
+}
+
+TEST(similar_names) {
+    // Names sharing prefixes, or differing only in length
+    StringInterner si;
+    std::string s;
+    for (int i = 0; i != 300; ++i) {
+        s += char('a' + i % 26);
+        CHECK_EQ(si.intern(s.c_str()), i);
+    }
+    s.clear();
+    int wrong = 0;
+    for (int i = 0; i != 300; ++i) {
+        s += char('a' + i % 26);
+        wrong += si.find(s.c_str()) != i;
+    }
+    CHECK_EQ(wrong, 0);
+}
+
+// 10k name lookups, as made by scripts resolving shaders and HUD elements each frame, against the linear search by name
+BENCH(lookup_10k) {
+    const int calls = 10000;
+    for (int count : { 16, 64, 256 }) {
+        std::vector<std::string> names = makeNames(count, "Data Files/shaders/XEffects/effect");
+        StringInterner si;
+        for (const std::string& n : names) {
+            si.intern(n.c_str());
+        }
+
+        std::mt19937 rng(1);
+        std::vector<const char*> queries;
+        for (int i = 0; i != calls; ++i) {
+            queries.push_back(names[rng() % count].c_str());
+        }
+
+        double t0 = Testing::seconds();
+        long sum = 0;
+        for (const char* q : queries) {
+            sum += si.find(q);
+        }
+        double t1 = Testing::seconds();
+        for (const char* q : queries) {
+            for (int i = 0; i != count; ++i) {
+                if (names[i] == q) {
+                    sum -= i;
+                    break;
+                }
+            }
+        }
+        double t2 = Testing::seconds();
+        std::printf("   %d names: interner %.0f us, linear search %.0f us per 10k calls%s\n",
+                    count, 1e6 * (t1 - t0), 1e6 * (t2 - t1), sum ? " (mismatch)" : "");
+    }
+}
@@ -0,0 +1,266 @@
+
+// TextureCache - Exact sizing, reference counting and least recently used eviction against a budget
+
+#include "testing.h"
+#include "support/texturecache.h"
+
+#include <memory>
+#include <vector>
+
+
+
+static const uint32_t FormatA8R8G8B8 = 21;
+static const uint32_t FormatR5G6B5 = 23;
+static const uint32_t FormatL8 = 50;
+static const uint32_t FormatDXT1 = 0x31545844;
+static const uint32_t FormatDXT5 = 0x35545844;
+
+// Reference counted texture, as created by a device with one reference held by the loader
+struct MockTexture {
+    unsigned long refs = 1;
+    bool destroyed = false;
+
+    unsigned long AddRef() { return ++refs; }
+    unsigned long Release() {
+        if (--refs == 0) {
+            destroyed = true;
+        }
+        return refs;
+    }
+};
+
+// Owns every mock texture, so that destroyed textures can still be inspected
+struct MockFactory {
+    std::vector<std::unique_ptr<MockTexture>> textures;
+
+    MockTexture* create() {
+        textures.emplace_back(new MockTexture);
+        return textures.back().get();
+    }
+
+    bool leaked() const {
+        for (const auto& t : textures) {
+            if (t->refs != 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// Mip chain size, as the game computes from each level description
+static size_t chainBytes(uint32_t format, unsigned int w, unsigned int h) {
+    size_t bytes = 0;
+    for (;;) {
+        bytes += surfaceBytes(format, w, h);
+        if (w == 1 && h == 1) {
+            return bytes;
+        }
+        w = w > 1 ? w / 2 : 1;
+        h = h > 1 ? h / 2 : 1;
+    }
+}
+
+TEST(surface_bytes) {
+    CHECK_EQ(surfaceBytes(FormatDXT1, 256, 256), size_t(32768));
+    CHECK_EQ(surfaceBytes(FormatDXT5, 256, 256), size_t(65536));
+    CHECK_EQ(surfaceBytes(FormatA8R8G8B8, 256, 256), size_t(262144));
+    CHECK_EQ(surfaceBytes(FormatR5G6B5, 10, 3), size_t(60));
+    CHECK_EQ(surfaceBytes(FormatL8, 10, 3), size_t(30));
+
+    // Compressed surfaces round up to whole 4x4 blocks
+    CHECK_EQ(surfaceBytes(FormatDXT1, 1, 1), size_t(8));
+    CHECK_EQ(surfaceBytes(FormatDXT5, 2, 1), size_t(16));
+    CHECK_EQ(surfaceBytes(FormatDXT1, 5, 9), size_t(2 * 3 * 8));
+
+    // Full chains, including the 1x1 tail
+    CHECK_EQ(chainBytes(FormatA8R8G8B8, 4, 4), size_t(64 + 16 + 4));
+    CHECK_EQ(chainBytes(FormatDXT1, 16, 16), size_t(128 + 32 + 8 + 8 + 8));
+}
+
+TEST(find_and_insert_references) {
+    MockFactory factory;
+    TextureCache<MockTexture> cache;
+    MockTexture* t = factory.create();
+    MockTexture* found = nullptr;
+
+    CHECK(!cache.find(1, &found));
+    cache.insert(1, t, 1000);
+    CHECK_EQ(t->refs, 2ul);             // Loader and cache
+    CHECK(cache.find(1, &found));
+    CHECK(found == t);
+    CHECK_EQ(t->refs, 3ul);             // Plus the second user
+
+    // Failed loads are remembered, and take no memory
+    cache.insert(2, nullptr, 1000);
+    found = t;
+    CHECK(cache.find(2, &found));
+    CHECK(found == nullptr);
+    CHECK_EQ(cache.size(), size_t(2));
+    CHECK_EQ(cache.residentBytes(), size_t(1000));
+
+    t->Release();
+    t->Release();
+    cache.clear();
+    CHECK(t->destroyed);
+    CHECK_EQ(cache.size(), size_t(0));
+    CHECK_EQ(cache.residentBytes(), size_t(0));
+    CHECK(!factory.leaked());
+}
+
+TEST(insert_replaces) {
+    MockFactory factory;
+    TextureCache<MockTexture> cache;
+    MockTexture* a = factory.create();
+    MockTexture* b = factory.create();
+
+    cache.insert(1, a, 100);
+    a->Release();
+    cache.insert(1, b, 300);
+    b->Release();
+    CHECK(a->destroyed);
+    CHECK_EQ(cache.size(), size_t(1));
+    CHECK_EQ(cache.residentBytes(), size_t(300));
+
+    cache.clear();
+    CHECK(!factory.leaked());
+}
+
+TEST(trim_within_budget) {
+    MockFactory factory;
+    TextureCache<MockTexture> cache;
+    for (int i = 0; i != 4; ++i) {
+        MockTexture* t = factory.create();
+        cache.insert(i, t, 100);
+        t->Release();
+    }
+
+    CHECK_EQ(cache.trim(400), 0);
+    CHECK_EQ(cache.size(), size_t(4));
+    cache.clear();
+    CHECK(!factory.leaked());
+}
+
+TEST(trim_least_recently_used) {
+    MockFactory factory;
+    TextureCache<MockTexture> cache;
+    std::vector<MockTexture*> t;
+    for (int i = 0; i != 5; ++i) {
+        t.push_back(factory.create());
+        cache.insert(i, t[i], 100);
+        t[i]->Release();
+    }
+
+    // Touch 0 and 2, so 1, 3, 4 are the oldest in that order
+    MockTexture* found = nullptr;
+    cache.find(0, &found);
+    found->Release();
+    cache.find(2, &found);
+    found->Release();
+
+    CHECK_EQ(cache.trim(300), 2);
+    CHECK(t[1]->destroyed && t[3]->destroyed);
+    CHECK(!t[0]->destroyed && !t[2]->destroyed && !t[4]->destroyed);
+    CHECK(!cache.find(1, &found) && !cache.find(3, &found));
+    CHECK_EQ(cache.residentBytes(), size_t(300));
+
+    cache.clear();
+    CHECK(!factory.leaked());
+}
+
+TEST(trim_keeps_referenced) {
+    // Textures held by loaded meshes or HUD elements are never evicted, even if over budget afterwards
+    MockFactory factory;
+    TextureCache<MockTexture> cache;
+    std::vector<MockTexture*> t;
+    for (int i = 0; i != 4; ++i) {
+        t.push_back(factory.create());
+        cache.insert(i, t[i], 100);
+    }
+    t[2]->Release();    // Only 2 is unreferenced outside the cache
+
+    CHECK_EQ(cache.trim(0), 1);
+    CHECK(t[2]->destroyed);
+    CHECK_EQ(cache.size(), size_t(3));
+    CHECK_EQ(cache.residentBytes(), size_t(300));
+    for (int i : { 0, 1, 3 }) {
+        CHECK_EQ(t[i]->refs, 2ul);
+    }
+
+    // Once a mesh releases its texture, it becomes evictable
+    t[0]->Release();
+    CHECK_EQ(cache.trim(150), 1);
+    CHECK(t[0]->destroyed);
+
+    t[1]->Release();
+    t[3]->Release();
+    cache.clear();
+    CHECK(!factory.leaked());
+}
+
+TEST(trim_skips_failed_loads) {
+    MockFactory factory;
+    TextureCache<MockTexture> cache;
+    MockTexture* t = factory.create();
+    cache.insert(1, nullptr, 0);
+    cache.insert(2, t, 500);
+    t->Release();
+
+    CHECK_EQ(cache.trim(0), 1);
+    MockTexture* found = t;
+    CHECK(cache.find(1, &found) && found == nullptr);
+    CHECK_EQ(cache.residentBytes(), size_t(0));
+    cache.clear();
+    CHECK(!factory.leaked());
+}
+
+TEST(worldspace_session) {
+    // Several worldspaces loaded in turn, each mesh set releasing its textures when unloaded
+    MockFactory factory;
+    TextureCache<MockTexture> cache;
+    const size_t bytes = chainBytes(FormatDXT1, 512, 512);
+    const size_t budget = 40 * bytes;
+
+    for (int world = 0; world != 10; ++world) {
+        std::vector<MockTexture*> held;
+        for (int i = 0; i != 30; ++i) {
+            int64_t key = world * 1000 + i;
+            MockTexture* tex;
+            if (!cache.find(key, &tex)) {
+                tex = factory.create();
+                cache.insert(key, tex, bytes);
+            }
+            held.push_back(tex);
+        }
+        cache.trim(budget);
+
+        // Everything in use stays resident
+        CHECK(cache.residentBytes() >= 30 * bytes);
+        for (MockTexture* tex : held) {
+            CHECK(!tex->destroyed);
+            tex->Release();
+        }
+    }
+    CHECK(cache.residentBytes() <= budget);
+
+    cache.clear();
+    CHECK(!factory.leaked());
+}
+
+BENCH(trim) {
+    MockFactory factory;
+    TextureCache<MockTexture> cache;
+    const int n = 20000;
+    for (int i = 0; i != n; ++i) {
+        MockTexture* t = factory.create();
+        cache.insert(i, t, 1000);
+        t->Release();
+    }
+
+    double t0 = Testing::seconds();
+    int evicted = cache.trim(size_t(n / 2) * 1000);
+    double t1 = Testing::seconds();
+    CHECK_EQ(evicted, n / 2);
+    std::printf("   %d textures, %.2f ms to evict half\n", n, 1e3 * (t1 - t0));
+    cache.clear();
+}
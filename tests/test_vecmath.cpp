@@ -0,0 +1,572 @@
+
+// Vector math - Transforms, frustum planes and bounds tests against a double precision reference
+
+#include "testing.h"
+#include "mge/dlmath.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <vector>
+
+
+
+// Double precision reference, written from the D3DX definitions rather than from vecmath.cpp
+struct RefMat {
+    double m[4][4];
+};
+
+static RefMat ref(const mat4& a) {
+    RefMat r;
+    for (int i = 0; i != 4; ++i) {
+        for (int j = 0; j != 4; ++j) {
+            r.m[i][j] = a.m[i][j];
+        }
+    }
+    return r;
+}
+
+static RefMat ref(const mat4x3& a) {
+    RefMat r = {{
+        { a._11, a._12, a._13, 0 },
+        { a._21, a._22, a._23, 0 },
+        { a._31, a._32, a._33, 0 },
+        { a._41, a._42, a._43, 1 }
+    }};
+    return r;
+}
+
+static RefMat multiply(const RefMat& a, const RefMat& b) {
+    RefMat r;
+    for (int i = 0; i != 4; ++i) {
+        for (int j = 0; j != 4; ++j) {
+            r.m[i][j] = 0;
+            for (int k = 0; k != 4; ++k) {
+                r.m[i][j] += a.m[i][k] * b.m[k][j];
+            }
+        }
+    }
+    return r;
+}
+
+// Sum of absolute products, which bounds the rounding error of a float dot product
+static RefMat magnitude(const RefMat& a, const RefMat& b) {
+    RefMat r;
+    for (int i = 0; i != 4; ++i) {
+        for (int j = 0; j != 4; ++j) {
+            r.m[i][j] = 0;
+            for (int k = 0; k != 4; ++k) {
+                r.m[i][j] += std::fabs(a.m[i][k] * b.m[k][j]);
+            }
+        }
+    }
+    return r;
+}
+
+// Row vector (x, y, z, w) times matrix
+static void transform(const RefMat& a, const double v[4], double out[4]) {
+    for (int j = 0; j != 4; ++j) {
+        out[j] = v[0] * a.m[0][j] + v[1] * a.m[1][j] + v[2] * a.m[2][j] + v[3] * a.m[3][j];
+    }
+}
+
+// Right handed rotation about a unit axis, as the rows of a row vector matrix (Rodrigues)
+static RefMat rotation(double kx, double ky, double kz, double angle) {
+    double s = std::sin(angle), c = std::cos(angle);
+    RefMat r = {{ { 0, 0, 0, 0 }, { 0, 0, 0, 0 }, { 0, 0, 0, 0 }, { 0, 0, 0, 1 } }};
+    const double basis[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+    for (int i = 0; i != 3; ++i) {
+        const double* v = basis[i];
+        double kv = kx * v[0] + ky * v[1] + kz * v[2];
+        double kxv[3] = { ky * v[2] - kz * v[1], kz * v[0] - kx * v[2], kx * v[1] - ky * v[0] };
+        r.m[i][0] = v[0] * c + kxv[0] * s + kx * kv * (1 - c);
+        r.m[i][1] = v[1] * c + kxv[1] * s + ky * kv * (1 - c);
+        r.m[i][2] = v[2] * c + kxv[2] * s + kz * kv * (1 - c);
+    }
+    return r;
+}
+
+// Normalized Gribb/Hartmann planes in the order near, far, left, right, top, bottom
+static void referencePlanes(const RefMat& vp, double out[6][4]) {
+    for (int k = 0; k != 4; ++k) {
+        double c1 = vp.m[k][0], c2 = vp.m[k][1], c3 = vp.m[k][2], c4 = vp.m[k][3];
+        out[0][k] = c3;
+        out[1][k] = c4 - c3;
+        out[2][k] = c4 + c1;
+        out[3][k] = c4 - c1;
+        out[4][k] = c4 - c2;
+        out[5][k] = c4 + c2;
+    }
+    for (int f = 0; f != 6; ++f) {
+        double len = std::sqrt(out[f][0] * out[f][0] + out[f][1] * out[f][1] + out[f][2] * out[f][2]);
+        for (int k = 0; k != 4; ++k) {
+            out[f][k] = (len == 0) ? 0 : out[f][k] / len;
+        }
+    }
+}
+
+// Containment rule of the original scalar ContainsSphere
+static ViewFrustum::Containment referenceContainsSphere(const plane planes[6], const BoundingSphere& s) {
+    float dist[6];
+    for (int f = 0; f != 6; ++f) {
+        dist[f] = planes[f].dotCoord(s.center);
+        if (dist[f] + s.radius < 0) {
+            return ViewFrustum::OUTSIDE;
+        }
+    }
+    for (int f = 0; f != 6; ++f) {
+        if (std::fabs(dist[f]) < s.radius) {
+            return ViewFrustum::INTERSECTS;
+        }
+    }
+    return ViewFrustum::INSIDE;
+}
+
+struct RandomMath {
+    std::mt19937 rng;
+
+    explicit RandomMath(uint32_t seed) : rng(seed) {}
+
+    float uniform(float lo, float hi) {
+        return std::uniform_real_distribution<float>(lo, hi)(rng);
+    }
+    vec3 point(float range) {
+        return vec3(uniform(-range, range), uniform(-range, range), uniform(-range, range));
+    }
+    mat4 matrix(float range) {
+        mat4 m;
+        for (int i = 0; i != 4; ++i) {
+            for (int j = 0; j != 4; ++j) {
+                m.m[i][j] = uniform(-range, range);
+            }
+        }
+        return m;
+    }
+    // Placement as the game builds it: scale, then rotations, then translation
+    mat4x3 placement(float range) {
+        const float pi = 3.14159265f;
+        return mat4x3::scaling(uniform(0.25f, 4.0f)) * mat4x3::rotationX(uniform(-pi, pi))
+             * mat4x3::rotationY(uniform(-pi, pi)) * mat4x3::rotationZ(uniform(-pi, pi))
+             * mat4x3::translation(uniform(-range, range), uniform(-range, range), uniform(-range, range));
+    }
+    // Camera in a worldspace, looking in any direction but straight up or down
+    mat4 view(const vec3& eye) {
+        vec3 look(uniform(-1, 1), uniform(-1, 1), uniform(-0.9f, 0.9f));
+        if (lengthSquared(look) < 1e-4f) {
+            look = vec3(1, 0, 0);
+        }
+        return mat4::lookAtLH(eye, eye + look, vec3(0, 0, 1));
+    }
+    mat4 projection() {
+        float zn = uniform(1.0f, 64.0f), zf = zn + uniform(100.0f, 300000.0f);
+        return mat4::perspectiveFovLH(uniform(0.5f, 2.0f), uniform(1.0f, 2.4f), zn, zf);
+    }
+};
+
+static bool near(float got, double want, double tolerance) {
+    return std::fabs(double(got) - want) <= tolerance;
+}
+
+// --------------------------------------------------------
+// Transforms
+
+TEST(mat4_multiply) {
+    RandomMath r(1);
+    int wrong = 0;
+    for (int n = 0; n != 10000; ++n) {
+        float range = (n % 3 == 0) ? 1.0f : (n % 3 == 1) ? 1000.0f : 1e-3f;
+        mat4 a = r.matrix(range), b = r.matrix(range), c = a * b;
+        RefMat want = multiply(ref(a), ref(b)), bound = magnitude(ref(a), ref(b));
+        for (int i = 0; i != 4; ++i) {
+            for (int j = 0; j != 4; ++j) {
+                wrong += !near(c.m[i][j], want.m[i][j], 4 * FLT_EPSILON * bound.m[i][j]);
+            }
+        }
+    }
+    CHECK_EQ(wrong, 0);
+
+    // Identity on both sides is exact
+    mat4 a = r.matrix(100.0f), i = mat4::identity(), ai = a * i, ia = i * a;
+    wrong = 0;
+    for (int k = 0; k != 16; ++k) {
+        wrong += ai.m[k / 4][k % 4] != a.m[k / 4][k % 4] || ia.m[k / 4][k % 4] != a.m[k / 4][k % 4];
+    }
+    CHECK_EQ(wrong, 0);
+}
+
+TEST(mat4_transform) {
+    RandomMath r(2);
+    int wrong = 0;
+    for (int n = 0; n != 10000; ++n) {
+        mat4 a = r.matrix(10.0f);
+        vec3 v = r.point(1000.0f);
+        double p[4] = { v.x, v.y, v.z, 1 }, d[4] = { v.x, v.y, v.z, 0 }, tp[4], td[4];
+        transform(ref(a), p, tp);
+        transform(ref(a), d, td);
+
+        // Skip points near w = 0, where the divide magnifies rounding without bound
+        if (std::fabs(tp[3]) > 1.0) {
+            vec3 c = a.transformCoord(v);
+            double tol = 1e-4 * (1 + std::fabs(tp[0] / tp[3]) + std::fabs(tp[1] / tp[3]) + std::fabs(tp[2] / tp[3]));
+            wrong += !near(c.x, tp[0] / tp[3], tol) || !near(c.y, tp[1] / tp[3], tol) || !near(c.z, tp[2] / tp[3], tol);
+        }
+
+        vec3 t = a.transformNormal(v);
+        double bound[3];
+        for (int j = 0; j != 3; ++j) {
+            bound[j] = 4 * FLT_EPSILON * (std::fabs(v.x * a.m[0][j]) + std::fabs(v.y * a.m[1][j]) + std::fabs(v.z * a.m[2][j]));
+        }
+        wrong += !near(t.x, td[0], bound[0]) || !near(t.y, td[1], bound[1]) || !near(t.z, td[2], bound[2]);
+    }
+    CHECK_EQ(wrong, 0);
+}
+
+TEST(mat4x3_matches_mat4) {
+    // The affine type must behave exactly as its 4x4 expansion
+    RandomMath r(3);
+    int wrong = 0;
+    for (int n = 0; n != 10000; ++n) {
+        mat4x3 a = r.placement(50000.0f), b = r.placement(50000.0f), ab = a * b;
+        vec3 v = r.point(8192.0f);
+
+        vec3 p = a.transformPoint(v), q = mat4(a).transformCoord(v);
+        wrong += p.x != q.x || p.y != q.y || p.z != q.z;
+        vec3 d = a.transformNormal(v), e = mat4(a).transformNormal(v);
+        wrong += d.x != e.x || d.y != e.y || d.z != e.z;
+
+        // Product against the double reference, with a bound from the operand magnitudes
+        RefMat want = multiply(ref(a), ref(b)), bound = magnitude(ref(a), ref(b));
+        mat4 got(ab);
+        for (int i = 0; i != 4; ++i) {
+            for (int j = 0; j != 4; ++j) {
+                wrong += !near(got.m[i][j], want.m[i][j], 4 * FLT_EPSILON * bound.m[i][j]);
+            }
+        }
+    }
+    CHECK_EQ(wrong, 0);
+}
+
+TEST(rotations) {
+    const float angles[] = { 0.0f, 1e-6f, 0.5f, 1.5707964f, 3.1415927f, -2.0f, 6.2831855f, 100.0f };
+    const double axes[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+    int wrong = 0;
+    for (float angle : angles) {
+        mat4x3 rot[3] = { mat4x3::rotationX(angle), mat4x3::rotationY(angle), mat4x3::rotationZ(angle) };
+        for (int a = 0; a != 3; ++a) {
+            RefMat want = rotation(axes[a][0], axes[a][1], axes[a][2], angle), got = ref(rot[a]);
+            for (int k = 0; k != 16; ++k) {
+                wrong += !near(float(got.m[k / 4][k % 4]), want.m[k / 4][k % 4], 1e-6);
+            }
+        }
+    }
+    CHECK_EQ(wrong, 0);
+
+    // D3DX convention: positive angles turn y towards z, z towards x and x towards y
+    vec3 y = mat4x3::rotationX(1.5707964f).transformNormal(vec3(0, 1, 0));
+    vec3 z = mat4x3::rotationY(1.5707964f).transformNormal(vec3(0, 0, 1));
+    vec3 x = mat4x3::rotationZ(1.5707964f).transformNormal(vec3(1, 0, 0));
+    CHECK_NEAR(y.z, 1.0, 1e-6);
+    CHECK_NEAR(z.x, 1.0, 1e-6);
+    CHECK_NEAR(x.y, 1.0, 1e-6);
+
+    // Scaling and translation
+    vec3 p = (mat4x3::scaling(2.0f) * mat4x3::translation(1, 2, 3)).transformPoint(vec3(1, 1, 1));
+    CHECK(p.x == 3 && p.y == 4 && p.z == 5);
+    vec3 d = mat4x3::translation(1, 2, 3).transformNormal(vec3(1, 1, 1));
+    CHECK(d.x == 1 && d.y == 1 && d.z == 1);
+}
+
+TEST(look_at) {
+    RandomMath r(4);
+    int wrong = 0;
+    for (int n = 0; n != 10000; ++n) {
+        vec3 eye = r.point(100000.0f), look = r.point(1.0f), up(0, 0, 1);
+        if (std::fabs(look.z) > 0.99f * length(look) || lengthSquared(look) < 1e-4f) {
+            continue;
+        }
+        float dist = r.uniform(1.0f, 1000.0f);
+        vec3 at = eye + normalize(look) * dist;
+        mat4 v = mat4::lookAtLH(eye, at, up);
+        RefMat m = ref(v);
+
+        // Eye to the origin, target on +z, up in the +y half of the yz plane
+        double e[4] = { eye.x, eye.y, eye.z, 1 }, a[4] = { at.x, at.y, at.z, 1 }, u[4] = { 0, 0, 1, 0 };
+        double te[4], ta[4], tu[4];
+        transform(m, e, te);
+        transform(m, a, ta);
+        transform(m, u, tu);
+        double tol = 1e-6 * (length(eye) + dist);
+        wrong += std::fabs(te[0]) > tol || std::fabs(te[1]) > tol || std::fabs(te[2]) > tol;
+        wrong += std::fabs(ta[0]) > tol || std::fabs(ta[1]) > tol || std::fabs(ta[2] - dist) > tol;
+        wrong += std::fabs(tu[0]) > 1e-6 || tu[1] <= 0;
+
+        // Orthonormal basis with determinant +1, so left handed view space keeps handedness
+        double det = m.m[0][0] * (m.m[1][1] * m.m[2][2] - m.m[1][2] * m.m[2][1])
+                   - m.m[0][1] * (m.m[1][0] * m.m[2][2] - m.m[1][2] * m.m[2][0])
+                   + m.m[0][2] * (m.m[1][0] * m.m[2][1] - m.m[1][1] * m.m[2][0]);
+        wrong += std::fabs(det - 1) > 1e-5;
+        for (int i = 0; i != 3; ++i) {
+            for (int j = 0; j != 3; ++j) {
+                double dotij = m.m[0][i] * m.m[0][j] + m.m[1][i] * m.m[1][j] + m.m[2][i] * m.m[2][j];
+                wrong += std::fabs(dotij - (i == j ? 1 : 0)) > 1e-5;
+            }
+        }
+    }
+    CHECK_EQ(wrong, 0);
+}
+
+TEST(perspective) {
+    RandomMath r(5);
+    int wrong = 0;
+    for (int n = 0; n != 10000; ++n) {
+        float fovy = r.uniform(0.3f, 2.5f), aspect = r.uniform(0.5f, 3.0f);
+        float zn = r.uniform(0.1f, 100.0f), zf = zn * r.uniform(2.0f, 10000.0f);
+        RefMat p = ref(mat4::perspectiveFovLH(fovy, aspect, zn, zf));
+
+        // Near and far map to depth 0 and 1; frustum edges at the field of view map to +-1
+        double h = std::tan(0.5 * fovy);
+        double pts[4][4] = {
+            { 0, 0, zn, 1 },
+            { 0, 0, zf, 1 },
+            { 0, h * zf, zf, 1 },
+            { -h * aspect * zn, 0, zn, 1 }
+        };
+        double want[4][3] = { { 0, 0, 0 }, { 0, 0, 1 }, { 0, 1, 1 }, { -1, 0, 0 } };
+        for (int i = 0; i != 4; ++i) {
+            double t[4];
+            transform(p, pts[i], t);
+            for (int k = 0; k != 3; ++k) {
+                wrong += std::fabs(t[k] / t[3] - want[i][k]) > 1e-4;
+            }
+        }
+    }
+    CHECK_EQ(wrong, 0);
+
+    // editProjectionZ only moves the clip planes
+    mat4 a = mat4::perspectiveFovLH(1.0f, 1.5f, 1.0f, 1000.0f), b = mat4::perspectiveFovLH(1.0f, 1.5f, 50.0f, 7168.0f);
+    editProjectionZ(&a, 50.0f, 7168.0f);
+    wrong = 0;
+    for (int k = 0; k != 16; ++k) {
+        wrong += a.m[k / 4][k % 4] != b.m[k / 4][k % 4];
+    }
+    CHECK_EQ(wrong, 0);
+}
+
+// --------------------------------------------------------
+// Frustum planes
+
+TEST(plane_extraction) {
+    RandomMath r(6);
+    int wrong = 0;
+    for (int n = 0; n != 10000; ++n) {
+        mat4 vp = (n % 4 == 0) ? r.matrix(10.0f) : r.view(r.point(100000.0f)) * r.projection();
+        plane got[6];
+        double want[6][4];
+        extractFrustumPlanes(vp, got);
+        referencePlanes(ref(vp), want);
+
+        // Only the final normalization rounds, apart from one add or subtract per element
+        for (int f = 0; f != 6; ++f) {
+            double tol = 4e-7 * (1 + std::fabs(want[f][3]));
+            wrong += !near(got[f].a, want[f][0], tol) || !near(got[f].b, want[f][1], tol);
+            wrong += !near(got[f].c, want[f][2], tol) || !near(got[f].d, want[f][3], tol);
+        }
+    }
+    CHECK_EQ(wrong, 0);
+}
+
+TEST(plane_classification) {
+    // A point is inside all six planes exactly when its clip coordinates are inside the D3D clip volume
+    RandomMath r(7);
+    int wrong = 0, inside = 0, tested = 0;
+    for (int n = 0; n != 200; ++n) {
+        vec3 eye = r.point(100000.0f);
+        mat4 vp = r.view(eye) * r.projection();
+        plane planes[6];
+        extractFrustumPlanes(vp, planes);
+        RefMat m = ref(vp);
+
+        for (int k = 0; k != 500; ++k) {
+            vec3 v = eye + r.point(k < 250 ? 500.0f : 200000.0f);
+            double p[4] = { v.x, v.y, v.z, 1 }, c[4];
+            transform(m, p, c);
+            double slack = std::min({ c[2], c[3] - c[2], c[3] + c[0], c[3] - c[0], c[3] - c[1], c[3] + c[1] });
+
+            // Skip points within rounding distance of a plane
+            double scale = std::fabs(c[0]) + std::fabs(c[1]) + std::fabs(c[2]) + std::fabs(c[3]);
+            if (std::fabs(slack) < 1e-4 * scale) {
+                continue;
+            }
+            bool want = slack > 0, got = true;
+            for (int f = 0; f != 6; ++f) {
+                got = got && planes[f].dotCoord(v) >= 0;
+            }
+            wrong += got != want;
+            inside += want;
+            ++tested;
+        }
+    }
+    CHECK_EQ(wrong, 0);
+    CHECK(inside > tested / 100);
+}
+
+// --------------------------------------------------------
+// Sphere and box tests
+
+// Axis aligned box from -10 to 10, built directly from planes so distances are exact
+static ViewFrustum boxFrustum() {
+    plane planes[6] = {
+        plane(0, 0, 1, 10), plane(0, 0, -1, 10),
+        plane(1, 0, 0, 10), plane(-1, 0, 0, 10),
+        plane(0, -1, 0, 10), plane(0, 1, 0, 10)
+    };
+    return ViewFrustum(planes);
+}
+
+static BoundingSphere sphere(float x, float y, float z, float radius) {
+    BoundingSphere s;
+    s.center = vec3(x, y, z);
+    s.radius = radius;
+    return s;
+}
+
+TEST(sphere_edges) {
+    ViewFrustum box = boxFrustum();
+    const float inf = std::numeric_limits<float>::infinity(), nan = std::numeric_limits<float>::quiet_NaN();
+
+    CHECK_EQ(box.ContainsSphere(sphere(0, 0, 0, 1)), ViewFrustum::INSIDE);
+    CHECK_EQ(box.ContainsSphere(sphere(0, 0, 0, 10)), ViewFrustum::INSIDE);          // Touching every plane from inside
+    CHECK_EQ(box.ContainsSphere(sphere(0, 0, 0, 10.5f)), ViewFrustum::INTERSECTS);
+    CHECK_EQ(box.ContainsSphere(sphere(9, 0, 0, 1.5f)), ViewFrustum::INTERSECTS);
+    CHECK_EQ(box.ContainsSphere(sphere(0, 0, 0, 1e30f)), ViewFrustum::INTERSECTS);
+    CHECK_EQ(box.ContainsSphere(sphere(0, 0, 0, inf)), ViewFrustum::INTERSECTS);
+    CHECK_EQ(box.ContainsSphere(sphere(1e30f, 0, 0, 1e30f)), ViewFrustum::INTERSECTS);
+
+    // Touching from outside is kept; any gap culls
+    CHECK(box.ContainsSphere(sphere(15, 0, 0, 5)) != ViewFrustum::OUTSIDE);
+    CHECK(box.ContainsSphere(sphere(0, -15, 0, 5)) != ViewFrustum::OUTSIDE);
+    CHECK_EQ(box.ContainsSphere(sphere(15.001f, 0, 0, 5)), ViewFrustum::OUTSIDE);
+    CHECK_EQ(box.ContainsSphere(sphere(0, 0, -15.001f, 5)), ViewFrustum::OUTSIDE);
+    CHECK_EQ(box.ContainsSphere(sphere(0, 0, 1e30f, 1)), ViewFrustum::OUTSIDE);
+
+    // Points, as zero radius spheres
+    CHECK_EQ(box.ContainsSphere(sphere(10, 10, 10, 0)), ViewFrustum::INSIDE);
+    CHECK_EQ(box.ContainsSphere(sphere(10.001f, 0, 0, 0)), ViewFrustum::OUTSIDE);
+
+    // Outside one plane while straddling others, e.g. beyond a corner
+    CHECK_EQ(box.ContainsSphere(sphere(12, 12, 0, 2.5f)), ViewFrustum::INTERSECTS);
+    CHECK_EQ(box.ContainsSphere(sphere(12, 0, 0, 1.5f)), ViewFrustum::OUTSIDE);
+
+    // A NaN centre never culls, so bad bounds show up on screen instead of vanishing
+    CHECK(box.ContainsSphere(sphere(nan, 0, 0, 1)) != ViewFrustum::OUTSIDE);
+
+    // Degenerate frustum from a zero matrix never culls
+    mat4 zero(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    CHECK(ViewFrustum(zero).ContainsSphere(sphere(1e6f, 0, 0, 1)) != ViewFrustum::OUTSIDE);
+}
+
+TEST(sphere_random) {
+    // SIMD and scalar paths must classify exactly as the original rule, including spheres on a plane
+    RandomMath r(9);
+    int wrong = 0, counts[3] = { 0, 0, 0 };
+    for (int n = 0; n != 200; ++n) {
+        vec3 eye = r.point(100000.0f);
+        mat4 vp = r.view(eye) * r.projection();
+        plane planes[6];
+        extractFrustumPlanes(vp, planes);
+        ViewFrustum frustum(planes);
+
+        for (int k = 0; k != 500; ++k) {
+            BoundingSphere s = sphere(0, 0, 0, 0);
+            if (k % 4 == 0) {
+                // Centred on one plane, or exactly a radius away from it
+                const plane& p = planes[k / 4 % 6];
+                vec3 onPlane = eye + r.point(3000.0f);
+                onPlane -= vec3(p.a, p.b, p.c) * p.dotCoord(onPlane);
+                s.radius = (k % 8 == 0) ? 0.0f : r.uniform(1.0f, 500.0f);
+                s.center = onPlane - vec3(p.a, p.b, p.c) * (k % 3 == 0 ? s.radius : 0.0f);
+            } else {
+                s.center = eye + r.point(k % 2 ? 2000.0f : 200000.0f);
+                s.radius = r.uniform(0.0f, 5000.0f);
+            }
+
+            ViewFrustum::Containment got = frustum.ContainsSphere(s);
+            wrong += got != referenceContainsSphere(planes, s);
+            counts[got] += 1;
+        }
+    }
+    CHECK_EQ(wrong, 0);
+    CHECK(counts[ViewFrustum::INSIDE] > 0 && counts[ViewFrustum::OUTSIDE] > 0 && counts[ViewFrustum::INTERSECTS] > 0);
+}
+
+TEST(box_conservative) {
+    // ContainsBox may keep boxes that are outside, but never culls a box with a corner inside
+    RandomMath r(10);
+    int wrong = 0, culled = 0;
+    for (int n = 0; n != 200; ++n) {
+        vec3 eye = r.point(100000.0f);
+        mat4 vp = r.view(eye) * r.projection();
+        ViewFrustum frustum(vp);
+        RefMat m = ref(vp);
+
+        for (int k = 0; k != 200; ++k) {
+            vec3 lo = eye + r.point(20000.0f), size(r.uniform(1, 4000), r.uniform(1, 4000), r.uniform(1, 4000));
+            BoundingBox box(lo, lo + size);
+            box.Transform(mat4x3::rotationZ(r.uniform(-3, 3)));
+
+            bool cornerInside = false;
+            for (int c = 0; c != 8; ++c) {
+                vec3 v = box.center + box.vx * ((c & 1) ? 1.0f : -1.0f) + box.vy * ((c & 2) ? 1.0f : -1.0f) + box.vz * ((c & 4) ? 1.0f : -1.0f);
+                double p[4] = { v.x, v.y, v.z, 1 }, t[4];
+                transform(m, p, t);
+                double slack = std::min({ t[2], t[3] - t[2], t[3] + t[0], t[3] - t[0], t[3] - t[1], t[3] + t[1] });
+                cornerInside = cornerInside || slack > 1e-3 * (std::fabs(t[0]) + std::fabs(t[1]) + std::fabs(t[2]) + std::fabs(t[3]));
+            }
+
+            bool isCulled = frustum.ContainsBox(box) == ViewFrustum::OUTSIDE;
+            wrong += cornerInside && isCulled;
+            culled += isCulled;
+        }
+    }
+    CHECK_EQ(wrong, 0);
+    CHECK(culled > 0);
+}
+
+// --------------------------------------------------------
+// Bounds
+
+TEST(sphere_merge) {
+    // Merged spheres contain both inputs and are no larger than the minimal enclosing sphere
+    RandomMath r(12);
+    int wrong = 0;
+    for (int n = 0; n != 10000; ++n) {
+        BoundingSphere a = sphere(0, 0, 0, 0), b = a;
+        a.center = r.point(1000.0f);
+        a.radius = r.uniform(0.0f, 500.0f);
+        b.center = (n % 5 == 0) ? a.center : (n % 5 == 1) ? a.center + r.point(10.0f) : r.point(1000.0f);
+        b.radius = (n % 7 == 0) ? 0.0f : r.uniform(0.0f, 500.0f);
+        BoundingSphere s = a + b;
+
+        double d = length(b.center - a.center);
+        double minimal = std::max({ double(a.radius), double(b.radius), 0.5 * (d + a.radius + b.radius) });
+        double tol = 1e-4 * (1 + minimal);
+        for (const BoundingSphere* in : { &a, &b }) {
+            if (in->radius == 0.0f) {
+                continue;
+            }
+            double reach = length(in->center - s.center) + in->radius;
+            // Centres closer than 0.001 are treated as coincident
+            wrong += reach > s.radius + tol + 0.001;
+        }
+        wrong += s.radius > minimal + tol;
+    }
+    CHECK_EQ(wrong, 0);
+
+    // An empty sphere leaves the other unchanged
+    BoundingSphere a = sphere(1, 2, 3, 4), empty;
+    BoundingSphere s = empty + a, t = a + empty;
+    CHECK(s.center.x == 1 && s.center.y == 2 && s.center.z == 3 && s.radius == 4);
+    CHECK(t.center.x == 1 && t.center.y == 2 && t.center.z == 3 && t.radius == 4);
+}
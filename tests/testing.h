@@ -0,0 +1,47 @@
+#pragma once
+
+// Minimal unit test harness for the portable parts of MGE XE.
+// TEST(name) defines a test case and BENCH(name) a benchmark; each test executable links testmain.cpp.
+// CHECK macros record a failure and continue, so one run reports every broken expectation.
+// Benchmarks only run with --bench, and report times without failing on them.
+
+#include <chrono>
+#include <cstdio>
+
+namespace Testing {
+    typedef void (*CaseFunction)();
+
+    struct Case {
+        const char* name;
+        CaseFunction run;
+        bool benchmark;
+        Case* next;
+    };
+
+    int registerCase(Case* c);
+    void fail(const char* file, int line, const char* expr);
+
+    // seconds - Monotonic time for benchmarks
+    inline double seconds() {
+        using namespace std::chrono;
+        return duration<double>(steady_clock::now().time_since_epoch()).count();
+    }
+}
+
+#define MGE_TEST_CASE(name, bench) \
+    static void test_##name(); \
+    static Testing::Case case_##name = { #name, test_##name, bench, nullptr }; \
+    static int registered_##name = Testing::registerCase(&case_##name); \
+    static void test_##name()
+
+#define TEST(name) MGE_TEST_CASE(name, false)
+#define BENCH(name) MGE_TEST_CASE(name, true)
+
+#define CHECK(expr) \
+    do { if (!(expr)) { Testing::fail(__FILE__, __LINE__, #expr); } } while (0)
+
+#define CHECK_EQ(a, b) \
+    do { if (!((a) == (b))) { Testing::fail(__FILE__, __LINE__, #a " == " #b); } } while (0)
+
+#define CHECK_NEAR(a, b, eps) \
+    do { double d_ = double(a) - double(b); if (!(d_ <= (eps) && -d_ <= (eps))) { Testing::fail(__FILE__, __LINE__, #a " ~= " #b); } } while (0)
@@ -0,0 +1,52 @@
+
+#include "testing.h"
+
+#include <cstring>
+
+
+
+static Testing::Case* firstCase = nullptr;
+static Testing::Case** lastCase = &firstCase;
+static int failures = 0;
+
+// registerCase - Append to the case list, keeping definition order
+int Testing::registerCase(Case* c) {
+    *lastCase = c;
+    lastCase = &c->next;
+    return 0;
+}
+
+void Testing::fail(const char* file, int line, const char* expr) {
+    std::printf("!! %s:%d: CHECK(%s) failed\n", file, line, expr);
+    ++failures;
+}
+
+// Usage: <test> [--bench] [case name]
+// Runs every test case, or every benchmark with --bench, optionally only the named one
+int main(int argc, char** argv) {
+    bool bench = false;
+    const char* only = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--bench") == 0) {
+            bench = true;
+        } else {
+            only = argv[i];
+        }
+    }
+
+    int ran = 0;
+    for (Testing::Case* c = firstCase; c; c = c->next) {
+        if (c->benchmark != bench || (only && std::strcmp(only, c->name) != 0)) {
+            continue;
+        }
+
+        int before = failures;
+        c->run();
+        std::printf("%s %s\n", (failures == before) ? "--" : "!!", c->name);
+        ++ran;
+    }
+
+    std::printf("%s %d %s, %d failed checks\n", failures ? "!!" : "--", ran, bench ? "benchmarks" : "tests", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,655 @@
+
+// mgecull - Distant land culling benchmark. Generates synthetic worldspaces, builds the distant static
+// quadtrees with the same placement code as the game, then flies scripted cameras through them, timing
+// the cull and sort work done each frame. Portable, so that culling changes can be measured and compared
+// between builds on any machine.
+//
+// Usage: mgecull [-w worldspace] [-s seed] [-n iterations] [-d draw distance]
+//   -w  Worldspace profile: vvardenfell (default), mainland, interior or all
+//   -s  Generator seed, default 1
+//   -n  Repeat each flythrough this many times, default 3
+//   -d  Draw distance in cells, default 10. Static ranges keep the default configuration's 2:4:5 ratio.
+//
+// Reports per-frame cull time percentiles and visible counts for each flythrough, and a checksum of the
+// visible counts. The checksum only changes if culling results change, so it can be compared across builds.
+// Also times the batch bounds transforms and frustum extraction against the per-object code, and fails if
+// their results differ.
+
+#include "mge/dlplacement.h"
+#include "support/timing.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+
+
+static const float kCellSize = 8192.0f;
+static const float kPi = 3.14159265f;
+
+// --------------------------------------------------------
+// Deterministic random numbers
+// The standard library distributions differ between implementations, which would make worldspaces
+// differ between platforms, so everything is derived from a fixed generator here.
+
+class Random {
+public:
+    explicit Random(uint64_t seed) : state(seed * 0x9E3779B97F4A7C15ull + 0x2545F4914F6CDD1Dull) {}
+
+    uint32_t next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return uint32_t((state * 0x2545F4914F6CDD1Dull) >> 32);
+    }
+    float uniform() {
+        return (next() >> 8) * (1.0f / 16777216.0f);
+    }
+    float range(float a, float b) {
+        return a + (b - a) * uniform();
+    }
+    int below(int n) {
+        return int((uint64_t(next()) * uint64_t(n)) >> 32);
+    }
+    // Skewed towards low indices, so that some models and textures are much more common than others
+    int skewed(int n) {
+        float u = uniform();
+        return std::min(n - 1, int(n * u * u));
+    }
+    float normal() {
+        float u = std::max(uniform(), 1e-7f), v = uniform();
+        return std::sqrt(-2.0f * std::log(u)) * std::cos(2.0f * kPi * v);
+    }
+    float logNormal(float median, float spread) {
+        return median * std::exp(spread * normal());
+    }
+
+private:
+    uint64_t state;
+};
+
+// --------------------------------------------------------
+// Worldspace profiles
+// Rough proportions of distant land builds; statics exclude grass, which is generated in patches per land cell.
+
+struct WorldProfile {
+    const char* name;
+    int cells;              // Width of the square worldspace in cells
+    int models;             // Distinct distant static models, excluding grass
+    int instances;          // Placed statics, excluding grass
+    int towns;              // Settlement clusters
+    int grassPerCell;       // Grass instances per land cell
+};
+
+static const WorldProfile worldProfiles[] = {
+    { "vvardenfell", 42, 4000, 45000, 25, 120 },
+    { "mainland", 110, 12000, 240000, 120, 40 },
+    { "interior", 3, 400, 2500, 1, 0 },
+};
+
+struct TypeProfile {
+    StaticType type;
+    float modelShare;       // Fraction of models of this type
+    float useRate;          // Relative number of instances per model
+    float radiusMedian;     // Log-normal bounding radius, world units
+    float radiusSpread;
+    int minSubsets, maxSubsets;
+    float townAffinity;     // Probability that an instance is placed in a settlement
+};
+
+static const TypeProfile typeProfiles[] = {
+    { STATIC_AUTO, 0.55f, 1.0f, 110.0f, 0.9f, 1, 3, 0.35f },
+    { STATIC_TREE, 0.12f, 4.0f, 320.0f, 0.4f, 2, 3, 0.1f },
+    { STATIC_BUILDING, 0.22f, 1.0f, 520.0f, 0.5f, 3, 10, 0.9f },
+    { STATIC_NEAR, 0.05f, 1.0f, 70.0f, 0.6f, 1, 2, 0.5f },
+    { STATIC_FAR, 0.04f, 1.0f, 900.0f, 0.4f, 1, 4, 0.3f },
+    { STATIC_VERY_FAR, 0.02f, 0.5f, 2600.0f, 0.4f, 2, 6, 0.0f },
+};
+
+static const TypeProfile grassProfile = { STATIC_GRASS, 0.0f, 1.0f, 45.0f, 0.3f, 1, 1, 0.0f };
+static const int grassModels = 24;
+static const int grassPerPatch = 40;
+static const float grassPatchRadius = 600.0f;
+static const float townRadius = 1.5f * kCellSize;
+
+// --------------------------------------------------------
+// Worldspace generation
+
+struct Worldspace {
+    const WorldProfile* profile;
+    std::vector<DistantStatic> statics;
+    std::vector<UsedDistantStatic> instances;
+    std::vector<vec3> towns;
+    size_t grassInstances = 0;
+
+    std::unique_ptr<QuadTree> nearStatics, farStatics, veryFarStatics, grassStatics;
+    DistantStaticTrees trees = {};
+    size_t meshes = 0;
+    float buildMilliseconds = 0;
+};
+
+// Resources are only compared and sorted by address, never dereferenced
+template<typename T>
+static T* fakeResource(uintptr_t& next) {
+    return reinterpret_cast<T*>(0x10000 + 16 * next++);
+}
+
+// terrainHeight - Rolling islands, below zero is water
+static float terrainHeight(const WorldProfile& profile, float x, float y) {
+    float extent = 0.5f * profile.cells * kCellSize;
+    float edge = std::max(std::fabs(x), std::fabs(y)) / extent;
+    float h = 1800.0f * std::sin(x * 0.00011f) * std::cos(y * 0.00009f) + 900.0f * std::sin((x + 2.0f * y) * 0.00031f);
+    return h + 1200.0f - 4000.0f * edge * edge;
+}
+
+// makeStatic - A model with sub-meshes spread inside its bounds, origin at the base like game meshes
+static DistantStatic makeStatic(Random& rng, const TypeProfile& tp, int textureCount, uintptr_t& nextResource) {
+    DistantStatic stat;
+    float r = tp.radiusMedian * std::exp(tp.radiusSpread * rng.normal());
+
+    stat.type = (unsigned char)tp.type;
+    stat.sphere.center = vec3(0, 0, 0.4f * r);
+    stat.sphere.radius = r;
+    stat.aabbMin = stat.sphere.center - vec3(0.6f * r, 0.6f * r, 0.5f * r);
+    stat.aabbMax = stat.sphere.center + vec3(0.6f * r, 0.6f * r, 0.5f * r);
+
+    int subsets = tp.minSubsets + rng.below(tp.maxSubsets - tp.minSubsets + 1);
+    for (int i = 0; i != subsets; ++i) {
+        DistantSubset s;
+        float sr = r * rng.range(0.3f, 0.7f);
+        vec3 offset(rng.range(-0.3f, 0.3f) * r, rng.range(-0.3f, 0.3f) * r, rng.range(-0.25f, 0.25f) * r);
+        vec3 extent(0.55f * sr, 0.55f * sr, 0.55f * sr);
+
+        s.sphere.center = stat.sphere.center + offset;
+        s.sphere.radius = sr;
+        s.aabbMin = s.sphere.center - extent;
+        s.aabbMax = s.sphere.center + extent;
+        s.tex = reinterpret_cast<IDirect3DTexture9*>(0x1000000 + 16 * uintptr_t(rng.skewed(textureCount)));
+        s.hasAlpha = tp.type == STATIC_TREE || tp.type == STATIC_GRASS || rng.below(8) == 0;
+        s.hasUVController = rng.below(50) == 0;
+        s.vbuffer = fakeResource<IDirect3DVertexBuffer9>(nextResource);
+        s.ibuffer = fakeResource<IDirect3DIndexBuffer9>(nextResource);
+        s.verts = 24 + rng.below(800);
+        s.faces = s.verts + rng.below(s.verts);
+        stat.subsets.push_back(s);
+    }
+    return stat;
+}
+
+// placeInstance - Transform an instance in the same way as loadDistantStatics, bounds are calculated later in a batch
+static void placeInstance(Worldspace& ws, uint32_t staticRef, const vec3& pos, float yaw, float pitch, float roll, float scale) {
+    UsedDistantStatic uds;
+    uds.staticRef = staticRef;
+    uds.visIndex = 0;
+    uds.pos = pos;
+    uds.scale = scale;
+
+    mat4x3 transmat = mat4x3::translation(pos.x, pos.y, pos.z);
+    mat4x3 rotmatx = mat4x3::rotationX(-yaw);
+    mat4x3 rotmaty = mat4x3::rotationY(-pitch);
+    mat4x3 rotmatz = mat4x3::rotationZ(-roll);
+    mat4x3 scalemat = mat4x3::scaling(scale);
+
+    uds.transform = scalemat * rotmatz * rotmaty * rotmatx * transmat;
+    ws.instances.push_back(uds);
+}
+
+// landPoint - Random point on land, near a centre if given
+static bool landPoint(Random& rng, const WorldProfile& profile, const vec3* centre, float spread, vec3& out) {
+    float extent = 0.5f * profile.cells * kCellSize;
+
+    for (int attempt = 0; attempt != 16; ++attempt) {
+        float x, y;
+        if (centre) {
+            x = centre->x + spread * rng.normal();
+            y = centre->y + spread * rng.normal();
+        } else {
+            x = rng.range(-extent, extent);
+            y = rng.range(-extent, extent);
+        }
+
+        float z = terrainHeight(profile, x, y);
+        if (z > 0.0f && std::fabs(x) < extent && std::fabs(y) < extent) {
+            out = vec3(x, y, z);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void generateWorldspace(Worldspace& ws, const WorldProfile& profile, uint64_t seed) {
+    Random rng(seed);
+    uintptr_t nextResource = 1;
+    int textureCount = profile.models / 2;
+
+    ws.profile = &profile;
+
+    // Settlements
+    for (int i = 0; i != profile.towns; ++i) {
+        vec3 p;
+        if (landPoint(rng, profile, nullptr, 0, p)) {
+            ws.towns.push_back(p);
+        }
+    }
+
+    // Models, grouped by type
+    struct ModelRange {
+        uint32_t first, count;
+    };
+    const size_t typeCount = sizeof(typeProfiles) / sizeof(typeProfiles[0]);
+    ModelRange modelRanges[typeCount];
+    float useWeights[typeCount], totalWeight = 0;
+
+    for (size_t t = 0; t != typeCount; ++t) {
+        const TypeProfile& tp = typeProfiles[t];
+        uint32_t count = std::max(1u, uint32_t(tp.modelShare * profile.models));
+
+        modelRanges[t].first = uint32_t(ws.statics.size());
+        modelRanges[t].count = count;
+        for (uint32_t i = 0; i != count; ++i) {
+            ws.statics.push_back(makeStatic(rng, tp, textureCount, nextResource));
+        }
+
+        useWeights[t] = tp.modelShare * tp.useRate;
+        totalWeight += useWeights[t];
+    }
+
+    // Instances, clustered into settlements by type
+    for (int i = 0; i != profile.instances; ++i) {
+        size_t t = 0;
+        for (float u = rng.uniform() * totalWeight; t + 1 < typeCount && u >= useWeights[t]; ++t) {
+            u -= useWeights[t];
+        }
+
+        const TypeProfile& tp = typeProfiles[t];
+        const vec3* town = nullptr;
+        if (!ws.towns.empty() && rng.uniform() < tp.townAffinity) {
+            town = &ws.towns[rng.skewed(int(ws.towns.size()))];
+        }
+
+        vec3 pos;
+        if (!landPoint(rng, profile, town, townRadius * 0.5f, pos)) {
+            continue;
+        }
+
+        uint32_t staticRef = modelRanges[t].first + uint32_t(rng.skewed(int(modelRanges[t].count)));
+        float tilt = (tp.type == STATIC_BUILDING) ? 0.0f : 0.08f;
+        float scale = (tp.type == STATIC_BUILDING) ? 1.0f : rng.logNormal(1.0f, 0.12f);
+        placeInstance(ws, staticRef, pos, rng.range(-tilt, tilt), rng.range(-tilt, tilt), rng.range(0, 2.0f * kPi), scale);
+    }
+
+    // Grass, in patches across land cells
+    uint32_t grassFirst = uint32_t(ws.statics.size());
+    for (int i = 0; i != grassModels; ++i) {
+        ws.statics.push_back(makeStatic(rng, grassProfile, textureCount, nextResource));
+    }
+
+    size_t before = ws.instances.size();
+    int patches = profile.cells * profile.cells * profile.grassPerCell / grassPerPatch;
+    for (int i = 0; i != patches; ++i) {
+        vec3 centre, pos;
+        if (!landPoint(rng, profile, nullptr, 0, centre)) {
+            continue;
+        }
+
+        uint32_t staticRef = grassFirst + uint32_t(rng.skewed(grassModels));
+        for (int j = 0; j != grassPerPatch; ++j) {
+            if (landPoint(rng, profile, &centre, grassPatchRadius, pos)) {
+                placeInstance(ws, staticRef, pos, 0, 0, rng.range(0, 2.0f * kPi), rng.logNormal(1.0f, 0.2f));
+            }
+        }
+    }
+    ws.grassInstances = ws.instances.size() - before;
+
+    boundDistantStatics(ws.statics, ws.instances.data(), ws.instances.size());
+}
+
+static void buildTrees(Worldspace& ws, float farStaticMinSize, float veryFarStaticMinSize) {
+    int64_t start = HighResolutionTimer::getTicks();
+
+    ws.nearStatics = std::make_unique<QuadTree>();
+    ws.farStatics = std::make_unique<QuadTree>();
+    ws.veryFarStatics = std::make_unique<QuadTree>();
+    ws.grassStatics = std::make_unique<QuadTree>();
+
+    DistantStaticTrees& trees = ws.trees;
+    trees.nearStatics = ws.nearStatics.get();
+    trees.farStatics = ws.farStatics.get();
+    trees.veryFarStatics = ws.veryFarStatics.get();
+    trees.grassStatics = ws.grassStatics.get();
+
+    DistantStaticRanges ranges;
+    ranges.farStaticMinSize = farStaticMinSize;
+    ranges.veryFarStaticMinSize = veryFarStaticMinSize;
+
+    ws.meshes = placeDistantStatics(trees, ranges, ws.statics, ws.instances, nullptr);
+    ws.buildMilliseconds = 0.001f * HighResolutionTimer::ticksToMicroseconds(HighResolutionTimer::getTicks() - start);
+}
+
+static size_t countMeshes(const QuadTreeNode* node) {
+    size_t n = node->meshes.size();
+    for (const QuadTreeNode* child : node->children) {
+        if (child) {
+            n += countMeshes(child);
+        }
+    }
+    return n;
+}
+
+// --------------------------------------------------------
+// Batch math
+// Times the batch bounds transforms and frustum extraction against the per-object code they replace,
+// and checks that both produce the same results.
+
+static bool sameSphere(const BoundingSphere& a, const BoundingSphere& b) {
+    return a.center.x == b.center.x && a.center.y == b.center.y && a.center.z == b.center.z && a.radius == b.radius;
+}
+
+static bool sameVec(const vec3& a, const vec3& b) {
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+static bool sameBox(const BoundingBox& a, const BoundingBox& b) {
+    return sameVec(a.center, b.center) && sameVec(a.vx, b.vx) && sameVec(a.vy, b.vy) && sameVec(a.vz, b.vz);
+}
+
+static bool measureBatchMath(const Worldspace& ws, const mat4& proj, int iterations) {
+    std::vector<UsedDistantStatic> perObject = ws.instances, batch = ws.instances;
+    float perObjectNs = 0, batchNs = 0;
+
+    for (int it = 0; it != iterations; ++it) {
+        int64_t t0 = HighResolutionTimer::getTicks();
+        for (auto& i : perObject) {
+            const DistantStatic* stat = &ws.statics[i.staticRef];
+            i.sphere = i.GetBoundingSphere(stat->sphere);
+            i.box = i.GetBoundingBox(stat->aabbMin, stat->aabbMax);
+        }
+        int64_t t1 = HighResolutionTimer::getTicks();
+        boundDistantStatics(ws.statics, batch.data(), batch.size());
+        int64_t t2 = HighResolutionTimer::getTicks();
+
+        perObjectNs += 1000.0f * HighResolutionTimer::ticksToMicroseconds(t1 - t0) / perObject.size();
+        batchNs += 1000.0f * HighResolutionTimer::ticksToMicroseconds(t2 - t1) / batch.size();
+    }
+
+    for (size_t i = 0; i != batch.size(); ++i) {
+        if (!sameSphere(perObject[i].sphere, batch[i].sphere) || !sameBox(perObject[i].box, batch[i].box)) {
+            std::fprintf(stderr, "mgecull: batch bounds differ from per-object bounds at instance %zu\n", i);
+            return false;
+        }
+    }
+
+    // Frusta for a spread of view directions, as many as a few seconds of cull ranges and shadow layers
+    const size_t frustumCount = 1000;
+    std::vector<mat4> viewProj(frustumCount);
+    std::vector<plane> perMatrix(6 * frustumCount), batchPlanes(6 * frustumCount);
+
+    for (size_t i = 0; i != frustumCount; ++i) {
+        float yaw = 0.01f * i, pitch = 0.5f * std::sin(0.1f * i);
+        vec3 eye(100.0f * i, -50.0f * i, 128.0f), look(std::cos(pitch) * std::sin(yaw), std::cos(pitch) * std::cos(yaw), std::sin(pitch));
+        viewProj[i] = mat4::lookAtLH(eye, eye + look, vec3(0, 0, 1)) * proj;
+    }
+
+    // Each pass is only microseconds long, so repeat it to get a stable time
+    const int frustumRepeats = 100 * iterations;
+    int64_t t0 = HighResolutionTimer::getTicks();
+    for (int r = 0; r != frustumRepeats; ++r) {
+        for (size_t i = 0; i != frustumCount; ++i) {
+            extractFrustumPlanes(viewProj[i], &perMatrix[6 * i]);
+        }
+    }
+    int64_t t1 = HighResolutionTimer::getTicks();
+    for (int r = 0; r != frustumRepeats; ++r) {
+        extractFrustumPlanes(viewProj.data(), reinterpret_cast<plane(*)[6]>(batchPlanes.data()), frustumCount);
+    }
+    int64_t t2 = HighResolutionTimer::getTicks();
+
+    for (size_t i = 0; i != perMatrix.size(); ++i) {
+        const plane& a = perMatrix[i], &b = batchPlanes[i];
+        if (a.a != b.a || a.b != b.b || a.c != b.c || a.d != b.d) {
+            std::fprintf(stderr, "mgecull: batch frustum planes differ from per-matrix planes at frustum %zu\n", i / 6);
+            return false;
+        }
+    }
+
+    std::printf("  bounds ns/instance  per-object %6.1f  batch %6.1f   frusta ns/frustum  per-matrix %6.1f  batch %6.1f\n",
+                perObjectNs / iterations, batchNs / iterations,
+                1000.0f * HighResolutionTimer::ticksToMicroseconds(t1 - t0) / (frustumCount * frustumRepeats),
+                1000.0f * HighResolutionTimer::ticksToMicroseconds(t2 - t1) / (frustumCount * frustumRepeats));
+    return true;
+}
+
+// --------------------------------------------------------
+// Flythroughs
+// Each produces a camera position and look direction for a frame, at 60 frames per second.
+
+struct Camera {
+    vec3 eye, look;
+};
+
+typedef Camera (*CameraPath)(const Worldspace& ws, int frame);
+
+static const int eyeHeight = 128;
+
+static vec3 direction(float yaw, float pitch) {
+    return vec3(std::cos(pitch) * std::sin(yaw), std::cos(pitch) * std::cos(yaw), std::sin(pitch));
+}
+
+static vec3 groundPoint(const Worldspace& ws, float x, float y, float above) {
+    return vec3(x, y, std::max(0.0f, terrainHeight(*ws.profile, x, y)) + above);
+}
+
+// walkPath - Running between settlements at ground level, looking around
+static Camera walkPath(const Worldspace& ws, int frame) {
+    const float speed = 600.0f / 60.0f;
+    size_t n = ws.towns.size();
+    vec3 a = n ? ws.towns[0] : vec3(0, 0, 0);
+    float travelled = speed * frame;
+
+    // Follow the town list, wrapping around
+    for (size_t i = 0; n > 1; i = (i + 1) % n) {
+        vec3 b = ws.towns[(i + 1) % n], d = b - a;
+        float leg = std::sqrt(d.x * d.x + d.y * d.y);
+        if (travelled <= leg) {
+            float t = leg > 0 ? travelled / leg : 0;
+            float yaw = std::atan2(d.x, d.y) + 0.7f * std::sin(frame * 0.02f);
+            Camera c = { groundPoint(ws, a.x + t * d.x, a.y + t * d.y, eyeHeight), direction(yaw, 0.1f * std::sin(frame * 0.013f)) };
+            return c;
+        }
+        travelled -= leg;
+        a = b;
+    }
+
+    Camera c = { groundPoint(ws, a.x, a.y, eyeHeight), direction(frame * 0.02f, 0) };
+    return c;
+}
+
+// levitatePath - Fast straight flight across the worldspace above the terrain
+static Camera levitatePath(const Worldspace& ws, int frame) {
+    float extent = 0.45f * ws.profile->cells * kCellSize;
+    float t = std::fmod(frame * (2500.0f / 60.0f) / (2.0f * extent), 1.0f);
+    float x = -extent + 2.0f * extent * t, y = -0.8f * extent + 1.6f * extent * t;
+
+    Camera c = { groundPoint(ws, x, y, 3000.0f), direction(std::atan2(1.0f, 0.8f), -0.15f) };
+    return c;
+}
+
+// spinPath - Turning on the spot in the busiest settlement, the worst case for frustum coherence
+static Camera spinPath(const Worldspace& ws, int frame) {
+    vec3 p = ws.towns.empty() ? vec3(0, 0, 0) : ws.towns[0];
+
+    Camera c = { groundPoint(ws, p.x, p.y, eyeHeight), direction(frame * (2.0f * kPi / 240.0f), 0.35f * std::sin(frame * 0.05f)) };
+    return c;
+}
+
+// overviewPath - Circling high above the worldspace centre, looking down over most of it
+static Camera overviewPath(const Worldspace& ws, int frame) {
+    float radius = 0.25f * ws.profile->cells * kCellSize, angle = frame * (2.0f * kPi / 1200.0f);
+    float x = radius * std::sin(angle), y = radius * std::cos(angle);
+
+    Camera c = { groundPoint(ws, x, y, 20000.0f), direction(angle + kPi, -0.5f) };
+    return c;
+}
+
+struct Flythrough {
+    const char* name;
+    CameraPath path;
+    int frames;
+};
+
+static const Flythrough flythroughs[] = {
+    { "walk", walkPath, 1800 },
+    { "levitate", levitatePath, 1200 },
+    { "spin", spinPath, 480 },
+    { "overview", overviewPath, 1200 },
+};
+
+// --------------------------------------------------------
+
+struct Samples {
+    std::vector<float> micros;
+    uint64_t visibleTotal = 0;
+    size_t visibleMax = 0;
+
+    void add(float us, size_t visible) {
+        micros.push_back(us);
+        visibleTotal += visible;
+        visibleMax = std::max(visibleMax, visible);
+    }
+
+    float percentile(double p) {
+        if (micros.empty()) {
+            return 0.0f;
+        }
+        size_t rank = size_t(std::ceil(p * micros.size()));
+        return micros[std::min(micros.size(), std::max<size_t>(rank, 1)) - 1];
+    }
+};
+
+static void printSamples(const char* label, Samples& s) {
+    std::sort(s.micros.begin(), s.micros.end());
+    double avg = s.micros.empty() ? 0.0 : double(s.visibleTotal) / s.micros.size();
+
+    std::printf("    %-8s us  p50 %8.2f  p90 %8.2f  p99 %8.2f  max %8.2f   visible avg %8.1f  max %6zu\n",
+                label, s.percentile(0.5), s.percentile(0.9), s.percentile(0.99), s.percentile(1.0), avg, s.visibleMax);
+}
+
+static bool runWorldspace(const WorldProfile& profile, uint64_t seed, int iterations, float drawDistance) {
+    Worldspace ws;
+    generateWorldspace(ws, profile, seed);
+    buildTrees(ws, 600.0f, 800.0f);
+
+    // Linear fog, which also limits grass to the fog end
+    DistantCullRanges cs;
+    cs.nearViewRange = 7168.0f;
+    cs.fogEnd = drawDistance * kCellSize;
+    cs.nearStaticEnd = 0.4f * drawDistance * kCellSize;
+    cs.farStaticEnd = 0.8f * drawDistance * kCellSize;
+    cs.veryFarStaticEnd = drawDistance * kCellSize;
+    cs.grassIgnoresFog = false;
+
+    // Morrowind's 75 degree horizontal field of view at 16:9
+    const float aspect = 16.0f / 9.0f, fovY = 2.0f * std::atan(std::tan(0.5f * 75.0f * kPi / 180.0f) / aspect);
+    mat4 proj = mat4::perspectiveFovLH(fovY, aspect, 1.0f, cs.fogEnd);
+
+    std::printf("mgecull: %s, seed %llu, %d cells, %zu statics + %zu grass, %d iterations, draw distance %.0f cells\n",
+                profile.name, (unsigned long long)seed, profile.cells * profile.cells, ws.instances.size() - ws.grassInstances,
+                ws.grassInstances, iterations, drawDistance);
+    std::printf("  build ms %8.1f   meshes near %zu  far %zu  very far %zu  grass %zu\n", ws.buildMilliseconds,
+                countMeshes(ws.nearStatics->m_root_node), countMeshes(ws.farStatics->m_root_node),
+                countMeshes(ws.veryFarStatics->m_root_node), countMeshes(ws.grassStatics->m_root_node));
+    if (!measureBatchMath(ws, proj, iterations)) {
+        return false;
+    }
+
+    VisibleSet visDistant, visGrass;
+    uint64_t checksum = 14695981039346656037ull;
+
+    for (const Flythrough& fly : flythroughs) {
+        Samples statics, grass;
+        uint64_t flyChecksum = 0;
+
+        for (int it = 0; it != iterations; ++it) {
+            uint64_t h = 14695981039346656037ull;
+
+            for (int f = 0; f != fly.frames; ++f) {
+                Camera cam = fly.path(ws, f);
+                mat4 view = mat4::lookAtLH(cam.eye, cam.eye + cam.look, vec3(0, 0, 1));
+
+                int64_t t0 = HighResolutionTimer::getTicks();
+                cullDistantStaticRanges(ws.trees, cs, cam.eye, view, proj, visDistant);
+                int64_t t1 = HighResolutionTimer::getTicks();
+                visGrass.RemoveAll();
+                cullGrassRange(ws.trees, cs, view, proj, visGrass);
+                int64_t t2 = HighResolutionTimer::getTicks();
+
+                statics.add(HighResolutionTimer::ticksToMicroseconds(t1 - t0), visDistant.size());
+                grass.add(HighResolutionTimer::ticksToMicroseconds(t2 - t1), visGrass.size());
+                h = (h ^ visDistant.size()) * 1099511628211ull;
+                h = (h ^ visGrass.size()) * 1099511628211ull;
+            }
+
+            // Every iteration must cull identically
+            if (it > 0 && h != flyChecksum) {
+                std::fprintf(stderr, "mgecull: %s culling is not deterministic\n", fly.name);
+                return false;
+            }
+            flyChecksum = h;
+        }
+        checksum = (checksum ^ flyChecksum) * 1099511628211ull;
+
+        std::printf("  %s, %d frames\n", fly.name, fly.frames);
+        printSamples("statics", statics);
+        printSamples("grass", grass);
+    }
+
+    std::printf("  visible checksum %016llx\n", (unsigned long long)checksum);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    const char* world = "vvardenfell";
+    uint64_t seed = 1;
+    int iterations = 3;
+    float drawDistance = 10.0f;
+    bool valid = true;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            world = argv[++i];
+        } else if (std::strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            seed = std::strtoull(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            iterations = std::max(1, std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            drawDistance = std::max(1.0f, float(std::atof(argv[++i])));
+        } else {
+            valid = false;
+        }
+    }
+
+    bool all = std::strcmp(world, "all") == 0, found = false;
+    for (const WorldProfile& profile : worldProfiles) {
+        found |= all || std::strcmp(world, profile.name) == 0;
+    }
+    if (!valid || !found) {
+        std::fprintf(stderr, "Usage: mgecull [-w vvardenfell|mainland|interior|all] [-s seed] [-n iterations] [-d draw distance]\n");
+        return 2;
+    }
+
+    HighResolutionTimer::init();
+
+    for (const WorldProfile& profile : worldProfiles) {
+        if (all || std::strcmp(world, profile.name) == 0) {
+            if (!runWorldspace(profile, seed, iterations, drawDistance)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
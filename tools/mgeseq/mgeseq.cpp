@@ -0,0 +1,29 @@
+// mgeseq - Encodes a frame sequence file captured by MGE XE into numbered PNG files,
+// with a CSV of frame timestamps alongside. Portable, so captures can be processed on any machine.
+//
+// Usage: mgeseq <sequence file> [output prefix]
+// The output prefix defaults to the sequence file path without its extension.
+
+#include "seqconvert.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argc > 3) {
+        std::fprintf(stderr, "Usage: mgeseq <sequence file> [output prefix]\n");
+        return 2;
+    }
+
+    std::string prefix = argc > 2 ? argv[2] : outputPrefix(argv[1]);
+    uint32_t frames;
+    int result = convertSequence(argv[1], prefix, stderr, &frames);
+
+    if (frames) {
+        std::printf("mgeseq: %u frames written to %s *.png\n", frames, prefix.c_str());
+    }
+    return result;
+}
@@ -0,0 +1,105 @@
+
+#include "seqconvert.h"
+#include "support/pngencode.h"
+#include "support/sequencefile.h"
+
+#include <vector>
+
+
+
+// outputPrefix - Sequence file path without its extension
+std::string outputPrefix(const char* path) {
+    std::string prefix = path;
+    size_t dot = prefix.find_last_of('.'), sep = prefix.find_last_of("/\\");
+    if (dot != std::string::npos && (sep == std::string::npos || dot > sep)) {
+        prefix.erase(dot);
+    }
+    return prefix;
+}
+
+// writeFile - Write a whole file, replacing any existing file
+static bool writeFile(const std::string& path, const std::vector<uint8_t>& data) {
+    FILE* f = std::fopen(path.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+    bool success = std::fwrite(data.data(), 1, data.size(), f) == data.size();
+    return std::fclose(f) == 0 && success;
+}
+
+// convertSequence - Encode each frame of a sequence file to "<prefix> <index>.png", with "<prefix> timestamps.csv"
+int convertSequence(const char* path, const std::string& prefix, FILE* err, uint32_t* framesConverted) {
+    SequenceReader reader;
+    *framesConverted = 0;
+
+    switch (reader.open(path)) {
+    case SequenceReader::Ok:
+        break;
+    case SequenceReader::CannotOpen:
+        std::fprintf(err, "mgeseq: cannot open %s\n", path);
+        return 1;
+    case SequenceReader::NotSequence:
+        std::fprintf(err, "mgeseq: %s is not a frame sequence file\n", path);
+        return 1;
+    case SequenceReader::UnsupportedVersion:
+        std::fprintf(err, "mgeseq: %s has unsupported version %u\n", path, reader.header().version);
+        return 1;
+    case SequenceReader::NoFrames:
+        std::fprintf(err, "mgeseq: %s contains no frames\n", path);
+        return 1;
+    }
+
+    const SequenceFileHeader& header = reader.header();
+    if (!reader.closedCleanly()) {
+        std::fprintf(err, "mgeseq: %s was not closed cleanly, reading frames until end of file\n", path);
+    }
+
+    std::string csvPath = prefix + " timestamps.csv";
+    FILE* csv = std::fopen(csvPath.c_str(), "w");
+    if (!csv) {
+        std::fprintf(err, "mgeseq: cannot create %s\n", csvPath.c_str());
+        return 1;
+    }
+    std::fprintf(csv, "frame,microseconds\n");
+
+    std::vector<uint8_t> pixels, png;
+    uint32_t frames = 0;
+    int result = 0;
+
+    for (;;) {
+        SequenceFrameHeader frame;
+        SequenceReader::FrameStatus status = reader.next(frame, pixels);
+        if (status == SequenceReader::End) {
+            break;
+        }
+        if (status == SequenceReader::Truncated) {
+            std::fprintf(err, "mgeseq: frame %u is truncated\n", frame.index);
+            result = 1;
+            break;
+        }
+
+        char suffix[32];
+        std::snprintf(suffix, sizeof(suffix), " %05u.png", frame.index);
+        std::string pngPath = prefix + suffix;
+
+        if (!pngEncodeBGRA(pixels.data(), header.width, header.height, header.width * 4, png) || !writeFile(pngPath, png)) {
+            std::fprintf(err, "mgeseq: cannot write %s\n", pngPath.c_str());
+            result = 1;
+            break;
+        }
+        std::fprintf(csv, "%u,%lld\n", frame.index, (long long)frame.timestamp);
+        ++frames;
+    }
+
+    if (result == 0 && reader.closedCleanly() && frames != header.frameCount) {
+        std::fprintf(err, "mgeseq: expected %u frames, found %u\n", header.frameCount, frames);
+        result = 1;
+    }
+
+    if (std::fclose(csv) != 0) {
+        std::fprintf(err, "mgeseq: cannot write %s\n", csvPath.c_str());
+        result = 1;
+    }
+    *framesConverted = frames;
+    return result;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// outputPrefix - Sequence file path without its extension
+std::string outputPrefix(const char* path);
+
+// convertSequence - Encode each frame of a sequence file to "<prefix> <index>.png", with "<prefix> timestamps.csv"
+// Problems are reported to err. Returns 0 on success, or 1 if the file could not be fully converted.
+int convertSequence(const char* path, const std::string& prefix, FILE* err, uint32_t* framesConverted);
@@ -0,0 +1,347 @@
+
+// mgetrace - Replays a D3D8 call trace recorded by MGE XE through the proxy device's forwarding rules
+// into a null device, measuring the CPU cost of the proxy layer. Portable, so that proxy overhead can be
+// measured and compared between builds on any machine.
+//
+// Usage: mgetrace <trace file> [-n iterations] [-d]
+//   -n  Replay the whole trace this many times, default 20
+//   -d  Emulate distant land being active, adding the fog overrides and state invalidations it causes
+//
+// Reports per-frame replay time percentiles, the calls reaching the null device, and a checksum of
+// those calls. The checksum only changes if forwarding behaviour changes, so it can be compared across builds.
+
+#include "mge/proxystate.h"
+#include "support/calltrace.h"
+#include "support/profilestats.h"
+#include "support/timing.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+
+
+// --------------------------------------------------------
+// Device interface, the subset of IDirect3DDevice9 the proxy forwards to
+// Virtual so that replay pays for an indirect call per forwarded call, as the proxy does
+
+class ReplayDevice {
+public:
+    virtual ~ReplayDevice() {}
+    virtual void Present() = 0;
+    virtual void BeginScene() = 0;
+    virtual void EndScene() = 0;
+    virtual void Clear(uint32_t count, const void* rects, uint32_t flags, uint32_t colour, float z, uint32_t stencil) = 0;
+    virtual void SetRenderTarget(uint32_t surface, uint32_t depth) = 0;
+    virtual void SetTransform(uint32_t state, const float* m) = 0;
+    virtual void MultiplyTransform(uint32_t state, const float* m) = 0;
+    virtual void SetMaterial(const ProxyState::Material* m) = 0;
+    virtual void SetLight(uint32_t index, const ProxyState::Light* light) = 0;
+    virtual void LightEnable(uint32_t index, uint32_t enable) = 0;
+    virtual void SetRenderState(uint32_t state, uint32_t value) = 0;
+    virtual void SetTextureStageState(uint32_t stage, uint32_t state, uint32_t value) = 0;
+    virtual void SetSamplerState(uint32_t sampler, uint32_t state, uint32_t value) = 0;
+    virtual void SetTexture(uint32_t stage, uint32_t texture) = 0;
+    virtual void SetFVF(uint32_t fvf) = 0;
+    virtual void SetStreamSource(uint32_t stream, uint32_t vb, uint32_t offset, uint32_t stride) = 0;
+    virtual void SetIndices(uint32_t ib) = 0;
+    virtual void DrawIndexedPrimitive(uint32_t type, int32_t baseVertex, uint32_t minIndex, uint32_t vertexCount, uint32_t startIndex, uint32_t primCount) = 0;
+    virtual void ApplyStateBlock(uint32_t token) = 0;
+    virtual void CreateResource(CallOp op, uint32_t id, uint32_t size) = 0;
+};
+
+// Null device, accepts everything and keeps a call count and a running checksum of the calls
+class NullDevice : public ReplayDevice {
+public:
+    uint64_t calls = 0, draws = 0, primitives = 0, resources = 0, resourceBytes = 0;
+    uint64_t checksum = 14695981039346656037ull;
+
+    void Present() override { mix(1); }
+    void BeginScene() override { mix(2); }
+    void EndScene() override { mix(3); }
+    void Clear(uint32_t count, const void*, uint32_t flags, uint32_t colour, float z, uint32_t stencil) override {
+        mix(4, count, flags, colour, bits(z), stencil);
+    }
+    void SetRenderTarget(uint32_t surface, uint32_t depth) override { mix(5, surface, depth); }
+    void SetTransform(uint32_t state, const float* m) override { mix(6, state); mixBytes(m, 64); }
+    void MultiplyTransform(uint32_t state, const float* m) override { mix(7, state); mixBytes(m, 64); }
+    void SetMaterial(const ProxyState::Material* m) override { mix(8); mixBytes(m, sizeof(*m)); }
+    void SetLight(uint32_t index, const ProxyState::Light* light) override { mix(9, index); mixBytes(light, sizeof(*light)); }
+    void LightEnable(uint32_t index, uint32_t enable) override { mix(10, index, enable); }
+    void SetRenderState(uint32_t state, uint32_t value) override { mix(11, state, value); }
+    void SetTextureStageState(uint32_t stage, uint32_t state, uint32_t value) override { mix(12, stage, state, value); }
+    void SetSamplerState(uint32_t sampler, uint32_t state, uint32_t value) override { mix(13, sampler, state, value); }
+    void SetTexture(uint32_t stage, uint32_t texture) override { mix(14, stage, texture); }
+    void SetFVF(uint32_t fvf) override { mix(15, fvf); }
+    void SetStreamSource(uint32_t stream, uint32_t vb, uint32_t offset, uint32_t stride) override { mix(16, stream, vb, offset, stride); }
+    void SetIndices(uint32_t ib) override { mix(17, ib); }
+    void DrawIndexedPrimitive(uint32_t type, int32_t baseVertex, uint32_t minIndex, uint32_t vertexCount, uint32_t startIndex, uint32_t primCount) override {
+        mix(18, type, uint32_t(baseVertex), minIndex, vertexCount, startIndex, primCount);
+        ++draws;
+        primitives += primCount;
+    }
+    void ApplyStateBlock(uint32_t token) override { mix(19, token); }
+    void CreateResource(CallOp, uint32_t, uint32_t size) override {
+        // Resource creation happens once per trace replay and is not part of the checksum
+        ++resources;
+        resourceBytes += size;
+    }
+
+private:
+    static uint32_t bits(float f) {
+        uint32_t x;
+        std::memcpy(&x, &f, sizeof(x));
+        return x;
+    }
+
+    // FNV-1a over 32-bit words
+    void mix(uint32_t method, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0, uint32_t d = 0, uint32_t e = 0, uint32_t f = 0) {
+        const uint32_t words[] = { method, a, b, c, d, e, f };
+        for (uint32_t w : words) {
+            checksum = (checksum ^ w) * 1099511628211ull;
+        }
+        ++calls;
+    }
+
+    void mixBytes(const void* p, size_t n) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(p);
+        for (size_t i = 0; i != n; ++i) {
+            checksum = (checksum ^ bytes[i]) * 1099511628211ull;
+        }
+    }
+};
+
+// --------------------------------------------------------
+// Proxy replay
+// Runs the trace through the same forwarding rules and state capture as MGEProxyDevice (see mge/proxystate.h),
+// and the ProxyDevice layer below it. Work done inside DistantLand needs the game and is not replayed,
+// the default hooks only stand in for it.
+
+class ReplayProxy {
+public:
+    ProxyState state;
+
+    ReplayProxy(ReplayDevice* device, bool distantLand) : state(&hooks), device(device) {
+        // With distant land emulated, fog is overridden and water is replaced, and anisotropic filtering is set
+        // as in a typical configuration
+        state.distantLandReady = state.distantLandFog = state.distantWaterEnabled = distantLand;
+        state.scaleFilter = D3DTEXF_ANISOTROPIC;
+        state.hudReady = true;
+        baseVertexIndex = 0;
+    }
+
+    void dispatch(const CallRecord& r) {
+        switch (r.op) {
+        case CallOp::Present:
+            state.present();
+            device->Present();
+            break;
+        case CallOp::BeginScene:
+            device->BeginScene();
+            state.beginScene();
+            break;
+        case CallOp::EndScene:
+            state.endScene();
+            device->EndScene();
+            break;
+        case CallOp::Clear:
+            device->Clear(r.dataSize / 16, r.data, r.arg(0), r.arg(1), r.argFloat(2), r.arg(3));
+            break;
+        case CallOp::SetRenderTarget:
+            if (r.arg(0)) {
+                state.setRenderTarget(r.arg(2) != 0);
+            }
+            device->SetRenderTarget(r.arg(0), r.arg(1));
+            break;
+        case CallOp::SetTransform:
+            if (r.dataSize == 64 && state.setTransform(r.arg(0), reinterpret_cast<const float*>(r.data))) {
+                device->SetTransform(r.arg(0), reinterpret_cast<const float*>(r.data));
+            }
+            break;
+        case CallOp::MultiplyTransform:
+            if (r.dataSize == 64) {
+                state.multiplyTransform();
+                device->MultiplyTransform(r.arg(0), reinterpret_cast<const float*>(r.data));
+            }
+            break;
+        case CallOp::SetMaterial:
+            if (r.dataSize == sizeof(ProxyState::Material)) {
+                state.setMaterial(reinterpret_cast<const ProxyState::Material*>(r.data));
+                device->SetMaterial(reinterpret_cast<const ProxyState::Material*>(r.data));
+            }
+            break;
+        case CallOp::SetLight:
+            if (r.dataSize == sizeof(ProxyState::Light)) {
+                state.setLight(r.arg(0), reinterpret_cast<const ProxyState::Light*>(r.data));
+                device->SetLight(r.arg(0), reinterpret_cast<const ProxyState::Light*>(r.data));
+            }
+            break;
+        case CallOp::LightEnable:
+            state.lightEnable(r.arg(0), r.arg(1) != 0);
+            device->LightEnable(r.arg(0), r.arg(1));
+            break;
+        case CallOp::SetRenderState:
+            if (state.setRenderState(r.arg(0), r.arg(1))) {
+                device->SetRenderState(r.arg(0), r.arg(1));
+            }
+            break;
+        case CallOp::SetTextureStageState: {
+            uint32_t value = r.arg(2), sampler;
+            if (state.setTextureStageState(r.arg(0), r.arg(1), value, sampler)) {
+                if (sampler) {
+                    device->SetSamplerState(r.arg(0), sampler, value);
+                } else {
+                    device->SetTextureStageState(r.arg(0), r.arg(1), value);
+                }
+            }
+            break;
+        }
+        case CallOp::SetTexture:
+            // Trace IDs stand in for texture pointers, both are unique per live texture
+            if (state.setTexture(r.arg(0), reinterpret_cast<IDirect3DTexture9*>(uintptr_t(r.arg(1))))) {
+                device->SetTexture(r.arg(0), r.arg(1));
+            }
+            break;
+        case CallOp::SetVertexShader:
+            state.setFVF(r.arg(0));
+            device->SetFVF(r.arg(0));
+            break;
+        case CallOp::SetStreamSource:
+            state.setStreamSource(r.arg(0), reinterpret_cast<IDirect3DVertexBuffer9*>(uintptr_t(r.arg(1))), r.arg(2));
+            device->SetStreamSource(r.arg(0), r.arg(1), 0, r.arg(2));
+            break;
+        case CallOp::SetIndices:
+            state.setIndices(reinterpret_cast<IDirect3DIndexBuffer9*>(uintptr_t(r.arg(0))));
+            baseVertexIndex = r.arg(1);
+            device->SetIndices(r.arg(0));
+            break;
+        case CallOp::DrawIndexedPrimitive:
+            if (state.drawIndexedPrimitive(r.arg(0), baseVertexIndex, r.arg(1), r.arg(2), r.arg(3), r.arg(4))) {
+                device->DrawIndexedPrimitive(r.arg(0), int32_t(baseVertexIndex), r.arg(1), r.arg(2), r.arg(3), r.arg(4));
+            }
+            break;
+        case CallOp::ApplyStateBlock:
+            state.applyStateBlock();
+            device->ApplyStateBlock(r.arg(0));
+            break;
+        case CallOp::DefineVertexBuffer:
+        case CallOp::DefineIndexBuffer:
+            device->CreateResource(r.op, r.arg(0), r.arg(1));
+            break;
+        case CallOp::DefineTexture:
+            device->CreateResource(r.op, r.arg(0), r.arg(1) * r.arg(2) * 4);
+            break;
+        default:
+            break;
+        }
+    }
+
+private:
+    static const uint32_t D3DTEXF_ANISOTROPIC = 3;
+
+    ProxyState::Hooks hooks;
+    ReplayDevice* device;
+    uint32_t baseVertexIndex;
+};
+
+// --------------------------------------------------------
+
+int main(int argc, char** argv) {
+    const char* path = nullptr;
+    int iterations = 20;
+    bool distantLand = false;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            iterations = std::max(1, std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "-d") == 0) {
+            distantLand = true;
+        } else if (!path && argv[i][0] != '-') {
+            path = argv[i];
+        } else {
+            path = nullptr;
+            break;
+        }
+    }
+    if (!path) {
+        std::fprintf(stderr, "Usage: mgetrace <trace file> [-n iterations] [-d]\n");
+        return 2;
+    }
+
+    CallTraceReader reader;
+    if (!reader.open(path)) {
+        std::fprintf(stderr, "mgetrace: %s is not a readable call trace\n", path);
+        return 1;
+    }
+    if (reader.header().frameCount == 0) {
+        std::fprintf(stderr, "mgetrace: %s was not closed cleanly, replaying records until end of file\n", path);
+    }
+
+    HighResolutionTimer::init();
+
+    RollingStats traceStats;
+    std::vector<float> frameTimes;
+    uint64_t checksum = 0, forwarded = 0, dropped = 0, swallowed = 0, deviceCalls = 0, draws = 0;
+    uint32_t records = 0, frames = 0;
+
+    for (int it = 0; it != iterations; ++it) {
+        NullDevice device;
+        ReplayProxy proxy(&device, distantLand);
+        CallRecord r;
+
+        reader.rewind();
+        records = frames = 0;
+
+        int64_t traceStart = HighResolutionTimer::getTicks(), frameStart = traceStart;
+        while (reader.next(r)) {
+            proxy.dispatch(r);
+            ++records;
+
+            if (r.op == CallOp::Present) {
+                int64_t now = HighResolutionTimer::getTicks();
+                frameTimes.push_back(HighResolutionTimer::ticksToMicroseconds(now - frameStart));
+                frameStart = now;
+                ++frames;
+            }
+        }
+        traceStats.add(HighResolutionTimer::ticksToMicroseconds(HighResolutionTimer::getTicks() - traceStart));
+
+        // Every iteration must forward identically
+        if (it > 0 && device.checksum != checksum) {
+            std::fprintf(stderr, "mgetrace: replay is not deterministic\n");
+            return 1;
+        }
+        checksum = device.checksum;
+        forwarded = proxy.state.stateFilter.forwarded;
+        dropped = proxy.state.stateFilter.dropped;
+        swallowed = proxy.state.swallowed;
+        deviceCalls = device.calls;
+        draws = device.draws;
+    }
+
+    if (reader.truncated()) {
+        std::fprintf(stderr, "mgetrace: %s is truncated after %u records\n", path, records);
+    }
+
+    // Percentiles over all frames of all iterations
+    std::sort(frameTimes.begin(), frameTimes.end());
+    auto percentile = [&frameTimes](double p) {
+        if (frameTimes.empty()) {
+            return 0.0f;
+        }
+        size_t rank = size_t(std::ceil(p * frameTimes.size()));
+        return frameTimes[std::min(frameTimes.size(), std::max<size_t>(rank, 1)) - 1];
+    };
+    auto trace = traceStats.summarise();
+
+    std::printf("mgetrace: %s, %u frames, %u records, %d iterations%s\n", path, frames, records, iterations, distantLand ? ", distant land" : "");
+    std::printf("  frame us     p50 %8.2f  p90 %8.2f  p99 %8.2f  max %8.2f\n", percentile(0.5), percentile(0.9), percentile(0.99), percentile(1.0));
+    std::printf("  trace us     min %8.0f  avg %8.0f  max %8.0f\n", trace.min, trace.avg, trace.max);
+    std::printf("  state filter %llu forwarded, %llu dropped, %llu swallowed\n", (unsigned long long)forwarded, (unsigned long long)dropped, (unsigned long long)swallowed);
+    std::printf("  null device  %llu calls, %llu draws, checksum %016llx\n", (unsigned long long)deviceCalls, (unsigned long long)draws, (unsigned long long)checksum);
+    return reader.truncated() ? 1 : 0;
+}